@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -17,11 +18,16 @@
 #include "backend/backend.h"
 #include "backend/multi.h"
 #include "render/allocator/allocator.h"
+#include "types/wlr_output.h"
+#include "util/log.h"
 #include "util/signal.h"
 
 #if WLR_HAS_DRM_BACKEND
+#include <pthread.h>
 #include <wlr/backend/drm.h>
+#include "backend/drm/drm.h"
 #include "backend/drm/monitor.h"
+#include "render/wlr_renderer.h"
 #endif
 
 #if WLR_HAS_LIBINPUT_BACKEND
@@ -80,6 +86,7 @@ static uint64_t get_current_time_ms(void) {
 }
 
 static struct wlr_session *session_create_and_wait(struct wl_display *disp) {
+	uint64_t created_at = get_current_time_ms();
 	struct wlr_session *session = wlr_session_create(disp);
 
 	if (!session) {
@@ -116,6 +123,8 @@ static struct wlr_session *session_create_and_wait(struct wl_display *disp) {
 		}
 	}
 
+	wlr_log(WLR_INFO, "Session ready in %" PRIu64 " ms",
+		get_current_time_ms() - created_at);
 	return session;
 }
 
@@ -141,6 +150,155 @@ uint32_t backend_get_buffer_caps(struct wlr_backend *backend) {
 	return backend->impl->get_buffer_caps(backend);
 }
 
+static bool backend_commit_group(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len,
+		bool test) {
+	struct output_commit *commits = calloc(states_len, sizeof(*commits));
+	struct wlr_backend_output_state *pending =
+		calloc(states_len, sizeof(*pending));
+	if (commits == NULL || pending == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		free(commits);
+		free(pending);
+		return false;
+	}
+
+	size_t prepared_len = 0;
+	bool ok = true;
+	for (size_t i = 0; i < states_len; i++) {
+		if (!output_commit_prepare(&commits[i], states[i].output,
+				&states[i].base, test)) {
+			ok = false;
+			break;
+		}
+		prepared_len++;
+		pending[i] = (struct wlr_backend_output_state){
+			.output = states[i].output,
+			.base = commits[i].pending,
+		};
+	}
+
+	if (ok) {
+		if (test) {
+			ok = backend->impl->test(backend, pending, states_len);
+		} else {
+			ok = backend->impl->commit(backend, pending, states_len);
+		}
+	}
+
+	for (size_t i = 0; i < prepared_len; i++) {
+		output_commit_finish(&commits[i], ok);
+	}
+
+	free(commits);
+	free(pending);
+	return ok;
+}
+
+struct backend_contains_data {
+	struct wlr_backend *child;
+	bool found;
+};
+
+static bool backend_contains(struct wlr_backend *backend,
+	struct wlr_backend *child);
+
+static void backend_contains_iterator(struct wlr_backend *backend,
+		void *data) {
+	struct backend_contains_data *contains_data = data;
+	contains_data->found = contains_data->found ||
+		backend_contains(backend, contains_data->child);
+}
+
+// Check whether child is backend itself or one of its sub-backends
+static bool backend_contains(struct wlr_backend *backend,
+		struct wlr_backend *child) {
+	if (backend == child) {
+		return true;
+	}
+	if (!wlr_backend_is_multi(backend)) {
+		return false;
+	}
+
+	struct backend_contains_data data = { .child = child };
+	wlr_multi_for_each_backend(backend, backend_contains_iterator, &data);
+	return data.found;
+}
+
+static bool backend_commit_states(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len,
+		bool test) {
+	for (size_t i = 0; i < states_len; i++) {
+		if (!backend_contains(backend, states[i].output->backend)) {
+			wlr_log(WLR_ERROR, "Output %s doesn't belong to the backend "
+				"of a multi-output commit", states[i].output->name);
+			return false;
+		}
+		for (size_t j = i + 1; j < states_len; j++) {
+			if (states[i].output == states[j].output) {
+				wlr_log(WLR_ERROR, "Output %s appears more than once "
+					"in a multi-output commit", states[i].output->name);
+				return false;
+			}
+		}
+	}
+
+	struct wlr_backend_output_state *group =
+		calloc(states_len, sizeof(*group));
+	bool *done = calloc(states_len, sizeof(*done));
+	if (group == NULL || done == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		free(group);
+		free(done);
+		return false;
+	}
+
+	// Outputs of a backend supporting multi-output commits are handled in
+	// one go, the others one by one
+	bool ok = true;
+	for (size_t i = 0; i < states_len && ok; i++) {
+		if (done[i]) {
+			continue;
+		}
+
+		struct wlr_backend *output_backend = states[i].output->backend;
+		bool supported = test ? output_backend->impl->test != NULL :
+			output_backend->impl->commit != NULL;
+		if (!supported) {
+			if (test) {
+				ok = wlr_output_test_state(states[i].output, &states[i].base);
+			} else {
+				ok = wlr_output_commit_state(states[i].output, &states[i].base);
+			}
+			done[i] = true;
+			continue;
+		}
+
+		size_t group_len = 0;
+		for (size_t j = i; j < states_len; j++) {
+			if (!done[j] && states[j].output->backend == output_backend) {
+				group[group_len++] = states[j];
+				done[j] = true;
+			}
+		}
+		ok = backend_commit_group(output_backend, group, group_len, test);
+	}
+
+	free(group);
+	free(done);
+	return ok;
+}
+
+bool wlr_backend_test(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len) {
+	return backend_commit_states(backend, states, states_len, true);
+}
+
+bool wlr_backend_commit(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len) {
+	return backend_commit_states(backend, states, states_len, false);
+}
+
 static size_t parse_outputs_env(const char *name) {
 	const char *outputs_str = getenv(name);
 	if (outputs_str == NULL) {
@@ -204,8 +362,30 @@ static struct wlr_backend *attempt_headless_backend(
 }
 
 #if WLR_HAS_DRM_BACKEND
+struct mgpu_renderer_job {
+	int drm_fd;
+	pthread_t thread;
+	bool started;
+	struct wlr_renderer *renderer;
+	uint64_t duration_ms;
+	// Replayed on the main thread, the log callback may not be thread-safe
+	struct log_capture log;
+};
+
+static void *mgpu_renderer_job_run(void *data) {
+	struct mgpu_renderer_job *job = data;
+	log_capture_begin(&job->log);
+	uint64_t started_at = get_current_time_ms();
+	job->renderer = renderer_autocreate_with_drm_fd(job->drm_fd);
+	job->duration_ms = get_current_time_ms() - started_at;
+	log_capture_end();
+	return NULL;
+}
+
 static struct wlr_backend *attempt_drm_backend(struct wl_display *display,
 		struct wlr_backend *backend, struct wlr_session *session) {
+	uint64_t started_at = get_current_time_ms();
+
 	struct wlr_device *gpus[8];
 	ssize_t num_gpus = wlr_session_find_gpus(session, 8, gpus);
 	if (num_gpus < 0) {
@@ -217,17 +397,46 @@ static struct wlr_backend *attempt_drm_backend(struct wl_display *display,
 		wlr_log(WLR_ERROR, "Found 0 GPUs, cannot create backend");
 		return NULL;
 	} else {
-		wlr_log(WLR_INFO, "Found %zu GPUs", num_gpus);
+		wlr_log(WLR_INFO, "Found %zu GPUs in %" PRIu64 " ms", num_gpus,
+			get_current_time_ms() - started_at);
+	}
+
+	// Secondary GPUs need a renderer for multi-GPU copies. Creating it
+	// (EGL initialization, shader compilation) is the slowest part of the
+	// backend initialization, so do it on worker threads while the DRM
+	// resources are initialized here.
+	struct mgpu_renderer_job jobs[8] = {0};
+	for (size_t i = 1; i < (size_t)num_gpus; ++i) {
+		jobs[i].drm_fd = gpus[i]->fd;
+		jobs[i].started = pthread_create(&jobs[i].thread, NULL,
+			mgpu_renderer_job_run, &jobs[i]) == 0;
+		if (!jobs[i].started) {
+			wlr_log(WLR_DEBUG, "Failed to start renderer thread for GPU %zu, "
+				"creating it on the main thread", i);
+		}
 	}
 
 	struct wlr_backend *primary_drm = NULL;
 	for (size_t i = 0; i < (size_t)num_gpus; ++i) {
-		struct wlr_backend *drm = wlr_drm_backend_create(display, session,
-			gpus[i], primary_drm);
+		uint64_t gpu_started_at = get_current_time_ms();
+
+		struct wlr_renderer *mgpu_renderer = NULL;
+		if (jobs[i].started) {
+			pthread_join(jobs[i].thread, NULL);
+			log_capture_replay(&jobs[i].log);
+			mgpu_renderer = jobs[i].renderer;
+			wlr_log(WLR_DEBUG, "Created multi-GPU renderer for GPU %zu "
+				"in %" PRIu64 " ms", i, jobs[i].duration_ms);
+		}
+
+		struct wlr_backend *drm = drm_backend_create(display, session,
+			gpus[i], primary_drm, mgpu_renderer);
 		if (!drm) {
 			wlr_log(WLR_ERROR, "Failed to create DRM backend");
 			continue;
 		}
+		wlr_log(WLR_DEBUG, "Initialized DRM backend for GPU %zu in %" PRIu64 " ms",
+			i, get_current_time_ms() - gpu_started_at);
 
 		if (!primary_drm) {
 			primary_drm = drm;
@@ -240,6 +449,8 @@ static struct wlr_backend *attempt_drm_backend(struct wl_display *display,
 		return NULL;
 	}
 
+	wlr_log(WLR_INFO, "Initialized DRM backends in %" PRIu64 " ms",
+		get_current_time_ms() - started_at);
 	return primary_drm;
 }
 #endif
@@ -1,12 +1,15 @@
 #define _POSIX_C_SOURCE 200809L
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include "backend/drm/drm.h"
 #include "backend/drm/iface.h"
 #include "backend/drm/util.h"
+#include "util/trace.h"
 
 static char *atomic_commit_flags_str(uint32_t flags) {
 	const char *const l[] = {
@@ -44,12 +47,40 @@ static char *atomic_commit_flags_str(uint32_t flags) {
 }
 
 struct atomic {
+	struct wlr_drm_backend *drm;
 	drmModeAtomicReq *req;
 	bool failed;
+	// Add properties even if they're unchanged
+	bool force;
+	// struct wlr_drm_prop_value, cached once committed
+	struct wl_array values;
 };
 
-static void atomic_begin(struct atomic *atom) {
+/**
+ * Find the cache entry of a property, or the free entry it should be stored
+ * in. Returns NULL if the cache is full.
+ */
+static struct wlr_drm_prop_value *prop_cache_find(
+		struct wlr_drm_backend *drm, uint32_t obj, uint32_t prop) {
+	size_t hash = ((size_t)obj * 2654435761u) ^ prop;
+	for (size_t i = 0; i < WLR_DRM_PROP_CACHE_SIZE; i++) {
+		struct wlr_drm_prop_value *entry =
+			&drm->prop_cache[(hash + i) % WLR_DRM_PROP_CACHE_SIZE];
+		if (entry->obj == 0 || (entry->obj == obj && entry->prop == prop)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+void drm_atomic_prop_cache_invalidate(struct wlr_drm_backend *drm) {
+	memset(drm->prop_cache, 0, sizeof(drm->prop_cache));
+}
+
+static void atomic_begin(struct atomic *atom, struct wlr_drm_backend *drm) {
 	memset(atom, 0, sizeof(*atom));
+	atom->drm = drm;
+	wl_array_init(&atom->values);
 
 	atom->req = drmModeAtomicAlloc();
 	if (!atom->req) {
@@ -59,18 +90,25 @@ static void atomic_begin(struct atomic *atom) {
 	}
 }
 
-static bool atomic_commit(struct atomic *atom,
+static bool atomic_commit(struct atomic *atom, struct wlr_drm_backend *drm,
 		struct wlr_drm_connector *conn, uint32_t flags) {
-	struct wlr_drm_backend *drm = conn->backend;
 	if (atom->failed) {
 		return false;
 	}
 
+	trace_begin("drmModeAtomicCommit %s%s",
+		conn != NULL ? conn->name : drm->name,
+		(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? " (test)" : "");
 	int ret = drmModeAtomicCommit(drm->fd, atom->req, flags, drm);
+	trace_end();
 	if (ret != 0) {
-		wlr_drm_conn_log_errno(conn,
-			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? WLR_DEBUG : WLR_ERROR,
-			"Atomic commit failed");
+		enum wlr_log_importance verbosity =
+			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? WLR_DEBUG : WLR_ERROR;
+		if (conn != NULL) {
+			wlr_drm_conn_log_errno(conn, verbosity, "Atomic commit failed");
+		} else {
+			wlr_log_errno(verbosity, "%s: Atomic commit failed", drm->name);
+		}
 		char *flags_str = atomic_commit_flags_str(flags);
 		wlr_log(WLR_DEBUG, "(Atomic commit flags: %s)",
 			flags_str ? flags_str : "<error>");
@@ -78,44 +116,186 @@ static bool atomic_commit(struct atomic *atom,
 		return false;
 	}
 
+	if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+		const struct wlr_drm_prop_value *value;
+		wl_array_for_each(value, &atom->values) {
+			struct wlr_drm_prop_value *entry =
+				prop_cache_find(drm, value->obj, value->prop);
+			if (entry != NULL) {
+				*entry = *value;
+			}
+		}
+	}
+
 	return true;
 }
 
 static void atomic_finish(struct atomic *atom) {
 	drmModeAtomicFree(atom->req);
+	wl_array_release(&atom->values);
 }
 
-static void atomic_add(struct atomic *atom, uint32_t id, uint32_t prop, uint64_t val) {
+/**
+ * Add a property which only applies to this commit, e.g. FB_DAMAGE_CLIPS or
+ * IN_FENCE_FD.
+ */
+static void atomic_add_volatile(struct atomic *atom, uint32_t id,
+		uint32_t prop, uint64_t val) {
 	if (!atom->failed && drmModeAtomicAddProperty(atom->req, id, prop, val) < 0) {
 		wlr_log_errno(WLR_ERROR, "Failed to add atomic DRM property");
 		atom->failed = true;
 	}
 }
 
+// Add a property, unless the kernel already has the same value
+static void atomic_add(struct atomic *atom, uint32_t id, uint32_t prop, uint64_t val) {
+	if (atom->failed) {
+		return;
+	}
+	if (!atom->force) {
+		const struct wlr_drm_prop_value *entry =
+			prop_cache_find(atom->drm, id, prop);
+		if (entry != NULL && entry->obj != 0 && entry->value == val) {
+			return;
+		}
+	}
+
+	struct wlr_drm_prop_value *value =
+		wl_array_add(&atom->values, sizeof(*value));
+	if (value == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		atom->failed = true;
+		return;
+	}
+	*value = (struct wlr_drm_prop_value){
+		.obj = id,
+		.prop = prop,
+		.value = val,
+	};
+	atomic_add_volatile(atom, id, prop, val);
+}
+
+static uint64_t blob_hash(const void *data, size_t size) {
+	// FNV-1a
+	const uint8_t *bytes = data;
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+/**
+ * Look up a blob created from the same contents, so that committing the same
+ * mode or gamma LUT again doesn't need new blobs.
+ */
+static uint32_t blob_cache_lookup(struct wlr_drm_blob_cache *cache,
+		const void *key, size_t key_size, uint64_t hash) {
+	for (size_t i = 0; i < WLR_DRM_BLOB_CACHE_SIZE; i++) {
+		struct wlr_drm_blob *blob = &cache->blobs[i];
+		if (blob->id != 0 && blob->hash == hash &&
+				blob->key_size == key_size &&
+				memcmp(blob->key, key, key_size) == 0) {
+			blob->last_used = ++cache->counter;
+			return blob->id;
+		}
+	}
+	return 0;
+}
+
+static void blob_cache_insert(struct wlr_drm_backend *drm,
+		struct wlr_drm_blob_cache *cache, uint32_t in_use,
+		const void *key, size_t key_size, uint64_t hash, uint32_t blob_id) {
+	void *key_copy = malloc(key_size);
+	if (key_copy == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	memcpy(key_copy, key, key_size);
+
+	// Evict the least recently used blob, but never the one in use: it'll
+	// likely be committed again when the new one is rolled back
+	struct wlr_drm_blob *lru = NULL;
+	for (size_t i = 0; i < WLR_DRM_BLOB_CACHE_SIZE; i++) {
+		struct wlr_drm_blob *blob = &cache->blobs[i];
+		if (blob->id == 0) {
+			lru = blob;
+			break;
+		}
+		if (blob->id != in_use &&
+				(lru == NULL || blob->last_used < lru->last_used)) {
+			lru = blob;
+		}
+	}
+	assert(lru != NULL);
+
+	// The kernel keeps blobs alive as long as they're part of the KMS state
+	if (lru->id != 0) {
+		drmModeDestroyPropertyBlob(drm->fd, lru->id);
+	}
+	free(lru->key);
+
+	lru->id = blob_id;
+	lru->hash = hash;
+	lru->key = key_copy;
+	lru->key_size = key_size;
+	lru->last_used = ++cache->counter;
+}
+
+void drm_atomic_blob_cache_finish(struct wlr_drm_backend *drm,
+		struct wlr_drm_blob_cache *cache) {
+	for (size_t i = 0; i < WLR_DRM_BLOB_CACHE_SIZE; i++) {
+		struct wlr_drm_blob *blob = &cache->blobs[i];
+		if (blob->id != 0) {
+			drmModeDestroyPropertyBlob(drm->fd, blob->id);
+		}
+		free(blob->key);
+	}
+	memset(cache, 0, sizeof(*cache));
+}
+
 static bool create_mode_blob(struct wlr_drm_backend *drm,
-		struct wlr_drm_connector *conn,
+		struct wlr_drm_crtc *crtc,
 		const struct wlr_drm_connector_state *state, uint32_t *blob_id) {
 	if (!state->active) {
 		*blob_id = 0;
 		return true;
 	}
 
+	uint64_t hash = blob_hash(&state->mode, sizeof(state->mode));
+	*blob_id = blob_cache_lookup(&crtc->mode_blobs,
+		&state->mode, sizeof(state->mode), hash);
+	if (*blob_id != 0) {
+		return true;
+	}
+
 	if (drmModeCreatePropertyBlob(drm->fd, &state->mode,
 			sizeof(drmModeModeInfo), blob_id)) {
 		wlr_log_errno(WLR_ERROR, "Unable to create mode property blob");
 		return false;
 	}
 
+	blob_cache_insert(drm, &crtc->mode_blobs, crtc->mode_id,
+		&state->mode, sizeof(state->mode), hash, *blob_id);
 	return true;
 }
 
 static bool create_gamma_lut_blob(struct wlr_drm_backend *drm,
-		size_t size, const uint16_t *lut, uint32_t *blob_id) {
+		struct wlr_drm_crtc *crtc, size_t size, const uint16_t *lut,
+		uint32_t *blob_id) {
 	if (size == 0) {
 		*blob_id = 0;
 		return true;
 	}
 
+	size_t lut_size = 3 * size * sizeof(lut[0]);
+	uint64_t hash = blob_hash(lut, lut_size);
+	*blob_id = blob_cache_lookup(&crtc->gamma_lut_blobs, lut, lut_size, hash);
+	if (*blob_id != 0) {
+		return true;
+	}
+
 	struct drm_color_lut *gamma = malloc(size * sizeof(struct drm_color_lut));
 	if (gamma == NULL) {
 		wlr_log(WLR_ERROR, "Failed to allocate gamma table");
@@ -139,35 +319,64 @@ static bool create_gamma_lut_blob(struct wlr_drm_backend *drm,
 	}
 	free(gamma);
 
+	blob_cache_insert(drm, &crtc->gamma_lut_blobs, crtc->gamma_lut,
+		lut, lut_size, hash, *blob_id);
 	return true;
 }
 
-static void commit_blob(struct wlr_drm_backend *drm,
-		uint32_t *current, uint32_t next) {
-	if (*current == next) {
-		return;
+static void plane_disable(struct atomic *atom, struct wlr_drm_plane *plane) {
+	uint32_t id = plane->id;
+	const union wlr_drm_plane_props *props = &plane->props;
+	atomic_add(atom, id, props->fb_id, 0);
+	atomic_add(atom, id, props->crtc_id, 0);
+}
+
+static uint64_t drm_rotation_from_transform(
+		enum wl_output_transform transform) {
+	// Both rotate counter-clockwise, flipped transforms reflect first
+	uint64_t rotation = 0;
+	switch (transform & ~WL_OUTPUT_TRANSFORM_FLIPPED) {
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+		rotation = DRM_MODE_ROTATE_0;
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		rotation = DRM_MODE_ROTATE_90;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		rotation = DRM_MODE_ROTATE_180;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		rotation = DRM_MODE_ROTATE_270;
+		break;
 	}
-	if (*current != 0) {
-		drmModeDestroyPropertyBlob(drm->fd, *current);
+	if (transform & WL_OUTPUT_TRANSFORM_FLIPPED) {
+		rotation |= DRM_MODE_REFLECT_X;
 	}
-	*current = next;
+	return rotation;
 }
 
-static void rollback_blob(struct wlr_drm_backend *drm,
-		uint32_t *current, uint32_t next) {
-	if (*current == next) {
-		return;
-	}
-	if (next != 0) {
-		drmModeDestroyPropertyBlob(drm->fd, next);
+// BACKGROUND_COLOR has 16 bits per channel, in the ARGB order
+static uint64_t convert_background_color(const float color[static 4]) {
+	uint64_t argb = 0xFFFF;
+	for (size_t i = 0; i < 3; i++) {
+		float c = color[i] < 0 ? 0 : color[i] > 1 ? 1 : color[i];
+		argb = (argb << 16) | (uint64_t)(c * 0xFFFF + 0.5f);
 	}
+	return argb;
 }
 
-static void plane_disable(struct atomic *atom, struct wlr_drm_plane *plane) {
-	uint32_t id = plane->id;
-	const union wlr_drm_plane_props *props = &plane->props;
-	atomic_add(atom, id, props->fb_id, 0);
-	atomic_add(atom, id, props->crtc_id, 0);
+static uint64_t convert_content_type(enum wlr_output_content_type type) {
+	switch (type) {
+	case WLR_OUTPUT_CONTENT_TYPE_NONE:
+		return DRM_MODE_CONTENT_TYPE_GRAPHICS;
+	case WLR_OUTPUT_CONTENT_TYPE_PHOTO:
+		return DRM_MODE_CONTENT_TYPE_PHOTO;
+	case WLR_OUTPUT_CONTENT_TYPE_VIDEO:
+		return DRM_MODE_CONTENT_TYPE_CINEMA;
+	case WLR_OUTPUT_CONTENT_TYPE_GAME:
+		return DRM_MODE_CONTENT_TYPE_GAME;
+	}
+	abort(); // unreachable
 }
 
 static void set_plane_props(struct atomic *atom, struct wlr_drm_backend *drm,
@@ -180,20 +389,43 @@ static void set_plane_props(struct atomic *atom, struct wlr_drm_backend *drm,
 		goto error;
 	}
 
-	uint32_t width = fb->wlr_buf->width;
-	uint32_t height = fb->wlr_buf->height;
+	const struct wlr_drm_plane_geometry *geometry = plane->pending_fb != NULL ?
+		&plane->pending_geometry : &plane->geometry;
+	struct wlr_fbox src = {
+		.width = fb->wlr_buf->width,
+		.height = fb->wlr_buf->height,
+	};
+	struct wlr_box dst = {
+		.x = x,
+		.y = y,
+		.width = fb->wlr_buf->width,
+		.height = fb->wlr_buf->height,
+	};
+	if (geometry->set) {
+		src = geometry->src;
+		dst = geometry->dst;
+		dst.x += x;
+		dst.y += y;
+	}
 
 	// The src_* properties are in 16.16 fixed point
-	atomic_add(atom, id, props->src_x, 0);
-	atomic_add(atom, id, props->src_y, 0);
-	atomic_add(atom, id, props->src_w, (uint64_t)width << 16);
-	atomic_add(atom, id, props->src_h, (uint64_t)height << 16);
-	atomic_add(atom, id, props->crtc_w, width);
-	atomic_add(atom, id, props->crtc_h, height);
+	atomic_add(atom, id, props->src_x, (uint64_t)(src.x * 65536));
+	atomic_add(atom, id, props->src_y, (uint64_t)(src.y * 65536));
+	atomic_add(atom, id, props->src_w, (uint64_t)(src.width * 65536));
+	atomic_add(atom, id, props->src_h, (uint64_t)(src.height * 65536));
+	atomic_add(atom, id, props->crtc_w, (uint64_t)dst.width);
+	atomic_add(atom, id, props->crtc_h, (uint64_t)dst.height);
 	atomic_add(atom, id, props->fb_id, fb->id);
 	atomic_add(atom, id, props->crtc_id, crtc_id);
-	atomic_add(atom, id, props->crtc_x, (uint64_t)x);
-	atomic_add(atom, id, props->crtc_y, (uint64_t)y);
+	atomic_add(atom, id, props->crtc_x, (uint64_t)dst.x);
+	atomic_add(atom, id, props->crtc_y, (uint64_t)dst.y);
+	if (plane->set_zpos) {
+		atomic_add(atom, id, props->zpos, plane->zpos);
+	}
+	if (props->rotation != 0) {
+		atomic_add(atom, id, props->rotation,
+			drm_rotation_from_transform(geometry->transform));
+	}
 
 	return;
 
@@ -202,24 +434,133 @@ error:
 	atom->failed = true;
 }
 
-static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
-		const struct wlr_drm_connector_state *state, uint32_t flags,
-		bool test_only) {
+/**
+ * Perform an async page-flip, which only updates the FB of the primary plane.
+ * Falls back to the legacy API if the driver doesn't support async atomic
+ * commits.
+ */
+static bool atomic_crtc_async_page_flip(struct wlr_drm_connector *conn,
+		uint32_t flags, bool test_only) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	struct wlr_drm_fb *fb = plane_get_next_fb(crtc->primary);
+	if (fb == NULL) {
+		wlr_log(WLR_ERROR, "Failed to acquire FB");
+		return false;
+	}
+
+	if (!drm->supports_atomic_async_page_flip) {
+		assert(drm->supports_async_page_flip);
+		// The legacy API can't test commits
+		if (test_only) {
+			return true;
+		}
+		if (drmModePageFlip(drm->fd, crtc->id, fb->id, flags, drm) != 0) {
+			wlr_drm_conn_log_errno(conn, WLR_ERROR, "drmModePageFlip failed");
+			return false;
+		}
+		struct wlr_drm_prop_value *entry = prop_cache_find(drm,
+			crtc->primary->id, crtc->primary->props.fb_id);
+		if (entry != NULL) {
+			*entry = (struct wlr_drm_prop_value){
+				.obj = crtc->primary->id,
+				.prop = crtc->primary->props.fb_id,
+				.value = fb->id,
+			};
+		}
+		return true;
+	}
+
+	if (test_only) {
+		flags |= DRM_MODE_ATOMIC_TEST_ONLY;
+	} else {
+		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+	}
+
+	// The request can't be empty
+	struct atomic atom;
+	atomic_begin(&atom, drm);
+	atom.force = true;
+	atomic_add(&atom, crtc->primary->id, crtc->primary->props.fb_id, fb->id);
+	bool ok = atomic_commit(&atom, drm, conn, flags);
+	atomic_finish(&atom);
+	return ok;
+}
+
+/**
+ * Create a FB_DAMAGE_CLIPS blob, letting drivers which need to copy or
+ * transfer the FB (e.g. virtual GPUs, USB and SPI displays) only process the
+ * damaged pixels. Returns 0 if the whole FB should be considered damaged.
+ */
+static uint32_t create_fb_damage_clips_blob(struct wlr_drm_backend *drm,
+		struct wlr_drm_plane *plane, const pixman_region32_t *damage) {
+	struct wlr_drm_fb *fb = plane_get_next_fb(plane);
+	if (fb == NULL) {
+		return 0;
+	}
+
+	// Clips outside of the FB are rejected by some drivers
+	pixman_region32_t clipped;
+	pixman_region32_init(&clipped);
+	pixman_region32_intersect_rect(&clipped, (pixman_region32_t *)damage,
+		0, 0, fb->wlr_buf->width, fb->wlr_buf->height);
+
+	// An empty blob would mean the same as no blob, use a tiny clip instead
+	// so that nothing is transferred needlessly
+	if (!pixman_region32_not_empty(&clipped)) {
+		pixman_region32_union_rect(&clipped, &clipped, 0, 0, 1, 1);
+	}
+
+	int rects_len;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&clipped, &rects_len);
+
+	uint32_t blob_id = 0;
+	if (drmModeCreatePropertyBlob(drm->fd, rects, sizeof(*rects) * rects_len,
+			&blob_id) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create FB_DAMAGE_CLIPS property blob");
+		blob_id = 0;
+	}
+
+	pixman_region32_fini(&clipped);
+	return blob_id;
+}
+
+/**
+ * Properties computed for a connector state before it's added to an atomic
+ * request.
+ */
+struct atomic_crtc_props {
+	uint32_t mode_id;
+	uint32_t gamma_lut;
+	uint32_t fb_damage_clips;
+	bool prev_vrr_enabled, vrr_enabled;
+	// Writeback connector capturing the CRTC, and the FB it writes to
+	struct wlr_drm_writeback *writeback;
+	struct wlr_drm_fb *writeback_fb;
+	int32_t writeback_out_fence; // written by the kernel
+	// The CRTC is disabled, writeback connectors routed to it are detached
+	bool detach_writebacks;
+};
+
+static bool atomic_crtc_prepare(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state, bool test_only,
+		struct atomic_crtc_props *props) {
 	struct wlr_drm_backend *drm = conn->backend;
 	struct wlr_output *output = &conn->output;
 	struct wlr_drm_crtc *crtc = conn->crtc;
 
-	bool modeset = state->modeset;
-	bool active = state->active;
+	memset(props, 0, sizeof(*props));
 
-	uint32_t mode_id = crtc->mode_id;
-	if (modeset) {
-		if (!create_mode_blob(drm, conn, state, &mode_id)) {
+	props->mode_id = crtc->mode_id;
+	if (state->modeset) {
+		if (!create_mode_blob(drm, crtc, state, &props->mode_id)) {
 			return false;
 		}
 	}
 
-	uint32_t gamma_lut = crtc->gamma_lut;
+	props->gamma_lut = crtc->gamma_lut;
 	if (state->base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
 		// Fallback to legacy gamma interface when gamma properties are not
 		// available (can happen on older Intel GPUs that support gamma but not
@@ -231,115 +572,359 @@ static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
 				return false;
 			}
 		} else {
-			if (!create_gamma_lut_blob(drm, state->base->gamma_lut_size,
-					state->base->gamma_lut, &gamma_lut)) {
+			if (!create_gamma_lut_blob(drm, crtc,
+					state->base->gamma_lut_size, state->base->gamma_lut,
+					&props->gamma_lut)) {
 				return false;
 			}
 		}
 	}
 
-	uint32_t fb_damage_clips = 0;
-	if ((state->base->committed & WLR_OUTPUT_STATE_DAMAGE) &&
-			pixman_region32_not_empty((pixman_region32_t *)&state->base->damage) &&
-			crtc->primary->props.fb_damage_clips != 0) {
-		int rects_len;
-		const pixman_box32_t *rects = pixman_region32_rectangles(
-			(pixman_region32_t *)&state->base->damage, &rects_len);
-		if (drmModeCreatePropertyBlob(drm->fd, rects,
-				sizeof(*rects) * rects_len, &fb_damage_clips) != 0) {
-			wlr_log_errno(WLR_ERROR, "Failed to create FB_DAMAGE_CLIPS property blob");
+	props->detach_writebacks = !state->active;
+	if (state->active && (state->base->committed & WLR_OUTPUT_STATE_CAPTURE)) {
+		struct wlr_buffer *buffer = state->base->capture_buffer;
+		struct wlr_drm_writeback *writeback =
+			drm_connector_find_writeback(conn, buffer);
+		if (writeback == NULL) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"No writeback connector available");
+			return false;
+		}
+		// Routing a connector to the CRTC needs a modeset, which must not
+		// happen behind the compositor's back on a regular frame. Callers
+		// read back the buffer instead.
+		if (writeback->crtc_id != conn->crtc->id &&
+				(!state->modeset || state->seamless)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Writeback connector isn't routed to the CRTC");
+			return false;
+		}
+		if (!drm_fb_import(&props->writeback_fb, drm, buffer, NULL)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Failed to import capture buffer");
+			return false;
 		}
+		writeback->pending = true;
+		props->writeback = writeback;
+		props->writeback_out_fence = -1;
 	}
 
-	bool prev_vrr_enabled =
+	// The kernel doesn't validate damage for test-only commits
+	if (!test_only && state->active &&
+			(state->base->committed & WLR_OUTPUT_STATE_DAMAGE) &&
+			crtc->primary->props.fb_damage_clips != 0) {
+		props->fb_damage_clips = create_fb_damage_clips_blob(drm,
+			crtc->primary, &state->base->damage);
+	}
+
+	props->prev_vrr_enabled =
 		output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
-	bool vrr_enabled = prev_vrr_enabled;
+	props->vrr_enabled = props->prev_vrr_enabled;
 	if ((state->base->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) &&
 			drm_connector_supports_vrr(conn)) {
-		vrr_enabled = state->base->adaptive_sync_enabled;
+		props->vrr_enabled = state->base->adaptive_sync_enabled;
 	}
 
-	if (test_only) {
-		flags |= DRM_MODE_ATOMIC_TEST_ONLY;
-	}
-	if (modeset) {
-		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
-	} else if (!test_only && (state->base->committed & WLR_OUTPUT_STATE_BUFFER)) {
-		// The wlr_output API requires non-modeset commits with a new buffer to
-		// wait for the frame event. However compositors often perform
-		// non-modesets commits without a new buffer without waiting for the
-		// frame event. In that case we need to make the KMS commit blocking,
-		// otherwise the kernel will error out with EBUSY.
-		flags |= DRM_MODE_ATOMIC_NONBLOCK;
-	}
+	return true;
+}
 
-	struct atomic atom;
-	atomic_begin(&atom);
-	atomic_add(&atom, conn->id, conn->props.crtc_id, active ? crtc->id : 0);
+static void atomic_crtc_add(struct atomic *atom,
+		struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state,
+		const struct atomic_crtc_props *props) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	bool modeset = state->modeset;
+	bool active = state->active;
+
+	// Add all properties on modesets and resumes, in case another DRM master
+	// changed them
+	bool prev_force = atom->force;
+	atom->force = modeset || state->resume;
+
+	atomic_add(atom, conn->id, conn->props.crtc_id, active ? crtc->id : 0);
 	if (modeset && active && conn->props.link_status != 0) {
-		atomic_add(&atom, conn->id, conn->props.link_status,
+		atomic_add(atom, conn->id, conn->props.link_status,
 			DRM_MODE_LINK_STATUS_GOOD);
 	}
 	if (active && conn->props.content_type != 0) {
-		atomic_add(&atom, conn->id, conn->props.content_type,
-			DRM_MODE_CONTENT_TYPE_GRAPHICS);
+		enum wlr_output_content_type content_type = conn->output.content_type;
+		if (state->base->committed & WLR_OUTPUT_STATE_CONTENT_TYPE) {
+			content_type = state->base->content_type;
+		}
+		atomic_add(atom, conn->id, conn->props.content_type,
+			convert_content_type(content_type));
 	}
-	atomic_add(&atom, crtc->id, crtc->props.mode_id, mode_id);
-	atomic_add(&atom, crtc->id, crtc->props.active, active);
+	// Unchanged blobs are left as they are, except on modesets and resumes in
+	// case another DRM master changed them
+	if (modeset || state->resume || props->mode_id != crtc->mode_id) {
+		atomic_add(atom, crtc->id, crtc->props.mode_id, props->mode_id);
+	}
+	// The CRTC must be part of the request for page-flip events to be sent
+	atomic_add_volatile(atom, crtc->id, crtc->props.active, active);
 	if (active) {
-		if (crtc->props.gamma_lut != 0) {
-			atomic_add(&atom, crtc->id, crtc->props.gamma_lut, gamma_lut);
+		if (crtc->props.gamma_lut != 0 && (modeset || state->resume ||
+				props->gamma_lut != crtc->gamma_lut)) {
+			atomic_add(atom, crtc->id, crtc->props.gamma_lut,
+				props->gamma_lut);
 		}
 		if (crtc->props.vrr_enabled != 0) {
-			atomic_add(&atom, crtc->id, crtc->props.vrr_enabled, vrr_enabled);
+			atomic_add(atom, crtc->id, crtc->props.vrr_enabled,
+				props->vrr_enabled);
+		}
+		if (crtc->props.background_color != 0) {
+			const float *color = conn->output.background_color;
+			if (state->base->committed & WLR_OUTPUT_STATE_BACKGROUND_COLOR) {
+				color = state->base->background_color;
+			}
+			atomic_add(atom, crtc->id, crtc->props.background_color,
+				convert_background_color(color));
+		}
+		set_plane_props(atom, drm, crtc->primary, crtc->id, 0, 0);
+		// The fence belongs to the buffer rendered on the parent GPU, not to
+		// the copy blitted for a secondary GPU
+		if ((state->base->committed & WLR_OUTPUT_STATE_IN_FENCE) &&
+				drm->parent == NULL && crtc->primary->props.in_fence_fd != 0) {
+			atomic_add_volatile(atom, crtc->primary->id,
+				crtc->primary->props.in_fence_fd, state->base->in_fence_fd);
 		}
-		set_plane_props(&atom, drm, crtc->primary, crtc->id, 0, 0);
 		if (crtc->primary->props.fb_damage_clips != 0) {
-			atomic_add(&atom, crtc->primary->id,
-				crtc->primary->props.fb_damage_clips, fb_damage_clips);
+			atomic_add_volatile(atom, crtc->primary->id,
+				crtc->primary->props.fb_damage_clips, props->fb_damage_clips);
 		}
 		if (crtc->cursor) {
 			if (drm_connector_is_cursor_visible(conn)) {
-				set_plane_props(&atom, drm, crtc->cursor, crtc->id,
+				set_plane_props(atom, drm, crtc->cursor, crtc->id,
 					conn->cursor_x, conn->cursor_y);
 			} else {
-				plane_disable(&atom, crtc->cursor);
+				plane_disable(atom, crtc->cursor);
+			}
+		}
+		if (state->base->committed & WLR_OUTPUT_STATE_LAYERS) {
+			// Overlay planes are left untouched unless layers are committed
+			for (size_t i = 0; i < crtc->overlays_len; i++) {
+				struct wlr_drm_plane *plane = crtc->overlays[i];
+				if (plane->pending_fb != NULL) {
+					const struct wlr_output_layer_state *layer_state =
+						&state->base->layers[i];
+					set_plane_props(atom, drm, plane, crtc->id,
+						layer_state->x, layer_state->y);
+				} else {
+					plane_disable(atom, plane);
+				}
 			}
 		}
+		if (props->writeback != NULL) {
+			// The FB is only written for this commit, the connector stays
+			// routed to the CRTC for the next captures
+			struct wlr_drm_writeback *writeback = props->writeback;
+			atomic_add(atom, writeback->id, writeback->props.crtc_id,
+				crtc->id);
+			atomic_add_volatile(atom, writeback->id,
+				writeback->props.writeback_fb_id, props->writeback_fb->id);
+			atomic_add_volatile(atom, writeback->id,
+				writeback->props.writeback_out_fence_ptr,
+				(uintptr_t)&props->writeback_out_fence);
+		}
 	} else {
-		plane_disable(&atom, crtc->primary);
+		plane_disable(atom, crtc->primary);
 		if (crtc->cursor) {
-			plane_disable(&atom, crtc->cursor);
+			plane_disable(atom, crtc->cursor);
+		}
+		for (size_t i = 0; i < crtc->overlays_len; i++) {
+			plane_disable(atom, crtc->overlays[i]);
+		}
+		struct wlr_drm_writeback *writeback;
+		wl_list_for_each(writeback, &drm->writebacks, link) {
+			if (writeback->crtc_id == crtc->id) {
+				atomic_add(atom, writeback->id, writeback->props.crtc_id, 0);
+			}
 		}
 	}
 
-	bool ok = atomic_commit(&atom, conn, flags);
-	atomic_finish(&atom);
+	atom->force = prev_force;
+}
+
+static void atomic_crtc_finish(struct wlr_drm_connector *conn,
+		struct atomic_crtc_props *props, bool committed) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_output *output = &conn->output;
+	struct wlr_drm_crtc *crtc = conn->crtc;
 
-	if (ok && !test_only) {
-		commit_blob(drm, &crtc->mode_id, mode_id);
-		commit_blob(drm, &crtc->gamma_lut, gamma_lut);
+	if (committed) {
+		// The blobs are owned by the CRTC's blob caches
+		crtc->mode_id = props->mode_id;
+		crtc->gamma_lut = props->gamma_lut;
 
-		if (vrr_enabled != prev_vrr_enabled) {
-			output->adaptive_sync_status = vrr_enabled ?
+		if (props->vrr_enabled != props->prev_vrr_enabled) {
+			output->adaptive_sync_status = props->vrr_enabled ?
 				WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED :
 				WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
 			wlr_drm_conn_log(conn, WLR_DEBUG, "VRR %s",
-				vrr_enabled ? "enabled" : "disabled");
+				props->vrr_enabled ? "enabled" : "disabled");
+		}
+
+		if (props->detach_writebacks) {
+			struct wlr_drm_writeback *writeback;
+			wl_list_for_each(writeback, &drm->writebacks, link) {
+				if (writeback->crtc_id == crtc->id) {
+					writeback->crtc_id = 0;
+				}
+			}
 		}
-	} else {
-		rollback_blob(drm, &crtc->mode_id, mode_id);
-		rollback_blob(drm, &crtc->gamma_lut, gamma_lut);
 	}
 
-	if (fb_damage_clips != 0 &&
-			drmModeDestroyPropertyBlob(drm->fd, fb_damage_clips) != 0) {
+	if (props->writeback != NULL) {
+		props->writeback->pending = false;
+		if (committed) {
+			props->writeback->crtc_id = crtc->id;
+			drm_connector_add_writeback_job(conn,
+				props->writeback_fb->wlr_buf, &props->writeback_fb,
+				props->writeback_out_fence);
+		}
+		drm_fb_clear(&props->writeback_fb);
+	}
+
+	if (props->fb_damage_clips != 0 &&
+			drmModeDestroyPropertyBlob(drm->fd, props->fb_damage_clips) != 0) {
 		wlr_log_errno(WLR_ERROR, "Failed to destroy FB_DAMAGE_CLIPS property blob");
 	}
+}
 
+static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state, uint32_t flags,
+		bool test_only) {
+	struct wlr_drm_backend *drm = conn->backend;
+
+	if (flags & DRM_MODE_PAGE_FLIP_ASYNC) {
+		assert(!state->modeset && state->active);
+		return atomic_crtc_async_page_flip(conn, flags, test_only);
+	}
+
+	struct atomic_crtc_props props;
+	if (!atomic_crtc_prepare(conn, state, test_only, &props)) {
+		return false;
+	}
+
+	if (test_only) {
+		flags |= DRM_MODE_ATOMIC_TEST_ONLY;
+	}
+	if (state->modeset) {
+		if (!state->seamless) {
+			flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+		}
+	} else if (!test_only && (state->base->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		// The wlr_output API requires non-modeset commits with a new buffer to
+		// wait for the frame event. However compositors often perform
+		// non-modesets commits without a new buffer without waiting for the
+		// frame event. In that case we need to make the KMS commit blocking,
+		// otherwise the kernel will error out with EBUSY.
+		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+	}
+
+	struct atomic atom;
+	atomic_begin(&atom, drm);
+	atomic_crtc_add(&atom, conn, state, &props);
+	bool ok = atomic_commit(&atom, drm, conn, flags);
+	atomic_finish(&atom);
+
+	atomic_crtc_finish(conn, &props, ok && !test_only);
+	return ok;
+}
+
+static bool atomic_commit_connectors(struct wlr_drm_backend *drm,
+		const struct wlr_drm_connector_state *states, size_t states_len,
+		bool test_only) {
+	struct atomic_crtc_props *props = calloc(states_len, sizeof(*props));
+	if (props == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	uint32_t flags = test_only ?
+		DRM_MODE_ATOMIC_TEST_ONLY : DRM_MODE_PAGE_FLIP_EVENT;
+	// Same rules as atomic_crtc_commit(), for all CRTCs at once
+	bool nonblock = !test_only;
+	size_t prepared_len = 0;
+	bool ok = true;
+	for (size_t i = 0; i < states_len; i++) {
+		const struct wlr_drm_connector_state *state = &states[i];
+		if (!atomic_crtc_prepare(state->connector, state, test_only,
+				&props[i])) {
+			ok = false;
+			break;
+		}
+		prepared_len++;
+
+		if (state->modeset) {
+			nonblock = false;
+			if (!state->seamless) {
+				flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+			}
+		} else if (!(state->base->committed & WLR_OUTPUT_STATE_BUFFER)) {
+			nonblock = false;
+		}
+	}
+	if (nonblock) {
+		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+	}
+
+	if (ok) {
+		struct atomic atom;
+		atomic_begin(&atom, drm);
+		for (size_t i = 0; i < states_len; i++) {
+			atomic_crtc_add(&atom, states[i].connector, &states[i], &props[i]);
+		}
+		ok = atomic_commit(&atom, drm, states_len == 1 ?
+			states[0].connector : NULL, flags);
+		atomic_finish(&atom);
+	}
+
+	for (size_t i = 0; i < prepared_len; i++) {
+		atomic_crtc_finish(states[i].connector, &props[i], ok && !test_only);
+	}
+
+	free(props);
+	return ok;
+}
+
+static bool atomic_crtc_commit_cursor(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	assert(crtc != NULL && crtc->cursor != NULL);
+
+	struct atomic atom;
+	atomic_begin(&atom, drm);
+	// The CRTC must be part of the request for the page-flip event to be sent
+	atomic_add_volatile(&atom, crtc->id, crtc->props.active, 1);
+	if (drm_connector_is_cursor_visible(conn)) {
+		set_plane_props(&atom, drm, crtc->cursor, crtc->id,
+			conn->cursor_x, conn->cursor_y);
+	} else {
+		plane_disable(&atom, crtc->cursor);
+	}
+	bool ok = atomic_commit(&atom, drm, conn,
+		DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK);
+	atomic_finish(&atom);
+	return ok;
+}
+
+static bool atomic_crtc_test_cursor(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	assert(crtc != NULL && crtc->cursor != NULL);
+
+	struct atomic atom;
+	atomic_begin(&atom, drm);
+	set_plane_props(&atom, drm, crtc->cursor, crtc->id, 0, 0);
+	bool ok = atomic_commit(&atom, drm, conn, DRM_MODE_ATOMIC_TEST_ONLY);
+	atomic_finish(&atom);
 	return ok;
 }
 
 const struct wlr_drm_interface atomic_iface = {
 	.crtc_commit = atomic_crtc_commit,
+	.crtc_commit_cursor = atomic_crtc_commit_cursor,
+	.crtc_test_cursor = atomic_crtc_test_cursor,
+	.commit_connectors = atomic_commit_connectors,
 };
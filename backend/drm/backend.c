@@ -13,6 +13,7 @@
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include "backend/drm/drm.h"
+#include "backend/drm/iface.h"
 #include "util/signal.h"
 
 struct wlr_drm_backend *get_drm_backend_from_backend(
@@ -45,6 +46,7 @@ static void backend_destroy(struct wlr_backend *backend) {
 	wl_list_for_each_safe(fb, fb_tmp, &drm->fbs, link) {
 		drm_fb_destroy(fb);
 	}
+	drm_fb_cache_finish(drm);
 
 	wl_list_remove(&drm->display_destroy.link);
 	wl_list_remove(&drm->session_destroy.link);
@@ -61,6 +63,7 @@ static void backend_destroy(struct wlr_backend *backend) {
 
 	udev_hwdb_unref(drm->hwdb);
 	free(drm->name);
+	free(drm->non_master_path);
 	wlr_session_close_file(drm->session, drm->dev);
 	wl_event_source_remove(drm->drm_event);
 	free(drm);
@@ -85,6 +88,18 @@ static uint32_t drm_backend_get_buffer_caps(struct wlr_backend *backend) {
 	return WLR_BUFFER_CAP_DMABUF;
 }
 
+static bool backend_test(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len) {
+	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
+	return drm_commit_connectors(drm, states, states_len, true);
+}
+
+static bool backend_commit(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len) {
+	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
+	return drm_commit_connectors(drm, states, states_len, false);
+}
+
 static const struct wlr_backend_impl backend_impl = {
 	.start = backend_start,
 	.destroy = backend_destroy,
@@ -93,8 +108,20 @@ static const struct wlr_backend_impl backend_impl = {
 	.get_buffer_caps = drm_backend_get_buffer_caps,
 };
 
+// Multi-output commits need a single atomic request, so they're only
+// supported with the atomic interface on the primary GPU
+static const struct wlr_backend_impl atomic_backend_impl = {
+	.start = backend_start,
+	.destroy = backend_destroy,
+	.get_presentation_clock = backend_get_presentation_clock,
+	.get_drm_fd = backend_get_drm_fd,
+	.get_buffer_caps = drm_backend_get_buffer_caps,
+	.test = backend_test,
+	.commit = backend_commit,
+};
+
 bool wlr_backend_is_drm(struct wlr_backend *b) {
-	return b->impl == &backend_impl;
+	return b->impl == &backend_impl || b->impl == &atomic_backend_impl;
 }
 
 static void handle_session_active(struct wl_listener *listener, void *data) {
@@ -102,12 +129,20 @@ static void handle_session_active(struct wl_listener *listener, void *data) {
 		wl_container_of(listener, drm, session_active);
 	struct wlr_session *session = drm->session;
 
+	// Other DRM masters may have changed the KMS state in the meantime
+	drm_test_cache_invalidate(drm);
+	drm_atomic_prop_cache_invalidate(drm);
+
 	if (session->active) {
 		wlr_log(WLR_INFO, "DRM fd resumed");
 		scan_drm_connectors(drm, NULL);
 
 		struct wlr_drm_connector *conn;
 		wl_list_for_each(conn, &drm->outputs, link) {
+			if (drm_connector_fast_resume(conn)) {
+				continue;
+			}
+
 			struct wlr_output_mode *mode = NULL;
 			uint32_t committed = WLR_OUTPUT_STATE_ENABLED;
 			if (conn->output.enabled && conn->output.current_mode != NULL) {
@@ -194,9 +229,21 @@ static struct udev_hwdb *create_udev_hwdb(void) {
 struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 		struct wlr_session *session, struct wlr_device *dev,
 		struct wlr_backend *parent) {
+	return drm_backend_create(display, session, dev, parent, NULL);
+}
+
+struct wlr_backend *drm_backend_create(struct wl_display *display,
+		struct wlr_session *session, struct wlr_device *dev,
+		struct wlr_backend *parent, struct wlr_renderer *mgpu_renderer) {
 	assert(display && session && dev);
 	assert(!parent || wlr_backend_is_drm(parent));
 
+	if (parent == NULL && mgpu_renderer != NULL) {
+		// This is the primary GPU after all, it doesn't need a copy renderer
+		wlr_renderer_destroy(mgpu_renderer);
+		mgpu_renderer = NULL;
+	}
+
 	char *name = drmGetDeviceNameFromFd2(dev->fd);
 	drmVersion *version = drmGetVersion(dev->fd);
 	wlr_log(WLR_INFO, "Initializing DRM backend for %s (%s)", name, version->name);
@@ -205,13 +252,16 @@ struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 	struct wlr_drm_backend *drm = calloc(1, sizeof(struct wlr_drm_backend));
 	if (!drm) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		wlr_renderer_destroy(mgpu_renderer);
 		return NULL;
 	}
 	wlr_backend_init(&drm->backend, &backend_impl);
 
 	drm->session = session;
 	wl_list_init(&drm->fbs);
+	wl_list_init(&drm->fb_cache);
 	wl_list_init(&drm->outputs);
+	wl_list_init(&drm->writebacks);
 
 	drm->dev = dev;
 	drm->fd = dev->fd;
@@ -254,13 +304,18 @@ struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 	if (!check_drm_features(drm)) {
 		goto error_event;
 	}
+	if (drm->iface->commit_connectors != NULL && drm->parent == NULL) {
+		drm->backend.impl = &atomic_backend_impl;
+	}
 
 	if (!init_drm_resources(drm)) {
 		goto error_event;
 	}
 
 	if (drm->parent) {
-		if (!init_drm_renderer(drm, &drm->mgpu_renderer)) {
+		bool ok = init_drm_renderer(drm, &drm->mgpu_renderer, mgpu_renderer);
+		mgpu_renderer = NULL;
+		if (!ok) {
 			wlr_log(WLR_ERROR, "Failed to initialize renderer");
 			goto error_resources;
 		}
@@ -311,5 +366,6 @@ error_fd:
 	wl_list_remove(&drm->parent_destroy.link);
 	wlr_session_close_file(drm->session, dev);
 	free(drm);
+	wlr_renderer_destroy(mgpu_renderer);
 	return NULL;
 }
@@ -30,13 +30,27 @@
 #include "render/swapchain.h"
 #include "render/wlr_renderer.h"
 #include "util/signal.h"
+#include "util/time.h"
+#include "util/trace.h"
+
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
+#ifndef DRM_CLIENT_CAP_WRITEBACK_CONNECTORS
+#define DRM_CLIENT_CAP_WRITEBACK_CONNECTORS 5
+#endif
 
 // Output state which needs a KMS commit to be applied
 static const uint32_t COMMIT_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BUFFER |
 	WLR_OUTPUT_STATE_MODE |
 	WLR_OUTPUT_STATE_ENABLED |
-	WLR_OUTPUT_STATE_GAMMA_LUT;
+	WLR_OUTPUT_STATE_GAMMA_LUT |
+	WLR_OUTPUT_STATE_LAYERS |
+	WLR_OUTPUT_STATE_BUFFER_GEOMETRY |
+	WLR_OUTPUT_STATE_CAPTURE |
+	WLR_OUTPUT_STATE_CONTENT_TYPE |
+	WLR_OUTPUT_STATE_BACKGROUND_COLOR;
 
 static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BACKEND_OPTIONAL | COMMIT_OUTPUT_STATE;
@@ -87,11 +101,28 @@ bool check_drm_features(struct wlr_drm_backend *drm) {
 	} else {
 		wlr_log(WLR_DEBUG, "Using atomic DRM interface");
 		drm->iface = &atomic_iface;
+
+		// Writeback connectors are only exposed to clients asking for them.
+		// Buffers captured on a secondary GPU couldn't be used.
+		if (drm->parent == NULL && drmSetClientCap(drm->fd,
+				DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1) != 0) {
+			wlr_log(WLR_DEBUG, "Writeback connectors unsupported");
+		}
 	}
 
 	int ret = drmGetCap(drm->fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap);
 	drm->clock = (ret == 0 && cap == 1) ? CLOCK_MONOTONIC : CLOCK_REALTIME;
 
+	ret = drmGetCap(drm->fd, DRM_CAP_ASYNC_PAGE_FLIP, &cap);
+	drm->supports_async_page_flip = ret == 0 && cap == 1;
+	if (drm->iface == &atomic_iface) {
+		ret = drmGetCap(drm->fd, DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, &cap);
+		drm->supports_atomic_async_page_flip = ret == 0 && cap == 1;
+	}
+	wlr_log(WLR_DEBUG, "Async page-flips %s%s",
+		drm->supports_async_page_flip ? "supported" : "unsupported",
+		drm->supports_atomic_async_page_flip ? " (atomic)" : "");
+
 	const char *no_modifiers = getenv("WLR_DRM_NO_MODIFIERS");
 	if (no_modifiers != NULL && strcmp(no_modifiers, "1") == 0) {
 		wlr_log(WLR_DEBUG, "WLR_DRM_NO_MODIFIERS set, disabling modifiers");
@@ -105,6 +136,80 @@ bool check_drm_features(struct wlr_drm_backend *drm) {
 	return true;
 }
 
+static int cmp_cursor_size(const void *arg1, const void *arg2) {
+	const struct wlr_drm_cursor_size *a = arg1, *b = arg2;
+	return a->width * a->height - b->width * b->height;
+}
+
+/**
+ * Collect the cursor buffer sizes from the SIZE_HINTS property. Without it,
+ * only the size advertised by DRM_CAP_CURSOR_WIDTH/HEIGHT is known to work,
+ * and larger power-of-two sizes are probed when first needed, since many
+ * drivers support them.
+ */
+static bool init_cursor_sizes(struct wlr_drm_backend *drm,
+		struct wlr_drm_plane *plane) {
+	// Same layout as struct drm_plane_size_hint, which older kernel headers
+	// lack
+	struct size_hint {
+		uint16_t width, height;
+	};
+
+	size_t hints_size = 0;
+	struct size_hint *hints = NULL;
+	if (plane->props.size_hints != 0) {
+		hints = get_drm_prop_blob(drm->fd, plane->id, plane->props.size_hints,
+			&hints_size);
+	}
+	size_t hints_len = hints_size / sizeof(*hints);
+
+	static const int probed_sizes[] = { 128, 256 };
+	size_t cap = hints_len > 0 ? hints_len :
+		1 + sizeof(probed_sizes) / sizeof(probed_sizes[0]);
+	plane->cursor_sizes = calloc(cap, sizeof(*plane->cursor_sizes));
+	if (plane->cursor_sizes == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(hints);
+		return false;
+	}
+
+	if (hints_len > 0) {
+		for (size_t i = 0; i < hints_len; i++) {
+			plane->cursor_sizes[i] = (struct wlr_drm_cursor_size){
+				.width = hints[i].width,
+				.height = hints[i].height,
+				.status = WLR_DRM_CURSOR_SIZE_SUPPORTED,
+			};
+		}
+		plane->cursor_sizes_len = hints_len;
+	} else {
+		plane->cursor_sizes[0] = (struct wlr_drm_cursor_size){
+			.width = drm->cursor_width,
+			.height = drm->cursor_height,
+			.status = WLR_DRM_CURSOR_SIZE_SUPPORTED,
+		};
+		plane->cursor_sizes_len = 1;
+		for (size_t i = 0; i < cap - 1; i++) {
+			int size = probed_sizes[i];
+			if ((uint64_t)size <= drm->cursor_width ||
+					(uint64_t)size <= drm->cursor_height) {
+				continue;
+			}
+			plane->cursor_sizes[plane->cursor_sizes_len++] =
+				(struct wlr_drm_cursor_size){
+					.width = size,
+					.height = size,
+					.status = WLR_DRM_CURSOR_SIZE_UNKNOWN,
+				};
+		}
+	}
+	free(hints);
+
+	qsort(plane->cursor_sizes, plane->cursor_sizes_len,
+		sizeof(*plane->cursor_sizes), cmp_cursor_size);
+	return true;
+}
+
 static bool add_plane(struct wlr_drm_backend *drm,
 		struct wlr_drm_crtc *crtc, const drmModePlane *drm_plane,
 		uint32_t type, union wlr_drm_plane_props *props) {
@@ -153,6 +258,10 @@ static bool add_plane(struct wlr_drm_backend *drm,
 		drmModeFreePropertyBlob(blob);
 	}
 
+	if (type == DRM_PLANE_TYPE_CURSOR && !init_cursor_sizes(drm, p)) {
+		goto error;
+	}
+
 	switch (type) {
 	case DRM_PLANE_TYPE_PRIMARY:
 		crtc->primary = p;
@@ -160,6 +269,18 @@ static bool add_plane(struct wlr_drm_backend *drm,
 	case DRM_PLANE_TYPE_CURSOR:
 		crtc->cursor = p;
 		break;
+	case DRM_PLANE_TYPE_OVERLAY:;
+		struct wlr_drm_plane **overlays = realloc(crtc->overlays,
+			(crtc->overlays_len + 1) * sizeof(crtc->overlays[0]));
+		if (overlays == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			wlr_drm_format_set_finish(&p->formats);
+			goto error;
+		}
+		overlays[crtc->overlays_len] = p;
+		crtc->overlays = overlays;
+		crtc->overlays_len++;
+		break;
 	default:
 		abort();
 	}
@@ -171,6 +292,67 @@ error:
 	return false;
 }
 
+/**
+ * Output layers are displayed above the composited buffer. Keep the overlay
+ * planes which can be stacked above the primary plane, raising the ones with
+ * a mutable zpos, and drop those which are stuck below it (underlays).
+ */
+static void crtc_init_overlay_zpos(struct wlr_drm_backend *drm,
+		struct wlr_drm_crtc *crtc) {
+	struct wlr_drm_plane *primary = crtc->primary;
+	uint64_t primary_zpos;
+	if (primary == NULL || primary->props.zpos == 0 ||
+			!get_drm_prop(drm->fd, primary->id, primary->props.zpos,
+			&primary_zpos)) {
+		// Without zpos, overlay planes are stacked above the primary plane
+		return;
+	}
+
+	uint64_t primary_min, primary_max;
+	if (get_drm_prop_range(drm->fd, primary->props.zpos,
+			&primary_min, &primary_max) && primary_min != primary_max) {
+		// Keep it at the bottom, another DRM master may have raised it
+		primary->set_zpos = true;
+		primary->zpos = primary_min;
+		primary_zpos = primary_min;
+	}
+
+	size_t overlays_len = 0;
+	for (size_t i = 0; i < crtc->overlays_len; i++) {
+		struct wlr_drm_plane *plane = crtc->overlays[i];
+
+		bool above = plane->props.zpos == 0;
+		uint64_t zpos, min, max;
+		if (!above && get_drm_prop(drm->fd, plane->id, plane->props.zpos,
+				&zpos)) {
+			if (get_drm_prop_range(drm->fd, plane->props.zpos, &min, &max) &&
+					min != max) {
+				// Stack the overlays in their order, above the primary
+				uint64_t target = primary_zpos + 1 + overlays_len;
+				if (target < min) {
+					target = min;
+				}
+				above = target <= max;
+				plane->set_zpos = above;
+				plane->zpos = target;
+			} else {
+				above = zpos > primary_zpos;
+			}
+		}
+
+		if (!above) {
+			wlr_log(WLR_DEBUG, "Overlay plane %"PRIu32" is stacked below "
+				"the primary plane of CRTC %"PRIu32", not using it",
+				plane->id, crtc->id);
+			wlr_drm_format_set_finish(&plane->formats);
+			free(plane);
+			continue;
+		}
+		crtc->overlays[overlays_len++] = plane;
+	}
+	crtc->overlays_len = overlays_len;
+}
+
 static bool init_planes(struct wlr_drm_backend *drm) {
 	drmModePlaneRes *plane_res = drmModeGetPlaneResources(drm->fd);
 	if (!plane_res) {
@@ -201,9 +383,8 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 			goto error;
 		}
 
-		// We don't really care about overlay planes, as we don't support them
-		// yet.
-		if (type == DRM_PLANE_TYPE_OVERLAY) {
+		// Overlay planes can only be driven with the atomic interface
+		if (type == DRM_PLANE_TYPE_OVERLAY && drm->iface != &atomic_iface) {
 			drmModeFreePlane(plane);
 			continue;
 		}
@@ -217,7 +398,12 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 			}
 
 			struct wlr_drm_crtc *candidate = &drm->crtcs[j];
-			if ((type == DRM_PLANE_TYPE_PRIMARY && !candidate->primary) ||
+			if (type == DRM_PLANE_TYPE_OVERLAY) {
+				// Spread overlay planes evenly across CRTCs
+				if (!crtc || candidate->overlays_len < crtc->overlays_len) {
+					crtc = candidate;
+				}
+			} else if ((type == DRM_PLANE_TYPE_PRIMARY && !candidate->primary) ||
 					(type == DRM_PLANE_TYPE_CURSOR && !candidate->cursor)) {
 				crtc = candidate;
 				break;
@@ -237,6 +423,10 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 	}
 
 	drmModeFreePlaneResources(plane_res);
+
+	for (size_t i = 0; i < drm->num_crtcs; i++) {
+		crtc_init_overlay_zpos(drm, &drm->crtcs[i]);
+	}
 	return true;
 
 error:
@@ -297,12 +487,8 @@ void finish_drm_resources(struct wlr_drm_backend *drm) {
 
 		drmModeFreeCrtc(crtc->legacy_crtc);
 
-		if (crtc->mode_id) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->mode_id);
-		}
-		if (crtc->gamma_lut) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->gamma_lut);
-		}
+		drm_atomic_blob_cache_finish(drm, &crtc->mode_blobs);
+		drm_atomic_blob_cache_finish(drm, &crtc->gamma_lut_blobs);
 
 		if (crtc->primary) {
 			wlr_drm_format_set_finish(&crtc->primary->formats);
@@ -310,11 +496,22 @@ void finish_drm_resources(struct wlr_drm_backend *drm) {
 		}
 		if (crtc->cursor) {
 			wlr_drm_format_set_finish(&crtc->cursor->formats);
+			free(crtc->cursor->cursor_sizes);
 			free(crtc->cursor);
 		}
+		for (size_t j = 0; j < crtc->overlays_len; j++) {
+			wlr_drm_format_set_finish(&crtc->overlays[j]->formats);
+			free(crtc->overlays[j]);
+		}
+		free(crtc->overlays);
 	}
 
 	free(drm->crtcs);
+
+	struct wlr_drm_writeback *writeback, *writeback_tmp;
+	wl_list_for_each_safe(writeback, writeback_tmp, &drm->writebacks, link) {
+		drm_writeback_destroy(writeback);
+	}
 }
 
 static struct wlr_drm_connector *get_drm_connector_from_output(
@@ -323,22 +520,39 @@ static struct wlr_drm_connector *get_drm_connector_from_output(
 	return (struct wlr_drm_connector *)wlr_output;
 }
 
-static bool drm_crtc_commit(struct wlr_drm_connector *conn,
-		const struct wlr_drm_connector_state *state,
-		uint32_t flags, bool test_only) {
-	// Disallow atomic-only flags
-	assert((flags & ~DRM_MODE_PAGE_FLIP_FLAGS) == 0);
-
+static void drm_crtc_commit_finish(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state, bool committed) {
 	struct wlr_drm_backend *drm = conn->backend;
 	struct wlr_drm_crtc *crtc = conn->crtc;
-	bool ok = drm->iface->crtc_commit(conn, state, flags, test_only);
-	if (ok && !test_only) {
+
+	if (committed) {
+		// The cursor plane is part of every commit
+		conn->cursor_dirty = false;
+		if (state->modeset) {
+			drm_test_cache_invalidate(drm);
+		}
+		if (state->base->committed & WLR_OUTPUT_STATE_LAYERS) {
+			++conn->overlays_seq;
+		}
+		if (crtc->primary->pending_fb != NULL) {
+			crtc->primary->geometry = crtc->primary->pending_geometry;
+		}
 		drm_fb_move(&crtc->primary->queued_fb, &crtc->primary->pending_fb);
 		if (crtc->cursor != NULL) {
 			drm_fb_move(&crtc->cursor->queued_fb, &crtc->cursor->pending_fb);
 		}
+		if (state->base->committed & WLR_OUTPUT_STATE_LAYERS) {
+			for (size_t i = 0; i < crtc->overlays_len; i++) {
+				struct wlr_drm_plane *plane = crtc->overlays[i];
+				plane->queued_disable = plane->pending_fb == NULL;
+				drm_fb_move(&plane->queued_fb, &plane->pending_fb);
+			}
+		}
 	} else {
 		drm_fb_clear(&crtc->primary->pending_fb);
+		for (size_t i = 0; i < crtc->overlays_len; i++) {
+			drm_fb_clear(&crtc->overlays[i]->pending_fb);
+		}
 		// The set_cursor() hook is a bit special: it's not really synchronized
 		// to commit() or test(). Once set_cursor() returns true, the new
 		// cursor is effectively committed. So don't roll it back here, or we
@@ -346,9 +560,56 @@ static bool drm_crtc_commit(struct wlr_drm_connector *conn,
 		// wlr_drm_connector.cursor_enabled is true.
 		// TODO: fix our output interface to avoid this issue.
 	}
+}
+
+static bool drm_crtc_commit(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state,
+		uint32_t flags, bool test_only) {
+	// Disallow atomic-only flags
+	assert((flags & ~DRM_MODE_PAGE_FLIP_FLAGS) == 0);
+
+	struct wlr_drm_backend *drm = conn->backend;
+
+	struct wlr_drm_test_key key;
+	bool cacheable = test_only &&
+		drm_test_cache_get_key(conn, state, flags, &key);
+	bool ok;
+	if (!cacheable || !drm_test_cache_lookup(conn, &key, &ok)) {
+		ok = drm->iface->crtc_commit(conn, state, flags, test_only);
+		if (cacheable) {
+			drm_test_cache_insert(conn, &key, ok);
+		}
+	}
+
+	drm_crtc_commit_finish(conn, state, ok && !test_only);
 	return ok;
 }
 
+static bool drm_connector_state_is_tearing(
+		const struct wlr_drm_connector_state *state) {
+	return (state->base->committed & WLR_OUTPUT_STATE_BUFFER) &&
+		state->base->tearing_page_flip;
+}
+
+// Wait for the page-flip event of a commit
+static void drm_connector_handle_page_flip_commit(
+		struct wlr_drm_connector *conn) {
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	conn->pending_page_flip_crtc = crtc->id;
+	trace_async_begin(crtc->id, "page-flip %s", conn->name);
+
+	struct timespec now;
+	clock_gettime(conn->backend->clock, &now);
+	conn->page_flip_commit = timespec_to_nsec(&now);
+
+	// wlr_output's API guarantees that submitting a buffer will schedule a
+	// frame event. However the DRM backend will also schedule a frame event
+	// when performing a modeset. Set frame_pending to true so that
+	// wlr_output_schedule_frame doesn't trigger a synthetic frame event.
+	conn->output.frame_pending = true;
+}
+
 static bool drm_crtc_page_flip(struct wlr_drm_connector *conn,
 		const struct wlr_drm_connector_state *state) {
 	struct wlr_drm_crtc *crtc = conn->crtc;
@@ -366,17 +627,15 @@ static bool drm_crtc_page_flip(struct wlr_drm_connector *conn,
 
 	assert(state->active);
 	assert(plane_get_next_fb(crtc->primary));
-	if (!drm_crtc_commit(conn, state, DRM_MODE_PAGE_FLIP_EVENT, false)) {
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+	if (drm_connector_state_is_tearing(state)) {
+		flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+	}
+	if (!drm_crtc_commit(conn, state, flags, false)) {
 		return false;
 	}
 
-	conn->pending_page_flip_crtc = crtc->id;
-
-	// wlr_output's API guarantees that submitting a buffer will schedule a
-	// frame event. However the DRM backend will also schedule a frame event
-	// when performing a modeset. Set frame_pending to true so that
-	// wlr_output_schedule_frame doesn't trigger a synthetic frame event.
-	conn->output.frame_pending = true;
+	drm_connector_handle_page_flip_commit(conn);
 	return true;
 }
 
@@ -384,6 +643,7 @@ static void drm_connector_state_init(struct wlr_drm_connector_state *state,
 		struct wlr_drm_connector *conn,
 		const struct wlr_output_state *base) {
 	memset(state, 0, sizeof(*state));
+	state->connector = conn;
 	state->base = base;
 	state->modeset = base->committed &
 		(WLR_OUTPUT_STATE_ENABLED | WLR_OUTPUT_STATE_MODE);
@@ -423,8 +683,53 @@ static bool drm_connector_set_pending_fb(struct wlr_drm_connector *conn,
 
 	assert(state->committed & WLR_OUTPUT_STATE_BUFFER);
 
+	plane->pending_geometry = (struct wlr_drm_plane_geometry){0};
+	if (state->committed & WLR_OUTPUT_STATE_BUFFER_GEOMETRY) {
+		struct wlr_drm_plane_geometry *geometry = &plane->pending_geometry;
+		geometry->set = true;
+		geometry->transform = state->buffer_transform;
+
+		geometry->src = state->buffer_src_box;
+		if (wlr_fbox_empty(&geometry->src)) {
+			geometry->src = (struct wlr_fbox){
+				.width = state->buffer->width,
+				.height = state->buffer->height,
+			};
+		}
+
+		geometry->dst = state->buffer_dst_box;
+		if (wlr_box_empty(&geometry->dst)) {
+			geometry->dst = (struct wlr_box){
+				.width = conn->output.width,
+				.height = conn->output.height,
+			};
+			if (state->committed & WLR_OUTPUT_STATE_MODE) {
+				switch (state->mode_type) {
+				case WLR_OUTPUT_STATE_MODE_FIXED:
+					geometry->dst.width = state->mode->width;
+					geometry->dst.height = state->mode->height;
+					break;
+				case WLR_OUTPUT_STATE_MODE_CUSTOM:
+					geometry->dst.width = state->custom_mode.width;
+					geometry->dst.height = state->custom_mode.height;
+					break;
+				}
+			}
+		}
+	}
+
 	struct wlr_buffer *local_buf;
 	if (drm->parent) {
+		// Scan out the parent GPU's buffer directly if this device can import
+		// it, e.g. linear buffers in system memory. Buffers which can't be
+		// imported are poisoned, so this is only tried once per buffer.
+		if (drm_fb_import(&plane->pending_fb, drm, state->buffer,
+				&plane->formats)) {
+			// The blit damage history doesn't include this frame
+			plane->mgpu_surf.previous_invalid = true;
+			return true;
+		}
+
 		struct wlr_drm_format *format =
 			drm_plane_pick_render_format(plane, &drm->mgpu_renderer);
 		if (format == NULL) {
@@ -440,7 +745,11 @@ static bool drm_connector_set_pending_fb(struct wlr_drm_connector *conn,
 			return false;
 		}
 
-		local_buf = drm_surface_blit(&plane->mgpu_surf, state->buffer);
+		const pixman_region32_t *damage = NULL;
+		if (state->committed & WLR_OUTPUT_STATE_DAMAGE) {
+			damage = &state->damage;
+		}
+		local_buf = drm_surface_blit(&plane->mgpu_surf, state->buffer, damage);
 		if (local_buf == NULL) {
 			return false;
 		}
@@ -460,8 +769,159 @@ static bool drm_connector_set_pending_fb(struct wlr_drm_connector *conn,
 	return true;
 }
 
+/**
+ * Import the buffers of the output layers into the CRTC's overlay planes. Each
+ * layer is mapped to the overlay plane with the same index. Layers which can't
+ * be imported are left for the compositor to composite.
+ */
+static void drm_connector_set_pending_layer_fbs(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	assert(state->committed & WLR_OUTPUT_STATE_LAYERS);
+
+	for (size_t i = 0; i < state->layers_len; i++) {
+		struct wlr_output_layer_state *layer_state = &state->layers[i];
+		layer_state->accepted = false;
+
+		// Buffers would need to be blitted to the secondary GPU, which
+		// defeats the purpose of overlay planes
+		if (crtc == NULL || drm->parent != NULL || i >= crtc->overlays_len ||
+				layer_state->buffer == NULL) {
+			continue;
+		}
+
+		struct wlr_drm_plane *plane = crtc->overlays[i];
+		layer_state->accepted = drm_fb_import(&plane->pending_fb, drm,
+			layer_state->buffer, &plane->formats);
+		if (!layer_state->accepted) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Failed to import buffer for overlay plane %"PRIu32, plane->id);
+		}
+	}
+}
+
 static bool drm_connector_alloc_crtc(struct wlr_drm_connector *conn);
 
+static bool drm_connector_test_tearing(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+	if (!(state->committed & WLR_OUTPUT_STATE_BUFFER) ||
+			!state->tearing_page_flip) {
+		return true;
+	}
+
+	if (!drm->supports_async_page_flip &&
+			!drm->supports_atomic_async_page_flip) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Tearing page-flips are not supported");
+		return false;
+	}
+
+	// Async page-flips can only update the FB of the primary plane, so
+	// overlay planes can't be touched either
+	uint32_t allowed = WLR_OUTPUT_STATE_BUFFER |
+		(WLR_OUTPUT_STATE_BACKEND_OPTIONAL & ~WLR_OUTPUT_STATE_LAYERS);
+	if ((state->committed & ~allowed) != 0) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Tearing page-flips can't be combined with other changes");
+		return false;
+	}
+	if (conn->crtc != NULL && conn->crtc->primary->geometry.set) {
+		// The previous SRC_* and CRTC_* properties would be kept
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Tearing page-flips can't follow a buffer geometry");
+		return false;
+	}
+	if (drm->iface == &atomic_iface && drm_connector_is_cursor_visible(conn)) {
+		// The cursor plane wouldn't be updated
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Tearing page-flips can't be used with a visible cursor");
+		return false;
+	}
+
+	return true;
+}
+
+static bool drm_connector_test_buffer_geometry(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+	if (!(state->committed & WLR_OUTPUT_STATE_BUFFER_GEOMETRY)) {
+		return true;
+	}
+
+	// The legacy API can't program the plane properties, and buffers blitted
+	// to a secondary GPU have the size of the output
+	if (drm->iface != &atomic_iface || drm->parent != NULL) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Buffer geometry requires atomic modesetting on the primary GPU");
+		return false;
+	}
+
+	if (state->buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL &&
+			conn->crtc != NULL && conn->crtc->primary->props.rotation == 0) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Primary plane doesn't support rotation");
+		return false;
+	}
+
+	const struct wlr_fbox *src = &state->buffer_src_box;
+	if (!wlr_fbox_empty(src) && (src->x < 0 || src->y < 0 ||
+			src->x + src->width > state->buffer->width ||
+			src->y + src->height > state->buffer->height)) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Buffer source box is out of bounds");
+		return false;
+	}
+
+	return true;
+}
+
+static bool drm_connector_test_capture(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+	if (!(state->committed & WLR_OUTPUT_STATE_CAPTURE)) {
+		return true;
+	}
+
+	if (drm->iface != &atomic_iface || drm->parent != NULL) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Capture requires atomic modesetting on the primary GPU");
+		return false;
+	}
+
+	if (drm_connector_find_writeback(conn, state->capture_buffer) == NULL) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"No writeback connector can capture into the buffer");
+		return false;
+	}
+
+	return true;
+}
+
+static bool drm_connector_test_background_color(
+		struct wlr_drm_connector *conn, const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+	if (!(state->committed & WLR_OUTPUT_STATE_BACKGROUND_COLOR)) {
+		return true;
+	}
+
+	// Black is the default background of all CRTCs
+	const float *color = state->background_color;
+	if (color[0] == 0 && color[1] == 0 && color[2] == 0) {
+		return true;
+	}
+
+	if (drm->iface != &atomic_iface || drm->parent != NULL ||
+			conn->crtc == NULL || conn->crtc->props.background_color == 0) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"CRTC doesn't support background colors");
+		return false;
+	}
+
+	return true;
+}
+
 static bool drm_connector_test(struct wlr_output *output,
 		const struct wlr_output_state *state) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
@@ -482,6 +942,10 @@ static bool drm_connector_test(struct wlr_output *output,
 		return true;
 	}
 
+	if (!drm_connector_test_tearing(conn, state)) {
+		return false;
+	}
+
 	if ((state->committed & WLR_OUTPUT_STATE_ENABLED) && state->enabled) {
 		if (output->current_mode == NULL &&
 				!(state->committed & WLR_OUTPUT_STATE_MODE)) {
@@ -510,6 +974,16 @@ static bool drm_connector_test(struct wlr_output *output,
 		}
 	}
 
+	if (!drm_connector_test_buffer_geometry(conn, state)) {
+		return false;
+	}
+	if (!drm_connector_test_capture(conn, state)) {
+		return false;
+	}
+	if (!drm_connector_test_background_color(conn, state)) {
+		return false;
+	}
+
 	if (conn->backend->parent) {
 		// If we're running as a secondary GPU, we can't perform an atomic
 		// commit without blitting a buffer.
@@ -527,8 +1001,15 @@ static bool drm_connector_test(struct wlr_output *output,
 			return false;
 		}
 	}
+	if (state->committed & WLR_OUTPUT_STATE_LAYERS) {
+		drm_connector_set_pending_layer_fbs(conn, pending.base);
+	}
 
-	return drm_crtc_commit(conn, &pending, 0, true);
+	uint32_t flags = 0;
+	if (drm_connector_state_is_tearing(&pending)) {
+		flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+	}
+	return drm_crtc_commit(conn, &pending, flags, true);
 }
 
 bool drm_connector_supports_vrr(struct wlr_drm_connector *conn) {
@@ -589,6 +1070,9 @@ bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 			return false;
 		}
 	}
+	if (pending.base->committed & WLR_OUTPUT_STATE_LAYERS) {
+		drm_connector_set_pending_layer_fbs(conn, pending.base);
+	}
 
 	if (pending.modeset) {
 		if (!drm_connector_set_mode(conn, &pending)) {
@@ -599,7 +1083,7 @@ bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 			return false;
 		}
 	} else if (pending.base->committed & (WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED |
-			WLR_OUTPUT_STATE_GAMMA_LUT)) {
+			WLR_OUTPUT_STATE_GAMMA_LUT | WLR_OUTPUT_STATE_LAYERS)) {
 		assert(conn->crtc != NULL);
 		// TODO: maybe request a page-flip event here?
 		if (!drm_crtc_commit(conn, &pending, 0, false)) {
@@ -674,6 +1158,53 @@ static bool drm_connector_alloc_crtc(struct wlr_drm_connector *conn) {
 	return conn->crtc != NULL;
 }
 
+static bool drm_mode_timings_equal(const drmModeModeInfo *a,
+		const drmModeModeInfo *b) {
+	// The name and type depend on where the mode came from
+	return a->clock == b->clock &&
+		a->hdisplay == b->hdisplay && a->hsync_start == b->hsync_start &&
+		a->hsync_end == b->hsync_end && a->htotal == b->htotal &&
+		a->hskew == b->hskew &&
+		a->vdisplay == b->vdisplay && a->vsync_start == b->vsync_start &&
+		a->vsync_end == b->vsync_end && a->vtotal == b->vtotal &&
+		a->vscan == b->vscan && a->flags == b->flags;
+}
+
+/**
+ * Check whether the kernel drives the connector from its CRTC with the given
+ * mode, e.g. as left by the firmware or by another DRM master.
+ */
+static bool drm_connector_kernel_mode_matches(struct wlr_drm_connector *conn,
+		const drmModeModeInfo *mode) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	uint64_t crtc_id, active;
+	if (!get_drm_prop(drm->fd, conn->id, conn->props.crtc_id, &crtc_id) ||
+			crtc_id != crtc->id ||
+			!get_drm_prop(drm->fd, crtc->id, crtc->props.active, &active) ||
+			!active) {
+		return false;
+	}
+	if (conn->props.link_status != 0) {
+		uint64_t link_status;
+		if (!get_drm_prop(drm->fd, conn->id, conn->props.link_status,
+				&link_status) ||
+				link_status == DRM_MODE_LINK_STATUS_BAD) {
+			return false;
+		}
+	}
+
+	size_t kernel_mode_len = 0;
+	drmModeModeInfo *kernel_mode = get_drm_prop_blob(drm->fd, crtc->id,
+		crtc->props.mode_id, &kernel_mode_len);
+	bool same_mode = kernel_mode != NULL &&
+		kernel_mode_len == sizeof(*kernel_mode) &&
+		drm_mode_timings_equal(kernel_mode, mode);
+	free(kernel_mode);
+	return same_mode;
+}
+
 static bool drm_connector_set_mode(struct wlr_drm_connector *conn,
 		const struct wlr_drm_connector_state *state) {
 	struct wlr_output_mode *wlr_mode = NULL;
@@ -702,6 +1233,15 @@ static bool drm_connector_set_mode(struct wlr_drm_connector *conn,
 			if (!drm_crtc_commit(conn, state, 0, false)) {
 				return false;
 			}
+
+			// The CRTC is off, don't keep full-size buffers alive until the
+			// next modeset. The cursor is left alone, since the cursor
+			// plane is only updated when the cursor changes.
+			drm_plane_finish_surface(conn->crtc->primary);
+			for (size_t i = 0; i < conn->crtc->overlays_len; i++) {
+				drm_plane_finish_surface(conn->crtc->overlays[i]);
+				conn->crtc->overlays[i]->queued_disable = false;
+			}
 		}
 		wlr_output_update_enabled(&conn->output, false);
 		return true;
@@ -731,7 +1271,27 @@ static bool drm_connector_set_mode(struct wlr_drm_connector *conn,
 		return false;
 	}
 
-	if (!drm_crtc_page_flip(conn, state)) {
+	// On the first modeset, take over the mode left by the firmware or boot
+	// splash if possible, to avoid blanking the screen
+	struct wlr_drm_connector_state seamless_state;
+	const struct wlr_drm_connector_state *commit_state = state;
+	if (conn->backend->iface == &atomic_iface &&
+			conn->status == WLR_DRM_CONN_NEEDS_MODESET &&
+			conn->crtc->mode_id == 0 &&
+			drm_connector_kernel_mode_matches(conn, &state->mode)) {
+		seamless_state = *state;
+		seamless_state.seamless = true;
+		// Test directly with the interface: a failed drm_crtc_commit() drops
+		// the pending FB
+		if (conn->backend->iface->crtc_commit(conn, &seamless_state,
+				DRM_MODE_PAGE_FLIP_EVENT, true)) {
+			wlr_drm_conn_log(conn, WLR_INFO,
+				"Taking over the current mode without a modeset");
+			commit_state = &seamless_state;
+		}
+	}
+
+	if (!drm_crtc_page_flip(conn, commit_state)) {
 		return false;
 	}
 
@@ -747,6 +1307,280 @@ static bool drm_connector_set_mode(struct wlr_drm_connector *conn,
 	return true;
 }
 
+static bool drm_connector_test_in_batch(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state, bool test_only) {
+	const struct wlr_output_state *base = state->base;
+
+	uint32_t unsupported = base->committed & ~SUPPORTED_OUTPUT_STATE;
+	if (unsupported != 0) {
+		wlr_log(WLR_DEBUG, "Unsupported output state fields: 0x%"PRIx32,
+			unsupported);
+		return false;
+	}
+
+	// Async page-flips can't be combined with other CRTCs
+	if (drm_connector_state_is_tearing(state)) {
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Tearing page-flips can't be part of a multi-output commit");
+		return false;
+	}
+
+	if (!state->active) {
+		return true;
+	}
+
+	if (state->modeset) {
+		if (conn->output.current_mode == NULL &&
+				!(base->committed & WLR_OUTPUT_STATE_MODE)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Can't enable an output without a mode");
+			return false;
+		}
+		if (!(base->committed & WLR_OUTPUT_STATE_BUFFER)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Can't enable an output without a buffer");
+			return false;
+		}
+		if (conn->status != WLR_DRM_CONN_CONNECTED &&
+				conn->status != WLR_DRM_CONN_NEEDS_MODESET) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Cannot modeset a disconnected output");
+			return false;
+		}
+	} else if (!test_only && conn->pending_page_flip_crtc != 0) {
+		wlr_drm_conn_log(conn, WLR_DEBUG, "Failed to page-flip output: "
+			"a page-flip is already pending");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Find a CRTC for each connector enabled by the batch. CRTCs of connectors
+ * disabled by the batch can be handed over to other connectors.
+ */
+static bool drm_connectors_alloc_crtcs(struct wlr_drm_backend *drm,
+		const struct wlr_drm_connector_state *states, size_t states_len) {
+	bool needs_realloc = false;
+	for (size_t i = 0; i < states_len; i++) {
+		if (states[i].active && states[i].connector->crtc == NULL) {
+			needs_realloc = true;
+		}
+	}
+	if (!needs_realloc) {
+		return true;
+	}
+
+	bool prev_desired_enabled[states_len];
+	for (size_t i = 0; i < states_len; i++) {
+		struct wlr_drm_connector *conn = states[i].connector;
+		prev_desired_enabled[i] = conn->desired_enabled;
+		conn->desired_enabled = states[i].active;
+	}
+	realloc_crtcs(drm);
+	bool ok = true;
+	for (size_t i = 0; i < states_len; i++) {
+		struct wlr_drm_connector *conn = states[i].connector;
+		conn->desired_enabled = prev_desired_enabled[i];
+		if (states[i].active && conn->crtc == NULL) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"No CRTC available for this connector");
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static void drm_connector_apply_batch_state(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state,
+		struct wlr_output_mode *wlr_mode) {
+	if (!state->modeset) {
+		return;
+	}
+	if (!state->active) {
+		conn->desired_enabled = false;
+		wlr_output_update_enabled(&conn->output, false);
+		return;
+	}
+
+	wlr_drm_conn_log(conn, WLR_INFO,
+		"Modesetting with '%" PRId32 "x%" PRId32 "@%" PRId32 "mHz'",
+		wlr_mode->width, wlr_mode->height, wlr_mode->refresh);
+	conn->status = WLR_DRM_CONN_CONNECTED;
+	wlr_output_update_mode(&conn->output, wlr_mode);
+	wlr_output_update_enabled(&conn->output, true);
+	conn->desired_enabled = true;
+	wlr_output_damage_whole(&conn->output);
+}
+
+bool drm_commit_connectors(struct wlr_drm_backend *drm,
+		const struct wlr_backend_output_state *states, size_t states_len,
+		bool test_only) {
+	assert(drm->iface->commit_connectors != NULL && drm->parent == NULL);
+
+	if (!drm->session->active) {
+		return false;
+	}
+
+	struct wlr_drm_connector_state *pending =
+		calloc(states_len, sizeof(*pending));
+	struct wlr_drm_connector_state *kms_states =
+		calloc(states_len, sizeof(*kms_states));
+	struct wlr_output_mode **modes = calloc(states_len, sizeof(*modes));
+	if (pending == NULL || kms_states == NULL || modes == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		free(pending);
+		free(kms_states);
+		free(modes);
+		return false;
+	}
+
+	// States which don't change the KMS state are left out
+	size_t pending_len = 0, kms_states_len = 0;
+	bool ok = true;
+	for (size_t i = 0; i < states_len; i++) {
+		struct wlr_drm_connector *conn =
+			get_drm_connector_from_output(states[i].output);
+		if ((states[i].base.committed & COMMIT_OUTPUT_STATE) == 0) {
+			continue;
+		}
+
+		struct wlr_drm_connector_state *state = &pending[pending_len++];
+		drm_connector_state_init(state, conn, &states[i].base);
+		if (!drm_connector_test_in_batch(conn, state, test_only)) {
+			ok = false;
+			goto out;
+		}
+	}
+
+	if (!drm_connectors_alloc_crtcs(drm, pending, pending_len)) {
+		ok = false;
+		goto out;
+	}
+
+	// Disabled connectors without a CRTC don't need to be part of the request,
+	// nor do CRTCs which are already off
+	for (size_t i = 0; i < pending_len; i++) {
+		struct wlr_drm_connector *conn = pending[i].connector;
+		if (conn->crtc == NULL ||
+				(!pending[i].active && !conn->output.enabled)) {
+			continue;
+		}
+		kms_states[kms_states_len] = pending[i];
+		modes[kms_states_len] = NULL;
+		kms_states_len++;
+	}
+
+	for (size_t i = 0; ok && i < kms_states_len; i++) {
+		struct wlr_drm_connector *conn = kms_states[i].connector;
+		const struct wlr_output_state *base = kms_states[i].base;
+
+		if (!drm_connector_test_buffer_geometry(conn, base) ||
+				!drm_connector_test_capture(conn, base)) {
+			ok = false;
+			break;
+		}
+		if ((base->committed & WLR_OUTPUT_STATE_BUFFER) &&
+				!drm_connector_set_pending_fb(conn, base)) {
+			ok = false;
+			break;
+		}
+		if (base->committed & WLR_OUTPUT_STATE_LAYERS) {
+			drm_connector_set_pending_layer_fbs(conn, base);
+		}
+		if (kms_states[i].active && !plane_get_next_fb(conn->crtc->primary)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG, "Missing FB in modeset");
+			ok = false;
+			break;
+		}
+
+		if (!test_only && kms_states[i].active && kms_states[i].modeset) {
+			if (!(base->committed & WLR_OUTPUT_STATE_MODE)) {
+				modes[i] = conn->output.current_mode;
+			} else if (base->mode_type == WLR_OUTPUT_STATE_MODE_FIXED) {
+				modes[i] = base->mode;
+			} else {
+				modes[i] = wlr_drm_connector_add_mode(&conn->output,
+					&kms_states[i].mode);
+				ok = modes[i] != NULL;
+			}
+		}
+	}
+
+	if (ok && kms_states_len > 0) {
+		ok = drm->iface->commit_connectors(drm, kms_states, kms_states_len,
+			test_only);
+	}
+
+	for (size_t i = 0; i < kms_states_len; i++) {
+		drm_crtc_commit_finish(kms_states[i].connector, &kms_states[i],
+			ok && !test_only);
+	}
+	if (!ok || test_only) {
+		goto out;
+	}
+
+	// All CRTCs of the request get a page-flip event
+	for (size_t i = 0; i < kms_states_len; i++) {
+		struct wlr_drm_connector *conn = kms_states[i].connector;
+		if (kms_states[i].active) {
+			drm_connector_handle_page_flip_commit(conn);
+		}
+		drm_connector_apply_batch_state(conn, &kms_states[i], modes[i]);
+	}
+	for (size_t i = 0; i < pending_len; i++) {
+		struct wlr_drm_connector *conn = pending[i].connector;
+		if (!pending[i].active && (conn->crtc == NULL ||
+				!conn->output.enabled)) {
+			drm_connector_apply_batch_state(conn, &pending[i], NULL);
+		}
+	}
+
+out:
+	free(pending);
+	free(kms_states);
+	free(modes);
+	return ok;
+}
+
+bool drm_connector_fast_resume(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+
+	// Legacy can't tell whether a commit would need a modeset
+	if (drm->iface != &atomic_iface || crtc == NULL ||
+			conn->status != WLR_DRM_CONN_CONNECTED ||
+			!conn->output.enabled || conn->output.current_mode == NULL ||
+			plane_get_next_fb(crtc->primary) == NULL) {
+		return false;
+	}
+
+	// Whoever had the device in the meantime must have left the connector on
+	// the same CRTC, with the same mode
+	const struct wlr_drm_mode *mode =
+		(const struct wlr_drm_mode *)conn->output.current_mode;
+	if (!drm_connector_kernel_mode_matches(conn, &mode->drm_mode)) {
+		return false;
+	}
+
+	// Restore our planes and blobs in a single commit, without
+	// ALLOW_MODESET: the kernel rejects it if a modeset is needed after all
+	struct wlr_output_state base = {0};
+	struct wlr_drm_connector_state state;
+	drm_connector_state_init(&state, conn, &base);
+	state.resume = true;
+	if (!drm_crtc_commit(conn, &state, 0, false)) {
+		return false;
+	}
+
+	wlr_drm_conn_log(conn, WLR_INFO, "Resumed without modeset");
+	// The commit is blocking and doesn't produce a page-flip event
+	wlr_output_damage_whole(&conn->output);
+	wlr_output_schedule_frame(&conn->output);
+	return true;
+}
+
 struct wlr_output_mode *wlr_drm_connector_add_mode(struct wlr_output *output,
 		const drmModeModeInfo *modeinfo) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
@@ -782,6 +1616,108 @@ struct wlr_output_mode *wlr_drm_connector_add_mode(struct wlr_output *output,
 	return &mode->wlr_mode;
 }
 
+static bool drm_connector_commit_cursor(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_plane *plane = conn->crtc->cursor;
+
+	conn->cursor_dirty = false;
+	if (!drm->iface->crtc_commit_cursor(conn)) {
+		return false;
+	}
+
+	if (plane->pending_fb != NULL) {
+		drm_fb_move(&plane->queued_fb, &plane->pending_fb);
+	}
+	conn->pending_page_flip_crtc = conn->crtc->id;
+	conn->cursor_commit_pending = true;
+	trace_async_begin(conn->crtc->id, "page-flip %s", conn->name);
+	// Buffer commits would fail with EBUSY until the page-flip completes, hold
+	// them off as if a frame was pending
+	conn->output.frame_pending = true;
+	return true;
+}
+
+/**
+ * Apply a cursor change. When the output is idle, the cursor plane is
+ * committed on its own so that cursor motion doesn't wait for the compositor
+ * to render a frame. Changes made while a cursor-only page-flip is pending are
+ * coalesced and committed when it completes, at most once per vblank. When a
+ * frame is about to be submitted anyway, the cursor rides along with it.
+ */
+static void drm_connector_update_cursor(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_output *output = &conn->output;
+
+	if (conn->cursor_commit_pending) {
+		conn->cursor_dirty = true;
+		return;
+	}
+
+	if (drm->iface->crtc_commit_cursor == NULL || !drm->session->active ||
+			!output->enabled || conn->pending_page_flip_crtc != 0 ||
+			output->frame_pending || output->needs_frame ||
+			!drm_connector_commit_cursor(conn)) {
+		wlr_output_update_needs_frame(output);
+	}
+}
+
+static void drm_connector_get_present_stats(struct wlr_output *output,
+		struct wlr_output_present_stats *stats) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+
+	size_t len = conn->present_samples_len;
+	size_t first = (conn->present_samples_next + WLR_OUTPUT_PRESENT_SAMPLES_LEN
+		- len) % WLR_OUTPUT_PRESENT_SAMPLES_LEN;
+	for (size_t i = 0; i < len; i++) {
+		stats->samples[i] =
+			conn->present_samples[(first + i) % WLR_OUTPUT_PRESENT_SAMPLES_LEN];
+	}
+	stats->samples_len = len;
+	stats->presented = conn->presented;
+	stats->missed_vblanks = conn->missed_vblanks;
+}
+
+static void record_present_sample(struct wlr_drm_connector *conn,
+		unsigned seq, const struct timespec *when, int refresh) {
+	struct wlr_output_present_sample sample = {
+		.when = *when,
+		.seq = seq,
+	};
+
+	if (conn->page_flip_commit != 0) {
+		sample.latency = timespec_to_nsec(when) - conn->page_flip_commit;
+		if (refresh > 0 && sample.latency > refresh) {
+			sample.missed_vblanks = sample.latency / refresh;
+		}
+		conn->page_flip_commit = 0;
+	}
+
+	if (conn->present_samples_len > 0) {
+		size_t prev_idx = (conn->present_samples_next +
+			WLR_OUTPUT_PRESENT_SAMPLES_LEN - 1) % WLR_OUTPUT_PRESENT_SAMPLES_LEN;
+		unsigned prev_seq = conn->present_samples[prev_idx].seq;
+		if (seq != 0 && prev_seq != 0 && seq - prev_seq > 1) {
+			sample.seq_gap = seq - prev_seq - 1;
+		}
+	}
+
+	conn->present_samples[conn->present_samples_next] = sample;
+	conn->present_samples_next =
+		(conn->present_samples_next + 1) % WLR_OUTPUT_PRESENT_SAMPLES_LEN;
+	if (conn->present_samples_len < WLR_OUTPUT_PRESENT_SAMPLES_LEN) {
+		conn->present_samples_len++;
+	}
+	conn->presented++;
+	conn->missed_vblanks += sample.missed_vblanks;
+}
+
+// Cursor sizes are probed with test commits, which need an active CRTC
+static bool drm_connector_can_probe_cursor(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	return drm->iface->crtc_test_cursor != NULL && drm->session->active &&
+		conn->crtc != NULL && conn->output.enabled;
+}
+
 static bool drm_connector_set_cursor(struct wlr_output *output,
 		struct wlr_buffer *buffer, int hotspot_x, int hotspot_y) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
@@ -810,8 +1746,18 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 
 	conn->cursor_enabled = false;
 	if (buffer != NULL) {
-		if ((uint64_t)buffer->width != drm->cursor_width ||
-				(uint64_t)buffer->height != drm->cursor_height) {
+		struct wlr_drm_cursor_size *size = NULL;
+		for (size_t i = 0; i < plane->cursor_sizes_len; i++) {
+			struct wlr_drm_cursor_size *s = &plane->cursor_sizes[i];
+			if (s->width == buffer->width && s->height == buffer->height) {
+				size = s;
+				break;
+			}
+		}
+		if (size == NULL ||
+				size->status == WLR_DRM_CURSOR_SIZE_UNSUPPORTED ||
+				(size->status == WLR_DRM_CURSOR_SIZE_UNKNOWN &&
+				!drm_connector_can_probe_cursor(conn))) {
 			wlr_drm_conn_log(conn, WLR_DEBUG, "Cursor buffer size mismatch");
 			return false;
 		}
@@ -832,7 +1778,7 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 				return false;
 			}
 
-			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer);
+			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer, NULL);
 			if (local_buf == NULL) {
 				return false;
 			}
@@ -847,12 +1793,24 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 			return false;
 		}
 
+		if (size->status == WLR_DRM_CURSOR_SIZE_UNKNOWN) {
+			ok = drm->iface->crtc_test_cursor(conn);
+			size->status = ok ? WLR_DRM_CURSOR_SIZE_SUPPORTED :
+				WLR_DRM_CURSOR_SIZE_UNSUPPORTED;
+			wlr_drm_conn_log(conn, WLR_DEBUG, "Cursor size %dx%d %s",
+				size->width, size->height, ok ? "supported" : "unsupported");
+			if (!ok) {
+				drm_fb_clear(&plane->pending_fb);
+				return false;
+			}
+		}
+
 		conn->cursor_enabled = true;
 		conn->cursor_width = buffer->width;
 		conn->cursor_height = buffer->height;
 	}
 
-	wlr_output_update_needs_frame(output);
+	drm_connector_update_cursor(conn);
 	return true;
 }
 
@@ -882,7 +1840,7 @@ static bool drm_connector_move_cursor(struct wlr_output *output,
 	conn->cursor_x = box.x;
 	conn->cursor_y = box.y;
 
-	wlr_output_update_needs_frame(output);
+	drm_connector_update_cursor(conn);
 	return true;
 }
 
@@ -905,12 +1863,23 @@ static void dealloc_crtc(struct wlr_drm_connector *conn);
 static void drm_connector_destroy_output(struct wlr_output *output) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
 
+	// The captures have already been cancelled by wlr_output_destroy()
+	drm_connector_destroy_writeback_jobs(conn);
 	dealloc_crtc(conn);
 
 	conn->status = WLR_DRM_CONN_DISCONNECTED;
 	conn->desired_enabled = false;
 	conn->possible_crtcs = 0;
+	if (conn->pending_page_flip_crtc != 0) {
+		trace_async_end(conn->pending_page_flip_crtc, "page-flip %s",
+			conn->name);
+	}
 	conn->pending_page_flip_crtc = 0;
+	conn->cursor_commit_pending = false;
+	conn->cursor_dirty = false;
+	conn->present_samples_len = conn->present_samples_next = 0;
+	conn->presented = conn->missed_vblanks = 0;
+	conn->page_flip_commit = 0;
 
 	struct wlr_drm_mode *mode, *mode_tmp;
 	wl_list_for_each_safe(mode, mode_tmp, &conn->output.modes, wlr_mode.link) {
@@ -942,9 +1911,36 @@ static const struct wlr_drm_format_set *drm_connector_get_cursor_formats(
 
 static void drm_connector_get_cursor_size(struct wlr_output *output,
 		int *width, int *height) {
-	struct wlr_drm_backend *drm = get_drm_backend_from_backend(output->backend);
-	*width = (int)drm->cursor_width;
-	*height = (int)drm->cursor_height;
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_plane *plane = conn->crtc != NULL ? conn->crtc->cursor : NULL;
+	if (plane == NULL) {
+		*width = (int)drm->cursor_width;
+		*height = (int)drm->cursor_height;
+		return;
+	}
+
+	// Pick the smallest size fitting the image, or else the largest one
+	bool can_probe = drm_connector_can_probe_cursor(conn);
+	const struct wlr_drm_cursor_size *best = NULL;
+	for (size_t i = 0; i < plane->cursor_sizes_len; i++) {
+		const struct wlr_drm_cursor_size *size = &plane->cursor_sizes[i];
+		if (size->status == WLR_DRM_CURSOR_SIZE_UNSUPPORTED ||
+				(size->status == WLR_DRM_CURSOR_SIZE_UNKNOWN && !can_probe)) {
+			continue;
+		}
+		best = size;
+		if (size->width >= *width && size->height >= *height) {
+			break;
+		}
+	}
+	if (best == NULL) {
+		*width = (int)drm->cursor_width;
+		*height = (int)drm->cursor_height;
+		return;
+	}
+	*width = best->width;
+	*height = best->height;
 }
 
 static const struct wlr_drm_format_set *drm_connector_get_primary_formats(
@@ -971,6 +1967,7 @@ static const struct wlr_output_impl output_impl = {
 	.get_gamma_size = drm_connector_get_gamma_size,
 	.get_cursor_formats = drm_connector_get_cursor_formats,
 	.get_cursor_size = drm_connector_get_cursor_size,
+	.get_present_stats = drm_connector_get_present_stats,
 	.get_primary_formats = drm_connector_get_primary_formats,
 };
 
@@ -983,6 +1980,22 @@ uint32_t wlr_drm_connector_get_id(struct wlr_output *output) {
 	return conn->id;
 }
 
+bool wlr_drm_backend_check_buffer_scanout(struct wlr_backend *backend,
+		struct wlr_buffer *buffer) {
+	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
+	if (buffer->scanout != WLR_BUFFER_SCANOUT_UNKNOWN) {
+		return buffer->scanout == WLR_BUFFER_SCANOUT_CAPABLE;
+	}
+	if (!drm->session->active) {
+		return false;
+	}
+	if (drm->parent != NULL) {
+		// Buffers are copied to the secondary GPU, the parent does scanout
+		return false;
+	}
+	return drm_fb_check_import(drm, buffer);
+}
+
 enum wl_output_transform wlr_drm_connector_get_panel_orientation(
 		struct wlr_output *output) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
@@ -1046,6 +2059,10 @@ static void dealloc_crtc(struct wlr_drm_connector *conn) {
 
 	drm_plane_finish_surface(conn->crtc->primary);
 	drm_plane_finish_surface(conn->crtc->cursor);
+	for (size_t i = 0; i < conn->crtc->overlays_len; i++) {
+		drm_plane_finish_surface(conn->crtc->overlays[i]);
+		conn->crtc->overlays[i]->queued_disable = false;
+	}
 
 	conn->cursor_enabled = false;
 	conn->crtc = NULL;
@@ -1066,8 +2083,14 @@ static void realloc_crtcs(struct wlr_drm_backend *drm) {
 	uint32_t previous_match[drm->num_crtcs];
 	uint32_t new_match[drm->num_crtcs];
 
+	// Leased CRTCs are owned by the lessee, never hand them to another
+	// connector
+	uint32_t leased_crtcs = 0;
 	for (size_t i = 0; i < drm->num_crtcs; ++i) {
 		previous_match[i] = UNMATCHED;
+		if (drm->crtcs[i].lease != NULL) {
+			leased_crtcs |= 1 << i;
+		}
 	}
 
 	wlr_log(WLR_DEBUG, "State before reallocation:");
@@ -1086,10 +2109,13 @@ static void realloc_crtcs(struct wlr_drm_backend *drm) {
 
 		// Only search CRTCs for user-enabled outputs (that are already
 		// connected or in need of a modeset)
-		if ((conn->status == WLR_DRM_CONN_CONNECTED ||
+		if (conn->lease != NULL && conn->crtc != NULL) {
+			// Keep the leased CRTC
+			connector_constraints[i] = 1 << (conn->crtc - drm->crtcs);
+		} else if ((conn->status == WLR_DRM_CONN_CONNECTED ||
 				conn->status == WLR_DRM_CONN_NEEDS_MODESET) &&
 				conn->desired_enabled) {
-			connector_constraints[i] = conn->possible_crtcs;
+			connector_constraints[i] = conn->possible_crtcs & ~leased_crtcs;
 		} else {
 			// Will always fail to match anything
 			connector_constraints[i] = 0;
@@ -1181,6 +2207,48 @@ static uint32_t get_possible_crtcs(int fd, const drmModeConnector *conn) {
 	return possible_crtcs;
 }
 
+/**
+ * Get the EDID of a connector. The last blob read is kept, so that the blob
+ * only needs to be fetched again if its ID has changed.
+ */
+static const uint8_t *get_drm_connector_edid(struct wlr_drm_connector *conn,
+		size_t *len) {
+	struct wlr_drm_backend *drm = conn->backend;
+
+	*len = 0;
+	uint64_t blob_id;
+	if (conn->props.edid == 0 ||
+			!get_drm_prop(drm->fd, conn->id, conn->props.edid, &blob_id) ||
+			blob_id == 0) {
+		return NULL;
+	}
+
+	if (blob_id != conn->edid_blob_id) {
+		drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(drm->fd, blob_id);
+		if (blob == NULL) {
+			wlr_drm_conn_log_errno(conn, WLR_ERROR, "Failed to get EDID blob");
+			return NULL;
+		}
+
+		uint8_t *edid = malloc(blob->length);
+		if (edid == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			drmModeFreePropertyBlob(blob);
+			return NULL;
+		}
+		memcpy(edid, blob->data, blob->length);
+
+		free(conn->edid);
+		conn->edid = edid;
+		conn->edid_len = blob->length;
+		conn->edid_blob_id = blob_id;
+		drmModeFreePropertyBlob(blob);
+	}
+
+	*len = conn->edid_len;
+	return conn->edid;
+}
+
 static void disconnect_drm_connector(struct wlr_drm_connector *conn);
 
 void scan_drm_connectors(struct wlr_drm_backend *drm,
@@ -1193,6 +2261,8 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 		return;
 	}
 
+	drm_test_cache_invalidate(drm);
+
 	if (event != NULL && event->connector_id != 0) {
 		wlr_log(WLR_INFO, "Scanning DRM connector %"PRIu32" on %s",
 			event->connector_id, drm->name);
@@ -1237,11 +2307,36 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 			continue;
 		}
 
+		// Writeback connectors are static, they're only scanned once
+		bool is_writeback = false;
+		struct wlr_drm_writeback *writeback;
+		wl_list_for_each(writeback, &drm->writebacks, link) {
+			is_writeback |= writeback->id == conn_id;
+		}
+		if (is_writeback) {
+			continue;
+		}
+
+		// Property change uevents can't change the connection state, e.g.
+		// content protection updates. Only a bad link status requires
+		// probing the connector again.
+		if (event != NULL && event->prop_id != 0 && wlr_conn != NULL &&
+				event->prop_id != wlr_conn->props.link_status) {
+			seen[index] = true;
+			continue;
+		}
+
 		drmModeConnector *drm_conn = drmModeGetConnector(drm->fd, conn_id);
 		if (!drm_conn) {
 			wlr_log_errno(WLR_ERROR, "Failed to get DRM connector");
 			continue;
 		}
+		if (drm_conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK) {
+			drm_writeback_create(drm, conn_id,
+				get_possible_crtcs(drm->fd, drm_conn));
+			drmModeFreeConnector(drm_conn);
+			continue;
+		}
 		drmModeEncoder *curr_enc = drmModeGetEncoder(drm->fd,
 			drm_conn->encoder_id);
 
@@ -1257,6 +2352,7 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 			wlr_conn->backend = drm;
 			wlr_conn->status = WLR_DRM_CONN_DISCONNECTED;
 			wlr_conn->id = drm_conn->connector_id;
+			wl_list_init(&wlr_conn->writeback_jobs);
 
 			snprintf(wlr_conn->name, sizeof(wlr_conn->name),
 				"%s-%"PRIu32, conn_get_name(drm_conn->connector_type),
@@ -1325,11 +2421,9 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 				wlr_conn->output.non_desktop = non_desktop;
 			}
 
-			size_t edid_len = 0;
-			uint8_t *edid = get_drm_prop_blob(drm->fd,
-				wlr_conn->id, wlr_conn->props.edid, &edid_len);
+			size_t edid_len;
+			const uint8_t *edid = get_drm_connector_edid(wlr_conn, &edid_len);
 			parse_edid(wlr_conn, edid_len, edid);
-			free(edid);
 
 			char *subconnector = NULL;
 			if (wlr_conn->props.subconnector) {
@@ -1435,6 +2529,11 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 }
 
 void scan_drm_leases(struct wlr_drm_backend *drm) {
+	// Lease events are also sent for leases issued by other DRM masters
+	if (drm->leases_len == 0) {
+		return;
+	}
+
 	drmModeLesseeListRes *list = drmModeListLessees(drm->fd);
 	if (list == NULL) {
 		wlr_log_errno(WLR_ERROR, "drmModeListLessees failed");
@@ -1486,6 +2585,9 @@ static void handle_page_flip(int fd, unsigned seq,
 	}
 
 	conn->pending_page_flip_crtc = 0;
+	trace_async_end(crtc_id, "page-flip %s", conn->name);
+	bool cursor_only = conn->cursor_commit_pending;
+	conn->cursor_commit_pending = false;
 
 	if (conn->status != WLR_DRM_CONN_CONNECTED || conn->crtc == NULL) {
 		wlr_drm_conn_log(conn, WLR_DEBUG,
@@ -1501,6 +2603,30 @@ static void handle_page_flip(int fd, unsigned seq,
 		drm_fb_move(&conn->crtc->cursor->current_fb,
 			&conn->crtc->cursor->queued_fb);
 	}
+	for (size_t i = 0; i < conn->crtc->overlays_len; i++) {
+		struct wlr_drm_plane *overlay = conn->crtc->overlays[i];
+		if (overlay->queued_fb || overlay->queued_disable) {
+			drm_fb_move(&overlay->current_fb, &overlay->queued_fb);
+			overlay->queued_disable = false;
+		}
+	}
+
+	if (cursor_only) {
+		// No new frame has been presented. Commit the latest cursor state if
+		// it changed in the meantime and the compositor isn't going to submit
+		// a frame.
+		if (conn->cursor_dirty) {
+			if (!conn->output.needs_frame && drm->session->active &&
+					drm_connector_commit_cursor(conn)) {
+				return;
+			}
+			wlr_output_update_needs_frame(&conn->output);
+		}
+		if (drm->session->active) {
+			wlr_output_send_frame(&conn->output);
+		}
+		return;
+	}
 
 	uint32_t present_flags = WLR_OUTPUT_PRESENT_VSYNC |
 		WLR_OUTPUT_PRESENT_HW_CLOCK | WLR_OUTPUT_PRESENT_HW_COMPLETION;
@@ -1517,6 +2643,9 @@ static void handle_page_flip(int fd, unsigned seq,
 		.tv_sec = tv_sec,
 		.tv_nsec = tv_usec * 1000,
 	};
+	int refresh = mhz_to_nsec(conn->output.refresh);
+	record_present_sample(conn, seq, &present_time, refresh);
+
 	struct wlr_output_event_present present_event = {
 		/* The DRM backend guarantees that the presentation event will be for
 		 * the last submitted frame. */
@@ -1524,7 +2653,7 @@ static void handle_page_flip(int fd, unsigned seq,
 		.presented = true,
 		.when = &present_time,
 		.seq = seq,
-		.refresh = mhz_to_nsec(conn->output.refresh),
+		.refresh = refresh,
 		.flags = present_flags,
 	};
 	wlr_output_send_present(&conn->output, &present_event);
@@ -1565,6 +2694,7 @@ void destroy_drm_connector(struct wlr_drm_connector *conn) {
 	disconnect_drm_connector(conn);
 
 	wl_list_remove(&conn->link);
+	free(conn->edid);
 	free(conn);
 }
 
@@ -1572,21 +2702,28 @@ int wlr_drm_backend_get_non_master_fd(struct wlr_backend *backend) {
 	assert(backend);
 
 	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
-	char *path = drmGetDeviceNameFromFd2(drm->fd);
-	if (!path) {
-		wlr_log(WLR_ERROR, "Failed to get device name from DRM fd");
-		return -1;
+	// Resolving the device name goes through sysfs, only do it once. The
+	// device can't change while the backend is alive.
+	if (drm->non_master_path == NULL) {
+		drm->non_master_path = drmGetDeviceNameFromFd2(drm->fd);
+		if (drm->non_master_path == NULL) {
+			wlr_log(WLR_ERROR, "Failed to get device name from DRM fd");
+			return -1;
+		}
 	}
 
-	int fd = open(path, O_RDWR | O_CLOEXEC);
+	// Each caller needs its own open file description: DRM authentication,
+	// master status and GEM handles are per file description, so the FD
+	// can't be shared with dup()
+	int fd = open(drm->non_master_path, O_RDWR | O_CLOEXEC);
 	if (fd < 0) {
 		wlr_log_errno(WLR_ERROR, "Unable to clone DRM fd for client fd");
-		free(path);
 		return -1;
 	}
 
 	if (drmIsMaster(fd) && drmDropMaster(fd) < 0) {
 		wlr_log_errno(WLR_ERROR, "Failed to drop master");
+		close(fd);
 		return -1;
 	}
 
@@ -1662,7 +2799,9 @@ struct wlr_drm_lease *wlr_drm_create_lease(struct wlr_output **outputs,
 				get_drm_connector_from_output(outputs[i]);
 		conn->lease = lease;
 		conn->crtc->lease = lease;
+		drm_test_cache_invalidate_connector(conn);
 	}
+	drm->leases_len++;
 
 	return lease;
 }
@@ -1688,14 +2827,19 @@ void drm_lease_destroy(struct wlr_drm_lease *lease) {
 	wl_list_for_each(conn, &drm->outputs, link) {
 		if (conn->lease == lease) {
 			conn->lease = NULL;
+			drm_test_cache_invalidate_connector(conn);
 		}
 	}
 
+	// The lessee may have changed the properties of the leased objects
+	drm_atomic_prop_cache_invalidate(drm);
+
 	for (size_t i = 0; i < drm->num_crtcs; ++i) {
 		if (drm->crtcs[i].lease == lease) {
 			drm->crtcs[i].lease = NULL;
 		}
 	}
+	drm->leases_len--;
 
 	free(lease);
 }
@@ -0,0 +1,115 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "backend/drm/util.h"
+
+/*
+ * Weight of matching an object with a resource. Solutions with the most
+ * matched objects are preferred, then the ones closest to the original
+ * solution: a matched object is worth more than keeping all original matches.
+ */
+static int64_t match_weight(size_t num_objs, const uint32_t *objs,
+		size_t num_res, const uint32_t *orig, size_t obj, size_t res) {
+	if (obj >= num_objs || res >= num_res || orig[res] == SKIP) {
+		return 0;
+	}
+
+	bool compatible = res < 32 && (objs[obj] & (1u << res));
+	bool kept = orig[res] == obj;
+	if (!compatible && !kept) {
+		return 0;
+	}
+
+	int64_t score = objs[obj] != 0 ? 1 : 0;
+	return score * (int64_t)(num_res + 1) + (kept ? 1 : 0);
+}
+
+size_t match_obj(size_t num_objs, const uint32_t objs[static restrict num_objs],
+		size_t num_res, const uint32_t res[static restrict num_res],
+		uint32_t out[static restrict num_res]) {
+	for (size_t i = 0; i < num_res; ++i) {
+		out[i] = res[i] == SKIP ? SKIP : UNMATCHED;
+	}
+
+	size_t n = num_objs > num_res ? num_objs : num_res;
+	if (n == 0) {
+		return 0;
+	}
+
+	/*
+	 * Maximum weight bipartite matching with the Hungarian algorithm, in
+	 * O(n^3). Rows are objects, columns are resources, both padded with
+	 * zero-weight dummies up to n. Arrays are 1-indexed, index 0 is the
+	 * sentinel used while augmenting.
+	 */
+	const int64_t max_weight = 2 * (int64_t)(num_res + 1);
+	int64_t u[n + 1], v[n + 1], min_slack[n + 1];
+	size_t row_of[n + 1], way[n + 1];
+	bool used[n + 1];
+	for (size_t j = 0; j <= n; ++j) {
+		u[j] = v[j] = 0;
+		row_of[j] = 0;
+		way[j] = 0;
+	}
+
+	for (size_t i = 1; i <= n; ++i) {
+		row_of[0] = i;
+		size_t j0 = 0;
+		for (size_t j = 0; j <= n; ++j) {
+			min_slack[j] = INT64_MAX;
+			used[j] = false;
+		}
+
+		do {
+			used[j0] = true;
+			size_t i0 = row_of[j0];
+			int64_t delta = INT64_MAX;
+			size_t j1 = 0;
+			for (size_t j = 1; j <= n; ++j) {
+				if (used[j]) {
+					continue;
+				}
+				int64_t cost = max_weight - match_weight(num_objs, objs,
+					num_res, res, i0 - 1, j - 1);
+				int64_t slack = cost - u[i0] - v[j];
+				if (slack < min_slack[j]) {
+					min_slack[j] = slack;
+					way[j] = j0;
+				}
+				if (min_slack[j] < delta) {
+					delta = min_slack[j];
+					j1 = j;
+				}
+			}
+			for (size_t j = 0; j <= n; ++j) {
+				if (used[j]) {
+					u[row_of[j]] += delta;
+					v[j] -= delta;
+				} else {
+					min_slack[j] -= delta;
+				}
+			}
+			j0 = j1;
+		} while (row_of[j0] != 0);
+
+		// Flip the augmenting path
+		do {
+			size_t j1 = way[j0];
+			row_of[j0] = row_of[j1];
+			j0 = j1;
+		} while (j0 != 0);
+	}
+
+	size_t score = 0;
+	for (size_t j = 1; j <= num_res; ++j) {
+		size_t obj = row_of[j] - 1;
+		if (match_weight(num_objs, objs, num_res, res, obj, j - 1) == 0) {
+			continue;
+		}
+		out[j - 1] = obj;
+		if (objs[obj] != 0) {
+			++score;
+		}
+	}
+	return score;
+}
@@ -24,6 +24,9 @@ static const struct prop_info connector_info[] = {
 	{ "DPMS", INDEX(dpms) },
 	{ "EDID", INDEX(edid) },
 	{ "PATH", INDEX(path) },
+	{ "WRITEBACK_FB_ID", INDEX(writeback_fb_id) },
+	{ "WRITEBACK_OUT_FENCE_PTR", INDEX(writeback_out_fence_ptr) },
+	{ "WRITEBACK_PIXEL_FORMATS", INDEX(writeback_pixel_formats) },
 	{ "content type", INDEX(content_type) },
 	{ "link-status", INDEX(link_status) },
 	{ "non-desktop", INDEX(non_desktop) },
@@ -36,6 +39,7 @@ static const struct prop_info connector_info[] = {
 static const struct prop_info crtc_info[] = {
 #define INDEX(name) (offsetof(union wlr_drm_crtc_props, name) / sizeof(uint32_t))
 	{ "ACTIVE", INDEX(active) },
+	{ "BACKGROUND_COLOR", INDEX(background_color) },
 	{ "GAMMA_LUT", INDEX(gamma_lut) },
 	{ "GAMMA_LUT_SIZE", INDEX(gamma_lut_size) },
 	{ "MODE_ID", INDEX(mode_id) },
@@ -52,13 +56,16 @@ static const struct prop_info plane_info[] = {
 	{ "CRTC_Y", INDEX(crtc_y) },
 	{ "FB_DAMAGE_CLIPS", INDEX(fb_damage_clips) },
 	{ "FB_ID", INDEX(fb_id) },
+	{ "IN_FENCE_FD", INDEX(in_fence_fd) },
 	{ "IN_FORMATS", INDEX(in_formats) },
+	{ "SIZE_HINTS", INDEX(size_hints) },
 	{ "SRC_H", INDEX(src_h) },
 	{ "SRC_W", INDEX(src_w) },
 	{ "SRC_X", INDEX(src_x) },
 	{ "SRC_Y", INDEX(src_y) },
 	{ "rotation", INDEX(rotation) },
 	{ "type", INDEX(type) },
+	{ "zpos", INDEX(zpos) },
 #undef INDEX
 };
 
@@ -181,3 +188,19 @@ char *get_drm_prop_enum(int fd, uint32_t obj, uint32_t prop_id) {
 
 	return str;
 }
+
+bool get_drm_prop_range(int fd, uint32_t prop_id, uint64_t *min, uint64_t *max) {
+	drmModePropertyRes *prop = drmModeGetProperty(fd, prop_id);
+	if (!prop) {
+		return false;
+	}
+
+	bool ok = (prop->flags & DRM_MODE_PROP_RANGE) && prop->count_values == 2;
+	if (ok) {
+		*min = prop->values[0];
+		*max = prop->values[1];
+	}
+
+	drmModeFreeProperty(prop);
+	return ok;
+}
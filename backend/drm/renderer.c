@@ -2,9 +2,11 @@
 #include <assert.h>
 #include <drm_fourcc.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wayland-util.h>
 #include <wlr/render/wlr_renderer.h>
@@ -17,12 +19,16 @@
 #include "render/pixel_format.h"
 #include "render/swapchain.h"
 #include "render/wlr_renderer.h"
+#include "util/time.h"
 
 bool init_drm_renderer(struct wlr_drm_backend *drm,
-		struct wlr_drm_renderer *renderer) {
+		struct wlr_drm_renderer *renderer, struct wlr_renderer *wlr_rend) {
 	renderer->backend = drm;
 
-	renderer->wlr_rend = renderer_autocreate_with_drm_fd(drm->fd);
+	renderer->wlr_rend = wlr_rend;
+	if (renderer->wlr_rend == NULL) {
+		renderer->wlr_rend = renderer_autocreate_with_drm_fd(drm->fd);
+	}
 	if (!renderer->wlr_rend) {
 		wlr_log(WLR_ERROR, "Failed to create renderer");
 		return false;
@@ -54,6 +60,9 @@ static void finish_drm_surface(struct wlr_drm_surface *surf) {
 	}
 
 	wlr_swapchain_destroy(surf->swapchain);
+	for (size_t i = 0; i < WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN; i++) {
+		pixman_region32_fini(&surf->previous[i]);
+	}
 
 	memset(surf, 0, sizeof(*surf));
 }
@@ -76,12 +85,15 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 	}
 
 	surf->renderer = renderer;
+	for (size_t i = 0; i < WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN; i++) {
+		pixman_region32_init(&surf->previous[i]);
+	}
 
 	return true;
 }
 
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
-		struct wlr_buffer *buffer) {
+		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
 	struct wlr_renderer *renderer = surf->renderer->wlr_rend;
 
 	if (surf->swapchain->width != buffer->width ||
@@ -95,29 +107,78 @@ struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
 		return NULL;
 	}
 
-	struct wlr_buffer *dst = wlr_swapchain_acquire(surf->swapchain, NULL);
+	int age;
+	struct wlr_buffer *dst = wlr_swapchain_acquire(surf->swapchain, &age);
 	if (!dst) {
 		wlr_texture_destroy(tex);
 		return NULL;
 	}
 
-	float mat[9];
-	wlr_matrix_identity(mat);
-	wlr_matrix_scale(mat, surf->swapchain->width, surf->swapchain->height);
-
-	if (!wlr_renderer_begin_with_buffer(renderer, dst)) {
-		wlr_buffer_unlock(dst);
-		wlr_texture_destroy(tex);
-		return NULL;
+	pixman_region32_t full;
+	pixman_region32_init_rect(&full, 0, 0, buffer->width, buffer->height);
+	if (damage == NULL) {
+		damage = &full;
 	}
 
-	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
-	wlr_render_texture_with_matrix(renderer, tex, mat, 1.0f);
+	// The destination already holds the frame from age blits ago, only the
+	// damage accumulated since then needs copying
+	pixman_region32_t copy;
+	pixman_region32_init(&copy);
+	bool full_copy = surf->previous_invalid || age <= 0 ||
+		age > WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN + 1;
+	if (full_copy) {
+		pixman_region32_copy(&copy, &full);
+	} else {
+		pixman_region32_intersect(&copy, damage, &full);
+		for (int i = 0; i < age - 1; i++) {
+			size_t j = (surf->previous_idx + WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN
+				- i) % WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN;
+			pixman_region32_union(&copy, &copy, &surf->previous[j]);
+		}
+	}
 
-	wlr_renderer_end(renderer);
+	struct wlr_render_op ops[] = {
+		{
+			.type = WLR_RENDER_OP_CLEAR,
+			.clip = &copy,
+			.clear.color = { 0.0, 0.0, 0.0, 0.0 },
+		},
+		{
+			.type = WLR_RENDER_OP_TEXTURE,
+			.clip = &copy,
+			.texture = {
+				.texture = tex,
+				.src_box = { .width = tex->width, .height = tex->height },
+				.alpha = 1.0,
+			},
+		},
+	};
+	wlr_matrix_identity(ops[1].texture.matrix);
+	wlr_matrix_scale(ops[1].texture.matrix, surf->swapchain->width,
+		surf->swapchain->height);
+
+	bool ok = wlr_renderer_begin_with_buffer(renderer, dst);
+	if (ok) {
+		wlr_renderer_submit_ops(renderer, ops, sizeof(ops) / sizeof(ops[0]));
+		wlr_renderer_end(renderer);
+
+		surf->previous_idx = (surf->previous_idx + 1) %
+			WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN;
+		// After skipped frames, the other swapchain buffers need a full copy
+		// too
+		pixman_region32_intersect(&surf->previous[surf->previous_idx],
+			surf->previous_invalid ? &full : damage, &full);
+		surf->previous_invalid = false;
+	}
 
+	pixman_region32_fini(&copy);
+	pixman_region32_fini(&full);
 	wlr_texture_destroy(tex);
 
+	if (!ok) {
+		wlr_buffer_unlock(dst);
+		return NULL;
+	}
 	return dst;
 }
 
@@ -177,7 +238,10 @@ struct wlr_drm_format *drm_plane_pick_render_format(
 		return NULL;
 	}
 
-	return format;
+	// Blit into compressed or tiled buffers when both GPUs support them
+	struct wlr_drm_format *preferred = wlr_drm_format_pick_preferred(format);
+	free(format);
+	return preferred;
 }
 
 void drm_fb_clear(struct wlr_drm_fb **fb_ptr) {
@@ -191,9 +255,32 @@ void drm_fb_clear(struct wlr_drm_fb **fb_ptr) {
 	*fb_ptr = NULL;
 }
 
+static void fb_cache_insert(struct wlr_drm_backend *drm,
+		struct wlr_drm_fb *fb) {
+	assert(fb->wlr_buf == NULL);
+	wl_list_insert(&drm->fb_cache, &fb->link);
+	drm->fb_cache_len++;
+
+	// Cached FBs keep their BO alive, so the cache is kept small
+	if (drm->fb_cache_len > WLR_DRM_FB_CACHE_SIZE) {
+		struct wlr_drm_fb *oldest =
+			wl_container_of(drm->fb_cache.prev, oldest, link);
+		drm_fb_destroy(oldest);
+	}
+}
+
 static void drm_fb_handle_destroy(struct wlr_addon *addon) {
 	struct wlr_drm_fb *fb = wl_container_of(addon, fb, addon);
-	drm_fb_destroy(fb);
+	if (!fb->has_key) {
+		drm_fb_destroy(fb);
+		return;
+	}
+
+	// Keep the FB around in case the DMA-BUF is imported again
+	wl_list_remove(&fb->link);
+	wlr_addon_finish(&fb->addon);
+	fb->wlr_buf = NULL;
+	fb_cache_insert(fb->backend, fb);
 }
 
 static const struct wlr_addon_interface fb_addon_impl = {
@@ -302,28 +389,95 @@ static void poison_buffer(struct wlr_drm_backend *drm,
 		return;
 	}
 	wlr_addon_init(addon, &buf->addons, drm, &poisoned_fb_addon_impl);
+	buf->scanout = WLR_BUFFER_SCANOUT_INCAPABLE;
 	wlr_log(WLR_DEBUG, "Poisoning buffer");
 }
 
-static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
-		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats) {
-	struct wlr_dmabuf_attributes attribs;
-	if (!wlr_buffer_get_dmabuf(buf, &attribs)) {
-		wlr_log(WLR_DEBUG, "Failed to get DMA-BUF from buffer");
-		return NULL;
+static bool fb_key_init(struct wlr_drm_fb_key *key,
+		const struct wlr_dmabuf_attributes *attribs) {
+	// Padding is compared as well
+	memset(key, 0, sizeof(*key));
+	key->format = attribs->format;
+	key->modifier = attribs->modifier;
+	key->width = attribs->width;
+	key->height = attribs->height;
+	key->n_planes = attribs->n_planes;
+	for (int i = 0; i < attribs->n_planes; i++) {
+		// DMA-BUFs have unique inode numbers
+		struct stat st;
+		if (fstat(attribs->fd[i], &st) != 0) {
+			wlr_log_errno(WLR_DEBUG, "fstat failed");
+			return false;
+		}
+		key->ino[i] = st.st_ino;
+		key->offset[i] = attribs->offset[i];
+		key->stride[i] = attribs->stride[i];
+	}
+	return true;
+}
+
+// Struct assignment doesn't preserve padding bytes, compare field by field
+static bool fb_key_equal(const struct wlr_drm_fb_key *a,
+		const struct wlr_drm_fb_key *b) {
+	if (a->format != b->format || a->width != b->width ||
+			a->height != b->height || a->modifier != b->modifier ||
+			a->n_planes != b->n_planes) {
+		return false;
+	}
+	for (int i = 0; i < a->n_planes; i++) {
+		if (a->offset[i] != b->offset[i] || a->stride[i] != b->stride[i] ||
+				a->ino[i] != b->ino[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct wlr_drm_fb *fb_cache_take(struct wlr_drm_backend *drm,
+		const struct wlr_drm_fb_key *key) {
+	struct wlr_drm_fb *fb;
+	wl_list_for_each(fb, &drm->fb_cache, link) {
+		if (fb_key_equal(&fb->key, key)) {
+			wl_list_remove(&fb->link);
+			drm->fb_cache_len--;
+			return fb;
+		}
+	}
+	return NULL;
+}
+
+static void fb_stats_update(struct wlr_drm_backend *drm) {
+	uint32_t now = get_current_time_msec();
+	uint32_t elapsed = now - drm->fb_stats.since_msec;
+	if (elapsed < 1000) {
+		return;
 	}
 
+	if (drm->fb_stats.hits + drm->fb_stats.misses > 0) {
+		wlr_log(WLR_DEBUG, "%s: FB cache: %"PRIu64" hits, %"PRIu64" misses, "
+			"%.1f imports/s", drm->name, drm->fb_stats.hits,
+			drm->fb_stats.misses,
+			(double)drm->fb_stats.imports * 1000 / elapsed);
+	}
+	drm->fb_stats.hits = drm->fb_stats.misses = drm->fb_stats.imports = 0;
+	drm->fb_stats.since_msec = now;
+}
+
+static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
+		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats) {
 	if (is_buffer_poisoned(drm, buf)) {
 		wlr_log(WLR_DEBUG, "Buffer is poisoned");
 		return NULL;
 	}
 
-	struct wlr_drm_fb *fb = calloc(1, sizeof(*fb));
-	if (!fb) {
-		wlr_log_errno(WLR_ERROR, "Allocation failed");
+	struct wlr_dmabuf_attributes attribs;
+	if (!wlr_buffer_get_dmabuf(buf, &attribs)) {
+		wlr_log(WLR_DEBUG, "Failed to get DMA-BUF from buffer");
 		return NULL;
 	}
 
+	struct wlr_drm_fb *fb = NULL;
+
 	if (formats && !wlr_drm_format_set_has(formats, attribs.format,
 			attribs.modifier)) {
 		// The format isn't supported by the plane. Try stripping the alpha
@@ -341,6 +495,34 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 		}
 	}
 
+	fb_stats_update(drm);
+
+	struct wlr_drm_fb_key key;
+	bool has_key = fb_key_init(&key, &attribs);
+	if (has_key) {
+		fb = fb_cache_take(drm, &key);
+	}
+	if (fb != NULL) {
+		drm->fb_stats.hits++;
+		if (fb->id == 0) {
+			// Failed to import this DMA-BUF before
+			fb_cache_insert(drm, fb);
+			poison_buffer(drm, buf);
+			return NULL;
+		}
+		goto out;
+	}
+	drm->fb_stats.misses++;
+
+	fb = calloc(1, sizeof(*fb));
+	if (!fb) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	fb->backend = drm;
+	fb->has_key = has_key;
+	fb->key = key;
+
 	uint32_t handles[4] = {0};
 	for (int i = 0; i < attribs.n_planes; ++i) {
 		int ret = drmPrimeFDToHandle(drm->fd, attribs.fd[i], &handles[i]);
@@ -351,19 +533,24 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 	}
 
 	fb->id = get_fb_for_bo(drm, &attribs, handles);
+	close_all_bo_handles(drm, handles);
 	if (!fb->id) {
 		wlr_log(WLR_DEBUG, "Failed to import BO in KMS");
 		poison_buffer(drm, buf);
-		goto error_bo_handle;
+		if (fb->has_key) {
+			// Remember the failure in case the DMA-BUF is imported again
+			fb_cache_insert(drm, fb);
+			return NULL;
+		}
+		goto error_fb;
 	}
+	drm->fb_stats.imports++;
 
-	close_all_bo_handles(drm, handles);
-
-	fb->backend = drm;
+out:
 	fb->wlr_buf = buf;
-
 	wlr_addon_init(&fb->addon, &buf->addons, drm, &fb_addon_impl);
 	wl_list_insert(&drm->fbs, &fb->link);
+	buf->scanout = WLR_BUFFER_SCANOUT_CAPABLE;
 
 	return fb;
 
@@ -378,15 +565,27 @@ void drm_fb_destroy(struct wlr_drm_fb *fb) {
 	struct wlr_drm_backend *drm = fb->backend;
 
 	wl_list_remove(&fb->link);
-	wlr_addon_finish(&fb->addon);
+	if (fb->wlr_buf != NULL) {
+		wlr_addon_finish(&fb->addon);
+	} else {
+		drm->fb_cache_len--;
+	}
 
-	if (drmModeRmFB(drm->fd, fb->id) != 0) {
+	if (fb->id != 0 && drmModeRmFB(drm->fd, fb->id) != 0) {
 		wlr_log(WLR_ERROR, "drmModeRmFB failed");
 	}
 
 	free(fb);
 }
 
+void drm_fb_cache_finish(struct wlr_drm_backend *drm) {
+	struct wlr_drm_fb *fb, *fb_tmp;
+	wl_list_for_each_safe(fb, fb_tmp, &drm->fb_cache, link) {
+		drm_fb_destroy(fb);
+	}
+	assert(drm->fb_cache_len == 0);
+}
+
 bool drm_fb_import(struct wlr_drm_fb **fb_ptr, struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats) {
 	struct wlr_drm_fb *fb;
@@ -405,6 +604,23 @@ bool drm_fb_import(struct wlr_drm_fb **fb_ptr, struct wlr_drm_backend *drm,
 	return true;
 }
 
+bool drm_fb_check_import(struct wlr_drm_backend *drm, struct wlr_buffer *buf) {
+	if (wlr_addon_find(&buf->addons, drm, &fb_addon_impl) != NULL) {
+		return true;
+	}
+
+	struct wlr_drm_fb *fb = drm_fb_create(drm, buf, NULL);
+	if (fb == NULL) {
+		return false;
+	}
+
+	// Don't tie the FB to this buffer: buffers are often wrapped before
+	// being committed, e.g. in a wlr_client_buffer. Keep it in the cache so
+	// that the import of the wrapper picks it up.
+	drm_fb_handle_destroy(&fb->addon);
+	return true;
+}
+
 void drm_fb_move(struct wlr_drm_fb **new, struct wlr_drm_fb **old) {
 	drm_fb_clear(new);
 	*new = *old;
@@ -0,0 +1,227 @@
+#include <string.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include "backend/drm/drm.h"
+#include "backend/drm/iface.h"
+
+/*
+ * Cache of test-only atomic commit outcomes. The kernel's answer only depends
+ * on the KMS state a commit results in, so configurations which have already
+ * been tested (e.g. when output_ensure_buffer() retries without modifiers, or
+ * when trying plane assignments every frame) don't need another ioctl.
+ *
+ * The results also depend on the state of the other CRTCs (bandwidth, shared
+ * resources), so the whole backend is invalidated on modesets, hotplug and
+ * session changes. Granting or revoking a lease doesn't change the KMS state
+ * of any CRTC, so it only invalidates the leased connectors.
+ */
+
+static void plane_key_from_buffer(struct wlr_drm_test_plane *plane,
+		struct wlr_buffer *buffer) {
+	struct wlr_dmabuf_attributes attribs;
+	if (wlr_buffer_get_dmabuf(buffer, &attribs)) {
+		plane->format = attribs.format;
+		plane->modifier = attribs.modifier;
+		plane->stride = attribs.stride[0];
+	}
+	plane->fb = true;
+	plane->width = buffer->width;
+	plane->height = buffer->height;
+}
+
+static void plane_key_from_fb(struct wlr_drm_test_plane *plane,
+		struct wlr_drm_fb *fb) {
+	if (fb != NULL) {
+		plane_key_from_buffer(plane, fb->wlr_buf);
+	}
+}
+
+static void geometry_key_from_plane(struct wlr_drm_test_geometry *key,
+		const struct wlr_drm_plane *plane) {
+	const struct wlr_drm_plane_geometry *geometry = plane->pending_fb != NULL ?
+		&plane->pending_geometry : &plane->geometry;
+	if (!geometry->set) {
+		return;
+	}
+	key->set = true;
+	key->src_x = (uint64_t)(geometry->src.x * 65536);
+	key->src_y = (uint64_t)(geometry->src.y * 65536);
+	key->src_w = (uint64_t)(geometry->src.width * 65536);
+	key->src_h = (uint64_t)(geometry->src.height * 65536);
+	key->dst_x = geometry->dst.x;
+	key->dst_y = geometry->dst.y;
+	key->dst_w = geometry->dst.width;
+	key->dst_h = geometry->dst.height;
+	key->transform = geometry->transform;
+}
+
+bool drm_test_cache_get_key(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state, uint32_t flags,
+		struct wlr_drm_test_key *key) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	const struct wlr_output_state *base = state->base;
+
+	// Legacy tests don't hit the kernel
+	if (drm->iface != &atomic_iface || crtc == NULL ||
+			crtc->overlays_len > WLR_DRM_TEST_MAX_OVERLAYS) {
+		return false;
+	}
+
+	// Fields which don't apply are compared as well
+	memset(key, 0, sizeof(*key));
+	key->seq = drm->test_cache_seq;
+	key->crtc_id = crtc->id;
+	key->flags = flags;
+	key->modeset = state->modeset;
+	key->active = state->active;
+	if (!state->active) {
+		return true;
+	}
+	key->mode = state->mode;
+	// The name isn't part of the KMS state, nor necessarily NUL-padded
+	memset(key->mode.name, 0, sizeof(key->mode.name));
+
+	key->vrr_enabled = conn->output.adaptive_sync_status ==
+		WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+	if (base->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) {
+		key->vrr_enabled = base->adaptive_sync_enabled;
+	}
+
+	key->gamma_lut = crtc->gamma_lut != 0;
+	if (base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
+		key->gamma_lut = base->gamma_lut_size > 0;
+	}
+
+	plane_key_from_fb(&key->primary, plane_get_next_fb(crtc->primary));
+	geometry_key_from_plane(&key->primary_geometry, crtc->primary);
+	if (crtc->cursor != NULL && drm_connector_is_cursor_visible(conn)) {
+		plane_key_from_fb(&key->cursor, plane_get_next_fb(crtc->cursor));
+	}
+
+	if (base->committed & WLR_OUTPUT_STATE_CAPTURE) {
+		plane_key_from_buffer(&key->capture, base->capture_buffer);
+		// Routing the writeback connector requires a modeset
+		struct wlr_drm_writeback *writeback =
+			drm_connector_find_writeback(conn, base->capture_buffer);
+		if (writeback != NULL) {
+			key->writeback_crtc_id = writeback->crtc_id;
+		}
+	}
+
+	if (base->committed & WLR_OUTPUT_STATE_LAYERS) {
+		key->layers = true;
+		for (size_t i = 0; i < crtc->overlays_len; i++) {
+			struct wlr_drm_plane *plane = crtc->overlays[i];
+			if (plane->pending_fb == NULL) {
+				continue;
+			}
+			struct wlr_drm_test_plane *plane_key = &key->overlays[i];
+			plane_key_from_fb(plane_key, plane->pending_fb);
+			plane_key->x = base->layers[i].x;
+			plane_key->y = base->layers[i].y;
+		}
+	} else {
+		// Overlay planes are left as they are, the result depends on what
+		// was last committed to them
+		key->overlays_seq = conn->overlays_seq;
+	}
+
+	return true;
+}
+
+static bool test_plane_equal(const struct wlr_drm_test_plane *a,
+		const struct wlr_drm_test_plane *b) {
+	return a->fb == b->fb && a->format == b->format &&
+		a->modifier == b->modifier && a->width == b->width &&
+		a->height == b->height && a->stride == b->stride &&
+		a->x == b->x && a->y == b->y;
+}
+
+static bool test_geometry_equal(const struct wlr_drm_test_geometry *a,
+		const struct wlr_drm_test_geometry *b) {
+	return a->set == b->set && a->src_x == b->src_x && a->src_y == b->src_y &&
+		a->src_w == b->src_w && a->src_h == b->src_h &&
+		a->dst_x == b->dst_x && a->dst_y == b->dst_y &&
+		a->dst_w == b->dst_w && a->dst_h == b->dst_h &&
+		a->transform == b->transform;
+}
+
+static bool test_mode_equal(const drmModeModeInfo *a,
+		const drmModeModeInfo *b) {
+	return a->clock == b->clock &&
+		a->hdisplay == b->hdisplay && a->hsync_start == b->hsync_start &&
+		a->hsync_end == b->hsync_end && a->htotal == b->htotal &&
+		a->hskew == b->hskew &&
+		a->vdisplay == b->vdisplay && a->vsync_start == b->vsync_start &&
+		a->vsync_end == b->vsync_end && a->vtotal == b->vtotal &&
+		a->vscan == b->vscan && a->vrefresh == b->vrefresh &&
+		a->flags == b->flags && a->type == b->type;
+}
+
+static bool test_key_equal(const struct wlr_drm_test_key *a,
+		const struct wlr_drm_test_key *b) {
+	if (a->seq != b->seq || a->crtc_id != b->crtc_id ||
+			a->flags != b->flags || a->modeset != b->modeset ||
+			a->active != b->active || !test_mode_equal(&a->mode, &b->mode) ||
+			a->vrr_enabled != b->vrr_enabled ||
+			a->gamma_lut != b->gamma_lut ||
+			!test_plane_equal(&a->primary, &b->primary) ||
+			!test_plane_equal(&a->cursor, &b->cursor) ||
+			!test_geometry_equal(&a->primary_geometry, &b->primary_geometry) ||
+			!test_plane_equal(&a->capture, &b->capture) ||
+			a->writeback_crtc_id != b->writeback_crtc_id ||
+			a->layers != b->layers || a->overlays_seq != b->overlays_seq) {
+		return false;
+	}
+	for (size_t i = 0; i < WLR_DRM_TEST_MAX_OVERLAYS; i++) {
+		if (!test_plane_equal(&a->overlays[i], &b->overlays[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool drm_test_cache_lookup(struct wlr_drm_connector *conn,
+		const struct wlr_drm_test_key *key, bool *ok) {
+	++conn->test_cache_counter;
+	for (size_t i = 0; i < WLR_DRM_TEST_CACHE_SIZE; i++) {
+		struct wlr_drm_test_entry *entry = &conn->test_cache[i];
+		if (entry->last_used != 0 && test_key_equal(&entry->key, key)) {
+			entry->last_used = conn->test_cache_counter;
+			*ok = entry->ok;
+			return true;
+		}
+	}
+	return false;
+}
+
+void drm_test_cache_insert(struct wlr_drm_connector *conn,
+		const struct wlr_drm_test_key *key, bool ok) {
+	// Replace the least recently used entry, stale ones first
+	struct wlr_drm_test_entry *lru = &conn->test_cache[0];
+	for (size_t i = 0; i < WLR_DRM_TEST_CACHE_SIZE; i++) {
+		struct wlr_drm_test_entry *entry = &conn->test_cache[i];
+		if (entry->last_used == 0 || entry->key.seq != key->seq) {
+			lru = entry;
+			break;
+		}
+		if (entry->last_used < lru->last_used) {
+			lru = entry;
+		}
+	}
+
+	lru->key = *key;
+	lru->ok = ok;
+	lru->last_used = ++conn->test_cache_counter;
+}
+
+void drm_test_cache_invalidate(struct wlr_drm_backend *drm) {
+	// Entries with an older sequence number never match again
+	++drm->test_cache_seq;
+}
+
+void drm_test_cache_invalidate_connector(struct wlr_drm_connector *conn) {
+	memset(conn->test_cache, 0, sizeof(conn->test_cache));
+}
@@ -63,51 +63,129 @@ static const char *get_manufacturer(struct udev_hwdb *hwdb, uint16_t code) {
 /* See https://en.wikipedia.org/wiki/Extended_Display_Identification_Data for layout of EDID data.
  * We don't parse the EDID properly. We just expect to receive valid data.
  */
-void parse_edid(struct wlr_drm_connector *conn, size_t len, const uint8_t *data) {
-	struct wlr_output *output = &conn->output;
+static uint64_t hash_edid(size_t len, const uint8_t *data) {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ data[i]) * 0x100000001b3;
+	}
+	return hash != 0 ? hash : 1;
+}
 
-	free(output->make);
-	free(output->model);
-	free(output->serial);
-	output->make = NULL;
-	output->model = NULL;
-	output->serial = NULL;
+static void parse_detailed_timing(struct wlr_drm_edid_info *info,
+		const uint8_t *dtd) {
+	uint32_t clock = dtd[0] | (dtd[1] << 8); // 10kHz
+	if (clock == 0 || info->timings_len == WLR_DRM_EDID_TIMINGS_CAP) {
+		return;
+	}
 
-	if (!data || len < 128) {
+	int32_t hactive = dtd[2] | ((dtd[4] & 0xF0) << 4);
+	int32_t hblank = dtd[3] | ((dtd[4] & 0x0F) << 8);
+	int32_t vactive = dtd[5] | ((dtd[7] & 0xF0) << 4);
+	int32_t vblank = dtd[6] | ((dtd[7] & 0x0F) << 8);
+	int64_t htotal = hactive + hblank, vtotal = vactive + vblank;
+	if (htotal == 0 || vtotal == 0) {
 		return;
 	}
 
+	struct wlr_drm_edid_timing *timing = &info->timings[info->timings_len++];
+	timing->width = hactive;
+	timing->height = vactive;
+	timing->refresh = (clock * 10000000LL + htotal * vtotal / 2) /
+		(htotal * vtotal);
+	if (dtd[17] & 0x80) { // interlaced
+		timing->height *= 2;
+		timing->refresh *= 2;
+	}
+}
+
+static void parse_cta_extension(struct wlr_drm_edid_info *info,
+		const uint8_t *ext) {
+	// Data blocks are located between byte 4 and the first detailed timing
+	uint8_t dtd_offset = ext[2];
+	if (dtd_offset < 4 || dtd_offset > 127) {
+		return;
+	}
+
+	for (size_t i = 4; i < dtd_offset;) {
+		uint8_t tag = ext[i] >> 5;
+		uint8_t len = ext[i] & 0x1F;
+		const uint8_t *payload = &ext[i + 1];
+		if (i + 1 + len > dtd_offset) {
+			break;
+		}
+
+		// Extended tag 6: HDR static metadata data block
+		if (tag == 7 && len >= 3 && payload[0] == 0x06) {
+			info->hdr.present = true;
+			info->hdr.eotfs = payload[1];
+			info->hdr.descriptors = payload[2];
+			if (len >= 4) {
+				info->hdr.max_luminance = payload[3];
+			}
+			if (len >= 5) {
+				info->hdr.max_frame_avg_luminance = payload[4];
+			}
+			if (len >= 6) {
+				info->hdr.min_luminance = payload[5];
+			}
+		}
+
+		i += 1 + len;
+	}
+
+	for (size_t i = dtd_offset; i + 18 <= 127; i += 18) {
+		parse_detailed_timing(info, &ext[i]);
+	}
+}
+
+static void parse_edid_info(struct wlr_drm_edid_info *info,
+		struct udev_hwdb *hwdb, size_t len, const uint8_t *data) {
 	uint16_t id = (data[8] << 8) | data[9];
-	output->make = strdup(get_manufacturer(conn->backend->hwdb, id));
+	snprintf(info->make, sizeof(info->make), "%s",
+		get_manufacturer(hwdb, id));
 
 	uint16_t model = data[10] | (data[11] << 8);
-	char model_str[32];
-	snprintf(model_str, sizeof(model_str), "0x%04" PRIX16, model);
+	snprintf(info->model, sizeof(info->model), "0x%04" PRIX16, model);
 
 	uint32_t serial = data[12] | (data[13] << 8) | (data[14] << 8) | (data[15] << 8);
-	char serial_str[32];
 	if (serial != 0) {
-		snprintf(serial_str, sizeof(serial_str), "0x%08" PRIX32, serial);
-	} else {
-		serial_str[0] = '\0';
+		snprintf(info->serial, sizeof(info->serial), "0x%08" PRIX32, serial);
 	}
 
-	for (size_t i = 72; i <= 108; i += 18) {
+	// The first descriptor holds the preferred timing
+	for (size_t i = 54; i <= 108; i += 18) {
 		uint16_t flag = (data[i] << 8) | data[i + 1];
-		if (flag == 0 && data[i + 3] == 0xFC) {
-			snprintf(model_str, sizeof(model_str), "%.13s", &data[i + 5]);
+		if (flag != 0) {
+			parse_detailed_timing(info, &data[i]);
+		} else if (i == 54) {
+			continue;
+		} else if (data[i + 3] == 0xFC) {
+			snprintf(info->model, sizeof(info->model), "%.13s", &data[i + 5]);
 
 			// Monitor names are terminated by newline if they're too short
-			char *nl = strchr(model_str, '\n');
+			char *nl = strchr(info->model, '\n');
 			if (nl) {
 				*nl = '\0';
 			}
-		} else if (flag == 0 && data[i + 3] == 0xFF) {
-			snprintf(serial_str, sizeof(serial_str), "%.13s", &data[i + 5]);
+		} else if (data[i + 3] == 0xFD) {
+			// Display range limits, the offset flags were added in EDID 1.4
+			int min_vrate = data[i + 5];
+			int max_vrate = data[i + 6];
+			if ((data[i + 4] & 0x3) == 0x3) {
+				min_vrate += 255;
+			}
+			if (data[i + 4] & 0x2) {
+				max_vrate += 255;
+			}
+			info->vrr_min_refresh = min_vrate * 1000;
+			info->vrr_max_refresh = max_vrate * 1000;
+		} else if (data[i + 3] == 0xFF) {
+			snprintf(info->serial, sizeof(info->serial), "%.13s", &data[i + 5]);
 
 			// Monitor serial numbers are terminated by newline if they're too
 			// short
-			char* nl = strchr(serial_str, '\n');
+			char* nl = strchr(info->serial, '\n');
 
 			if (nl) {
 				*nl = '\0';
@@ -115,12 +193,63 @@ void parse_edid(struct wlr_drm_connector *conn, size_t len, const uint8_t *data)
 		}
 	}
 
-	output->model = strdup(model_str);
-	if (serial_str[0] != '\0') {
-		output->serial = strdup(serial_str);
+	size_t exts = data[126];
+	for (size_t i = 1; i <= exts && (i + 1) * 128 <= len; i++) {
+		const uint8_t *ext = &data[i * 128];
+		if (ext[0] == 0x02) { // CTA-861
+			parse_cta_extension(info, ext);
+		}
 	}
 }
 
+void parse_edid(struct wlr_drm_connector *conn, size_t len, const uint8_t *data) {
+	struct wlr_output *output = &conn->output;
+	struct wlr_drm_edid_info *info = &conn->edid_info;
+
+	free(output->make);
+	free(output->model);
+	free(output->serial);
+	output->make = NULL;
+	output->model = NULL;
+	output->serial = NULL;
+	output->adaptive_sync_min_refresh = 0;
+	output->adaptive_sync_max_refresh = 0;
+
+	if (!data || len < 128) {
+		*info = (struct wlr_drm_edid_info){0};
+		return;
+	}
+
+	// Monitors are often re-plugged, and the kernel creates a new blob on
+	// each probe: only parse again if the contents changed
+	uint64_t hash = hash_edid(len, data);
+	if (info->hash != hash) {
+		*info = (struct wlr_drm_edid_info){ .hash = hash };
+		parse_edid_info(info, conn->backend->hwdb, len, data);
+
+		for (size_t i = 0; i < info->timings_len; i++) {
+			const struct wlr_drm_edid_timing *timing = &info->timings[i];
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"EDID timing: %"PRId32"x%"PRId32"@%"PRId32"%s",
+				timing->width, timing->height, timing->refresh,
+				i == 0 ? " (preferred)" : "");
+		}
+		if (info->hdr.present) {
+			wlr_drm_conn_log(conn, WLR_DEBUG, "EDID HDR static metadata: "
+				"EOTFs 0x%02"PRIX8", max luminance %"PRIu8, info->hdr.eotfs,
+				info->hdr.max_luminance);
+		}
+	}
+
+	output->make = strdup(info->make);
+	output->model = strdup(info->model);
+	if (info->serial[0] != '\0') {
+		output->serial = strdup(info->serial);
+	}
+	output->adaptive_sync_min_refresh = info->vrr_min_refresh;
+	output->adaptive_sync_max_refresh = info->vrr_max_refresh;
+}
+
 const char *conn_get_name(uint32_t type_id) {
 	switch (type_id) {
 	case DRM_MODE_CONNECTOR_Unknown:     return "Unknown";
@@ -151,149 +280,3 @@ const char *conn_get_name(uint32_t type_id) {
 	default:                             return "Unknown";
 	}
 }
-
-static bool is_taken(size_t n, const uint32_t arr[static n], uint32_t key) {
-	for (size_t i = 0; i < n; ++i) {
-		if (arr[i] == key) {
-			return true;
-		}
-	}
-	return false;
-}
-
-/*
- * Store all of the non-recursive state in a struct, so we aren't literally
- * passing 12 arguments to a function.
- */
-struct match_state {
-	const size_t num_objs;
-	const uint32_t *restrict objs;
-	const size_t num_res;
-	size_t score;
-	size_t replaced;
-	uint32_t *restrict res;
-	uint32_t *restrict best;
-	const uint32_t *restrict orig;
-	bool exit_early;
-};
-
-/*
- * skips: The number of SKIP elements encountered so far.
- * score: The number of resources we've matched so far.
- * replaced: The number of changes from the original solution.
- * i: The index of the current element.
- *
- * This tries to match a solution as close to st->orig as it can.
- *
- * Returns whether we've set a new best element with this solution.
- */
-static bool match_obj_(struct match_state *st, size_t skips, size_t score, size_t replaced, size_t i) {
-	// Finished
-	if (i >= st->num_res) {
-		if (score > st->score ||
-				(score == st->score && replaced < st->replaced)) {
-			st->score = score;
-			st->replaced = replaced;
-			memcpy(st->best, st->res, sizeof(st->best[0]) * st->num_res);
-
-			st->exit_early = (st->score == st->num_res - skips
-					|| st->score == st->num_objs)
-					&& st->replaced == 0;
-
-			return true;
-		} else {
-			return false;
-		}
-	}
-
-	if (st->orig[i] == SKIP) {
-		st->res[i] = SKIP;
-		return match_obj_(st, skips + 1, score, replaced, i + 1);
-	}
-
-	bool has_best = false;
-
-	/*
-	 * Attempt to use the current solution first, to try and avoid
-	 * recalculating everything
-	 */
-	if (st->orig[i] != UNMATCHED && !is_taken(i, st->res, st->orig[i])) {
-		st->res[i] = st->orig[i];
-		size_t obj_score = st->objs[st->res[i]] != 0 ? 1 : 0;
-		if (match_obj_(st, skips, score + obj_score, replaced, i + 1)) {
-			has_best = true;
-		}
-	}
-	if (st->orig[i] == UNMATCHED) {
-		st->res[i] = UNMATCHED;
-		if (match_obj_(st, skips, score, replaced, i + 1)) {
-			has_best = true;
-		}
-	}
-	if (st->exit_early) {
-		return true;
-	}
-
-	if (st->orig[i] != UNMATCHED) {
-		++replaced;
-	}
-
-	for (size_t candidate = 0; candidate < st->num_objs; ++candidate) {
-		// We tried this earlier
-		if (candidate == st->orig[i]) {
-			continue;
-		}
-
-		// Not compatible
-		if (!(st->objs[candidate] & (1 << i))) {
-			continue;
-		}
-
-		// Already taken
-		if (is_taken(i, st->res, candidate)) {
-			continue;
-		}
-
-		st->res[i] = candidate;
-		size_t obj_score = st->objs[candidate] != 0 ? 1 : 0;
-		if (match_obj_(st, skips, score + obj_score, replaced, i + 1)) {
-			has_best = true;
-		}
-
-		if (st->exit_early) {
-			return true;
-		}
-	}
-
-	if (has_best) {
-		return true;
-	}
-
-	// Maybe this resource can't be matched
-	st->res[i] = UNMATCHED;
-	return match_obj_(st, skips, score, replaced, i + 1);
-}
-
-size_t match_obj(size_t num_objs, const uint32_t objs[static restrict num_objs],
-		size_t num_res, const uint32_t res[static restrict num_res],
-		uint32_t out[static restrict num_res]) {
-	uint32_t solution[num_res];
-	for (size_t i = 0; i < num_res; ++i) {
-		solution[i] = UNMATCHED;
-	}
-
-	struct match_state st = {
-		.num_objs = num_objs,
-		.num_res = num_res,
-		.score = 0,
-		.replaced = SIZE_MAX,
-		.objs = objs,
-		.res = solution,
-		.best = out,
-		.orig = res,
-		.exit_early = false,
-	};
-
-	match_obj_(&st, 0, 0, 0, 0);
-	return st.score;
-}
@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/util/log.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "backend/drm/drm.h"
+#include "backend/drm/renderer.h"
+
+/*
+ * Writeback connectors capture the output of a CRTC after blending, so that
+ * screen capture includes the cursor and overlay planes without any
+ * composition. The connector is routed to the CRTC being captured, and a FB
+ * is attached to each atomic commit which should be captured. The kernel
+ * signals an out-fence once the frame has been written.
+ */
+
+struct wlr_drm_writeback *drm_writeback_create(struct wlr_drm_backend *drm,
+		uint32_t id, uint32_t possible_crtcs) {
+	struct wlr_drm_writeback *writeback = calloc(1, sizeof(*writeback));
+	if (writeback == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	writeback->backend = drm;
+	writeback->id = id;
+	writeback->possible_crtcs = possible_crtcs;
+
+	if (!get_drm_connector_props(drm->fd, id, &writeback->props) ||
+			writeback->props.crtc_id == 0 ||
+			writeback->props.writeback_fb_id == 0 ||
+			writeback->props.writeback_out_fence_ptr == 0) {
+		wlr_log(WLR_ERROR, "Writeback connector %"PRIu32" is missing "
+			"properties", id);
+		free(writeback);
+		return NULL;
+	}
+
+	size_t formats_size = 0;
+	writeback->formats = get_drm_prop_blob(drm->fd, id,
+		writeback->props.writeback_pixel_formats, &formats_size);
+	writeback->formats_len = formats_size / sizeof(uint32_t);
+	if (writeback->formats_len == 0) {
+		wlr_log(WLR_ERROR, "Writeback connector %"PRIu32" has no pixel "
+			"formats", id);
+		free(writeback->formats);
+		free(writeback);
+		return NULL;
+	}
+
+	// The connector may have been left routed by the previous DRM master
+	uint64_t crtc_id;
+	if (get_drm_prop(drm->fd, id, writeback->props.crtc_id, &crtc_id)) {
+		writeback->crtc_id = crtc_id;
+	}
+
+	wl_list_insert(drm->writebacks.prev, &writeback->link);
+	wlr_log(WLR_INFO, "Found writeback connector %"PRIu32" (%zu formats)",
+		id, writeback->formats_len);
+	return writeback;
+}
+
+void drm_writeback_destroy(struct wlr_drm_writeback *writeback) {
+	wl_list_remove(&writeback->link);
+	free(writeback->formats);
+	free(writeback);
+}
+
+static bool writeback_supports_buffer(const struct wlr_drm_writeback *writeback,
+		struct wlr_buffer *buffer) {
+	struct wlr_dmabuf_attributes attribs;
+	if (!wlr_buffer_get_dmabuf(buffer, &attribs)) {
+		return false;
+	}
+
+	// The formats blob doesn't list modifiers, drivers write linear buffers
+	if (attribs.modifier != DRM_FORMAT_MOD_LINEAR &&
+			attribs.modifier != DRM_FORMAT_MOD_INVALID) {
+		return false;
+	}
+
+	for (size_t i = 0; i < writeback->formats_len; i++) {
+		if (writeback->formats[i] == attribs.format) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct wlr_drm_writeback *drm_connector_find_writeback(
+		struct wlr_drm_connector *conn, struct wlr_buffer *buffer) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	if (crtc == NULL) {
+		return NULL;
+	}
+	uint32_t crtc_bit = 1 << (crtc - drm->crtcs);
+
+	// Prefer a connector which is already routed, re-routing is a modeset
+	struct wlr_drm_writeback *writeback, *found = NULL;
+	wl_list_for_each(writeback, &drm->writebacks, link) {
+		if (writeback->pending || !(writeback->possible_crtcs & crtc_bit) ||
+				!writeback_supports_buffer(writeback, buffer)) {
+			continue;
+		}
+		if (writeback->crtc_id == crtc->id) {
+			return writeback;
+		}
+		if (found == NULL || (found->crtc_id != 0 && writeback->crtc_id == 0)) {
+			found = writeback;
+		}
+	}
+	return found;
+}
+
+static void writeback_job_destroy(struct wlr_drm_writeback_job *job) {
+	if (job->event_source != NULL) {
+		wl_event_source_remove(job->event_source);
+	}
+	if (job->out_fence_fd >= 0) {
+		close(job->out_fence_fd);
+	}
+	drm_fb_clear(&job->fb);
+	wl_list_remove(&job->link);
+	free(job);
+}
+
+static void writeback_job_finish(struct wlr_drm_writeback_job *job,
+		bool success) {
+	struct wlr_output *output = &job->conn->output;
+	// Kept alive by the wlr_output_capture
+	struct wlr_buffer *buffer = job->buffer;
+	writeback_job_destroy(job);
+	wlr_output_send_capture_done(output, buffer, success);
+}
+
+static int handle_writeback_fence(int fd, uint32_t mask, void *data) {
+	struct wlr_drm_writeback_job *job = data;
+	writeback_job_finish(job, !(mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)));
+	return 0;
+}
+
+static void handle_writeback_failed(void *data) {
+	struct wlr_drm_writeback_job *job = data;
+	job->event_source = NULL;
+	writeback_job_finish(job, false);
+}
+
+void drm_connector_add_writeback_job(struct wlr_drm_connector *conn,
+		struct wlr_buffer *buffer, struct wlr_drm_fb **fb, int out_fence_fd) {
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(conn->backend->display);
+
+	struct wlr_drm_writeback_job *job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		if (out_fence_fd >= 0) {
+			close(out_fence_fd);
+		}
+		drm_fb_clear(fb);
+		return;
+	}
+
+	job->conn = conn;
+	job->buffer = buffer;
+	job->out_fence_fd = out_fence_fd;
+	drm_fb_move(&job->fb, fb);
+	wl_list_insert(conn->writeback_jobs.prev, &job->link);
+
+	// The capture is only marked as submitted once the commit returns, so
+	// failures must be reported from the event loop
+	if (out_fence_fd >= 0) {
+		job->event_source = wl_event_loop_add_fd(loop, out_fence_fd,
+			WL_EVENT_READABLE, handle_writeback_fence, job);
+	} else {
+		wlr_drm_conn_log(conn, WLR_ERROR, "Missing writeback out-fence");
+	}
+	if (job->event_source == NULL) {
+		job->event_source = wl_event_loop_add_idle(loop,
+			handle_writeback_failed, job);
+	}
+}
+
+void drm_connector_destroy_writeback_jobs(struct wlr_drm_connector *conn) {
+	struct wlr_drm_writeback_job *job, *tmp;
+	wl_list_for_each_safe(job, tmp, &conn->writeback_jobs, link) {
+		writeback_job_destroy(job);
+	}
+}
@@ -68,10 +68,14 @@ static bool output_commit(struct wlr_output *wlr_output,
 			.commit_seq = wlr_output->commit_seq + 1,
 			.presented = true,
 		};
+		if (output->clock == WLR_HEADLESS_OUTPUT_CLOCK_MANUAL) {
+			present_event.when = &output->clock_time;
+			present_event.refresh = 1000000000000 / wlr_output->refresh;
+		}
 		wlr_output_send_present(wlr_output, &present_event);
 	}
 
-	wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+	headless_output_schedule_frame(output);
 
 	return true;
 }
@@ -81,6 +85,9 @@ static void output_destroy(struct wlr_output *wlr_output) {
 		headless_output_from_output(wlr_output);
 	wl_list_remove(&output->link);
 	wl_event_source_remove(output->frame_timer);
+	if (output->frame_idle != NULL) {
+		wl_event_source_remove(output->frame_idle);
+	}
 	free(output);
 }
 
@@ -99,6 +106,63 @@ static int signal_frame(void *data) {
 	return 0;
 }
 
+static void handle_frame_idle(void *data) {
+	struct wlr_headless_output *output = data;
+	output->frame_idle = NULL;
+	wlr_output_send_frame(&output->wlr_output);
+}
+
+void headless_output_schedule_frame(struct wlr_headless_output *output) {
+	switch (output->clock) {
+	case WLR_HEADLESS_OUTPUT_CLOCK_REFRESH:
+		wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+		break;
+	case WLR_HEADLESS_OUTPUT_CLOCK_FREE_RUNNING:
+		if (output->frame_idle == NULL) {
+			struct wl_event_loop *ev =
+				wl_display_get_event_loop(output->backend->display);
+			output->frame_idle =
+				wl_event_loop_add_idle(ev, handle_frame_idle, output);
+		}
+		break;
+	case WLR_HEADLESS_OUTPUT_CLOCK_MANUAL:
+		break;
+	}
+}
+
+void wlr_headless_output_set_clock(struct wlr_output *wlr_output,
+		enum wlr_headless_output_clock clock) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	if (output->clock == clock) {
+		return;
+	}
+
+	wl_event_source_timer_update(output->frame_timer, 0);
+	if (output->frame_idle != NULL) {
+		wl_event_source_remove(output->frame_idle);
+		output->frame_idle = NULL;
+	}
+
+	output->clock = clock;
+	if (output->backend->started) {
+		headless_output_schedule_frame(output);
+	}
+}
+
+void wlr_headless_output_advance_clock(struct wlr_output *wlr_output) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	assert(output->clock == WLR_HEADLESS_OUTPUT_CLOCK_MANUAL);
+
+	int64_t refresh_ns = 1000000000000 / wlr_output->refresh;
+	int64_t nsec = output->clock_time.tv_nsec + refresh_ns;
+	output->clock_time.tv_sec += nsec / 1000000000;
+	output->clock_time.tv_nsec = nsec % 1000000000;
+
+	wlr_output_send_frame(wlr_output);
+}
+
 struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 		unsigned int width, unsigned int height) {
 	struct wlr_headless_backend *backend =
@@ -132,7 +196,7 @@ struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 	wl_list_insert(&backend->outputs, &output->link);
 
 	if (backend->started) {
-		wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+		headless_output_schedule_frame(output);
 		wlr_output_update_enabled(wlr_output, true);
 		wlr_signal_emit_safe(&backend->backend.events.new_output, wlr_output);
 	}
@@ -7,6 +7,7 @@
 #include <wlr/util/log.h>
 #include "backend/libinput.h"
 #include "util/signal.h"
+#include "util/trace.h"
 
 static struct wlr_libinput_backend *get_libinput_backend_from_backend(
 		struct wlr_backend *wlr_backend) {
@@ -47,10 +48,12 @@ static const struct libinput_interface libinput_impl = {
 
 static int handle_libinput_readable(int fd, uint32_t mask, void *_backend) {
 	struct wlr_libinput_backend *backend = _backend;
+	trace_begin("libinput dispatch");
 	int ret = libinput_dispatch(backend->libinput_context);
 	if (ret != 0) {
 		wlr_log(WLR_ERROR, "Failed to dispatch libinput: %s", strerror(-ret));
 		wl_display_terminate(backend->display);
+		trace_end();
 		return 0;
 	}
 	struct libinput_event *event;
@@ -58,6 +61,11 @@ static int handle_libinput_readable(int fd, uint32_t mask, void *_backend) {
 		handle_libinput_event(backend, event);
 		libinput_event_destroy(event);
 	}
+	struct wlr_libinput_input_device *dev;
+	wl_list_for_each(dev, &backend->devices, link) {
+		flush_pointer_motion(dev);
+	}
+	trace_end();
 	return 0;
 }
 
@@ -119,6 +127,18 @@ static bool backend_start(struct wlr_backend *wlr_backend) {
 		}
 	}
 
+	if (backend->use_input_thread) {
+		if (backend->input_thread == NULL) {
+			backend->input_thread = input_thread_create(backend);
+		}
+		if (backend->input_thread != NULL) {
+			wlr_log(WLR_DEBUG, "libinput successfully initialized");
+			return true;
+		}
+		wlr_log(WLR_ERROR, "Failed to start input thread, "
+			"reading events on the main thread");
+	}
+
 	struct wl_event_loop *event_loop =
 		wl_display_get_event_loop(backend->display);
 	if (backend->input_event) {
@@ -141,6 +161,9 @@ static void backend_destroy(struct wlr_backend *wlr_backend) {
 	struct wlr_libinput_backend *backend =
 		get_libinput_backend_from_backend(wlr_backend);
 
+	input_thread_destroy(backend->input_thread);
+	backend->input_thread = NULL;
+
 	struct wlr_libinput_input_device *dev, *tmp;
 	wl_list_for_each_safe(dev, tmp, &backend->devices, link) {
 		destroy_libinput_input_device(dev);
@@ -177,11 +200,13 @@ static void session_signal(struct wl_listener *listener, void *data) {
 		return;
 	}
 
+	input_thread_lock(backend);
 	if (session->active) {
 		libinput_resume(backend->libinput_context);
 	} else {
 		libinput_suspend(backend->libinput_context);
 	}
+	input_thread_unlock(backend);
 }
 
 static void handle_session_destroy(struct wl_listener *listener, void *data) {
@@ -211,6 +236,16 @@ struct wlr_backend *wlr_libinput_backend_create(struct wl_display *display,
 	backend->session = session;
 	backend->display = display;
 
+	const char *coalesce = getenv("WLR_LIBINPUT_COALESCE_MOTION");
+	backend->coalesce_motion = coalesce != NULL && strcmp(coalesce, "1") == 0;
+	if (backend->coalesce_motion) {
+		wlr_log(WLR_INFO, "Coalescing relative pointer motion events");
+	}
+
+	const char *input_thread = getenv("WLR_LIBINPUT_THREAD");
+	backend->use_input_thread =
+		input_thread != NULL && strcmp(input_thread, "1") == 0;
+
 	backend->session_signal.notify = session_signal;
 	wl_signal_add(&session->events.active, &backend->session_signal);
 
@@ -223,7 +258,7 @@ struct wlr_backend *wlr_libinput_backend_create(struct wl_display *display,
 	return &backend->backend;
 }
 
-struct libinput_device *wlr_libinput_get_device_handle(
+static struct wlr_libinput_input_device *device_from_input_device(
 		struct wlr_input_device *wlr_dev) {
 	struct wlr_libinput_input_device *dev = NULL;
 	switch (wlr_dev->type) {
@@ -246,7 +281,26 @@ struct libinput_device *wlr_libinput_get_device_handle(
 		dev = device_from_tablet_pad(wlr_dev->tablet_pad);
 		break;
 	}
-	return dev->handle;
+	return dev;
+}
+
+struct libinput_device *wlr_libinput_get_device_handle(
+		struct wlr_input_device *wlr_dev) {
+	return device_from_input_device(wlr_dev)->handle;
+}
+
+static struct wlr_libinput_backend *backend_from_input_device(
+		struct wlr_input_device *wlr_dev) {
+	struct wlr_libinput_input_device *dev = device_from_input_device(wlr_dev);
+	return libinput_get_user_data(libinput_device_get_context(dev->handle));
+}
+
+void wlr_libinput_device_lock(struct wlr_input_device *wlr_dev) {
+	input_thread_lock(backend_from_input_device(wlr_dev));
+}
+
+void wlr_libinput_device_unlock(struct wlr_input_device *wlr_dev) {
+	input_thread_unlock(backend_from_input_device(wlr_dev));
 }
 
 uint32_t usec_to_msec(uint64_t usec) {
@@ -150,6 +150,13 @@ void handle_libinput_event(struct wlr_libinput_backend *backend,
 	struct wlr_libinput_input_device *dev =
 		libinput_device_get_user_data(libinput_dev);
 	enum libinput_event_type event_type = libinput_event_get_type(event);
+
+	// Deliver coalesced motion before any other event of the device, so that
+	// e.g. a button press happens at the right cursor position
+	if (dev != NULL && event_type != LIBINPUT_EVENT_POINTER_MOTION) {
+		flush_pointer_motion(dev);
+	}
+
 	switch (event_type) {
 	case LIBINPUT_EVENT_DEVICE_ADDED:
 		handle_device_added(backend, libinput_dev);
@@ -161,7 +168,11 @@ void handle_libinput_event(struct wlr_libinput_backend *backend,
 		handle_keyboard_key(event, &dev->keyboard);
 		break;
 	case LIBINPUT_EVENT_POINTER_MOTION:
-		handle_pointer_motion(event, &dev->pointer);
+		if (backend->coalesce_motion) {
+			queue_pointer_motion(event, dev);
+		} else {
+			handle_pointer_motion(event, &dev->pointer);
+		}
 		break;
 	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
 		handle_pointer_motion_abs(event, &dev->pointer);
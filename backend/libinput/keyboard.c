@@ -14,7 +14,11 @@ struct wlr_libinput_input_device *device_from_keyboard(
 
 static void keyboard_set_leds(struct wlr_keyboard *wlr_kb, uint32_t leds) {
 	struct wlr_libinput_input_device *dev = device_from_keyboard(wlr_kb);
+	struct wlr_libinput_backend *backend =
+		libinput_get_user_data(libinput_device_get_context(dev->handle));
+	input_thread_lock(backend);
 	libinput_device_led_update(dev->handle, leds);
+	input_thread_unlock(backend);
 }
 
 const struct wlr_keyboard_impl libinput_keyboard_impl = {
@@ -37,8 +41,8 @@ void handle_keyboard_key(struct libinput_event *event,
 	struct libinput_event_keyboard *kbevent =
 		libinput_event_get_keyboard_event(event);
 	struct wlr_keyboard_key_event wlr_event = { 0 };
-	wlr_event.time_msec =
-		usec_to_msec(libinput_event_keyboard_get_time_usec(kbevent));
+	wlr_event.time_usec = libinput_event_keyboard_get_time_usec(kbevent);
+	wlr_event.time_msec = usec_to_msec(wlr_event.time_usec);
 	wlr_event.keycode = libinput_event_keyboard_get_key(kbevent);
 	enum libinput_key_state state =
 		libinput_event_keyboard_get_key_state(kbevent);
@@ -25,14 +25,32 @@ struct wlr_libinput_input_device *device_from_pointer(
 	return dev;
 }
 
+static void emit_relative_motion(struct libinput_event_pointer *pevent,
+		struct wlr_pointer *pointer) {
+	if (wl_list_empty(&pointer->events.relative_motion.listener_list)) {
+		return;
+	}
+	struct wlr_pointer_relative_motion_event wlr_event = {
+		.pointer = pointer,
+		.time_usec = libinput_event_pointer_get_time_usec(pevent),
+		.delta_x = libinput_event_pointer_get_dx(pevent),
+		.delta_y = libinput_event_pointer_get_dy(pevent),
+		.unaccel_dx = libinput_event_pointer_get_dx_unaccelerated(pevent),
+		.unaccel_dy = libinput_event_pointer_get_dy_unaccelerated(pevent),
+	};
+	wlr_signal_emit_safe(&pointer->events.relative_motion, &wlr_event);
+}
+
 void handle_pointer_motion(struct libinput_event *event,
 		struct wlr_pointer *pointer) {
 	struct libinput_event_pointer *pevent =
 		libinput_event_get_pointer_event(event);
+	emit_relative_motion(pevent, pointer);
+
 	struct wlr_pointer_motion_event wlr_event = { 0 };
 	wlr_event.pointer = pointer;
-	wlr_event.time_msec =
-		usec_to_msec(libinput_event_pointer_get_time_usec(pevent));
+	wlr_event.time_usec = libinput_event_pointer_get_time_usec(pevent);
+	wlr_event.time_msec = usec_to_msec(wlr_event.time_usec);
 	wlr_event.delta_x = libinput_event_pointer_get_dx(pevent);
 	wlr_event.delta_y = libinput_event_pointer_get_dy(pevent);
 	wlr_event.unaccel_dx = libinput_event_pointer_get_dx_unaccelerated(pevent);
@@ -41,14 +59,46 @@ void handle_pointer_motion(struct libinput_event *event,
 	wlr_signal_emit_safe(&pointer->events.frame, pointer);
 }
 
+void queue_pointer_motion(struct libinput_event *event,
+		struct wlr_libinput_input_device *dev) {
+	struct libinput_event_pointer *pevent =
+		libinput_event_get_pointer_event(event);
+	emit_relative_motion(pevent, &dev->pointer);
+
+	struct wlr_pointer_motion_event *pending = &dev->pending_motion;
+	if (!dev->motion_pending) {
+		*pending = (struct wlr_pointer_motion_event){
+			.pointer = &dev->pointer,
+		};
+		dev->motion_pending = true;
+	}
+	pending->time_usec = libinput_event_pointer_get_time_usec(pevent);
+	pending->time_msec = usec_to_msec(pending->time_usec);
+	pending->delta_x += libinput_event_pointer_get_dx(pevent);
+	pending->delta_y += libinput_event_pointer_get_dy(pevent);
+	pending->unaccel_dx += libinput_event_pointer_get_dx_unaccelerated(pevent);
+	pending->unaccel_dy += libinput_event_pointer_get_dy_unaccelerated(pevent);
+}
+
+void flush_pointer_motion(struct wlr_libinput_input_device *dev) {
+	if (!dev->motion_pending) {
+		return;
+	}
+	dev->motion_pending = false;
+
+	struct wlr_pointer_motion_event wlr_event = dev->pending_motion;
+	wlr_signal_emit_safe(&dev->pointer.events.motion, &wlr_event);
+	wlr_signal_emit_safe(&dev->pointer.events.frame, &dev->pointer);
+}
+
 void handle_pointer_motion_abs(struct libinput_event *event,
 		struct wlr_pointer *pointer) {
 	struct libinput_event_pointer *pevent =
 		libinput_event_get_pointer_event(event);
 	struct wlr_pointer_motion_absolute_event wlr_event = { 0 };
 	wlr_event.pointer = pointer;
-	wlr_event.time_msec =
-		usec_to_msec(libinput_event_pointer_get_time_usec(pevent));
+	wlr_event.time_usec = libinput_event_pointer_get_time_usec(pevent);
+	wlr_event.time_msec = usec_to_msec(wlr_event.time_usec);
 	wlr_event.x = libinput_event_pointer_get_absolute_x_transformed(pevent, 1);
 	wlr_event.y = libinput_event_pointer_get_absolute_y_transformed(pevent, 1);
 	wlr_signal_emit_safe(&pointer->events.motion_absolute, &wlr_event);
@@ -61,8 +111,8 @@ void handle_pointer_button(struct libinput_event *event,
 		libinput_event_get_pointer_event(event);
 	struct wlr_pointer_button_event wlr_event = { 0 };
 	wlr_event.pointer = pointer;
-	wlr_event.time_msec =
-		usec_to_msec(libinput_event_pointer_get_time_usec(pevent));
+	wlr_event.time_usec = libinput_event_pointer_get_time_usec(pevent);
+	wlr_event.time_msec = usec_to_msec(wlr_event.time_usec);
 	wlr_event.button = libinput_event_pointer_get_button(pevent);
 	switch (libinput_event_pointer_get_button_state(pevent)) {
 	case LIBINPUT_BUTTON_STATE_PRESSED:
@@ -82,8 +132,8 @@ void handle_pointer_axis(struct libinput_event *event,
 		libinput_event_get_pointer_event(event);
 	struct wlr_pointer_axis_event wlr_event = { 0 };
 	wlr_event.pointer = pointer;
-	wlr_event.time_msec =
-		usec_to_msec(libinput_event_pointer_get_time_usec(pevent));
+	wlr_event.time_usec = libinput_event_pointer_get_time_usec(pevent);
+	wlr_event.time_msec = usec_to_msec(wlr_event.time_usec);
 	switch (libinput_event_pointer_get_axis_source(pevent)) {
 	case LIBINPUT_POINTER_AXIS_SOURCE_WHEEL:
 		wlr_event.source = WLR_AXIS_SOURCE_WHEEL;
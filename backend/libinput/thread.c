@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <libinput.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "backend/libinput.h"
+#include "util/log.h"
+#include "util/trace.h"
+
+/**
+ * Reads input in a dedicated thread, so that a slow frame on the main thread
+ * doesn't leave events in the kernel buffers until they overflow.
+ *
+ * libinput isn't thread-safe: every call into the context, including the
+ * event accessors, is made with the mutex held. The thread only holds it
+ * while dispatching, the main thread while processing a batch of events.
+ * The mutex is recursive so that wlroots functions taking it may be called
+ * from input event handlers.
+ *
+ * Messages logged by the input thread, including the ones libinput logs while
+ * dispatching, are captured and logged again from the main thread, so that
+ * the compositor's log callback doesn't need to be thread-safe.
+ */
+struct wlr_libinput_input_thread {
+	struct wlr_libinput_backend *backend;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	int stop_fd; // written to by the main thread to stop the input thread
+	int event_fd; // written to by the input thread when events are queued
+	struct wl_event_source *event_source;
+
+	// protected by mutex
+	struct libinput_event **events; // ring buffer
+	size_t events_cap, events_head, events_len;
+	struct log_capture log;
+	bool failed;
+};
+
+static bool queue_push(struct wlr_libinput_input_thread *thread,
+		struct libinput_event *event) {
+	if (thread->events_len == thread->events_cap) {
+		size_t cap = thread->events_cap == 0 ? 64 : thread->events_cap * 2;
+		struct libinput_event **events = malloc(cap * sizeof(events[0]));
+		if (events == NULL) {
+			return false;
+		}
+		for (size_t i = 0; i < thread->events_len; i++) {
+			events[i] = thread->events[
+				(thread->events_head + i) % thread->events_cap];
+		}
+		free(thread->events);
+		thread->events = events;
+		thread->events_cap = cap;
+		thread->events_head = 0;
+	}
+
+	size_t i = (thread->events_head + thread->events_len) % thread->events_cap;
+	thread->events[i] = event;
+	thread->events_len++;
+	return true;
+}
+
+static struct libinput_event *queue_pop(
+		struct wlr_libinput_input_thread *thread) {
+	if (thread->events_len == 0) {
+		return NULL;
+	}
+	struct libinput_event *event = thread->events[thread->events_head];
+	thread->events_head = (thread->events_head + 1) % thread->events_cap;
+	thread->events_len--;
+	return event;
+}
+
+static void notify_main_thread(struct wlr_libinput_input_thread *thread) {
+	uint64_t one = 1;
+	if (write(thread->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		wlr_log_errno(WLR_ERROR, "Failed to write to input thread eventfd");
+	}
+}
+
+static void *input_thread_run(void *data) {
+	struct wlr_libinput_input_thread *thread = data;
+	struct libinput *libinput = thread->backend->libinput_context;
+
+	struct pollfd fds[] = {
+		{ .fd = libinput_get_fd(libinput), .events = POLLIN },
+		{ .fd = thread->stop_fd, .events = POLLIN },
+	};
+
+	// Everything logged from this thread goes to thread->log, so the mutex
+	// must be held whenever logging
+	pthread_mutex_lock(&thread->mutex);
+	log_capture_begin(&thread->log);
+	pthread_mutex_unlock(&thread->mutex);
+
+	while (true) {
+		if (poll(fds, sizeof(fds) / sizeof(fds[0]), -1) < 0) {
+			int err = errno;
+			if (err == EINTR) {
+				continue;
+			}
+			pthread_mutex_lock(&thread->mutex);
+			wlr_log(WLR_ERROR, "poll failed: %s", strerror(err));
+			pthread_mutex_unlock(&thread->mutex);
+			break;
+		}
+		if (fds[1].revents != 0) {
+			log_capture_end();
+			return NULL;
+		}
+
+		pthread_mutex_lock(&thread->mutex);
+		int ret = libinput_dispatch(libinput);
+		if (ret != 0) {
+			wlr_log(WLR_ERROR, "Failed to dispatch libinput: %s",
+				strerror(-ret));
+			pthread_mutex_unlock(&thread->mutex);
+			break;
+		}
+		bool queued = false;
+		struct libinput_event *event;
+		while ((event = libinput_get_event(libinput))) {
+			if (!queue_push(thread, event)) {
+				wlr_log(WLR_ERROR, "Allocation failed, dropping input event");
+				libinput_event_destroy(event);
+				continue;
+			}
+			queued = true;
+		}
+		if (queued || thread->log.messages.size > 0) {
+			notify_main_thread(thread);
+		}
+		pthread_mutex_unlock(&thread->mutex);
+	}
+
+	pthread_mutex_lock(&thread->mutex);
+	thread->failed = true;
+	notify_main_thread(thread);
+	pthread_mutex_unlock(&thread->mutex);
+	log_capture_end();
+	return NULL;
+}
+
+static int handle_event_fd_readable(int fd, uint32_t mask, void *data) {
+	struct wlr_libinput_input_thread *thread = data;
+	struct wlr_libinput_backend *backend = thread->backend;
+
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		wlr_log_errno(WLR_ERROR, "Failed to read from input thread eventfd");
+	}
+
+	trace_begin("libinput dispatch");
+	pthread_mutex_lock(&thread->mutex);
+	log_capture_replay(&thread->log);
+	struct libinput_event *event;
+	while ((event = queue_pop(thread))) {
+		handle_libinput_event(backend, event);
+		libinput_event_destroy(event);
+	}
+	struct wlr_libinput_input_device *dev;
+	wl_list_for_each(dev, &backend->devices, link) {
+		flush_pointer_motion(dev);
+	}
+	bool failed = thread->failed;
+	pthread_mutex_unlock(&thread->mutex);
+	trace_end();
+
+	if (failed) {
+		wlr_log(WLR_ERROR, "libinput input thread exited");
+		wl_display_terminate(backend->display);
+	}
+	return 0;
+}
+
+struct wlr_libinput_input_thread *input_thread_create(
+		struct wlr_libinput_backend *backend) {
+	struct wlr_libinput_input_thread *thread = calloc(1, sizeof(*thread));
+	if (thread == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	thread->backend = backend;
+
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&thread->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	thread->stop_fd = eventfd(0, EFD_CLOEXEC);
+	thread->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->stop_fd < 0 || thread->event_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "eventfd failed");
+		goto error;
+	}
+
+	struct wl_event_loop *event_loop =
+		wl_display_get_event_loop(backend->display);
+	thread->event_source = wl_event_loop_add_fd(event_loop, thread->event_fd,
+		WL_EVENT_READABLE, handle_event_fd_readable, thread);
+	if (thread->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create input thread event source");
+		goto error;
+	}
+
+	int ret = pthread_create(&thread->thread, NULL, input_thread_run, thread);
+	if (ret != 0) {
+		wlr_log(WLR_ERROR, "pthread_create failed: %s", strerror(ret));
+		goto error;
+	}
+
+	wlr_log(WLR_INFO, "Reading libinput events in a dedicated thread");
+	return thread;
+
+error:
+	if (thread->event_source != NULL) {
+		wl_event_source_remove(thread->event_source);
+	}
+	if (thread->stop_fd >= 0) {
+		close(thread->stop_fd);
+	}
+	if (thread->event_fd >= 0) {
+		close(thread->event_fd);
+	}
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+	return NULL;
+}
+
+void input_thread_destroy(struct wlr_libinput_input_thread *thread) {
+	if (thread == NULL) {
+		return;
+	}
+
+	uint64_t one = 1;
+	if (write(thread->stop_fd, &one, sizeof(one)) < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to stop input thread");
+	}
+	pthread_join(thread->thread, NULL);
+
+	log_capture_replay(&thread->log);
+	struct libinput_event *event;
+	while ((event = queue_pop(thread))) {
+		libinput_event_destroy(event);
+	}
+	free(thread->events);
+
+	wl_event_source_remove(thread->event_source);
+	close(thread->stop_fd);
+	close(thread->event_fd);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+}
+
+void input_thread_lock(struct wlr_libinput_backend *backend) {
+	if (backend->input_thread != NULL) {
+		pthread_mutex_lock(&backend->input_thread->mutex);
+	}
+}
+
+void input_thread_unlock(struct wlr_libinput_backend *backend) {
+	if (backend->input_thread != NULL) {
+		pthread_mutex_unlock(&backend->input_thread->mutex);
+	}
+}
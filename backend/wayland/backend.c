@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -345,6 +346,9 @@ static void registry_global(void *data, struct wl_registry *registry,
 	if (strcmp(iface, wl_compositor_interface.name) == 0) {
 		wl->compositor = wl_registry_bind(registry, name,
 			&wl_compositor_interface, 4);
+	} else if (strcmp(iface, wl_subcompositor_interface.name) == 0) {
+		wl->subcompositor = wl_registry_bind(registry, name,
+			&wl_subcompositor_interface, 1);
 	} else if (strcmp(iface, wl_seat_interface.name) == 0) {
 		struct wl_seat *wl_seat = wl_registry_bind(registry, name,
 			&wl_seat_interface, 5);
@@ -441,6 +445,10 @@ static void backend_destroy(struct wlr_backend *backend) {
 		wlr_output_destroy(&output->wlr_output);
 	}
 
+	wlr_log(WLR_DEBUG, "Imported buffers: %" PRIu64 " reused, %" PRIu64
+		" imported, %" PRIu64 " evicted", wl->buffer_stats.hits,
+		wl->buffer_stats.imports, wl->buffer_stats.evictions);
+
 	struct wlr_wl_buffer *buffer, *tmp_buffer;
 	wl_list_for_each_safe(buffer, tmp_buffer, &wl->buffers, link) {
 		destroy_wl_buffer(buffer);
@@ -478,6 +486,9 @@ static void backend_destroy(struct wlr_backend *backend) {
 	}
 	free(wl->drm_render_name);
 	free(wl->activation_token);
+	if (wl->subcompositor) {
+		wl_subcompositor_destroy(wl->subcompositor);
+	}
 	xdg_wm_base_destroy(wl->xdg_wm_base);
 	wl_compositor_destroy(wl->compositor);
 	wl_registry_destroy(wl->registry);
@@ -564,6 +575,16 @@ struct wlr_backend *wlr_wl_backend_create(struct wl_display *display,
 		goto error_registry;
 	}
 
+	const char *cursor_subsurface = getenv("WLR_WL_CURSOR_SUBSURFACE");
+	if (cursor_subsurface != NULL && strcmp(cursor_subsurface, "1") == 0) {
+		if (wl->subcompositor != NULL) {
+			wl->cursor_subsurface = true;
+		} else {
+			wlr_log(WLR_ERROR, "Remote Wayland compositor does not support "
+				"wl_subcompositor, using the host cursor");
+		}
+	}
+
 	struct zwp_linux_dmabuf_feedback_v1 *linux_dmabuf_feedback_v1 = NULL;
 	struct wlr_wl_linux_dmabuf_feedback_v1 feedback_data = { .backend = wl };
 	if (wl->zwp_linux_dmabuf_v1 != NULL &&
@@ -119,10 +119,25 @@ void destroy_wl_buffer(struct wlr_wl_buffer *buffer) {
 	}
 	wl_list_remove(&buffer->buffer_destroy.link);
 	wl_list_remove(&buffer->link);
+	buffer->backend->buffers_len--;
 	wl_buffer_destroy(buffer->wl_buffer);
 	free(buffer);
 }
 
+static void evict_wl_buffers(struct wlr_wl_backend *wl) {
+	struct wlr_wl_buffer *buffer, *tmp;
+	wl_list_for_each_reverse_safe(buffer, tmp, &wl->buffers, link) {
+		if (wl->buffers_len < WLR_WL_BUFFER_CACHE_SIZE) {
+			break;
+		}
+		// Buffers still in use by the host compositor can't be destroyed
+		if (buffer->released) {
+			destroy_wl_buffer(buffer);
+			wl->buffer_stats.evictions++;
+		}
+	}
+}
+
 static void buffer_handle_release(void *data, struct wl_buffer *wl_buffer) {
 	struct wlr_wl_buffer *buffer = data;
 	buffer->released = true;
@@ -211,9 +226,12 @@ static struct wlr_wl_buffer *create_wl_buffer(struct wlr_wl_backend *wl,
 		wl_buffer_destroy(wl_buffer);
 		return NULL;
 	}
+	buffer->backend = wl;
 	buffer->wl_buffer = wl_buffer;
 	buffer->buffer = wlr_buffer_lock(wlr_buffer);
 	wl_list_insert(&wl->buffers, &buffer->link);
+	wl->buffers_len++;
+	wl->buffer_stats.imports++;
 
 	wl_buffer_add_listener(wl_buffer, &buffer_listener, buffer);
 
@@ -233,10 +251,14 @@ static struct wlr_wl_buffer *get_or_create_wl_buffer(struct wlr_wl_backend *wl,
 		if (buffer->buffer == wlr_buffer && buffer->released) {
 			buffer->released = false;
 			wlr_buffer_lock(buffer->buffer);
+			wl_list_remove(&buffer->link);
+			wl_list_insert(&wl->buffers, &buffer->link);
+			wl->buffer_stats.hits++;
 			return buffer;
 		}
 	}
 
+	evict_wl_buffers(wl);
 	return create_wl_buffer(wl, wlr_buffer);
 }
 
@@ -355,6 +377,36 @@ static bool output_commit(struct wlr_output *wlr_output,
 	return true;
 }
 
+static void update_cursor_subsurface_position(struct wlr_wl_output *output) {
+	wl_subsurface_set_position(output->cursor.subsurface,
+		output->cursor.x - output->cursor.hotspot_x,
+		output->cursor.y - output->cursor.hotspot_y);
+	// The position is part of the parent surface state. Committing the parent
+	// without attaching a new buffer only damages the area of the cursor on
+	// the host.
+	wl_surface_commit(output->surface);
+}
+
+static struct wl_surface *create_cursor_surface(struct wlr_wl_output *output) {
+	struct wlr_wl_backend *backend = output->backend;
+	struct wl_surface *surface =
+		wl_compositor_create_surface(backend->compositor);
+	if (surface == NULL || !backend->cursor_subsurface) {
+		return surface;
+	}
+
+	output->cursor.subsurface = wl_subcompositor_get_subsurface(
+		backend->subcompositor, surface, output->surface);
+	wl_subsurface_set_desync(output->cursor.subsurface);
+
+	// Let pointer events go through to the output surface
+	struct wl_region *region = wl_compositor_create_region(backend->compositor);
+	wl_surface_set_input_region(surface, region);
+	wl_region_destroy(region);
+
+	return surface;
+}
+
 static bool output_set_cursor(struct wlr_output *wlr_output,
 		struct wlr_buffer *wlr_buffer, int hotspot_x, int hotspot_y) {
 	struct wlr_wl_output *output = get_wl_output_from_output(wlr_output);
@@ -364,8 +416,7 @@ static bool output_set_cursor(struct wlr_output *wlr_output,
 	output->cursor.hotspot_y = hotspot_y;
 
 	if (output->cursor.surface == NULL) {
-		output->cursor.surface =
-			wl_compositor_create_surface(backend->compositor);
+		output->cursor.surface = create_cursor_surface(output);
 	}
 	struct wl_surface *surface = output->cursor.surface;
 
@@ -384,7 +435,11 @@ static bool output_set_cursor(struct wlr_output *wlr_output,
 		wl_surface_commit(surface);
 	}
 
-	update_wl_output_cursor(output);
+	if (output->cursor.subsurface != NULL) {
+		update_cursor_subsurface_position(output);
+	} else {
+		update_wl_output_cursor(output);
+	}
 	wl_display_flush(backend->remote_display);
 	return true;
 }
@@ -408,6 +463,9 @@ static void output_destroy(struct wlr_output *wlr_output) {
 
 	wl_list_remove(&output->link);
 
+	if (output->cursor.subsurface) {
+		wl_subsurface_destroy(output->cursor.subsurface);
+	}
 	if (output->cursor.surface) {
 		wl_surface_destroy(output->cursor.surface);
 	}
@@ -439,14 +497,30 @@ void update_wl_output_cursor(struct wlr_wl_output *output) {
 		assert(output->enter_serial);
 
 		struct wlr_wl_seat *seat = pointer->seat;
+		if (output->cursor.subsurface != NULL) {
+			// The cursor is drawn in the subsurface, hide the host cursor
+			wl_pointer_set_cursor(seat->wl_pointer, output->enter_serial,
+				NULL, 0, 0);
+			return;
+		}
 		wl_pointer_set_cursor(seat->wl_pointer, output->enter_serial,
 			output->cursor.surface, output->cursor.hotspot_x,
 			output->cursor.hotspot_y);
 	}
 }
 
-static bool output_move_cursor(struct wlr_output *_output, int x, int y) {
-	// TODO: only return true if x == current x and y == current y
+static bool output_move_cursor(struct wlr_output *wlr_output, int x, int y) {
+	struct wlr_wl_output *output = get_wl_output_from_output(wlr_output);
+	output->cursor.x = x;
+	output->cursor.y = y;
+
+	if (output->cursor.subsurface == NULL) {
+		// TODO: only return true if x == current x and y == current y
+		return true;
+	}
+
+	update_cursor_subsurface_position(output);
+	wl_display_flush(output->backend->remote_display);
 	return true;
 }
 
@@ -391,6 +391,22 @@ static void x11_get_argb32(struct wlr_x11_backend *x11) {
 	free(reply);
 }
 
+static uint32_t get_present_interval(void) {
+	const char *str = getenv("WLR_X11_PRESENT_INTERVAL");
+	if (str == NULL) {
+		return 1;
+	}
+
+	char *end;
+	long interval = strtol(str, &end, 10);
+	if (*end || interval < 0 || interval > 16) {
+		wlr_log(WLR_ERROR, "WLR_X11_PRESENT_INTERVAL specified with invalid "
+			"integer, ignoring");
+		return 1;
+	}
+	return interval;
+}
+
 struct wlr_backend *wlr_x11_backend_create(struct wl_display *display,
 		const char *x11_display) {
 	wlr_log(WLR_INFO, "Creating X11 backend");
@@ -403,6 +419,7 @@ struct wlr_backend *wlr_x11_backend_create(struct wl_display *display,
 	wlr_backend_init(&x11->backend, &backend_impl);
 	x11->wl_display = display;
 	wl_list_init(&x11->outputs);
+	x11->present_interval = get_present_interval();
 
 	x11->xcb = xcb_connect(x11_display, NULL);
 	if (!x11->xcb || xcb_connection_has_error(x11->xcb)) {
@@ -86,6 +86,11 @@ static void output_destroy(struct wlr_output *wlr_output) {
 	wlr_pointer_finish(&output->pointer);
 	wlr_touch_finish(&output->touch);
 
+	wlr_log(WLR_DEBUG, "Output '%s' pixmaps: %" PRIu64 " reused, %" PRIu64
+		" imported, %" PRIu64 " evicted", wlr_output->name,
+		output->buffer_stats.hits, output->buffer_stats.imports,
+		output->buffer_stats.evictions);
+
 	struct wlr_x11_buffer *buffer, *buffer_tmp;
 	wl_list_for_each_safe(buffer, buffer_tmp, &output->buffers, link) {
 		destroy_x11_buffer(buffer);
@@ -126,10 +131,25 @@ static void destroy_x11_buffer(struct wlr_x11_buffer *buffer) {
 	}
 	wl_list_remove(&buffer->buffer_destroy.link);
 	wl_list_remove(&buffer->link);
+	buffer->output->buffers_len--;
 	xcb_free_pixmap(buffer->x11->xcb, buffer->pixmap);
 	free(buffer);
 }
 
+static void evict_x11_buffers(struct wlr_x11_output *output) {
+	struct wlr_x11_buffer *buffer, *tmp;
+	wl_list_for_each_reverse_safe(buffer, tmp, &output->buffers, link) {
+		if (output->buffers_len < WLR_X11_BUFFER_CACHE_SIZE) {
+			break;
+		}
+		// The X server may still read from busy pixmaps
+		if (buffer->busy == 0) {
+			destroy_x11_buffer(buffer);
+			output->buffer_stats.evictions++;
+		}
+	}
+}
+
 static void buffer_handle_buffer_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_x11_buffer *buffer =
@@ -236,7 +256,11 @@ static struct wlr_x11_buffer *create_x11_buffer(struct wlr_x11_output *output,
 	buffer->buffer = wlr_buffer_lock(wlr_buffer);
 	buffer->pixmap = pixmap;
 	buffer->x11 = x11;
+	buffer->output = output;
+	buffer->busy = 1;
 	wl_list_insert(&output->buffers, &buffer->link);
+	output->buffers_len++;
+	output->buffer_stats.imports++;
 
 	buffer->buffer_destroy.notify = buffer_handle_buffer_destroy;
 	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
@@ -250,10 +274,15 @@ static struct wlr_x11_buffer *get_or_create_x11_buffer(
 	wl_list_for_each(buffer, &output->buffers, link) {
 		if (buffer->buffer == wlr_buffer) {
 			wlr_buffer_lock(buffer->buffer);
+			buffer->busy++;
+			wl_list_remove(&buffer->link);
+			wl_list_insert(&output->buffers, &buffer->link);
+			output->buffer_stats.hits++;
 			return buffer;
 		}
 	}
 
+	evict_x11_buffers(output);
 	return create_x11_buffer(output, wlr_buffer);
 }
 
@@ -272,7 +301,16 @@ static bool output_commit_buffer(struct wlr_x11_output *output,
 	if (state->committed & WLR_OUTPUT_STATE_DAMAGE) {
 		pixman_region32_union(&output->exposed, &output->exposed,
 			(pixman_region32_t *) &state->damage);
+	}
 
+	// No region means the whole pixmap is updated
+	pixman_box32_t full_box = {
+		.x2 = output->wlr_output.width,
+		.y2 = output->wlr_output.height,
+	};
+	if ((state->committed & WLR_OUTPUT_STATE_DAMAGE) &&
+			pixman_region32_contains_rectangle(&output->exposed,
+			&full_box) != PIXMAN_REGION_IN) {
 		int rects_len = 0;
 		pixman_box32_t *rects = pixman_region32_rectangles(&output->exposed, &rects_len);
 
@@ -301,7 +339,10 @@ static bool output_commit_buffer(struct wlr_x11_output *output,
 
 	uint32_t serial = output->wlr_output.commit_seq;
 	uint32_t options = 0;
-	uint64_t target_msc = output->last_msc ? output->last_msc + 1 : 0;
+	uint64_t target_msc = 0;
+	if (output->last_msc != 0 && x11->present_interval > 0) {
+		target_msc = output->last_msc + x11->present_interval;
+	}
 	xcb_present_pixmap(x11->xcb, output->win, x11_buffer->pixmap, serial,
 		0, region, 0, 0, XCB_NONE, XCB_NONE, XCB_NONE, options, target_msc,
 		0, 0, 0, NULL);
@@ -670,6 +711,9 @@ void handle_x11_present_event(struct wlr_x11_backend *x11,
 			return;
 		}
 
+		if (buffer->busy > 0) {
+			buffer->busy--;
+		}
 		wlr_buffer_unlock(buffer->buffer); // may destroy buffer
 		break;
 	case XCB_PRESENT_COMPLETE_NOTIFY:;
@@ -682,7 +726,18 @@ void handle_x11_present_event(struct wlr_x11_backend *x11,
 			return;
 		}
 
+		if (output->last_ust != 0 && complete_notify->msc > output->last_msc &&
+				complete_notify->ust > output->last_ust) {
+			// The X server reports vblank counters and timestamps, derive
+			// the refresh period from them
+			uint64_t refresh_nsec = (complete_notify->ust - output->last_ust) *
+				1000 / (complete_notify->msc - output->last_msc);
+			if (refresh_nsec <= INT32_MAX) {
+				output->refresh_nsec = refresh_nsec;
+			}
+		}
 		output->last_msc = complete_notify->msc;
+		output->last_ust = complete_notify->ust;
 
 		struct timespec t;
 		timespec_from_nsec(&t, complete_notify->ust * 1000);
@@ -699,6 +754,7 @@ void handle_x11_present_event(struct wlr_x11_backend *x11,
 			.presented = presented,
 			.when = &t,
 			.seq = complete_notify->msc,
+			.refresh = output->refresh_nsec,
 			.flags = flags,
 		};
 		wlr_output_send_present(&output->wlr_output, &present_event);
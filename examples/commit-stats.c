@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200112L
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+/* Simple scene-graph compositor which periodically prints the commit
+ * statistics of its clients. Input is unimplemented.
+ *
+ * Clients committing excessively show up with a high commit rate or a large
+ * share of the compositor time. */
+
+static const int default_interval_ms = 5000;
+
+struct server {
+	struct wl_display *display;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_scene *scene;
+	struct wlr_compositor *compositor;
+
+	int interval_ms;
+	struct wl_event_source *timer;
+
+	struct wl_listener new_output;
+	struct wl_listener new_surface;
+};
+
+struct surface {
+	struct wlr_scene_surface *scene_surface;
+
+	struct wl_listener destroy;
+};
+
+struct output {
+	struct wlr_output *wlr;
+	struct wlr_scene_output *scene_output;
+
+	struct wl_listener frame;
+};
+
+static void output_handle_frame(struct wl_listener *listener, void *data) {
+	struct output *output = wl_container_of(listener, output, frame);
+
+	if (!wlr_scene_output_commit(output->scene_output)) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wlr_scene_output_send_frame_done(output->scene_output, &now);
+}
+
+static void server_handle_new_output(struct wl_listener *listener, void *data) {
+	struct server *server = wl_container_of(listener, server, new_output);
+	struct wlr_output *wlr_output = data;
+
+	wlr_output_init_render(wlr_output, server->allocator, server->renderer);
+
+	struct output *output = calloc(1, sizeof(struct output));
+	output->wlr = wlr_output;
+	output->frame.notify = output_handle_frame;
+	wl_signal_add(&wlr_output->events.frame, &output->frame);
+
+	output->scene_output = wlr_scene_output_create(server->scene, wlr_output);
+
+	if (!wl_list_empty(&wlr_output->modes)) {
+		struct wlr_output_mode *mode = wlr_output_preferred_mode(wlr_output);
+		wlr_output_set_mode(wlr_output, mode);
+		wlr_output_commit(wlr_output);
+	}
+
+	wlr_output_create_global(wlr_output);
+}
+
+static void surface_handle_destroy(struct wl_listener *listener, void *data) {
+	struct surface *surface = wl_container_of(listener, surface, destroy);
+	wlr_scene_node_destroy(&surface->scene_surface->buffer->node);
+	wl_list_remove(&surface->destroy.link);
+	free(surface);
+}
+
+static void server_handle_new_surface(struct wl_listener *listener,
+		void *data) {
+	struct server *server = wl_container_of(listener, server, new_surface);
+	struct wlr_surface *wlr_surface = data;
+
+	struct surface *surface = calloc(1, sizeof(struct surface));
+	surface->destroy.notify = surface_handle_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &surface->destroy);
+
+	surface->scene_surface =
+		wlr_scene_surface_create(&server->scene->tree, wlr_surface);
+}
+
+static int handle_timer(void *data) {
+	struct server *server = data;
+
+	printf("%8s %10s %10s %14s %12s\n",
+		"pid", "commits", "buffers", "damage (px)", "time (ms)");
+
+	struct wlr_compositor_client_stats *client_stats;
+	wl_list_for_each(client_stats, &server->compositor->client_stats, link) {
+		pid_t pid = 0;
+		wl_client_get_credentials(client_stats->client, &pid, NULL, NULL);
+
+		const struct wlr_surface_stats *stats = &client_stats->stats;
+		printf("%8d %10" PRIu64 " %10" PRIu64 " %14" PRIu64 " %12.3f\n",
+			(int)pid, stats->commits, stats->buffers, stats->damage_area,
+			stats->commit_time_ns / 1e6);
+	}
+	printf("\n");
+	fflush(stdout);
+
+	wl_event_source_timer_update(server->timer, server->interval_ms);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_INFO, NULL);
+
+	char *startup_cmd = NULL;
+	int interval_ms = default_interval_ms;
+
+	int c;
+	while ((c = getopt(argc, argv, "s:i:")) != -1) {
+		switch (c) {
+		case 's':
+			startup_cmd = optarg;
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		default:
+			printf("usage: %s [-s startup-command] [-i interval-ms]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || interval_ms <= 0) {
+		printf("usage: %s [-s startup-command] [-i interval-ms]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct server server = {0};
+	server.interval_ms = interval_ms;
+	server.display = wl_display_create();
+	server.backend = wlr_backend_autocreate(server.display);
+	server.scene = wlr_scene_create();
+
+	server.renderer = wlr_renderer_autocreate(server.backend);
+	wlr_renderer_init_wl_display(server.renderer, server.display);
+
+	server.allocator = wlr_allocator_autocreate(server.backend,
+		server.renderer);
+
+	server.compositor = wlr_compositor_create(server.display, server.renderer);
+
+	wlr_xdg_shell_create(server.display, 2);
+
+	server.new_output.notify = server_handle_new_output;
+	wl_signal_add(&server.backend->events.new_output, &server.new_output);
+
+	server.new_surface.notify = server_handle_new_surface;
+	wl_signal_add(&server.compositor->events.new_surface, &server.new_surface);
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(server.display);
+	server.timer = wl_event_loop_add_timer(loop, handle_timer, &server);
+	wl_event_source_timer_update(server.timer, server.interval_ms);
+
+	const char *socket = wl_display_add_socket_auto(server.display);
+	if (!socket) {
+		wl_display_destroy(server.display);
+		return EXIT_FAILURE;
+	}
+
+	if (!wlr_backend_start(server.backend)) {
+		wl_display_destroy(server.display);
+		return EXIT_FAILURE;
+	}
+
+	setenv("WAYLAND_DISPLAY", socket, true);
+	if (startup_cmd != NULL) {
+		if (fork() == 0) {
+			execl("/bin/sh", "/bin/sh", "-c", startup_cmd, (void *)NULL);
+		}
+	}
+
+	wlr_log(WLR_INFO, "Running Wayland compositor on WAYLAND_DISPLAY=%s",
+		socket);
+	wl_display_run(server.display);
+
+	wl_event_source_remove(server.timer);
+	wl_display_destroy_clients(server.display);
+	wl_display_destroy(server.display);
+	return EXIT_SUCCESS;
+}
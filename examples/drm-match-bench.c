@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "backend/drm/util.h"
+
+/* Measures match_obj() on synthetic connector/CRTC topologies. Each topology
+ * has random possible_crtcs masks, disabled connectors, leased CRTCs and a
+ * previous configuration, like realloc_crtcs() builds them. Small topologies
+ * are first checked against an exhaustive search: the matcher must find as
+ * many matches as possible, then keep as many previously lit CRTCs as
+ * possible. */
+
+static const char usage[] =
+	"usage: %s [-n topologies] [-i iterations]\n"
+	"  -n  number of topologies checked against exhaustive search "
+	"(default: 20000)\n"
+	"  -i  number of calls per topology size (default: 100000)\n";
+
+#define MAX_CHECKED 7
+#define MAX_RES 32
+
+struct topology {
+	size_t num_objs, num_res;
+	uint32_t objs[MAX_RES];
+	uint32_t orig[MAX_RES];
+};
+
+struct result {
+	size_t matched, kept;
+};
+
+static uint32_t rand_state = 1;
+
+static uint32_t rand_next(void) {
+	// xorshift, so that runs are reproducible
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static bool rand_chance(int percent) {
+	return rand_next() % 100 < (uint32_t)percent;
+}
+
+static void gen_topology(struct topology *topo, size_t num_objs,
+		size_t num_res) {
+	topo->num_objs = num_objs;
+	topo->num_res = num_res;
+
+	uint32_t all_res = num_res == 32 ? UINT32_MAX : (1u << num_res) - 1;
+	uint32_t leased = 0;
+	for (size_t i = 0; i < num_res; i++) {
+		topo->orig[i] = UNMATCHED;
+		if (rand_chance(5)) {
+			topo->orig[i] = SKIP;
+			leased |= 1u << i;
+		}
+	}
+
+	for (size_t i = 0; i < num_objs; i++) {
+		// Most connectors can use any CRTC, some are wired to a few
+		uint32_t possible = all_res;
+		if (rand_chance(50)) {
+			possible = rand_next() & all_res;
+		}
+
+		// Give some connectors a CRTC from the previous configuration
+		if (rand_chance(60)) {
+			size_t crtc = rand_next() % num_res;
+			if (topo->orig[crtc] == UNMATCHED) {
+				topo->orig[crtc] = i;
+			}
+		}
+
+		if (rand_chance(20)) {
+			// Disconnected or disabled by the compositor
+			topo->objs[i] = 0;
+		} else {
+			topo->objs[i] = possible & ~leased;
+		}
+	}
+}
+
+struct search {
+	const struct topology *topo;
+	bool used[MAX_CHECKED];
+	struct result best;
+};
+
+static bool result_better(const struct result *a, const struct result *b) {
+	return a->matched > b->matched ||
+		(a->matched == b->matched && a->kept > b->kept);
+}
+
+static void search_res(struct search *s, size_t res, struct result cur) {
+	const struct topology *topo = s->topo;
+	if (res == topo->num_res) {
+		if (result_better(&cur, &s->best)) {
+			s->best = cur;
+		}
+		return;
+	}
+
+	search_res(s, res + 1, cur);
+	if (topo->orig[res] == SKIP) {
+		return;
+	}
+
+	for (size_t obj = 0; obj < topo->num_objs; obj++) {
+		bool kept = topo->orig[res] == obj;
+		if (s->used[obj] || (!(topo->objs[obj] & (1u << res)) && !kept)) {
+			continue;
+		}
+		s->used[obj] = true;
+		struct result next = {
+			.matched = cur.matched + (topo->objs[obj] != 0 ? 1 : 0),
+			.kept = cur.kept + (kept ? 1 : 0),
+		};
+		search_res(s, res + 1, next);
+		s->used[obj] = false;
+	}
+}
+
+static struct result exhaustive_match(const struct topology *topo) {
+	struct search s = { .topo = topo };
+	search_res(&s, 0, (struct result){0});
+	return s.best;
+}
+
+// Checks that out is a valid solution, and returns its score
+static bool eval_match(const struct topology *topo, const uint32_t *out,
+		struct result *result) {
+	bool used[MAX_RES] = {0};
+	*result = (struct result){0};
+	for (size_t res = 0; res < topo->num_res; res++) {
+		uint32_t obj = out[res];
+		if (topo->orig[res] == SKIP) {
+			if (obj != SKIP) {
+				return false;
+			}
+			continue;
+		}
+		if (obj == UNMATCHED) {
+			continue;
+		}
+
+		bool kept = topo->orig[res] == obj;
+		if (obj >= topo->num_objs || used[obj] ||
+				(!(topo->objs[obj] & (1u << res)) && !kept)) {
+			return false;
+		}
+		used[obj] = true;
+		if (topo->objs[obj] != 0) {
+			result->matched++;
+		}
+		if (kept) {
+			result->kept++;
+		}
+	}
+	return true;
+}
+
+static bool check_topologies(int count) {
+	for (int i = 0; i < count; i++) {
+		struct topology topo;
+		gen_topology(&topo, 1 + rand_next() % MAX_CHECKED,
+			1 + rand_next() % MAX_CHECKED);
+
+		uint32_t out[MAX_RES];
+		size_t score = match_obj(topo.num_objs, topo.objs,
+			topo.num_res, topo.orig, out);
+
+		struct result got;
+		struct result want = exhaustive_match(&topo);
+		if (!eval_match(&topo, out, &got)) {
+			fprintf(stderr, "topology %d: invalid solution\n", i);
+			return false;
+		}
+		if (got.matched != want.matched || got.kept != want.kept ||
+				score != got.matched) {
+			fprintf(stderr, "topology %d (%zu connectors, %zu CRTCs): "
+				"got %zu matched/%zu kept (returned %zu), "
+				"expected %zu matched/%zu kept\n", i, topo.num_objs,
+				topo.num_res, got.matched, got.kept, score,
+				want.matched, want.kept);
+			return false;
+		}
+	}
+	return true;
+}
+
+static int64_t get_time_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const size_t sizes[][2] = {
+	{ 1, 1 }, { 2, 4 }, { 4, 4 }, { 4, 8 }, { 8, 8 }, { 16, 16 }, { 24, 32 },
+};
+
+// Number of distinct topologies each size is timed with
+#define TOPOLOGIES_PER_SIZE 64
+
+int main(int argc, char *argv[]) {
+	int checked = 20000;
+	int iterations = 100000;
+
+	int c;
+	while ((c = getopt(argc, argv, "n:i:h")) != -1) {
+		switch (c) {
+		case 'n':
+			checked = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || checked < 0 || iterations <= 0) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!check_topologies(checked)) {
+		fprintf(stderr, "match_obj() doesn't match the exhaustive search\n");
+		return EXIT_FAILURE;
+	}
+	printf("%d topologies of up to %d connectors and CRTCs match the "
+		"exhaustive search\n\n", checked, MAX_CHECKED);
+
+	printf("%d calls, ns per call\n", iterations);
+	printf("%10s %6s %10s\n", "connectors", "CRTCs", "match_obj");
+
+	static struct topology topos[TOPOLOGIES_PER_SIZE];
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (size_t j = 0; j < TOPOLOGIES_PER_SIZE; j++) {
+			gen_topology(&topos[j], sizes[i][0], sizes[i][1]);
+		}
+
+		uint32_t out[MAX_RES];
+		int64_t start = get_time_nsec();
+		for (int k = 0; k < iterations; k++) {
+			const struct topology *topo = &topos[k % TOPOLOGIES_PER_SIZE];
+			match_obj(topo->num_objs, topo->objs, topo->num_res, topo->orig,
+				out);
+		}
+		double ns = (double)(get_time_nsec() - start) / iterations;
+
+		printf("%10zu %6zu %10.1f\n", sizes[i][0], sizes[i][1], ns);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/box.h>
+
+/* Measures the cost of positioning a popup, which is what a popup pays on
+ * every unconstrain cache miss. The rule sets cover the fast path and the
+ * pathological cases running the flip, slide and resize passes one after
+ * another. The outcome of each rule set is checked before timing it. */
+
+static const char usage[] =
+	"usage: %s [-i iterations]\n"
+	"  -i  number of calls per rule set (default: 1000000)\n";
+
+#define ALL_ADJUSTMENTS \
+	(XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_FLIP_X | \
+	XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_FLIP_Y | \
+	XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_SLIDE_X | \
+	XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_SLIDE_Y | \
+	XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_RESIZE_X | \
+	XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_RESIZE_Y)
+
+static const struct wlr_box output_box = { 0, 0, 1920, 1080 };
+
+struct rule_set {
+	const char *name;
+	struct wlr_box anchor_rect;
+	enum xdg_positioner_anchor anchor;
+	enum xdg_positioner_gravity gravity;
+	uint32_t adjustment;
+	int width, height;
+	// Defaults to the output
+	bool has_constraint;
+	struct wlr_box constraint;
+	// Whether the popup must end up inside the constraint
+	bool inside;
+};
+
+static const struct rule_set rule_sets[] = {
+	{
+		.name = "fits",
+		.anchor_rect = { 100, 100, 20, 20 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_BOTTOM_RIGHT,
+		.adjustment = ALL_ADJUSTMENTS,
+		.width = 200, .height = 300,
+		.inside = true,
+	},
+	{
+		// Context menu opened in the bottom right corner
+		.name = "flip-corner",
+		.anchor_rect = { 1880, 1040, 20, 20 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_BOTTOM_RIGHT,
+		.adjustment = XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_FLIP_X |
+			XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_FLIP_Y,
+		.width = 200, .height = 300,
+		.inside = true,
+	},
+	{
+		// Flipping doesn't help, sliding does
+		.name = "flip-then-slide",
+		.anchor_rect = { 1700, 500, 100, 20 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_BOTTOM_RIGHT,
+		.adjustment = XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_FLIP_X |
+			XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_SLIDE_X,
+		.width = 1800, .height = 300,
+		.inside = true,
+	},
+	{
+		// Bigger than the output on both axes, clipped by the resize pass
+		.name = "oversized",
+		.anchor_rect = { 900, 500, 20, 20 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_BOTTOM_RIGHT,
+		.adjustment = ALL_ADJUSTMENTS,
+		.width = 4000, .height = 3000,
+		.inside = true,
+	},
+	{
+		.name = "anchor-offscreen",
+		.anchor_rect = { -5000, -5000, 10, 10 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_TOP_LEFT,
+		.adjustment = ALL_ADJUSTMENTS,
+		.width = 300, .height = 200,
+		.inside = true,
+	},
+	{
+		.name = "resize-only",
+		.anchor_rect = { 1800, 900, 20, 20 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_BOTTOM_RIGHT,
+		.adjustment = XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_RESIZE_X |
+			XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_RESIZE_Y,
+		.width = 400, .height = 400,
+		.inside = true,
+	},
+	{
+		// Constrained, but the client doesn't allow any adjustment
+		.name = "no-adjustment",
+		.anchor_rect = { 1880, 1040, 20, 20 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_BOTTOM_RIGHT,
+		.adjustment = XDG_POSITIONER_CONSTRAINT_ADJUSTMENT_NONE,
+		.width = 200, .height = 300,
+		.inside = false,
+	},
+	{
+		// Every pass runs and fails, e.g. while an output is going away
+		.name = "empty-constraint",
+		.anchor_rect = { 950, 530, 20, 20 },
+		.anchor = XDG_POSITIONER_ANCHOR_BOTTOM_RIGHT,
+		.gravity = XDG_POSITIONER_GRAVITY_BOTTOM_RIGHT,
+		.adjustment = ALL_ADJUSTMENTS,
+		.width = 200, .height = 200,
+		.has_constraint = true,
+		.constraint = { 960, 540, 0, 0 },
+		.inside = false,
+	},
+};
+
+static void init_rules(struct wlr_xdg_positioner_rules *rules,
+		const struct rule_set *set) {
+	*rules = (struct wlr_xdg_positioner_rules){
+		.anchor_rect = set->anchor_rect,
+		.anchor = set->anchor,
+		.gravity = set->gravity,
+		.constraint_adjustment = set->adjustment,
+		.size = { .width = set->width, .height = set->height },
+	};
+}
+
+static const struct wlr_box *get_constraint(const struct rule_set *set) {
+	return set->has_constraint ? &set->constraint : &output_box;
+}
+
+static bool box_inside(const struct wlr_box *box,
+		const struct wlr_box *constraint) {
+	return box->x >= constraint->x && box->y >= constraint->y &&
+		box->x + box->width <= constraint->x + constraint->width &&
+		box->y + box->height <= constraint->y + constraint->height;
+}
+
+static bool check_rule_set(const struct rule_set *set) {
+	struct wlr_xdg_positioner_rules rules;
+	init_rules(&rules, set);
+	const struct wlr_box *constraint = get_constraint(set);
+
+	struct wlr_box box;
+	wlr_xdg_positioner_rules_get_geometry(&rules, &box);
+	wlr_xdg_positioner_rules_unconstrain_box(&rules, constraint, &box);
+
+	if (wlr_box_empty(&box) || box.width > set->width ||
+			box.height > set->height) {
+		fprintf(stderr, "%s: invalid size %dx%d\n", set->name,
+			box.width, box.height);
+		return false;
+	}
+	if (box_inside(&box, constraint) != set->inside) {
+		fprintf(stderr, "%s: box %d,%d %dx%d is %s the constraint\n",
+			set->name, box.x, box.y, box.width, box.height,
+			set->inside ? "outside" : "inside");
+		return false;
+	}
+	return true;
+}
+
+static int64_t get_time_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	int iterations = 1000000;
+
+	int c;
+	while ((c = getopt(argc, argv, "i:h")) != -1) {
+		switch (c) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || iterations <= 0) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	size_t rule_sets_len = sizeof(rule_sets) / sizeof(rule_sets[0]);
+	for (size_t i = 0; i < rule_sets_len; i++) {
+		if (!check_rule_set(&rule_sets[i])) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%d calls, ns per call\n", iterations);
+	printf("%-18s %10s %12s\n", "rule set", "geometry", "unconstrain");
+
+	for (size_t i = 0; i < rule_sets_len; i++) {
+		const struct rule_set *set = &rule_sets[i];
+		struct wlr_xdg_positioner_rules rules;
+		init_rules(&rules, set);
+		const struct wlr_box *constraint = get_constraint(set);
+
+		struct wlr_box geometry;
+		int64_t start = get_time_nsec();
+		for (int k = 0; k < iterations; k++) {
+			// Move the anchor, like a popup following the pointer would
+			rules.anchor_rect.x = set->anchor_rect.x + (k & 1);
+			wlr_xdg_positioner_rules_get_geometry(&rules, &geometry);
+		}
+		double geometry_ns = (double)(get_time_nsec() - start) / iterations;
+
+		start = get_time_nsec();
+		for (int k = 0; k < iterations; k++) {
+			rules.anchor_rect.x = set->anchor_rect.x + (k & 1);
+			struct wlr_box box;
+			wlr_xdg_positioner_rules_get_geometry(&rules, &box);
+			wlr_xdg_positioner_rules_unconstrain_box(&rules, constraint, &box);
+		}
+		double unconstrain_ns =
+			(double)(get_time_nsec() - start) / iterations - geometry_ns;
+
+		printf("%-18s %10.1f %12.1f\n", set->name, geometry_ns, unconstrain_ns);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/util/region.h>
+
+/* Measures the region helpers on damage regions typical of a desktop, and
+ * the box variants working on caller-provided storage. The box variants are
+ * first checked against a plain scalar implementation, so that this also
+ * validates the SIMD kernels of the platform it runs on. */
+
+static const char usage[] =
+	"usage: %s [-i iterations]\n"
+	"  -i  number of calls per region and operation (default: 100000)\n";
+
+#define OUTPUT_WIDTH 3840
+#define OUTPUT_HEIGHT 2160
+
+struct damage {
+	const char *name;
+	pixman_region32_t region;
+};
+
+enum op_type {
+	OP_SCALE,
+	OP_TRANSFORM,
+	OP_EXPAND,
+};
+
+struct op {
+	const char *name;
+	enum op_type type;
+	float scale;
+	enum wl_output_transform transform;
+	int distance;
+};
+
+static const struct op ops[] = {
+	{ .name = "scale 2", .type = OP_SCALE, .scale = 2 },
+	{ .name = "scale 1.5", .type = OP_SCALE, .scale = 1.5 },
+	{ .name = "transform 90", .type = OP_TRANSFORM,
+		.transform = WL_OUTPUT_TRANSFORM_90 },
+	{ .name = "transform flipped-270", .type = OP_TRANSFORM,
+		.transform = WL_OUTPUT_TRANSFORM_FLIPPED_270 },
+	{ .name = "expand 1", .type = OP_EXPAND, .distance = 1 },
+};
+
+static uint32_t rand_state = 1;
+
+static int rand_range(int min, int max) {
+	// xorshift, so that runs are reproducible
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return min + (int)(rand_state % (uint32_t)(max - min + 1));
+}
+
+static void add_rect(pixman_region32_t *region, int x, int y,
+		int width, int height) {
+	pixman_region32_union_rect(region, region, x, y, width, height);
+}
+
+static void init_damage(struct damage *damages) {
+	// A fullscreen client
+	damages[0].name = "fullscreen";
+	pixman_region32_init_rect(&damages[0].region, 0, 0,
+		OUTPUT_WIDTH, OUTPUT_HEIGHT);
+
+	// A few overlapping windows, e.g. while moving one of them
+	damages[1].name = "windows";
+	pixman_region32_init(&damages[1].region);
+	for (int i = 0; i < 6; i++) {
+		add_rect(&damages[1].region, 100 + i * 420, 80 + i * 230, 1200, 800);
+	}
+
+	// Lines of text updated in a terminal, next to a blinking cursor
+	damages[2].name = "terminal";
+	pixman_region32_init(&damages[2].region);
+	for (int i = 0; i < 40; i++) {
+		add_rect(&damages[2].region, 20, 40 + i * 36,
+			rand_range(200, 1800), 18);
+	}
+	add_rect(&damages[2].region, 1900, 1500, 10, 18);
+
+	// A software cursor and a few small widgets animating
+	damages[3].name = "cursor-trail";
+	pixman_region32_init(&damages[3].region);
+	for (int i = 0; i < 16; i++) {
+		add_rect(&damages[3].region, 300 + i * 97, 600 + i * 31, 24, 24);
+	}
+
+	// Many clients updating small parts of their surfaces
+	damages[4].name = "fragmented";
+	pixman_region32_init(&damages[4].region);
+	for (int i = 0; i < 200; i++) {
+		add_rect(&damages[4].region, rand_range(0, OUTPUT_WIDTH - 64),
+			rand_range(0, OUTPUT_HEIGHT - 64), rand_range(4, 64),
+			rand_range(4, 64));
+	}
+}
+
+static void reference_box(pixman_box32_t *dst, const pixman_box32_t *src,
+		const struct op *op, int width, int height) {
+	switch (op->type) {
+	case OP_SCALE:
+		dst->x1 = floor(src->x1 * op->scale);
+		dst->y1 = floor(src->y1 * op->scale);
+		dst->x2 = ceil(src->x2 * op->scale);
+		dst->y2 = ceil(src->y2 * op->scale);
+		return;
+	case OP_EXPAND:
+		dst->x1 = src->x1 - op->distance;
+		dst->y1 = src->y1 - op->distance;
+		dst->x2 = src->x2 + op->distance;
+		dst->y2 = src->y2 + op->distance;
+		return;
+	case OP_TRANSFORM:
+		break;
+	}
+
+	switch (op->transform) {
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+		*dst = *src;
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		*dst = (pixman_box32_t){ height - src->y2, src->x1,
+			height - src->y1, src->x2 };
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		*dst = (pixman_box32_t){ width - src->x2, height - src->y2,
+			width - src->x1, height - src->y1 };
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		*dst = (pixman_box32_t){ src->y1, width - src->x2,
+			src->y2, width - src->x1 };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		*dst = (pixman_box32_t){ width - src->x2, src->y1,
+			width - src->x1, src->y2 };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		*dst = (pixman_box32_t){ src->y1, src->x1, src->y2, src->x2 };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		*dst = (pixman_box32_t){ src->x1, height - src->y2,
+			src->x2, height - src->y1 };
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		*dst = (pixman_box32_t){ height - src->y2, width - src->x2,
+			height - src->y1, width - src->x1 };
+		break;
+	}
+}
+
+static void run_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, const struct op *op) {
+	switch (op->type) {
+	case OP_SCALE:
+		wlr_region_scale_boxes(dst, src, len, op->scale, op->scale);
+		break;
+	case OP_TRANSFORM:
+		wlr_region_transform_boxes(dst, src, len, op->transform,
+			OUTPUT_WIDTH, OUTPUT_HEIGHT);
+		break;
+	case OP_EXPAND:
+		wlr_region_expand_boxes(dst, src, len, op->distance);
+		break;
+	}
+}
+
+static void run_region(pixman_region32_t *dst, pixman_region32_t *src,
+		const struct op *op) {
+	switch (op->type) {
+	case OP_SCALE:
+		wlr_region_scale(dst, src, op->scale);
+		break;
+	case OP_TRANSFORM:
+		wlr_region_transform(dst, src, op->transform,
+			OUTPUT_WIDTH, OUTPUT_HEIGHT);
+		break;
+	case OP_EXPAND:
+		wlr_region_expand(dst, src, op->distance);
+		break;
+	}
+}
+
+static bool check_boxes(const pixman_box32_t *src, int len) {
+	pixman_box32_t *dst = calloc(len, sizeof(*dst));
+	if (dst == NULL) {
+		return false;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]) && ok; i++) {
+		run_boxes(dst, src, len, &ops[i]);
+		for (int j = 0; j < len; j++) {
+			pixman_box32_t ref;
+			reference_box(&ref, &src[j], &ops[i],
+				OUTPUT_WIDTH, OUTPUT_HEIGHT);
+			if (memcmp(&ref, &dst[j], sizeof(ref)) != 0) {
+				fprintf(stderr, "%s: box %d is (%d,%d)-(%d,%d), "
+					"expected (%d,%d)-(%d,%d)\n", ops[i].name, j,
+					dst[j].x1, dst[j].y1, dst[j].x2, dst[j].y2,
+					ref.x1, ref.y1, ref.x2, ref.y2);
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	// All transforms, with odd sizes
+	for (int t = 0; t <= WL_OUTPUT_TRANSFORM_FLIPPED_270 && ok; t++) {
+		struct op op = { .type = OP_TRANSFORM, .transform = t };
+		wlr_region_transform_boxes(dst, src, len, t, 1001, 777);
+		for (int j = 0; j < len; j++) {
+			pixman_box32_t ref;
+			reference_box(&ref, &src[j], &op, 1001, 777);
+			if (memcmp(&ref, &dst[j], sizeof(ref)) != 0) {
+				fprintf(stderr, "transform %d: box %d mismatch\n", t, j);
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	free(dst);
+	return ok;
+}
+
+static int64_t get_time_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	int iterations = 100000;
+
+	int c;
+	while ((c = getopt(argc, argv, "i:h")) != -1) {
+		switch (c) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || iterations <= 0) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct damage damages[5];
+	init_damage(damages);
+	size_t damages_len = sizeof(damages) / sizeof(damages[0]);
+
+	// Negative and unaligned coordinates too, e.g. for surface damage
+	pixman_box32_t edge_cases[64];
+	for (size_t i = 0; i < sizeof(edge_cases) / sizeof(edge_cases[0]); i++) {
+		int x = rand_range(-5000, 5000), y = rand_range(-5000, 5000);
+		edge_cases[i] = (pixman_box32_t){
+			x, y, x + rand_range(1, 3000), y + rand_range(1, 3000),
+		};
+	}
+	bool ok = check_boxes(edge_cases,
+		sizeof(edge_cases) / sizeof(edge_cases[0]));
+	for (size_t i = 0; i < damages_len && ok; i++) {
+		int len;
+		const pixman_box32_t *boxes =
+			pixman_region32_rectangles(&damages[i].region, &len);
+		ok = check_boxes(boxes, len);
+	}
+	if (!ok) {
+		fprintf(stderr, "Box variants don't match the reference\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%d calls, ns per call\n", iterations);
+	printf("%-14s %6s %-22s %10s %10s\n", "damage", "rects", "operation",
+		"region", "boxes");
+
+	pixman_region32_t dst;
+	pixman_region32_init(&dst);
+	for (size_t i = 0; i < damages_len; i++) {
+		struct damage *damage = &damages[i];
+		int len;
+		const pixman_box32_t *boxes =
+			pixman_region32_rectangles(&damage->region, &len);
+		pixman_box32_t *storage = calloc(len, sizeof(*storage));
+		if (storage == NULL) {
+			return EXIT_FAILURE;
+		}
+
+		for (size_t j = 0; j < sizeof(ops) / sizeof(ops[0]); j++) {
+			const struct op *op = &ops[j];
+
+			int64_t start = get_time_nsec();
+			for (int k = 0; k < iterations; k++) {
+				run_region(&dst, &damage->region, op);
+			}
+			double region_ns = (double)(get_time_nsec() - start) / iterations;
+
+			start = get_time_nsec();
+			for (int k = 0; k < iterations; k++) {
+				run_boxes(storage, boxes, len, op);
+			}
+			double boxes_ns = (double)(get_time_nsec() - start) / iterations;
+
+			printf("%-14s %6d %-22s %10.1f %10.1f\n", damage->name, len,
+				op->name, region_ns, boxes_ns);
+		}
+
+		free(storage);
+		pixman_region32_fini(&damage->region);
+	}
+	pixman_region32_fini(&dst);
+
+	return EXIT_SUCCESS;
+}
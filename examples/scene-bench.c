@@ -0,0 +1,428 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+/* Renders a synthetic scene on headless outputs as fast as possible and
+ * reports frame time percentiles and CPU usage, for each of the requested
+ * renderers. Useful to spot scene-graph and renderer regressions.
+ *
+ * The scene is made of rects and buffers spread across nested trees (standing
+ * in for subsurfaces). All nodes move every frame so that each commit has
+ * damage. */
+
+static const char usage[] =
+	"usage: %s [-r renderer,...] [-o outputs] [-s width x height]\n"
+	"       [-n buffers] [-R rects] [-d depth] [-f frames] [-a] [-H]\n"
+	"  -r  comma-separated list of renderers (default: gles2,pixman)\n"
+	"  -o  number of outputs (default: 1)\n"
+	"  -s  output size (default: 1920x1080)\n"
+	"  -n  number of buffers (default: 64)\n"
+	"  -R  number of rects (default: 64)\n"
+	"  -d  depth of the tree each node is nested in (default: 1)\n"
+	"  -f  number of frames per output (default: 1000)\n"
+	"  -a  use buffers from the allocator (DMA-BUFs on GPU renderers)\n"
+	"      instead of shared memory buffers\n"
+	"  -H  run each renderer again with huge page backed output buffers\n"
+	"      (WLR_SHM_HUGEPAGES=1, only changes renderers using shared memory\n"
+	"      output buffers, e.g. pixman), reported as <renderer>+hp\n";
+
+struct config {
+	int outputs;
+	int width, height;
+	int buffers;
+	int rects;
+	int depth;
+	int frames;
+	bool allocator_buffers;
+	bool hugepages;
+};
+
+static const int buffer_size = 256;
+
+struct shm_buffer {
+	struct wlr_buffer base;
+	void *data;
+	size_t stride;
+};
+
+static void shm_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool shm_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*data = buffer->data;
+	*format = DRM_FORMAT_ARGB8888;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void shm_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// Nothing to do
+}
+
+static const struct wlr_buffer_impl shm_buffer_impl = {
+	.destroy = shm_buffer_destroy,
+	.begin_data_ptr_access = shm_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = shm_buffer_end_data_ptr_access,
+};
+
+static struct wlr_buffer *shm_buffer_create(int width, int height,
+		uint32_t color) {
+	struct shm_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+	buffer->stride = width * 4;
+	buffer->data = malloc(buffer->stride * height);
+	if (buffer->data == NULL) {
+		free(buffer);
+		return NULL;
+	}
+	uint32_t *pixels = buffer->data;
+	for (int i = 0; i < width * height; i++) {
+		pixels[i] = color;
+	}
+	wlr_buffer_init(&buffer->base, &shm_buffer_impl, width, height);
+	return &buffer->base;
+}
+
+static struct wlr_buffer *allocator_buffer_create(
+		struct wlr_allocator *allocator, int width, int height) {
+	struct wlr_drm_format *format =
+		calloc(1, sizeof(*format) + sizeof(format->modifiers[0]));
+	if (format == NULL) {
+		return NULL;
+	}
+	format->format = DRM_FORMAT_ARGB8888;
+	format->len = 1;
+	format->capacity = 1;
+	format->modifiers[0] = DRM_FORMAT_MOD_INVALID;
+	struct wlr_buffer *buffer =
+		wlr_allocator_create_buffer(allocator, width, height, format);
+	free(format);
+	return buffer;
+}
+
+static struct wlr_scene_tree *create_nested_tree(struct wlr_scene_tree *parent,
+		int depth) {
+	struct wlr_scene_tree *tree = parent;
+	for (int i = 0; i < depth; i++) {
+		tree = wlr_scene_tree_create(tree);
+		wlr_scene_node_set_position(&tree->node, 1, 1);
+	}
+	return tree;
+}
+
+struct node {
+	struct wlr_scene_node *node;
+	int x, y, dx, dy;
+};
+
+static void node_move(struct node *node, int width, int height) {
+	node->x += node->dx;
+	node->y += node->dy;
+	if (node->x < 0 || node->x + buffer_size > width) {
+		node->dx = -node->dx;
+	}
+	if (node->y < 0 || node->y + buffer_size > height) {
+		node->dy = -node->dy;
+	}
+	wlr_scene_node_set_position(node->node, node->x, node->y);
+}
+
+static int64_t timespec_to_nsec(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static int64_t timeval_to_nsec(const struct timeval *tv) {
+	return (int64_t)tv->tv_sec * 1000000000 + tv->tv_usec * 1000;
+}
+
+static int64_t get_time_nsec(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return timespec_to_nsec(&ts);
+}
+
+static int compare_int64(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static bool run_bench(const char *renderer_name, bool hugepages,
+		const struct config *config) {
+	setenv("WLR_RENDERER", renderer_name, true);
+	setenv("WLR_SHM_HUGEPAGES", hugepages ? "1" : "0", true);
+	char label[64];
+	snprintf(label, sizeof(label), "%s%s", renderer_name, hugepages ? "+hp" : "");
+
+	bool ok = false;
+	struct wl_display *display = wl_display_create();
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	struct wlr_backend *backend = wlr_headless_backend_create(display);
+	struct wlr_renderer *renderer = NULL;
+	struct wlr_allocator *allocator = NULL;
+	struct wlr_scene *scene = NULL;
+	struct wlr_scene_output **scene_outputs = NULL;
+	struct node *nodes = NULL;
+	int64_t *frame_times = NULL;
+	if (backend == NULL) {
+		goto out;
+	}
+
+	renderer = wlr_renderer_autocreate(backend);
+	if (renderer == NULL) {
+		fprintf(stderr, "%s: failed to create renderer\n", renderer_name);
+		goto out;
+	}
+	allocator = wlr_allocator_autocreate(backend, renderer);
+	if (allocator == NULL) {
+		fprintf(stderr, "%s: failed to create allocator\n", renderer_name);
+		goto out;
+	}
+
+	scene = wlr_scene_create();
+
+	scene_outputs = calloc(config->outputs, sizeof(*scene_outputs));
+	if (scene_outputs == NULL) {
+		goto out;
+	}
+	for (int i = 0; i < config->outputs; i++) {
+		struct wlr_output *output = wlr_headless_add_output(backend,
+			config->width, config->height);
+		wlr_output_init_render(output, allocator, renderer);
+		wlr_output_enable(output, true);
+		if (!wlr_output_commit(output)) {
+			fprintf(stderr, "%s: failed to enable output\n", renderer_name);
+			goto out;
+		}
+		scene_outputs[i] = wlr_scene_output_create(scene, output);
+		wlr_scene_output_set_position(scene_outputs[i], i * config->width, 0);
+	}
+
+	if (!wlr_backend_start(backend)) {
+		goto out;
+	}
+
+	int width = config->outputs * config->width;
+	int height = config->height;
+	int nodes_len = config->buffers + config->rects;
+	nodes = calloc(nodes_len, sizeof(*nodes));
+	frame_times = calloc(config->frames * config->outputs,
+		sizeof(*frame_times));
+	if (nodes == NULL || frame_times == NULL) {
+		goto out;
+	}
+
+	srand(42);
+	for (int i = 0; i < nodes_len; i++) {
+		struct wlr_scene_tree *tree = create_nested_tree(&scene->tree,
+			config->depth - 1);
+		uint32_t color = 0xFF000000 | (rand() & 0xFFFFFF);
+
+		if (i < config->buffers) {
+			struct wlr_buffer *buffer = config->allocator_buffers ?
+				allocator_buffer_create(allocator, buffer_size, buffer_size) :
+				shm_buffer_create(buffer_size, buffer_size, color);
+			if (buffer == NULL) {
+				fprintf(stderr, "%s: failed to create buffer\n",
+					renderer_name);
+				goto out;
+			}
+			struct wlr_scene_buffer *scene_buffer =
+				wlr_scene_buffer_create(tree, buffer);
+			wlr_buffer_drop(buffer);
+			nodes[i].node = &scene_buffer->node;
+		} else {
+			float rgba[4] = {
+				(color & 0xFF) / 255.0, ((color >> 8) & 0xFF) / 255.0,
+				((color >> 16) & 0xFF) / 255.0, 1,
+			};
+			struct wlr_scene_rect *rect = wlr_scene_rect_create(tree,
+				buffer_size, buffer_size, rgba);
+			nodes[i].node = &rect->node;
+		}
+
+		nodes[i].x = rand() % (width - buffer_size);
+		nodes[i].y = rand() % (height - buffer_size);
+		nodes[i].dx = rand() % 2 ? 3 : -3;
+		nodes[i].dy = rand() % 2 ? 2 : -2;
+	}
+
+	// Warm up texture uploads and allocations
+	for (int i = 0; i < config->outputs; i++) {
+		wlr_scene_output_commit(scene_outputs[i]);
+	}
+
+	struct rusage usage_start, usage_end;
+	getrusage(RUSAGE_SELF, &usage_start);
+	int64_t start = get_time_nsec(CLOCK_MONOTONIC);
+
+	int frames_len = 0, failed = 0;
+	for (int f = 0; f < config->frames; f++) {
+		for (int i = 0; i < nodes_len; i++) {
+			node_move(&nodes[i], width, height);
+		}
+
+		for (int i = 0; i < config->outputs; i++) {
+			int64_t frame_start = get_time_nsec(CLOCK_MONOTONIC);
+			if (!wlr_scene_output_commit(scene_outputs[i])) {
+				failed++;
+				continue;
+			}
+			frame_times[frames_len++] =
+				get_time_nsec(CLOCK_MONOTONIC) - frame_start;
+		}
+
+		// Process buffer releases and present events
+		wl_event_loop_dispatch(loop, 0);
+	}
+
+	int64_t elapsed = get_time_nsec(CLOCK_MONOTONIC) - start;
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	if (frames_len == 0) {
+		fprintf(stderr, "%s: no frame committed\n", renderer_name);
+		goto out;
+	}
+
+	qsort(frame_times, frames_len, sizeof(*frame_times), compare_int64);
+	int64_t sum = 0;
+	for (int i = 0; i < frames_len; i++) {
+		sum += frame_times[i];
+	}
+
+	int64_t cpu =
+		timeval_to_nsec(&usage_end.ru_utime) +
+		timeval_to_nsec(&usage_end.ru_stime) -
+		timeval_to_nsec(&usage_start.ru_utime) -
+		timeval_to_nsec(&usage_start.ru_stime);
+
+	printf("%-8s %8d %8d %10.3f %10.3f %10.3f %10.3f %10.1f %6.1f%% %10ld\n",
+		label, frames_len, failed, sum / 1e6 / frames_len,
+		frame_times[frames_len / 2] / 1e6,
+		frame_times[frames_len * 95 / 100] / 1e6,
+		frame_times[frames_len * 99 / 100] / 1e6,
+		frames_len * 1e9 / elapsed, 100.0 * cpu / elapsed,
+		usage_end.ru_maxrss);
+	ok = true;
+
+out:
+	free(frame_times);
+	free(nodes);
+	free(scene_outputs);
+	if (scene != NULL) {
+		wlr_scene_node_destroy(&scene->tree.node);
+	}
+	wl_display_destroy(display);
+	wlr_allocator_destroy(allocator);
+	wlr_renderer_destroy(renderer);
+	return ok;
+}
+
+static bool parse_size(const char *str, int *width, int *height) {
+	return sscanf(str, "%dx%d", width, height) == 2 &&
+		*width > 0 && *height > 0;
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	const char *renderers = "gles2,pixman";
+	struct config config = {
+		.outputs = 1,
+		.width = 1920,
+		.height = 1080,
+		.buffers = 64,
+		.rects = 64,
+		.depth = 1,
+		.frames = 1000,
+	};
+
+	int c;
+	while ((c = getopt(argc, argv, "r:o:s:n:R:d:f:aHh")) != -1) {
+		switch (c) {
+		case 'r':
+			renderers = optarg;
+			break;
+		case 'o':
+			config.outputs = atoi(optarg);
+			break;
+		case 's':
+			if (!parse_size(optarg, &config.width, &config.height)) {
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			config.buffers = atoi(optarg);
+			break;
+		case 'R':
+			config.rects = atoi(optarg);
+			break;
+		case 'd':
+			config.depth = atoi(optarg);
+			break;
+		case 'f':
+			config.frames = atoi(optarg);
+			break;
+		case 'a':
+			config.allocator_buffers = true;
+			break;
+		case 'H':
+			config.hugepages = true;
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || config.outputs <= 0 || config.buffers < 0 ||
+			config.rects < 0 || config.depth <= 0 || config.frames <= 0 ||
+			config.width <= buffer_size || config.height <= buffer_size) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%d output(s) %dx%d, %d buffers, %d rects, depth %d\n",
+		config.outputs, config.width, config.height, config.buffers,
+		config.rects, config.depth);
+	printf("%-8s %8s %8s %10s %10s %10s %10s %10s %7s %10s\n",
+		"renderer", "frames", "failed", "avg (ms)", "p50 (ms)", "p95 (ms)",
+		"p99 (ms)", "fps", "cpu", "rss (KiB)");
+
+	bool ok = true;
+	char *list = strdup(renderers);
+	char *saveptr = NULL;
+	for (char *name = strtok_r(list, ",", &saveptr); name != NULL;
+			name = strtok_r(NULL, ",", &saveptr)) {
+		ok = run_bench(name, false, &config) && ok;
+		if (config.hugepages) {
+			ok = run_bench(name, true, &config) && ok;
+		}
+	}
+	free(list);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,265 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+/* Measures the cost of scene-graph node operations over trees of increasing
+ * size. Nothing is rendered: the operations only damage the scene outputs and
+ * update the outputs each node is visible on, like a compositor moving many
+ * windows at once when switching workspaces. */
+
+static const char usage[] =
+	"usage: %s [-o outputs] [-i iterations] [-t]\n"
+	"  -o  number of outputs (default: 2)\n"
+	"  -i  number of passes over the tree per operation (default: 10)\n"
+	"  -t  batch each pass with wlr_scene_begin_update()\n";
+
+static const int tree_sizes[] = { 10, 100, 1000, 10000 };
+static const int output_width = 1920, output_height = 1080;
+static const int node_size = 64;
+
+struct bench_buffer {
+	struct wlr_buffer base;
+	uint32_t data[1];
+};
+
+static void bench_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	free(buffer);
+}
+
+static bool bench_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*data = buffer->data;
+	*format = DRM_FORMAT_ARGB8888;
+	*stride = sizeof(buffer->data);
+	return true;
+}
+
+static void bench_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// Nothing to do
+}
+
+static const struct wlr_buffer_impl bench_buffer_impl = {
+	.destroy = bench_buffer_destroy,
+	.begin_data_ptr_access = bench_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = bench_buffer_end_data_ptr_access,
+};
+
+// Tiny buffer, only its size matters to the scene-graph
+static struct wlr_buffer *bench_buffer_create(void) {
+	struct bench_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+	wlr_buffer_init(&buffer->base, &bench_buffer_impl, 1, 1);
+	return &buffer->base;
+}
+
+struct bench {
+	struct wlr_scene *scene;
+	struct wlr_scene_tree *trees[2];
+	struct wlr_scene_buffer **buffers;
+	int len;
+	int width; // of the whole output layout
+	struct wlr_buffer *wlr_buffers[2];
+};
+
+static int64_t get_time_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void node_grid_position(struct bench *bench, int i, int pass,
+		int *x, int *y) {
+	int cols = bench->width / node_size;
+	int rows = output_height / node_size;
+	int cell = (i + pass) % (cols * rows);
+	*x = (cell % cols) * node_size;
+	*y = (cell / cols) * node_size;
+}
+
+static void op_set_position(struct bench *bench, int i, int pass) {
+	int x, y;
+	node_grid_position(bench, i, pass + 1, &x, &y);
+	wlr_scene_node_set_position(&bench->buffers[i]->node, x, y);
+}
+
+static void op_raise_to_top(struct bench *bench, int i, int pass) {
+	wlr_scene_node_raise_to_top(&bench->buffers[i]->node);
+}
+
+static void op_reparent(struct bench *bench, int i, int pass) {
+	wlr_scene_node_reparent(&bench->buffers[i]->node,
+		bench->trees[(i + pass + 1) % 2]);
+}
+
+static void op_set_buffer(struct bench *bench, int i, int pass) {
+	pixman_region32_t damage;
+	pixman_region32_init_rect(&damage, 0, 0, 1, 1);
+	wlr_scene_buffer_set_buffer_with_damage(bench->buffers[i],
+		bench->wlr_buffers[(pass + 1) % 2], &damage);
+	pixman_region32_fini(&damage);
+}
+
+static void op_node_at(struct bench *bench, int i, int pass) {
+	int x, y;
+	node_grid_position(bench, i, pass, &x, &y);
+	double nx, ny;
+	wlr_scene_node_at(&bench->scene->tree.node, x + node_size / 2,
+		y + node_size / 2, &nx, &ny);
+}
+
+struct op {
+	const char *name;
+	void (*run)(struct bench *bench, int i, int pass);
+};
+
+static const struct op ops[] = {
+	{ "set_position", op_set_position },
+	{ "raise_to_top", op_raise_to_top },
+	{ "reparent", op_reparent },
+	{ "set_buffer_with_damage", op_set_buffer },
+	{ "node_at", op_node_at },
+};
+
+static bool bench_init(struct bench *bench, int len) {
+	bench->len = len;
+	bench->buffers = calloc(len, sizeof(*bench->buffers));
+	if (bench->buffers == NULL) {
+		return false;
+	}
+
+	bench->trees[0] = wlr_scene_tree_create(&bench->scene->tree);
+	bench->trees[1] = wlr_scene_tree_create(&bench->scene->tree);
+	for (int i = 0; i < len; i++) {
+		bench->buffers[i] = wlr_scene_buffer_create(bench->trees[i % 2],
+			bench->wlr_buffers[0]);
+		wlr_scene_buffer_set_dest_size(bench->buffers[i],
+			node_size, node_size);
+		int x, y;
+		node_grid_position(bench, i, 0, &x, &y);
+		wlr_scene_node_set_position(&bench->buffers[i]->node, x, y);
+	}
+	return true;
+}
+
+static void bench_finish(struct bench *bench) {
+	wlr_scene_node_destroy(&bench->trees[0]->node);
+	wlr_scene_node_destroy(&bench->trees[1]->node);
+	free(bench->buffers);
+	bench->buffers = NULL;
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	int outputs_len = 2;
+	int iterations = 10;
+	bool batch = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "o:i:th")) != -1) {
+		switch (c) {
+		case 'o':
+			outputs_len = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 't':
+			batch = true;
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || outputs_len <= 0 || iterations <= 0) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct wl_display *display = wl_display_create();
+	struct wlr_backend *backend = wlr_headless_backend_create(display);
+	if (backend == NULL) {
+		wl_display_destroy(display);
+		return EXIT_FAILURE;
+	}
+
+	struct bench bench = {
+		.scene = wlr_scene_create(),
+		.width = outputs_len * output_width,
+		.wlr_buffers = { bench_buffer_create(), bench_buffer_create() },
+	};
+	if (bench.wlr_buffers[0] == NULL || bench.wlr_buffers[1] == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < outputs_len; i++) {
+		struct wlr_output *output = wlr_headless_add_output(backend,
+			output_width, output_height);
+		struct wlr_scene_output *scene_output =
+			wlr_scene_output_create(bench.scene, output);
+		wlr_scene_output_set_position(scene_output, i * output_width, 0);
+	}
+	if (!wlr_backend_start(backend)) {
+		wl_display_destroy(display);
+		return EXIT_FAILURE;
+	}
+
+	printf("%d output(s), %d pass(es)%s, ns per operation\n",
+		outputs_len, iterations, batch ? " batched" : "");
+	printf("%-24s", "nodes");
+	for (size_t s = 0; s < sizeof(tree_sizes) / sizeof(tree_sizes[0]); s++) {
+		printf(" %10d", tree_sizes[s]);
+	}
+	printf("\n");
+
+	for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+		printf("%-24s", ops[o].name);
+		for (size_t s = 0; s < sizeof(tree_sizes) / sizeof(tree_sizes[0]); s++) {
+			if (!bench_init(&bench, tree_sizes[s])) {
+				return EXIT_FAILURE;
+			}
+
+			int64_t start = get_time_nsec();
+			for (int pass = 0; pass < iterations; pass++) {
+				if (batch) {
+					wlr_scene_begin_update(bench.scene);
+				}
+				for (int i = 0; i < bench.len; i++) {
+					ops[o].run(&bench, i, pass);
+				}
+				if (batch) {
+					wlr_scene_commit_update(bench.scene);
+				}
+			}
+			int64_t elapsed = get_time_nsec() - start;
+
+			printf(" %10.1f", (double)elapsed / iterations / bench.len);
+			fflush(stdout);
+			bench_finish(&bench);
+		}
+		printf("\n");
+	}
+
+	wlr_scene_node_destroy(&bench.scene->tree.node);
+	wlr_buffer_drop(bench.wlr_buffers[0]);
+	wlr_buffer_drop(bench.wlr_buffers[1]);
+	wl_display_destroy(display);
+	return EXIT_SUCCESS;
+}
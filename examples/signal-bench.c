@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include "util/signal.h"
+
+/* Measures the cost of emitting a signal depending on the number of
+ * listeners, with wl_signal_emit() as a reference. The listeners do nothing,
+ * so only the emission overhead is measured. */
+
+static const char usage[] =
+	"usage: %s [-i iterations]\n"
+	"  -i  number of emissions per listener count (default: 1000000)\n";
+
+static const int listener_counts[] = { 0, 1, 2, 4, 8, 32, 128 };
+
+static void handle_notify(struct wl_listener *listener, void *data) {
+	// Do nothing
+}
+
+static int64_t get_time_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double bench_emit(struct wl_signal *signal, int iterations,
+		void (*emit)(struct wl_signal *signal, void *data)) {
+	int64_t start = get_time_nsec();
+	for (int i = 0; i < iterations; i++) {
+		emit(signal, NULL);
+	}
+	return (double)(get_time_nsec() - start) / iterations;
+}
+
+int main(int argc, char *argv[]) {
+	int iterations = 1000000;
+
+	int c;
+	while ((c = getopt(argc, argv, "i:h")) != -1) {
+		switch (c) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || iterations <= 0) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%d emissions, ns per emission\n", iterations);
+	printf("%-10s %14s %22s\n", "listeners", "wl_signal_emit",
+		"wlr_signal_emit_safe");
+
+	for (size_t i = 0; i < sizeof(listener_counts) / sizeof(listener_counts[0]); i++) {
+		int len = listener_counts[i];
+		struct wl_listener *listeners = calloc(len > 0 ? len : 1,
+			sizeof(*listeners));
+		if (listeners == NULL) {
+			return EXIT_FAILURE;
+		}
+
+		struct wl_signal signal;
+		wl_signal_init(&signal);
+		for (int j = 0; j < len; j++) {
+			listeners[j].notify = handle_notify;
+			wl_signal_add(&signal, &listeners[j]);
+		}
+
+		double reference = bench_emit(&signal, iterations, wl_signal_emit);
+		double safe = bench_emit(&signal, iterations, wlr_signal_emit_safe);
+		printf("%-10d %14.1f %22.1f\n", len, reference, safe);
+
+		for (int j = 0; j < len; j++) {
+			wl_list_remove(&listeners[j].link);
+		}
+		free(listeners);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1153 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_subcompositor.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/* Records the wire traffic of a client session, then replays it against a
+ * headless compositor and reports the cost of composition and protocol
+ * dispatch. Useful to benchmark scene-graph, compositor and shm code paths
+ * with real-world clients, reproducibly.
+ *
+ * When recording, the client is started with WAYLAND_SOCKET set to a
+ * connection proxied by the tool, which runs a minimal compositor on the
+ * usual backends. Requests are written to the trace along with the contents
+ * of the shared memory the client passes: pages which changed are saved each
+ * time the client sends data, so that pixels are up to date when buffers are
+ * committed. Other file descriptors (e.g. DMA-BUFs, data transfer pipes) are
+ * replaced with /dev/null on replay, so only shm clients replay faithfully.
+ *
+ * Events are not recorded: the replay compositor exposes the same globals
+ * and sends the same serials as long as the session doesn't depend on input
+ * or on timing, which is why no seat is advertised. Objects created by the
+ * compositor (e.g. data offers) can't be replayed.
+ *
+ * The trace is a header followed by records, in host byte order. */
+
+static const char usage[] =
+	"usage: %s -o trace -s startup-command\n"
+	"       %s -i trace [-f] [-v]\n"
+	"  -o  record the session of the startup command to the trace\n"
+	"  -s  command to start the client with\n"
+	"  -i  replay the trace on a headless output\n"
+	"  -f  replay as fast as possible instead of at the recorded pace\n"
+	"  -v  print the timings of each frame\n";
+
+#define TRACE_MAGIC "WLRTRACE"
+#define TRACE_VERSION 1
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	int32_t width, height; // of the output
+	float scale;
+};
+
+enum trace_record_type {
+	// Client data: struct trace_data, then the bytes
+	TRACE_DATA,
+	// A shared memory file was created or resized: struct trace_fd
+	TRACE_FD_SIZE,
+	// Contents of a shared memory file: struct trace_fd, then the bytes
+	TRACE_FD_WRITE,
+	// A file descriptor which can't be mapped was passed: struct trace_fd
+	TRACE_FD_OTHER,
+};
+
+struct trace_record {
+	uint32_t type; // enum trace_record_type
+	uint32_t size; // of the payload following the record
+	uint64_t time_ns; // since the start of the session
+};
+
+struct trace_fd {
+	uint32_t index;
+	uint32_t pad;
+	uint64_t value; // size or write offset
+};
+
+struct trace_data {
+	uint32_t fds_len;
+	uint32_t fds[]; // file indices, followed by the bytes
+};
+
+// Same as the libwayland limits, so that no message is split
+#define MAX_FDS 28
+#define MAX_CHUNK_SIZE 4096
+
+struct server {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_scene *scene;
+	struct wlr_compositor *compositor;
+	struct wlr_xdg_shell *xdg_shell;
+
+	struct wlr_output *output; // the first one, with a global
+	struct wlr_scene_output *scene_output;
+	struct wlr_render_timer *render_timer;
+
+	// Replay statistics
+	int64_t *frame_cpu_ns, *frame_gpu_ns;
+	size_t frames_len, frames_cap;
+	int64_t frame_cpu_total_ns;
+	int64_t dispatch_cpu_ns;
+	bool gpu_pending;
+
+	struct wl_client *client;
+	bool client_destroyed;
+
+	struct wl_listener new_output;
+	struct wl_listener output_frame;
+	struct wl_listener output_destroy;
+	struct wl_listener new_xdg_surface;
+	struct wl_listener client_destroy;
+};
+
+static int64_t timespec_to_nsec(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static int64_t get_time_nsec(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return timespec_to_nsec(&ts);
+}
+
+static int compare_int64(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static size_t get_heap_in_use(void) {
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#endif
+#endif
+	return 0;
+}
+
+static void poll_gpu_time(struct server *server) {
+	if (!server->gpu_pending) {
+		return;
+	}
+	int64_t duration = wlr_render_timer_get_duration_ns(server->render_timer);
+	if (duration >= 0) {
+		server->frame_gpu_ns[server->frames_len - 1] = duration;
+		server->gpu_pending = false;
+	}
+}
+
+static void record_frame(struct server *server, int64_t cpu_ns,
+		bool rendered) {
+	if (server->frame_cpu_ns == NULL) {
+		// Not replaying
+		return;
+	}
+	server->frame_cpu_total_ns += cpu_ns;
+	if (!rendered) {
+		return;
+	}
+
+	if (server->frames_len == server->frames_cap) {
+		size_t cap = server->frames_cap * 2;
+		int64_t *cpu = realloc(server->frame_cpu_ns, cap * sizeof(*cpu));
+		if (cpu == NULL) {
+			return;
+		}
+		server->frame_cpu_ns = cpu;
+		int64_t *gpu = realloc(server->frame_gpu_ns, cap * sizeof(*gpu));
+		if (gpu == NULL) {
+			return;
+		}
+		server->frame_gpu_ns = gpu;
+		server->frames_cap = cap;
+	}
+
+	server->frame_cpu_ns[server->frames_len] = cpu_ns;
+	server->frame_gpu_ns[server->frames_len] = -1;
+	server->frames_len++;
+	server->gpu_pending = server->render_timer != NULL;
+}
+
+static void output_handle_frame(struct wl_listener *listener, void *data) {
+	struct server *server = wl_container_of(listener, server, output_frame);
+
+	if (server->render_timer != NULL) {
+		// The GPU is most likely done with the previous frame by now
+		poll_gpu_time(server);
+		server->gpu_pending = false;
+		wlr_renderer_set_timer(server->renderer, server->render_timer);
+	}
+
+	int64_t start = get_time_nsec(CLOCK_THREAD_CPUTIME_ID);
+	bool ok = wlr_scene_output_commit(server->scene_output);
+	int64_t cpu_ns = get_time_nsec(CLOCK_THREAD_CPUTIME_ID) - start;
+
+	// The timer is detached by wlr_renderer_end(), so it's still attached if
+	// there was nothing to render
+	bool rendered = ok;
+	if (server->render_timer != NULL) {
+		rendered = ok && server->renderer->timer == NULL;
+		wlr_renderer_set_timer(server->renderer, NULL);
+	}
+	record_frame(server, cpu_ns, rendered);
+	if (rendered) {
+		poll_gpu_time(server);
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wlr_scene_output_send_frame_done(server->scene_output, &now);
+}
+
+static void output_handle_destroy(struct wl_listener *listener, void *data) {
+	struct server *server = wl_container_of(listener, server, output_destroy);
+	wl_list_remove(&server->output_frame.link);
+	wl_list_remove(&server->output_destroy.link);
+	server->output = NULL;
+	server->scene_output = NULL;
+}
+
+static void server_handle_new_output(struct wl_listener *listener,
+		void *data) {
+	struct server *server = wl_container_of(listener, server, new_output);
+	struct wlr_output *wlr_output = data;
+
+	wlr_output_init_render(wlr_output, server->allocator, server->renderer);
+
+	if (!wl_list_empty(&wlr_output->modes)) {
+		struct wlr_output_mode *mode = wlr_output_preferred_mode(wlr_output);
+		wlr_output_set_mode(wlr_output, mode);
+	}
+	wlr_output_enable(wlr_output, true);
+	wlr_output_commit(wlr_output);
+
+	// Other outputs are ignored, so that the globals are the same as when
+	// replaying
+	if (server->output != NULL) {
+		return;
+	}
+
+	server->output = wlr_output;
+	server->scene_output = wlr_scene_output_create(server->scene, wlr_output);
+	server->output_frame.notify = output_handle_frame;
+	wl_signal_add(&wlr_output->events.frame, &server->output_frame);
+	server->output_destroy.notify = output_handle_destroy;
+	wl_signal_add(&wlr_output->events.destroy, &server->output_destroy);
+
+	wlr_output_create_global(wlr_output);
+}
+
+static void server_handle_new_xdg_surface(struct wl_listener *listener,
+		void *data) {
+	struct server *server = wl_container_of(listener, server, new_xdg_surface);
+	struct wlr_xdg_surface *xdg_surface = data;
+
+	// Popups are added to the tree of their parent by the scene helper
+	if (xdg_surface->role == WLR_XDG_SURFACE_ROLE_TOPLEVEL) {
+		wlr_scene_xdg_surface_create(&server->scene->tree, xdg_surface);
+	}
+}
+
+static void server_handle_client_destroy(struct wl_listener *listener,
+		void *data) {
+	struct server *server = wl_container_of(listener, server, client_destroy);
+	wl_list_remove(&server->client_destroy.link);
+	server->client = NULL;
+	server->client_destroyed = true;
+	wl_display_terminate(server->display);
+}
+
+/**
+ * Sets up the compositor. The globals must be created in the same order when
+ * recording and replaying, since clients bind them by name.
+ */
+static bool server_init(struct server *server, bool headless) {
+	server->display = wl_display_create();
+	server->loop = wl_display_get_event_loop(server->display);
+	server->backend = headless ?
+		wlr_headless_backend_create(server->display) :
+		wlr_backend_autocreate(server->display);
+	if (server->backend == NULL) {
+		fprintf(stderr, "failed to create backend\n");
+		return false;
+	}
+
+	server->renderer = wlr_renderer_autocreate(server->backend);
+	if (server->renderer == NULL) {
+		fprintf(stderr, "failed to create renderer\n");
+		return false;
+	}
+	// Only advertise wl_shm, which is all that can be replayed, so that
+	// the globals don't depend on the renderer
+	if (!wlr_renderer_init_wl_shm(server->renderer, server->display)) {
+		return false;
+	}
+
+	server->allocator = wlr_allocator_autocreate(server->backend,
+		server->renderer);
+	if (server->allocator == NULL) {
+		fprintf(stderr, "failed to create allocator\n");
+		return false;
+	}
+
+	server->scene = wlr_scene_create();
+	server->compositor =
+		wlr_compositor_create(server->display, server->renderer);
+	wlr_subcompositor_create(server->display);
+	wlr_data_device_manager_create(server->display);
+	server->xdg_shell = wlr_xdg_shell_create(server->display, 3);
+
+	server->new_output.notify = server_handle_new_output;
+	wl_signal_add(&server->backend->events.new_output, &server->new_output);
+	server->new_xdg_surface.notify = server_handle_new_xdg_surface;
+	wl_signal_add(&server->xdg_shell->events.new_surface,
+		&server->new_xdg_surface);
+
+	return true;
+}
+
+static void server_finish(struct server *server) {
+	if (server->display == NULL) {
+		return;
+	}
+	wl_display_destroy_clients(server->display);
+	if (server->scene != NULL) {
+		wlr_scene_node_destroy(&server->scene->tree.node);
+	}
+	wl_display_destroy(server->display);
+	wlr_render_timer_destroy(server->render_timer);
+	wlr_allocator_destroy(server->allocator);
+	wlr_renderer_destroy(server->renderer);
+	free(server->frame_cpu_ns);
+	free(server->frame_gpu_ns);
+}
+
+static struct wl_client *server_add_client(struct server *server, int fd) {
+	server->client = wl_client_create(server->display, fd);
+	if (server->client == NULL) {
+		close(fd);
+		return NULL;
+	}
+	server->client_destroy.notify = server_handle_client_destroy;
+	wl_client_add_destroy_listener(server->client, &server->client_destroy);
+	return server->client;
+}
+
+/**
+ * Receives a chunk of data along with file descriptors. Returns the number of
+ * bytes read, zero on hangup and -1 on error.
+ */
+static ssize_t recv_chunk(int sock, void *buf, size_t size, int *fds,
+		size_t *fds_len) {
+	char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+	struct iovec iov = { .iov_base = buf, .iov_len = size };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+
+	ssize_t n;
+	do {
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+
+	*fds_len = 0;
+	if (n < 0) {
+		return -1;
+	}
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+				cmsg->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+		size_t len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(&fds[*fds_len], CMSG_DATA(cmsg), len * sizeof(int));
+		*fds_len += len;
+	}
+	return n;
+}
+
+static bool send_chunk(int sock, const void *buf, size_t size,
+		const int *fds, size_t fds_len) {
+	char control[CMSG_SPACE(sizeof(int) * MAX_FDS)] = {0};
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = size };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	if (fds_len > 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds_len);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds_len);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fds_len);
+	}
+
+	ssize_t n;
+	do {
+		n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	return n == (ssize_t)size;
+}
+
+/**
+ * A file descriptor passed by the client. Shared memory files are kept
+ * mapped along with a copy of their contents, to find out which pages the
+ * client has written to.
+ */
+struct recorded_file {
+	uint32_t index;
+	dev_t dev;
+	ino_t ino;
+	int fd;
+	void *data;
+	uint8_t *shadow;
+	size_t size;
+};
+
+struct recorder {
+	struct server *server;
+	FILE *trace;
+	int64_t start_ns;
+	bool failed;
+
+	int client_fd, server_fd;
+	struct wl_event_source *client_source, *server_source;
+
+	struct recorded_file *files;
+	size_t files_len, files_cap;
+	uint32_t next_index;
+};
+
+static void recorder_write(struct recorder *recorder, uint32_t type,
+		const void *payload, size_t payload_size,
+		const void *extra, size_t extra_size) {
+	struct trace_record record = {
+		.type = type,
+		.size = payload_size + extra_size,
+		.time_ns = get_time_nsec(CLOCK_MONOTONIC) - recorder->start_ns,
+	};
+	bool ok = fwrite(&record, sizeof(record), 1, recorder->trace) == 1 &&
+		fwrite(payload, 1, payload_size, recorder->trace) == payload_size &&
+		fwrite(extra, 1, extra_size, recorder->trace) == extra_size;
+	if (!ok && !recorder->failed) {
+		fprintf(stderr, "failed to write trace: %s\n", strerror(errno));
+		recorder->failed = true;
+		wl_display_terminate(recorder->server->display);
+	}
+}
+
+static void recorder_snapshot_file(struct recorder *recorder,
+		struct recorded_file *file) {
+	struct stat st;
+	if (fstat(file->fd, &st) != 0) {
+		return;
+	}
+
+	size_t size = st.st_size;
+	if (size != file->size) {
+		// Pools only ever grow
+		void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, file->fd, 0);
+		uint8_t *shadow = realloc(file->shadow, size);
+		if (data == MAP_FAILED || shadow == NULL) {
+			if (data != MAP_FAILED) {
+				munmap(data, size);
+			}
+			return;
+		}
+		memset(shadow + file->size, 0,
+			size > file->size ? size - file->size : 0);
+		if (file->data != NULL) {
+			munmap(file->data, file->size);
+		}
+		file->data = data;
+		file->shadow = shadow;
+		file->size = size;
+
+		struct trace_fd fd = { .index = file->index, .value = size };
+		recorder_write(recorder, TRACE_FD_SIZE, &fd, sizeof(fd), NULL, 0);
+	}
+
+	// Write runs of changed pages
+	const size_t page_size = 4096;
+	const uint8_t *data = file->data;
+	size_t offset = 0;
+	while (offset < file->size) {
+		size_t len = file->size - offset < page_size ?
+			file->size - offset : page_size;
+		if (memcmp(data + offset, file->shadow + offset, len) == 0) {
+			offset += len;
+			continue;
+		}
+
+		size_t end = offset + len;
+		while (end < file->size) {
+			len = file->size - end < page_size ? file->size - end : page_size;
+			if (memcmp(data + end, file->shadow + end, len) == 0) {
+				break;
+			}
+			end += len;
+		}
+
+		memcpy(file->shadow + offset, data + offset, end - offset);
+		struct trace_fd fd = { .index = file->index, .value = offset };
+		recorder_write(recorder, TRACE_FD_WRITE, &fd, sizeof(fd),
+			file->shadow + offset, end - offset);
+		offset = end;
+	}
+}
+
+static uint32_t recorder_add_other_file(struct recorder *recorder) {
+	uint32_t index = recorder->next_index++;
+	struct trace_fd record = { .index = index };
+	recorder_write(recorder, TRACE_FD_OTHER, &record, sizeof(record), NULL, 0);
+	return index;
+}
+
+static uint32_t recorder_add_file(struct recorder *recorder, int fd) {
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		return recorder_add_other_file(recorder);
+	}
+
+	// Clients may pass the same file several times, e.g. when re-creating
+	// pools
+	for (size_t i = 0; i < recorder->files_len; i++) {
+		struct recorded_file *file = &recorder->files[i];
+		if (file->dev == st.st_dev && file->ino == st.st_ino) {
+			return file->index;
+		}
+	}
+
+	if (recorder->files_len == recorder->files_cap) {
+		size_t cap = recorder->files_cap == 0 ? 8 : recorder->files_cap * 2;
+		struct recorded_file *files =
+			realloc(recorder->files, cap * sizeof(*files));
+		if (files == NULL) {
+			return recorder_add_other_file(recorder);
+		}
+		recorder->files = files;
+		recorder->files_cap = cap;
+	}
+
+	int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (dup_fd < 0) {
+		return recorder_add_other_file(recorder);
+	}
+
+	struct recorded_file *file = &recorder->files[recorder->files_len++];
+	*file = (struct recorded_file){
+		.index = recorder->next_index++,
+		.dev = st.st_dev,
+		.ino = st.st_ino,
+		.fd = dup_fd,
+	};
+	return file->index;
+}
+
+static void recorder_finish_files(struct recorder *recorder) {
+	for (size_t i = 0; i < recorder->files_len; i++) {
+		struct recorded_file *file = &recorder->files[i];
+		if (file->data != NULL) {
+			munmap(file->data, file->size);
+		}
+		free(file->shadow);
+		close(file->fd);
+	}
+	free(recorder->files);
+}
+
+static int recorder_handle_client_readable(int fd, uint32_t mask,
+		void *data) {
+	struct recorder *recorder = data;
+
+	uint8_t buf[MAX_CHUNK_SIZE];
+	int fds[MAX_FDS];
+	size_t fds_len;
+	ssize_t n = recv_chunk(fd, buf, sizeof(buf), fds, &fds_len);
+	if (n <= 0) {
+		wl_display_terminate(recorder->server->display);
+		return 0;
+	}
+
+	struct {
+		struct trace_data data;
+		uint32_t fds[MAX_FDS];
+	} header = { .data.fds_len = fds_len };
+	for (size_t i = 0; i < fds_len; i++) {
+		header.fds[i] = recorder_add_file(recorder, fds[i]);
+	}
+
+	// Save the pixels written by the client before the requests referencing
+	// them reach the compositor
+	for (size_t i = 0; i < recorder->files_len; i++) {
+		recorder_snapshot_file(recorder, &recorder->files[i]);
+	}
+	recorder_write(recorder, TRACE_DATA, &header,
+		sizeof(header.data) + fds_len * sizeof(header.fds[0]), buf, n);
+
+	// The compositor runs in this thread and will read the data on the next
+	// loop iteration, so this doesn't block for long
+	if (!send_chunk(recorder->server_fd, buf, n, fds, fds_len)) {
+		wl_display_terminate(recorder->server->display);
+	}
+	for (size_t i = 0; i < fds_len; i++) {
+		close(fds[i]);
+	}
+	return 0;
+}
+
+static int recorder_handle_server_readable(int fd, uint32_t mask,
+		void *data) {
+	struct recorder *recorder = data;
+
+	uint8_t buf[MAX_CHUNK_SIZE];
+	int fds[MAX_FDS];
+	size_t fds_len;
+	ssize_t n = recv_chunk(fd, buf, sizeof(buf), fds, &fds_len);
+	if (n <= 0 || !send_chunk(recorder->client_fd, buf, n, fds, fds_len)) {
+		wl_display_terminate(recorder->server->display);
+	}
+	for (size_t i = 0; i < fds_len; i++) {
+		close(fds[i]);
+	}
+	return 0;
+}
+
+static bool record(const char *path, const char *startup_cmd) {
+	struct server server = {0};
+	struct recorder recorder = { .server = &server };
+	bool ok = false;
+
+	int client_sock[2] = { -1, -1 }, server_sock[2] = { -1, -1 };
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, client_sock) != 0 ||
+			socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+				server_sock) != 0) {
+		fprintf(stderr, "socketpair failed: %s\n", strerror(errno));
+		goto out;
+	}
+
+	recorder.trace = fopen(path, "wb");
+	if (recorder.trace == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if (!server_init(&server, false)) {
+		goto out;
+	}
+	if (!wlr_backend_start(server.backend)) {
+		goto out;
+	}
+	if (server.output == NULL) {
+		fprintf(stderr, "no output\n");
+		goto out;
+	}
+
+	struct trace_header header = {
+		.version = TRACE_VERSION,
+		.width = server.output->width,
+		.height = server.output->height,
+		.scale = server.output->scale,
+	};
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	if (fwrite(&header, sizeof(header), 1, recorder.trace) != 1) {
+		goto out;
+	}
+
+	int fd = server_sock[0];
+	server_sock[0] = -1;
+	if (server_add_client(&server, fd) == NULL) {
+		goto out;
+	}
+
+	recorder.client_fd = client_sock[0];
+	recorder.server_fd = server_sock[1];
+	recorder.client_source = wl_event_loop_add_fd(server.loop,
+		recorder.client_fd, WL_EVENT_READABLE,
+		recorder_handle_client_readable, &recorder);
+	recorder.server_source = wl_event_loop_add_fd(server.loop,
+		recorder.server_fd, WL_EVENT_READABLE,
+		recorder_handle_server_readable, &recorder);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork failed: %s\n", strerror(errno));
+		goto out;
+	} else if (pid == 0) {
+		// Without FD_CLOEXEC, so that the client inherits it
+		int client_fd = dup(client_sock[1]);
+		char fd_str[16];
+		snprintf(fd_str, sizeof(fd_str), "%d", client_fd);
+		setenv("WAYLAND_SOCKET", fd_str, true);
+		unsetenv("WAYLAND_DISPLAY");
+		execl("/bin/sh", "/bin/sh", "-c", startup_cmd, (void *)NULL);
+		_exit(EXIT_FAILURE);
+	}
+	close(client_sock[1]);
+	client_sock[1] = -1;
+
+	recorder.start_ns = get_time_nsec(CLOCK_MONOTONIC);
+	wlr_log(WLR_INFO, "Recording to %s", path);
+	wl_display_run(server.display);
+
+	ok = !recorder.failed;
+
+out:
+	if (recorder.client_source != NULL) {
+		wl_event_source_remove(recorder.client_source);
+	}
+	if (recorder.server_source != NULL) {
+		wl_event_source_remove(recorder.server_source);
+	}
+	server_finish(&server);
+	recorder_finish_files(&recorder);
+	for (size_t i = 0; i < 2; i++) {
+		if (client_sock[i] >= 0) {
+			close(client_sock[i]);
+		}
+		if (server_sock[i] >= 0) {
+			close(server_sock[i]);
+		}
+	}
+	if (recorder.trace != NULL && fclose(recorder.trace) != 0) {
+		ok = false;
+	}
+	return ok;
+}
+
+struct replayer {
+	struct server *server;
+	int sock;
+	struct wl_event_source *source;
+
+	int *files; // indexed by trace_fd.index, -1 if unused
+	size_t files_len;
+
+	// Number of bytes left in the current message, to count messages
+	size_t message_remaining;
+	uint8_t message_header[8];
+	size_t message_header_len;
+	uint64_t messages, bytes;
+};
+
+static int replayer_handle_readable(int fd, uint32_t mask, void *data) {
+	struct replayer *replayer = data;
+
+	// Events are discarded
+	uint8_t buf[MAX_CHUNK_SIZE];
+	int fds[MAX_FDS];
+	size_t fds_len;
+	ssize_t n = recv_chunk(fd, buf, sizeof(buf), fds, &fds_len);
+	for (size_t i = 0; i < fds_len; i++) {
+		close(fds[i]);
+	}
+	if (n <= 0) {
+		wl_event_source_remove(replayer->source);
+		replayer->source = NULL;
+	}
+	return 0;
+}
+
+static int *replayer_get_file(struct replayer *replayer, uint32_t index) {
+	if (index >= replayer->files_len) {
+		size_t len = index + 1;
+		int *files = realloc(replayer->files, len * sizeof(*files));
+		if (files == NULL) {
+			return NULL;
+		}
+		for (size_t i = replayer->files_len; i < len; i++) {
+			files[i] = -1;
+		}
+		replayer->files = files;
+		replayer->files_len = len;
+	}
+	return &replayer->files[index];
+}
+
+static void replayer_count_messages(struct replayer *replayer,
+		const uint8_t *data, size_t size) {
+	replayer->bytes += size;
+	while (size > 0) {
+		if (replayer->message_remaining > 0) {
+			size_t len = size < replayer->message_remaining ?
+				size : replayer->message_remaining;
+			replayer->message_remaining -= len;
+			data += len;
+			size -= len;
+			continue;
+		}
+
+		// The header may be split across chunks
+		size_t len = sizeof(replayer->message_header) -
+			replayer->message_header_len;
+		len = size < len ? size : len;
+		memcpy(replayer->message_header + replayer->message_header_len,
+			data, len);
+		replayer->message_header_len += len;
+		data += len;
+		size -= len;
+		if (replayer->message_header_len < sizeof(replayer->message_header)) {
+			break;
+		}
+
+		uint32_t size_opcode;
+		memcpy(&size_opcode, replayer->message_header + 4,
+			sizeof(size_opcode));
+		size_t message_size = size_opcode >> 16;
+		replayer->message_remaining = message_size > 8 ? message_size - 8 : 0;
+		replayer->message_header_len = 0;
+		replayer->messages++;
+	}
+}
+
+static bool replayer_send_data(struct replayer *replayer,
+		const struct trace_record *record, const uint8_t *payload) {
+	const struct trace_data *data = (const struct trace_data *)payload;
+	if (record->size < sizeof(*data) || data->fds_len > MAX_FDS ||
+			record->size < sizeof(*data) +
+			data->fds_len * sizeof(data->fds[0])) {
+		return false;
+	}
+
+	int fds[MAX_FDS];
+	for (size_t i = 0; i < data->fds_len; i++) {
+		uint32_t index = data->fds[i];
+		if (index >= replayer->files_len || replayer->files[index] < 0) {
+			return false;
+		}
+		fds[i] = replayer->files[index];
+	}
+
+	size_t offset = sizeof(*data) + data->fds_len * sizeof(data->fds[0]);
+	replayer_count_messages(replayer, payload + offset, record->size - offset);
+	return send_chunk(replayer->sock, payload + offset,
+		record->size - offset, fds, data->fds_len);
+}
+
+static bool replayer_apply(struct replayer *replayer,
+		const struct trace_record *record, const uint8_t *payload) {
+	if (record->type == TRACE_DATA) {
+		return replayer_send_data(replayer, record, payload);
+	}
+	if (record->type > TRACE_FD_OTHER) {
+		// Skip records added by later versions
+		return true;
+	}
+
+	const struct trace_fd *trace_fd = (const struct trace_fd *)payload;
+	if (record->size < sizeof(*trace_fd)) {
+		return false;
+	}
+	int *file = replayer_get_file(replayer, trace_fd->index);
+	if (file == NULL) {
+		return false;
+	}
+
+	switch (record->type) {
+	case TRACE_FD_SIZE:
+		if (*file < 0) {
+			*file = memfd_create("traffic-replay", MFD_CLOEXEC);
+			if (*file < 0) {
+				return false;
+			}
+		}
+		return ftruncate(*file, trace_fd->value) == 0;
+	case TRACE_FD_WRITE:;
+		size_t len = record->size - sizeof(*trace_fd);
+		return *file >= 0 && pwrite(*file, payload + sizeof(*trace_fd), len,
+			trace_fd->value) == (ssize_t)len;
+	case TRACE_FD_OTHER:
+		if (*file < 0) {
+			*file = open("/dev/null", O_RDWR | O_CLOEXEC);
+		}
+		return *file >= 0;
+	}
+	abort(); // unreachable
+}
+
+/**
+ * Dispatches the compositor, accounting the time spent processing requests
+ * separately from the time spent on composition.
+ */
+static void replay_dispatch(struct server *server, int timeout_ms) {
+	wl_display_flush_clients(server->display);
+	int64_t frame_start = server->frame_cpu_total_ns;
+	int64_t start = get_time_nsec(CLOCK_THREAD_CPUTIME_ID);
+	wl_event_loop_dispatch(server->loop, timeout_ms);
+	int64_t cpu_ns = get_time_nsec(CLOCK_THREAD_CPUTIME_ID) - start;
+	server->dispatch_cpu_ns +=
+		cpu_ns - (server->frame_cpu_total_ns - frame_start);
+}
+
+static void print_stats(const char *name, int64_t *values, size_t len) {
+	if (len == 0) {
+		printf("%-10s %10s\n", name, "n/a");
+		return;
+	}
+	qsort(values, len, sizeof(*values), compare_int64);
+	int64_t sum = 0;
+	for (size_t i = 0; i < len; i++) {
+		sum += values[i];
+	}
+	printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+		sum / 1e6 / len, values[len / 2] / 1e6, values[len * 95 / 100] / 1e6,
+		values[len * 99 / 100] / 1e6, values[len - 1] / 1e6);
+}
+
+static bool replay(const char *path, bool fast, bool verbose) {
+	struct server server = {0};
+	struct replayer replayer = { .server = &server, .sock = -1 };
+	uint8_t *payload = NULL;
+	bool ok = false;
+
+	FILE *trace = fopen(path, "rb");
+	if (trace == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct trace_header header;
+	if (fread(&header, sizeof(header), 1, trace) != 1 ||
+			memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != TRACE_VERSION ||
+			header.width <= 0 || header.height <= 0) {
+		fprintf(stderr, "%s: invalid trace\n", path);
+		goto out;
+	}
+
+	int sock[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sock) != 0) {
+		fprintf(stderr, "socketpair failed: %s\n", strerror(errno));
+		goto out;
+	}
+	replayer.sock = sock[1];
+
+	if (!server_init(&server, true)) {
+		close(sock[0]);
+		goto out;
+	}
+
+	server.frames_cap = 1024;
+	server.frame_cpu_ns = calloc(server.frames_cap,
+		sizeof(*server.frame_cpu_ns));
+	server.frame_gpu_ns = calloc(server.frames_cap,
+		sizeof(*server.frame_gpu_ns));
+	if (server.frame_cpu_ns == NULL || server.frame_gpu_ns == NULL) {
+		close(sock[0]);
+		goto out;
+	}
+	server.render_timer = wlr_render_timer_create(server.renderer);
+
+	struct wlr_output *output = wlr_headless_add_output(server.backend,
+		header.width, header.height);
+	if (output == NULL) {
+		close(sock[0]);
+		goto out;
+	}
+	wlr_headless_output_set_clock(output, fast ?
+		WLR_HEADLESS_OUTPUT_CLOCK_FREE_RUNNING :
+		WLR_HEADLESS_OUTPUT_CLOCK_REFRESH);
+	wlr_output_set_scale(output, header.scale);
+	wlr_output_commit(output);
+
+	if (!wlr_backend_start(server.backend) ||
+			server_add_client(&server, sock[0]) == NULL) {
+		goto out;
+	}
+	replayer.source = wl_event_loop_add_fd(server.loop, replayer.sock,
+		WL_EVENT_READABLE, replayer_handle_readable, &replayer);
+
+	size_t heap_start = get_heap_in_use();
+	struct rusage usage_start, usage_end;
+	getrusage(RUSAGE_SELF, &usage_start);
+	int64_t start = get_time_nsec(CLOCK_MONOTONIC);
+	uint64_t records = 0;
+
+	struct trace_record record;
+	while (!server.client_destroyed &&
+			fread(&record, sizeof(record), 1, trace) == 1) {
+		uint8_t *new_payload = realloc(payload, record.size);
+		if (new_payload == NULL && record.size > 0) {
+			goto out;
+		}
+		payload = new_payload;
+		if (fread(payload, 1, record.size, trace) != record.size) {
+			fprintf(stderr, "%s: truncated trace\n", path);
+			goto out;
+		}
+
+		// Let the compositor catch up without waiting when replaying as
+		// fast as possible, so that frames are still rendered
+		int64_t due = start + record.time_ns;
+		int64_t now;
+		while (!fast && (now = get_time_nsec(CLOCK_MONOTONIC)) < due &&
+				!server.client_destroyed) {
+			replay_dispatch(&server, (due - now + 999999) / 1000000);
+		}
+
+		if (!replayer_apply(&replayer, &record, payload)) {
+			fprintf(stderr, "%s: failed to replay record %" PRIu64 "\n",
+				path, records);
+			goto out;
+		}
+		records++;
+
+		if (record.type == TRACE_DATA) {
+			replay_dispatch(&server, 0);
+		}
+	}
+
+	// Render the last frames
+	int64_t end = get_time_nsec(CLOCK_MONOTONIC) + 100 * 1000000;
+	while (!server.client_destroyed &&
+			get_time_nsec(CLOCK_MONOTONIC) < end) {
+		replay_dispatch(&server, 10);
+	}
+	poll_gpu_time(&server);
+
+	int64_t elapsed = get_time_nsec(CLOCK_MONOTONIC) - start;
+	getrusage(RUSAGE_SELF, &usage_end);
+	size_t heap_end = get_heap_in_use();
+
+	if (server.client_destroyed) {
+		fprintf(stderr, "%s: the client was disconnected during the replay, "
+			"the trace may have been recorded against another compositor\n",
+			path);
+	}
+
+	if (verbose) {
+		printf("%8s %12s %12s\n", "frame", "cpu (ms)", "gpu (ms)");
+		for (size_t i = 0; i < server.frames_len; i++) {
+			printf("%8zu %12.3f %12.3f\n", i, server.frame_cpu_ns[i] / 1e6,
+				server.frame_gpu_ns[i] / 1e6);
+		}
+		printf("\n");
+	}
+
+	printf("%" PRIu64 " records, %" PRIu64 " requests, %" PRIu64 " bytes, "
+		"%zu frames in %.3f s\n", records, replayer.messages, replayer.bytes,
+		server.frames_len, elapsed / 1e9);
+	printf("%-10s %10s %10s %10s %10s %10s\n",
+		"", "avg (ms)", "p50 (ms)", "p95 (ms)", "p99 (ms)", "max (ms)");
+	print_stats("frame cpu", server.frame_cpu_ns, server.frames_len);
+
+	size_t gpu_len = 0;
+	for (size_t i = 0; i < server.frames_len; i++) {
+		if (server.frame_gpu_ns[i] >= 0) {
+			server.frame_gpu_ns[gpu_len++] = server.frame_gpu_ns[i];
+		}
+	}
+	print_stats("frame gpu", server.frame_gpu_ns, gpu_len);
+
+	printf("dispatch: %.3f ms total, %.3f us per request\n",
+		server.dispatch_cpu_ns / 1e6, replayer.messages > 0 ?
+		server.dispatch_cpu_ns / 1e3 / replayer.messages : 0.0);
+	printf("heap growth: %zd KiB, max rss: %ld KiB\n",
+		((ssize_t)heap_end - (ssize_t)heap_start) / 1024,
+		usage_end.ru_maxrss);
+
+	ok = !server.client_destroyed;
+
+out:
+	if (replayer.source != NULL) {
+		wl_event_source_remove(replayer.source);
+	}
+	if (server.renderer != NULL) {
+		wlr_renderer_set_timer(server.renderer, NULL);
+	}
+	server_finish(&server);
+	for (size_t i = 0; i < replayer.files_len; i++) {
+		if (replayer.files[i] >= 0) {
+			close(replayer.files[i]);
+		}
+	}
+	free(replayer.files);
+	if (replayer.sock >= 0) {
+		close(replayer.sock);
+	}
+	free(payload);
+	fclose(trace);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	const char *output_path = NULL, *input_path = NULL, *startup_cmd = NULL;
+	bool fast = false, verbose = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "o:s:i:fvh")) != -1) {
+		switch (c) {
+		case 'o':
+			output_path = optarg;
+			break;
+		case 's':
+			startup_cmd = optarg;
+			break;
+		case 'i':
+			input_path = optarg;
+			break;
+		case 'f':
+			fast = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			fprintf(stderr, usage, argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	bool recording = output_path != NULL && startup_cmd != NULL &&
+		input_path == NULL;
+	bool replaying = input_path != NULL && output_path == NULL &&
+		startup_cmd == NULL;
+	if (optind < argc || (!recording && !replaying)) {
+		fprintf(stderr, usage, argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	bool ok = recording ? record(output_path, startup_cmd) :
+		replay(input_path, fast, verbose);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
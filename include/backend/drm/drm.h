@@ -10,11 +10,31 @@
 #include <wlr/backend/drm.h>
 #include <wlr/backend/session.h>
 #include <wlr/render/drm_format_set.h>
+#include <wlr/util/box.h>
 #include <xf86drmMode.h>
 #include "backend/drm/iface.h"
 #include "backend/drm/properties.h"
 #include "backend/drm/renderer.h"
 
+/* How the FB of a plane is displayed, only used for primary planes */
+struct wlr_drm_plane_geometry {
+	bool set; // false to display the whole FB at the top-left of the CRTC
+	struct wlr_fbox src; // FB coordinates
+	struct wlr_box dst; // CRTC coordinates
+	enum wl_output_transform transform;
+};
+
+enum wlr_drm_cursor_size_status {
+	WLR_DRM_CURSOR_SIZE_UNKNOWN, // needs to be probed with a test commit
+	WLR_DRM_CURSOR_SIZE_SUPPORTED,
+	WLR_DRM_CURSOR_SIZE_UNSUPPORTED,
+};
+
+struct wlr_drm_cursor_size {
+	int width, height;
+	enum wlr_drm_cursor_size_status status;
+};
+
 struct wlr_drm_plane {
 	uint32_t type;
 	uint32_t id;
@@ -28,12 +48,51 @@ struct wlr_drm_plane {
 	struct wlr_drm_fb *queued_fb;
 	/* Buffer currently displayed on screen */
 	struct wlr_drm_fb *current_fb;
+	/* Overlay planes only: the plane is disabled on next vblank */
+	bool queued_disable;
+	/* Geometry of the pending FB, and as of the last commit */
+	struct wlr_drm_plane_geometry pending_geometry, geometry;
 
 	struct wlr_drm_format_set formats;
 
+	/* Cursor planes only: buffer sizes which may be used, by increasing
+	 * area */
+	struct wlr_drm_cursor_size *cursor_sizes;
+	size_t cursor_sizes_len;
+
+	/* Value of the zpos property set on each commit, if it's mutable:
+	 * overlay planes are kept above the primary plane */
+	bool set_zpos;
+	uint64_t zpos;
+
 	union wlr_drm_plane_props props;
 };
 
+#define WLR_DRM_BLOB_CACHE_SIZE 4
+
+struct wlr_drm_blob {
+	uint32_t id; // zero if unused
+	uint64_t hash;
+	void *key;
+	size_t key_size;
+	uint64_t last_used;
+};
+
+// Property blobs indexed by the contents they were created from
+struct wlr_drm_blob_cache {
+	struct wlr_drm_blob blobs[WLR_DRM_BLOB_CACHE_SIZE];
+	uint64_t counter;
+};
+
+#define WLR_DRM_PROP_CACHE_SIZE 512
+
+// Atomic modesetting only: a property value as of the last commit
+struct wlr_drm_prop_value {
+	uint32_t obj; // zero if unused
+	uint32_t prop;
+	uint64_t value;
+};
+
 struct wlr_drm_crtc {
 	uint32_t id;
 	struct wlr_drm_lease *lease;
@@ -41,6 +100,8 @@ struct wlr_drm_crtc {
 	// Atomic modesetting only
 	uint32_t mode_id;
 	uint32_t gamma_lut;
+	// Own the mode_id and gamma_lut blobs
+	struct wlr_drm_blob_cache mode_blobs, gamma_lut_blobs;
 
 	// Legacy only
 	drmModeCrtc *legacy_crtc;
@@ -48,6 +109,10 @@ struct wlr_drm_crtc {
 	struct wlr_drm_plane *primary;
 	struct wlr_drm_plane *cursor;
 
+	// Overlay planes statically assigned to this CRTC, bottom to top
+	struct wlr_drm_plane **overlays;
+	size_t overlays_len;
+
 	union wlr_drm_crtc_props props;
 };
 
@@ -58,11 +123,16 @@ struct wlr_drm_backend {
 	const struct wlr_drm_interface *iface;
 	clockid_t clock;
 	bool addfb2_modifiers;
+	bool supports_async_page_flip;
+	bool supports_atomic_async_page_flip;
 	struct udev_hwdb *hwdb;
 
 	int fd;
 	char *name;
 	struct wlr_device *dev;
+	// Path of the device node, resolved on first use by
+	// wlr_drm_backend_get_non_master_fd()
+	char *non_master_path;
 
 	size_t num_crtcs;
 	struct wlr_drm_crtc *crtcs;
@@ -78,7 +148,17 @@ struct wlr_drm_backend {
 	struct wl_listener dev_remove;
 
 	struct wl_list fbs; // wlr_drm_fb.link
+	// FBs whose buffer has been destroyed, kept in case the same DMA-BUF is
+	// imported again (e.g. clients re-creating wl_buffers), most recently
+	// used first
+	struct wl_list fb_cache; // wlr_drm_fb.link
+	size_t fb_cache_len;
+	struct {
+		uint64_t hits, misses, imports;
+		uint32_t since_msec;
+	} fb_stats;
 	struct wl_list outputs;
+	struct wl_list writebacks; // wlr_drm_writeback.link
 
 	/* Only initialized on multi-GPU setups */
 	struct wlr_drm_renderer mgpu_renderer;
@@ -88,6 +168,14 @@ struct wlr_drm_backend {
 	uint64_t cursor_width, cursor_height;
 
 	struct wlr_drm_format_set mgpu_formats;
+
+	// Bumped whenever cached test results may have become stale
+	uint64_t test_cache_seq;
+	// Committed property values, so that unchanged properties can be left
+	// out of atomic requests. Hash table indexed by object and property IDs.
+	struct wlr_drm_prop_value prop_cache[WLR_DRM_PROP_CACHE_SIZE];
+
+	size_t leases_len; // number of active leases
 };
 
 enum wlr_drm_connector_status {
@@ -105,10 +193,120 @@ struct wlr_drm_mode {
 };
 
 struct wlr_drm_connector_state {
+	struct wlr_drm_connector *connector;
 	const struct wlr_output_state *base;
 	bool modeset;
 	bool active;
 	drmModeModeInfo mode;
+	// Re-apply the blobs another DRM master may have replaced, without a
+	// modeset
+	bool resume;
+	// Perform the modeset without ALLOW_MODESET, the kernel already uses
+	// the same mode
+	bool seamless;
+};
+
+#define WLR_DRM_TEST_CACHE_SIZE 16
+#define WLR_DRM_TEST_MAX_OVERLAYS 8
+
+struct wlr_drm_test_plane {
+	bool fb;
+	uint32_t format;
+	uint64_t modifier;
+	int width, height;
+	uint32_t stride;
+	int x, y; // overlays only
+};
+
+// Plane geometry, as sent to the kernel
+struct wlr_drm_test_geometry {
+	bool set;
+	uint64_t src_x, src_y, src_w, src_h; // 16.16 fixed point
+	int dst_x, dst_y, dst_w, dst_h;
+	enum wl_output_transform transform;
+};
+
+// The KMS state resulting from a test-only commit, compared field by field
+struct wlr_drm_test_key {
+	uint64_t seq; // wlr_drm_backend.test_cache_seq
+	uint32_t crtc_id;
+	uint32_t flags;
+	bool modeset, active;
+	drmModeModeInfo mode;
+	bool vrr_enabled;
+	bool gamma_lut;
+	struct wlr_drm_test_plane primary, cursor;
+	struct wlr_drm_test_geometry primary_geometry;
+	struct wlr_drm_test_plane capture;
+	uint32_t writeback_crtc_id; // CRTC the writeback connector is routed to
+	bool layers; // whether the overlays are committed
+	uint32_t overlays_seq; // wlr_drm_connector.overlays_seq, if !layers
+	struct wlr_drm_test_plane overlays[WLR_DRM_TEST_MAX_OVERLAYS];
+};
+
+struct wlr_drm_test_entry {
+	struct wlr_drm_test_key key;
+	bool ok;
+	uint64_t last_used; // zero if unused
+};
+
+/**
+ * A writeback connector, which writes the contents of a CRTC into a buffer.
+ * These aren't exposed as outputs, they capture other connectors.
+ */
+struct wlr_drm_writeback {
+	struct wlr_drm_backend *backend;
+	uint32_t id;
+	uint32_t possible_crtcs;
+	union wlr_drm_connector_props props;
+	uint32_t *formats; // WRITEBACK_PIXEL_FORMATS
+	size_t formats_len;
+	// CRTC the connector is routed to, zero if none. Changing it requires
+	// ALLOW_MODESET.
+	uint32_t crtc_id;
+	bool pending; // part of the atomic commit being built
+	struct wl_list link; // wlr_drm_backend.writebacks
+};
+
+// A capture submitted to the kernel, done once its out-fence is signalled
+struct wlr_drm_writeback_job {
+	struct wlr_drm_connector *conn;
+	struct wlr_buffer *buffer;
+	struct wlr_drm_fb *fb;
+	int out_fence_fd;
+	struct wl_event_source *event_source;
+	struct wl_list link; // wlr_drm_connector.writeback_jobs
+};
+
+#define WLR_DRM_EDID_TIMINGS_CAP 8
+
+struct wlr_drm_edid_timing {
+	int32_t width, height;
+	int32_t refresh; // mHz
+};
+
+/**
+ * Information extracted from an EDID, kept across disconnections so that the
+ * EDID is only parsed again if its contents change.
+ */
+struct wlr_drm_edid_info {
+	uint64_t hash; // of the EDID contents, zero if no EDID has been parsed
+	char make[64];
+	char model[32];
+	char serial[32];
+	// Display range limits, in mHz, zero if unknown
+	int32_t vrr_min_refresh, vrr_max_refresh;
+	// CTA-861 HDR static metadata data block
+	struct {
+		bool present;
+		uint8_t eotfs; // bitfield of supported EOTFs
+		uint8_t descriptors; // bitfield of static metadata descriptors
+		// Coded luminance values as found in the EDID, zero if absent
+		uint8_t max_luminance, max_frame_avg_luminance, min_luminance;
+	} hdr;
+	// Detailed timing descriptors, preferred first
+	struct wlr_drm_edid_timing timings[WLR_DRM_EDID_TIMINGS_CAP];
+	size_t timings_len;
 };
 
 struct wlr_drm_connector {
@@ -141,8 +339,41 @@ struct wlr_drm_connector {
 	 * they're sent.
 	 */
 	uint32_t pending_page_flip_crtc;
+	// The pending page-flip only updates the cursor plane
+	bool cursor_commit_pending;
+	// The cursor changed while a cursor-only page-flip was pending
+	bool cursor_dirty;
+
+	// Last EDID read, kept across disconnections
+	uint64_t edid_blob_id;
+	uint8_t *edid;
+	size_t edid_len;
+	struct wlr_drm_edid_info edid_info;
+
+	// Outcomes of recent test-only commits
+	struct wlr_drm_test_entry test_cache[WLR_DRM_TEST_CACHE_SIZE];
+	uint64_t test_cache_counter;
+	// Bumped whenever the overlay planes are committed
+	uint32_t overlays_seq;
+
+	// Timings of the latest page-flips, see wlr_output_get_present_stats()
+	struct wlr_output_present_sample
+		present_samples[WLR_OUTPUT_PRESENT_SAMPLES_LEN];
+	size_t present_samples_len, present_samples_next;
+	uint64_t presented, missed_vblanks;
+	int64_t page_flip_commit; // ns, zero if unknown
+
+	struct wl_list writeback_jobs; // wlr_drm_writeback_job.link
 };
 
+/**
+ * Same as wlr_drm_backend_create(), but with the renderer used for multi-GPU
+ * copies already created, e.g. on another thread. Takes ownership of
+ * mgpu_renderer, which may be NULL.
+ */
+struct wlr_backend *drm_backend_create(struct wl_display *display,
+	struct wlr_session *session, struct wlr_device *dev,
+	struct wlr_backend *parent, struct wlr_renderer *mgpu_renderer);
 struct wlr_drm_backend *get_drm_backend_from_backend(
 	struct wlr_backend *wlr_backend);
 bool check_drm_features(struct wlr_drm_backend *drm);
@@ -155,14 +386,66 @@ int handle_drm_event(int fd, uint32_t mask, void *data);
 void destroy_drm_connector(struct wlr_drm_connector *conn);
 bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 	const struct wlr_output_state *state);
+/**
+ * Test or commit the states of several connectors in a single atomic commit,
+ * reallocating CRTCs between them if needed. Requires the atomic interface,
+ * and a primary GPU.
+ */
+bool drm_commit_connectors(struct wlr_drm_backend *drm,
+	const struct wlr_backend_output_state *states, size_t states_len,
+	bool test_only);
 bool drm_connector_is_cursor_visible(struct wlr_drm_connector *conn);
 bool drm_connector_supports_vrr(struct wlr_drm_connector *conn);
 size_t drm_crtc_get_gamma_lut_size(struct wlr_drm_backend *drm,
 	struct wlr_drm_crtc *crtc);
 void drm_lease_destroy(struct wlr_drm_lease *lease);
+/**
+ * Restore the connector's state after a session switch without a modeset, if
+ * the kernel still drives it with the same CRTC and mode. Returns false if a
+ * full modeset is needed.
+ */
+bool drm_connector_fast_resume(struct wlr_drm_connector *conn);
 
 struct wlr_drm_fb *plane_get_next_fb(struct wlr_drm_plane *plane);
 
+/**
+ * Build the test cache key of a test-only commit. Returns false if the commit
+ * can't be cached.
+ */
+bool drm_test_cache_get_key(struct wlr_drm_connector *conn,
+	const struct wlr_drm_connector_state *state, uint32_t flags,
+	struct wlr_drm_test_key *key);
+bool drm_test_cache_lookup(struct wlr_drm_connector *conn,
+	const struct wlr_drm_test_key *key, bool *ok);
+void drm_test_cache_insert(struct wlr_drm_connector *conn,
+	const struct wlr_drm_test_key *key, bool ok);
+/**
+ * Drop the cached test results of all connectors.
+ */
+void drm_test_cache_invalidate(struct wlr_drm_backend *drm);
+/**
+ * Drop the cached test results of a single connector.
+ */
+void drm_test_cache_invalidate_connector(struct wlr_drm_connector *conn);
+
+struct wlr_drm_writeback *drm_writeback_create(struct wlr_drm_backend *drm,
+	uint32_t id, uint32_t possible_crtcs);
+void drm_writeback_destroy(struct wlr_drm_writeback *writeback);
+/**
+ * Find a writeback connector which can capture the connector's CRTC into the
+ * buffer, preferring one which is already routed to the CRTC. Connectors part
+ * of the commit being built are skipped.
+ */
+struct wlr_drm_writeback *drm_connector_find_writeback(
+	struct wlr_drm_connector *conn, struct wlr_buffer *buffer);
+/**
+ * Notify the output once the kernel has written a committed capture. Takes
+ * ownership of the FB and of the out-fence, which may be -1 on error.
+ */
+void drm_connector_add_writeback_job(struct wlr_drm_connector *conn,
+	struct wlr_buffer *buffer, struct wlr_drm_fb **fb, int out_fence_fd);
+void drm_connector_destroy_writeback_jobs(struct wlr_drm_connector *conn);
+
 #define wlr_drm_conn_log(conn, verb, fmt, ...) \
 	wlr_log(verb, "connector %s: " fmt, conn->name, ##__VA_ARGS__)
 #define wlr_drm_conn_log_errno(conn, verb, fmt, ...) \
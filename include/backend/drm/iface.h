@@ -2,6 +2,7 @@
 #define BACKEND_DRM_IFACE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -10,6 +11,7 @@ struct wlr_drm_backend;
 struct wlr_drm_connector;
 struct wlr_drm_crtc;
 struct wlr_drm_connector_state;
+struct wlr_drm_blob_cache;
 
 // Used to provide atomic or legacy DRM functions
 struct wlr_drm_interface {
@@ -17,11 +19,30 @@ struct wlr_drm_interface {
 	bool (*crtc_commit)(struct wlr_drm_connector *conn,
 		const struct wlr_drm_connector_state *state, uint32_t flags,
 		bool test_only);
+	// Commit the cursor plane state only, requesting a page-flip event.
+	// Optional.
+	bool (*crtc_commit_cursor)(struct wlr_drm_connector *conn);
+	// Check whether the pending cursor FB can be displayed, wherever the
+	// cursor is. Optional.
+	bool (*crtc_test_cursor)(struct wlr_drm_connector *conn);
+	// Commit the pending changes of several connectors and their CRTCs in a
+	// single request, requesting page-flip events unless testing. Optional.
+	bool (*commit_connectors)(struct wlr_drm_backend *drm,
+		const struct wlr_drm_connector_state *states, size_t states_len,
+		bool test_only);
 };
 
 extern const struct wlr_drm_interface atomic_iface;
 extern const struct wlr_drm_interface legacy_iface;
 
+void drm_atomic_blob_cache_finish(struct wlr_drm_backend *drm,
+	struct wlr_drm_blob_cache *cache);
+/**
+ * Forget the committed property values, e.g. when another DRM master may have
+ * changed them. The next atomic commits will set all properties.
+ */
+void drm_atomic_prop_cache_invalidate(struct wlr_drm_backend *drm);
+
 bool drm_legacy_crtc_set_gamma(struct wlr_drm_backend *drm,
 	struct wlr_drm_crtc *crtc, size_t size, uint16_t *lut);
 
@@ -25,8 +25,14 @@ union wlr_drm_connector_props {
 		// atomic-modesetting only
 
 		uint32_t crtc_id;
+
+		// writeback connectors only
+
+		uint32_t writeback_fb_id;
+		uint32_t writeback_out_fence_ptr;
+		uint32_t writeback_pixel_formats;
 	};
-	uint32_t props[4];
+	uint32_t props[13];
 };
 
 union wlr_drm_crtc_props {
@@ -35,6 +41,7 @@ union wlr_drm_crtc_props {
 		uint32_t vrr_enabled;
 		uint32_t gamma_lut;
 		uint32_t gamma_lut_size;
+		uint32_t background_color;
 
 		// atomic-modesetting only
 
@@ -63,8 +70,11 @@ union wlr_drm_plane_props {
 		uint32_t fb_id;
 		uint32_t crtc_id;
 		uint32_t fb_damage_clips;
+		uint32_t in_fence_fd; // Not guaranteed to exist
+		uint32_t size_hints; // Not guaranteed to exist
+		uint32_t zpos; // Not guaranteed to exist
 	};
-	uint32_t props[14];
+	uint32_t props[17];
 };
 
 bool get_drm_connector_props(int fd, uint32_t id,
@@ -75,5 +85,6 @@ bool get_drm_plane_props(int fd, uint32_t id, union wlr_drm_plane_props *out);
 bool get_drm_prop(int fd, uint32_t obj, uint32_t prop, uint64_t *ret);
 void *get_drm_prop_blob(int fd, uint32_t obj, uint32_t prop, size_t *ret_len);
 char *get_drm_prop_enum(int fd, uint32_t obj, uint32_t prop);
+bool get_drm_prop_range(int fd, uint32_t prop, uint64_t *min, uint64_t *max);
 
 #endif
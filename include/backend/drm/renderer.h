@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <wlr/backend.h>
+#include <wlr/render/dmabuf.h>
 #include <wlr/render/wlr_renderer.h>
 
 struct wlr_drm_backend;
@@ -17,22 +19,52 @@ struct wlr_drm_renderer {
 	struct wlr_allocator *allocator;
 };
 
+#define WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN 3
+
 struct wlr_drm_surface {
 	struct wlr_drm_renderer *renderer;
 	struct wlr_swapchain *swapchain;
+
+	// Damage of the previous blits, in buffer-local coordinates, used to
+	// only copy what changed since a swapchain buffer was last used
+	pixman_region32_t previous[WLR_DRM_SURFACE_DAMAGE_PREVIOUS_LEN];
+	size_t previous_idx;
+	// Frames were displayed without being blitted, the swapchain buffers
+	// may all be outdated
+	bool previous_invalid;
+};
+
+#define WLR_DRM_FB_CACHE_SIZE 8
+
+// Identifies the DMA-BUF a FB was imported from
+struct wlr_drm_fb_key {
+	uint32_t format, width, height;
+	uint64_t modifier;
+	int n_planes;
+	uint32_t offset[WLR_DMABUF_MAX_PLANES];
+	uint32_t stride[WLR_DMABUF_MAX_PLANES];
+	ino_t ino[WLR_DMABUF_MAX_PLANES];
 };
 
 struct wlr_drm_fb {
-	struct wlr_buffer *wlr_buf;
+	struct wlr_buffer *wlr_buf; // NULL once cached
 	struct wlr_addon addon;
 	struct wlr_drm_backend *backend;
-	struct wl_list link; // wlr_drm_backend.fbs
+	// wlr_drm_backend.fbs, or wlr_drm_backend.fb_cache once the buffer is
+	// destroyed
+	struct wl_list link;
 
-	uint32_t id;
+	uint32_t id; // zero if the DMA-BUF couldn't be imported
+	bool has_key;
+	struct wlr_drm_fb_key key;
 };
 
+/**
+ * Initialize a renderer for the DRM device. If wlr_rend is NULL, a renderer is
+ * created, otherwise takes ownership of it.
+ */
 bool init_drm_renderer(struct wlr_drm_backend *drm,
-	struct wlr_drm_renderer *renderer);
+	struct wlr_drm_renderer *renderer, struct wlr_renderer *wlr_rend);
 void finish_drm_renderer(struct wlr_drm_renderer *renderer);
 
 bool init_drm_surface(struct wlr_drm_surface *surf,
@@ -42,12 +74,25 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 bool drm_fb_import(struct wlr_drm_fb **fb, struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats);
 void drm_fb_destroy(struct wlr_drm_fb *fb);
+/**
+ * Try to import the buffer in KMS without keeping a reference to it. Updates
+ * wlr_buffer.scanout.
+ */
+bool drm_fb_check_import(struct wlr_drm_backend *drm, struct wlr_buffer *buf);
+/**
+ * Destroy the FBs kept around after their buffer has been destroyed.
+ */
+void drm_fb_cache_finish(struct wlr_drm_backend *drm);
 
 void drm_fb_clear(struct wlr_drm_fb **fb);
 void drm_fb_move(struct wlr_drm_fb **new, struct wlr_drm_fb **old);
 
+/**
+ * Copy a buffer from the parent GPU into one of the surface's buffers.
+ * Damage is in buffer-local coordinates, NULL if the whole buffer changed.
+ */
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
-	struct wlr_buffer *buffer);
+	struct wlr_buffer *buffer, const pixman_region32_t *damage);
 
 struct wlr_drm_format *drm_plane_pick_render_format(
 		struct wlr_drm_plane *plane, struct wlr_drm_renderer *renderer);
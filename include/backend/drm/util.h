@@ -9,7 +9,9 @@ struct wlr_drm_connector;
 
 // Calculates a more accurate refresh rate (mHz) than what mode itself provides
 int32_t calculate_refresh_rate(const drmModeModeInfo *mode);
-// Populates the make/model/phys_{width,height} of output from the edid data
+// Populates the make/model/serial/adaptive sync range of the output from the
+// EDID data. Also fills wlr_drm_connector.edid_info, unless the EDID contents
+// haven't changed since the last call.
 void parse_edid(struct wlr_drm_connector *conn, size_t len, const uint8_t *data);
 // Returns the string representation of a DRM output type
 const char *conn_get_name(uint32_t type_id);
@@ -29,6 +31,10 @@ enum {
  *
  * res contains an index of which objs it is matched with or UNMATCHED.
  *
+ * The solution with the most matches is picked, ties are broken by keeping as
+ * many of the matches in res as possible. It's computed as a maximum weight
+ * bipartite matching, in O(n^3) for n = max(num_objs, num_res).
+ *
  * This solution is left in out.
  * Returns the total number of matched solutions.
  */
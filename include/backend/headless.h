@@ -21,11 +21,15 @@ struct wlr_headless_output {
 	struct wlr_headless_backend *backend;
 	struct wl_list link;
 
+	enum wlr_headless_output_clock clock;
 	struct wl_event_source *frame_timer;
 	int frame_delay; // ms
+	struct wl_event_source *frame_idle; // free-running clock
+	struct timespec clock_time; // manual clock
 };
 
 struct wlr_headless_backend *headless_backend_from_backend(
 	struct wlr_backend *wlr_backend);
+void headless_output_schedule_frame(struct wlr_headless_output *output);
 
 #endif
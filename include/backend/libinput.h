@@ -26,6 +26,14 @@ struct wlr_libinput_backend {
 	struct wl_listener session_signal;
 
 	struct wl_list devices; // wlr_libinput_device::link
+
+	// Accumulate relative pointer motion into one event per dispatch
+	bool coalesce_motion;
+
+	bool use_input_thread;
+	// Non-NULL when events are read in a dedicated thread, see
+	// backend/libinput/thread.c
+	struct wlr_libinput_input_thread *input_thread;
 };
 
 struct wlr_libinput_input_device {
@@ -39,11 +47,26 @@ struct wlr_libinput_input_device {
 	struct wl_list tablet_tools; // see backend/libinput/tablet_tool.c
 	struct wlr_tablet_pad tablet_pad;
 
+	// Relative motion accumulated during the current dispatch, see
+	// backend/libinput/pointer.c
+	struct wlr_pointer_motion_event pending_motion;
+	bool motion_pending;
+
 	struct wl_list link;
 };
 
 uint32_t usec_to_msec(uint64_t usec);
 
+struct wlr_libinput_input_thread *input_thread_create(
+	struct wlr_libinput_backend *backend);
+void input_thread_destroy(struct wlr_libinput_input_thread *thread);
+/**
+ * Serialize calls into the libinput context with the input thread, if any.
+ * Event handlers already run with the lock held.
+ */
+void input_thread_lock(struct wlr_libinput_backend *backend);
+void input_thread_unlock(struct wlr_libinput_backend *backend);
+
 void handle_libinput_event(struct wlr_libinput_backend *state,
 		struct libinput_event *event);
 
@@ -64,6 +87,9 @@ void init_device_pointer(struct wlr_libinput_input_device *dev);
 struct wlr_libinput_input_device *device_from_pointer(struct wlr_pointer *kb);
 void handle_pointer_motion(struct libinput_event *event,
 	struct wlr_pointer *pointer);
+void queue_pointer_motion(struct libinput_event *event,
+	struct wlr_libinput_input_device *dev);
+void flush_pointer_motion(struct wlr_libinput_input_device *dev);
 void handle_pointer_motion_abs(struct libinput_event *event,
 	struct wlr_pointer *pointer);
 void handle_pointer_button(struct libinput_event *event,
@@ -23,7 +23,11 @@ struct wlr_wl_backend {
 	struct wl_display *local_display;
 	struct wl_list outputs;
 	int drm_fd;
-	struct wl_list buffers; // wlr_wl_buffer.link
+	struct wl_list buffers; // wlr_wl_buffer.link, most recently used first
+	size_t buffers_len;
+	struct {
+		uint64_t hits, imports, evictions;
+	} buffer_stats;
 	size_t requested_outputs;
 	size_t last_output_num;
 	struct wl_listener local_display_destroy;
@@ -34,6 +38,7 @@ struct wlr_wl_backend {
 	struct wl_event_source *remote_display_src;
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
 	struct xdg_wm_base *xdg_wm_base;
 	struct zxdg_decoration_manager_v1 *zxdg_decoration_manager_v1;
 	struct zwp_pointer_gestures_v1 *zwp_pointer_gestures_v1;
@@ -49,9 +54,19 @@ struct wlr_wl_backend {
 	struct wl_drm *legacy_drm;
 	struct xdg_activation_v1 *activation_v1;
 	char *drm_render_name;
+	// Show the cursor in a subsurface of the output instead of using the
+	// host cursor
+	bool cursor_subsurface;
 };
 
+/**
+ * Maximum number of imported buffers kept around. Buffers released by the
+ * host compositor are evicted in least recently used order past this limit.
+ */
+#define WLR_WL_BUFFER_CACHE_SIZE 32
+
 struct wlr_wl_buffer {
+	struct wlr_wl_backend *backend;
 	struct wlr_buffer *buffer;
 	struct wl_buffer *wl_buffer;
 	bool released;
@@ -84,7 +99,9 @@ struct wlr_wl_output {
 	struct {
 		struct wlr_wl_pointer *pointer;
 		struct wl_surface *surface;
+		struct wl_subsurface *subsurface; // only in subsurface mode
 		int32_t hotspot_x, hotspot_y;
+		int x, y;
 	} cursor;
 };
 
@@ -38,11 +38,19 @@ struct wlr_x11_output {
 	struct wlr_touch touch;
 	struct wl_list touchpoints; // wlr_x11_touchpoint::link
 
-	struct wl_list buffers; // wlr_x11_buffer::link
+	struct wl_list buffers; // wlr_x11_buffer::link, most recently used first
+	size_t buffers_len;
+	struct {
+		uint64_t hits, imports, evictions;
+	} buffer_stats;
 
 	pixman_region32_t exposed;
 
 	uint64_t last_msc;
+	uint64_t last_ust;
+	// Refresh period estimated from PresentCompleteNotify events, 0 if
+	// unknown
+	int refresh_nsec;
 
 	struct {
 		struct wlr_swapchain *swapchain;
@@ -105,13 +113,26 @@ struct wlr_x11_backend {
 	uint8_t present_opcode;
 	uint8_t xinput_opcode;
 
+	// Number of vblanks between two presented frames, 0 to present as soon
+	// as possible
+	uint32_t present_interval;
+
 	struct wl_listener display_destroy;
 };
 
+/**
+ * Maximum number of pixmaps kept around per output. Idle pixmaps are evicted
+ * in least recently used order past this limit.
+ */
+#define WLR_X11_BUFFER_CACHE_SIZE 32
+
 struct wlr_x11_buffer {
 	struct wlr_x11_backend *x11;
+	struct wlr_x11_output *output;
 	struct wlr_buffer *buffer;
 	xcb_pixmap_t pixmap;
+	// Number of presentations not yet followed by a PresentIdleNotify
+	int busy;
 	struct wl_list link; // wlr_x11_output::buffers
 	struct wl_listener buffer_destroy;
 };
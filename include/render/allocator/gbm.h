@@ -5,6 +5,7 @@
 #include <wlr/render/dmabuf.h>
 #include <wlr/types/wlr_buffer.h>
 #include "render/allocator/allocator.h"
+#include "render/dmabuf.h"
 
 struct wlr_gbm_buffer {
 	struct wlr_buffer base;
@@ -13,6 +14,7 @@ struct wlr_gbm_buffer {
 
 	struct gbm_bo *gbm_bo; // NULL if the gbm_device has been destroyed
 	struct wlr_dmabuf_attributes dmabuf;
+	struct dmabuf_mapping mapping; // for linear buffers
 };
 
 struct wlr_gbm_allocator {
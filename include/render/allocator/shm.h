@@ -13,6 +13,7 @@ struct wlr_shm_buffer {
 
 struct wlr_shm_allocator {
 	struct wlr_allocator base;
+	bool hugepages; // back large buffers with huge pages, if possible
 };
 
 /**
@@ -0,0 +1,63 @@
+#ifndef RENDER_BUFFER_POOL_H
+#define RENDER_BUFFER_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/render/drm_format_set.h>
+
+struct wlr_buffer_pool_entry {
+	struct wlr_buffer_pool *pool;
+	struct wlr_buffer *buffer;
+	struct wl_list link; // wlr_buffer_pool.entries
+
+	int width, height;
+	uint32_t format;
+	bool has_modifier; // false if the buffer isn't a DMA-BUF
+	uint64_t modifier;
+
+	bool acquired; // waiting for release
+	struct wl_listener release;
+};
+
+/**
+ * A pool of buffers of any size and format, for allocations which don't fit a
+ * swapchain because their parameters change from one use to the next.
+ *
+ * Released buffers are kept around up to a limit, and handed out again to
+ * callers asking for the same size, format and a compatible modifier.
+ */
+struct wlr_buffer_pool {
+	struct wlr_allocator *allocator; // NULL if destroyed
+
+	// Most recently released first
+	struct wl_list entries; // wlr_buffer_pool_entry.link
+	size_t released_len;
+	// Maximum number of released buffers kept around
+	size_t max_released;
+
+	struct wl_listener allocator_destroy;
+};
+
+struct wlr_buffer_pool *wlr_buffer_pool_create(struct wlr_allocator *alloc,
+	size_t max_released);
+/**
+ * Destroy the pool. Buffers which are still acquired are destroyed once
+ * released.
+ */
+void wlr_buffer_pool_destroy(struct wlr_buffer_pool *pool);
+/**
+ * Acquire a buffer from the pool, re-using a released one if possible.
+ *
+ * The returned buffer is locked. When the caller is done with it, they must
+ * unlock it by calling wlr_buffer_unlock.
+ */
+struct wlr_buffer *wlr_buffer_pool_acquire(struct wlr_buffer_pool *pool,
+	int width, int height, const struct wlr_drm_format *format);
+/**
+ * Destroy released buffers, starting with the least recently used, until at
+ * most max_released remain.
+ */
+void wlr_buffer_pool_trim(struct wlr_buffer_pool *pool, size_t max_released);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef RENDER_DMABUF_H
+#define RENDER_DMABUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wlr/render/dmabuf.h>
+
+// Copied from <linux/dma-buf.h> to avoid #ifdef soup
+#define DMA_BUF_SYNC_READ (1 << 0)
+#define DMA_BUF_SYNC_WRITE (2 << 0)
+
+/**
+ * Attach a sync_file to all planes of the DMA-BUF as an implicit fence, so
+ * that consumers relying on implicit synchronization wait for it. flags is a
+ * combination of DMA_BUF_SYNC_READ and DMA_BUF_SYNC_WRITE. Fails if the
+ * kernel doesn't support DMA_BUF_IOCTL_IMPORT_SYNC_FILE.
+ */
+bool dmabuf_import_sync_file(const struct wlr_dmabuf_attributes *dmabuf,
+	uint32_t flags, int sync_file_fd);
+/**
+ * Get the implicit fences of all planes of the DMA-BUF as a single sync_file.
+ * With DMA_BUF_SYNC_READ, the sync_file signals once the buffer can be read,
+ * with DMA_BUF_SYNC_WRITE once it can be written. Returns -1 if the kernel
+ * doesn't support DMA_BUF_IOCTL_EXPORT_SYNC_FILE.
+ */
+int dmabuf_export_sync_file(const struct wlr_dmabuf_attributes *dmabuf,
+	uint32_t flags);
+
+/**
+ * A CPU mapping of a single-plane linear DMA-BUF, used by buffer
+ * implementations to provide data pointer access. Accesses are bracketed by
+ * DMA_BUF_IOCTL_SYNC, so that the kernel can flush and invalidate CPU caches
+ * and wait for pending GPU work.
+ */
+struct dmabuf_mapping {
+	void *addr; // NULL if not mapped yet
+	size_t size;
+	bool writable;
+	uint32_t sync_flags; // of the current access
+};
+
+/**
+ * Begin a data pointer access, mapping the DMA-BUF on first use. flags is a
+ * combination of enum wlr_buffer_data_ptr_access_flag. Fails if the DMA-BUF
+ * has multiple planes or a non-linear layout.
+ */
+bool dmabuf_mapping_begin_access(struct dmabuf_mapping *mapping,
+	const struct wlr_dmabuf_attributes *dmabuf, uint32_t flags, void **data,
+	uint32_t *format, size_t *stride);
+void dmabuf_mapping_end_access(struct dmabuf_mapping *mapping,
+	const struct wlr_dmabuf_attributes *dmabuf);
+void dmabuf_mapping_finish(struct dmabuf_mapping *mapping);
+
+#endif
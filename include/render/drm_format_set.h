@@ -17,4 +17,32 @@ struct wlr_drm_format *wlr_drm_format_dup(const struct wlr_drm_format *format);
 struct wlr_drm_format *wlr_drm_format_intersect(
 	const struct wlr_drm_format *a, const struct wlr_drm_format *b);
 
+/**
+ * How much memory bandwidth buffers with a modifier are expected to save,
+ * higher is better. Compressed layouts (ARM AFBC, Intel CCS, AMD DCC) rank
+ * above tiled layouts, which rank above linear.
+ */
+enum wlr_drm_modifier_rank {
+	WLR_DRM_MODIFIER_RANK_IMPLICIT,
+	WLR_DRM_MODIFIER_RANK_LINEAR,
+	WLR_DRM_MODIFIER_RANK_TILED,
+	WLR_DRM_MODIFIER_RANK_COMPRESSED,
+};
+
+enum wlr_drm_modifier_rank wlr_drm_modifier_get_rank(uint64_t modifier);
+/**
+ * Get the best ranked modifiers of a DRM format, to let the allocator choose
+ * among them only. If no modifier ranks above linear, a copy of the format is
+ * returned.
+ */
+struct wlr_drm_format *wlr_drm_format_pick_preferred(
+	const struct wlr_drm_format *format);
+/**
+ * Get the best ranked modifiers of each format in a set, skipping formats
+ * whose modifiers don't rank above linear. Returns false if the result would
+ * be empty.
+ */
+bool wlr_drm_format_set_pick_preferred(struct wlr_drm_format_set *dst,
+	const struct wlr_drm_format_set *src);
+
 #endif
@@ -15,6 +15,8 @@ struct wlr_egl {
 		bool EXT_image_dma_buf_import;
 		bool EXT_image_dma_buf_import_modifiers;
 		bool IMG_context_priority;
+		bool KHR_fence_sync;
+		bool ANDROID_native_fence_sync;
 
 		// Device extensions
 		bool EXT_device_drm;
@@ -37,6 +39,9 @@ struct wlr_egl {
 		PFNEGLQUERYDISPLAYATTRIBEXTPROC eglQueryDisplayAttribEXT;
 		PFNEGLQUERYDEVICESTRINGEXTPROC eglQueryDeviceStringEXT;
 		PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT;
+		PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+		PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+		PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID;
 	} procs;
 
 	bool has_modifiers;
@@ -89,6 +94,26 @@ bool wlr_egl_destroy_image(struct wlr_egl *egl, EGLImageKHR image);
 
 int wlr_egl_dup_drm_fd(struct wlr_egl *egl);
 
+/**
+ * Insert a native fence into the command stream of the current context.
+ *
+ * The fence can be exported with wlr_egl_dup_fence_fd() once the client API
+ * commands have been flushed. Returns EGL_NO_SYNC_KHR if
+ * EGL_ANDROID_native_fence_sync is not supported.
+ */
+EGLSyncKHR wlr_egl_create_sync(struct wlr_egl *egl);
+
+/**
+ * Destroys an EGL sync created with the given wlr_egl.
+ */
+void wlr_egl_destroy_sync(struct wlr_egl *egl, EGLSyncKHR sync);
+
+/**
+ * Export a flushed native fence as a sync_file FD. The caller takes ownership
+ * of the returned FD. Returns -1 on error.
+ */
+int wlr_egl_dup_fence_fd(struct wlr_egl *egl, EGLSyncKHR sync);
+
 /**
  * Save the current EGL context to the structure provided in the argument.
  *
@@ -113,4 +138,19 @@ bool wlr_egl_unset_current(struct wlr_egl *egl);
 
 bool wlr_egl_is_current(struct wlr_egl *egl);
 
+/**
+ * Build the key identifying the driver and device in the DMA-BUF format cache.
+ * Returns NULL if the device can't be identified.
+ */
+char *egl_format_cache_key(struct wlr_egl *egl);
+/**
+ * Load the DMA-BUF texture and render formats from the on-disk cache. The
+ * cache is only used if it was written for the same key and the same list of
+ * formats, as returned by eglQueryDmaBufFormatsEXT.
+ */
+bool egl_format_cache_load(struct wlr_egl *egl, const char *key,
+	const int *formats, int formats_len);
+void egl_format_cache_save(struct wlr_egl *egl, const char *key,
+	const int *formats, int formats_len);
+
 #endif
@@ -13,8 +13,38 @@
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/wlr_texture.h>
 #include <wlr/util/addon.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 
+// GLES3 pixel buffer objects, the GLES2 headers don't define these
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+
+typedef void *(GL_APIENTRYP wlr_gles2_map_buffer_range_proc)(GLenum target,
+	GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLboolean (GL_APIENTRYP wlr_gles2_unmap_buffer_proc)(GLenum target);
+
+// Number of pixel buffer objects used in turn for shm texture uploads
+#define WLR_GLES2_UPLOAD_BUFFERS 4
+// Uploads larger than this go straight from client memory
+#define WLR_GLES2_UPLOAD_BUFFER_MAX_SIZE (64 * 1024 * 1024)
+
 struct wlr_gles2_pixel_format {
 	uint32_t drm_format;
 	// optional field, if empty then internalformat = format
@@ -25,11 +55,25 @@ struct wlr_gles2_pixel_format {
 
 struct wlr_gles2_tex_shader {
 	GLuint program;
-	GLint proj;
 	GLint tex;
-	GLint alpha;
 	GLint pos_attrib;
 	GLint tex_attrib;
+	GLint alpha_attrib; // -1 for the variants without alpha multiplication
+};
+
+// Converts RGB into one plane of a YUV buffer, drawn over the whole plane
+struct wlr_gles2_yuv_shader {
+	GLuint program;
+	GLint tex;
+	GLint pos_attrib;
+};
+
+// Vertices are batched in normalized device coordinates
+struct wlr_gles2_vertex {
+	GLfloat pos[2];
+	GLfloat texcoord[2]; // only used by textured quads
+	GLfloat color[4]; // only used by colored quads
+	GLfloat alpha; // only used by textured quads
 };
 
 struct wlr_gles2_renderer {
@@ -48,6 +92,10 @@ struct wlr_gles2_renderer {
 		bool EXT_texture_type_2_10_10_10_REV;
 		bool OES_texture_half_float_linear;
 		bool EXT_texture_norm16;
+		bool pixel_buffer_object; // GLES 3.0
+		bool EXT_disjoint_timer_query;
+		bool OES_texture_npot; // GLES 3.0, needed for mipmaps
+		bool OES_get_program_binary;
 	} exts;
 
 	struct {
@@ -57,25 +105,76 @@ struct wlr_gles2_renderer {
 		PFNGLPOPDEBUGGROUPKHRPROC glPopDebugGroupKHR;
 		PFNGLPUSHDEBUGGROUPKHRPROC glPushDebugGroupKHR;
 		PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC glEGLImageTargetRenderbufferStorageOES;
+		wlr_gles2_map_buffer_range_proc glMapBufferRange;
+		wlr_gles2_unmap_buffer_proc glUnmapBuffer;
+		PFNGLGENQUERIESEXTPROC glGenQueriesEXT;
+		PFNGLDELETEQUERIESEXTPROC glDeleteQueriesEXT;
+		PFNGLBEGINQUERYEXTPROC glBeginQueryEXT;
+		PFNGLENDQUERYEXTPROC glEndQueryEXT;
+		PFNGLGETQUERYOBJECTUIVEXTPROC glGetQueryObjectuivEXT;
+		PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
+		PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+		PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
 	} procs;
 
+	// Only set while the renderer is being created, see program_cache.c
+	struct wlr_gles2_program_cache *program_cache;
+
 	struct {
 		struct {
 			GLuint program;
-			GLint proj;
-			GLint color;
 			GLint pos_attrib;
+			GLint color_attrib;
 		} quad;
 		struct wlr_gles2_tex_shader tex_rgba;
 		struct wlr_gles2_tex_shader tex_rgbx;
 		struct wlr_gles2_tex_shader tex_ext;
+		// Same as above, for quads drawn with an alpha of 1
+		struct wlr_gles2_tex_shader tex_rgba_no_alpha;
+		struct wlr_gles2_tex_shader tex_rgbx_no_alpha;
+		struct wlr_gles2_tex_shader tex_ext_no_alpha;
+		// YUV to RGB conversion of textures imported plane by plane
+		struct wlr_gles2_tex_shader tex_nv12, tex_yuv420;
+		// Luma and chroma planes, sampling 2D or external textures
+		struct wlr_gles2_yuv_shader yuv_y, yuv_uv;
+		struct wlr_gles2_yuv_shader yuv_y_ext, yuv_uv_ext;
 	} shaders;
 
+	// Planar YUV formats supported by blit_to_yuv
+	uint32_t yuv_formats[2];
+	size_t yuv_formats_len;
+
 	struct wl_list buffers; // wlr_gles2_buffer.link
 	struct wl_list textures; // wlr_gles2_texture.link
 
 	struct wlr_gles2_buffer *current_buffer;
 	uint32_t viewport_width, viewport_height;
+
+	// Ring of pixel buffer objects for shm uploads, only used if
+	// exts.pixel_buffer_object. Each buffer is re-specified before being
+	// written to, so that the driver doesn't wait for pending transfers.
+	struct {
+		GLuint buffers[WLR_GLES2_UPLOAD_BUFFERS];
+		size_t next;
+	} upload;
+
+	// Scissor box in window coordinates. Quads which remain axis-aligned on
+	// screen are clipped on the CPU, other quads use the GL scissor test.
+	struct {
+		bool enabled;
+		struct wlr_box box;
+	} scissor;
+
+	// Quads are accumulated and drawn with a single call until the texture,
+	// the blending mode or the GL scissor box changes
+	struct {
+		struct wlr_gles2_texture *texture; // NULL for colored quads
+		struct wlr_gles2_tex_shader *shader; // NULL for colored quads
+		bool mipmap; // whether the texture's downscaled copy is sampled
+		bool blend;
+		bool scissor; // whether the GL scissor test is needed
+		struct wl_array vertices; // struct wlr_gles2_vertex
+	} batch;
 };
 
 struct wlr_gles2_buffer {
@@ -90,6 +189,25 @@ struct wlr_gles2_buffer {
 	struct wlr_addon addon;
 };
 
+// Asynchronous read-back into a pixel buffer object, only used if
+// exts.pixel_buffer_object
+struct wlr_gles2_readback {
+	struct wlr_render_readback base;
+	struct wlr_gles2_renderer *renderer;
+	uint32_t width, height;
+	uint32_t bytes_per_pixel;
+	GLuint pbo;
+	int sync_fd; // signalled once the PBO has been written, may be -1
+};
+
+struct wlr_gles2_render_timer {
+	struct wlr_render_timer base;
+	struct wlr_gles2_renderer *renderer;
+	GLuint query;
+	bool query_pending; // the result of the last pass hasn't been read yet
+	int64_t duration; // ns, -1 if unknown
+};
+
 struct wlr_gles2_texture {
 	struct wlr_texture wlr_texture;
 	struct wlr_gles2_renderer *renderer;
@@ -103,6 +221,12 @@ struct wlr_gles2_texture {
 
 	EGLImageKHR image;
 
+	// Chroma planes of a multi-planar YUV DMA-BUF imported plane by plane,
+	// tex and image then hold the luma plane
+	size_t chroma_planes_len; // 0 for other textures
+	GLuint chroma_texs[2];
+	EGLImageKHR chroma_images[2];
+
 	bool has_alpha;
 
 	// Only affects target == GL_TEXTURE_2D
@@ -110,6 +234,15 @@ struct wlr_gles2_texture {
 	// If imported from a wlr_buffer
 	struct wlr_buffer *buffer;
 	struct wlr_addon buffer_addon;
+
+	// Half-size copy with a mipmap chain, sampled instead of the texture when
+	// it is drawn much smaller than its size. Only used if
+	// exts.OES_texture_npot.
+	struct {
+		GLuint tex, fbo; // 0 if not allocated
+		bool dirty; // the texture contents changed since the last update
+		bool failed;
+	} mipmap;
 };
 
 
@@ -131,6 +264,39 @@ struct wlr_texture *gles2_texture_from_wl_drm(struct wlr_renderer *wlr_renderer,
 struct wlr_texture *gles2_texture_from_buffer(struct wlr_renderer *wlr_renderer,
 	struct wlr_buffer *buffer);
 void gles2_texture_destroy(struct wlr_gles2_texture *texture);
+/**
+ * Bring the downscaled copy of the texture up to date, drawing the texture
+ * with the shader. Must be called while rendering. Returns false if the copy
+ * can't be used.
+ */
+bool gles2_texture_update_mipmap(struct wlr_gles2_texture *texture,
+	struct wlr_gles2_tex_shader *shader);
+
+/**
+ * Draw the quads accumulated so far. Must be called before GL state used by
+ * the batch is modified, e.g. when a texture is updated or destroyed.
+ */
+void gles2_flush_batch(struct wlr_gles2_renderer *renderer);
+
+/**
+ * Load the binaries of the programs linked by a previous instance with the
+ * same driver. Does nothing if GL_OES_get_program_binary isn't supported.
+ */
+void gles2_program_cache_init(struct wlr_gles2_renderer *renderer);
+/**
+ * Create a program from a cached binary. Returns 0 on cache miss.
+ */
+GLuint gles2_program_cache_link(struct wlr_gles2_renderer *renderer,
+	const GLchar *vert_src, const GLchar *frag_src);
+/**
+ * Add the binary of a program linked from source to the cache.
+ */
+void gles2_program_cache_add(struct wlr_gles2_renderer *renderer,
+	const GLchar *vert_src, const GLchar *frag_src, GLuint prog);
+/**
+ * Write the cache back to disk if it has changed and release it.
+ */
+void gles2_program_cache_finish(struct wlr_gles2_renderer *renderer);
 
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
 	const char *file, const char *func);
@@ -1,6 +1,8 @@
 #ifndef RENDER_PIXMAN_H
 #define RENDER_PIXMAN_H
 
+#include <time.h>
+#include <wlr/render/interface.h>
 #include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/drm_format_set.h>
@@ -12,6 +14,25 @@ struct wlr_pixman_pixel_format {
 };
 
 struct wlr_pixman_buffer;
+struct wlr_pixman_workers;
+struct wlr_pixman_frame;
+
+// A draw operation recorded while compositing with worker threads
+struct wlr_pixman_draw {
+	pixman_op_t op;
+	pixman_box32_t bounds; // clipped to the scissor box and the buffer
+
+	pixman_image_t *image; // referenced, NULL for solid fills
+	pixman_color_t color; // if image is NULL
+	struct pixman_transform transform;
+	// The image is only offset by (dx, dy), the transform is unused
+	bool translate_only;
+	int32_t dx, dy;
+	uint16_t mask_alpha; // 0xFFFF if there is no mask
+
+	// Draws holding data pointer access to a texture buffer, locked
+	struct wlr_buffer *buffer;
+};
 
 struct wlr_pixman_renderer {
 	struct wlr_renderer wlr_renderer;
@@ -21,6 +42,26 @@ struct wlr_pixman_renderer {
 
 	struct wlr_pixman_buffer *current_buffer;
 	int32_t width, height;
+	struct timespec pass_start; // if wlr_renderer.timer is set
+
+	// NULL if compositing on the caller's thread
+	struct wlr_pixman_workers *workers;
+	// Set during passes whose draws are recorded, with workers or deferred
+	bool recording;
+	struct wl_array draws; // struct wlr_pixman_draw, if recording
+
+	// The next pass is handed over as a frame instead of being composited
+	bool defer_pass;
+	struct wlr_pixman_frame *deferred_frame; // not taken yet
+	struct wl_list frames; // wlr_pixman_frame.link
+	struct {
+		bool enabled;
+		pixman_box32_t box;
+	} scissor;
+
+	bool shadow_enabled;
+	// Drawn since the beginning of the pass, if the buffer has a shadow
+	pixman_region32_t shadow_damage;
 
 	struct wlr_drm_format_set drm_formats;
 };
@@ -29,8 +70,18 @@ struct wlr_pixman_buffer {
 	struct wlr_buffer *buffer;
 	struct wlr_pixman_renderer *renderer;
 
+	// The shadow copy if there is one, drawn into during the pass
 	pixman_image_t *image;
 
+	/**
+	 * Reading back from DMA-BUFs is slow, device memory is usually uncached
+	 * or write-combined. Such buffers get a copy in system memory which
+	 * is rendered into, and the damaged parts are copied to the buffer at
+	 * the end of each pass.
+	 */
+	void *shadow_data; // NULL if there is no shadow copy
+	pixman_image_t *target; // the buffer's own memory, if shadowed
+
 	struct wl_listener buffer_destroy;
 	struct wl_list link; // wlr_pixman_renderer.buffers
 };
@@ -48,8 +99,77 @@ struct wlr_pixman_texture {
 	struct wlr_buffer *buffer; // if created via texture_from_buffer
 };
 
+struct wlr_pixman_render_timer {
+	struct wlr_render_timer base;
+	int64_t duration; // ns, -1 if nothing has been measured yet
+};
+
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
 uint32_t get_drm_format_from_pixman(pixman_format_code_t fmt);
 const uint32_t *get_pixman_drm_formats(size_t *len);
 
+/**
+ * Create the worker pool configured via WLR_PIXMAN_THREADS. Returns NULL if
+ * drawing should happen immediately on the caller's thread.
+ */
+struct wlr_pixman_workers *pixman_workers_create(void);
+void pixman_workers_destroy(struct wlr_pixman_workers *workers);
+/**
+ * Record a draw operation touching the given bounds. Returns NULL if nothing
+ * needs to be drawn.
+ */
+struct wlr_pixman_draw *pixman_add_draw(struct wlr_pixman_renderer *renderer,
+	pixman_op_t op, const pixman_box32_t *bounds);
+/**
+ * Compute the bounds of a width x height rectangle transformed by mat.
+ */
+void pixman_get_transformed_bounds(pixman_box32_t *bounds,
+	const float mat[static 9], float width, float height);
+/**
+ * Composite all recorded draws, splitting the buffer into bands shared
+ * between the worker threads if there are any.
+ */
+void pixman_flush_draws(struct wlr_pixman_renderer *renderer);
+
+/**
+ * Move the draws recorded during the current pass to a new frame, along with
+ * the data pointer access to the bound buffer.
+ */
+struct wlr_pixman_frame *pixman_frame_create(
+	struct wlr_pixman_renderer *renderer);
+/**
+ * Composite a frame and flush its shadow copy. May be called from any thread,
+ * once per frame.
+ */
+void pixman_frame_composite(struct wlr_pixman_frame *frame);
+/**
+ * Block until the frame has been composited.
+ */
+void pixman_frame_wait(struct wlr_pixman_frame *frame);
+/**
+ * Wait for the frame to be composited and release it. Must be called from
+ * the renderer's thread.
+ */
+void pixman_frame_destroy(struct wlr_pixman_frame *frame);
+/**
+ * Block until all frames of the renderer have been composited, e.g. before
+ * releasing the memory they read from.
+ */
+void pixman_wait_frames(struct wlr_pixman_renderer *renderer);
+void pixman_frames_finish(struct wlr_pixman_renderer *renderer);
+
+/**
+ * Record the next pass started on the renderer instead of compositing it.
+ * Once the pass has ended, the recorded frame must be taken with
+ * pixman_renderer_take_frame().
+ */
+void pixman_renderer_defer_pass(struct wlr_renderer *renderer);
+/**
+ * Take the frame recorded by the last deferred pass. The caller must
+ * composite it with pixman_frame_composite() and then destroy it. Returns
+ * NULL if the pass couldn't be deferred and has already been composited.
+ */
+struct wlr_pixman_frame *pixman_renderer_take_frame(
+	struct wlr_renderer *renderer);
+
 #endif
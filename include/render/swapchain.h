@@ -22,6 +22,10 @@ struct wlr_swapchain {
 	struct wlr_drm_format *format;
 
 	struct wlr_swapchain_slot slots[WLR_SWAPCHAIN_CAP];
+	// Number of usable slots, WLR_SWAPCHAIN_CAP by default
+	size_t len;
+	// Fill all slots, and re-use the least recently submitted buffer first
+	bool strict;
 
 	struct wl_listener allocator_destroy;
 };
@@ -30,6 +34,18 @@ struct wlr_swapchain *wlr_swapchain_create(
 	struct wlr_allocator *alloc, int width, int height,
 	const struct wlr_drm_format *format);
 void wlr_swapchain_destroy(struct wlr_swapchain *swapchain);
+/**
+ * Limit the number of buffers and choose how they're re-used, see
+ * wlr_output_set_swapchain_depth(). Must be called before the first buffer is
+ * acquired.
+ */
+void wlr_swapchain_set_depth(struct wlr_swapchain *swapchain, size_t len,
+	bool strict);
+/**
+ * Destroy the buffers which are not waiting for release. They are allocated
+ * again when needed, their age is then zero.
+ */
+void wlr_swapchain_trim(struct wlr_swapchain *swapchain);
 /**
  * Acquire a buffer from the swap chain.
  *
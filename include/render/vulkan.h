@@ -4,13 +4,16 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include <vulkan/vulkan.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/wlr_texture.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/render/interface.h>
+#include <wlr/util/addon.h>
 
 struct wlr_vk_descriptor_pool;
+struct wlr_vk_memory_block;
 
 // Central vulkan state that should only be needed once per compositor.
 struct wlr_vk_instance {
@@ -37,6 +40,10 @@ struct wlr_vk_instance *vulkan_instance_create(size_t ext_count,
 	const char **exts, bool debug);
 void vulkan_instance_destroy(struct wlr_vk_instance *ini);
 
+// Must allow for at least twice the number of supported formats
+#define WLR_VK_FORMAT_TABLE_BITS 4
+#define WLR_VK_FORMAT_TABLE_SIZE (1 << WLR_VK_FORMAT_TABLE_BITS)
+
 // Logical vulkan device state.
 // Ownership can be shared by multiple renderers, reference counted
 // with `renderers`.
@@ -52,16 +59,41 @@ struct wlr_vk_device {
 	size_t extension_count;
 	const char **extensions;
 
-	// we only ever need one queue for rendering and transfer commands
+	// one queue for rendering and transfer commands
 	uint32_t queue_family;
 	VkQueue queue;
 
+	// optional queue of a dedicated transfer-only family, used to upload
+	// shm textures asynchronously
+	bool has_transfer_queue;
+	uint32_t transfer_queue_family;
+	VkQueue transfer_queue;
+
+	// whether binary semaphores can be exported as sync_file FDs
+	bool sync_file_export;
+	// whether sync_file FDs can be imported into binary semaphores
+	bool sync_file_import;
+
+	// whether multi-planar YUV formats can be sampled, converted to RGB by
+	// the sampler
+	bool sampler_ycbcr_conversion;
+
+	// whether the graphics queue supports timestamp queries
+	bool timestamps;
+	float timestamp_period; // ns per timestamp tick
+	uint64_t timestamp_mask; // valid timestamp bits
+
 	struct {
 		PFN_vkGetMemoryFdPropertiesKHR getMemoryFdPropertiesKHR;
+		PFN_vkGetSemaphoreFdKHR getSemaphoreFdKHR; // if sync_file_export
+		PFN_vkImportSemaphoreFdKHR importSemaphoreFdKHR; // if sync_file_import
 	} api;
 
 	uint32_t format_prop_count;
 	struct wlr_vk_format_props *format_props;
+	// open addressing hash table of format_props entries, keyed by
+	// DRM format. Used by vulkan_format_props_from_drm()
+	struct wlr_vk_format_props *format_props_table[WLR_VK_FORMAT_TABLE_SIZE];
 	struct wlr_drm_format_set dmabuf_render_formats;
 	struct wlr_drm_format_set dmabuf_texture_formats;
 
@@ -92,6 +124,7 @@ int vulkan_find_mem_type(struct wlr_vk_device *device,
 struct wlr_vk_format {
 	uint32_t drm_format;
 	VkFormat vk_format;
+	bool is_ycbcr; // multi-planar, needs a VkSamplerYcbcrConversion
 };
 
 // Returns all known format mappings.
@@ -133,6 +166,53 @@ struct wlr_vk_render_format_setup {
 
 	VkPipeline tex_pipe;
 	VkPipeline quad_pipe;
+	struct wl_list ycbcr_pipes; // wlr_vk_ycbcr_pipeline.link
+};
+
+// Sampler and layouts for the textures of a multi-planar YUV format. The
+// YCbCr conversion is baked into the sampler, which must be immutable in the
+// descriptor set layout, so each format needs its own layouts and pipelines.
+struct wlr_vk_ycbcr_layout {
+	struct wl_list link; // wlr_vk_renderer.ycbcr_layouts
+	VkFormat format;
+	VkSamplerYcbcrConversion conversion;
+	VkSampler sampler;
+	VkDescriptorSetLayout ds_layout;
+	VkPipelineLayout pipe_layout;
+};
+
+// Texture pipeline of a render format setup for a YCbCr layout
+struct wlr_vk_ycbcr_pipeline {
+	struct wl_list link; // wlr_vk_render_format_setup.ycbcr_pipes
+	const struct wlr_vk_ycbcr_layout *layout;
+	VkPipeline pipe;
+};
+
+// Identifies a DMA-BUF import. DMA-BUF inodes are unique as long as the
+// buffer is alive, which the imported memory guarantees. n_planes is zero
+// if the import can't be cached.
+struct wlr_vk_dmabuf_key {
+	uint32_t format;
+	uint64_t modifier;
+	int32_t width, height;
+	uint32_t n_planes;
+	ino_t inode[WLR_DMABUF_MAX_PLANES];
+	uint32_t offset[WLR_DMABUF_MAX_PLANES];
+	uint32_t stride[WLR_DMABUF_MAX_PLANES];
+	bool for_render;
+};
+
+// Image and memory of a DMA-BUF import whose texture or render buffer was
+// destroyed, kept in case the same DMA-BUF is imported again. Only contains
+// images which are not used by any frame in flight.
+struct wlr_vk_dmabuf_import {
+	struct wl_list link; // wlr_vk_renderer.dmabuf_imports
+	struct wlr_vk_dmabuf_key key;
+	VkImage image;
+	uint32_t mem_count;
+	VkDeviceMemory memories[WLR_DMABUF_MAX_PLANES];
+	bool transitioned;
+	uint32_t cached_frame; // id of the frame it was cached in
 };
 
 // Renderer-internal represenation of an wlr_buffer imported for rendering.
@@ -148,8 +228,37 @@ struct wlr_vk_render_buffer {
 	uint32_t mem_count;
 	VkDeviceMemory memories[WLR_DMABUF_MAX_PLANES];
 	bool transitioned;
+	uint32_t last_used; // id of the last frame rendering into the buffer
+	// The fence of the last frame couldn't be attached to the DMA-BUF, wait
+	// for it on the CPU when the buffer is unbound
+	bool needs_wait;
+	struct wlr_vk_dmabuf_key dmabuf_key;
 
-	struct wl_listener buffer_destroy;
+	struct wlr_addon addon;
+};
+
+#define WLR_VK_MAX_FRAMES_IN_FLIGHT 3
+
+// Resources of a frame which may be in flight on the GPU. They are only
+// recycled once the frame's fence has signalled.
+struct wlr_vk_frame {
+	VkCommandBuffer cb; // render commands
+	VkCommandBuffer stage_cb; // uploads and barriers, executed before cb
+	// uploads on the dedicated transfer queue, only if
+	// wlr_vk_renderer.transfer_command_pool exists
+	VkCommandBuffer transfer_cb;
+	VkSemaphore transfer_semaphore; // signalled by transfer_cb
+	VkFence fence;
+	// signalled by cb, only valid if dev->sync_file_export
+	VkSemaphore semaphore;
+	int sync_file_fd; // exported from semaphore, -1 if none
+	// fences of the DMA-BUFs accessed by the frame, imported from sync_files
+	// if dev->sync_file_import. Re-used once the frame has been retired.
+	struct wl_array wait_semaphores; // VkSemaphore
+	size_t wait_semaphores_len; // used by the last submission
+
+	uint32_t id; // frame id
+	bool pending; // submitted, fence not waited for yet
 };
 
 // Vulkan wlr_renderer implementation on top of a wlr_vk_device.
@@ -159,6 +268,9 @@ struct wlr_vk_renderer {
 	struct wlr_vk_device *dev;
 
 	VkCommandPool command_pool;
+	// for wlr_vk_device.transfer_queue, VK_NULL_HANDLE if there is none
+	VkCommandPool transfer_command_pool;
+	uint32_t concurrent_queue_families[2]; // graphics and transfer
 
 	VkShaderModule vert_module;
 	VkShaderModule tex_frag_module;
@@ -167,36 +279,56 @@ struct wlr_vk_renderer {
 	VkDescriptorSetLayout ds_layout;
 	VkPipelineLayout pipe_layout;
 	VkSampler sampler;
+	struct wl_list ycbcr_layouts; // wlr_vk_ycbcr_layout.link
 
-	VkFence fence;
+	struct {
+		VkPipelineCache cache; // used for all pipeline creation
+		size_t saved_size; // size of the data last loaded from/saved to disk
+	} pipeline_cache;
 
 	struct wlr_vk_render_buffer *current_render_buffer;
 
+	// frames used round-robin, up to frames_in_flight may be pending
+	struct wlr_vk_frame frames[WLR_VK_MAX_FRAMES_IN_FLIGHT];
+	size_t frames_in_flight;
+	// frame being recorded, its previous submission has always finished
+	struct wlr_vk_frame *current_frame;
+
 	// current frame id. Used in wlr_vk_texture.last_used
 	// Increased every time a frame is ended for the renderer
 	uint32_t frame;
+	// all frames with an id older than this one have finished execution
+	uint32_t finished_frame;
 	VkRect2D scissor; // needed for clearing
 
-	VkCommandBuffer cb;
 	VkPipeline bound_pipe;
+	VkDescriptorSet bound_ds;
+	struct wl_array op_rects; // VkClearRect, scratch space for submit_ops
 
 	uint32_t render_width;
 	uint32_t render_height;
 	float projection[9];
 
 	size_t last_pool_size;
-	struct wl_list descriptor_pools; // type wlr_vk_descriptor_pool
+	// type wlr_vk_descriptor_pool, only pools with free descriptor sets
+	struct wl_list descriptor_pools;
+	struct wl_list full_descriptor_pools; // type wlr_vk_descriptor_pool
 	struct wl_list render_format_setups;
 
 	struct wl_list textures; // wlr_gles2_texture.link
 	struct wl_list destroy_textures; // wlr_vk_texture to destroy after frame
 	struct wl_list foreign_textures; // wlr_vk_texture to return to foreign queue
 
+	struct wl_list memory_blocks; // wlr_vk_memory_block.link
+
 	struct wl_list render_buffers; // wlr_vk_render_buffer
+	// wlr_vk_dmabuf_import, most recently cached first
+	struct wl_list dmabuf_imports;
+	size_t dmabuf_import_count;
 
 	struct {
-		VkCommandBuffer cb;
-		bool recording;
+		bool recording; // current_frame->stage_cb
+		bool transfer_recording; // current_frame->transfer_cb
 		struct wl_list buffers; // type wlr_vk_shared_buffer
 	} stage;
 };
@@ -204,44 +336,84 @@ struct wlr_vk_renderer {
 // Creates a vulkan renderer for the given device.
 struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev);
 
+// Creates the pipeline cache, pre-filled with the data saved to
+// $XDG_CACHE_HOME/wlroots by previous runs on the same device and driver.
+bool vulkan_pipeline_cache_init(struct wlr_vk_renderer *renderer);
+// Writes the pipeline cache to disk if it has grown since the last save.
+void vulkan_pipeline_cache_save(struct wlr_vk_renderer *renderer);
+// Saves and destroys the pipeline cache.
+void vulkan_pipeline_cache_finish(struct wlr_vk_renderer *renderer);
+
 // stage utility - for uploading/retrieving data
 // Gets an command buffer in recording state which is guaranteed to be
 // executed before the next frame.
 VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer);
 
-// Submits the current stage command buffer and waits until it has
-// finished execution.
+// Gets a command buffer in recording state for the dedicated transfer queue,
+// which is guaranteed to finish execution before the next frame is rendered.
+// Returns VK_NULL_HANDLE if there is no such queue. Resources used on it
+// must be created with vulkan_set_sharing_mode() applied.
+VkCommandBuffer vulkan_record_transfer_cb(struct wlr_vk_renderer *renderer);
+
+// Lets images and buffers be accessed from the graphics and the transfer
+// queue without ownership transfers. Call before creating them.
+void vulkan_set_sharing_mode(struct wlr_vk_renderer *renderer,
+	VkSharingMode *mode, uint32_t *family_count, const uint32_t **families);
+
+// Submits the current stage and transfer command buffers and waits until
+// they have finished execution.
 bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer);
 
-// Suballocates a buffer span with the given size that can be mapped
-// and used as staging buffer. The allocation is implicitly released when the
-// stage cb has finished execution.
+// Whether a frame with the given id may still be executing on the GPU.
+bool vulkan_frame_is_busy(struct wlr_vk_renderer *renderer, uint32_t frame);
+
+// Suballocates a buffer span with the given size that can be written through
+// wlr_vk_shared_buffer.cpu_mapping and used as staging buffer. The allocation
+// is implicitly released when the stage cb has finished execution. May submit
+// the pending stage cb and wait for it to make room.
 struct wlr_vk_buffer_span vulkan_get_stage_span(
 	struct wlr_vk_renderer *renderer, VkDeviceSize size);
 
-// Tries to allocate a texture descriptor set. Will additionally
-// return the pool it was allocated from when successful (for freeing it later).
+// Tries to allocate a texture descriptor set with the given layout. Will
+// additionally return the pool it was allocated from when successful (for
+// freeing it later).
 struct wlr_vk_descriptor_pool *vulkan_alloc_texture_ds(
-	struct wlr_vk_renderer *renderer, VkDescriptorSet *ds);
+	struct wlr_vk_renderer *renderer, VkDescriptorSetLayout ds_layout,
+	VkDescriptorSet *ds);
+
+// Gets the layouts for textures of the given multi-planar format, creating
+// them if needed. Returns NULL on error.
+struct wlr_vk_ycbcr_layout *vulkan_get_ycbcr_layout(
+	struct wlr_vk_renderer *renderer, const struct wlr_vk_format *format);
 
-// Frees the given descriptor set from the pool its pool.
+// Frees the given descriptor set from the pool its pool. Pools left empty
+// are destroyed, unless no other pool has free descriptor sets.
 void vulkan_free_ds(struct wlr_vk_renderer *renderer,
 	struct wlr_vk_descriptor_pool *pool, VkDescriptorSet ds);
 struct wlr_vk_format_props *vulkan_format_props_from_drm(
 	struct wlr_vk_device *dev, uint32_t drm_format);
+// Slot of a DRM format in wlr_vk_device.format_props_table
+static inline uint32_t vulkan_format_table_hash(uint32_t drm_format) {
+	// fourcc codes mostly differ in their last characters, Fibonacci
+	// hashing mixes them into the top bits
+	return (drm_format * 2654435769u) >> (32 - WLR_VK_FORMAT_TABLE_BITS);
+}
 struct wlr_vk_renderer *vulkan_get_renderer(struct wlr_renderer *r);
 
 // State (e.g. image texture) associated with a surface.
 struct wlr_vk_texture {
 	struct wlr_texture wlr_texture;
 	struct wlr_vk_renderer *renderer;
-	uint32_t mem_count;
-	VkDeviceMemory memories[WLR_DMABUF_MAX_PLANES];
+	uint32_t mem_count; // if dmabuf_imported
+	VkDeviceMemory memories[WLR_DMABUF_MAX_PLANES]; // if dmabuf_imported
+	struct wlr_vk_memory memory; // if !dmabuf_imported
 	VkImage image;
 	VkImageView image_view;
 	const struct wlr_vk_format *format;
 	VkDescriptorSet ds;
 	struct wlr_vk_descriptor_pool *ds_pool;
+	// layouts of the YCbCr sampler, NULL for RGB formats
+	struct wlr_vk_ycbcr_layout *ycbcr_layout;
 	uint32_t last_used; // to track when it can be destroyed
 	bool dmabuf_imported;
 	bool owned; // if dmabuf_imported: whether we have ownership of the image
@@ -250,26 +422,80 @@ struct wlr_vk_texture {
 	struct wl_list destroy_link;
 	struct wl_list link; // wlr_gles2_renderer.textures
 
+	struct wlr_vk_dmabuf_key dmabuf_key; // if dmabuf_imported
+
 	// If imported from a wlr_buffer
 	struct wlr_buffer *buffer;
-	struct wl_listener buffer_destroy;
+	struct wlr_addon buffer_addon;
 };
 
 struct wlr_vk_texture *vulkan_get_texture(struct wlr_texture *wlr_texture);
+// Imports the DMA-BUF, taking the image from the import cache if the same
+// DMA-BUF was imported before. Fills key, which must be passed to
+// vulkan_release_dmabuf_import() once the image is no longer used, and sets
+// transitioned if the image was transitioned by its previous user.
 VkImage vulkan_import_dmabuf(struct wlr_vk_renderer *renderer,
 	const struct wlr_dmabuf_attributes *attribs,
 	VkDeviceMemory mems[static WLR_DMABUF_MAX_PLANES], uint32_t *n_mems,
-	bool for_render);
+	bool for_render, struct wlr_vk_dmabuf_key *key, bool *transitioned);
+// Moves an idle image imported with vulkan_import_dmabuf() into the import
+// cache, or destroys it if it can't be cached.
+void vulkan_release_dmabuf_import(struct wlr_vk_renderer *renderer,
+	const struct wlr_vk_dmabuf_key *key, VkImage image,
+	VkDeviceMemory mems[static WLR_DMABUF_MAX_PLANES], uint32_t n_mems,
+	bool transitioned);
+// Destroys cached imports which haven't been reused in a while, or all of
+// them if all is set.
+void vulkan_prune_dmabuf_imports(struct wlr_vk_renderer *renderer, bool all);
 struct wlr_texture *vulkan_texture_from_buffer(
 	struct wlr_renderer *wlr_renderer, struct wlr_buffer *buffer);
 void vulkan_texture_destroy(struct wlr_vk_texture *texture);
 
+// Measures a rendering pass with a pair of GPU timestamps
+struct wlr_vk_render_timer {
+	struct wlr_render_timer base;
+	struct wlr_vk_renderer *renderer;
+	VkQueryPool query_pool;
+	bool pending; // the last measured frame hasn't been read back yet
+	uint32_t frame; // id of the last measured frame
+	int64_t duration; // ns, -1 if unknown
+};
+
 struct wlr_vk_descriptor_pool {
 	VkDescriptorPool pool;
+	uint32_t size; // total number of descriptor sets
 	uint32_t free; // number of textures that can be allocated
+	// wlr_vk_renderer.descriptor_pools or full_descriptor_pools if free == 0
 	struct wl_list link;
 };
 
+// Device memory suballocated from a larger block, or dedicated to a single
+// resource.
+struct wlr_vk_memory {
+	VkDeviceMemory memory;
+	VkDeviceSize offset; // to bind the resource at
+	void *cpu_mapping; // start of the allocation, if host-visible
+
+	struct wlr_vk_memory_block *block; // NULL if dedicated
+	int order; // buddy order, if suballocated
+};
+
+// Allocates memory for a resource with the given requirements, from a memory
+// type with the given property flags. linear must be set for buffers and
+// linear images. Small allocations are carved out of shared blocks, unless
+// dedicated_image is set.
+bool vulkan_alloc_memory(struct wlr_vk_renderer *renderer,
+	const VkMemoryRequirements *reqs, VkMemoryPropertyFlags flags,
+	bool linear, VkImage dedicated_image, struct wlr_vk_memory *mem);
+// Frees memory allocated with vulkan_alloc_memory(). The resource using it
+// must have been destroyed.
+void vulkan_free_memory(struct wlr_vk_renderer *renderer,
+	struct wlr_vk_memory *mem);
+// Frees the memory blocks without any allocation left.
+void vulkan_memory_trim(struct wlr_vk_renderer *renderer);
+// Destroys the memory blocks, all memory must have been freed.
+void vulkan_memory_finish(struct wlr_vk_renderer *renderer);
+
 struct wlr_vk_allocation {
 	VkDeviceSize start;
 	VkDeviceSize size;
@@ -277,15 +503,17 @@ struct wlr_vk_allocation {
 
 // List of suballocated staging buffers.
 // Used to upload to/read from device local images.
+// Spans are handed out linearly; the whole buffer is recycled at once when the
+// stage commands referencing it have finished execution.
 struct wlr_vk_shared_buffer {
-	struct wl_list link;
+	struct wl_list link; // wlr_vk_renderer.stage.buffers
 	VkBuffer buffer;
-	VkDeviceMemory memory;
+	struct wlr_vk_memory memory;
 	VkDeviceSize buf_size;
+	void *cpu_mapping; // persistently mapped for the buffer lifetime
 
-	size_t allocs_size;
-	size_t allocs_capacity;
-	struct wlr_vk_allocation *allocs;
+	VkDeviceSize offset; // start of the unused part of the buffer
+	uint32_t last_used; // frame id of the last allocation
 };
 
 // Suballocated range on a buffer.
@@ -27,5 +27,45 @@ const struct wlr_drm_format_set *wlr_renderer_get_render_formats(
  * This functions returns a bitfield of supported wlr_buffer_cap.
  */
 uint32_t renderer_get_render_buffer_caps(struct wlr_renderer *renderer);
+/**
+ * Export a sync_file FD which is signalled when the rendering operations
+ * submitted for the currently bound buffer have completed. The caller takes
+ * ownership of the FD.
+ *
+ * Returns -1 if the renderer doesn't support explicit synchronization.
+ */
+int renderer_export_sync_file(struct wlr_renderer *renderer);
+/**
+ * Get the bounding box of the pixels an operation can modify, in buffer-local
+ * coordinates, ignoring its clip region.
+ *
+ * Returns false if the operation is unbounded, e.g. for clears.
+ */
+bool render_op_get_bounds(const struct wlr_render_op *op,
+	pixman_box32_t *bounds);
+/**
+ * Draw an operation with the renderer's immediate mode functions, once per
+ * rectangle of its clip region, like wlr_renderer_submit_ops() does for
+ * renderers without a submit_ops implementation. The scissor box is left in
+ * an undefined state.
+ */
+bool render_op_draw_clipped(struct wlr_renderer *r,
+	const struct wlr_render_op *op);
+/**
+ * Take a released mutable texture with the given DRM format and size out of
+ * the renderer's pool, to save the allocation of a new one. Its contents are
+ * undefined.
+ *
+ * Returns NULL if there is no such texture.
+ */
+struct wlr_texture *renderer_texture_pool_acquire(struct wlr_renderer *renderer,
+	uint32_t format, uint32_t width, uint32_t height);
+/**
+ * Hand a texture created from pixels with the given DRM format over to the
+ * renderer's pool. Immutable textures are destroyed, as is the least recently
+ * released texture when the pool is full.
+ */
+void renderer_texture_pool_release(struct wlr_renderer *renderer,
+	struct wlr_texture *texture, uint32_t format);
 
 #endif
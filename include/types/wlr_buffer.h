@@ -69,4 +69,29 @@ struct wlr_dmabuf_buffer *dmabuf_buffer_create(
  */
 bool dmabuf_buffer_drop(struct wlr_dmabuf_buffer *buffer);
 
+/**
+ * Same as wlr_client_buffer_apply_damage(), but the pixels are only uploaded
+ * when the texture is read with client_buffer_get_texture(). The next buffer
+ * is kept locked until then.
+ */
+bool client_buffer_defer_damage(struct wlr_client_buffer *client_buffer,
+	struct wlr_buffer *next, const pixman_region32_t *damage);
+/**
+ * Drop the deferred upload, if any. The damage which wasn't uploaded is added
+ * to the damage region.
+ */
+void client_buffer_discard_pending(struct wlr_client_buffer *client_buffer,
+	pixman_region32_t *damage);
+/**
+ * Get the texture of the client buffer, uploading deferred damage first.
+ */
+struct wlr_texture *client_buffer_get_texture(
+	struct wlr_client_buffer *client_buffer);
+/**
+ * Get the color of a client buffer created from a single-pixel buffer, which
+ * can be drawn as a color fill instead of a texture.
+ */
+bool client_buffer_get_color(struct wlr_client_buffer *client_buffer,
+	float color[static 4]);
+
 #endif
@@ -0,0 +1,25 @@
+#ifndef TYPES_WLR_CLIENT_USAGE_H
+#define TYPES_WLR_CLIENT_USAGE_H
+
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_client_usage.h>
+
+/**
+ * Account a buffer created from a client's wl_buffer, until it's destroyed.
+ * Buffers which are already accounted are ignored.
+ */
+void client_usage_add_buffer(struct wl_client *client,
+	struct wlr_buffer *buffer);
+/**
+ * Account the texture of a client buffer to the client owning its source
+ * buffer, if any.
+ */
+void client_usage_add_client_buffer(struct wlr_client_buffer *client_buffer);
+/**
+ * Account a shm pool being created (old_size is zero), resized or destroyed
+ * (new_size is zero).
+ */
+void client_usage_update_shm_pool(struct wl_client *client, size_t old_size,
+	size_t new_size);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef TYPES_WLR_COMPOSITOR_H
+#define TYPES_WLR_COMPOSITOR_H
+
+#include <wlr/types/wlr_compositor.h>
+
+/*
+ * Marks the flattened subsurface tree of the surface and of all of its
+ * ancestors as stale. Must be called whenever a subsurface of the tree is
+ * mapped, unmapped, moved or re-ordered.
+ */
+void surface_invalidate_subsurface_tree(struct wlr_surface *surface);
+
+#endif
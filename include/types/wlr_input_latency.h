@@ -0,0 +1,12 @@
+#ifndef TYPES_WLR_INPUT_LATENCY_H
+#define TYPES_WLR_INPUT_LATENCY_H
+
+#include <wlr/types/wlr_input_latency.h>
+
+/**
+ * Records the delivery of the pending input event to a client, if any. Called
+ * by the seat whenever an input event is sent.
+ */
+void input_latency_handle_delivery(struct wlr_input_latency *latency);
+
+#endif
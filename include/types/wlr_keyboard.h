@@ -6,3 +6,17 @@ void keyboard_key_update(struct wlr_keyboard *keyboard,
 bool keyboard_modifier_update(struct wlr_keyboard *keyboard);
 
 void keyboard_led_update(struct wlr_keyboard *keyboard);
+
+/**
+ * Compile and set a keymap uploaded by a client. Keymaps with the same source
+ * as one already in use are not compiled again.
+ */
+bool keyboard_set_keymap_from_string(struct wlr_keyboard *kb,
+	const char *source, size_t size);
+
+/**
+ * Check whether two keyboards use identical keymaps, without serializing
+ * them.
+ */
+bool keyboard_keymaps_match(struct wlr_keyboard *kb1,
+	struct wlr_keyboard *kb2);
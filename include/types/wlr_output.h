@@ -15,4 +15,93 @@ void output_clear_back_buffer(struct wlr_output *output);
 bool output_ensure_buffer(struct wlr_output *output,
 	const struct wlr_output_state *state, bool *new_back_buffer);
 
+/**
+ * An output commit between the generic checks and the backend commit, so
+ * that backends can commit the states of several outputs at once.
+ */
+struct output_commit {
+	struct wlr_output *output;
+	bool test;
+	// Changed fields of the committed state, with the back buffer if needed
+	struct wlr_output_state pending;
+	bool new_back_buffer;
+	struct wlr_buffer *back_buffer;
+	int render_fence_fd;
+	struct wlr_buffer *capture_buffer; // of the attached wlr_output_capture
+	struct timespec now;
+};
+
+/**
+ * Run the generic checks and emit the precommit event. If this returns true,
+ * the backend must then be asked to commit (or test) the pending state and
+ * output_commit_finish() must be called with the result.
+ *
+ * In test mode, no event is emitted and the back buffer is kept attached.
+ */
+bool output_commit_prepare(struct output_commit *commit,
+	struct wlr_output *output, const struct wlr_output_state *state,
+	bool test);
+/**
+ * Apply the pending state to the output and emit the commit event if it has
+ * been committed by the backend, or release the resources of the commit.
+ */
+void output_commit_finish(struct output_commit *commit, bool committed);
+
+/**
+ * Attach the next render timer to the renderer, so that it measures the frame
+ * rendered into the back buffer.
+ */
+void output_arm_render_timer(struct wlr_output *output);
+/**
+ * Update wlr_output.render_time with the most recent available measurement.
+ */
+void output_poll_render_time(struct wlr_output *output);
+void output_render_timing_finish(struct wlr_output *output);
+
+void output_frame_scheduling_finish(struct wlr_output *output);
+/**
+ * Delay the upcoming frame event if predictive frame scheduling is enabled.
+ * Returns true if the frame event will be sent later by the scheduler.
+ */
+bool output_frame_scheduling_delay_frame(struct wlr_output *output);
+void output_frame_scheduling_handle_frame(struct wlr_output *output);
+void output_frame_scheduling_handle_commit(struct wlr_output *output);
+void output_frame_scheduling_handle_present(struct wlr_output *output,
+	const struct wlr_output_event_present *event);
+
+/**
+ * Release the cached hardware cursor buffers.
+ */
+void output_cursor_buffer_cache_finish(struct wlr_output *output);
+/**
+ * Keep at least the provided number of hardware cursor buffers cached, e.g.
+ * all frames of an animated cursor. Zero restores the default.
+ */
+void output_cursor_buffer_cache_reserve(struct wlr_output *output,
+	size_t cap);
+
+/**
+ * Attach the first pending wlr_output_capture the backend accepts to a state
+ * with a buffer. Captures the backend rejects are done, unsuccessfully. The
+ * backend is only asked again when the output state or the buffer format
+ * changes.
+ * Returns a new reference to the attached buffer, or NULL.
+ */
+struct wlr_buffer *output_state_add_capture(struct wlr_output *output,
+	struct wlr_output_state *state);
+/**
+ * Mark the capture attached to a committed state as submitted.
+ */
+void output_captures_handle_commit(struct wlr_output *output,
+	const struct wlr_output_state *state, const struct timespec *when);
+void output_captures_handle_commit_failure(struct wlr_output *output,
+	const struct wlr_output_state *state);
+void output_captures_finish(struct wlr_output *output);
+
+void output_lfc_finish(struct wlr_output *output);
+void output_lfc_handle_commit(struct wlr_output *output,
+	const struct wlr_output_state *state);
+void output_lfc_handle_present(struct wlr_output *output,
+	const struct wlr_output_event_present *event);
+
 #endif
@@ -5,4 +5,29 @@
 
 struct wlr_scene *scene_node_get_root(struct wlr_scene_node *node);
 
+struct wlr_pixman_frame;
+struct scene_render_thread;
+
+struct scene_render_thread *scene_render_thread_create(
+	struct wlr_scene_output *scene_output);
+void scene_render_thread_destroy(struct scene_render_thread *thread);
+/**
+ * Returns true if a frame is being composited or waits to be committed.
+ */
+bool scene_render_thread_busy(struct scene_render_thread *thread);
+/**
+ * Hand over a frame to the thread, which must not be busy.
+ * scene_output_handle_frame_composited() is called from the event loop once
+ * the frame has been composited.
+ */
+void scene_render_thread_submit(struct scene_render_thread *thread,
+	struct wlr_pixman_frame *frame);
+/**
+ * Block until the frame in flight has been composited, if any.
+ */
+void scene_render_thread_wait(struct scene_render_thread *thread);
+
+void scene_output_handle_frame_composited(
+	struct wlr_scene_output *scene_output);
+
 #endif
@@ -8,6 +8,11 @@ extern const struct wlr_pointer_grab_interface default_pointer_grab_impl;
 extern const struct wlr_keyboard_grab_interface default_keyboard_grab_impl;
 extern const struct wlr_touch_grab_interface default_touch_grab_impl;
 
+/**
+ * Must be called whenever an input event is sent to a client.
+ */
+void seat_handle_input_delivery(struct wlr_seat *seat);
+
 void seat_client_create_pointer(struct wlr_seat_client *seat_client,
 	uint32_t version, uint32_t id);
 void seat_client_destroy_pointer(struct wl_resource *resource);
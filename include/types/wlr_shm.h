@@ -0,0 +1,75 @@
+#ifndef TYPES_WLR_SHM_H
+#define TYPES_WLR_SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_buffer.h>
+
+/**
+ * A wl_shm global which, unlike the one provided by libwayland, keeps the file
+ * descriptors of the pools around. This allows buffers to be wrapped into
+ * DMA-BUFs via /dev/udmabuf, so that they can be sampled or scanned out
+ * without being copied.
+ */
+struct wlr_shm {
+	struct wl_global *global;
+	uint32_t *formats; // DRM formats
+	size_t formats_len;
+	int udmabuf_fd; // /dev/udmabuf, -1 if unavailable
+	struct wl_list pools; // wlr_shm_pool.link
+
+	struct wl_listener display_destroy;
+};
+
+struct wlr_shm_mapping {
+	void *data;
+	size_t size;
+	size_t n_refs; // the pool and data pointer accesses
+	bool sigbus; // the client has truncated the file
+	struct wl_list link; // accessed_mappings, while accessed
+	size_t n_accesses;
+};
+
+struct wlr_shm_pool {
+	struct wl_resource *resource; // NULL if destroyed
+	struct wlr_shm *shm; // NULL if the global has been destroyed
+	struct wl_list link; // wlr_shm.pools
+	int fd;
+	struct wlr_shm_mapping *mapping;
+	size_t n_refs; // the resource and the buffers
+	// Sealed against shrinking, so that it can be wrapped into a udmabuf
+	bool sealed;
+};
+
+struct wlr_shm_pool_buffer {
+	struct wlr_buffer base;
+	struct wlr_shm_pool *pool;
+	struct wl_resource *resource; // NULL if destroyed
+
+	uint32_t drm_format;
+	int32_t offset, stride;
+
+	struct wlr_shm_mapping *mapping; // while accessing the data pointer
+
+	int dmabuf_fd; // udmabuf, -1 if not created
+	uint32_t dmabuf_offset;
+	bool dmabuf_disabled;
+
+	struct wl_listener release;
+};
+
+/**
+ * Create the wl_shm global, advertising the given DRM formats. udmabuf is used
+ * if available.
+ */
+struct wlr_shm *shm_create(struct wl_display *display,
+	const uint32_t *formats, size_t formats_len);
+bool shm_resource_is_buffer(struct wl_resource *resource);
+/**
+ * Stop exposing a buffer as a DMA-BUF, e.g. because it couldn't be imported.
+ * Returns false if the buffer wasn't exposed as a DMA-BUF.
+ */
+bool shm_buffer_disable_dmabuf(struct wlr_buffer *buffer);
+
+#endif
@@ -71,6 +71,14 @@ struct wlr_tablet_tool_client_v2 {
 	struct wlr_tablet_seat_client_v2 *seat;
 
 	struct wl_event_source *frame_source;
+
+	// Axis values last sent since proximity in, in wire units, used to skip
+	// redundant events. sent_axes is a bitfield of enum wlr_tablet_tool_axes.
+	uint32_t sent_axes;
+	int32_t sent_x, sent_y;
+	int32_t sent_pressure, sent_distance;
+	int32_t sent_tilt_x, sent_tilt_y;
+	int32_t sent_rotation, sent_slider;
 };
 
 struct wlr_tablet_client_v2 *tablet_client_from_resource(struct wl_resource *resource);
@@ -0,0 +1,52 @@
+#ifndef UTIL_CACHE_FILE_H
+#define UTIL_CACHE_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Get the path of a file in the wlroots cache directory, $XDG_CACHE_HOME/wlroots
+ * or ~/.cache/wlroots. If create_dir is set, the missing directories are
+ * created. Returns a newly allocated string, or NULL.
+ */
+char *cache_file_get_path(const char *name, bool create_dir);
+/**
+ * Read a whole cache file. Returns NULL if the file doesn't exist, is empty
+ * or is larger than max_size.
+ */
+void *cache_file_read(const char *path, size_t max_size, size_t *size);
+
+struct cache_reader {
+	const uint8_t *data;
+	size_t size, pos;
+	bool failed; // set once a read goes past the end
+};
+
+const void *cache_read_bytes(struct cache_reader *r, size_t len);
+uint32_t cache_read_u32(struct cache_reader *r);
+uint64_t cache_read_u64(struct cache_reader *r);
+
+/**
+ * Writes a cache file atomically: the contents go to a temporary file in the
+ * same directory, which replaces the cache file once complete. Concurrent
+ * writers each get their own temporary file.
+ */
+struct cache_writer {
+	FILE *f;
+	char *path, *tmp_path;
+	bool failed;
+};
+
+bool cache_writer_open(struct cache_writer *w, const char *path);
+void cache_write_bytes(struct cache_writer *w, const void *data, size_t len);
+void cache_write_u32(struct cache_writer *w, uint32_t v);
+void cache_write_u64(struct cache_writer *w, uint64_t v);
+/**
+ * Close the temporary file and move it in place, unless a write failed.
+ * Returns false if the cache file couldn't be written.
+ */
+bool cache_writer_finish(struct cache_writer *w);
+
+#endif
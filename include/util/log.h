@@ -0,0 +1,26 @@
+#ifndef UTIL_LOG_H
+#define UTIL_LOG_H
+
+#include <wayland-util.h>
+
+/**
+ * Messages logged by a worker thread, kept until they can be logged from the
+ * thread which owns the log callback. Compositor callbacks don't need to be
+ * thread-safe this way, and the asynchronous logger keeps a single producer.
+ */
+struct log_capture {
+	struct wl_array messages; // struct log_capture_message
+};
+
+/**
+ * Capture the messages logged by the calling thread until log_capture_end()
+ * is called.
+ */
+void log_capture_begin(struct log_capture *capture);
+void log_capture_end(void);
+/**
+ * Log the captured messages from the calling thread, then free them.
+ */
+void log_capture_replay(struct log_capture *capture);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef UTIL_TRACE_H
+#define UTIL_TRACE_H
+
+#include <wlr/util/log.h>
+
+/**
+ * Tracing spans, written to the ftrace trace_marker file in the atrace format.
+ * Perfetto and trace-cmd display them as slices alongside kernel scheduling
+ * and GPU events.
+ *
+ * Spans are only compiled in with -Dtracing=true, and only recorded when
+ * WLR_TRACE=1 is set. Other builds don't evaluate the arguments.
+ */
+#if HAS_TRACING
+
+/**
+ * Open a span on the current thread. Spans nest and must be closed with
+ * trace_end() on the same thread.
+ */
+void trace_begin(const char *fmt, ...) _WLR_ATTRIB_PRINTF(1, 2);
+void trace_end(void);
+
+/**
+ * Open a span which may be closed from another callback, e.g. a page-flip
+ * handler. The span is identified by its name and cookie.
+ */
+void trace_async_begin(int cookie, const char *fmt, ...) _WLR_ATTRIB_PRINTF(2, 3);
+void trace_async_end(int cookie, const char *fmt, ...) _WLR_ATTRIB_PRINTF(2, 3);
+
+#else
+
+#define trace_begin(...) ((void)0)
+#define trace_end() ((void)0)
+#define trace_async_begin(...) ((void)0)
+#define trace_async_end(...) ((void)0)
+
+#endif
+
+#endif
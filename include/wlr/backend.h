@@ -11,6 +11,7 @@
 
 #include <wayland-server-core.h>
 #include <wlr/backend/session.h>
+#include <wlr/types/wlr_output.h>
 
 struct wlr_backend_impl;
 
@@ -64,4 +65,35 @@ clockid_t wlr_backend_get_presentation_clock(struct wlr_backend *backend);
  */
 int wlr_backend_get_drm_fd(struct wlr_backend *backend);
 
+/**
+ * A state to apply to an output, as part of a multi-output commit.
+ */
+struct wlr_backend_output_state {
+	struct wlr_output *output;
+	struct wlr_output_state base;
+};
+
+/**
+ * Check whether the states of several outputs can be applied together.
+ *
+ * The outputs must belong to the backend, or to one of its sub-backends if it's
+ * a multi-backend. Each output may only appear once.
+ */
+bool wlr_backend_test(struct wlr_backend *backend,
+	const struct wlr_backend_output_state *states, size_t states_len);
+/**
+ * Apply the states of several outputs.
+ *
+ * Outputs driven by the same backend device are committed at once when the
+ * backend supports it (e.g. a single atomic commit for all CRTCs of a DRM
+ * device, which also allows CRTCs to be reassigned between the outputs):
+ * either all of these states are applied, or none. Other outputs are
+ * committed one after the other, so a failure may leave some of them
+ * committed.
+ *
+ * The outputs must belong to the backend, as for wlr_backend_test().
+ */
+bool wlr_backend_commit(struct wlr_backend *backend,
+	const struct wlr_backend_output_state *states, size_t states_len);
+
 #endif
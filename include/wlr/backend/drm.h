@@ -51,10 +51,26 @@ uint32_t wlr_drm_connector_get_id(struct wlr_output *output);
  * Tries to open non-master DRM FD. The compositor must not call drmSetMaster()
  * on the returned FD.
  *
+ * Each call returns a new open file description owned by the caller, which
+ * must close it. Don't hand the same FD (or a dup() of it) to multiple
+ * clients: they would share DRM authentication and GEM handles. The device
+ * path is resolved once per backend, so calls only cost an open().
+ *
  * Returns a valid opened DRM FD, or -1 on error.
  */
 int wlr_drm_backend_get_non_master_fd(struct wlr_backend *backend);
 
+/**
+ * Check whether the buffer can be imported in KMS, and update
+ * wlr_buffer.scanout accordingly. This doesn't check whether a plane supports
+ * the buffer's format and modifier.
+ *
+ * The imported framebuffer is kept around, so that a later commit of the
+ * same DMA-BUF doesn't need to import it again.
+ */
+bool wlr_drm_backend_check_buffer_scanout(struct wlr_backend *backend,
+	struct wlr_buffer *buffer);
+
 /**
  * Leases the given outputs to the caller. The outputs must be from the
  * associated DRM backend.
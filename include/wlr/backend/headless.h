@@ -9,9 +9,21 @@
 #ifndef WLR_BACKEND_HEADLESS_H
 #define WLR_BACKEND_HEADLESS_H
 
+#include <time.h>
 #include <wlr/backend.h>
 #include <wlr/types/wlr_output.h>
 
+enum wlr_headless_output_clock {
+	/* Frame events are sent at the refresh rate of the output mode */
+	WLR_HEADLESS_OUTPUT_CLOCK_REFRESH,
+	/* A frame event is sent as soon as the previous commit completes, so
+	 * rendering isn't throttled */
+	WLR_HEADLESS_OUTPUT_CLOCK_FREE_RUNNING,
+	/* Frame events are only sent by wlr_headless_output_advance_clock(),
+	 * presentation times follow a virtual clock */
+	WLR_HEADLESS_OUTPUT_CLOCK_MANUAL,
+};
+
 /**
  * Creates a headless backend. A headless backend has no outputs or inputs by
  * default.
@@ -25,6 +37,19 @@ struct wlr_backend *wlr_headless_backend_create(struct wl_display *display);
 struct wlr_output *wlr_headless_add_output(struct wlr_backend *backend,
 	unsigned int width, unsigned int height);
 
+/**
+ * Set how frame events of a headless output are paced. Defaults to
+ * WLR_HEADLESS_OUTPUT_CLOCK_REFRESH.
+ */
+void wlr_headless_output_set_clock(struct wlr_output *output,
+	enum wlr_headless_output_clock clock);
+/**
+ * Advance the virtual clock of a headless output in the manual clock mode by
+ * one refresh cycle and send a frame event. Buffers committed afterwards are
+ * presented at the new virtual time, which starts at zero.
+ */
+void wlr_headless_output_advance_clock(struct wlr_output *output);
+
 bool wlr_backend_is_headless(struct wlr_backend *backend);
 bool wlr_output_is_headless(struct wlr_output *output);
 
@@ -20,6 +20,16 @@ struct wlr_backend_impl {
 	clockid_t (*get_presentation_clock)(struct wlr_backend *backend);
 	int (*get_drm_fd)(struct wlr_backend *backend);
 	uint32_t (*get_buffer_caps)(struct wlr_backend *backend);
+	/**
+	 * Test or commit the states of several outputs of this backend at once.
+	 * Either all states are applied, or none. The states only contain the
+	 * fields which need to be changed. Optional: outputs are committed one
+	 * after the other if missing.
+	 */
+	bool (*test)(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len);
+	bool (*commit)(struct wlr_backend *backend,
+		const struct wlr_backend_output_state *states, size_t states_len);
 };
 
 /**
@@ -20,9 +20,23 @@ struct wlr_backend *wlr_libinput_backend_create(struct wl_display *display,
 		struct wlr_session *session);
 /**
  * Gets the underlying struct libinput_device handle for the given input device.
+ *
+ * When WLR_LIBINPUT_THREAD is enabled, libinput is dispatched from another
+ * thread: outside of input event handlers, calls into libinput with the
+ * handle must be made between wlr_libinput_device_lock() and
+ * wlr_libinput_device_unlock().
  */
 struct libinput_device *wlr_libinput_get_device_handle(
 		struct wlr_input_device *dev);
+/**
+ * Prevents the backend from dispatching libinput until
+ * wlr_libinput_device_unlock() is called. Calls may be nested, and may be
+ * made from input event handlers, where the lock is already held.
+ *
+ * This is a no-op unless WLR_LIBINPUT_THREAD is enabled.
+ */
+void wlr_libinput_device_lock(struct wlr_input_device *dev);
+void wlr_libinput_device_unlock(struct wlr_input_device *dev);
 
 bool wlr_backend_is_libinput(struct wlr_backend *backend);
 bool wlr_input_device_is_libinput(struct wlr_input_device *device);
@@ -23,7 +23,10 @@
 	WLR_OUTPUT_STATE_TRANSFORM | \
 	WLR_OUTPUT_STATE_RENDER_FORMAT | \
 	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED | \
-	WLR_OUTPUT_STATE_SUBPIXEL)
+	WLR_OUTPUT_STATE_SUBPIXEL | \
+	WLR_OUTPUT_STATE_LAYERS | \
+	WLR_OUTPUT_STATE_IN_FENCE | \
+	WLR_OUTPUT_STATE_CONTENT_TYPE)
 
 /**
  * A backend implementation of struct wlr_output.
@@ -84,6 +87,9 @@ struct wlr_output_impl {
 	/**
 	 * Get the size suitable for the cursor buffer. Attempts to use a different
 	 * size for the cursor may fail.
+	 *
+	 * On input, width and height contain the size of the cursor image, so
+	 * that backends supporting several sizes can pick one fitting it.
 	 */
 	void (*get_cursor_size)(struct wlr_output *output, int *width, int *height);
 	/**
@@ -95,6 +101,11 @@ struct wlr_output_impl {
 	 */
 	const struct wlr_drm_format_set *(*get_primary_formats)(
 		struct wlr_output *output, uint32_t buffer_caps);
+	/**
+	 * Get timing statistics about the latest presentations.
+	 */
+	void (*get_present_stats)(struct wlr_output *output,
+		struct wlr_output_present_stats *stats);
 };
 
 /**
@@ -147,5 +158,13 @@ void wlr_output_send_frame(struct wlr_output *output);
  */
 void wlr_output_send_present(struct wlr_output *output,
 	struct wlr_output_event_present *event);
+/**
+ * Notify that the capture into a buffer committed with
+ * WLR_OUTPUT_STATE_CAPTURE is done.
+ *
+ * See struct wlr_output_capture.
+ */
+void wlr_output_send_capture_done(struct wlr_output *output,
+	struct wlr_buffer *buffer, bool success);
 
 #endif
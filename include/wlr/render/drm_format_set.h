@@ -13,7 +13,7 @@ struct wlr_drm_format {
 	size_t len;
 	// The capacity of the array; do not use.
 	size_t capacity;
-	// The actual modifiers
+	// The actual modifiers, sorted in ascending order
 	uint64_t modifiers[];
 };
 
@@ -40,7 +40,8 @@ struct wlr_drm_format_set {
 	size_t len;
 	// The capacity of the array; private to wlroots
 	size_t capacity;
-	// A pointer to an array of `struct wlr_drm_format *` of length `len`.
+	// A pointer to an array of `struct wlr_drm_format *` of length `len`,
+	// sorted by format.
 	struct wlr_drm_format **formats;
 };
 
@@ -0,0 +1,92 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_RENDER_DRM_SYNCOBJ_H
+#define WLR_RENDER_DRM_SYNCOBJ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/**
+ * A DRM synchronization object timeline.
+ *
+ * Timelines contain a sequence of points. Each point can be waited upon to
+ * be signalled, and points are signalled in ascending order.
+ */
+struct wlr_drm_syncobj_timeline {
+	int drm_fd;
+	uint32_t handle;
+
+	// private state
+
+	size_t n_refs;
+};
+
+/**
+ * Waits for a timeline point without blocking, see
+ * wlr_drm_syncobj_timeline_waiter_init().
+ */
+struct wlr_drm_syncobj_timeline_waiter {
+	struct {
+		struct wl_signal ready;
+	} events;
+
+	// private state
+
+	int ev_fd;
+	struct wl_event_source *event_source;
+};
+
+/**
+ * Import a timeline from a drm_syncobj FD.
+ */
+struct wlr_drm_syncobj_timeline *wlr_drm_syncobj_timeline_import(int drm_fd,
+	int drm_syncobj_fd);
+/**
+ * Reference a timeline.
+ */
+struct wlr_drm_syncobj_timeline *wlr_drm_syncobj_timeline_ref(
+	struct wlr_drm_syncobj_timeline *timeline);
+/**
+ * Unreference a timeline. The timeline is destroyed once no more references
+ * remain.
+ */
+void wlr_drm_syncobj_timeline_unref(struct wlr_drm_syncobj_timeline *timeline);
+/**
+ * Signal a timeline point once the fence of a sync_file is signalled. The
+ * sync_file FD is not consumed.
+ */
+bool wlr_drm_syncobj_timeline_import_sync_file(
+	struct wlr_drm_syncobj_timeline *timeline, uint64_t dst_point,
+	int sync_file_fd);
+/**
+ * Signal a timeline point immediately.
+ */
+bool wlr_drm_syncobj_timeline_signal(struct wlr_drm_syncobj_timeline *timeline,
+	uint64_t point);
+/**
+ * Check whether waiters are supported on a DRM device. They need
+ * DRM_IOCTL_SYNCOBJ_EVENTFD, which was added in Linux 6.6, after timelines.
+ */
+bool wlr_drm_syncobj_timeline_waiter_supported(int drm_fd);
+/**
+ * Start waiting for a timeline point to be signalled. The ready event is
+ * emitted from the event loop once it is.
+ */
+bool wlr_drm_syncobj_timeline_waiter_init(
+	struct wlr_drm_syncobj_timeline_waiter *waiter,
+	struct wlr_drm_syncobj_timeline *timeline, uint64_t point,
+	struct wl_event_loop *loop);
+/**
+ * Stop waiting for a timeline point.
+ */
+void wlr_drm_syncobj_timeline_waiter_finish(
+	struct wlr_drm_syncobj_timeline_waiter *waiter);
+
+#endif
@@ -28,6 +28,7 @@ GLuint wlr_gles2_renderer_get_current_fbo(struct wlr_renderer *wlr_renderer);
 
 struct wlr_gles2_texture_attribs {
 	GLenum target; /* either GL_TEXTURE_2D or GL_TEXTURE_EXTERNAL_OES */
+	/* only the luma plane for YUV DMA-BUFs imported plane by plane */
 	GLuint tex;
 
 	bool has_alpha;
@@ -32,6 +32,9 @@ struct wlr_renderer_impl {
 		const float matrix[static 9], float alpha);
 	void (*render_quad_with_matrix)(struct wlr_renderer *renderer,
 		const float color[static 4], const float matrix[static 9]);
+	// Optional, falls back to one scissored draw per clip rectangle
+	bool (*submit_ops)(struct wlr_renderer *renderer,
+		const struct wlr_render_op *ops, size_t ops_len);
 	const uint32_t *(*get_shm_texture_formats)(
 		struct wlr_renderer *renderer, size_t *len);
 	const struct wlr_drm_format_set *(*get_dmabuf_texture_formats)(
@@ -48,17 +51,69 @@ struct wlr_renderer_impl {
 	uint32_t (*get_render_buffer_caps)(struct wlr_renderer *renderer);
 	struct wlr_texture *(*texture_from_buffer)(struct wlr_renderer *renderer,
 		struct wlr_buffer *buffer);
+	int (*export_sync_file)(struct wlr_renderer *renderer);
+	struct wlr_render_timer *(*render_timer_create)(
+		struct wlr_renderer *renderer);
+	// Starts reading pixels of the current buffer into a staging area
+	struct wlr_render_readback *(*read_pixels_async)(
+		struct wlr_renderer *renderer, uint32_t fmt, uint32_t width,
+		uint32_t height, uint32_t src_x, uint32_t src_y);
+	// Optional, color conversion into planar YUV DMA-BUFs
+	const uint32_t *(*get_yuv_render_formats)(
+		struct wlr_renderer *renderer, size_t *len);
+	bool (*blit_to_yuv)(struct wlr_renderer *renderer,
+		struct wlr_texture *src, struct wlr_buffer *dst);
+	// Optional, drops caches, see wlr_renderer_trim()
+	void (*trim)(struct wlr_renderer *renderer, enum wlr_trim_level level);
 };
 
 void wlr_renderer_init(struct wlr_renderer *renderer,
 	const struct wlr_renderer_impl *impl);
 
+struct wlr_render_timer_impl {
+	int64_t (*get_duration_ns)(struct wlr_render_timer *timer);
+	void (*destroy)(struct wlr_render_timer *timer);
+};
+
+struct wlr_render_timer {
+	const struct wlr_render_timer_impl *impl;
+	struct wlr_renderer *renderer;
+};
+
+void wlr_render_timer_init(struct wlr_render_timer *timer,
+	const struct wlr_render_timer_impl *impl, struct wlr_renderer *renderer);
+
+struct wlr_render_readback_impl {
+	// Returns a sync_file FD which is signalled once the pixels can be copied
+	// without blocking, or -1. The readback keeps ownership of the FD.
+	int (*get_sync_file)(struct wlr_render_readback *readback);
+	bool (*get_pixels)(struct wlr_render_readback *readback, uint32_t *flags,
+		uint32_t stride, uint32_t dst_x, uint32_t dst_y, void *data);
+	void (*destroy)(struct wlr_render_readback *readback);
+};
+
+struct wlr_render_readback {
+	const struct wlr_render_readback_impl *impl;
+	struct wlr_renderer *renderer;
+
+	// private state
+
+	struct wl_event_source *event_source; // while pending
+	wlr_render_readback_func_t done;
+	void *data;
+};
+
+void wlr_render_readback_init(struct wlr_render_readback *readback,
+	const struct wlr_render_readback_impl *impl, struct wlr_renderer *renderer);
+
 struct wlr_texture_impl {
 	bool (*is_opaque)(struct wlr_texture *texture);
 	bool (*write_pixels)(struct wlr_texture *texture,
 		uint32_t stride, uint32_t width, uint32_t height,
 		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
 		const void *data);
+	bool (*write_pixels_rects)(struct wlr_texture *texture, uint32_t stride,
+		const pixman_box32_t *rects, size_t rects_len, const void *data);
 	void (*destroy)(struct wlr_texture *texture);
 };
 
@@ -9,10 +9,13 @@
 #ifndef WLR_RENDER_WLR_RENDERER_H
 #define WLR_RENDER_WLR_RENDERER_H
 
+#include <pixman.h>
 #include <stdint.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
 #include <wlr/render/wlr_texture.h>
+#include <wlr/util/box.h>
+#include <wlr/util/trim.h>
 
 enum wlr_renderer_read_pixels_flags {
 	WLR_RENDERER_READ_PIXELS_Y_INVERT = 1,
@@ -21,18 +24,27 @@ enum wlr_renderer_read_pixels_flags {
 struct wlr_renderer_impl;
 struct wlr_drm_format_set;
 struct wlr_buffer;
-struct wlr_box;
-struct wlr_fbox;
+struct wlr_render_timer;
 
 struct wlr_renderer {
 	const struct wlr_renderer_impl *impl;
 
 	bool rendering;
 	bool rendering_with_buffer;
+	// measures the next or current rendering pass, see wlr_renderer_set_timer()
+	struct wlr_render_timer *timer;
 
 	struct {
 		struct wl_signal destroy;
 	} events;
+
+	// private state
+
+	// Released mutable textures, see renderer_texture_pool_acquire()
+	struct wl_list texture_pool; // wlr_pooled_texture.link
+	size_t texture_pool_len;
+	// Rendered hardware cursor buffers of all outputs using this renderer
+	struct wl_list cursor_buffers; // output_cursor_cache_entry.renderer_link
 };
 
 struct wlr_renderer *wlr_renderer_autocreate(struct wlr_backend *backend);
@@ -75,12 +87,78 @@ void wlr_render_rect(struct wlr_renderer *r, const struct wlr_box *box,
  */
 void wlr_render_quad_with_matrix(struct wlr_renderer *r,
 	const float color[static 4], const float matrix[static 9]);
+
+enum wlr_render_op_type {
+	WLR_RENDER_OP_CLEAR,
+	WLR_RENDER_OP_TEXTURE,
+	WLR_RENDER_OP_QUAD,
+	WLR_RENDER_OP_FILL,
+};
+
+/**
+ * A draw operation, see wlr_renderer_submit_ops(). Matrices are the same as
+ * the ones passed to wlr_render_subtexture_with_matrix() and
+ * wlr_render_quad_with_matrix().
+ */
+struct wlr_render_op {
+	enum wlr_render_op_type type;
+	// Part of the buffer the operation is restricted to, in buffer-local
+	// coordinates. NULL leaves the operation unclipped.
+	const pixman_region32_t *clip;
+
+	union {
+		struct {
+			float color[4];
+		} clear;
+		struct {
+			struct wlr_texture *texture;
+			struct wlr_fbox src_box;
+			float matrix[9];
+			float alpha;
+		} texture;
+		struct {
+			float color[4];
+			float matrix[9];
+		} quad;
+		// Blends the color over the whole clip region, which is required.
+		// Cheaper than covering the region with quads.
+		struct {
+			float color[4];
+		} fill;
+	};
+};
+
+/**
+ * Draws a list of operations, in order. The result is the same as drawing
+ * each operation once per rectangle of its clip region, with the scissor box
+ * set to that rectangle. Renderers may batch the operations and skip the ones
+ * which don't affect the result.
+ *
+ * The scissor box is disabled afterwards. Returns false if an operation
+ * failed, the other ones are still drawn.
+ */
+bool wlr_renderer_submit_ops(struct wlr_renderer *r,
+	const struct wlr_render_op *ops, size_t ops_len);
 /**
  * Get the shared-memory formats supporting import usage. Buffers allocated
  * with a format from this list may be imported via wlr_texture_from_pixels().
  */
 const uint32_t *wlr_renderer_get_shm_texture_formats(
 	struct wlr_renderer *r, size_t *len);
+/**
+ * Get the planar YUV DMA-BUF formats which can be written with
+ * wlr_renderer_blit_to_yuv(). Returns NULL if there are none.
+ */
+const uint32_t *wlr_renderer_get_yuv_render_formats(
+	struct wlr_renderer *r, size_t *len);
+/**
+ * Converts the texture into a planar YUV DMA-BUF (BT.709, limited range),
+ * scaled to the size of the buffer. The buffer format must be one of
+ * wlr_renderer_get_yuv_render_formats() with a linear layout. Must not be
+ * called between wlr_renderer_begin() and wlr_renderer_end().
+ */
+bool wlr_renderer_blit_to_yuv(struct wlr_renderer *r,
+	struct wlr_texture *src, struct wlr_buffer *dst);
 /**
  * Get the DMA-BUF formats supporting sampling usage. Buffers allocated with
  * a format from this list may be imported via wlr_texture_from_dmabuf().
@@ -98,6 +176,40 @@ bool wlr_renderer_read_pixels(struct wlr_renderer *r, uint32_t fmt,
 	uint32_t *flags, uint32_t stride, uint32_t width, uint32_t height,
 	uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y, void *data);
 
+struct wlr_render_readback;
+
+typedef void (*wlr_render_readback_func_t)(struct wlr_render_readback *readback,
+	void *data);
+
+/**
+ * Starts reading out pixels of the currently bound surface without waiting
+ * for the GPU. `done` is called from `loop` once the pixels are available,
+ * at the earliest in a later event loop iteration. They can then be fetched
+ * with wlr_render_readback_get_pixels().
+ *
+ * Renderers without support for asynchronous read-back read the pixels
+ * synchronously, `done` is still called later.
+ *
+ * Returns NULL on failure.
+ */
+struct wlr_render_readback *wlr_renderer_read_pixels_async(
+	struct wlr_renderer *r, struct wl_event_loop *loop, uint32_t fmt,
+	uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+	wlr_render_readback_func_t done, void *data);
+/**
+ * Copies the pixels of a finished read-back into `data`, with the same
+ * semantics as wlr_renderer_read_pixels(). May only be called once the
+ * `done` callback has been invoked.
+ */
+bool wlr_render_readback_get_pixels(struct wlr_render_readback *readback,
+	uint32_t *flags, uint32_t stride, uint32_t dst_x, uint32_t dst_y,
+	void *data);
+/**
+ * Destroys the read-back. If it is still pending, it is cancelled and the
+ * `done` callback won't be called.
+ */
+void wlr_render_readback_destroy(struct wlr_render_readback *readback);
+
 /**
  * Initializes wl_shm, linux-dmabuf and other buffer factory protocols.
  *
@@ -119,6 +231,45 @@ bool wlr_renderer_init_wl_shm(struct wlr_renderer *r,
  */
 int wlr_renderer_get_drm_fd(struct wlr_renderer *r);
 
+/**
+ * Creates a timer measuring how long the renderer takes to execute rendering
+ * passes. GPU renderers measure the time spent on the GPU, the pixman renderer
+ * measures CPU time.
+ *
+ * Returns NULL if the renderer doesn't support timers. Timers must be
+ * destroyed before the renderer.
+ */
+struct wlr_render_timer *wlr_render_timer_create(struct wlr_renderer *r);
+/**
+ * Measures the next rendering pass, from wlr_renderer_begin() to
+ * wlr_renderer_end(), with the timer. Must not be called while rendering.
+ * The timer is detached again by wlr_renderer_end(). Pass NULL to detach the
+ * timer before the pass has begun.
+ */
+void wlr_renderer_set_timer(struct wlr_renderer *r,
+	struct wlr_render_timer *timer);
+/**
+ * Get the duration of the last pass measured with the timer, in nanoseconds.
+ *
+ * GPU renderers only know the duration once the GPU has finished executing
+ * the pass. Until then, or if the timer hasn't measured any pass yet, -1 is
+ * returned. Results are not blocked on, so this can be polled at any time
+ * after wlr_renderer_end(), e.g. on the next frame.
+ */
+int64_t wlr_render_timer_get_duration_ns(struct wlr_render_timer *timer);
+/**
+ * Destroys the timer. It must not be attached to a renderer.
+ */
+void wlr_render_timer_destroy(struct wlr_render_timer *timer);
+
+/**
+ * Release memory held by the renderer's caches, e.g. in response to memory
+ * pressure. Only reconstructible state is dropped, so this doesn't cause any
+ * visible artifacts, but the next frames may take longer to render. Must not
+ * be called while rendering.
+ */
+void wlr_renderer_trim(struct wlr_renderer *r, enum wlr_trim_level level);
+
 /**
  * Destroys the renderer.
  *
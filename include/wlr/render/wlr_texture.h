@@ -9,6 +9,7 @@
 #ifndef WLR_RENDER_WLR_TEXTURE_H
 #define WLR_RENDER_WLR_TEXTURE_H
 
+#include <pixman.h>
 #include <stdint.h>
 #include <wayland-server-core.h>
 #include <wlr/render/dmabuf.h>
@@ -50,6 +51,18 @@ bool wlr_texture_write_pixels(struct wlr_texture *texture,
 	uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
 	const void *data);
 
+/**
+ * Update rectangles of the texture with raw pixels. The data covers the whole
+ * texture, and each rectangle is read at the same position it's written to.
+ * Rectangles may overlap. The same requirements as wlr_texture_write_pixels()
+ * apply.
+ *
+ * Renderers may submit all rectangles in a single operation.
+ */
+bool wlr_texture_write_pixels_rects(struct wlr_texture *texture,
+	uint32_t stride, const pixman_box32_t *rects, size_t rects_len,
+	const void *data);
+
 /**
  * Destroys the texture.
  */
@@ -0,0 +1,82 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_RENDER_WLR_TEXTURE_ATLAS_H
+#define WLR_RENDER_WLR_TEXTURE_ATLAS_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/util/box.h>
+
+struct wlr_buffer;
+struct wlr_renderer;
+struct wlr_texture;
+struct wlr_texture_atlas_page;
+struct wlr_texture_atlas_shelf;
+
+/**
+ * Packs many small buffers into a few shared textures, so that drawing them
+ * doesn't require binding a texture for each one. This suits compositor-side
+ * buffers such as icons, text labels and decorations; client buffers should be
+ * imported as usual.
+ *
+ * Regions hold a copy of the buffer contents taken when they're added. Each
+ * region is surrounded by a transparent gutter so that linear filtering
+ * doesn't sample its neighbours.
+ */
+struct wlr_texture_atlas {
+	struct wlr_renderer *renderer;
+	uint32_t format; // DRM format of the pages and of accepted buffers
+	int page_size; // width and height of the page textures
+	int max_region_size; // buffers larger than this aren't accepted
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_list pages; // wlr_texture_atlas_page.link
+	size_t bpp;
+	bool destroyed; // kept until the last region is destroyed
+};
+
+struct wlr_texture_atlas_region {
+	struct wlr_texture *texture; // shared page texture
+	struct wlr_box box; // position of the buffer in the texture
+
+	// private state
+
+	struct wlr_texture_atlas_page *page;
+	struct wlr_texture_atlas_shelf *shelf;
+};
+
+/**
+ * Create an atlas allocating square pages of the given size and DRM format,
+ * which must be usable with wlr_texture_from_pixels(). The atlas must be
+ * destroyed before the renderer.
+ */
+struct wlr_texture_atlas *wlr_texture_atlas_create(
+	struct wlr_renderer *renderer, uint32_t format, int page_size);
+/**
+ * Destroy the atlas. Its memory is kept until all regions are destroyed, but
+ * no new regions can be added.
+ */
+void wlr_texture_atlas_destroy(struct wlr_texture_atlas *atlas);
+
+/**
+ * Copy the contents of the buffer into the atlas. Returns NULL if the buffer
+ * doesn't allow data pointer access, doesn't have the atlas' format, is larger
+ * than max_region_size, or if no page has room and a new one can't be
+ * allocated.
+ */
+struct wlr_texture_atlas_region *wlr_texture_atlas_add_buffer(
+	struct wlr_texture_atlas *atlas, struct wlr_buffer *buffer);
+void wlr_texture_atlas_region_destroy(struct wlr_texture_atlas_region *region);
+
+#endif
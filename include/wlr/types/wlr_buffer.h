@@ -36,6 +36,15 @@ enum wlr_buffer_cap {
 	WLR_BUFFER_CAP_SHM = 1 << 2,
 };
 
+/**
+ * Whether a buffer can be directly scanned out by the display hardware.
+ */
+enum wlr_buffer_scanout {
+	WLR_BUFFER_SCANOUT_UNKNOWN,
+	WLR_BUFFER_SCANOUT_CAPABLE,
+	WLR_BUFFER_SCANOUT_INCAPABLE,
+};
+
 /**
  * A buffer containing pixel data.
  *
@@ -53,6 +62,9 @@ struct wlr_buffer {
 	size_t n_locks;
 	bool accessing_data_ptr;
 
+	// Set by the DRM backend once it has tried to import the buffer in KMS
+	enum wlr_buffer_scanout scanout;
+
 	struct {
 		struct wl_signal destroy;
 		struct wl_signal release;
@@ -140,7 +152,9 @@ struct wlr_client_buffer {
 
 	/**
 	 * The buffer's texture, if any. A buffer will not have a texture if the
-	 * client destroys the buffer before it has been released.
+	 * client destroys the buffer before it has been released. Single-pixel
+	 * buffers don't have a texture until it is read with
+	 * wlr_surface_get_texture().
 	 */
 	struct wlr_texture *texture;
 	/**
@@ -154,6 +168,19 @@ struct wlr_client_buffer {
 
 	// If the client buffer has been created from a wl_shm buffer
 	uint32_t shm_source_format;
+
+	// The texture goes back to the renderer's pool, NULL if destroyed
+	struct wlr_renderer *renderer;
+	struct wl_listener renderer_destroy;
+
+	// Buffer whose damage hasn't been uploaded to the texture yet, see
+	// client_buffer_defer_damage()
+	struct wlr_buffer *pending_source; // locked
+	pixman_region32_t pending_damage;
+
+	// Premultiplied color of single-pixel buffers
+	bool has_color;
+	float color[4];
 };
 
 /**
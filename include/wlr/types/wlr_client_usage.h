@@ -0,0 +1,70 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_CLIENT_USAGE_H
+#define WLR_TYPES_WLR_CLIENT_USAGE_H
+
+#include <stddef.h>
+#include <wayland-server-core.h>
+
+struct wlr_renderer;
+
+/**
+ * Resources held by a client.
+ *
+ * Buffers are accounted from the moment they are first used by the compositor
+ * (e.g. attached to a surface) until they are destroyed, which may be after
+ * the client has destroyed the wl_buffer. Sizes are estimated from the buffer
+ * dimensions and strides.
+ *
+ * Textures only include those of struct wlr_client_buffer. Their size is the
+ * memory allocated by the renderer to hold a copy of the pixels: textures
+ * sampling a DMA-BUF directly are counted but don't add any bytes.
+ */
+struct wlr_client_usage {
+	struct wl_client *client;
+
+	size_t buffers; // all buffers, including DMA-BUFs
+	size_t buffer_bytes;
+	size_t dmabuf_buffers;
+	size_t dmabuf_bytes;
+	size_t shm_pools; // only for the wl_shm global created by wlroots
+	size_t shm_pool_bytes;
+	size_t textures;
+	size_t texture_bytes;
+
+	struct {
+		struct wl_signal update;
+		struct wl_signal destroy;
+	} events;
+
+	void *data;
+
+	// private state
+
+	struct wl_list entries; // client_usage_entry.link
+	struct wl_listener client_destroy;
+};
+
+/**
+ * Get the resource usage of a client. The usage is destroyed along with the
+ * client.
+ *
+ * The update event is emitted whenever one of the totals changes, so that the
+ * compositor can enforce limits, e.g. by disconnecting the client.
+ */
+struct wlr_client_usage *wlr_client_usage_get(struct wl_client *client);
+
+/**
+ * Get the number and estimated size of the textures created by a renderer
+ * for a client's buffers.
+ */
+void wlr_client_usage_get_renderer_textures(struct wlr_client_usage *usage,
+	struct wlr_renderer *renderer, size_t *textures, size_t *bytes);
+
+#endif
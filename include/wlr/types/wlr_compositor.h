@@ -28,6 +28,7 @@ enum wlr_surface_state_field {
 	WLR_SURFACE_STATE_SCALE = 1 << 6,
 	WLR_SURFACE_STATE_FRAME_CALLBACK_LIST = 1 << 7,
 	WLR_SURFACE_STATE_VIEWPORT = 1 << 8,
+	WLR_SURFACE_STATE_CONTENT_TYPE = 1 << 9,
 };
 
 struct wlr_surface_state {
@@ -65,6 +66,22 @@ struct wlr_surface_state {
 		int dst_width, dst_height; // in surface-local coordinates
 	} viewport;
 
+	// enum wp_content_type_v1_type, set with content-type-v1
+	uint32_t content_type;
+
+	/**
+	 * Explicit synchronization points set with linux-drm-syncobj-v1. The
+	 * buffer can be read once the acquire point is signalled, and the
+	 * release point must be signalled once the buffer isn't read anymore.
+	 * The timelines are NULL if the client uses implicit synchronization.
+	 */
+	struct {
+		struct wlr_drm_syncobj_timeline *acquire_timeline;
+		uint64_t acquire_point;
+		struct wlr_drm_syncobj_timeline *release_timeline;
+		uint64_t release_point;
+	} syncobj;
+
 	// Number of locks that prevent this surface state from being committed.
 	size_t cached_state_locks;
 	struct wl_list cached_state_link; // wlr_surface.cached
@@ -86,6 +103,33 @@ struct wlr_surface_output {
 	struct wl_listener destroy;
 };
 
+/**
+ * Commit statistics, accumulated since the surface or the client was created.
+ * They can be used to find clients which burn compositor time.
+ */
+struct wlr_surface_stats {
+	uint64_t commits;
+	uint64_t buffers; // commits attaching a non-NULL buffer
+	uint64_t damage_area; // in buffer-local pixels
+	// Time spent applying commits, including the commit handlers and the
+	// commits of synchronized subsurfaces applied along
+	int64_t commit_time_ns;
+};
+
+/**
+ * Commit statistics of all surfaces of a client.
+ */
+struct wlr_compositor_client_stats {
+	struct wl_client *client;
+	struct wlr_surface_stats stats;
+	struct wl_list link; // wlr_compositor.client_stats
+
+	// private state
+
+	size_t n_refs; // the client and its surfaces
+	struct wl_listener client_destroy;
+};
+
 struct wlr_surface {
 	struct wl_resource *resource;
 	struct wlr_renderer *renderer;
@@ -128,6 +172,26 @@ struct wlr_surface {
 	 * the surface bounds.
 	 */
 	pixman_region32_t input_region;
+	/**
+	 * Maximum number of rectangles of the damage regions, 0 if unlimited.
+	 * Past it, damage collapses to its extents. Defaults to
+	 * `wlr_compositor.max_damage_rects`.
+	 */
+	size_t max_damage_rects;
+	/**
+	 * Number of times damage of this surface has been collapsed because it
+	 * exceeded `max_damage_rects`. Helps spotting misbehaving clients.
+	 */
+	size_t damage_overflows;
+	/**
+	 * If true, the damage of wl_shm buffers is only uploaded when the texture
+	 * is read with wlr_surface_get_texture() or rendered by the scene-graph,
+	 * so that hidden surfaces don't cost GPU time. The texture of
+	 * `buffer` must not be accessed directly. Defaults to
+	 * `wlr_compositor.lazy_texture_upload`.
+	 */
+	bool lazy_texture_upload;
+	struct wlr_surface_stats stats;
 	/**
 	 * `current` contains the current, committed surface state. `pending`
 	 * accumulates state changes from the client between commits and shouldn't
@@ -144,6 +208,11 @@ struct wlr_surface {
 		struct wl_signal client_commit;
 		struct wl_signal commit;
 		struct wl_signal new_subsurface;
+		/**
+		 * Emitted before commit when the committed state adds, moves or
+		 * reorders sub-surfaces.
+		 */
+		struct wl_signal subsurfaces_changed;
 		struct wl_signal destroy;
 	} events;
 
@@ -156,6 +225,26 @@ struct wlr_surface {
 
 	struct wl_listener renderer_destroy;
 
+	struct wlr_compositor_client_stats *client_stats;
+
+	// Previous client buffer, kept around so that its texture can be updated
+	// instead of creating a new one when the current one is still in use.
+	// Only kept for buffers with a mutable texture.
+	struct wlr_client_buffer *spare_buffer;
+	// Damage since the spare buffer's contents, in buffer-local coordinates
+	pixman_region32_t spare_damage;
+
+	// Released cached states, re-used by later cached commits
+	struct wl_list cached_pool; // wlr_surface_state.cached_state_link
+	size_t cached_pool_len;
+	// Deepest cache observed, bounds the number of pooled states
+	size_t cached_max_depth;
+
+	// Mapped surfaces of the subsurface tree in rendering order, including
+	// this surface, re-built lazily when dirty
+	struct wl_array subsurface_tree; // struct wlr_surface_tree_entry
+	bool subsurface_tree_dirty;
+
 	struct {
 		int32_t scale;
 		enum wl_output_transform transform;
@@ -164,12 +253,25 @@ struct wlr_surface {
 	} previous;
 };
 
+struct wlr_surface_tree_entry {
+	struct wlr_surface *surface;
+	int x, y; // relative to the surface owning the tree
+};
+
 struct wlr_renderer;
 
 struct wlr_compositor {
 	struct wl_global *global;
 	struct wlr_renderer *renderer;
 
+	// Initial wlr_surface.max_damage_rects of new surfaces
+	size_t max_damage_rects;
+	// Initial wlr_surface.lazy_texture_upload of new surfaces, false by default
+	bool lazy_texture_upload;
+
+	// Clients which have created surfaces, until they disconnect
+	struct wl_list client_stats; // wlr_compositor_client_stats.link
+
 	struct wl_listener display_destroy;
 
 	struct {
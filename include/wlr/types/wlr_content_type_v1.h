@@ -0,0 +1,49 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_CONTENT_TYPE_V1_H
+#define WLR_TYPES_WLR_CONTENT_TYPE_V1_H
+
+#include <wayland-server-core.h>
+#include "content-type-v1-protocol.h"
+
+struct wlr_surface;
+
+/**
+ * Implementation for the content-type-v1 protocol.
+ *
+ * Clients describe the kind of content their surfaces display: photos, video
+ * or games. The content type is double-buffered surface state.
+ *
+ * The scene-graph forwards the content type of the buffer covering an output
+ * to the output, see wlr_output_state_set_content_type(). Compositors can
+ * read wlr_output.content_type to pick a presentation policy, or let the
+ * scene-graph apply its own, see wlr_scene_output_set_content_type_policy().
+ */
+struct wlr_content_type_manager_v1 {
+	struct wl_global *global;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_listener display_destroy;
+};
+
+struct wlr_content_type_manager_v1 *wlr_content_type_manager_v1_create(
+	struct wl_display *display, uint32_t version);
+
+/**
+ * Get the current content type of a surface.
+ */
+enum wp_content_type_v1_type wlr_surface_get_content_type_v1(
+	struct wlr_surface *surface);
+
+#endif
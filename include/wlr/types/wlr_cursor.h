@@ -28,6 +28,7 @@ struct wlr_input_device;
 
 struct wlr_box;
 struct wlr_cursor_state;
+struct wlr_xcursor;
 
 struct wlr_cursor {
 	struct wlr_cursor_state *state;
@@ -154,6 +155,26 @@ void wlr_cursor_set_image(struct wlr_cursor *cur, const uint8_t *pixels,
 void wlr_cursor_set_surface(struct wlr_cursor *cur, struct wlr_surface *surface,
 	int32_t hotspot_x, int32_t hotspot_y);
 
+/**
+ * Set the cursor image from an XCursor. If scale isn't zero, the image is only
+ * set on outputs having the provided scale.
+ *
+ * Animated XCursors are rendered once into hardware cursor buffers, then
+ * advanced on the output frame events while the cursor is visible on the
+ * output. Setting the same XCursor again keeps the animation running. The
+ * XCursor must stay alive until another cursor image is set.
+ */
+void wlr_cursor_set_xcursor(struct wlr_cursor *cur,
+	struct wlr_xcursor *xcursor, float scale);
+
+/**
+ * Draw a drag-and-drop icon surface along with the cursor image, on the
+ * cursor plane when possible, see wlr_output_cursor_set_drag_icon(). The
+ * compositor must not draw the icon itself. Pass NULL once the drag ends.
+ */
+void wlr_cursor_set_drag_icon(struct wlr_cursor *cur,
+	struct wlr_surface *icon);
+
 /**
  * Attaches this input device to this cursor. The input device must be one of:
  *
@@ -0,0 +1,105 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_DAMAGE_RING_H
+#define WLR_TYPES_WLR_DAMAGE_RING_H
+
+#include <pixman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/**
+ * Number of buffers whose damage is tracked, enough for the deepest output
+ * swapchain.
+ */
+#define WLR_DAMAGE_RING_BUFFERS_LEN 4
+
+struct wlr_box;
+struct wlr_buffer;
+
+struct wlr_damage_ring_buffer {
+	struct wlr_buffer *buffer; // NULL if unused
+	// Damage accumulated since the buffer was last rendered
+	pixman_region32_t damage;
+	uint64_t last_used;
+
+	struct wl_listener destroy;
+};
+
+/**
+ * Tracks damage for a set of buffers rendered in turn, e.g. an output's
+ * swapchain buffers.
+ *
+ * Unlike buffer ages, which only say how many frames ago a buffer was
+ * rendered, the damage of each buffer is tracked individually. The damage to
+ * repaint a buffer is always exact, however long it has been since it was last
+ * rendered, as long as it's one of the last WLR_DAMAGE_RING_BUFFERS_LEN
+ * rendered buffers.
+ *
+ * It doesn't depend on wlr_output, and can be used by compositors which don't
+ * use the scene-graph.
+ */
+struct wlr_damage_ring {
+	int32_t width, height;
+
+	// Difference between the current frame and the previous one
+	pixman_region32_t current;
+
+	// private state
+
+	struct wlr_damage_ring_buffer buffers[WLR_DAMAGE_RING_BUFFERS_LEN];
+	uint64_t counter;
+};
+
+void wlr_damage_ring_init(struct wlr_damage_ring *ring);
+void wlr_damage_ring_finish(struct wlr_damage_ring *ring);
+/**
+ * Set ring bounds and damage the ring fully.
+ *
+ * Next time damage will be added, it will be cropped to the ring bounds.
+ * If at least one of the dimensions is 0, bounds are removed.
+ *
+ * By default, a damage ring doesn't have bounds.
+ */
+void wlr_damage_ring_set_bounds(struct wlr_damage_ring *ring,
+	int32_t width, int32_t height);
+/**
+ * Add a region to the current damage.
+ *
+ * Returns true if the region intersects the ring bounds, false otherwise.
+ */
+bool wlr_damage_ring_add(struct wlr_damage_ring *ring,
+	const pixman_region32_t *damage);
+/**
+ * Add a box to the current damage.
+ *
+ * Returns true if the box intersects the ring bounds, false otherwise.
+ */
+bool wlr_damage_ring_add_box(struct wlr_damage_ring *ring,
+	const struct wlr_box *box);
+/**
+ * Damage the ring fully.
+ */
+void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring);
+/**
+ * Get the region which needs to be repainted to bring the contents of a buffer
+ * up to date with the current frame. Buffers which haven't been rendered
+ * before, or not recently enough, need to be fully repainted.
+ */
+void wlr_damage_ring_get_buffer_damage(struct wlr_damage_ring *ring,
+	struct wlr_buffer *buffer, pixman_region32_t *damage);
+/**
+ * Mark the current frame as rendered into a buffer. Should be called once the
+ * frame has been submitted. The current damage is moved to the other buffers
+ * and cleared.
+ */
+void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
+	struct wlr_buffer *buffer);
+
+#endif
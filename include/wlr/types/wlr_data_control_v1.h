@@ -22,6 +22,10 @@ struct wlr_data_control_manager_v1 {
 	} events;
 
 	struct wl_listener display_destroy;
+
+	// private state
+
+	struct wl_list selection_caches; // selection_cache.link
 };
 
 struct wlr_data_control_device_v1 {
@@ -9,6 +9,7 @@
 #ifndef WLR_TYPES_WLR_DATA_DEVICE_H
 #define WLR_TYPES_WLR_DATA_DEVICE_H
 
+#include <sys/types.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_seat.h>
 
@@ -49,6 +50,12 @@ struct wlr_data_offer {
 	enum wl_data_device_manager_dnd_action preferred_action;
 	bool in_ask;
 
+	// private state
+
+	// the offer was introduced through this wl_data_device, only compared
+	// against live resources as it may have been destroyed since
+	struct wl_resource *device_resource;
+
 	struct wl_listener source_destroy;
 };
 
@@ -264,4 +271,76 @@ void wlr_data_source_dnd_finish(struct wlr_data_source *source);
 void wlr_data_source_dnd_action(struct wlr_data_source *source,
 	enum wl_data_device_manager_dnd_action action);
 
+/**
+ * Provides the data of a wlr_data_transfer created with
+ * wlr_data_transfer_create().
+ */
+struct wlr_data_transfer_provider {
+	/**
+	 * Copy up to len bytes of data into buf. Returns the number of bytes
+	 * copied, 0 once all of the data has been provided, or -1 on error.
+	 * Only called when the previous data has been written out.
+	 */
+	ssize_t (*read)(void *data, void *buf, size_t len);
+	/**
+	 * Called once when the transfer is over, unless it's destroyed with
+	 * wlr_data_transfer_destroy() first. Optional.
+	 */
+	void (*finish)(void *data, bool success);
+};
+
+/**
+ * A non-blocking transfer of data to a file descriptor, typically the one
+ * passed to a compositor-side wlr_data_source's send function. Data is only
+ * written when the file descriptor is writable, and at most one chunk of data
+ * is buffered at a time, so a slow reader never blocks the event loop nor
+ * makes the compositor hold large amounts of data.
+ *
+ * The transfer closes the file descriptor and destroys itself once it is
+ * over, or when the event loop is destroyed.
+ */
+struct wlr_data_transfer {
+	int fd;
+	uint64_t transferred; // in bytes
+
+	// private state
+
+	const struct wlr_data_transfer_provider *provider;
+	void *data;
+
+	int src_fd; // -1 if using the provider
+	off_t src_offset, src_size;
+	bool splice; // false once splice() failed for this pair of fds
+
+	char *buf;
+	size_t buf_start, buf_end;
+	bool eof;
+
+	struct wl_event_source *event_source;
+	struct wl_listener event_loop_destroy;
+};
+
+/**
+ * Start transferring the data returned by the provider to fd. The transfer
+ * takes ownership of fd.
+ */
+struct wlr_data_transfer *wlr_data_transfer_create(
+	struct wl_event_loop *loop, int fd,
+	const struct wlr_data_transfer_provider *provider, void *data);
+/**
+ * Start transferring the whole contents of src_fd, e.g. a memfd, to fd. The
+ * data is moved with splice() when fd is a pipe, without copying it through
+ * userspace. The transfer takes ownership of fd, src_fd is duplicated and can
+ * be re-used for other transfers. Only the finish callback of the provider is
+ * used, the provider can be NULL.
+ */
+struct wlr_data_transfer *wlr_data_transfer_create_from_fd(
+	struct wl_event_loop *loop, int fd, int src_fd,
+	const struct wlr_data_transfer_provider *provider, void *data);
+/**
+ * Abort the transfer, closing its file descriptor. The finish callback isn't
+ * called.
+ */
+void wlr_data_transfer_destroy(struct wlr_data_transfer *transfer);
+
 #endif
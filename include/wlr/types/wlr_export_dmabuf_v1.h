@@ -34,6 +34,20 @@ struct wlr_export_dmabuf_frame_v1 {
 	bool cursor_locked;
 
 	struct wl_listener output_commit;
+
+	// private state
+
+	bool layers_locked;
+	// Captured by the display hardware instead of exporting the committed
+	// buffer, see wlr_output_capture
+	struct wlr_buffer *capture_buffer; // locked
+	struct wlr_output_capture *capture;
+	struct wl_listener capture_done;
+	struct wl_listener capture_destroy;
+	bool overlay_cursor;
+	// Commit which can't be exported after falling back from a capture
+	uint32_t skip_commit_seq;
+	bool skip_commit;
 };
 
 struct wlr_export_dmabuf_manager_v1 *wlr_export_dmabuf_manager_v1_create(
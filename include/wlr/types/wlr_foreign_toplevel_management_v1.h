@@ -74,6 +74,11 @@ struct wlr_foreign_toplevel_handle_v1 {
 	} events;
 
 	void *data;
+
+	// private state
+
+	// Changes sent to clients with the next done event
+	bool title_pending, app_id_pending, state_pending;
 };
 
 struct wlr_foreign_toplevel_handle_v1_maximized_event {
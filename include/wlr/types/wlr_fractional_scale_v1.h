@@ -0,0 +1,49 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_FRACTIONAL_SCALE_V1_H
+#define WLR_TYPES_WLR_FRACTIONAL_SCALE_V1_H
+
+#include <wayland-server-core.h>
+
+struct wlr_surface;
+
+/**
+ * Implementation for the fractional-scale-v1 protocol.
+ *
+ * Clients render their buffers at the preferred scale sent by the compositor
+ * and use viewporter to set the surface size, instead of rendering at the
+ * next integer scale which the compositor has to scale down.
+ *
+ * The scene-graph sends the preferred scale of the surfaces it displays.
+ * Other compositors need to call wlr_fractional_scale_v1_notify_scale(),
+ * e.g. when a surface enters an output.
+ */
+struct wlr_fractional_scale_manager_v1 {
+	struct wl_global *global;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_listener display_destroy;
+};
+
+struct wlr_fractional_scale_manager_v1 *wlr_fractional_scale_manager_v1_create(
+	struct wl_display *display, uint32_t version);
+
+/**
+ * Notify the client of the scale it should render the surface at. The scale
+ * is remembered if the client hasn't asked for it yet.
+ */
+void wlr_fractional_scale_v1_notify_scale(struct wlr_surface *surface,
+	double scale);
+
+#endif
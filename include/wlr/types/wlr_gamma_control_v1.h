@@ -28,6 +28,14 @@ struct wlr_gamma_control_v1 {
 	struct wl_listener output_destroy_listener;
 
 	void *data;
+
+	// private state
+
+	// Ramps set during the same event loop iteration are applied at once
+	struct wl_event_source *idle_apply;
+	// The table tested with the pending state of this output commit
+	bool tested;
+	uint32_t tested_commit_seq;
 };
 
 struct wlr_gamma_control_manager_v1 *wlr_gamma_control_manager_v1_create(
@@ -34,17 +34,25 @@ struct wlr_idle {
 	} events;
 
 	void *data;
+
+	// private state
+
+	// Shared by all timers, armed for the earliest deadline
+	struct wl_event_source *timer_source;
+	int64_t armed_deadline_msec; // 0 if disarmed
 };
 
 struct wlr_idle_timeout {
 	struct wl_resource *resource;
 	struct wl_list link;
 	struct wlr_seat *seat;
+	struct wlr_idle *idle;
 
-	struct wl_event_source *idle_source;
 	bool idle_state;
 	bool enabled;
 	uint32_t timeout; // milliseconds
+	// Time of the last activity, CLOCK_MONOTONIC, milliseconds
+	int64_t last_activity_msec;
 
 	struct {
 		struct wl_signal idle;
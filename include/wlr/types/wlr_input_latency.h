@@ -0,0 +1,99 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_INPUT_LATENCY_H
+#define WLR_TYPES_WLR_INPUT_LATENCY_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct wlr_seat;
+struct wlr_output;
+
+/**
+ * Bucket i holds samples in the range [2^i, 2^(i + 1)) microseconds, bucket 0
+ * also holds samples below 1us.
+ */
+#define WLR_LATENCY_HISTOGRAM_BUCKETS 32
+
+struct wlr_latency_histogram {
+	uint64_t buckets[WLR_LATENCY_HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sum_usec;
+	uint64_t min_usec, max_usec;
+};
+
+/**
+ * Tracks the latency of input events of a seat, from the hardware timestamp
+ * of the event (the time_usec field of input device events) up to:
+ *
+ * - delivery: the first wl_pointer, wl_keyboard or wl_touch event sent to a
+ *   client as a result of the input event;
+ * - presentation: the presentation of the first frame committed on a tracked
+ *   output after the delivery.
+ *
+ * The presentation latency assumes the client's response makes it into the
+ * next frame, so it is a lower bound for slow clients. Timestamps are
+ * expected to use CLOCK_MONOTONIC, as libinput and the DRM backend do.
+ *
+ * Compositors call wlr_input_latency_notify_input() with the timestamp of each
+ * input event before forwarding it to the seat.
+ */
+struct wlr_input_latency {
+	struct wlr_seat *seat;
+
+	struct wlr_latency_histogram delivery;
+	struct wlr_latency_histogram presentation;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	uint64_t input_usec; // oldest input not yet delivered, 0 if none
+	struct wl_list outputs; // wlr_input_latency_output.link
+
+	struct wl_listener seat_destroy;
+};
+
+/**
+ * Start tracking input latency for the seat. Only a single tracker can be
+ * attached to a seat. The tracker is destroyed with the seat.
+ */
+struct wlr_input_latency *wlr_input_latency_create(struct wlr_seat *seat);
+void wlr_input_latency_destroy(struct wlr_input_latency *latency);
+
+/**
+ * Record the presentation latency of inputs on this output. Removed
+ * automatically when the output is destroyed.
+ */
+void wlr_input_latency_add_output(struct wlr_input_latency *latency,
+	struct wlr_output *output);
+void wlr_input_latency_remove_output(struct wlr_input_latency *latency,
+	struct wlr_output *output);
+
+/**
+ * Notify the tracker of an input event with the given hardware timestamp, in
+ * microseconds. Only the latest input is tracked until it is delivered. A zero
+ * timestamp (unknown) discards the pending input.
+ */
+void wlr_input_latency_notify_input(struct wlr_input_latency *latency,
+	uint64_t time_usec);
+
+void wlr_latency_histogram_add(struct wlr_latency_histogram *hist,
+	uint64_t usec);
+void wlr_latency_histogram_reset(struct wlr_latency_histogram *hist);
+/**
+ * Get an upper bound of the given percentile (between 0 and 1) of the
+ * samples, in microseconds. Returns 0 if the histogram is empty.
+ */
+uint64_t wlr_latency_histogram_get_percentile(
+	const struct wlr_latency_histogram *hist, double percentile);
+
+#endif
@@ -38,8 +38,11 @@ enum wlr_keyboard_modifier {
 };
 
 #define WLR_KEYBOARD_KEYS_CAP 32
+// Keycodes tracked with a bitmap, higher ones are searched in keycodes
+#define WLR_KEYBOARD_BITMAP_KEYCODES 256
 
 struct wlr_keyboard_impl;
+struct wlr_keyboard_keymap_file;
 
 struct wlr_keyboard_modifiers {
 	xkb_mod_mask_t depressed;
@@ -54,6 +57,8 @@ struct wlr_keyboard {
 	const struct wlr_keyboard_impl *impl;
 	struct wlr_keyboard_group *group;
 
+	// Serialized keymap, shared with other keyboards using the same keymap.
+	// keymap_fd is read-only and can be sent to clients as-is.
 	char *keymap_string;
 	size_t keymap_size;
 	int keymap_fd;
@@ -89,13 +94,50 @@ struct wlr_keyboard {
 		struct wl_signal modifiers;
 		struct wl_signal keymap;
 		struct wl_signal repeat_info;
+
+		/**
+		 * The `repeat` event signals with a struct wlr_keyboard_key_event
+		 * that a held key repeats. It is only emitted while a server-side
+		 * repeater is set, see wlr_keyboard_set_repeater(). The event should
+		 * be forwarded as a key press, it doesn't update the xkb state.
+		 */
+		struct wl_signal repeat;
 	} events;
 
 	void *data;
+
+	// private state
+
+	struct wlr_keyboard_keymap_file *keymap_file;
+
+	// Pressed keycodes below WLR_KEYBOARD_BITMAP_KEYCODES, with their index
+	// in keycodes
+	uint32_t pressed_keys[WLR_KEYBOARD_BITMAP_KEYCODES / 32];
+	uint8_t keycode_indexes[WLR_KEYBOARD_BITMAP_KEYCODES];
+
+	struct wlr_keyboard_repeater *repeater;
+	struct wl_list repeat_link; // wlr_keyboard_repeater.keyboards
+	bool repeating;
+	uint32_t repeat_keycode;
+	int64_t repeat_next_msec;
+};
+
+/**
+ * Server-side key repeat. The repeats of all keyboards using the repeater are
+ * driven by a single timer on the event loop, according to the repeat info of
+ * each keyboard.
+ *
+ * At most one repeat per keyboard is delivered per timer expiry, so a stalled
+ * compositor doesn't flood clients with repeats when it catches up.
+ */
+struct wlr_keyboard_repeater {
+	struct wl_event_source *timer;
+	struct wl_list keyboards; // wlr_keyboard.repeat_link
 };
 
 struct wlr_keyboard_key_event {
 	uint32_t time_msec;
+	uint64_t time_usec; // 0 if unknown
 	uint32_t keycode;
 	bool update_state; // if backend doesn't update modifiers on its own
 	enum wl_keyboard_key_state state;
@@ -113,6 +155,20 @@ bool wlr_keyboard_keymaps_match(struct xkb_keymap *km1, struct xkb_keymap *km2);
 void wlr_keyboard_set_repeat_info(struct wlr_keyboard *kb, int32_t rate,
 	int32_t delay);
 void wlr_keyboard_led_update(struct wlr_keyboard *keyboard, uint32_t leds);
+
+struct wlr_keyboard_repeater *wlr_keyboard_repeater_create(
+	struct wl_event_loop *loop);
+/**
+ * Destroys the repeater. Keyboards using it go back to client-side repeat.
+ */
+void wlr_keyboard_repeater_destroy(struct wlr_keyboard_repeater *repeater);
+/**
+ * Sets the server-side repeater of the keyboard, or NULL to leave key repeat
+ * to clients. While a repeater is set, wlr_seat advertises a repeat rate of
+ * zero to clients and repeats are emitted through wlr_keyboard.events.repeat.
+ */
+void wlr_keyboard_set_repeater(struct wlr_keyboard *kb,
+	struct wlr_keyboard_repeater *repeater);
 uint32_t wlr_keyboard_get_modifiers(struct wlr_keyboard *keyboard);
 
 #endif
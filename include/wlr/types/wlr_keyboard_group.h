@@ -15,7 +15,9 @@
 struct wlr_keyboard_group {
 	struct wlr_keyboard keyboard;
 	struct wl_list devices; // keyboard_group_device.link
-	struct wl_list keys; // keyboard_group_key.link
+	// keyboard_group_key.link, pressed keycodes above
+	// WLR_KEYBOARD_BITMAP_KEYCODES
+	struct wl_list keys;
 
 	struct {
 		/**
@@ -41,6 +43,12 @@ struct wlr_keyboard_group {
 	} events;
 
 	void *data;
+
+	// private state
+
+	// Number of devices pressing each keycode below
+	// WLR_KEYBOARD_BITMAP_KEYCODES
+	size_t key_counts[WLR_KEYBOARD_BITMAP_KEYCODES];
 };
 
 struct wlr_keyboard_group *wlr_keyboard_group_create(void);
@@ -15,6 +15,7 @@
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/render/dmabuf.h>
 
+struct wlr_output;
 struct wlr_surface;
 
 struct wlr_dmabuf_v1_buffer {
@@ -66,9 +67,15 @@ struct wlr_linux_dmabuf_v1 {
 
 	struct wlr_linux_dmabuf_feedback_v1_compiled *default_feedback;
 	struct wl_list surfaces; // wlr_linux_dmabuf_v1_surface.link
+	// Shared between surfaces with identical feedback
+	struct wl_list compiled_feedbacks; // wlr_linux_dmabuf_feedback_v1_compiled.link
+	struct wl_list feedback_tables; // wlr_linux_dmabuf_feedback_v1_table.link
+
+	struct wlr_backend *scanout_backend; // may be NULL
 
 	struct wl_listener display_destroy;
 	struct wl_listener renderer_destroy;
+	struct wl_listener scanout_backend_destroy;
 };
 
 /**
@@ -86,4 +93,27 @@ bool wlr_linux_dmabuf_v1_set_surface_feedback(
 	struct wlr_linux_dmabuf_v1 *linux_dmabuf, struct wlr_surface *surface,
 	const struct wlr_linux_dmabuf_feedback_v1 *feedback);
 
+/**
+ * Set a surface's DMA-BUF feedback to prefer formats which can be scanned out
+ * on the output's primary plane, falling back to the formats supported by the
+ * renderer.
+ *
+ * Passing a NULL output resets the feedback to the default feedback. The
+ * default feedback is used as well if the output can't scan out buffers
+ * allocated by the renderer's device.
+ */
+bool wlr_linux_dmabuf_v1_set_surface_scanout_feedback(
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf, struct wlr_surface *surface,
+	struct wlr_output *output);
+
+/**
+ * Check whether buffers can be scanned out by the DRM backend when clients
+ * create them, see wlr_drm_backend_check_buffer_scanout(). This lets the
+ * compositor skip scanout attempts which are bound to fail.
+ *
+ * The backend must be a DRM backend. Passing NULL disables the check.
+ */
+void wlr_linux_dmabuf_v1_set_scanout_backend(
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf, struct wlr_backend *backend);
+
 #endif
@@ -0,0 +1,48 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_LINUX_DRM_SYNCOBJ_V1_H
+#define WLR_TYPES_WLR_LINUX_DRM_SYNCOBJ_V1_H
+
+#include <wayland-server-core.h>
+
+/**
+ * Implementation for the linux-drm-syncobj-v1 protocol.
+ *
+ * Clients attach acquire and release timeline points to their DMA-BUFs,
+ * instead of relying on implicit synchronization. The points are stored in
+ * wlr_surface_state.syncobj.
+ *
+ * Commits are delayed until their acquire point is signalled, without
+ * blocking the event loop. The release point is signalled once the buffer
+ * isn't used anymore, after the rendering operations submitted so far.
+ */
+struct wlr_linux_drm_syncobj_manager_v1 {
+	struct wl_global *global;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	int drm_fd;
+
+	struct wl_listener display_destroy;
+};
+
+/**
+ * Advertise explicit synchronization support to clients.
+ *
+ * Timelines are imported with the DRM FD, usually the renderer's. The DRM
+ * device must support timeline syncobjs. Returns NULL if it doesn't.
+ */
+struct wlr_linux_drm_syncobj_manager_v1 *wlr_linux_drm_syncobj_manager_v1_create(
+	struct wl_display *display, uint32_t version, int drm_fd);
+
+#endif
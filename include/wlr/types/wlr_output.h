@@ -16,6 +16,8 @@
 #include <wayland-util.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/util/addon.h>
+#include <wlr/util/box.h>
+#include <wlr/util/trim.h>
 
 struct wlr_output_mode {
 	int32_t width, height;
@@ -35,11 +37,19 @@ struct wlr_output_cursor {
 
 	// only when using a software cursor without a surface
 	struct wlr_texture *texture;
+	// hash of the image contents, to re-use rendered hardware cursor buffers
+	bool has_image_hash;
+	uint64_t image_hash;
 
 	// only when using a cursor surface
 	struct wlr_surface *surface;
 	struct wl_listener surface_commit;
 	struct wl_listener surface_destroy;
+
+	// drag-and-drop icon drawn along with the cursor image, may be NULL
+	struct wlr_surface *drag_icon;
+	struct wl_listener drag_icon_commit;
+	struct wl_listener drag_icon_destroy;
 };
 
 enum wlr_output_adaptive_sync_status {
@@ -59,6 +69,57 @@ enum wlr_output_state_field {
 	WLR_OUTPUT_STATE_GAMMA_LUT = 1 << 7,
 	WLR_OUTPUT_STATE_RENDER_FORMAT = 1 << 8,
 	WLR_OUTPUT_STATE_SUBPIXEL = 1 << 9,
+	WLR_OUTPUT_STATE_LAYERS = 1 << 10,
+	WLR_OUTPUT_STATE_IN_FENCE = 1 << 11,
+	WLR_OUTPUT_STATE_BUFFER_GEOMETRY = 1 << 12,
+	WLR_OUTPUT_STATE_CAPTURE = 1 << 13,
+	WLR_OUTPUT_STATE_CONTENT_TYPE = 1 << 14,
+	WLR_OUTPUT_STATE_BACKGROUND_COLOR = 1 << 15,
+};
+
+/**
+ * The kind of content displayed on an output.
+ *
+ * This is a hint: backends may pass it on to the display, which can adjust
+ * its processing (e.g. disable scaling filters or reduce latency), and
+ * compositors may use it to pick a presentation policy.
+ */
+enum wlr_output_content_type {
+	WLR_OUTPUT_CONTENT_TYPE_NONE,
+	WLR_OUTPUT_CONTENT_TYPE_PHOTO,
+	WLR_OUTPUT_CONTENT_TYPE_VIDEO,
+	WLR_OUTPUT_CONTENT_TYPE_GAME,
+};
+
+/**
+ * An output layer.
+ *
+ * Output layers are displayed above the output's primary buffer, in the order
+ * they are passed to wlr_output_state_set_layers(). Backends may be able to
+ * scan them out with hardware planes, bypassing composition.
+ */
+struct wlr_output_layer {
+	struct wl_list link; // wlr_output.layers
+	struct wlr_addon_set addons;
+
+	void *data;
+};
+
+/**
+ * The state of an output layer for a commit.
+ */
+struct wlr_output_layer_state {
+	struct wlr_output_layer *layer;
+
+	// Buffer to display, or NULL to disable the layer
+	struct wlr_buffer *buffer;
+	// Position of the top-left corner in output-buffer-local coordinates
+	int x, y;
+
+	// Populated by the backend after wlr_output_test() and wlr_output_commit(),
+	// indicates whether the backend will take care of displaying the layer.
+	// Layers which haven't been accepted need to be composited by the caller.
+	bool accepted;
 };
 
 enum wlr_output_state_mode_type {
@@ -78,9 +139,27 @@ struct wlr_output_state {
 	bool adaptive_sync_enabled;
 	uint32_t render_format;
 	enum wl_output_subpixel subpixel;
+	enum wlr_output_content_type content_type;
+	// Color displayed where the buffer doesn't cover the output, opaque
+	float background_color[4];
 
 	// only valid if WLR_OUTPUT_STATE_BUFFER
 	struct wlr_buffer *buffer;
+	// Display the buffer as soon as possible instead of waiting for the next
+	// vblank, at the cost of tearing. Only valid if WLR_OUTPUT_STATE_BUFFER.
+	// Backends which can't perform tearing page-flips reject the commit.
+	bool tearing_page_flip;
+	// only valid if WLR_OUTPUT_STATE_IN_FENCE, owned by the caller
+	int in_fence_fd;
+
+	// only valid if WLR_OUTPUT_STATE_BUFFER_GEOMETRY
+	struct wlr_fbox buffer_src_box; // buffer coordinates, empty for all
+	struct wlr_box buffer_dst_box; // output-buffer-local, empty for all
+	enum wl_output_transform buffer_transform;
+
+	// only valid if WLR_OUTPUT_STATE_CAPTURE, owned by the caller, see
+	// struct wlr_output_capture
+	struct wlr_buffer *capture_buffer;
 
 	// only valid if WLR_OUTPUT_STATE_MODE
 	enum wlr_output_state_mode_type mode_type;
@@ -93,9 +172,17 @@ struct wlr_output_state {
 	// only valid if WLR_OUTPUT_STATE_GAMMA_LUT
 	uint16_t *gamma_lut;
 	size_t gamma_lut_size;
+
+	// only valid if WLR_OUTPUT_STATE_LAYERS, owned by the caller
+	struct wlr_output_layer_state *layers;
+	size_t layers_len;
 };
 
 struct wlr_output_impl;
+struct wlr_output_frame_coordinator;
+struct wlr_render_timer;
+
+#define WLR_OUTPUT_RENDER_TIMERS 4
 
 /**
  * A compositor output region. This typically corresponds to a monitor that
@@ -132,7 +219,11 @@ struct wlr_output {
 	enum wl_output_subpixel subpixel;
 	enum wl_output_transform transform;
 	enum wlr_output_adaptive_sync_status adaptive_sync_status;
+	// Refresh rate range supported with adaptive sync, mHz, zero if unknown
+	int32_t adaptive_sync_min_refresh, adaptive_sync_max_refresh;
 	uint32_t render_format;
+	enum wlr_output_content_type content_type;
+	float background_color[4]; // opaque black by default
 
 	bool needs_frame;
 	// damage for cursors and fullscreen surface, in output-local coordinates
@@ -173,18 +264,78 @@ struct wlr_output {
 	struct wl_event_source *idle_frame;
 	struct wl_event_source *idle_done;
 
+	// See wlr_output_set_frame_scheduling()
+	struct {
+		bool enabled;
+		int safety_margin; // ms
+		int64_t render_time; // predicted, ns
+		// Number of frames presented after the vblank they were scheduled for
+		uint64_t missed;
+
+		// private state
+
+		struct wl_event_source *timer;
+		bool frame_delayed;
+		int64_t frame_sent; // ns, zero if no frame is being rendered
+		int64_t last_present; // ns, zero if unknown
+		int refresh; // ns, zero if unknown
+		int64_t target; // predicted vblank for the next frame, ns
+		int64_t committed_target; // ns, zero if unknown
+		uint32_t committed_seq;
+		int64_t deadline; // ns, start of the delayed frame's render
+		struct wlr_output_frame_coordinator *coordinator; // may be NULL
+		struct wl_list coordinator_link;
+	} frame_scheduling;
+
+	// See wlr_output_set_low_framerate_compensation()
+	struct {
+		bool enabled;
+
+		// private state
+
+		struct wl_event_source *timer;
+		struct wlr_buffer *buffer; // last committed buffer
+		int64_t last_commit; // ns, zero if unknown
+		int64_t interval; // average interval between buffers, ns
+		int64_t repeat_interval; // ns, zero if not compensating
+		bool repeating;
+	} lfc;
+
 	int attach_render_locks; // number of locks forcing rendering
 
 	struct wl_list cursors; // wlr_output_cursor::link
 	struct wlr_output_cursor *hardware_cursor;
-	struct wlr_swapchain *cursor_swapchain;
+	struct wlr_buffer_pool *cursor_buffer_pool;
+	// Recently rendered hardware cursor buffers, most recent first
+	struct wl_list cursor_buffer_cache; // output_cursor_cache_entry.link
+	size_t cursor_buffer_cache_cap; // zero for the default
 	struct wlr_buffer *cursor_front_buffer;
 	int software_cursor_locks; // number of locks forcing software cursors
 
+	struct wl_list layers; // wlr_output_layer.link
+	int layer_locks; // number of locks forcing a single primary buffer
+
+	struct wl_list captures; // wlr_output_capture.link
+	// Whether the backend accepted the last tested capture buffer format,
+	// valid until a commit changes the mode or fails with a capture attached
+	bool capture_tested, capture_accepted;
+	uint32_t capture_tested_format;
+	uint64_t capture_tested_modifier;
+
 	struct wlr_allocator *allocator;
 	struct wlr_renderer *renderer;
 	struct wlr_swapchain *swapchain;
+	// See wlr_output_set_swapchain_depth(), zero for the default
+	int swapchain_depth;
+	bool swapchain_strict;
 	struct wlr_buffer *back_buffer;
+	// Duration of the most recently finished measured frame, in ns, -1 if
+	// unknown. See wlr_output_event_commit.render_time.
+	int64_t render_time;
+	// Timers measuring frames rendered after wlr_output_attach_render(), used
+	// in turn since GPU results only arrive after a few frames
+	struct wlr_render_timer *render_timers[WLR_OUTPUT_RENDER_TIMERS];
+	size_t next_render_timer;
 
 	struct wl_listener display_destroy;
 
@@ -193,6 +344,42 @@ struct wlr_output {
 	void *data;
 };
 
+/**
+ * A request to copy the contents displayed by an output into a buffer, done by
+ * the display hardware rather than the renderer (e.g. with a DRM writeback
+ * connector). The result includes the cursor and the output layers, without
+ * any composition.
+ *
+ * Captures are attached to the output's next commit with a buffer, after
+ * checking with a test commit that the backend accepts them. Pending captures
+ * are destroyed without a done event when the output is destroyed.
+ */
+struct wlr_output_capture {
+	struct wlr_output *output;
+	struct wlr_buffer *buffer;
+	// Time of the commit the capture is attached to
+	struct timespec commit_time;
+
+	struct {
+		// Emitted once the buffer has been written to, or once the capture
+		// has failed. The capture is destroyed right after.
+		struct wl_signal done; // struct wlr_output_event_capture
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_list link; // wlr_output.captures
+	bool submitted;
+};
+
+struct wlr_output_event_capture {
+	struct wlr_output_capture *capture;
+	// If false, the backend couldn't capture the frame, and callers should
+	// read back the committed buffer instead
+	bool success;
+};
+
 struct wlr_output_event_damage {
 	struct wlr_output *output;
 	pixman_region32_t *damage; // output-buffer-local coordinates
@@ -209,6 +396,11 @@ struct wlr_output_event_commit {
 	uint32_t committed; // bitmask of enum wlr_output_state_field
 	struct timespec *when;
 	struct wlr_buffer *buffer; // NULL if no buffer is committed
+	// Time the renderer spent on the most recent frame rendered after
+	// wlr_output_attach_render() whose measurement is available, in ns.
+	// Measured on the GPU for GPU renderers, so this usually describes a
+	// frame committed earlier. -1 if unknown.
+	int64_t render_time;
 };
 
 enum wlr_output_present_flag {
@@ -247,6 +439,49 @@ struct wlr_output_event_bind {
 	struct wl_resource *resource;
 };
 
+#define WLR_OUTPUT_PRESENT_SAMPLES_LEN 64
+
+struct wlr_output_present_sample {
+	struct timespec when; // presentation time
+	unsigned seq; // vertical retrace counter
+	// Time between the commit and the presentation, ns
+	int64_t latency;
+	// Vertical retraces which went by between the commit and the
+	// presentation, beyond the first one
+	uint32_t missed_vblanks;
+	// Vertical retraces since the previous presentation, beyond the first
+	// one. Zero if unknown.
+	uint32_t seq_gap;
+};
+
+struct wlr_output_present_stats {
+	// Latest presentations, oldest first
+	struct wlr_output_present_sample samples[WLR_OUTPUT_PRESENT_SAMPLES_LEN];
+	size_t samples_len;
+	// Totals since the output was created
+	uint64_t presented;
+	uint64_t missed_vblanks;
+};
+
+/**
+ * Sequences the delayed `frame` events of outputs using predictive frame
+ * scheduling, possibly on different backends, in earliest-deadline-first
+ * order. See wlr_output_set_frame_coordinator().
+ */
+struct wlr_output_frame_coordinator {
+	// Number of frames sent ahead of their schedule to avoid blocking an
+	// output with an earlier vblank
+	uint64_t reordered;
+
+	// private state
+
+	struct wl_list outputs; // wlr_output.frame_scheduling.coordinator_link
+	struct wl_event_loop *event_loop;
+	struct wl_event_source *timer;
+	struct wl_event_source *idle;
+	struct wl_listener display_destroy;
+};
+
 struct wlr_surface;
 
 /**
@@ -467,6 +702,99 @@ void wlr_output_lock_attach_render(struct wlr_output *output, bool lock);
  * a lock.
  */
 void wlr_output_lock_software_cursors(struct wlr_output *output, bool lock);
+/**
+ * Locks the output to display everything in its primary buffer, without
+ * output layers. Unlike wlr_output_lock_attach_render(), direct scan-out of a
+ * client buffer is still allowed. This is useful for screen capture of the
+ * committed buffer. There must be as many unlocks as there have been locks to
+ * restore the original state. There should never be an unlock before a lock.
+ */
+void wlr_output_lock_layers(struct wlr_output *output, bool lock);
+/**
+ * Enables or disables predictive frame scheduling.
+ *
+ * By default, the `frame` event is emitted right after the previous frame has
+ * been presented, leaving almost a whole refresh cycle between rendering and
+ * scan-out. With predictive frame scheduling, the `frame` event is delayed
+ * until shortly before the next predicted vblank. The delay is computed from
+ * the time the compositor spent between the previous `frame` events and their
+ * commits, the renderer's measured GPU time if available (see
+ * wlr_output.render_time), plus `safety_margin` milliseconds.
+ *
+ * Compositors must only commit new buffers in response to the `frame` event
+ * when this is enabled. Frames which miss their vblank are counted in
+ * wlr_output.frame_scheduling.missed, compositors may want to increase the
+ * safety margin if it grows quickly.
+ */
+void wlr_output_set_frame_scheduling(struct wlr_output *output, bool enabled,
+	int safety_margin);
+/**
+ * Create a frame coordinator. It is destroyed with the display.
+ *
+ * Without a coordinator, each output's delayed `frame` event fires on its own
+ * timer, and rendering a frame for one output can push the render of another
+ * output past its vblank. A coordinator instead dispatches the frames of all of
+ * its outputs from a single timer: when frames are due, the frame with the
+ * earliest predicted vblank among those which would otherwise be blocked is
+ * sent first, so that a slow output doesn't make a faster one miss frames.
+ */
+struct wlr_output_frame_coordinator *wlr_output_frame_coordinator_create(
+	struct wl_display *display);
+void wlr_output_frame_coordinator_destroy(
+	struct wlr_output_frame_coordinator *coordinator);
+/**
+ * Add the output to a frame coordinator, or remove it from its current one if
+ * NULL. Only outputs with predictive frame scheduling enabled are
+ * coordinated, see wlr_output_set_frame_scheduling().
+ */
+void wlr_output_set_frame_coordinator(struct wlr_output *output,
+	struct wlr_output_frame_coordinator *coordinator);
+/**
+ * Enables or disables low framerate compensation (LFC).
+ *
+ * When adaptive sync is enabled, a display repeats the last frame on its own if
+ * no new frame arrives before the lowest refresh rate it supports is reached
+ * (see wlr_output.adaptive_sync_min_refresh). A frame which arrives while the
+ * display is repeating is delayed, causing judder. With LFC, when the
+ * compositor commits buffers less often than that, the last buffer is
+ * committed again at an integer fraction of the interval between buffers, so
+ * that new buffers line up with refresh cycles.
+ *
+ * The repeated commits emit the usual precommit, commit and present events.
+ */
+void wlr_output_set_low_framerate_compensation(struct wlr_output *output,
+	bool enabled);
+/**
+ * Configures the swapchain used for buffers rendered with
+ * wlr_output_attach_render().
+ *
+ * At most `depth` buffers are allocated, from 2 to 4 (the default): 2 for
+ * double buffering, 3 for triple buffering. Fewer buffers use less memory, but
+ * rendering may need to wait for a buffer to be released by the backend.
+ *
+ * When `strict` is set, all `depth` buffers are allocated and used in turn,
+ * the least recently submitted one is re-used first. The buffer age is then
+ * always `depth`. Otherwise the first released buffer is re-used and buffers
+ * are only allocated when needed.
+ *
+ * The swapchain is re-created with the new configuration on the next frame.
+ */
+void wlr_output_set_swapchain_depth(struct wlr_output *output, int depth,
+	bool strict);
+/**
+ * Release memory held by the output, e.g. in response to memory pressure.
+ *
+ * Cached cursor buffers are dropped. With WLR_TRIM_CRITICAL, the swapchain
+ * buffers which aren't in use by the backend are released too, the next frame
+ * then needs to be fully repainted.
+ */
+void wlr_output_trim(struct wlr_output *output, enum wlr_trim_level level);
+/**
+ * Get timing statistics about the latest presentations, e.g. to detect
+ * dropped frames. Returns false if the backend doesn't keep track of them.
+ */
+bool wlr_output_get_present_stats(struct wlr_output *output,
+	struct wlr_output_present_stats *stats);
 /**
  * Renders software cursors. This is a utility function that can be called when
  * compositors render.
@@ -496,11 +824,57 @@ void wlr_output_cursor_set_surface(struct wlr_output_cursor *cursor,
 	struct wlr_surface *surface, int32_t hotspot_x, int32_t hotspot_y);
 bool wlr_output_cursor_set_buffer(struct wlr_output_cursor *cursor,
 	struct wlr_buffer *buffer, int32_t hotspot_x, int32_t hotspot_y);
+/**
+ * Draw a drag-and-drop icon along with the cursor image, at the icon surface
+ * position relative to the cursor hotspot. Both are combined into the
+ * hardware cursor buffer when possible, so that dragging doesn't require
+ * compositing, and are drawn as a software cursor otherwise: compositors
+ * must not draw the icon themselves. Pass NULL to remove the icon.
+ */
+void wlr_output_cursor_set_drag_icon(struct wlr_output_cursor *cursor,
+	struct wlr_surface *icon);
 bool wlr_output_cursor_move(struct wlr_output_cursor *cursor,
 	double x, double y);
 void wlr_output_cursor_destroy(struct wlr_output_cursor *cursor);
 
 
+/**
+ * Create a new output layer.
+ *
+ * The layer isn't displayed until it's referenced in a
+ * wlr_output_state_set_layers() call.
+ */
+struct wlr_output_layer *wlr_output_layer_create(struct wlr_output *output);
+/**
+ * Destroy an output layer.
+ *
+ * The layer must not be referenced by any pending output state.
+ */
+void wlr_output_layer_destroy(struct wlr_output_layer *layer);
+
+/**
+ * Capture the contents of the next frame displayed by the output into the
+ * buffer. The buffer must have the size of the output and be importable by
+ * the backend, it is locked until the capture is done.
+ *
+ * Only some backends support this. Use wlr_output_test_capture() to check
+ * beforehand whether the buffer can be captured into.
+ */
+struct wlr_output_capture *wlr_output_capture_create(struct wlr_output *output,
+	struct wlr_buffer *buffer);
+/**
+ * Cancel a capture. If it has already been submitted, the backend still
+ * writes into the buffer, but no done event is emitted.
+ */
+void wlr_output_capture_destroy(struct wlr_output_capture *capture);
+/**
+ * Check whether the backend can capture the output into the buffer, with
+ * wlr_output_capture_create().
+ */
+bool wlr_output_test_capture(struct wlr_output *output,
+	struct wlr_buffer *buffer);
+
+
 void wlr_output_state_set_enabled(struct wlr_output_state *state,
 	bool enabled);
 void wlr_output_state_set_mode(struct wlr_output_state *state,
@@ -516,6 +890,61 @@ void wlr_output_state_set_render_format(struct wlr_output_state *state,
 	uint32_t format);
 void wlr_output_state_set_subpixel(struct wlr_output_state *state,
 	enum wl_output_subpixel subpixel);
+/**
+ * Set the kind of content displayed by the output. Backends which can't
+ * forward the hint to the display ignore it.
+ */
+void wlr_output_state_set_content_type(struct wlr_output_state *state,
+	enum wlr_output_content_type content_type);
+/**
+ * Set the color displayed where the buffer doesn't cover the output, e.g.
+ * when its destination box is smaller than the output. The alpha component
+ * is ignored. Backends which can't fill the output with a color reject
+ * anything but black.
+ */
+void wlr_output_state_set_background_color(struct wlr_output_state *state,
+	const float color[static 4]);
+/**
+ * Set a sync_file FD which is signalled when the committed buffer is ready to
+ * be displayed. The FD is owned by the caller and must remain valid until the
+ * state is committed or discarded.
+ *
+ * When a buffer rendered with wlr_output_attach_render() is committed without
+ * an in-fence, a render fence is exported from the renderer if supported.
+ * Backends which don't support explicit synchronization ignore the fence and
+ * rely on implicit synchronization.
+ */
+void wlr_output_state_set_in_fence(struct wlr_output_state *state, int fd);
+/**
+ * Set how the buffer of a state is displayed: the buffer is cropped to
+ * src_box, transformed, then scaled to dst_box. An empty src_box means the
+ * whole buffer, an empty dst_box the whole output. Parts of the output not
+ * covered by dst_box are black.
+ *
+ * This allows buffers which don't match the output to be scanned out
+ * directly. Only some backends support this, others reject the state.
+ */
+void wlr_output_state_set_buffer_geometry(struct wlr_output_state *state,
+	const struct wlr_fbox *src_box, const struct wlr_box *dst_box,
+	enum wl_output_transform transform);
+/**
+ * Ask the backend to capture the contents displayed after this commit into
+ * the buffer. Most callers should use wlr_output_capture_create() instead.
+ * The buffer is owned by the caller, backends lock it until the capture is
+ * done and then call wlr_output_send_capture_done().
+ */
+void wlr_output_state_set_capture_buffer(struct wlr_output_state *state,
+	struct wlr_buffer *buffer);
+/**
+ * Set the output layers for a state. Layers not included in the array are
+ * disabled. The array is owned by the caller and must remain valid until the
+ * state is committed or discarded.
+ *
+ * After a successful test or commit, the backend sets the `accepted` field of
+ * each layer state.
+ */
+void wlr_output_state_set_layers(struct wlr_output_state *state,
+	struct wlr_output_layer_state *layers, size_t layers_len);
 
 
 /**
@@ -13,8 +13,7 @@
 #include <wayland-util.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/util/addon.h>
-
-struct wlr_box;
+#include <wlr/util/box.h>
 
 /**
  * Helper to arrange outputs in a 2D coordinate space. The output effective
@@ -34,6 +33,13 @@ struct wlr_output_layout {
 	} events;
 
 	void *data;
+
+	// private state
+
+	struct wl_array index; // see types/wlr_output_layout.c
+	struct wlr_box extents;
+	int index_max_width;
+	bool index_dirty;
 };
 
 struct wlr_output_layout_output_state;
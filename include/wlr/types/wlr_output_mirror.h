@@ -0,0 +1,71 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_OUTPUT_MIRROR_H
+#define WLR_TYPES_WLR_OUTPUT_MIRROR_H
+
+#include <wayland-server-core.h>
+
+struct wlr_output;
+
+/**
+ * Displays the buffers committed on a source output on other outputs, e.g.
+ * to clone a laptop panel to projectors. The content is only rendered once,
+ * for the source output.
+ *
+ * Each buffer is scanned out directly on the mirror outputs if the backend
+ * accepts it, scaled with the buffer geometry to fit the output while keeping
+ * its aspect ratio. Otherwise it's blitted to the mirror output's swapchain.
+ * Buffers of outputs with a different transform are rotated accordingly.
+ *
+ * Mirror outputs must be enabled by the compositor but must not be rendered
+ * to otherwise. They are presented at their own refresh rate: if a frame is
+ * pending on a mirror output, only the latest source buffer is presented once
+ * it's done. Cursors are not mirrored, unless they are software cursors
+ * rendered into the source buffer.
+ */
+struct wlr_output_mirror {
+	struct wlr_output *source;
+	struct wl_list outputs; // wlr_output_mirror_output.link
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_listener source_commit;
+	struct wl_listener source_destroy;
+};
+
+struct wlr_output_mirror_output {
+	struct wlr_output_mirror *mirror;
+	struct wlr_output *output;
+	struct wl_list link; // wlr_output_mirror.outputs
+
+	// private state
+
+	struct wlr_buffer *pending_buffer; // latest source buffer, locked
+	bool direct; // whether the previous buffer was scanned out directly
+
+	struct wl_listener output_frame;
+	struct wl_listener output_destroy;
+};
+
+struct wlr_output_mirror *wlr_output_mirror_create(struct wlr_output *source);
+void wlr_output_mirror_destroy(struct wlr_output_mirror *mirror);
+/**
+ * Start displaying the source output on another output. The mirror output
+ * is automatically removed when it's destroyed.
+ */
+struct wlr_output_mirror_output *wlr_output_mirror_add_output(
+	struct wlr_output_mirror *mirror, struct wlr_output *output);
+void wlr_output_mirror_output_destroy(
+	struct wlr_output_mirror_output *mirror_output);
+
+#endif
@@ -25,6 +25,11 @@ struct wlr_pointer {
 
 	struct {
 		struct wl_signal motion; // struct wlr_event_pointer_motion
+		// Raw relative motion, emitted for every hardware event even when
+		// motion is coalesced. Meant to be forwarded to relative pointer
+		// clients, e.g. while the pointer is locked, without going through
+		// cursor handling.
+		struct wl_signal relative_motion; // struct wlr_pointer_relative_motion_event
 		struct wl_signal motion_absolute; // struct wlr_event_pointer_motion_absolute
 		struct wl_signal button; // struct wlr_event_pointer_button
 		struct wl_signal axis; // struct wlr_event_pointer_axis
@@ -48,6 +53,14 @@ struct wlr_pointer {
 struct wlr_pointer_motion_event {
 	struct wlr_pointer *pointer;
 	uint32_t time_msec;
+	uint64_t time_usec; // 0 if unknown
+	double delta_x, delta_y;
+	double unaccel_dx, unaccel_dy;
+};
+
+struct wlr_pointer_relative_motion_event {
+	struct wlr_pointer *pointer;
+	uint64_t time_usec;
 	double delta_x, delta_y;
 	double unaccel_dx, unaccel_dy;
 };
@@ -55,6 +68,7 @@ struct wlr_pointer_motion_event {
 struct wlr_pointer_motion_absolute_event {
 	struct wlr_pointer *pointer;
 	uint32_t time_msec;
+	uint64_t time_usec; // 0 if unknown
 	// From 0..1
 	double x, y;
 };
@@ -62,6 +76,7 @@ struct wlr_pointer_motion_absolute_event {
 struct wlr_pointer_button_event {
 	struct wlr_pointer *pointer;
 	uint32_t time_msec;
+	uint64_t time_usec; // 0 if unknown
 	uint32_t button;
 	enum wlr_button_state state;
 };
@@ -81,6 +96,7 @@ enum wlr_axis_orientation {
 struct wlr_pointer_axis_event {
 	struct wlr_pointer *pointer;
 	uint32_t time_msec;
+	uint64_t time_usec; // 0 if unknown
 	enum wlr_axis_source source;
 	enum wlr_axis_orientation orientation;
 	double delta;
@@ -9,6 +9,7 @@
 #ifndef WLR_TYPES_WLR_POINTER_CONSTRAINTS_V1_H
 #define WLR_TYPES_WLR_POINTER_CONSTRAINTS_V1_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <wayland-server-core.h>
 #include <pixman.h>
@@ -16,6 +17,7 @@
 #include "pointer-constraints-unstable-v1-protocol.h"
 
 struct wlr_seat;
+struct wlr_pointer_constraint_v1_band;
 
 enum wlr_pointer_constraint_v1_type {
 	WLR_POINTER_CONSTRAINT_V1_LOCKED,
@@ -65,6 +67,14 @@ struct wlr_pointer_constraint_v1 {
 	} events;
 
 	void *data;
+
+	// private state
+
+	// Copy of the rectangles of region, split in horizontal bands sorted by y
+	pixman_box32_t *band_rects;
+	size_t band_rects_cap;
+	struct wlr_pointer_constraint_v1_band *bands;
+	size_t bands_len, bands_cap;
 };
 
 struct wlr_pointer_constraints_v1 {
@@ -93,6 +103,19 @@ struct wlr_pointer_constraint_v1 *
 	struct wlr_pointer_constraints_v1 *pointer_constraints,
 	struct wlr_surface *surface, struct wlr_seat *seat);
 
+/**
+ * Clamp a pointer motion starting at the surface-local coordinates (sx, sy)
+ * against the constraint region. The motion slides along the region edges
+ * like wlr_region_confine(), but region lookups use a cache rebuilt on
+ * surface commit, so this is cheap enough to call for every motion event.
+ *
+ * Returns false and leaves dx and dy untouched if the starting point is
+ * outside of the region.
+ */
+bool wlr_pointer_constraint_v1_confine_motion(
+	struct wlr_pointer_constraint_v1 *constraint, double sx, double sy,
+	double *dx, double *dy);
+
 void wlr_pointer_constraint_v1_send_activated(
 	struct wlr_pointer_constraint_v1 *constraint);
 /**
@@ -27,21 +27,31 @@ struct wlr_presentation {
 		struct wl_signal destroy;
 	} events;
 
+	// private state
+
+	struct wl_list feedbacks; // wlr_presentation_feedback.link
+	// Destroyed feedbacks kept for reuse
+	struct wl_list feedback_pool; // wlr_presentation_feedback.link
+	size_t feedback_pool_len;
+	struct wl_list outputs; // wlr_presentation_output.link
+
 	struct wl_listener display_destroy;
 };
 
 struct wlr_presentation_feedback {
 	struct wl_list resources; // wl_resource_get_link()
 
-	// Only when the wlr_presentation_surface_sampled_on_output() helper has
-	// been called.
+	// Only when the wlr_presentation_surface_sampled_on_output() or
+	// wlr_presentation_surface_committed_on_output() helper has been called.
 	struct wlr_output *output;
 	bool output_committed;
 	uint32_t output_commit_seq;
 
-	struct wl_listener output_commit;
-	struct wl_listener output_present;
-	struct wl_listener output_destroy;
+	// private state
+
+	struct wlr_presentation *presentation; // NULL once it's destroyed
+	struct wl_list link; // wlr_presentation.feedbacks
+	struct wl_list output_link; // wlr_presentation_output.feedbacks
 };
 
 struct wlr_presentation_event {
@@ -95,5 +105,15 @@ void wlr_presentation_event_from_output(struct wlr_presentation_event *event,
 void wlr_presentation_surface_sampled_on_output(
 	struct wlr_presentation *presentation, struct wlr_surface *surface,
 	struct wlr_output *output);
+/**
+ * Mark the current surface's buffer as displayed on the given output.
+ *
+ * Same as wlr_presentation_surface_sampled_on_output(), but to be called once
+ * the wlr_output_commit() call displaying the surface's current contents has
+ * succeeded, e.g. from the output commit event.
+ */
+void wlr_presentation_surface_committed_on_output(
+	struct wlr_presentation *presentation, struct wlr_surface *surface,
+	struct wlr_output *output);
 
 #endif
@@ -10,6 +10,7 @@
 #define WLR_TYPES_WLR_RELATIVE_POINTER_V1_H
 
 #include <wayland-server-core.h>
+#include <wlr/types/wlr_pointer.h>
 
 /**
  * This protocol specifies a set of interfaces used for making clients able to
@@ -69,6 +70,16 @@ void wlr_relative_pointer_manager_v1_send_relative_motion(
 	uint64_t time_usec, double dx, double dy,
 	double dx_unaccel, double dy_unaccel);
 
+/**
+ * Send the raw relative motion of struct wlr_pointer.events.relative_motion to
+ * the seat. While the pointer is locked, compositors can call this from their
+ * relative_motion handler and ignore wlr_pointer.events.motion entirely, except
+ * for sending wl_pointer.frame.
+ */
+void wlr_relative_pointer_manager_v1_send_pointer_motion(
+	struct wlr_relative_pointer_manager_v1 *manager, struct wlr_seat *seat,
+	const struct wlr_pointer_relative_motion_event *event);
+
 /**
  * Get a relative pointer from its resource. Returns NULL if inert.
  */
@@ -22,9 +22,13 @@
 #include <pixman.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_damage_ring.h>
+#include <wlr/types/wlr_output.h>
 
-struct wlr_output;
+struct wlr_linux_dmabuf_v1;
 struct wlr_output_layout;
+struct wlr_renderer;
+struct wlr_texture_atlas;
 struct wlr_xdg_surface;
 struct wlr_layer_surface_v1;
 
@@ -71,11 +75,63 @@ enum wlr_scene_debug_damage_option {
 	WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT
 };
 
+/**
+ * Why a scene output couldn't be directly scanned out, i.e. why the top-most
+ * buffer had to be composited.
+ */
+enum wlr_scene_scanout_failure {
+	// The output was directly scanned out
+	WLR_SCENE_SCANOUT_FAILURE_NONE,
+	// Damage highlighting is enabled, see WLR_SCENE_DEBUG_DAMAGE
+	WLR_SCENE_SCANOUT_FAILURE_DEBUG_DAMAGE,
+	// Nothing is displayed, or the top-most node isn't a buffer
+	WLR_SCENE_SCANOUT_FAILURE_NO_BUFFER,
+	// Other nodes than rects and single-pixel buffers of the background color
+	// are displayed beneath the top-most buffer
+	WLR_SCENE_SCANOUT_FAILURE_MULTIPLE_NODES,
+	// The buffer isn't entirely on the output
+	WLR_SCENE_SCANOUT_FAILURE_OUT_OF_BOUNDS,
+	// The buffer has already been rejected by the backend
+	WLR_SCENE_SCANOUT_FAILURE_INCAPABLE,
+	// The test commit failed and the backend had to crop the buffer
+	WLR_SCENE_SCANOUT_FAILURE_SRC_BOX,
+	// The test commit failed and the backend had to rotate the buffer
+	WLR_SCENE_SCANOUT_FAILURE_TRANSFORM,
+	// The test commit failed and the backend had to scale or move the buffer
+	WLR_SCENE_SCANOUT_FAILURE_SIZE,
+	// The test commit failed, e.g. because of the buffer format or modifier
+	WLR_SCENE_SCANOUT_FAILURE_TEST,
+	// The commit failed even though the test commit succeeded
+	WLR_SCENE_SCANOUT_FAILURE_COMMIT,
+	// The test commit failed and the backend had to fill the output with the
+	// color of the bottom-most rect
+	WLR_SCENE_SCANOUT_FAILURE_BACKGROUND,
+};
+
+#define WLR_SCENE_SCANOUT_FAILURE_COUNT 12
+
+/**
+ * How the primary output of a buffer is picked among the outputs it's
+ * displayed on.
+ */
+enum wlr_scene_primary_output_policy {
+	// The output displaying the largest area of the buffer
+	WLR_SCENE_PRIMARY_OUTPUT_LARGEST_OVERLAP,
+	// The output with the highest refresh rate, ties are broken by overlap
+	WLR_SCENE_PRIMARY_OUTPUT_HIGHEST_REFRESH,
+};
+
 /** A sub-tree in the scene-graph. */
 struct wlr_scene_tree {
 	struct wlr_scene_node node;
 
 	struct wl_list children; // wlr_scene_node.link
+
+	// private state
+
+	// Bounding box of all enabled descendants, relative to the tree node
+	struct wlr_box bounds;
+	bool bounds_dirty;
 };
 
 /** The root scene-graph node. */
@@ -86,13 +142,36 @@ struct wlr_scene {
 
 	// May be NULL
 	struct wlr_presentation *presentation;
+	// May be NULL
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf_v1;
+	// May be NULL
+	struct wlr_texture_atlas *texture_atlas;
 
 	// private state
 
 	struct wl_listener presentation_destroy;
+	struct wl_listener linux_dmabuf_v1_destroy;
+	struct wl_listener texture_atlas_destroy;
 
 	enum wlr_scene_debug_damage_option debug_damage_option;
 	struct wl_list damage_highlight_regions;
+	bool debug_scanout;
+
+	enum wlr_scene_primary_output_policy primary_output_policy;
+
+	int hidden_frame_done_interval; // in milliseconds, 0 if disabled
+	// Only exists while the scene has outputs
+	struct wl_event_source *hidden_frame_done_timer;
+	bool hidden_frame_done_scheduled;
+
+	int update_depth; // wlr_scene_begin_update() nesting level
+	pixman_region32_t update_damage; // layout coordinates
+	// Damage in layout coordinates not yet added to the outputs
+	pixman_region32_t pending_damage;
+	struct wl_event_source *pending_damage_idle;
+	bool update_outputs_pending;
+
+	struct wl_list render_caches; // scene_render_cache.link
 };
 
 /** A scene-graph node displaying a single surface. */
@@ -108,6 +187,7 @@ struct wlr_scene_surface {
 	struct wl_listener output_leave;
 	struct wl_listener output_present;
 	struct wl_listener frame_done;
+	struct wl_listener preferred_scale;
 	struct wl_listener surface_destroy;
 	struct wl_listener surface_commit;
 };
@@ -129,28 +209,56 @@ struct wlr_scene_buffer {
 	struct {
 		struct wl_signal output_enter; // struct wlr_scene_output
 		struct wl_signal output_leave; // struct wlr_scene_output
+		// Emitted when an output commit displaying the buffer succeeded
 		struct wl_signal output_present; // struct wlr_scene_output
 		struct wl_signal frame_done; // struct timespec
+		struct wl_signal preferred_scale;
 	} events;
 
-	// May be NULL
+	/**
+	 * May be NULL. Hit-testing skips sub-trees whose bounding box doesn't
+	 * contain the point, so this should only accept points inside the
+	 * buffer's destination box.
+	 */
 	wlr_scene_buffer_point_accepts_input_func_t point_accepts_input;
 
 	/**
-	 * The output that the largest area of this buffer is displayed on.
-	 * This may be NULL if the buffer is not currently displayed on any
-	 * outputs. This is the output that should be used for frame callbacks,
-	 * presentation feedback, etc.
+	 * The output that this buffer is displayed on picked according to
+	 * wlr_scene_set_primary_output_policy(), by default the one displaying
+	 * its largest area. This may be NULL if the buffer is not currently
+	 * displayed on any outputs. This is the output that should be used for
+	 * frame callbacks, presentation feedback, etc.
 	 */
 	struct wlr_scene_output *primary_output;
 
+	/**
+	 * The highest scale of the outputs this buffer is displayed on, or 0 if
+	 * it is not displayed on any outputs. The preferred_scale event is
+	 * emitted when it changes.
+	 */
+	float preferred_scale;
+
+	/**
+	 * The kind of content displayed by the buffer. The scene output passes
+	 * the content type of a buffer covering the whole output to the output.
+	 */
+	enum wlr_output_content_type content_type;
+
 	// private state
 
 	uint64_t active_outputs;
-	struct wlr_texture *texture;
+	// Fully hidden by opaque nodes on its primary output, as of the last
+	// frame rendered there
+	bool occluded;
+	// Scan-out target of the DMA-BUF feedback sent to the surface, NULL for
+	// the default feedback. Only used for comparisons.
+	struct wlr_output *dmabuf_feedback_output;
+	// Textures imported for renderers and buffers, most recently used first
+	struct wl_list textures; // scene_buffer_texture.link
 	struct wlr_fbox src_box;
 	int dst_width, dst_height;
 	enum wl_output_transform transform;
+	pixman_region32_t opaque_region;
 };
 
 /** A viewport for an output in the scene-graph */
@@ -160,10 +268,18 @@ struct wlr_scene_output {
 	struct wlr_scene *scene;
 	struct wlr_addon addon;
 
-	struct wlr_output_damage *damage;
+	struct wlr_damage_ring damage_ring;
 
 	int x, y;
 
+	struct wlr_scene_output_scanout_stats {
+		uint64_t scanout_frames; // frames directly scanned out
+		uint64_t composited_frames;
+		// Number of frames for which direct scan-out failed, by reason
+		uint64_t failures[WLR_SCENE_SCANOUT_FAILURE_COUNT];
+		enum wlr_scene_scanout_failure last_failure;
+	} scanout_stats;
+
 	struct {
 		struct wl_signal destroy;
 	} events;
@@ -172,9 +288,39 @@ struct wlr_scene_output {
 
 	uint8_t index;
 	bool prev_scanout;
+	bool allow_tearing;
 
+	// See wlr_scene_output_set_content_type_policy()
+	struct {
+		bool enabled;
+		enum wlr_output_content_type applied;
+		// The compositor's settings, restored for other content types
+		bool adaptive_sync, lfc, frame_scheduling;
+		int safety_margin;
+	} content_type_policy;
+
+	// Flattened list of the nodes to render, in rendering order
+	struct wl_array render_list; // struct render_list_entry
+	bool render_list_dirty;
+
+	struct wl_array layers; // struct wlr_output_layer_state
+	struct wl_array layer_nodes; // struct wlr_scene_node *, on layers
+	// The layer assignment needs to be tested again
+	bool layers_dirty;
+
+	// Buffers displayed by the next commit with a buffer, which get their
+	// output_present event once it has succeeded
+	struct wl_array present_buffers; // struct wlr_scene_buffer *
+
+	struct scene_render_thread *render_thread; // NULL if disabled
+	// A frame handed over to render_thread waits to be committed
+	bool commit_pending;
+
+	struct wl_listener output_precommit; // if render_thread is set
 	struct wl_listener output_commit;
 	struct wl_listener output_mode;
+	struct wl_listener output_damage;
+	struct wl_listener output_needs_frame;
 };
 
 /** A layer shell scene helper */
@@ -188,6 +334,20 @@ struct wlr_scene_layer_surface_v1 {
 	struct wl_listener layer_surface_destroy;
 	struct wl_listener layer_surface_map;
 	struct wl_listener layer_surface_unmap;
+
+	// Inputs and results of the last configure, to skip redundant ones
+	struct {
+		bool valid;
+		uint32_t anchor;
+		int32_t exclusive_zone;
+		struct {
+			int32_t top, right, bottom, left;
+		} margin;
+		uint32_t desired_width, desired_height;
+		uint32_t layer; // enum zwlr_layer_shell_v1_layer
+		struct wlr_box full_area, usable_area;
+		struct wlr_box box, next_usable_area;
+	} arranged;
 };
 
 /**
@@ -249,11 +409,74 @@ void wlr_scene_node_for_each_buffer(struct wlr_scene_node *node,
  */
 struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 	double lx, double ly, double *nx, double *ny);
+/**
+ * Render a node and its children into a buffer, e.g. to share a single
+ * window. The node's origin is drawn at the top-left corner of the buffer,
+ * scaled by the given factor. Parts of the buffer which aren't covered by any
+ * node are cleared to transparent.
+ *
+ * Only the sub-tree is drawn, so the cost scales with the size of the node
+ * instead of the size of the outputs it's displayed on.
+ */
+bool wlr_scene_node_render(struct wlr_scene_node *node,
+	struct wlr_renderer *renderer, struct wlr_buffer *buffer, float scale);
+/**
+ * Render a node like wlr_scene_node_render(), but only repaint the parts of
+ * the buffer which have changed since it was last rendered with this
+ * function, e.g. to keep window previews up to date cheaply. Damage is
+ * tracked per node and per buffer, so that a few buffers can be used in turn.
+ *
+ * If damage is non-NULL, it's set to the repainted region, in buffer-local
+ * coordinates.
+ */
+bool wlr_scene_node_render_to_buffer(struct wlr_scene_node *node,
+	struct wlr_renderer *renderer, struct wlr_buffer *buffer, float scale,
+	pixman_region32_t *damage);
+/**
+ * If a node and its children only display a single DMA-BUF at their origin,
+ * without cropping, scaling nor transform, return it. The buffer can then be
+ * shared as-is instead of rendering the node with wlr_scene_node_render().
+ * Returns NULL otherwise.
+ */
+struct wlr_buffer *wlr_scene_node_get_single_buffer(
+	struct wlr_scene_node *node);
 
 /**
  * Create a new scene-graph.
  */
 struct wlr_scene *wlr_scene_create(void);
+/**
+ * Set the interval at which buffers which are fully occluded, or which aren't
+ * displayed on any output, receive frame_done events. Defaults to 1000 ms.
+ *
+ * With an interval of 0, occluded buffers receive frame_done events on every
+ * frame of their primary output, and buffers outside of all outputs don't
+ * receive any.
+ */
+void wlr_scene_set_hidden_frame_done_interval(struct wlr_scene *scene,
+	int interval_ms);
+/**
+ * Set how the primary output of buffers is picked. Buffers only receive
+ * frame_done events and presentation feedback from their primary output, so
+ * that a surface spanning several outputs isn't asked to render more often
+ * than one of them refreshes. Defaults to
+ * WLR_SCENE_PRIMARY_OUTPUT_LARGEST_OVERLAP.
+ */
+void wlr_scene_set_primary_output_policy(struct wlr_scene *scene,
+	enum wlr_scene_primary_output_policy policy);
+/**
+ * Batch modifications of the scene-graph, e.g. moving all windows of a
+ * workspace. Until the matching wlr_scene_commit_update() call, damage is
+ * collected in layout coordinates instead of being applied to each output,
+ * and the outputs buffers are displayed on (output_enter/output_leave and
+ * primary_output) aren't updated. wlr_scene_commit_update() then applies the
+ * damage and updates the outputs once for the whole scene.
+ *
+ * Calls may be nested, only the outermost commit applies the changes. Outputs
+ * must not be rendered during an update.
+ */
+void wlr_scene_begin_update(struct wlr_scene *scene);
+void wlr_scene_commit_update(struct wlr_scene *scene);
 /**
  * Handle presentation feedback for all surfaces in the scene, assuming that
  * scene outputs and the scene rendering functions are used.
@@ -262,6 +485,37 @@ struct wlr_scene *wlr_scene_create(void);
  */
 void wlr_scene_set_presentation(struct wlr_scene *scene,
 	struct wlr_presentation *presentation);
+/**
+ * Send DMA-BUF feedback to the surfaces in the scene. Surfaces covering a
+ * whole output are asked to prefer formats which can be scanned out, so that
+ * they become candidates for direct scan-out. Other surfaces get the default
+ * feedback.
+ *
+ * Asserts that a struct wlr_linux_dmabuf_v1 hasn't already been set for the
+ * scene.
+ */
+void wlr_scene_set_linux_dmabuf_v1(struct wlr_scene *scene,
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf_v1);
+/**
+ * Pack small compositor-side buffers displayed by the scene into the atlas
+ * when rendering with its renderer, so that they share textures. Client
+ * buffers are never packed. Buffers which don't fit the atlas are imported
+ * as usual.
+ *
+ * Asserts that a struct wlr_texture_atlas hasn't already been set for the
+ * scene.
+ */
+void wlr_scene_set_texture_atlas(struct wlr_scene *scene,
+	struct wlr_texture_atlas *atlas);
+
+/**
+ * Release textures cached by the scene, e.g. in response to memory pressure.
+ *
+ * Textures of buffers which are not displayed anymore are dropped. With
+ * WLR_TRIM_CRITICAL, textures of buffers which are not visible on any output
+ * are dropped too, they are imported again when needed.
+ */
+void wlr_scene_trim(struct wlr_scene *scene, enum wlr_trim_level level);
 
 /**
  * Add a node displaying nothing but its children.
@@ -330,6 +584,16 @@ void wlr_scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 void wlr_scene_buffer_set_buffer_with_damage(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_buffer *buffer, pixman_region32_t *region);
 
+/**
+ * Sets the buffer's opaque region. This is an optimization hint used to
+ * determine if buffers which reside under this one need to be rendered or not.
+ *
+ * The region is in scene-buffer-local coordinates. If NULL, the buffer is
+ * only considered opaque if its texture doesn't have an alpha channel.
+ */
+void wlr_scene_buffer_set_opaque_region(struct wlr_scene_buffer *scene_buffer,
+	pixman_region32_t *region);
+
 /**
  * Set the source rectangle describing the region of the buffer which will be
  * sampled to render this node. This allows cropping the buffer.
@@ -355,6 +619,12 @@ void wlr_scene_buffer_set_dest_size(struct wlr_scene_buffer *scene_buffer,
 void wlr_scene_buffer_set_transform(struct wlr_scene_buffer *scene_buffer,
 	enum wl_output_transform transform);
 
+/**
+ * Set the kind of content displayed by the buffer.
+ */
+void wlr_scene_buffer_set_content_type(struct wlr_scene_buffer *scene_buffer,
+	enum wlr_output_content_type content_type);
+
 /**
  * Calls the buffer's frame_done signal.
  */
@@ -377,14 +647,58 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output);
  */
 void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 	int lx, int ly);
+/**
+ * Allow tearing page-flips when a single buffer is directly scanned out on the
+ * output. This lowers latency for fullscreen clients such as games, at the
+ * cost of visible tearing. Disabled by default.
+ */
+void wlr_scene_output_set_allow_tearing(struct wlr_scene_output *scene_output,
+	bool allow_tearing);
+/**
+ * Adapt the output's presentation to the content type of the buffer covering
+ * it (see wlr_scene_buffer_set_content_type()):
+ *
+ * - Games get adaptive sync, low framerate compensation (see
+ *   wlr_output_set_low_framerate_compensation()) and predictive frame
+ *   scheduling (see wlr_output_set_frame_scheduling()), to lower latency.
+ * - Videos get adaptive sync and low framerate compensation, so that their
+ *   frames are paced in whole refresh cycles.
+ *
+ * Adaptive sync is only requested if the output accepts it. The compositor's
+ * settings are restored for other content types and when the policy is
+ * disabled, and must not be changed while it is enabled. Outputs added to a
+ * frame coordinator stay coordinated. Disabled by default.
+ */
+void wlr_scene_output_set_content_type_policy(
+	struct wlr_scene_output *scene_output, bool enabled);
+/**
+ * Composite the output's frames on a dedicated thread, so that a slow output
+ * doesn't delay the frames of the others. wlr_scene_output_commit() then
+ * returns once the frame has been recorded, and the output is committed from
+ * the event loop once it has been composited. Only the pixman renderer is
+ * supported. Disabled by default.
+ *
+ * Returns false if the thread couldn't be started.
+ */
+bool wlr_scene_output_set_render_thread(struct wlr_scene_output *scene_output,
+	bool enabled);
+/**
+ * Get a description of a direct scan-out failure reason, e.g. for logging.
+ */
+const char *wlr_scene_scanout_failure_name(
+	enum wlr_scene_scanout_failure failure);
 /**
  * Render and commit an output.
+ *
+ * Direct scan-out is attempted first, the outcome is recorded in
+ * wlr_scene_output.scanout_stats.
  */
 bool wlr_scene_output_commit(struct wlr_scene_output *scene_output);
 /**
  * Call wlr_surface_send_frame_done() on all surfaces in the scene rendered by
  * wlr_scene_output_commit() for which wlr_scene_surface.primary_output
- * matches the given scene_output.
+ * matches the given scene_output. Fully occluded surfaces are throttled, see
+ * wlr_scene_set_hidden_frame_done_interval().
  */
 void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
 	struct timespec *now);
@@ -454,5 +768,17 @@ struct wlr_scene_layer_surface_v1 *wlr_scene_layer_surface_v1_create(
 void wlr_scene_layer_surface_v1_configure(
 	struct wlr_scene_layer_surface_v1 *scene_layer_surface,
 	const struct wlr_box *full_area, struct wlr_box *usable_area);
+/**
+ * Check whether the anchor, margins, exclusive zone, desired size or layer of
+ * the layer surface changed since it was last configured.
+ *
+ * Calling wlr_scene_layer_surface_v1_configure() for all layer surfaces of an
+ * output is cheap when nothing changed: surfaces whose state and areas are
+ * the same as last time aren't configured again. Compositors can skip the
+ * arrangement altogether on commits for which this returns false, e.g. panels
+ * which only update their contents.
+ */
+bool wlr_scene_layer_surface_v1_needs_configure(
+	const struct wlr_scene_layer_surface_v1 *scene_layer_surface);
 
 #endif
@@ -13,6 +13,8 @@
 #include <wayland-server-core.h>
 #include <wlr/util/box.h>
 
+struct wlr_screencopy_v1_readback;
+
 struct wlr_screencopy_manager_v1 {
 	struct wl_global *global;
 	struct wl_list frames; // wlr_screencopy_frame_v1.link
@@ -24,6 +26,11 @@ struct wlr_screencopy_manager_v1 {
 	} events;
 
 	void *data;
+
+	// private state
+
+	struct wl_list readbacks; // wlr_screencopy_v1_readback.link
+	int max_fps; // 0 if unlimited
 };
 
 struct wlr_screencopy_v1_client {
@@ -46,7 +53,7 @@ struct wlr_screencopy_frame_v1 {
 
 	bool with_damage;
 
-	struct wl_shm_buffer *shm_buffer;
+	struct wlr_buffer *shm_buffer; // locked
 	struct wlr_dmabuf_v1_buffer *dma_buffer;
 
 	struct wl_listener buffer_destroy;
@@ -56,10 +63,39 @@ struct wlr_screencopy_frame_v1 {
 	struct wl_listener output_destroy;
 	struct wl_listener output_enable;
 
+	// private state
+
+	// While copying into shm_buffer, possibly shared with other frames
+	struct wlr_screencopy_v1_readback *readback;
+	struct wl_list readback_link; // wlr_screencopy_v1_readback.frames
+	struct wl_resource *buffer_resource;
+	struct wlr_box copy_box; // part of shm_buffer being copied
+	struct timespec commit_time; // of the frame being copied
+	struct wlr_box damage_box; // sent once copied, if with_damage
+	struct wl_event_source *rate_limit_timer;
+	bool output_locked;
+	// Captured by the display hardware instead of copied by the renderer,
+	// see wlr_output_capture
+	bool use_capture;
+	struct wlr_output_capture *capture; // NULL until the next capture
+	struct wl_listener capture_done;
+	// Commit which can't be copied after falling back from a capture
+	uint32_t skip_commit_seq;
+	bool skip_commit;
+
 	void *data;
 };
 
 struct wlr_screencopy_manager_v1 *wlr_screencopy_manager_v1_create(
 	struct wl_display *display);
 
+/**
+ * Limit the rate at which each client can capture an output. Frames requested
+ * sooner are completed on a later commit, so high refresh rate outputs don't
+ * cause more copies than e.g. a 30 fps recorder needs. Zero (the default)
+ * disables the limit.
+ */
+void wlr_screencopy_manager_v1_set_max_fps(
+	struct wlr_screencopy_manager_v1 *manager, int max_fps);
+
 #endif
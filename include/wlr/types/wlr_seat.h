@@ -54,6 +54,10 @@ struct wlr_seat_client {
 	// for use by wlr_seat_client_{next_serial,validate_event_serial}
 	struct wlr_serial_ringset serials;
 	bool needs_touch_frame;
+
+	// private state
+
+	struct wl_list bucket_link; // bucket of wlr_seat.client_buckets
 };
 
 struct wlr_touch_point {
@@ -74,6 +78,13 @@ struct wlr_touch_point {
 	} events;
 
 	struct wl_list link;
+
+	// private state
+
+	// Last motion, sent to the client on the next frame
+	bool motion_pending;
+	uint32_t motion_time;
+	double motion_sx, motion_sy;
 };
 
 struct wlr_seat_pointer_grab;
@@ -157,6 +168,7 @@ struct wlr_seat_pointer_grab {
 };
 
 #define WLR_POINTER_BUTTONS_CAP 16
+#define WLR_SEAT_TOUCH_SLOTS 16
 
 struct wlr_seat_pointer_state {
 	struct wlr_seat *seat;
@@ -214,6 +226,13 @@ struct wlr_seat_touch_state {
 
 	struct wlr_seat_touch_grab *grab;
 	struct wlr_seat_touch_grab *default_grab;
+
+	// private state
+
+	// Touch points by touch ID modulo WLR_SEAT_TOUCH_SLOTS, points whose
+	// slot is taken are only in touch_points
+	struct wlr_touch_point *point_slots[WLR_SEAT_TOUCH_SLOTS];
+	int num_points;
 };
 
 struct wlr_primary_selection_source;
@@ -285,6 +304,15 @@ struct wlr_seat {
 	} events;
 
 	void *data;
+
+	// private state
+
+	// Hash table of wlr_seat_client.bucket_link indexed by wl_client
+	struct wl_list *client_buckets;
+	size_t client_buckets_len; // power of two, 0 if not allocated
+	size_t clients_len;
+
+	struct wlr_input_latency *input_latency; // may be NULL
 };
 
 struct wlr_seat_pointer_request_set_cursor_event {
@@ -609,8 +637,9 @@ void wlr_seat_touch_send_up(struct wlr_seat *seat, uint32_t time_msec,
 /**
  * Send a touch motion event for the touch point given by the `touch_id`. The
  * event will go to the client for the surface given in the corresponding touch
- * down event. This function does not respect touch grabs: you probably want
- * wlr_seat_touch_notify_motion() instead.
+ * down event. Motion is coalesced per touch point and delivered on the next
+ * up event or frame. This function does not respect touch grabs: you probably
+ * want wlr_seat_touch_notify_motion() instead.
  */
 void wlr_seat_touch_send_motion(struct wlr_seat *seat, uint32_t time_msec,
 		int32_t touch_id, double sx, double sy);
@@ -13,6 +13,9 @@
 #include <stdint.h>
 #include <wayland-server-core.h>
 
+struct wlr_buffer;
+struct wlr_output;
+
 struct wlr_session_lock_manager_v1 {
 	struct wl_global *global;
 
@@ -91,6 +94,40 @@ uint32_t wlr_session_lock_surface_v1_configure(
 	struct wlr_session_lock_surface_v1 *lock_surface,
 	uint32_t width, uint32_t height);
 
+/**
+ * A solid color buffer rendered ahead of time, which covers an output as soon
+ * as the session is locked, without waiting for the lock client to map a lock
+ * surface nor for a frame to be rendered.
+ */
+struct wlr_session_lock_blank_v1 {
+	struct wlr_output *output;
+	float color[4];
+
+	// private state
+
+	struct wlr_buffer *buffer;
+	struct wl_listener output_destroy;
+};
+
+/**
+ * Pre-render a blank buffer for an output, which must be enabled and have
+ * rendering initialized. The output's pending state is discarded.
+ *
+ * The blank is destroyed along with the output.
+ */
+struct wlr_session_lock_blank_v1 *wlr_session_lock_blank_v1_create(
+	struct wlr_output *output, const float color[static 4]);
+void wlr_session_lock_blank_v1_destroy(struct wlr_session_lock_blank_v1 *blank);
+/**
+ * Commit the blank buffer along with the output's pending state. Compositors
+ * should call this for every output when a new lock is created, and send the
+ * locked event once all of the commits succeeded.
+ *
+ * The buffer is scanned out as-is, unless the output mode changed since it
+ * was rendered, in which case it's rendered again.
+ */
+bool wlr_session_lock_blank_v1_commit(struct wlr_session_lock_blank_v1 *blank);
+
 bool wlr_surface_is_session_lock_surface_v1(struct wlr_surface *surface);
 struct wlr_session_lock_surface_v1 *wlr_session_lock_surface_v1_from_wlr_surface(
 	struct wlr_surface *surface);
@@ -0,0 +1,46 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_SINGLE_PIXEL_BUFFER_V1_H
+#define WLR_TYPES_WLR_SINGLE_PIXEL_BUFFER_V1_H
+
+#include <stdbool.h>
+#include <wayland-server-core.h>
+
+struct wlr_buffer;
+
+/**
+ * Implementation for the single-pixel-buffer-v1 protocol.
+ *
+ * Clients use single-pixel buffers, scaled with viewporter, for solid-colored
+ * surfaces. Surfaces showing them don't hold a texture, the scene-graph draws
+ * them as color fills.
+ */
+struct wlr_single_pixel_buffer_manager_v1 {
+	struct wl_global *global;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	// private state
+
+	struct wl_listener display_destroy;
+};
+
+struct wlr_single_pixel_buffer_manager_v1 *
+	wlr_single_pixel_buffer_manager_v1_create(struct wl_display *display);
+
+/**
+ * Get the color of a single-pixel buffer, as premultiplied RGBA. Returns
+ * false if the buffer isn't a single-pixel buffer.
+ */
+bool wlr_single_pixel_buffer_v1_get_color(struct wlr_buffer *buffer,
+	float color[static 4]);
+
+#endif
@@ -120,6 +120,24 @@ struct wlr_tablet_v2_event_cursor {
 	struct wlr_seat_client *seat_client;
 };
 
+/**
+ * A set of tool axes which changed in a single hardware frame. Only the axes
+ * set in updated (a bitfield of enum wlr_tablet_tool_axes) are meaningful.
+ * Motion and tilt are always sent as a pair: if either component is updated,
+ * both must be valid.
+ */
+struct wlr_tablet_v2_tool_axes {
+	uint32_t updated;
+	double x, y;
+	double pressure;
+	double distance;
+	double tilt_x, tilt_y;
+	double rotation;
+	double slider;
+	double wheel_delta;
+	int32_t wheel_clicks;
+};
+
 struct wlr_tablet_v2_event_feedback {
 	const char *description;
 	size_t index;
@@ -172,6 +190,14 @@ void wlr_send_tablet_v2_tablet_tool_slider(
 void wlr_send_tablet_v2_tablet_tool_wheel(
 	struct wlr_tablet_v2_tablet_tool *tool, double degrees, int32_t clicks);
 
+/**
+ * Send all updated axes of a hardware frame at once. Values which didn't
+ * change since they were last sent to the focused client are skipped.
+ */
+void wlr_send_tablet_v2_tablet_tool_axes(
+	struct wlr_tablet_v2_tablet_tool *tool,
+	const struct wlr_tablet_v2_tool_axes *axes);
+
 void wlr_send_tablet_v2_tablet_tool_proximity_out(
 	struct wlr_tablet_v2_tablet_tool *tool);
 
@@ -210,6 +236,10 @@ void wlr_tablet_v2_tablet_tool_notify_slider(
 void wlr_tablet_v2_tablet_tool_notify_wheel(
 	struct wlr_tablet_v2_tablet_tool *tool, double degrees, int32_t clicks);
 
+void wlr_tablet_v2_tablet_tool_notify_axes(
+	struct wlr_tablet_v2_tablet_tool *tool,
+	const struct wlr_tablet_v2_tool_axes *axes);
+
 void wlr_tablet_v2_tablet_tool_notify_proximity_out(
 	struct wlr_tablet_v2_tablet_tool *tool);
 
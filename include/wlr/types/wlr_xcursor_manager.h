@@ -20,6 +20,11 @@ struct wlr_xcursor_manager_theme {
 	float scale;
 	struct wlr_xcursor_theme *theme;
 	struct wl_list link;
+
+	// private state
+
+	// most recently used cursors, most recent first
+	struct wlr_xcursor *recent[4];
 };
 
 /**
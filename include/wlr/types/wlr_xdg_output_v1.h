@@ -39,6 +39,12 @@ struct wlr_xdg_output_manager_v1 {
 	struct wl_listener layout_add;
 	struct wl_listener layout_change;
 	struct wl_listener layout_destroy;
+
+	// private state
+
+	struct wl_event_loop *event_loop;
+	// Layout changes are coalesced until the event loop is idle
+	struct wl_event_source *idle_update;
 };
 
 struct wlr_xdg_output_manager_v1 *wlr_xdg_output_manager_v1_create(
@@ -109,6 +109,17 @@ struct wlr_xdg_popup {
 	} events;
 
 	struct wl_list grab_link; // wlr_xdg_popup_grab.popups
+
+	// private state
+
+	// Result of the last wlr_xdg_popup_unconstrain_from_box() call, re-used
+	// while its inputs don't change
+	struct {
+		bool valid;
+		struct wlr_xdg_positioner_rules rules;
+		struct wlr_box constraint, geometry;
+		struct wlr_box result;
+	} unconstrain_cache;
 };
 
 // each seat gets a popup grab
@@ -276,6 +287,14 @@ struct wlr_xdg_surface {
 	} events;
 
 	void *data;
+
+	// private state
+
+	// See wlr_xdg_surface_set_configure_output()
+	struct wlr_output *configure_output;
+	bool configure_frame_pending;
+	struct wl_listener configure_output_frame;
+	struct wl_listener configure_output_destroy;
 };
 
 struct wlr_xdg_toplevel_move_event {
@@ -499,4 +518,17 @@ void wlr_xdg_surface_for_each_popup_surface(struct wlr_xdg_surface *surface,
  */
 uint32_t wlr_xdg_surface_schedule_configure(struct wlr_xdg_surface *surface);
 
+/**
+ * Align the configure events of the surface with the frames of the output:
+ * scheduled state changes are merged and sent on the next frame event of the
+ * output, so that at most one configure is sent per refresh cycle. This keeps
+ * client wake-ups and buffer re-allocations bounded during interactive
+ * resizes.
+ *
+ * Passing a NULL output restores the default behavior, where configure events
+ * are sent once the event loop is idle.
+ */
+void wlr_xdg_surface_set_configure_output(struct wlr_xdg_surface *surface,
+	struct wlr_output *output);
+
 #endif
@@ -11,13 +11,17 @@
 
 #include <wayland-server-core.h>
 
+#define WLR_ADDON_SET_CACHE_SIZE 4
+
+struct wlr_addon;
+
 struct wlr_addon_set {
 	// private state
 	struct wl_list addons;
+	// recently found addons, indexed by a hash of their owner and interface
+	struct wlr_addon *cache[WLR_ADDON_SET_CACHE_SIZE];
 };
 
-struct wlr_addon;
-
 struct wlr_addon_interface {
 	const char *name;
 	// Has to call wlr_addon_finish()
@@ -28,6 +32,7 @@ struct wlr_addon {
 	const struct wlr_addon_interface *impl;
 	// private state
 	const void *owner;
+	struct wlr_addon_set *set;
 	struct wl_list link;
 };
 
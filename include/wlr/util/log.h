@@ -18,6 +18,7 @@
 
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 
@@ -48,6 +49,36 @@ void wlr_log_init(enum wlr_log_importance verbosity, wlr_log_func_t callback);
  */
 enum wlr_log_importance wlr_log_get_verbosity(void);
 
+enum wlr_log_async_overflow {
+	// Drop messages, the number of dropped messages is logged later
+	WLR_LOG_ASYNC_DROP,
+	// Wait for the writer thread to make room
+	WLR_LOG_ASYNC_WAIT,
+};
+
+/**
+ * Make the default logger write asynchronously. Messages are formatted into a
+ * ring buffer of at least buffer_size bytes, which a background thread writes
+ * to stderr. The overflow policy decides what to do when the buffer is full.
+ *
+ * Messages logged by other threads than the caller's are written
+ * synchronously. Asynchronous logging can't be disabled afterwards. Pending
+ * messages are flushed at exit.
+ *
+ * Returns false if the writer thread couldn't be started, in which case
+ * messages are still written synchronously.
+ */
+bool wlr_log_init_async(size_t buffer_size,
+	enum wlr_log_async_overflow overflow);
+
+/**
+ * Write the pending messages of the asynchronous logger. This function is
+ * async-signal-safe, and meant to be called from a crash handler: messages
+ * are left to the logger thread, so they may be repeated. Exiting normally
+ * already waits for the pending messages to be written.
+ */
+void wlr_log_flush(void);
+
 #ifdef __GNUC__
 #define _WLR_ATTRIB_PRINTF(start, end) __attribute__((format(printf, start, end)))
 #else
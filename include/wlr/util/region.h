@@ -52,6 +52,23 @@ void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
 void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
 	float rotation, int ox, int oy);
 
+/**
+ * Variants of wlr_region_scale_xy(), wlr_region_transform() and
+ * wlr_region_expand() working on `len` boxes, e.g. the rectangles of a
+ * region. The results are written to `dst`, which may be `src`: these don't
+ * allocate, the caller provides the storage.
+ *
+ * Unlike the region functions, these don't build a region from the results:
+ * pass them to pixman_region32_init_rects() if needed.
+ */
+void wlr_region_scale_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+	int len, float scale_x, float scale_y);
+void wlr_region_transform_boxes(pixman_box32_t *dst,
+	const pixman_box32_t *src, int len,
+	enum wl_output_transform transform, int width, int height);
+void wlr_region_expand_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+	int len, int distance);
+
 bool wlr_region_confine(pixman_region32_t *region, double x1, double y1, double x2,
 	double y2, double *x2_out, double *y2_out);
 
@@ -0,0 +1,25 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_UTIL_TRIM_H
+#define WLR_UTIL_TRIM_H
+
+/**
+ * How much memory to give back when trimming caches, e.g. in response to
+ * memory pressure. See wlr_renderer_trim(), wlr_output_trim() and
+ * wlr_scene_trim().
+ */
+enum wlr_trim_level {
+	// Drop caches of resources which are not in use
+	WLR_TRIM_MODERATE,
+	// Also drop caches which are expensive to re-create, e.g. the imports of
+	// buffers rendered to every frame
+	WLR_TRIM_CRITICAL,
+};
+
+#endif
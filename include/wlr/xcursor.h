@@ -68,16 +68,37 @@ struct wlr_xcursor {
 	struct wlr_xcursor_image **images;
 	char *name;
 	uint32_t total_delay; /* total duration of the animation in ms */
+
+	// private state
+
+	// image storage shared with other themes, NULL if the buffers are owned
+	struct _XcursorImages *shared_images;
 };
 
+struct wlr_xcursor_theme_entry;
+
 /**
  * Container for an Xcursor theme.
+ *
+ * Cursor files are only decoded when first requested with
+ * wlr_xcursor_theme_get_cursor(), so cursors only contains the cursors
+ * requested so far. Image buffers are shared between themes picking the same
+ * images from a cursor file and must not be modified.
  */
 struct wlr_xcursor_theme {
 	unsigned int cursor_count;
 	struct wlr_xcursor **cursors;
 	char *name;
 	int size;
+
+	// private state
+
+	// cursor files of the theme, in lookup order
+	unsigned int entry_count;
+	struct wlr_xcursor_theme_entry *entries;
+	// entry indices hashed by name, see wlr_xcursor_theme_get_cursor()
+	unsigned int entry_buckets_len;
+	unsigned int *entry_buckets;
 };
 
 /**
@@ -119,6 +140,13 @@ struct wlr_xcursor *wlr_xcursor_theme_get_cursor(
  */
 int wlr_xcursor_frame(struct wlr_xcursor *cursor, uint32_t time);
 
+/**
+ * Same as wlr_xcursor_frame(), but also returns in duration the time left (in
+ * ms) until the next frame, or zero for static cursors.
+ */
+int wlr_xcursor_frame_and_duration(struct wlr_xcursor *cursor, uint32_t time,
+	uint32_t *duration);
+
 /**
  * Get the name of the resize cursor for the given edges.
  */
@@ -26,6 +26,9 @@ struct wlr_xwayland_server_options {
 	bool no_touch_pointer_emulation;
 	bool force_xrandr_emulation;
 	int terminate_delay; // in seconds, 0 to terminate immediately
+	// In lazy mode, start Xwayland after this many seconds even if no client
+	// connected yet, 0 to only start it on demand
+	int warm_delay;
 };
 
 struct wlr_xwayland_server {
@@ -42,6 +45,7 @@ struct wlr_xwayland_server {
 	char display_name[16];
 	int x_fd[2];
 	struct wl_event_source *x_fd_read_event[2];
+	struct wl_event_source *warm_timer;
 	struct wlr_xwayland_server_options options;
 
 	struct wl_display *wl_display;
@@ -198,6 +202,12 @@ struct wlr_xwayland_surface {
 	struct wl_listener surface_destroy;
 
 	void *data;
+
+	// private state
+
+	// X11 replies not received yet, the surface isn't mapped until they are
+	int pending_replies;
+	struct wl_list bucket_link; // bucket of wlr_xwm.surface_buckets
 };
 
 struct wlr_xwayland_surface_configure_event {
@@ -234,7 +244,9 @@ void wlr_xwayland_server_destroy(struct wlr_xwayland_server *server);
 /** Create an Xwayland server and XWM.
  *
  * The server supports a lazy mode in which Xwayland is only started when a
- * client tries to connect.
+ * client tries to connect. In lazy mode, the WLR_XWAYLAND_WARM_DELAY
+ * environment variable can be set to start Xwayland in the background a few
+ * seconds after compositor startup.
  */
 struct wlr_xwayland *wlr_xwayland_create(struct wl_display *wl_display,
 	struct wlr_compositor *compositor, bool lazy);
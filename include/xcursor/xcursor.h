@@ -27,6 +27,8 @@
 #define XCURSOR_H
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 
 typedef int XcursorBool;
 typedef uint32_t XcursorUInt;
@@ -52,13 +54,25 @@ typedef struct _XcursorImages {
     int		    nimage;	/* number of images */
     XcursorImage    **images;	/* array of XcursorImage pointers */
     char	    *name;	/* name used to load images */
+
+    /* shared by all loads of the same file and size, see xcursor_load_images */
+    int		    refcount;
+    dev_t	    dev;
+    ino_t	    ino;
+    off_t	    file_size;
+    struct timespec mtime;
+    XcursorDim	    size;	/* size of the images picked from the file */
+    struct _XcursorImages *next;
 } XcursorImages;
 
 void
 XcursorImagesDestroy (XcursorImages *images);
 
 void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
+xcursor_index_theme(const char *theme,
+		    void (*index_callback)(const char *, const char *, void *),
 		    void *user_data);
+
+XcursorImages *
+xcursor_load_images(const char *path, const char *name, int size);
 #endif
@@ -3,7 +3,10 @@
 
 #include <xcb/xfixes.h>
 
+// Bounds of the size of the chunks transferred at once, the actual size
+// depends on the maximum request length of the X server
 #define INCR_CHUNK_SIZE (64 * 1024)
+#define MAX_INCR_CHUNK_SIZE (1024 * 1024)
 
 #define XDND_VERSION 5
 
@@ -28,6 +31,7 @@ struct wlr_xwm_selection_transfer {
 	// when receiving from x11
 	int property_start;
 	xcb_get_property_reply_t *property_reply;
+	uint32_t property_offset; // of the next read, in 32-bit units
 	xcb_window_t incoming_window;
 };
 
@@ -38,6 +42,7 @@ struct wlr_xwm_selection {
 	xcb_window_t window;
 	xcb_window_t owner;
 	xcb_timestamp_t timestamp;
+	size_t chunk_size; // in bytes, multiple of 4
 
 	struct wl_list incoming;
 	struct wl_list outgoing;
@@ -89,6 +89,11 @@ enum atom_name {
 
 extern const char *const atom_map[ATOM_LAST];
 
+#define ATOM_NAME_BUCKETS 256
+
+// Number of buckets of wlr_xwm.unpaired_surfaces
+#define XWM_UNPAIRED_SURFACE_BUCKETS 64
+
 struct wlr_xwm {
 	struct wlr_xwayland *xwayland;
 	struct wl_event_source *event_source;
@@ -112,10 +117,29 @@ struct wlr_xwm {
 
 	// Surfaces in creation order
 	struct wl_list surfaces; // wlr_xwayland_surface::link
+	size_t surfaces_len;
+	// Hash table of surfaces by window ID
+	struct wl_list *surface_buckets;
+	size_t surface_buckets_len; // power of two, 0 if not allocated
 	// Surfaces in bottom-to-top stacking order, for _NET_CLIENT_LIST_STACKING
 	struct wl_list surfaces_in_stack_order; // wlr_xwayland_surface::stack_link
-	struct wl_list unpaired_surfaces; // wlr_xwayland_surface::unpaired_link
+	// Hash table of surfaces waiting for their wl_surface, by surface ID.
+	// Buckets of wlr_xwayland_surface::unpaired_link.
+	struct wl_list unpaired_surfaces[XWM_UNPAIRED_SURFACE_BUCKETS];
 	struct wl_list pending_startup_ids; // pending_startup_id
+	// Requests waiting for a reply, in sequence order
+	struct wl_list pending_replies; // xwm_pending_reply.link
+
+	// Mapped windows in map order, for _NET_CLIENT_LIST
+	struct wl_array client_list; // xcb_window_t
+
+	// Names of atoms, which never change for the lifetime of the X server
+	struct wl_list atom_names[ATOM_NAME_BUCKETS]; // xwm_atom_name.link
+	size_t atom_names_len;
+	// Root window properties are written at most once per event loop
+	// iteration, when this idle source fires
+	struct wl_event_source *client_list_idle;
+	bool client_list_dirty, client_list_stacking_dirty;
 
 	struct wlr_drag *drag;
 	struct wlr_xwayland_surface *drag_focus;
@@ -153,7 +177,16 @@ int xwm_handle_selection_client_message(struct wlr_xwm *xwm,
 
 void xwm_set_seat(struct wlr_xwm *xwm, struct wlr_seat *seat);
 
+/**
+ * Get the name of an atom. The returned string must be freed by the caller.
+ * Blocks on a round-trip unless the name is cached.
+ */
 char *xwm_get_atom_name(struct wlr_xwm *xwm, xcb_atom_t atom);
+/**
+ * Fetch the names of the atoms not cached yet, with a single round-trip.
+ */
+void xwm_cache_atom_names(struct wlr_xwm *xwm, const xcb_atom_t *atoms,
+	size_t atoms_len);
 bool xwm_atoms_contains(struct wlr_xwm *xwm, xcb_atom_t *atoms,
 	size_t num_atoms, enum atom_name needle);
 
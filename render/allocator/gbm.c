@@ -148,6 +148,7 @@ static struct wlr_gbm_buffer *create_buffer(struct wlr_gbm_allocator *alloc,
 static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
 	struct wlr_gbm_buffer *buffer =
 		get_gbm_buffer_from_buffer(wlr_buffer);
+	dmabuf_mapping_finish(&buffer->mapping);
 	wlr_dmabuf_attributes_finish(&buffer->dmabuf);
 	if (buffer->gbm_bo != NULL) {
 		gbm_bo_destroy(buffer->gbm_bo);
@@ -164,9 +165,25 @@ static bool buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
 	return true;
 }
 
+static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct wlr_gbm_buffer *buffer =
+		get_gbm_buffer_from_buffer(wlr_buffer);
+	return dmabuf_mapping_begin_access(&buffer->mapping, &buffer->dmabuf,
+		flags, data, format, stride);
+}
+
+static void buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	struct wlr_gbm_buffer *buffer =
+		get_gbm_buffer_from_buffer(wlr_buffer);
+	dmabuf_mapping_end_access(&buffer->mapping, &buffer->dmabuf);
+}
+
 static const struct wlr_buffer_impl buffer_impl = {
 	.destroy = buffer_destroy,
 	.get_dmabuf = buffer_get_dmabuf,
+	.begin_data_ptr_access = buffer_begin_data_ptr_access,
+	.end_data_ptr_access = buffer_end_data_ptr_access,
 };
 
 static const struct wlr_allocator_interface allocator_impl;
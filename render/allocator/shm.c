@@ -1,6 +1,9 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <wlr/interfaces/wlr_buffer.h>
@@ -12,7 +15,15 @@
 #include "render/allocator/shm.h"
 #include "util/shm.h"
 
+// Size of the huge pages backing large buffers (PMD size on x86_64 and
+// aarch64 with 4 KiB pages). Other sizes make the huge page paths fail and
+// fall back to regular pages.
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+// Alignment of the rows of huge page buffers
+#define STRIDE_ALIGN 64
+
 static const struct wlr_buffer_impl buffer_impl;
+static const struct wlr_allocator_interface allocator_impl;
 
 static struct wlr_shm_buffer *shm_buffer_from_buffer(
 		struct wlr_buffer *wlr_buffer) {
@@ -54,9 +65,87 @@ static const struct wlr_buffer_impl buffer_impl = {
 	.end_data_ptr_access = shm_buffer_end_data_ptr_access,
 };
 
+static struct wlr_shm_allocator *shm_allocator_from_allocator(
+		struct wlr_allocator *wlr_allocator) {
+	assert(wlr_allocator->impl == &allocator_impl);
+	return (struct wlr_shm_allocator *)wlr_allocator;
+}
+
+static size_t align(size_t size, size_t alignment) {
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+#if defined(MFD_HUGETLB) && defined(MADV_HUGEPAGE)
+static int allocate_memfd(size_t size, unsigned int flags) {
+	int fd = memfd_create("wlroots-shm", MFD_CLOEXEC | flags);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int ret;
+	do {
+		ret = ftruncate(fd, size);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+#endif
+
+/**
+ * Allocate and map a buffer backed by huge pages, using hugetlbfs if pages are
+ * reserved, or else transparent huge pages. Returns false if neither is
+ * supported, without logging anything.
+ */
+static bool allocate_hugepages(struct wlr_shm_buffer *buffer) {
+#if defined(MFD_HUGETLB) && defined(MADV_HUGEPAGE)
+	// hugetlbfs pages are reserved when mapping, this fails if none are left
+	int fd = allocate_memfd(buffer->size, MFD_HUGETLB);
+	if (fd >= 0) {
+		void *data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+		if (data != MAP_FAILED) {
+			buffer->shm.fd = fd;
+			buffer->data = data;
+			return true;
+		}
+		close(fd);
+	}
+
+	// memfds are on the internal shmem mount, which honors MADV_HUGEPAGE
+	// when /sys/kernel/mm/transparent_hugepage/shmem_enabled is "advise"
+	fd = allocate_memfd(buffer->size, 0);
+	if (fd < 0) {
+		return false;
+	}
+	void *data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	if (madvise(data, buffer->size, MADV_HUGEPAGE) != 0) {
+		munmap(data, buffer->size);
+		close(fd);
+		return false;
+	}
+	buffer->shm.fd = fd;
+	buffer->data = data;
+	return true;
+#else
+	return false;
+#endif
+}
+
 static struct wlr_buffer *allocator_create_buffer(
 		struct wlr_allocator *wlr_allocator, int width, int height,
 		const struct wlr_drm_format *format) {
+	struct wlr_shm_allocator *allocator =
+		shm_allocator_from_allocator(wlr_allocator);
+
 	const struct wlr_pixel_format_info *info =
 		drm_get_pixel_format_info(format->format);
 	if (info == NULL) {
@@ -74,10 +163,39 @@ static struct wlr_buffer *allocator_create_buffer(
 	int bytes_per_pixel = info->bpp / 8;
 	int stride = width * bytes_per_pixel; // TODO: align?
 	buffer->size = stride * height;
-	buffer->shm.fd = allocate_shm_file(buffer->size);
-	if (buffer->shm.fd < 0) {
-		free(buffer);
-		return NULL;
+
+	// Only worth it for buffers spanning several huge pages, e.g. the
+	// swapchain of a large output rendered with pixman
+	bool hugepages = false;
+	if (allocator->hugepages && buffer->size >= 2 * HUGEPAGE_SIZE) {
+		size_t aligned_stride = align(stride, STRIDE_ALIGN);
+		size_t aligned_size =
+			align(aligned_stride * height, HUGEPAGE_SIZE);
+		size_t size = buffer->size;
+		buffer->size = aligned_size;
+		hugepages = allocate_hugepages(buffer);
+		if (hugepages) {
+			stride = aligned_stride;
+		} else {
+			buffer->size = size;
+		}
+	}
+
+	if (!hugepages) {
+		buffer->shm.fd = allocate_shm_file(buffer->size);
+		if (buffer->shm.fd < 0) {
+			free(buffer);
+			return NULL;
+		}
+
+		buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, buffer->shm.fd, 0);
+		if (buffer->data == MAP_FAILED) {
+			wlr_log_errno(WLR_ERROR, "mmap failed");
+			close(buffer->shm.fd);
+			free(buffer);
+			return NULL;
+		}
 	}
 
 	buffer->shm.format = format->format;
@@ -86,15 +204,6 @@ static struct wlr_buffer *allocator_create_buffer(
 	buffer->shm.stride = stride;
 	buffer->shm.offset = 0;
 
-	buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED,
-		buffer->shm.fd, 0);
-	if (buffer->data == MAP_FAILED) {
-		wlr_log_errno(WLR_ERROR, "mmap failed");
-		close(buffer->shm.fd);
-		free(buffer);
-		return NULL;
-	}
-
 	return &buffer->base;
 }
 
@@ -115,6 +224,11 @@ struct wlr_allocator *wlr_shm_allocator_create(void) {
 	wlr_allocator_init(&allocator->base, &allocator_impl,
 		WLR_BUFFER_CAP_DATA_PTR | WLR_BUFFER_CAP_SHM);
 
-	wlr_log(WLR_DEBUG, "Created shm allocator");
+	const char *hugepages_env = getenv("WLR_SHM_HUGEPAGES");
+	allocator->hugepages = hugepages_env != NULL &&
+		strcmp(hugepages_env, "1") == 0;
+
+	wlr_log(WLR_DEBUG, "Created shm allocator%s",
+		allocator->hugepages ? " with huge pages" : "");
 	return &allocator->base;
 }
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/log.h>
+#include "render/allocator/allocator.h"
+#include "render/buffer_pool.h"
+#include "render/drm_format_set.h"
+
+static void pool_handle_allocator_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_buffer_pool *pool =
+		wl_container_of(listener, pool, allocator_destroy);
+	pool->allocator = NULL;
+}
+
+struct wlr_buffer_pool *wlr_buffer_pool_create(struct wlr_allocator *alloc,
+		size_t max_released) {
+	assert(max_released > 0);
+
+	struct wlr_buffer_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	pool->allocator = alloc;
+	pool->max_released = max_released;
+	wl_list_init(&pool->entries);
+
+	pool->allocator_destroy.notify = pool_handle_allocator_destroy;
+	wl_signal_add(&alloc->events.destroy, &pool->allocator_destroy);
+
+	return pool;
+}
+
+static void entry_destroy(struct wlr_buffer_pool_entry *entry) {
+	if (entry->acquired) {
+		wl_list_remove(&entry->release.link);
+	} else {
+		entry->pool->released_len--;
+	}
+	wl_list_remove(&entry->link);
+	wlr_buffer_drop(entry->buffer);
+	free(entry);
+}
+
+void wlr_buffer_pool_destroy(struct wlr_buffer_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+	struct wlr_buffer_pool_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &pool->entries, link) {
+		entry_destroy(entry);
+	}
+	wl_list_remove(&pool->allocator_destroy.link);
+	free(pool);
+}
+
+void wlr_buffer_pool_trim(struct wlr_buffer_pool *pool, size_t max_released) {
+	struct wlr_buffer_pool_entry *entry, *tmp;
+	wl_list_for_each_reverse_safe(entry, tmp, &pool->entries, link) {
+		if (pool->released_len <= max_released) {
+			break;
+		}
+		if (!entry->acquired) {
+			entry_destroy(entry);
+		}
+	}
+}
+
+static void entry_handle_release(struct wl_listener *listener, void *data) {
+	struct wlr_buffer_pool_entry *entry =
+		wl_container_of(listener, entry, release);
+	struct wlr_buffer_pool *pool = entry->pool;
+
+	wl_list_remove(&entry->release.link);
+	entry->acquired = false;
+	pool->released_len++;
+
+	wl_list_remove(&entry->link);
+	wl_list_insert(&pool->entries, &entry->link);
+
+	// The buffer is being released, it can't be destroyed from here. It's the
+	// most recently released one, so it's trimmed last and max_released is
+	// never zero.
+	wlr_buffer_pool_trim(pool, pool->max_released);
+}
+
+static struct wlr_buffer *entry_acquire(struct wlr_buffer_pool_entry *entry) {
+	assert(!entry->acquired);
+
+	// Keep acquired entries out of the way of released ones
+	wl_list_remove(&entry->link);
+	wl_list_insert(entry->pool->entries.prev, &entry->link);
+
+	entry->acquired = true;
+	entry->release.notify = entry_handle_release;
+	wl_signal_add(&entry->buffer->events.release, &entry->release);
+
+	return wlr_buffer_lock(entry->buffer);
+}
+
+static bool entry_matches(const struct wlr_buffer_pool_entry *entry,
+		int width, int height, const struct wlr_drm_format *format) {
+	if (entry->acquired || entry->width != width ||
+			entry->height != height || entry->format != format->format) {
+		return false;
+	}
+	return !entry->has_modifier || format->len == 0 ||
+		wlr_drm_format_has(format, entry->modifier);
+}
+
+struct wlr_buffer *wlr_buffer_pool_acquire(struct wlr_buffer_pool *pool,
+		int width, int height, const struct wlr_drm_format *format) {
+	struct wlr_buffer_pool_entry *entry;
+	wl_list_for_each(entry, &pool->entries, link) {
+		if (entry_matches(entry, width, height, format)) {
+			pool->released_len--;
+			return entry_acquire(entry);
+		}
+	}
+
+	if (pool->allocator == NULL) {
+		return NULL;
+	}
+
+	struct wlr_buffer *buffer =
+		wlr_allocator_create_buffer(pool->allocator, width, height, format);
+	if (buffer == NULL && pool->released_len > 0) {
+		// Give the memory held by released buffers back, and try again
+		wlr_log(WLR_DEBUG, "Allocation failed, trimming buffer pool "
+			"(%zu released buffers)", pool->released_len);
+		wlr_buffer_pool_trim(pool, 0);
+		buffer = wlr_allocator_create_buffer(pool->allocator,
+			width, height, format);
+	}
+	if (buffer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to allocate buffer");
+		return NULL;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		wlr_buffer_drop(buffer);
+		return NULL;
+	}
+	entry->pool = pool;
+	entry->buffer = buffer;
+	entry->width = width;
+	entry->height = height;
+	entry->format = format->format;
+
+	struct wlr_dmabuf_attributes dmabuf;
+	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		entry->has_modifier = true;
+		entry->modifier = dmabuf.modifier;
+	}
+
+	wl_list_insert(&pool->entries, &entry->link);
+	return entry_acquire(entry);
+}
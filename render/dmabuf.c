@@ -1,8 +1,43 @@
 #define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <linux/ioctl.h>
+#include <linux/sync_file.h>
+#include <linux/types.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/util/log.h>
+#include "render/dmabuf.h"
+
+// Copied from <linux/dma-buf.h>
+struct dma_buf_sync {
+	__u64 flags;
+};
+
+#define DMA_BUF_SYNC_START (0 << 2)
+#define DMA_BUF_SYNC_END (1 << 2)
+
+// Copied from <linux/dma-buf.h>, only available since Linux 6.0
+struct dma_buf_export_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+struct dma_buf_import_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+
+#define DMA_BUF_BASE 'b'
+#define DMA_BUF_IOCTL_SYNC _IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
+#define DMA_BUF_IOCTL_EXPORT_SYNC_FILE \
+	_IOWR(DMA_BUF_BASE, 2, struct dma_buf_export_sync_file)
+#define DMA_BUF_IOCTL_IMPORT_SYNC_FILE \
+	_IOW(DMA_BUF_BASE, 3, struct dma_buf_import_sync_file)
 
 void wlr_dmabuf_attributes_finish(struct wlr_dmabuf_attributes *attribs) {
 	for (int i = 0; i < attribs->n_planes; ++i) {
@@ -35,3 +70,159 @@ error:
 	dst->n_planes = 0;
 	return false;
 }
+
+bool dmabuf_import_sync_file(const struct wlr_dmabuf_attributes *dmabuf,
+		uint32_t flags, int sync_file_fd) {
+	for (int i = 0; i < dmabuf->n_planes; ++i) {
+		struct dma_buf_import_sync_file data = {
+			.flags = flags,
+			.fd = sync_file_fd,
+		};
+		if (ioctl(dmabuf->fd[i], DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &data) != 0) {
+			static bool warned = false;
+			if (!warned || errno != ENOTTY) {
+				wlr_log_errno(WLR_DEBUG, "DMA_BUF_IOCTL_IMPORT_SYNC_FILE failed");
+				warned = true;
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+static int sync_file_merge(int fd1, int fd2) {
+	struct sync_merge_data data = { .fd2 = fd2 };
+	strncpy(data.name, "wlroots", sizeof(data.name) - 1);
+	if (ioctl(fd1, SYNC_IOC_MERGE, &data) != 0) {
+		wlr_log_errno(WLR_ERROR, "SYNC_IOC_MERGE failed");
+		return -1;
+	}
+	return data.fence;
+}
+
+int dmabuf_export_sync_file(const struct wlr_dmabuf_attributes *dmabuf,
+		uint32_t flags) {
+	int sync_file_fd = -1;
+	for (int i = 0; i < dmabuf->n_planes; ++i) {
+		struct dma_buf_export_sync_file data = {
+			.flags = flags,
+			.fd = -1,
+		};
+		if (ioctl(dmabuf->fd[i], DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &data) != 0) {
+			static bool warned = false;
+			if (!warned || errno != ENOTTY) {
+				wlr_log_errno(WLR_DEBUG, "DMA_BUF_IOCTL_EXPORT_SYNC_FILE failed");
+				warned = true;
+			}
+			goto error;
+		}
+
+		if (sync_file_fd < 0) {
+			sync_file_fd = data.fd;
+			continue;
+		}
+
+		// Planes usually share the same buffer object, but may not
+		int merged_fd = sync_file_merge(sync_file_fd, data.fd);
+		close(data.fd);
+		close(sync_file_fd);
+		sync_file_fd = merged_fd;
+		if (sync_file_fd < 0) {
+			goto error;
+		}
+	}
+	return sync_file_fd;
+
+error:
+	if (sync_file_fd >= 0) {
+		close(sync_file_fd);
+	}
+	return -1;
+}
+
+static bool dmabuf_sync(int fd, uint64_t flags) {
+	struct dma_buf_sync data = { .flags = flags };
+	int ret;
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &data);
+	} while (ret != 0 && (errno == EINTR || errno == EAGAIN));
+	if (ret != 0) {
+		wlr_log_errno(WLR_ERROR, "DMA_BUF_IOCTL_SYNC failed");
+		return false;
+	}
+	return true;
+}
+
+static bool dmabuf_mapping_map(struct dmabuf_mapping *mapping,
+		const struct wlr_dmabuf_attributes *dmabuf) {
+	off_t size = lseek(dmabuf->fd[0], 0, SEEK_END);
+	if (size < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to get DMA-BUF size");
+		return false;
+	}
+
+	// DMA-BUFs imported read-only can't be mapped for writing
+	bool writable = true;
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		dmabuf->fd[0], 0);
+	if (addr == MAP_FAILED && errno == EACCES) {
+		writable = false;
+		addr = mmap(NULL, size, PROT_READ, MAP_SHARED, dmabuf->fd[0], 0);
+	}
+	if (addr == MAP_FAILED) {
+		wlr_log_errno(WLR_ERROR, "Failed to mmap DMA-BUF");
+		return false;
+	}
+
+	mapping->addr = addr;
+	mapping->size = size;
+	mapping->writable = writable;
+	return true;
+}
+
+bool dmabuf_mapping_begin_access(struct dmabuf_mapping *mapping,
+		const struct wlr_dmabuf_attributes *dmabuf, uint32_t flags, void **data,
+		uint32_t *format, size_t *stride) {
+	// Tiled layouts can't be accessed linearly, and implicit modifiers may
+	// be tiled
+	if (dmabuf->n_planes != 1 || dmabuf->modifier != DRM_FORMAT_MOD_LINEAR) {
+		return false;
+	}
+
+	if (mapping->addr == NULL && !dmabuf_mapping_map(mapping, dmabuf)) {
+		return false;
+	}
+	if ((flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE) && !mapping->writable) {
+		return false;
+	}
+
+	uint32_t sync_flags = 0;
+	if (flags & WLR_BUFFER_DATA_PTR_ACCESS_READ) {
+		sync_flags |= DMA_BUF_SYNC_READ;
+	}
+	if (flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE) {
+		sync_flags |= DMA_BUF_SYNC_WRITE;
+	}
+	if (!dmabuf_sync(dmabuf->fd[0], DMA_BUF_SYNC_START | sync_flags)) {
+		return false;
+	}
+	mapping->sync_flags = sync_flags;
+
+	*data = (char *)mapping->addr + dmabuf->offset[0];
+	*format = dmabuf->format;
+	*stride = dmabuf->stride[0];
+	return true;
+}
+
+void dmabuf_mapping_end_access(struct dmabuf_mapping *mapping,
+		const struct wlr_dmabuf_attributes *dmabuf) {
+	dmabuf_sync(dmabuf->fd[0], DMA_BUF_SYNC_END | mapping->sync_flags);
+	mapping->sync_flags = 0;
+}
+
+void dmabuf_mapping_finish(struct dmabuf_mapping *mapping) {
+	if (mapping->addr != NULL) {
+		munmap(mapping->addr, mapping->size);
+	}
+	mapping->addr = NULL;
+}
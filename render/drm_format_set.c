@@ -19,22 +19,58 @@ void wlr_drm_format_set_finish(struct wlr_drm_format_set *set) {
 	set->formats = NULL;
 }
 
-static struct wlr_drm_format **format_set_get_ref(struct wlr_drm_format_set *set,
-		uint32_t format) {
-	for (size_t i = 0; i < set->len; ++i) {
-		if (set->formats[i]->format == format) {
-			return &set->formats[i];
+/**
+ * Lookup a format in the set, sorted by fourcc. Returns true if found, and
+ * sets pos to the index of the format, or to the index where it needs to be
+ * inserted otherwise.
+ */
+static bool format_set_find(const struct wlr_drm_format_set *set,
+		uint32_t format, size_t *pos) {
+	size_t lo = 0, hi = set->len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		uint32_t mid_format = set->formats[mid]->format;
+		if (mid_format == format) {
+			*pos = mid;
+			return true;
+		} else if (mid_format < format) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
+	*pos = lo;
+	return false;
+}
 
-	return NULL;
+/**
+ * Same as format_set_find(), for a modifier of a format, sorted by value.
+ */
+static bool format_find(const struct wlr_drm_format *fmt, uint64_t modifier,
+		size_t *pos) {
+	size_t lo = 0, hi = fmt->len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (fmt->modifiers[mid] == modifier) {
+			*pos = mid;
+			return true;
+		} else if (fmt->modifiers[mid] < modifier) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*pos = lo;
+	return false;
 }
 
 const struct wlr_drm_format *wlr_drm_format_set_get(
 		const struct wlr_drm_format_set *set, uint32_t format) {
-	struct wlr_drm_format **ptr =
-		format_set_get_ref((struct wlr_drm_format_set *)set, format);
-	return ptr ? *ptr : NULL;
+	size_t pos;
+	if (!format_set_find(set, format, &pos)) {
+		return NULL;
+	}
+	return set->formats[pos];
 }
 
 bool wlr_drm_format_set_has(const struct wlr_drm_format_set *set,
@@ -50,9 +86,9 @@ bool wlr_drm_format_set_add(struct wlr_drm_format_set *set, uint32_t format,
 		uint64_t modifier) {
 	assert(format != DRM_FORMAT_INVALID);
 
-	struct wlr_drm_format **ptr = format_set_get_ref(set, format);
-	if (ptr) {
-		return wlr_drm_format_add(ptr, modifier);
+	size_t pos;
+	if (format_set_find(set, format, &pos)) {
+		return wlr_drm_format_add(&set->formats[pos], modifier);
 	}
 
 	struct wlr_drm_format *fmt = wlr_drm_format_create(format);
@@ -67,7 +103,7 @@ bool wlr_drm_format_set_add(struct wlr_drm_format_set *set, uint32_t format,
 		size_t new = set->capacity ? set->capacity * 2 : 4;
 
 		struct wlr_drm_format **tmp = realloc(set->formats,
-			sizeof(*fmt) + sizeof(fmt->modifiers[0]) * new);
+			sizeof(*set->formats) * new);
 		if (!tmp) {
 			wlr_log_errno(WLR_ERROR, "Allocation failed");
 			free(fmt);
@@ -78,7 +114,10 @@ bool wlr_drm_format_set_add(struct wlr_drm_format_set *set, uint32_t format,
 		set->formats = tmp;
 	}
 
-	set->formats[set->len++] = fmt;
+	memmove(&set->formats[pos + 1], &set->formats[pos],
+		(set->len - pos) * sizeof(set->formats[0]));
+	set->formats[pos] = fmt;
+	set->len++;
 	return true;
 }
 
@@ -96,18 +135,15 @@ struct wlr_drm_format *wlr_drm_format_create(uint32_t format) {
 }
 
 bool wlr_drm_format_has(const struct wlr_drm_format *fmt, uint64_t modifier) {
-	for (size_t i = 0; i < fmt->len; ++i) {
-		if (fmt->modifiers[i] == modifier) {
-			return true;
-		}
-	}
-	return false;
+	size_t pos;
+	return format_find(fmt, modifier, &pos);
 }
 
 bool wlr_drm_format_add(struct wlr_drm_format **fmt_ptr, uint64_t modifier) {
 	struct wlr_drm_format *fmt = *fmt_ptr;
 
-	if (wlr_drm_format_has(fmt, modifier)) {
+	size_t pos;
+	if (format_find(fmt, modifier, &pos)) {
 		return true;
 	}
 
@@ -124,7 +160,10 @@ bool wlr_drm_format_add(struct wlr_drm_format **fmt_ptr, uint64_t modifier) {
 		*fmt_ptr = fmt;
 	}
 
-	fmt->modifiers[fmt->len++] = modifier;
+	memmove(&fmt->modifiers[pos + 1], &fmt->modifiers[pos],
+		(fmt->len - pos) * sizeof(fmt->modifiers[0]));
+	fmt->modifiers[pos] = modifier;
+	fmt->len++;
 	return true;
 }
 
@@ -155,14 +194,19 @@ struct wlr_drm_format *wlr_drm_format_intersect(
 	format->format = a->format;
 	format->capacity = format_cap;
 
-	for (size_t i = 0; i < a->len; i++) {
-		for (size_t j = 0; j < b->len; j++) {
-			if (a->modifiers[i] == b->modifiers[j]) {
-				assert(format->len < format->capacity);
-				format->modifiers[format->len] = a->modifiers[i];
-				format->len++;
-				break;
-			}
+	// Both modifier lists are sorted
+	size_t i = 0, j = 0;
+	while (i < a->len && j < b->len) {
+		if (a->modifiers[i] < b->modifiers[j]) {
+			i++;
+		} else if (a->modifiers[i] > b->modifiers[j]) {
+			j++;
+		} else {
+			assert(format->len < format->capacity);
+			format->modifiers[format->len] = a->modifiers[i];
+			format->len++;
+			i++;
+			j++;
 		}
 	}
 
@@ -188,21 +232,164 @@ bool wlr_drm_format_set_intersect(struct wlr_drm_format_set *dst,
 		return false;
 	}
 
-	for (size_t i = 0; i < a->len; i++) {
-		for (size_t j = 0; j < b->len; j++) {
-			if (a->formats[i]->format == b->formats[j]->format) {
-				// When the two formats have no common modifier, keep
-				// intersecting the rest of the formats: they may be compatible
-				// with each other
-				struct wlr_drm_format *format =
-					wlr_drm_format_intersect(a->formats[i], b->formats[j]);
-				if (format != NULL) {
-					out.formats[out.len] = format;
-					out.len++;
-				}
-				break;
-			}
+	// Both format lists are sorted, and so is the result
+	size_t i = 0, j = 0;
+	while (i < a->len && j < b->len) {
+		uint32_t a_format = a->formats[i]->format;
+		uint32_t b_format = b->formats[j]->format;
+		if (a_format < b_format) {
+			i++;
+			continue;
+		} else if (a_format > b_format) {
+			j++;
+			continue;
+		}
+
+		// When the two formats have no common modifier, keep intersecting
+		// the rest of the formats: they may be compatible with each other
+		struct wlr_drm_format *format =
+			wlr_drm_format_intersect(a->formats[i], b->formats[j]);
+		if (format != NULL) {
+			out.formats[out.len] = format;
+			out.len++;
+		}
+		i++;
+		j++;
+	}
+
+	if (out.len == 0) {
+		wlr_drm_format_set_finish(&out);
+		return false;
+	}
+
+	*dst = out;
+	return true;
+}
+
+enum wlr_drm_modifier_rank wlr_drm_modifier_get_rank(uint64_t modifier) {
+	if (modifier == DRM_FORMAT_MOD_INVALID) {
+		return WLR_DRM_MODIFIER_RANK_IMPLICIT;
+	}
+	if (modifier == DRM_FORMAT_MOD_LINEAR) {
+		return WLR_DRM_MODIFIER_RANK_LINEAR;
+	}
+
+	uint64_t vendor = modifier >> 56;
+	switch (vendor) {
+	case DRM_FORMAT_MOD_VENDOR_ARM:;
+		// AFBC and AFRC, but not the misc. tiled layouts
+		uint64_t arm_type = (modifier >> 52) & 0xF;
+		if (arm_type == DRM_FORMAT_MOD_ARM_TYPE_AFBC) {
+			return WLR_DRM_MODIFIER_RANK_COMPRESSED;
+		}
+#ifdef DRM_FORMAT_MOD_ARM_TYPE_AFRC
+		if (arm_type == DRM_FORMAT_MOD_ARM_TYPE_AFRC) {
+			return WLR_DRM_MODIFIER_RANK_COMPRESSED;
+		}
+#endif
+		break;
+	case DRM_FORMAT_MOD_VENDOR_INTEL:
+		switch (modifier) {
+		case I915_FORMAT_MOD_Y_TILED_CCS:
+		case I915_FORMAT_MOD_Yf_TILED_CCS:
+		case I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS:
+		case I915_FORMAT_MOD_Y_TILED_GEN12_MC_CCS:
+		case I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS_CC:
+#ifdef I915_FORMAT_MOD_4_TILED_DG2_RC_CCS
+		case I915_FORMAT_MOD_4_TILED_DG2_RC_CCS:
+		case I915_FORMAT_MOD_4_TILED_DG2_MC_CCS:
+		case I915_FORMAT_MOD_4_TILED_DG2_RC_CCS_CC:
+#endif
+#ifdef I915_FORMAT_MOD_4_TILED_MTL_RC_CCS
+		case I915_FORMAT_MOD_4_TILED_MTL_RC_CCS:
+		case I915_FORMAT_MOD_4_TILED_MTL_MC_CCS:
+		case I915_FORMAT_MOD_4_TILED_MTL_RC_CCS_CC:
+#endif
+			return WLR_DRM_MODIFIER_RANK_COMPRESSED;
+		}
+		break;
+	case DRM_FORMAT_MOD_VENDOR_AMD:
+		if (AMD_FMT_MOD_GET(DCC, modifier)) {
+			return WLR_DRM_MODIFIER_RANK_COMPRESSED;
+		}
+		break;
+	case DRM_FORMAT_MOD_VENDOR_NVIDIA:
+		// 2D block-linear layouts carry a compression type
+		if ((modifier & 0x10) && ((modifier >> 23) & 0x7) != 0) {
+			return WLR_DRM_MODIFIER_RANK_COMPRESSED;
+		}
+		break;
+	}
+
+	return WLR_DRM_MODIFIER_RANK_TILED;
+}
+
+static enum wlr_drm_modifier_rank format_get_best_rank(
+		const struct wlr_drm_format *format) {
+	enum wlr_drm_modifier_rank best = WLR_DRM_MODIFIER_RANK_IMPLICIT;
+	for (size_t i = 0; i < format->len; i++) {
+		enum wlr_drm_modifier_rank rank =
+			wlr_drm_modifier_get_rank(format->modifiers[i]);
+		if (rank > best) {
+			best = rank;
+		}
+	}
+	return best;
+}
+
+static struct wlr_drm_format *format_filter_rank(
+		const struct wlr_drm_format *format, enum wlr_drm_modifier_rank rank) {
+	struct wlr_drm_format *out = wlr_drm_format_create(format->format);
+	if (out == NULL) {
+		return NULL;
+	}
+	// The modifiers are kept sorted
+	for (size_t i = 0; i < format->len; i++) {
+		if (wlr_drm_modifier_get_rank(format->modifiers[i]) == rank &&
+				!wlr_drm_format_add(&out, format->modifiers[i])) {
+			free(out);
+			return NULL;
+		}
+	}
+	return out;
+}
+
+struct wlr_drm_format *wlr_drm_format_pick_preferred(
+		const struct wlr_drm_format *format) {
+	enum wlr_drm_modifier_rank best = format_get_best_rank(format);
+	if (best <= WLR_DRM_MODIFIER_RANK_LINEAR) {
+		// Leave the choice between implicit and linear to the caller
+		return wlr_drm_format_dup(format);
+	}
+	return format_filter_rank(format, best);
+}
+
+bool wlr_drm_format_set_pick_preferred(struct wlr_drm_format_set *dst,
+		const struct wlr_drm_format_set *src) {
+	assert(dst != src);
+
+	struct wlr_drm_format_set out = {0};
+	out.capacity = src->len;
+	out.formats = calloc(out.capacity, sizeof(struct wlr_drm_format *));
+	if (out.formats == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	// The source formats are sorted, and so is the result
+	for (size_t i = 0; i < src->len; i++) {
+		enum wlr_drm_modifier_rank best = format_get_best_rank(src->formats[i]);
+		if (best <= WLR_DRM_MODIFIER_RANK_LINEAR) {
+			continue;
+		}
+		struct wlr_drm_format *format =
+			format_filter_rank(src->formats[i], best);
+		if (format == NULL) {
+			wlr_drm_format_set_finish(&out);
+			return false;
 		}
+		out.formats[out.len] = format;
+		out.len++;
 	}
 
 	if (out.len == 0) {
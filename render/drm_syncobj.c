@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <linux/types.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wlr/render/drm_syncobj.h>
+#include <wlr/util/log.h>
+#include <xf86drm.h>
+#include "util/signal.h"
+
+/*
+ * Points are waited upon with eventfds, so that waiting doesn't block the
+ * event loop. DRM_IOCTL_SYNCOBJ_EVENTFD is only wrapped by recent libdrm
+ * versions, call it directly.
+ */
+
+#ifndef DRM_IOCTL_SYNCOBJ_EVENTFD
+// Copied from <drm/drm.h>, only available since Linux 6.6
+struct drm_syncobj_eventfd {
+	__u32 handle;
+	__u32 flags;
+	__u64 point;
+	__s32 fd;
+	__u32 pad;
+};
+
+#define DRM_IOCTL_SYNCOBJ_EVENTFD DRM_IOWR(0xCF, struct drm_syncobj_eventfd)
+#endif
+
+struct wlr_drm_syncobj_timeline *wlr_drm_syncobj_timeline_import(int drm_fd,
+		int drm_syncobj_fd) {
+	struct wlr_drm_syncobj_timeline *timeline = calloc(1, sizeof(*timeline));
+	if (timeline == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	timeline->drm_fd = drm_fd;
+	timeline->n_refs = 1;
+
+	if (drmSyncobjFDToHandle(drm_fd, drm_syncobj_fd, &timeline->handle) != 0) {
+		wlr_log_errno(WLR_ERROR, "drmSyncobjFDToHandle() failed");
+		free(timeline);
+		return NULL;
+	}
+
+	return timeline;
+}
+
+struct wlr_drm_syncobj_timeline *wlr_drm_syncobj_timeline_ref(
+		struct wlr_drm_syncobj_timeline *timeline) {
+	timeline->n_refs++;
+	return timeline;
+}
+
+void wlr_drm_syncobj_timeline_unref(struct wlr_drm_syncobj_timeline *timeline) {
+	if (timeline == NULL) {
+		return;
+	}
+
+	assert(timeline->n_refs > 0);
+	timeline->n_refs--;
+	if (timeline->n_refs > 0) {
+		return;
+	}
+
+	drmSyncobjDestroy(timeline->drm_fd, timeline->handle);
+	free(timeline);
+}
+
+bool wlr_drm_syncobj_timeline_import_sync_file(
+		struct wlr_drm_syncobj_timeline *timeline, uint64_t dst_point,
+		int sync_file_fd) {
+	// Sync files can only be imported into binary syncobjs, transfer the
+	// fence to the timeline point afterwards
+	uint32_t tmp;
+	if (drmSyncobjCreate(timeline->drm_fd, 0, &tmp) != 0) {
+		wlr_log_errno(WLR_ERROR, "drmSyncobjCreate() failed");
+		return false;
+	}
+
+	bool ok = false;
+	if (drmSyncobjImportSyncFile(timeline->drm_fd, tmp, sync_file_fd) != 0) {
+		wlr_log_errno(WLR_ERROR, "drmSyncobjImportSyncFile() failed");
+		goto out;
+	}
+	if (drmSyncobjTransfer(timeline->drm_fd, timeline->handle, dst_point,
+			tmp, 0, 0) != 0) {
+		wlr_log_errno(WLR_ERROR, "drmSyncobjTransfer() failed");
+		goto out;
+	}
+	ok = true;
+
+out:
+	drmSyncobjDestroy(timeline->drm_fd, tmp);
+	return ok;
+}
+
+bool wlr_drm_syncobj_timeline_signal(struct wlr_drm_syncobj_timeline *timeline,
+		uint64_t point) {
+	if (drmSyncobjTimelineSignal(timeline->drm_fd, &timeline->handle,
+			&point, 1) != 0) {
+		wlr_log_errno(WLR_ERROR, "drmSyncobjTimelineSignal() failed");
+		return false;
+	}
+	return true;
+}
+
+static int handle_eventfd_ready(int ev_fd, uint32_t mask, void *data) {
+	struct wlr_drm_syncobj_timeline_waiter *waiter = data;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		wlr_log(WLR_ERROR, "Failed to wait for timeline point: "
+			"eventfd error");
+	}
+
+	if (mask & WL_EVENT_READABLE) {
+		uint64_t ev_fd_value;
+		if (read(ev_fd, &ev_fd_value, sizeof(ev_fd_value)) <= 0) {
+			wlr_log_errno(WLR_ERROR, "Failed to read from eventfd");
+		}
+	}
+
+	wl_event_source_remove(waiter->event_source);
+	waiter->event_source = NULL;
+	wlr_signal_emit_safe(&waiter->events.ready, NULL);
+	return 0;
+}
+
+bool wlr_drm_syncobj_timeline_waiter_supported(int drm_fd) {
+	// Kernels with the ioctl fail to look up the invalid handle 0, older ones
+	// reject the unknown ioctl with EINVAL
+	struct drm_syncobj_eventfd syncobj_eventfd = {
+		.handle = 0,
+		.fd = -1,
+	};
+	return drmIoctl(drm_fd, DRM_IOCTL_SYNCOBJ_EVENTFD, &syncobj_eventfd) != 0 &&
+		errno == ENOENT;
+}
+
+bool wlr_drm_syncobj_timeline_waiter_init(
+		struct wlr_drm_syncobj_timeline_waiter *waiter,
+		struct wlr_drm_syncobj_timeline *timeline, uint64_t point,
+		struct wl_event_loop *loop) {
+	*waiter = (struct wlr_drm_syncobj_timeline_waiter){ .ev_fd = -1 };
+
+	int ev_fd = eventfd(0, EFD_CLOEXEC);
+	if (ev_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "eventfd() failed");
+		return false;
+	}
+
+	struct drm_syncobj_eventfd syncobj_eventfd = {
+		.handle = timeline->handle,
+		.point = point,
+		.fd = ev_fd,
+	};
+	if (drmIoctl(timeline->drm_fd, DRM_IOCTL_SYNCOBJ_EVENTFD,
+			&syncobj_eventfd) != 0) {
+		wlr_log_errno(WLR_ERROR, "DRM_IOCTL_SYNCOBJ_EVENTFD failed");
+		close(ev_fd);
+		return false;
+	}
+
+	struct wl_event_source *source = wl_event_loop_add_fd(loop, ev_fd,
+		WL_EVENT_READABLE, handle_eventfd_ready, waiter);
+	if (source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add FD to event loop");
+		close(ev_fd);
+		return false;
+	}
+
+	waiter->ev_fd = ev_fd;
+	waiter->event_source = source;
+	wl_signal_init(&waiter->events.ready);
+	return true;
+}
+
+void wlr_drm_syncobj_timeline_waiter_finish(
+		struct wlr_drm_syncobj_timeline_waiter *waiter) {
+	if (waiter->event_source != NULL) {
+		wl_event_source_remove(waiter->event_source);
+	}
+	if (waiter->ev_fd >= 0) {
+		close(waiter->ev_fd);
+	}
+}
@@ -4,6 +4,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <gbm.h>
 #include <wlr/render/egl.h>
@@ -105,8 +106,16 @@ static void init_dmabuf_formats(struct wlr_egl *egl) {
 		return;
 	}
 
-	bool has_modifiers = false;
-	for (int i = 0; i < formats_len; i++) {
+	const char *cache_env = getenv("WLR_EGL_FORMAT_CACHE");
+	char *cache_key = NULL;
+	if (cache_env == NULL || strcmp(cache_env, "0") != 0) {
+		cache_key = egl_format_cache_key(egl);
+	}
+
+	bool cached = cache_key != NULL &&
+		egl_format_cache_load(egl, cache_key, formats, formats_len);
+	bool has_modifiers = egl->has_modifiers;
+	for (int i = 0; !cached && i < formats_len; i++) {
 		uint32_t fmt = formats[i];
 
 		uint64_t *modifiers;
@@ -147,6 +156,12 @@ static void init_dmabuf_formats(struct wlr_egl *egl) {
 		free(external_only);
 	}
 
+	if (cache_key != NULL && !cached) {
+		egl->has_modifiers = has_modifiers;
+		egl_format_cache_save(egl, cache_key, formats, formats_len);
+	}
+	free(cache_key);
+
 	char *str_formats = malloc(formats_len * 5 + 1);
 	if (str_formats == NULL) {
 		goto out;
@@ -156,8 +171,9 @@ static void init_dmabuf_formats(struct wlr_egl *egl) {
 			(char*)&formats[i]);
 	}
 	wlr_log(WLR_DEBUG, "Supported DMA-BUF formats: %s", str_formats);
-	wlr_log(WLR_DEBUG, "EGL DMA-BUF format modifiers %s",
-		has_modifiers ? "supported" : "unsupported");
+	wlr_log(WLR_DEBUG, "EGL DMA-BUF format modifiers %s%s",
+		has_modifiers ? "supported" : "unsupported",
+		cached ? " (cached)" : "");
 	free(str_formats);
 
 	egl->has_modifiers = has_modifiers;
@@ -266,6 +282,19 @@ static bool egl_init_display(struct wlr_egl *egl, EGLDisplay *display) {
 			"eglQueryDmaBufModifiersEXT");
 	}
 
+	if (check_egl_ext(display_exts_str, "EGL_KHR_fence_sync")) {
+		egl->exts.KHR_fence_sync = true;
+		load_egl_proc(&egl->procs.eglCreateSyncKHR, "eglCreateSyncKHR");
+		load_egl_proc(&egl->procs.eglDestroySyncKHR, "eglDestroySyncKHR");
+	}
+
+	if (egl->exts.KHR_fence_sync &&
+			check_egl_ext(display_exts_str, "EGL_ANDROID_native_fence_sync")) {
+		egl->exts.ANDROID_native_fence_sync = true;
+		load_egl_proc(&egl->procs.eglDupNativeFenceFDANDROID,
+			"eglDupNativeFenceFDANDROID");
+	}
+
 	const char *device_exts_str = NULL, *driver_name = NULL;
 	if (egl->exts.EXT_device_query) {
 		EGLAttrib device_attrib;
@@ -601,6 +630,42 @@ bool wlr_egl_destroy_image(struct wlr_egl *egl, EGLImage image) {
 	return egl->procs.eglDestroyImageKHR(egl->display, image);
 }
 
+EGLSyncKHR wlr_egl_create_sync(struct wlr_egl *egl) {
+	if (!egl->exts.ANDROID_native_fence_sync) {
+		return EGL_NO_SYNC_KHR;
+	}
+
+	EGLSyncKHR sync = egl->procs.eglCreateSyncKHR(egl->display,
+		EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+	if (sync == EGL_NO_SYNC_KHR) {
+		wlr_log(WLR_ERROR, "eglCreateSyncKHR failed");
+	}
+	return sync;
+}
+
+void wlr_egl_destroy_sync(struct wlr_egl *egl, EGLSyncKHR sync) {
+	if (sync == EGL_NO_SYNC_KHR) {
+		return;
+	}
+	assert(egl->procs.eglDestroySyncKHR);
+	if (egl->procs.eglDestroySyncKHR(egl->display, sync) != EGL_TRUE) {
+		wlr_log(WLR_ERROR, "eglDestroySyncKHR failed");
+	}
+}
+
+int wlr_egl_dup_fence_fd(struct wlr_egl *egl, EGLSyncKHR sync) {
+	if (!egl->exts.ANDROID_native_fence_sync) {
+		return -1;
+	}
+
+	int fd = egl->procs.eglDupNativeFenceFDANDROID(egl->display, sync);
+	if (fd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+		wlr_log(WLR_ERROR, "eglDupNativeFenceFDANDROID failed");
+		return -1;
+	}
+	return fd;
+}
+
 bool wlr_egl_make_current(struct wlr_egl *egl) {
 	if (!eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
 			egl->context)) {
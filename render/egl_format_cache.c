@@ -0,0 +1,309 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <gbm.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include <xf86drm.h>
+#include "render/egl.h"
+#include "util/cache_file.h"
+
+/*
+ * Cache file layout, all integers in host byte order:
+ *
+ *   u32 magic, u32 version
+ *   u32 key length, key
+ *   u32 has_modifiers
+ *   u32 number of distinct modifiers, u64 modifiers[]
+ *   u32 number of formats, for each format:
+ *     u32 fourcc, u32 number of modifiers, u16 modifier indices[]
+ *
+ * Each modifier index has FORMAT_CACHE_RENDER set if the format/modifier pair
+ * can be rendered to, not only textured from. The formats are listed in the
+ * order returned by eglQueryDmaBufFormatsEXT.
+ */
+
+#define FORMAT_CACHE_MAGIC 0x464c4757 // "WGLF"
+#define FORMAT_CACHE_VERSION 1
+#define FORMAT_CACHE_RENDER 0x8000
+#define FORMAT_CACHE_MAX_MODIFIERS 0x7fff
+#define FORMAT_CACHE_MAX_SIZE (4 * 1024 * 1024)
+
+static void key_append(char **key, size_t *len, const char *str) {
+	if (*key == NULL) {
+		return;
+	}
+	size_t str_len = str != NULL ? strlen(str) : 0;
+	char *new_key = realloc(*key, *len + str_len + 2);
+	if (new_key == NULL) {
+		free(*key);
+		*key = NULL;
+		return;
+	}
+	memcpy(new_key + *len, str, str_len);
+	new_key[*len + str_len] = '\n';
+	new_key[*len + str_len + 1] = '\0';
+	*key = new_key;
+	*len += str_len + 1;
+}
+
+static void key_append_device(char **key, size_t *len, int drm_fd) {
+	char buf[128];
+
+	drmVersion *version = drmGetVersion(drm_fd);
+	if (version != NULL) {
+		snprintf(buf, sizeof(buf), "%s %d.%d.%d %s", version->name,
+			version->version_major, version->version_minor,
+			version->version_patchlevel, version->date);
+		key_append(key, len, buf);
+		drmFreeVersion(version);
+	}
+
+	drmDevice *dev = NULL;
+	if (drmGetDevice2(drm_fd, 0, &dev) == 0) {
+		if (dev->bustype == DRM_BUS_PCI) {
+			snprintf(buf, sizeof(buf), "pci %04x:%04x rev %02x %04x:%02x:%02x.%u",
+				dev->deviceinfo.pci->vendor_id, dev->deviceinfo.pci->device_id,
+				dev->deviceinfo.pci->revision_id, dev->businfo.pci->domain,
+				dev->businfo.pci->bus, dev->businfo.pci->dev,
+				dev->businfo.pci->func);
+			key_append(key, len, buf);
+		} else if (dev->bustype == DRM_BUS_PLATFORM &&
+				dev->businfo.platform != NULL) {
+			key_append(key, len, dev->businfo.platform->fullname);
+		}
+		drmFreeDevice(&dev);
+	}
+}
+
+char *egl_format_cache_key(struct wlr_egl *egl) {
+	size_t len = 0;
+	char *key = strdup("");
+
+	// Driver and device identity. The kernel release covers kernel driver
+	// updates, the EGL strings user-space driver updates.
+	struct utsname uts;
+	if (uname(&uts) == 0) {
+		key_append(&key, &len, uts.release);
+	}
+	key_append(&key, &len, eglQueryString(egl->display, EGL_VENDOR));
+	key_append(&key, &len, eglQueryString(egl->display, EGL_VERSION));
+	key_append(&key, &len, eglQueryString(egl->display, EGL_EXTENSIONS));
+
+	int drm_fd = wlr_egl_dup_drm_fd(egl);
+	if (drm_fd >= 0) {
+		key_append_device(&key, &len, drm_fd);
+		close(drm_fd);
+	} else if (egl->gbm_device != NULL) {
+		key_append(&key, &len, gbm_device_get_backend_name(egl->gbm_device));
+		key_append_device(&key, &len, gbm_device_get_fd(egl->gbm_device));
+	} else {
+		// Can't tell devices apart
+		free(key);
+		return NULL;
+	}
+
+	return key;
+}
+
+static uint64_t hash_key(const char *key) {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static char *get_cache_path(const char *key, bool create_dir) {
+	char name[64];
+	snprintf(name, sizeof(name), "egl-formats-%016" PRIx64 ".bin",
+		hash_key(key));
+	return cache_file_get_path(name, create_dir);
+}
+
+bool egl_format_cache_load(struct wlr_egl *egl, const char *key,
+		const int *formats, int formats_len) {
+	char *path = get_cache_path(key, false);
+	if (path == NULL) {
+		return false;
+	}
+
+	uint64_t *modifiers = NULL;
+	bool ok = false;
+
+	size_t size = 0;
+	uint8_t *data = cache_file_read(path, FORMAT_CACHE_MAX_SIZE, &size);
+	if (data == NULL) {
+		goto out;
+	}
+
+	struct cache_reader r = { .data = data, .size = size };
+	if (cache_read_u32(&r) != FORMAT_CACHE_MAGIC ||
+			cache_read_u32(&r) != FORMAT_CACHE_VERSION) {
+		goto out;
+	}
+	uint32_t key_len = cache_read_u32(&r);
+	const char *cached_key = cache_read_bytes(&r, key_len);
+	if (cached_key == NULL || key_len != strlen(key) ||
+			memcmp(cached_key, key, key_len) != 0) {
+		goto out;
+	}
+	bool has_modifiers = cache_read_u32(&r) != 0;
+
+	uint32_t modifiers_len = cache_read_u32(&r);
+	if (r.failed || modifiers_len > FORMAT_CACHE_MAX_MODIFIERS) {
+		goto out;
+	}
+	modifiers = calloc(modifiers_len > 0 ? modifiers_len : 1, sizeof(*modifiers));
+	const void *modifiers_data =
+		cache_read_bytes(&r, modifiers_len * sizeof(*modifiers));
+	if (modifiers == NULL || modifiers_data == NULL) {
+		goto out;
+	}
+	memcpy(modifiers, modifiers_data, modifiers_len * sizeof(*modifiers));
+
+	// Cheap validation: the driver must still report the same formats
+	if (cache_read_u32(&r) != (uint32_t)formats_len) {
+		goto out;
+	}
+	struct wlr_drm_format_set texture = {0}, render = {0};
+	for (int i = 0; i < formats_len && !r.failed; i++) {
+		uint32_t fmt = cache_read_u32(&r);
+		uint32_t len = cache_read_u32(&r);
+		if (fmt != (uint32_t)formats[i]) {
+			r.failed = true;
+			break;
+		}
+		for (uint32_t j = 0; j < len && !r.failed; j++) {
+			uint16_t index;
+			const void *p = cache_read_bytes(&r, sizeof(index));
+			if (p == NULL) {
+				break;
+			}
+			memcpy(&index, p, sizeof(index));
+			uint16_t mod_index = index & ~FORMAT_CACHE_RENDER;
+			if (mod_index >= modifiers_len) {
+				r.failed = true;
+				break;
+			}
+			wlr_drm_format_set_add(&texture, fmt, modifiers[mod_index]);
+			if (index & FORMAT_CACHE_RENDER) {
+				wlr_drm_format_set_add(&render, fmt, modifiers[mod_index]);
+			}
+		}
+	}
+	if (r.failed || r.pos != r.size) {
+		wlr_drm_format_set_finish(&texture);
+		wlr_drm_format_set_finish(&render);
+		goto out;
+	}
+
+	wlr_drm_format_set_finish(&egl->dmabuf_texture_formats);
+	wlr_drm_format_set_finish(&egl->dmabuf_render_formats);
+	egl->dmabuf_texture_formats = texture;
+	egl->dmabuf_render_formats = render;
+	egl->has_modifiers = has_modifiers;
+	ok = true;
+
+out:
+	if (!ok) {
+		wlr_log(WLR_DEBUG, "No valid DMA-BUF format cache in %s", path);
+	}
+	free(modifiers);
+	free(data);
+	free(path);
+	return ok;
+}
+
+static int find_modifier(const uint64_t *modifiers, size_t modifiers_len,
+		uint64_t mod) {
+	for (size_t i = 0; i < modifiers_len; i++) {
+		if (modifiers[i] == mod) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void egl_format_cache_save(struct wlr_egl *egl, const char *key,
+		const int *formats, int formats_len) {
+	const struct wlr_drm_format_set *texture = &egl->dmabuf_texture_formats;
+	const struct wlr_drm_format_set *render = &egl->dmabuf_render_formats;
+
+	// Drivers share a handful of modifiers between all formats, store each
+	// of them once
+	uint64_t *modifiers = NULL;
+	size_t modifiers_len = 0, modifiers_cap = 0;
+	for (size_t i = 0; i < texture->len; i++) {
+		const struct wlr_drm_format *fmt = texture->formats[i];
+		for (size_t j = 0; j < fmt->len; j++) {
+			if (find_modifier(modifiers, modifiers_len, fmt->modifiers[j]) >= 0) {
+				continue;
+			}
+			if (modifiers_len == FORMAT_CACHE_MAX_MODIFIERS) {
+				free(modifiers);
+				return;
+			}
+			if (modifiers_len == modifiers_cap) {
+				modifiers_cap = modifiers_cap == 0 ? 16 : modifiers_cap * 2;
+				uint64_t *new_modifiers = realloc(modifiers,
+					modifiers_cap * sizeof(*modifiers));
+				if (new_modifiers == NULL) {
+					free(modifiers);
+					return;
+				}
+				modifiers = new_modifiers;
+			}
+			modifiers[modifiers_len++] = fmt->modifiers[j];
+		}
+	}
+
+	char *path = get_cache_path(key, true);
+	struct cache_writer w;
+	if (path == NULL || !cache_writer_open(&w, path)) {
+		free(modifiers);
+		free(path);
+		return;
+	}
+
+	size_t key_len = strlen(key);
+	cache_write_u32(&w, FORMAT_CACHE_MAGIC);
+	cache_write_u32(&w, FORMAT_CACHE_VERSION);
+	cache_write_u32(&w, key_len);
+	cache_write_bytes(&w, key, key_len);
+	cache_write_u32(&w, egl->has_modifiers);
+	cache_write_u32(&w, modifiers_len);
+	cache_write_bytes(&w, modifiers, modifiers_len * sizeof(*modifiers));
+	cache_write_u32(&w, formats_len);
+	for (int i = 0; i < formats_len; i++) {
+		const struct wlr_drm_format *fmt =
+			wlr_drm_format_set_get(texture, formats[i]);
+		const struct wlr_drm_format *render_fmt =
+			wlr_drm_format_set_get(render, formats[i]);
+		size_t len = fmt != NULL ? fmt->len : 0;
+		cache_write_u32(&w, formats[i]);
+		cache_write_u32(&w, len);
+		for (size_t j = 0; j < len; j++) {
+			uint64_t mod = fmt->modifiers[j];
+			uint16_t index = find_modifier(modifiers, modifiers_len, mod);
+			if (render_fmt != NULL &&
+					find_modifier(render_fmt->modifiers, render_fmt->len, mod) >= 0) {
+				index |= FORMAT_CACHE_RENDER;
+			}
+			cache_write_bytes(&w, &index, sizeof(index));
+		}
+	}
+
+	if (cache_writer_finish(&w)) {
+		wlr_log(WLR_DEBUG, "Saved DMA-BUF format cache to %s", path);
+	}
+	free(modifiers);
+	free(path);
+}
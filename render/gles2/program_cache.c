@@ -0,0 +1,313 @@
+#define _POSIX_C_SOURCE 200809L
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include "render/gles2.h"
+#include "util/cache_file.h"
+
+/*
+ * Cache file layout, all integers in host byte order:
+ *
+ *   u32 magic, u32 version
+ *   u32 key length, key
+ *   u32 number of programs, for each program:
+ *     u64 hash of the shader sources, u32 binary format, u32 length, binary
+ *
+ * Program binaries are only valid for the driver which created them, the key
+ * is made of the GL vendor, renderer and version strings. Drivers reject
+ * stale binaries anyways, in which case the program is linked from source.
+ */
+
+#define PROGRAM_CACHE_MAGIC 0x50474c57 // "WLGP"
+#define PROGRAM_CACHE_VERSION 1
+#define PROGRAM_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+struct wlr_gles2_program_binary {
+	uint64_t hash;
+	GLenum format;
+	GLsizei len;
+	void *data;
+};
+
+struct wlr_gles2_program_cache {
+	char *key;
+	struct wl_array programs; // struct wlr_gles2_program_binary
+	bool dirty; // programs were linked from source
+};
+
+static uint64_t hash_str(uint64_t hash, const char *str) {
+	// FNV-1a, including the NUL terminator to separate strings
+	const unsigned char *c = (const unsigned char *)str;
+	do {
+		hash ^= *c;
+		hash *= 0x100000001b3;
+	} while (*c++ != '\0');
+	return hash;
+}
+
+static uint64_t hash_sources(const GLchar *vert_src, const GLchar *frag_src) {
+	uint64_t hash = 0xcbf29ce484222325;
+	hash = hash_str(hash, vert_src);
+	return hash_str(hash, frag_src);
+}
+
+static char *get_cache_key(void) {
+	const char *strs[] = {
+		(const char *)glGetString(GL_VENDOR),
+		(const char *)glGetString(GL_RENDERER),
+		(const char *)glGetString(GL_VERSION),
+	};
+	size_t len = 0;
+	for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		if (strs[i] == NULL) {
+			return NULL;
+		}
+		len += strlen(strs[i]) + 1;
+	}
+
+	char *key = malloc(len + 1);
+	if (key == NULL) {
+		return NULL;
+	}
+	key[0] = '\0';
+	for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		strcat(key, strs[i]);
+		strcat(key, "\n");
+	}
+	return key;
+}
+
+static char *get_cache_path(const char *key, bool create_dir) {
+	char name[64];
+	snprintf(name, sizeof(name), "gles2-programs-%016" PRIx64 ".bin",
+		hash_str(0xcbf29ce484222325, key));
+	return cache_file_get_path(name, create_dir);
+}
+
+static bool cache_add(struct wlr_gles2_program_cache *cache, uint64_t hash,
+		GLenum format, GLsizei len, const void *data) {
+	struct wlr_gles2_program_binary *binary =
+		wl_array_add(&cache->programs, sizeof(*binary));
+	if (binary == NULL) {
+		return false;
+	}
+	*binary = (struct wlr_gles2_program_binary){
+		.hash = hash,
+		.format = format,
+		.len = len,
+		.data = malloc(len),
+	};
+	if (binary->data == NULL) {
+		cache->programs.size -= sizeof(*binary);
+		return false;
+	}
+	memcpy(binary->data, data, len);
+	return true;
+}
+
+static void cache_load(struct wlr_gles2_program_cache *cache) {
+	char *path = get_cache_path(cache->key, false);
+	if (path == NULL) {
+		return;
+	}
+
+	size_t size = 0;
+	uint8_t *data = cache_file_read(path, PROGRAM_CACHE_MAX_SIZE, &size);
+	if (data == NULL) {
+		goto out;
+	}
+
+	struct cache_reader r = { .data = data, .size = size };
+	if (cache_read_u32(&r) != PROGRAM_CACHE_MAGIC ||
+			cache_read_u32(&r) != PROGRAM_CACHE_VERSION) {
+		goto out;
+	}
+	uint32_t key_len = cache_read_u32(&r);
+	const char *cached_key = cache_read_bytes(&r, key_len);
+	if (cached_key == NULL || key_len != strlen(cache->key) ||
+			memcmp(cached_key, cache->key, key_len) != 0) {
+		goto out;
+	}
+
+	uint32_t programs_len = cache_read_u32(&r);
+	for (uint32_t i = 0; i < programs_len && !r.failed; i++) {
+		uint64_t hash = cache_read_u64(&r);
+		uint32_t format = cache_read_u32(&r);
+		uint32_t len = cache_read_u32(&r);
+		const void *binary = cache_read_bytes(&r, len);
+		if (binary == NULL || len == 0 ||
+				!cache_add(cache, hash, format, len, binary)) {
+			r.failed = true;
+		}
+	}
+	if (r.failed || r.pos != r.size) {
+		struct wlr_gles2_program_binary *binary;
+		wl_array_for_each(binary, &cache->programs) {
+			free(binary->data);
+		}
+		cache->programs.size = 0;
+		goto out;
+	}
+
+	wlr_log(WLR_DEBUG, "Loaded %"PRIu32" GLES2 program binaries from %s",
+		programs_len, path);
+
+out:
+	free(data);
+	free(path);
+}
+
+static void cache_save(struct wlr_gles2_program_cache *cache) {
+	char *path = get_cache_path(cache->key, true);
+	struct cache_writer w;
+	if (path == NULL || !cache_writer_open(&w, path)) {
+		free(path);
+		return;
+	}
+
+	size_t key_len = strlen(cache->key);
+	size_t programs_len =
+		cache->programs.size / sizeof(struct wlr_gles2_program_binary);
+	cache_write_u32(&w, PROGRAM_CACHE_MAGIC);
+	cache_write_u32(&w, PROGRAM_CACHE_VERSION);
+	cache_write_u32(&w, key_len);
+	cache_write_bytes(&w, cache->key, key_len);
+	cache_write_u32(&w, programs_len);
+	struct wlr_gles2_program_binary *binary;
+	wl_array_for_each(binary, &cache->programs) {
+		cache_write_u64(&w, binary->hash);
+		cache_write_u32(&w, binary->format);
+		cache_write_u32(&w, binary->len);
+		cache_write_bytes(&w, binary->data, binary->len);
+	}
+
+	if (cache_writer_finish(&w)) {
+		wlr_log(WLR_DEBUG, "Saved GLES2 program binaries to %s", path);
+	}
+	free(path);
+}
+
+void gles2_program_cache_init(struct wlr_gles2_renderer *renderer) {
+	const char *cache_env = getenv("WLR_GLES2_PROGRAM_CACHE");
+	if (!renderer->exts.OES_get_program_binary ||
+			(cache_env != NULL && strcmp(cache_env, "0") == 0)) {
+		return;
+	}
+
+	GLint formats_len = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats_len);
+	if (formats_len <= 0) {
+		return;
+	}
+
+	struct wlr_gles2_program_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		return;
+	}
+	cache->key = get_cache_key();
+	if (cache->key == NULL) {
+		free(cache);
+		return;
+	}
+	wl_array_init(&cache->programs);
+
+	cache_load(cache);
+	renderer->program_cache = cache;
+}
+
+GLuint gles2_program_cache_link(struct wlr_gles2_renderer *renderer,
+		const GLchar *vert_src, const GLchar *frag_src) {
+	struct wlr_gles2_program_cache *cache = renderer->program_cache;
+	if (cache == NULL) {
+		return 0;
+	}
+
+	uint64_t hash = hash_sources(vert_src, frag_src);
+	struct wlr_gles2_program_binary *binary;
+	wl_array_for_each(binary, &cache->programs) {
+		if (binary->hash != hash) {
+			continue;
+		}
+
+		GLuint prog = glCreateProgram();
+		renderer->procs.glProgramBinaryOES(prog, binary->format,
+			binary->data, binary->len);
+		GLint ok;
+		glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+		if (ok == GL_FALSE) {
+			// e.g. the driver was rebuilt without changing its version
+			wlr_log(WLR_DEBUG, "Driver rejected cached GLES2 program binary");
+			glDeleteProgram(prog);
+			return 0;
+		}
+		return prog;
+	}
+	return 0;
+}
+
+void gles2_program_cache_add(struct wlr_gles2_renderer *renderer,
+		const GLchar *vert_src, const GLchar *frag_src, GLuint prog) {
+	struct wlr_gles2_program_cache *cache = renderer->program_cache;
+	if (cache == NULL) {
+		return;
+	}
+
+	GLint len = 0;
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &len);
+	if (len <= 0) {
+		return;
+	}
+	void *data = malloc(len);
+	if (data == NULL) {
+		return;
+	}
+	GLenum format;
+	GLsizei written = 0;
+	renderer->procs.glGetProgramBinaryOES(prog, len, &written, &format, data);
+	if (written <= 0) {
+		free(data);
+		return;
+	}
+
+	// Replace a stale binary of the same program
+	uint64_t hash = hash_sources(vert_src, frag_src);
+	struct wlr_gles2_program_binary *binary;
+	wl_array_for_each(binary, &cache->programs) {
+		if (binary->hash == hash) {
+			free(binary->data);
+			binary->data = data;
+			binary->format = format;
+			binary->len = written;
+			cache->dirty = true;
+			return;
+		}
+	}
+	if (cache_add(cache, hash, format, written, data)) {
+		cache->dirty = true;
+	}
+	free(data);
+}
+
+void gles2_program_cache_finish(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_program_cache *cache = renderer->program_cache;
+	if (cache == NULL) {
+		return;
+	}
+
+	if (cache->dirty) {
+		cache_save(cache);
+	}
+
+	struct wlr_gles2_program_binary *binary;
+	wl_array_for_each(binary, &cache->programs) {
+		free(binary->data);
+	}
+	wl_array_release(&cache->programs);
+	free(cache->key);
+	free(cache);
+	renderer->program_cache = NULL;
+}
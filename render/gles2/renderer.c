@@ -2,6 +2,8 @@
 #include <drm_fourcc.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,12 +21,9 @@
 #include "render/pixel_format.h"
 #include "types/wlr_matrix.h"
 
-static const GLfloat verts[] = {
-	1, 0, // top right
-	0, 0, // top left
-	1, 1, // bottom right
-	0, 1, // bottom left
-};
+// Minimum downscaling factor above which textures are drawn from their
+// downscaled copy
+#define MIPMAP_MIN_DOWNSCALE 2
 
 static const struct wlr_renderer_impl renderer_impl;
 
@@ -158,6 +157,8 @@ static bool gles2_bind_buffer(struct wlr_renderer *wlr_renderer,
 	if (renderer->current_buffer != NULL) {
 		assert(wlr_egl_is_current(renderer->egl));
 
+		gles2_flush_batch(renderer);
+
 		push_gles2_debug(renderer);
 		glFlush();
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -192,6 +193,246 @@ static bool gles2_bind_buffer(struct wlr_renderer *wlr_renderer,
 	return true;
 }
 
+static int gles2_export_sync_file(struct wlr_renderer *wlr_renderer) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	assert(renderer->current_buffer != NULL);
+	assert(wlr_egl_is_current(renderer->egl));
+
+	EGLSyncKHR sync = wlr_egl_create_sync(renderer->egl);
+	if (sync == EGL_NO_SYNC_KHR) {
+		return -1;
+	}
+
+	// The native fence only materializes once the fence command is flushed
+	push_gles2_debug(renderer);
+	glFlush();
+	pop_gles2_debug(renderer);
+
+	int fd = wlr_egl_dup_fence_fd(renderer->egl, sync);
+	wlr_egl_destroy_sync(renderer->egl, sync);
+	return fd;
+}
+
+void gles2_flush_batch(struct wlr_gles2_renderer *renderer) {
+	size_t vertices_len =
+		renderer->batch.vertices.size / sizeof(struct wlr_gles2_vertex);
+	if (vertices_len == 0) {
+		return;
+	}
+
+	const struct wlr_gles2_vertex *vertices = renderer->batch.vertices.data;
+	const GLsizei stride = sizeof(*vertices);
+
+	push_gles2_debug(renderer);
+
+	if (renderer->batch.blend) {
+		glEnable(GL_BLEND);
+	} else {
+		glDisable(GL_BLEND);
+	}
+
+	if (renderer->batch.scissor) {
+		const struct wlr_box *box = &renderer->scissor.box;
+		glScissor(box->x, box->y, box->width, box->height);
+		glEnable(GL_SCISSOR_TEST);
+	}
+
+	struct wlr_gles2_texture *texture = renderer->batch.texture;
+	GLint attribs[3];
+	size_t attribs_len = 0;
+	if (texture != NULL) {
+		struct wlr_gles2_tex_shader *shader = renderer->batch.shader;
+
+		glActiveTexture(GL_TEXTURE0);
+		if (renderer->batch.mipmap) {
+			glBindTexture(GL_TEXTURE_2D, texture->mipmap.tex);
+		} else {
+			glBindTexture(texture->target, texture->tex);
+			glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		}
+
+		// Chroma planes are never sampled through the downscaled copy
+		for (size_t i = 0; i < texture->chroma_planes_len; i++) {
+			glActiveTexture(GL_TEXTURE1 + i);
+			glBindTexture(GL_TEXTURE_2D, texture->chroma_texs[i]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		}
+		glActiveTexture(GL_TEXTURE0);
+
+		glUseProgram(shader->program);
+		glUniform1i(shader->tex, 0);
+
+		glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE,
+			stride, vertices->pos);
+		glVertexAttribPointer(shader->tex_attrib, 2, GL_FLOAT, GL_FALSE,
+			stride, vertices->texcoord);
+		attribs[attribs_len++] = shader->pos_attrib;
+		attribs[attribs_len++] = shader->tex_attrib;
+		if (shader->alpha_attrib >= 0) {
+			glVertexAttribPointer(shader->alpha_attrib, 1, GL_FLOAT, GL_FALSE,
+				stride, &vertices->alpha);
+			attribs[attribs_len++] = shader->alpha_attrib;
+		}
+	} else {
+		glUseProgram(renderer->shaders.quad.program);
+
+		glVertexAttribPointer(renderer->shaders.quad.pos_attrib, 2, GL_FLOAT,
+			GL_FALSE, stride, vertices->pos);
+		glVertexAttribPointer(renderer->shaders.quad.color_attrib, 4, GL_FLOAT,
+			GL_FALSE, stride, vertices->color);
+		attribs[attribs_len++] = renderer->shaders.quad.pos_attrib;
+		attribs[attribs_len++] = renderer->shaders.quad.color_attrib;
+	}
+
+	for (size_t i = 0; i < attribs_len; i++) {
+		glEnableVertexAttribArray(attribs[i]);
+	}
+
+	glDrawArrays(GL_TRIANGLES, 0, vertices_len);
+
+	for (size_t i = 0; i < attribs_len; i++) {
+		glDisableVertexAttribArray(attribs[i]);
+	}
+
+	if (texture != NULL) {
+		glBindTexture(renderer->batch.mipmap ?
+			GL_TEXTURE_2D : texture->target, 0);
+		for (size_t i = 0; i < texture->chroma_planes_len; i++) {
+			glActiveTexture(GL_TEXTURE1 + i);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+	if (renderer->batch.scissor) {
+		glDisable(GL_SCISSOR_TEST);
+	}
+
+	pop_gles2_debug(renderer);
+
+	renderer->batch.vertices.size = 0;
+	renderer->batch.texture = NULL;
+	renderer->batch.shader = NULL;
+	renderer->batch.mipmap = false;
+	renderer->batch.scissor = false;
+}
+
+/**
+ * Prepare the batch for a new quad, flushing it if the quad can't be drawn
+ * with the same GL state as the pending ones.
+ */
+static void batch_begin_quad(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture, struct wlr_gles2_tex_shader *shader,
+		bool mipmap, bool blend, bool scissor) {
+	if (renderer->batch.vertices.size > 0 &&
+			(renderer->batch.texture != texture ||
+			renderer->batch.shader != shader ||
+			renderer->batch.mipmap != mipmap ||
+			renderer->batch.blend != blend ||
+			renderer->batch.scissor != scissor)) {
+		gles2_flush_batch(renderer);
+	}
+
+	renderer->batch.texture = texture;
+	renderer->batch.shader = shader;
+	renderer->batch.mipmap = mipmap;
+	renderer->batch.blend = blend;
+	renderer->batch.scissor = scissor;
+}
+
+/**
+ * Append a quad to the batch. The matrix maps the unit square to normalized
+ * device coordinates, the unit square corners map to the texture coordinates
+ * in uv_box. The quad is clipped to the scissor box.
+ */
+static void batch_add_quad(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture, struct wlr_gles2_tex_shader *shader,
+		bool mipmap, bool blend, const float gl_matrix[static 9],
+		const struct wlr_fbox *uv_box, const float color[static 4],
+		float alpha) {
+	// Affine mapping from the unit square to window coordinates
+	float half_width = renderer->viewport_width / 2.0;
+	float half_height = renderer->viewport_height / 2.0;
+	float a = gl_matrix[0] * half_width;
+	float b = gl_matrix[1] * half_width;
+	float tx = (gl_matrix[2] + 1.0) * half_width;
+	float c = gl_matrix[3] * half_height;
+	float d = gl_matrix[4] * half_height;
+	float ty = (gl_matrix[5] + 1.0) * half_height;
+
+	float det = a * d - b * c;
+	if (det == 0.0) {
+		return;
+	}
+
+	// Unit square coordinates of the corners, in triangle strip order
+	float corners[4][2] = {
+		{ 0, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 },
+	};
+
+	bool axis_aligned = (b == 0.0 && c == 0.0) || (a == 0.0 && d == 0.0);
+	if (renderer->scissor.enabled && axis_aligned) {
+		float x1 = tx, x2 = a + b + tx;
+		float y1 = ty, y2 = c + d + ty;
+		if (x1 > x2) {
+			float tmp = x1;
+			x1 = x2;
+			x2 = tmp;
+		}
+		if (y1 > y2) {
+			float tmp = y1;
+			y1 = y2;
+			y2 = tmp;
+		}
+
+		const struct wlr_box *box = &renderer->scissor.box;
+		x1 = fmaxf(x1, box->x);
+		y1 = fmaxf(y1, box->y);
+		x2 = fminf(x2, box->x + box->width);
+		y2 = fminf(y2, box->y + box->height);
+		if (x1 >= x2 || y1 >= y2) {
+			return;
+		}
+
+		// Map the clipped rectangle back to the unit square
+		float window[4][2] = {
+			{ x1, y1 }, { x2, y1 }, { x1, y2 }, { x2, y2 },
+		};
+		for (size_t i = 0; i < 4; i++) {
+			float x = window[i][0] - tx, y = window[i][1] - ty;
+			corners[i][0] = (d * x - b * y) / det;
+			corners[i][1] = (a * y - c * x) / det;
+		}
+	}
+
+	batch_begin_quad(renderer, texture, shader, mipmap, blend,
+		renderer->scissor.enabled && !axis_aligned);
+
+	struct wlr_gles2_vertex quad[4];
+	for (size_t i = 0; i < 4; i++) {
+		float s = corners[i][0], t = corners[i][1];
+		struct wlr_gles2_vertex *v = &quad[i];
+		v->pos[0] = (a * s + b * t + tx) / half_width - 1.0;
+		v->pos[1] = (c * s + d * t + ty) / half_height - 1.0;
+		v->texcoord[0] = uv_box->x + s * uv_box->width;
+		v->texcoord[1] = uv_box->y + t * uv_box->height;
+		memcpy(v->color, color, sizeof(v->color));
+		v->alpha = alpha;
+	}
+
+	struct wlr_gles2_vertex *vertices =
+		wl_array_add(&renderer->batch.vertices, 6 * sizeof(*vertices));
+	if (vertices == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	vertices[0] = quad[0];
+	vertices[1] = quad[1];
+	vertices[2] = quad[2];
+	vertices[3] = quad[1];
+	vertices[4] = quad[3];
+	vertices[5] = quad[2];
+}
+
 static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 		uint32_t height) {
 	struct wlr_gles2_renderer *renderer =
@@ -209,15 +450,31 @@ static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
+	renderer->scissor.enabled = false;
+
 	// XXX: maybe we should save output projection and remove some of the need
 	// for users to sling matricies themselves
 
+	if (wlr_renderer->timer != NULL) {
+		struct wlr_gles2_render_timer *timer =
+			wl_container_of(wlr_renderer->timer, timer, base);
+		// Starting a new query discards the result of the previous one
+		timer->query_pending = true;
+		timer->duration = -1;
+		renderer->procs.glBeginQueryEXT(GL_TIME_ELAPSED_EXT, timer->query);
+	}
+
 	pop_gles2_debug(renderer);
 }
 
 static void gles2_end(struct wlr_renderer *wlr_renderer) {
-	gles2_get_renderer_in_context(wlr_renderer);
-	// no-op
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+	gles2_flush_batch(renderer);
+
+	if (wlr_renderer->timer != NULL) {
+		renderer->procs.glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+	}
 }
 
 static void gles2_clear(struct wlr_renderer *wlr_renderer,
@@ -225,6 +482,26 @@ static void gles2_clear(struct wlr_renderer *wlr_renderer,
 	struct wlr_gles2_renderer *renderer =
 		gles2_get_renderer_in_context(wlr_renderer);
 
+	if (renderer->scissor.enabled) {
+		// Overwriting the scissor box with an opaque quad is equivalent to a
+		// scissored clear, and can be batched
+		const struct wlr_box *box = &renderer->scissor.box;
+		float half_width = renderer->viewport_width / 2.0;
+		float half_height = renderer->viewport_height / 2.0;
+		float gl_matrix[9] = {
+			box->width / half_width, 0, box->x / half_width - 1.0,
+			0, box->height / half_height, box->y / half_height - 1.0,
+			0, 0, 1,
+		};
+		batch_add_quad(renderer, NULL, NULL, false, false, gl_matrix,
+			&(struct wlr_fbox){0}, color, 1.0);
+		return;
+	}
+
+	// Everything pending would be overwritten
+	renderer->batch.vertices.size = 0;
+	renderer->batch.scissor = false;
+
 	push_gles2_debug(renderer);
 	glClearColor(color[0], color[1], color[2], color[3]);
 	glClear(GL_COLOR_BUFFER_BIT);
@@ -236,14 +513,43 @@ static void gles2_scissor(struct wlr_renderer *wlr_renderer,
 	struct wlr_gles2_renderer *renderer =
 		gles2_get_renderer_in_context(wlr_renderer);
 
-	push_gles2_debug(renderer);
+	// Quads clipped on the CPU don't depend on the scissor box anymore, only
+	// flush quads relying on the GL scissor test
+	struct wlr_box *cur = &renderer->scissor.box;
+	bool changed = box == NULL || box->x != cur->x || box->y != cur->y ||
+		box->width != cur->width || box->height != cur->height;
+	if (changed && renderer->batch.scissor) {
+		gles2_flush_batch(renderer);
+	}
+
+	renderer->scissor.enabled = box != NULL;
 	if (box != NULL) {
-		glScissor(box->x, box->y, box->width, box->height);
-		glEnable(GL_SCISSOR_TEST);
-	} else {
-		glDisable(GL_SCISSOR_TEST);
+		renderer->scissor.box = *box;
+	}
+}
+
+/**
+ * Pick the program for a textured quad. Quads drawn at full opacity use a
+ * variant without the per-vertex alpha multiplication.
+ */
+static struct wlr_gles2_tex_shader *get_tex_shader(
+		struct wlr_gles2_renderer *renderer, GLenum target, bool has_alpha,
+		float alpha) {
+	bool opaque = alpha == 1.0;
+	switch (target) {
+	case GL_TEXTURE_2D:
+		if (has_alpha) {
+			return opaque ? &renderer->shaders.tex_rgba_no_alpha :
+				&renderer->shaders.tex_rgba;
+		}
+		return opaque ? &renderer->shaders.tex_rgbx_no_alpha :
+			&renderer->shaders.tex_rgbx;
+	case GL_TEXTURE_EXTERNAL_OES:
+		return opaque ? &renderer->shaders.tex_ext_no_alpha :
+			&renderer->shaders.tex_ext;
+	default:
+		abort();
 	}
-	pop_gles2_debug(renderer);
 }
 
 static bool gles2_render_subtexture_with_matrix(
@@ -256,80 +562,58 @@ static bool gles2_render_subtexture_with_matrix(
 		gles2_get_texture(wlr_texture);
 	assert(texture->renderer == renderer);
 
-	struct wlr_gles2_tex_shader *shader = NULL;
+	if (texture->target == GL_TEXTURE_EXTERNAL_OES &&
+			!renderer->exts.OES_egl_image_external) {
+		wlr_log(WLR_ERROR, "Failed to render texture: "
+			"GL_TEXTURE_EXTERNAL_OES not supported");
+		return false;
+	}
 
-	switch (texture->target) {
-	case GL_TEXTURE_2D:
-		if (texture->has_alpha) {
-			shader = &renderer->shaders.tex_rgba;
-		} else {
-			shader = &renderer->shaders.tex_rgbx;
-		}
+	struct wlr_gles2_tex_shader *shader;
+	switch (texture->chroma_planes_len) {
+	case 0:
+		shader = get_tex_shader(renderer, texture->target,
+			texture->has_alpha, alpha);
 		break;
-	case GL_TEXTURE_EXTERNAL_OES:
-		shader = &renderer->shaders.tex_ext;
-
-		if (!renderer->exts.OES_egl_image_external) {
-			wlr_log(WLR_ERROR, "Failed to render texture: "
-				"GL_TEXTURE_EXTERNAL_OES not supported");
-			return false;
-		}
+	case 1:
+		shader = &renderer->shaders.tex_nv12;
 		break;
 	default:
-		abort();
+		shader = &renderer->shaders.tex_yuv420;
+		break;
 	}
 
 	float gl_matrix[9];
 	wlr_matrix_multiply(gl_matrix, renderer->projection, matrix);
 
-	// OpenGL ES 2 requires the glUniformMatrix3fv transpose parameter to be set
-	// to GL_FALSE
-	wlr_matrix_transpose(gl_matrix, gl_matrix);
-
-	push_gles2_debug(renderer);
-
-	if (!texture->has_alpha && alpha == 1.0) {
-		glDisable(GL_BLEND);
-	} else {
-		glEnable(GL_BLEND);
-	}
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(texture->target, texture->tex);
-
-	glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-	glUseProgram(shader->program);
-
-	glUniformMatrix3fv(shader->proj, 1, GL_FALSE, gl_matrix);
-	glUniform1i(shader->tex, 0);
-	glUniform1f(shader->alpha, alpha);
-
-	const GLfloat x1 = box->x / wlr_texture->width;
-	const GLfloat y1 = box->y / wlr_texture->height;
-	const GLfloat x2 = (box->x + box->width) / wlr_texture->width;
-	const GLfloat y2 = (box->y + box->height) / wlr_texture->height;
-	const GLfloat texcoord[] = {
-		x2, y1, // top right
-		x1, y1, // top left
-		x2, y2, // bottom right
-		x1, y2, // bottom left
+	struct wlr_fbox uv_box = {
+		.x = box->x / wlr_texture->width,
+		.y = box->y / wlr_texture->height,
+		.width = box->width / wlr_texture->width,
+		.height = box->height / wlr_texture->height,
 	};
 
-	glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
-	glVertexAttribPointer(shader->tex_attrib, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
-
-	glEnableVertexAttribArray(shader->pos_attrib);
-	glEnableVertexAttribArray(shader->tex_attrib);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-	glDisableVertexAttribArray(shader->pos_attrib);
-	glDisableVertexAttribArray(shader->tex_attrib);
-
-	glBindTexture(texture->target, 0);
+	// Sample the downscaled copy if the texture is drawn much smaller than its
+	// size, bilinear filtering would skip most of the texels otherwise
+	bool mipmap = false;
+	if (renderer->exts.OES_texture_npot && texture->chroma_planes_len == 0) {
+		float a = gl_matrix[0] * renderer->viewport_width / 2.0;
+		float b = gl_matrix[1] * renderer->viewport_width / 2.0;
+		float c = gl_matrix[3] * renderer->viewport_height / 2.0;
+		float d = gl_matrix[4] * renderer->viewport_height / 2.0;
+		double dst_area = fabs(a * d - b * c);
+		double src_area = box->width * box->height;
+		if (src_area >= dst_area * MIPMAP_MIN_DOWNSCALE * MIPMAP_MIN_DOWNSCALE &&
+				gles2_texture_update_mipmap(texture, shader)) {
+			mipmap = true;
+			shader = get_tex_shader(renderer, GL_TEXTURE_2D,
+				texture->has_alpha, alpha);
+		}
+	}
 
-	pop_gles2_debug(renderer);
+	bool blend = texture->has_alpha || alpha != 1.0;
+	batch_add_quad(renderer, texture, shader, mipmap, blend, gl_matrix,
+		&uv_box, (float[4]){0}, alpha);
 	return true;
 }
 
@@ -341,33 +625,9 @@ static void gles2_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 	float gl_matrix[9];
 	wlr_matrix_multiply(gl_matrix, renderer->projection, matrix);
 
-	// OpenGL ES 2 requires the glUniformMatrix3fv transpose parameter to be set
-	// to GL_FALSE
-	wlr_matrix_transpose(gl_matrix, gl_matrix);
-
-	push_gles2_debug(renderer);
-
-	if (color[3] == 1.0) {
-		glDisable(GL_BLEND);
-	} else {
-		glEnable(GL_BLEND);
-	}
-
-	glUseProgram(renderer->shaders.quad.program);
-
-	glUniformMatrix3fv(renderer->shaders.quad.proj, 1, GL_FALSE, gl_matrix);
-	glUniform4f(renderer->shaders.quad.color, color[0], color[1], color[2], color[3]);
-
-	glVertexAttribPointer(renderer->shaders.quad.pos_attrib, 2, GL_FLOAT, GL_FALSE,
-			0, verts);
-
-	glEnableVertexAttribArray(renderer->shaders.quad.pos_attrib);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-	glDisableVertexAttribArray(renderer->shaders.quad.pos_attrib);
-
-	pop_gles2_debug(renderer);
+	bool blend = color[3] != 1.0;
+	batch_add_quad(renderer, NULL, NULL, false, blend, gl_matrix,
+		&(struct wlr_fbox){0}, color, 1.0);
 }
 
 static const uint32_t *gles2_get_shm_texture_formats(
@@ -419,23 +679,34 @@ static uint32_t gles2_preferred_read_format(
 	return DRM_FORMAT_XBGR8888;
 }
 
-static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
-		uint32_t drm_format, uint32_t *flags, uint32_t stride,
-		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
-		uint32_t dst_x, uint32_t dst_y, void *data) {
-	struct wlr_gles2_renderer *renderer =
-		gles2_get_renderer_in_context(wlr_renderer);
-
+static const struct wlr_gles2_pixel_format *get_read_format(
+		struct wlr_gles2_renderer *renderer, uint32_t drm_format) {
 	const struct wlr_gles2_pixel_format *fmt =
 		get_gles2_format_from_drm(drm_format);
 	if (fmt == NULL || !is_gles2_pixel_format_supported(renderer, fmt)) {
 		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format 0x%"PRIX32, drm_format);
-		return false;
+		return NULL;
 	}
 
 	if (fmt->gl_format == GL_BGRA_EXT && !renderer->exts.EXT_read_format_bgra) {
 		wlr_log(WLR_ERROR,
 			"Cannot read pixels: missing GL_EXT_read_format_bgra extension");
+		return NULL;
+	}
+
+	return fmt;
+}
+
+static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
+		uint32_t drm_format, uint32_t *flags, uint32_t stride,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+		uint32_t dst_x, uint32_t dst_y, void *data) {
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+
+	const struct wlr_gles2_pixel_format *fmt =
+		get_read_format(renderer, drm_format);
+	if (fmt == NULL) {
 		return false;
 	}
 
@@ -443,6 +714,8 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 		drm_get_pixel_format_info(fmt->drm_format);
 	assert(drm_fmt);
 
+	gles2_flush_batch(renderer);
+
 	push_gles2_debug(renderer);
 
 	// Make sure any pending drawing is finished before we try to read it
@@ -476,6 +749,295 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 	return glGetError() == GL_NO_ERROR;
 }
 
+static struct wlr_gles2_readback *gles2_readback_from_readback(
+		struct wlr_render_readback *wlr_readback) {
+	struct wlr_gles2_readback *readback =
+		wl_container_of(wlr_readback, readback, base);
+	return readback;
+}
+
+static int gles2_readback_get_sync_file(
+		struct wlr_render_readback *wlr_readback) {
+	struct wlr_gles2_readback *readback =
+		gles2_readback_from_readback(wlr_readback);
+	return readback->sync_fd;
+}
+
+static bool gles2_readback_get_pixels(struct wlr_render_readback *wlr_readback,
+		uint32_t *flags, uint32_t stride, uint32_t dst_x, uint32_t dst_y,
+		void *data) {
+	struct wlr_gles2_readback *readback =
+		gles2_readback_from_readback(wlr_readback);
+	struct wlr_gles2_renderer *renderer = readback->renderer;
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+	push_gles2_debug(renderer);
+
+	uint32_t pack_stride = readback->width * readback->bytes_per_pixel;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->pbo);
+	const unsigned char *src = renderer->procs.glMapBufferRange(
+		GL_PIXEL_PACK_BUFFER, 0, pack_stride * readback->height,
+		GL_MAP_READ_BIT);
+	if (src != NULL) {
+		unsigned char *dst = (unsigned char *)data + dst_y * stride +
+			dst_x * readback->bytes_per_pixel;
+		for (uint32_t i = 0; i < readback->height; ++i) {
+			memcpy(dst + i * stride, src + i * pack_stride, pack_stride);
+		}
+		renderer->procs.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		wlr_log(WLR_ERROR, "Failed to map pixel pack buffer");
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	pop_gles2_debug(renderer);
+	wlr_egl_restore_context(&prev_ctx);
+
+	if (flags != NULL) {
+		*flags = 0;
+	}
+	return src != NULL;
+}
+
+static void gles2_readback_destroy(struct wlr_render_readback *wlr_readback) {
+	struct wlr_gles2_readback *readback =
+		gles2_readback_from_readback(wlr_readback);
+	struct wlr_gles2_renderer *renderer = readback->renderer;
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+	glDeleteBuffers(1, &readback->pbo);
+	wlr_egl_restore_context(&prev_ctx);
+
+	if (readback->sync_fd >= 0) {
+		close(readback->sync_fd);
+	}
+	free(readback);
+}
+
+static const struct wlr_render_readback_impl readback_impl = {
+	.get_sync_file = gles2_readback_get_sync_file,
+	.get_pixels = gles2_readback_get_pixels,
+	.destroy = gles2_readback_destroy,
+};
+
+static struct wlr_render_readback *gles2_read_pixels_async(
+		struct wlr_renderer *wlr_renderer, uint32_t drm_format,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y) {
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+	if (!renderer->exts.pixel_buffer_object) {
+		return NULL;
+	}
+
+	const struct wlr_gles2_pixel_format *fmt =
+		get_read_format(renderer, drm_format);
+	if (fmt == NULL) {
+		return NULL;
+	}
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(fmt->drm_format);
+	assert(drm_fmt);
+
+	struct wlr_gles2_readback *readback = calloc(1, sizeof(*readback));
+	if (readback == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_render_readback_init(&readback->base, &readback_impl, wlr_renderer);
+	readback->renderer = renderer;
+	readback->width = width;
+	readback->height = height;
+	readback->bytes_per_pixel = drm_fmt->bpp / 8;
+	readback->sync_fd = -1;
+
+	gles2_flush_batch(renderer);
+
+	push_gles2_debug(renderer);
+	glGetError(); // Clear the error flag
+
+	// With a pack buffer bound, glReadPixels only queues the copy instead of
+	// waiting for the GPU
+	uint32_t pack_stride = width * readback->bytes_per_pixel;
+	glGenBuffers(1, &readback->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, pack_stride * height, NULL,
+		GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(src_x, src_y, width, height, fmt->gl_format, fmt->gl_type,
+		NULL);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	bool ok = glGetError() == GL_NO_ERROR;
+	pop_gles2_debug(renderer);
+	if (!ok) {
+		gles2_readback_destroy(&readback->base);
+		return NULL;
+	}
+
+	readback->sync_fd = gles2_export_sync_file(wlr_renderer);
+	return &readback->base;
+}
+
+static const uint32_t *gles2_get_yuv_render_formats(
+		struct wlr_renderer *wlr_renderer, size_t *len) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	*len = renderer->yuv_formats_len;
+	return renderer->yuv_formats_len > 0 ? renderer->yuv_formats : NULL;
+}
+
+// Each plane of a YUV buffer is rendered into as a single-plane buffer
+static bool get_yuv_plane_formats(uint32_t format, uint32_t plane_formats[2]) {
+	switch (format) {
+	case DRM_FORMAT_NV12:
+		plane_formats[0] = DRM_FORMAT_R8;
+		plane_formats[1] = DRM_FORMAT_GR88;
+		return true;
+	case DRM_FORMAT_P010:
+		plane_formats[0] = DRM_FORMAT_R16;
+		plane_formats[1] = DRM_FORMAT_GR1616;
+		return true;
+	}
+	return false;
+}
+
+static bool blit_yuv_plane(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture,
+		const struct wlr_dmabuf_attributes *attribs, int plane,
+		uint32_t plane_format, struct wlr_gles2_yuv_shader *shader) {
+	// Chroma is subsampled horizontally and vertically
+	int div = plane == 0 ? 1 : 2;
+	struct wlr_dmabuf_attributes plane_attribs = {
+		.width = (attribs->width + div - 1) / div,
+		.height = (attribs->height + div - 1) / div,
+		.format = plane_format,
+		.modifier = attribs->modifier,
+		.n_planes = 1,
+		.offset = { attribs->offset[plane] },
+		.stride = { attribs->stride[plane] },
+		.fd = { attribs->fd[plane] },
+	};
+
+	bool external_only;
+	EGLImageKHR image = wlr_egl_create_image_from_dmabuf(renderer->egl,
+		&plane_attribs, &external_only);
+	if (image == EGL_NO_IMAGE_KHR) {
+		wlr_log(WLR_ERROR, "Failed to import YUV plane %d", plane);
+		return false;
+	}
+
+	push_gles2_debug(renderer);
+
+	GLuint rbo, fbo;
+	glGenRenderbuffers(1, &rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+	renderer->procs.glEGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER,
+		image);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, rbo);
+	bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+		GL_FRAMEBUFFER_COMPLETE;
+	if (ok) {
+		static const GLfloat verts[] = {
+			-1, -1,
+			1, -1,
+			-1, 1,
+			1, 1,
+		};
+
+		glViewport(0, 0, plane_attribs.width, plane_attribs.height);
+		glDisable(GL_BLEND);
+		glDisable(GL_SCISSOR_TEST);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(texture->target, texture->tex);
+		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glUseProgram(shader->program);
+		glUniform1i(shader->tex, 0);
+		glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE,
+			0, verts);
+		glEnableVertexAttribArray(shader->pos_attrib);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glDisableVertexAttribArray(shader->pos_attrib);
+
+		glBindTexture(texture->target, 0);
+	} else {
+		wlr_log(WLR_ERROR, "Failed to create FBO for YUV plane %d", plane);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &rbo);
+
+	pop_gles2_debug(renderer);
+
+	wlr_egl_destroy_image(renderer->egl, image);
+	return ok;
+}
+
+static bool gles2_blit_to_yuv(struct wlr_renderer *wlr_renderer,
+		struct wlr_texture *wlr_texture, struct wlr_buffer *dst) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	if (!wlr_texture_is_gles2(wlr_texture)) {
+		return false;
+	}
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+
+	struct wlr_dmabuf_attributes attribs = {0};
+	if (!wlr_buffer_get_dmabuf(dst, &attribs)) {
+		return false;
+	}
+
+	uint32_t plane_formats[2];
+	if (!get_yuv_plane_formats(attribs.format, plane_formats) ||
+			attribs.n_planes != 2 ||
+			attribs.modifier != DRM_FORMAT_MOD_LINEAR) {
+		wlr_log(WLR_DEBUG, "Unsupported YUV buffer format 0x%"PRIX32
+			" or modifier 0x%"PRIX64, attribs.format, attribs.modifier);
+		return false;
+	}
+
+	bool found = false;
+	for (size_t i = 0; i < renderer->yuv_formats_len; i++) {
+		found |= renderer->yuv_formats[i] == attribs.format;
+	}
+	if (!found) {
+		return false;
+	}
+
+	bool external = texture->target == GL_TEXTURE_EXTERNAL_OES;
+	if ((external && renderer->shaders.yuv_y_ext.program == 0) ||
+			texture->chroma_planes_len > 0) {
+		return false;
+	}
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+
+	bool ok = blit_yuv_plane(renderer, texture, &attribs, 0, plane_formats[0],
+			external ? &renderer->shaders.yuv_y_ext : &renderer->shaders.yuv_y) &&
+		blit_yuv_plane(renderer, texture, &attribs, 1, plane_formats[1],
+			external ? &renderer->shaders.yuv_uv_ext : &renderer->shaders.yuv_uv);
+
+	push_gles2_debug(renderer);
+	glFlush();
+	pop_gles2_debug(renderer);
+
+	wlr_egl_restore_context(&prev_ctx);
+	return ok;
+}
+
 static int gles2_get_drm_fd(struct wlr_renderer *wlr_renderer) {
 	struct wlr_gles2_renderer *renderer =
 		gles2_get_renderer(wlr_renderer);
@@ -517,6 +1079,18 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 	glDeleteProgram(renderer->shaders.tex_rgba.program);
 	glDeleteProgram(renderer->shaders.tex_rgbx.program);
 	glDeleteProgram(renderer->shaders.tex_ext.program);
+	glDeleteProgram(renderer->shaders.tex_rgba_no_alpha.program);
+	glDeleteProgram(renderer->shaders.tex_rgbx_no_alpha.program);
+	glDeleteProgram(renderer->shaders.tex_ext_no_alpha.program);
+	glDeleteProgram(renderer->shaders.yuv_y.program);
+	glDeleteProgram(renderer->shaders.yuv_uv.program);
+	glDeleteProgram(renderer->shaders.yuv_y_ext.program);
+	glDeleteProgram(renderer->shaders.yuv_uv_ext.program);
+	glDeleteProgram(renderer->shaders.tex_nv12.program);
+	glDeleteProgram(renderer->shaders.tex_yuv420.program);
+	if (renderer->exts.pixel_buffer_object) {
+		glDeleteBuffers(WLR_GLES2_UPLOAD_BUFFERS, renderer->upload.buffers);
+	}
 	pop_gles2_debug(renderer);
 
 	if (renderer->exts.KHR_debug) {
@@ -531,9 +1105,105 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 		close(renderer->drm_fd);
 	}
 
+	wl_array_release(&renderer->batch.vertices);
 	free(renderer);
 }
 
+static int64_t gles2_render_timer_get_duration_ns(
+		struct wlr_render_timer *wlr_timer) {
+	struct wlr_gles2_render_timer *timer =
+		wl_container_of(wlr_timer, timer, base);
+	struct wlr_gles2_renderer *renderer = timer->renderer;
+	if (!timer->query_pending) {
+		return timer->duration;
+	}
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+
+	GLuint available = GL_FALSE;
+	renderer->procs.glGetQueryObjectuivEXT(timer->query,
+		GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+	if (available) {
+		timer->query_pending = false;
+
+		// Results are meaningless if the GPU clock was disturbed, e.g. by a
+		// frequency change
+		GLint disjoint = GL_FALSE;
+		glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+		if (!disjoint) {
+			GLuint64 elapsed = 0;
+			renderer->procs.glGetQueryObjectui64vEXT(timer->query,
+				GL_QUERY_RESULT_EXT, &elapsed);
+			timer->duration = elapsed;
+		}
+	}
+
+	wlr_egl_restore_context(&prev_ctx);
+	return timer->duration;
+}
+
+static void gles2_render_timer_destroy(struct wlr_render_timer *wlr_timer) {
+	struct wlr_gles2_render_timer *timer =
+		wl_container_of(wlr_timer, timer, base);
+	struct wlr_gles2_renderer *renderer = timer->renderer;
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+	renderer->procs.glDeleteQueriesEXT(1, &timer->query);
+	wlr_egl_restore_context(&prev_ctx);
+
+	free(timer);
+}
+
+static const struct wlr_render_timer_impl render_timer_impl = {
+	.get_duration_ns = gles2_render_timer_get_duration_ns,
+	.destroy = gles2_render_timer_destroy,
+};
+
+static struct wlr_render_timer *gles2_render_timer_create(
+		struct wlr_renderer *wlr_renderer) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	if (!renderer->exts.EXT_disjoint_timer_query) {
+		return NULL;
+	}
+
+	struct wlr_gles2_render_timer *timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_render_timer_init(&timer->base, &render_timer_impl, wlr_renderer);
+	timer->renderer = renderer;
+	timer->duration = -1;
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_save_context(&prev_ctx);
+	wlr_egl_make_current(renderer->egl);
+	renderer->procs.glGenQueriesEXT(1, &timer->query);
+	wlr_egl_restore_context(&prev_ctx);
+
+	return &timer->base;
+}
+
+static void gles2_trim(struct wlr_renderer *wlr_renderer,
+		enum wlr_trim_level level) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	if (level < WLR_TRIM_CRITICAL) {
+		return;
+	}
+
+	// The EGLImage and FBO are re-created the next time the buffer is bound
+	struct wlr_gles2_buffer *buffer, *buffer_tmp;
+	wl_list_for_each_safe(buffer, buffer_tmp, &renderer->buffers, link) {
+		if (buffer != renderer->current_buffer) {
+			destroy_buffer(buffer);
+		}
+	}
+}
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.destroy = gles2_destroy,
 	.bind_buffer = gles2_bind_buffer,
@@ -551,6 +1221,12 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.get_drm_fd = gles2_get_drm_fd,
 	.get_render_buffer_caps = gles2_get_render_buffer_caps,
 	.texture_from_buffer = gles2_texture_from_buffer,
+	.export_sync_file = gles2_export_sync_file,
+	.render_timer_create = gles2_render_timer_create,
+	.read_pixels_async = gles2_read_pixels_async,
+	.get_yuv_render_formats = gles2_get_yuv_render_formats,
+	.blit_to_yuv = gles2_blit_to_yuv,
+	.trim = gles2_trim,
 };
 
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
@@ -614,6 +1290,12 @@ static GLuint link_program(struct wlr_gles2_renderer *renderer,
 		const GLchar *vert_src, const GLchar *frag_src) {
 	push_gles2_debug(renderer);
 
+	GLuint prog = gles2_program_cache_link(renderer, vert_src, frag_src);
+	if (prog != 0) {
+		pop_gles2_debug(renderer);
+		return prog;
+	}
+
 	GLuint vert = compile_shader(renderer, GL_VERTEX_SHADER, vert_src);
 	if (!vert) {
 		goto error;
@@ -625,7 +1307,7 @@ static GLuint link_program(struct wlr_gles2_renderer *renderer,
 		goto error;
 	}
 
-	GLuint prog = glCreateProgram();
+	prog = glCreateProgram();
 	glAttachShader(prog, vert);
 	glAttachShader(prog, frag);
 	glLinkProgram(prog);
@@ -642,6 +1324,8 @@ static GLuint link_program(struct wlr_gles2_renderer *renderer,
 		goto error;
 	}
 
+	gles2_program_cache_add(renderer, vert_src, frag_src, prog);
+
 	pop_gles2_debug(renderer);
 	return prog;
 
@@ -650,6 +1334,21 @@ error:
 	return 0;
 }
 
+static bool link_tex_shader(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_tex_shader *shader, const GLchar *vert_src,
+		const GLchar *frag_src) {
+	GLuint prog = link_program(renderer, vert_src, frag_src);
+	shader->program = prog;
+	if (!prog) {
+		return false;
+	}
+	shader->tex = glGetUniformLocation(prog, "tex");
+	shader->pos_attrib = glGetAttribLocation(prog, "pos");
+	shader->tex_attrib = glGetAttribLocation(prog, "texcoord");
+	shader->alpha_attrib = glGetAttribLocation(prog, "alpha");
+	return true;
+}
+
 static bool check_gl_ext(const char *exts, const char *ext) {
 	size_t extlen = strlen(ext);
 	const char *end = exts + strlen(exts);
@@ -683,6 +1382,83 @@ extern const GLchar tex_vertex_src[];
 extern const GLchar tex_fragment_src_rgba[];
 extern const GLchar tex_fragment_src_rgbx[];
 extern const GLchar tex_fragment_src_external[];
+extern const GLchar tex_vertex_src_no_alpha[];
+extern const GLchar tex_fragment_src_rgba_no_alpha[];
+extern const GLchar tex_fragment_src_rgbx_no_alpha[];
+extern const GLchar tex_fragment_src_external_no_alpha[];
+extern const GLchar yuv_vertex_src[];
+extern const GLchar yuv_y_fragment_src[];
+extern const GLchar yuv_uv_fragment_src[];
+extern const GLchar yuv_y_fragment_src_external[];
+extern const GLchar yuv_uv_fragment_src_external[];
+extern const GLchar tex_fragment_src_nv12[];
+extern const GLchar tex_fragment_src_yuv420[];
+
+// Importing YUV DMA-BUFs plane by plane is optional
+static void link_tex_yuv_shader(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_tex_shader *shader, const GLchar *frag_src) {
+	if (!link_tex_shader(renderer, shader, tex_vertex_src, frag_src)) {
+		wlr_log(WLR_DEBUG, "Failed to create YUV texture shader");
+		return;
+	}
+	// Sampler bindings are program state, they only need to be set once
+	glUseProgram(shader->program);
+	glUniform1i(glGetUniformLocation(shader->program, "tex1"), 1);
+	glUniform1i(glGetUniformLocation(shader->program, "tex2"), 2);
+	glUseProgram(0);
+}
+
+static bool link_yuv_shader(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_yuv_shader *shader, const GLchar *frag_src) {
+	GLuint prog = link_program(renderer, yuv_vertex_src, frag_src);
+	if (!prog) {
+		return false;
+	}
+	shader->program = prog;
+	shader->tex = glGetUniformLocation(prog, "tex");
+	shader->pos_attrib = glGetAttribLocation(prog, "pos");
+	return true;
+}
+
+// YUV conversion is optional, failing to set it up isn't fatal
+static void init_yuv_formats(struct wlr_gles2_renderer *renderer) {
+	const struct wlr_drm_format_set *formats =
+		wlr_egl_get_dmabuf_render_formats(renderer->egl);
+	if (!renderer->procs.glEGLImageTargetRenderbufferStorageOES) {
+		return;
+	}
+
+	if (!link_yuv_shader(renderer, &renderer->shaders.yuv_y,
+				yuv_y_fragment_src) ||
+			!link_yuv_shader(renderer, &renderer->shaders.yuv_uv,
+				yuv_uv_fragment_src)) {
+		wlr_log(WLR_DEBUG, "Failed to create YUV conversion shaders");
+		return;
+	}
+	if (renderer->exts.OES_egl_image_external) {
+		link_yuv_shader(renderer, &renderer->shaders.yuv_y_ext,
+			yuv_y_fragment_src_external);
+		link_yuv_shader(renderer, &renderer->shaders.yuv_uv_ext,
+			yuv_uv_fragment_src_external);
+	}
+
+	static const uint32_t yuv_formats[] = { DRM_FORMAT_NV12, DRM_FORMAT_P010 };
+	for (size_t i = 0; i < sizeof(yuv_formats) / sizeof(yuv_formats[0]); i++) {
+		uint32_t plane_formats[2];
+		get_yuv_plane_formats(yuv_formats[i], plane_formats);
+		if (plane_formats[0] == DRM_FORMAT_R16 &&
+				!renderer->exts.EXT_texture_norm16) {
+			continue;
+		}
+		if (!wlr_drm_format_set_has(formats, plane_formats[0],
+					DRM_FORMAT_MOD_LINEAR) ||
+				!wlr_drm_format_set_has(formats, plane_formats[1],
+					DRM_FORMAT_MOD_LINEAR)) {
+			continue;
+		}
+		renderer->yuv_formats[renderer->yuv_formats_len++] = yuv_formats[i];
+	}
+}
 
 struct wlr_renderer *wlr_gles2_renderer_create_with_drm_fd(int drm_fd) {
 	struct wlr_egl *egl = wlr_egl_create_with_drm_fd(drm_fd);
@@ -721,6 +1497,7 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_array_init(&renderer->batch.vertices);
 
 	renderer->egl = egl;
 	renderer->exts_str = exts_str;
@@ -780,6 +1557,31 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 			"glEGLImageTargetRenderbufferStorageOES");
 	}
 
+	if (check_gl_ext(exts_str, "GL_EXT_disjoint_timer_query")) {
+		renderer->exts.EXT_disjoint_timer_query = true;
+		load_gl_proc(&renderer->procs.glGenQueriesEXT, "glGenQueriesEXT");
+		load_gl_proc(&renderer->procs.glDeleteQueriesEXT, "glDeleteQueriesEXT");
+		load_gl_proc(&renderer->procs.glBeginQueryEXT, "glBeginQueryEXT");
+		load_gl_proc(&renderer->procs.glEndQueryEXT, "glEndQueryEXT");
+		load_gl_proc(&renderer->procs.glGetQueryObjectuivEXT,
+			"glGetQueryObjectuivEXT");
+		load_gl_proc(&renderer->procs.glGetQueryObjectui64vEXT,
+			"glGetQueryObjectui64vEXT");
+	}
+
+	int gl_major = 0;
+	const char *gl_version = (const char *)glGetString(GL_VERSION);
+	if (gl_version != NULL &&
+			sscanf(gl_version, "OpenGL ES %d.", &gl_major) == 1 &&
+			gl_major >= 3) {
+		renderer->exts.pixel_buffer_object = true;
+		load_gl_proc(&renderer->procs.glMapBufferRange, "glMapBufferRange");
+		load_gl_proc(&renderer->procs.glUnmapBuffer, "glUnmapBuffer");
+	}
+
+	renderer->exts.OES_texture_npot = gl_major >= 3 ||
+		check_gl_ext(exts_str, "GL_OES_texture_npot");
+
 	if (renderer->exts.KHR_debug) {
 		glEnable(GL_DEBUG_OUTPUT_KHR);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
@@ -792,53 +1594,59 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 			GL_DEBUG_TYPE_PUSH_GROUP_KHR, GL_DONT_CARE, 0, NULL, GL_FALSE);
 	}
 
+	if (check_gl_ext(exts_str, "GL_OES_get_program_binary")) {
+		renderer->exts.OES_get_program_binary = true;
+		load_gl_proc(&renderer->procs.glGetProgramBinaryOES,
+			"glGetProgramBinaryOES");
+		load_gl_proc(&renderer->procs.glProgramBinaryOES,
+			"glProgramBinaryOES");
+	}
+
 	push_gles2_debug(renderer);
 
+	gles2_program_cache_init(renderer);
+
 	GLuint prog;
 	renderer->shaders.quad.program = prog =
 		link_program(renderer, quad_vertex_src, quad_fragment_src);
 	if (!renderer->shaders.quad.program) {
 		goto error;
 	}
-	renderer->shaders.quad.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.quad.color = glGetUniformLocation(prog, "color");
 	renderer->shaders.quad.pos_attrib = glGetAttribLocation(prog, "pos");
-
-	renderer->shaders.tex_rgba.program = prog =
-		link_program(renderer, tex_vertex_src, tex_fragment_src_rgba);
-	if (!renderer->shaders.tex_rgba.program) {
-		goto error;
-	}
-	renderer->shaders.tex_rgba.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgba.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgba.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgba.pos_attrib = glGetAttribLocation(prog, "pos");
-	renderer->shaders.tex_rgba.tex_attrib = glGetAttribLocation(prog, "texcoord");
-
-	renderer->shaders.tex_rgbx.program = prog =
-		link_program(renderer, tex_vertex_src, tex_fragment_src_rgbx);
-	if (!renderer->shaders.tex_rgbx.program) {
+	renderer->shaders.quad.color_attrib = glGetAttribLocation(prog, "color");
+
+	if (!link_tex_shader(renderer, &renderer->shaders.tex_rgba,
+			tex_vertex_src, tex_fragment_src_rgba) ||
+			!link_tex_shader(renderer, &renderer->shaders.tex_rgbx,
+			tex_vertex_src, tex_fragment_src_rgbx) ||
+			!link_tex_shader(renderer, &renderer->shaders.tex_rgba_no_alpha,
+			tex_vertex_src_no_alpha, tex_fragment_src_rgba_no_alpha) ||
+			!link_tex_shader(renderer, &renderer->shaders.tex_rgbx_no_alpha,
+			tex_vertex_src_no_alpha, tex_fragment_src_rgbx_no_alpha)) {
 		goto error;
 	}
-	renderer->shaders.tex_rgbx.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgbx.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgbx.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgbx.pos_attrib = glGetAttribLocation(prog, "pos");
-	renderer->shaders.tex_rgbx.tex_attrib = glGetAttribLocation(prog, "texcoord");
 
 	if (renderer->exts.OES_egl_image_external) {
-		renderer->shaders.tex_ext.program = prog =
-			link_program(renderer, tex_vertex_src, tex_fragment_src_external);
-		if (!renderer->shaders.tex_ext.program) {
+		if (!link_tex_shader(renderer, &renderer->shaders.tex_ext,
+				tex_vertex_src, tex_fragment_src_external) ||
+				!link_tex_shader(renderer, &renderer->shaders.tex_ext_no_alpha,
+				tex_vertex_src_no_alpha, tex_fragment_src_external_no_alpha)) {
 			goto error;
 		}
-		renderer->shaders.tex_ext.proj = glGetUniformLocation(prog, "proj");
-		renderer->shaders.tex_ext.tex = glGetUniformLocation(prog, "tex");
-		renderer->shaders.tex_ext.alpha = glGetUniformLocation(prog, "alpha");
-		renderer->shaders.tex_ext.pos_attrib = glGetAttribLocation(prog, "pos");
-		renderer->shaders.tex_ext.tex_attrib = glGetAttribLocation(prog, "texcoord");
 	}
 
+	if (renderer->exts.pixel_buffer_object) {
+		glGenBuffers(WLR_GLES2_UPLOAD_BUFFERS, renderer->upload.buffers);
+	}
+
+	init_yuv_formats(renderer);
+	link_tex_yuv_shader(renderer, &renderer->shaders.tex_nv12,
+		tex_fragment_src_nv12);
+	link_tex_yuv_shader(renderer, &renderer->shaders.tex_yuv420,
+		tex_fragment_src_yuv420);
+
+	gles2_program_cache_finish(renderer);
+
 	pop_gles2_debug(renderer);
 
 	wlr_egl_unset_current(renderer->egl);
@@ -850,6 +1658,11 @@ error:
 	glDeleteProgram(renderer->shaders.tex_rgba.program);
 	glDeleteProgram(renderer->shaders.tex_rgbx.program);
 	glDeleteProgram(renderer->shaders.tex_ext.program);
+	glDeleteProgram(renderer->shaders.tex_rgba_no_alpha.program);
+	glDeleteProgram(renderer->shaders.tex_rgbx_no_alpha.program);
+	glDeleteProgram(renderer->shaders.tex_ext_no_alpha.program);
+
+	gles2_program_cache_finish(renderer);
 
 	pop_gles2_debug(renderer);
 
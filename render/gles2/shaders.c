@@ -3,23 +3,18 @@
 
 // Colored quads
 const GLchar quad_vertex_src[] =
-"uniform mat3 proj;\n"
-"uniform vec4 color;\n"
 "attribute vec2 pos;\n"
-"attribute vec2 texcoord;\n"
+"attribute vec4 color;\n"
 "varying vec4 v_color;\n"
-"varying vec2 v_texcoord;\n"
 "\n"
 "void main() {\n"
-"	gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
+"	gl_Position = vec4(pos, 0.0, 1.0);\n"
 "	v_color = color;\n"
-"	v_texcoord = texcoord;\n"
 "}\n";
 
 const GLchar quad_fragment_src[] =
 "precision mediump float;\n"
 "varying vec4 v_color;\n"
-"varying vec2 v_texcoord;\n"
 "\n"
 "void main() {\n"
 "	gl_FragColor = v_color;\n"
@@ -27,34 +22,36 @@ const GLchar quad_fragment_src[] =
 
 // Textured quads
 const GLchar tex_vertex_src[] =
-"uniform mat3 proj;\n"
 "attribute vec2 pos;\n"
 "attribute vec2 texcoord;\n"
+"attribute float alpha;\n"
 "varying vec2 v_texcoord;\n"
+"varying float v_alpha;\n"
 "\n"
 "void main() {\n"
-"	gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
+"	gl_Position = vec4(pos, 0.0, 1.0);\n"
 "	v_texcoord = texcoord;\n"
+"	v_alpha = alpha;\n"
 "}\n";
 
 const GLchar tex_fragment_src_rgba[] =
 "precision mediump float;\n"
 "varying vec2 v_texcoord;\n"
 "uniform sampler2D tex;\n"
-"uniform float alpha;\n"
+"varying float v_alpha;\n"
 "\n"
 "void main() {\n"
-"	gl_FragColor = texture2D(tex, v_texcoord) * alpha;\n"
+"	gl_FragColor = texture2D(tex, v_texcoord) * v_alpha;\n"
 "}\n";
 
 const GLchar tex_fragment_src_rgbx[] =
 "precision mediump float;\n"
 "varying vec2 v_texcoord;\n"
 "uniform sampler2D tex;\n"
-"uniform float alpha;\n"
+"varying float v_alpha;\n"
 "\n"
 "void main() {\n"
-"	gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0) * alpha;\n"
+"	gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0) * v_alpha;\n"
 "}\n";
 
 const GLchar tex_fragment_src_external[] =
@@ -62,8 +59,116 @@ const GLchar tex_fragment_src_external[] =
 "precision mediump float;\n"
 "varying vec2 v_texcoord;\n"
 "uniform samplerExternalOES texture0;\n"
-"uniform float alpha;\n"
+"varying float v_alpha;\n"
+"\n"
+"void main() {\n"
+"	gl_FragColor = texture2D(texture0, v_texcoord) * v_alpha;\n"
+"}\n";
+
+// Textured quads drawn at full opacity, without the alpha multiplication
+const GLchar tex_vertex_src_no_alpha[] =
+"attribute vec2 pos;\n"
+"attribute vec2 texcoord;\n"
+"varying vec2 v_texcoord;\n"
+"\n"
+"void main() {\n"
+"	gl_Position = vec4(pos, 0.0, 1.0);\n"
+"	v_texcoord = texcoord;\n"
+"}\n";
+
+const GLchar tex_fragment_src_rgba_no_alpha[] =
+"precision mediump float;\n"
+"varying vec2 v_texcoord;\n"
+"uniform sampler2D tex;\n"
 "\n"
 "void main() {\n"
-"	gl_FragColor = texture2D(texture0, v_texcoord) * alpha;\n"
+"	gl_FragColor = texture2D(tex, v_texcoord);\n"
 "}\n";
+
+const GLchar tex_fragment_src_rgbx_no_alpha[] =
+"precision mediump float;\n"
+"varying vec2 v_texcoord;\n"
+"uniform sampler2D tex;\n"
+"\n"
+"void main() {\n"
+"	gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0);\n"
+"}\n";
+
+const GLchar tex_fragment_src_external_no_alpha[] =
+"#extension GL_OES_EGL_image_external : require\n\n"
+"precision mediump float;\n"
+"varying vec2 v_texcoord;\n"
+"uniform samplerExternalOES texture0;\n"
+"\n"
+"void main() {\n"
+"	gl_FragColor = texture2D(texture0, v_texcoord);\n"
+"}\n";
+
+// RGB to YUV conversion, BT.709 limited range. The chroma plane is half the
+// size of the luma plane, linear filtering averages the source pixels.
+const GLchar yuv_vertex_src[] =
+"attribute vec2 pos;\n"
+"varying vec2 v_texcoord;\n"
+"\n"
+"void main() {\n"
+"	gl_Position = vec4(pos, 0.0, 1.0);\n"
+"	v_texcoord = pos * 0.5 + 0.5;\n"
+"}\n";
+
+#define YUV_FRAGMENT_SRC(ext_header, sampler, main) \
+	ext_header \
+	"precision mediump float;\n" \
+	"varying vec2 v_texcoord;\n" \
+	"uniform " sampler " tex;\n" \
+	"\n" \
+	"void main() {\n" \
+	"	vec3 rgb = texture2D(tex, v_texcoord).rgb;\n" \
+	main \
+	"}\n"
+
+#define YUV_Y_MAIN \
+	"	float y = dot(rgb, vec3(0.2126, 0.7152, 0.0722));\n" \
+	"	gl_FragColor = vec4(y * 219.0 / 255.0 + 16.0 / 255.0, 0.0, 0.0, 1.0);\n"
+
+#define YUV_UV_MAIN \
+	"	vec2 uv = vec2(dot(rgb, vec3(-0.1146, -0.3854, 0.5)),\n" \
+	"		dot(rgb, vec3(0.5, -0.4542, -0.0458)));\n" \
+	"	gl_FragColor = vec4(uv * 224.0 / 255.0 + 128.0 / 255.0, 0.0, 1.0);\n"
+
+#define YUV_EXT_HEADER "#extension GL_OES_EGL_image_external : require\n\n"
+
+const GLchar yuv_y_fragment_src[] =
+	YUV_FRAGMENT_SRC("", "sampler2D", YUV_Y_MAIN);
+const GLchar yuv_uv_fragment_src[] =
+	YUV_FRAGMENT_SRC("", "sampler2D", YUV_UV_MAIN);
+const GLchar yuv_y_fragment_src_external[] =
+	YUV_FRAGMENT_SRC(YUV_EXT_HEADER, "samplerExternalOES", YUV_Y_MAIN);
+const GLchar yuv_uv_fragment_src_external[] =
+	YUV_FRAGMENT_SRC(YUV_EXT_HEADER, "samplerExternalOES", YUV_UV_MAIN);
+
+// YUV to RGB conversion of DMA-BUFs imported plane by plane, BT.601 limited
+// range. The chroma planes are bound to the texture units after the luma one.
+#define TEX_YUV_FRAGMENT_SRC(samplers, chroma) \
+	"precision mediump float;\n" \
+	"varying vec2 v_texcoord;\n" \
+	"varying float v_alpha;\n" \
+	"uniform sampler2D tex;\n" \
+	samplers \
+	"\n" \
+	"void main() {\n" \
+	"	float y = texture2D(tex, v_texcoord).r - 16.0 / 255.0;\n" \
+	chroma \
+	"	vec3 rgb = mat3(1.1644, 1.1644, 1.1644,\n" \
+	"		0.0, -0.3918, 2.0172,\n" \
+	"		1.5960, -0.8130, 0.0) * vec3(y, uv - 128.0 / 255.0);\n" \
+	"	gl_FragColor = vec4(rgb, 1.0) * v_alpha;\n" \
+	"}\n"
+
+const GLchar tex_fragment_src_nv12[] = TEX_YUV_FRAGMENT_SRC(
+	"uniform sampler2D tex1;\n",
+	"	vec2 uv = texture2D(tex1, v_texcoord).rg;\n");
+const GLchar tex_fragment_src_yuv420[] = TEX_YUV_FRAGMENT_SRC(
+	"uniform sampler2D tex1;\n"
+	"uniform sampler2D tex2;\n",
+	"	vec2 uv = vec2(texture2D(tex1, v_texcoord).r,\n"
+	"		texture2D(tex2, v_texcoord).r);\n");
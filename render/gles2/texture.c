@@ -4,6 +4,7 @@
 #include <GLES2/gl2ext.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-server-protocol.h>
 #include <wayland-util.h>
 #include <wlr/render/egl.h>
@@ -49,12 +50,74 @@ static bool check_stride(const struct wlr_pixel_format_info *fmt,
 	return true;
 }
 
-static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
-		uint32_t stride, uint32_t width, uint32_t height,
-		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
-		const void *data) {
-	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+/**
+ * Copy the rectangle into the next pixel buffer object of the ring and upload
+ * it from there. The copy lets the client buffer be released right away, and
+ * the transfer to the texture can happen asynchronously.
+ *
+ * The texture must be bound to GL_TEXTURE_2D. Returns false if the upload
+ * needs to go through the synchronous path.
+ */
+static bool write_pixels_with_pbo(struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *fmt,
+		const struct wlr_pixel_format_info *drm_fmt, uint32_t stride,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+		uint32_t dst_x, uint32_t dst_y, const void *data) {
+	if (!renderer->exts.pixel_buffer_object) {
+		return false;
+	}
+
+	// Rows are tightly packed, up to the default GL_UNPACK_ALIGNMENT of 4
+	size_t bytes_per_pixel = drm_fmt->bpp / 8;
+	size_t row_size = width * bytes_per_pixel;
+	size_t packed_stride = (row_size + 3) & ~(size_t)3;
+	size_t size = packed_stride * height;
+	if (size == 0 || size > WLR_GLES2_UPLOAD_BUFFER_MAX_SIZE) {
+		return false;
+	}
+
+	GLuint pbo = renderer->upload.buffers[renderer->upload.next];
+	renderer->upload.next =
+		(renderer->upload.next + 1) % WLR_GLES2_UPLOAD_BUFFERS;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	// Orphan the previous storage, which may still be read by the GPU
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	unsigned char *map = renderer->procs.glMapBufferRange(
+		GL_PIXEL_UNPACK_BUFFER, 0, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (map == NULL) {
+		wlr_log(WLR_DEBUG, "Failed to map pixel buffer object");
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	const unsigned char *src = (const unsigned char *)data +
+		src_y * stride + src_x * bytes_per_pixel;
+	for (uint32_t i = 0; i < height; i++) {
+		memcpy(map + i * packed_stride, src + i * stride, row_size);
+	}
+
+	bool ok = renderer->procs.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	if (ok) {
+		// The data pointer is an offset into the bound buffer
+		glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x, dst_y, width, height,
+			fmt->gl_format, fmt->gl_type, NULL);
+	} else {
+		wlr_log(WLR_DEBUG, "Pixel buffer object contents were lost");
+	}
 
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return ok;
+}
+
+/**
+ * Upload rectangles of the texture. The source data for a destination rect is
+ * read at an offset of (src_dx, src_dy).
+ */
+static bool write_pixels_rects(struct wlr_gles2_texture *texture,
+		uint32_t stride, const pixman_box32_t *rects, size_t rects_len,
+		int32_t src_dx, int32_t src_dy, const void *data) {
 	if (texture->target != GL_TEXTURE_2D || texture->image != EGL_NO_IMAGE_KHR) {
 		wlr_log(WLR_ERROR, "Cannot write pixels to immutable texture");
 		return false;
@@ -68,28 +131,46 @@ static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
 		drm_get_pixel_format_info(texture->drm_format);
 	assert(drm_fmt);
 
-	if (!check_stride(drm_fmt, stride, width)) {
-		return false;
+	for (size_t i = 0; i < rects_len; i++) {
+		if (!check_stride(drm_fmt, stride, rects[i].x2 - rects[i].x1)) {
+			return false;
+		}
 	}
 
 	struct wlr_egl_context prev_ctx;
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(texture->renderer->egl);
 
+	// Quads sampling the previous contents must be drawn first
+	if (texture->renderer->batch.texture == texture) {
+		gles2_flush_batch(texture->renderer);
+	}
+
 	push_gles2_debug(texture->renderer);
 
 	glBindTexture(GL_TEXTURE_2D, texture->tex);
+	texture->mipmap.dirty = true;
+
+	for (size_t i = 0; i < rects_len; i++) {
+		const pixman_box32_t *r = &rects[i];
+		uint32_t width = r->x2 - r->x1, height = r->y2 - r->y1;
+		uint32_t src_x = r->x1 + src_dx, src_y = r->y1 + src_dy;
+		if (write_pixels_with_pbo(texture->renderer, fmt, drm_fmt, stride,
+				width, height, src_x, src_y, r->x1, r->y1, data)) {
+			continue;
+		}
 
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / (drm_fmt->bpp / 8));
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, src_x);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, src_y);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / (drm_fmt->bpp / 8));
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, src_x);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, src_y);
 
-	glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x, dst_y, width, height,
-		fmt->gl_format, fmt->gl_type, data);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r->x1, r->y1, width, height,
+			fmt->gl_format, fmt->gl_type, data);
 
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -100,10 +181,33 @@ static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
 	return true;
 }
 
+static bool gles2_texture_write_pixels(struct wlr_texture *wlr_texture,
+		uint32_t stride, uint32_t width, uint32_t height,
+		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
+		const void *data) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+	pixman_box32_t rect = {
+		.x1 = dst_x,
+		.y1 = dst_y,
+		.x2 = dst_x + width,
+		.y2 = dst_y + height,
+	};
+	return write_pixels_rects(texture, stride, &rect, 1,
+		(int32_t)src_x - (int32_t)dst_x, (int32_t)src_y - (int32_t)dst_y, data);
+}
+
+static bool gles2_texture_write_pixels_rects(struct wlr_texture *wlr_texture,
+		uint32_t stride, const pixman_box32_t *rects, size_t rects_len,
+		const void *data) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+	return write_pixels_rects(texture, stride, rects, rects_len, 0, 0, data);
+}
+
 static bool gles2_texture_invalidate(struct wlr_gles2_texture *texture) {
 	if (texture->image == EGL_NO_IMAGE_KHR) {
 		return false;
 	}
+	texture->mipmap.dirty = true;
 	if (texture->target == GL_TEXTURE_EXTERNAL_OES) {
 		// External changes are immediately made visible by the GL implementation
 		return true;
@@ -113,11 +217,20 @@ static bool gles2_texture_invalidate(struct wlr_gles2_texture *texture) {
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(texture->renderer->egl);
 
+	if (texture->renderer->batch.texture == texture) {
+		gles2_flush_batch(texture->renderer);
+	}
+
 	push_gles2_debug(texture->renderer);
 
 	glBindTexture(texture->target, texture->tex);
 	texture->renderer->procs.glEGLImageTargetTexture2DOES(texture->target,
 		texture->image);
+	for (size_t i = 0; i < texture->chroma_planes_len; i++) {
+		glBindTexture(GL_TEXTURE_2D, texture->chroma_texs[i]);
+		texture->renderer->procs.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D,
+			texture->chroma_images[i]);
+	}
 	glBindTexture(texture->target, 0);
 
 	pop_gles2_debug(texture->renderer);
@@ -127,6 +240,112 @@ static bool gles2_texture_invalidate(struct wlr_gles2_texture *texture) {
 	return true;
 }
 
+static void texture_destroy_mipmap(struct wlr_gles2_texture *texture) {
+	glDeleteFramebuffers(1, &texture->mipmap.fbo);
+	glDeleteTextures(1, &texture->mipmap.tex);
+	texture->mipmap.fbo = 0;
+	texture->mipmap.tex = 0;
+}
+
+static bool texture_create_mipmap(struct wlr_gles2_texture *texture,
+		int width, int height) {
+	glGenTextures(1, &texture->mipmap.tex);
+	glBindTexture(GL_TEXTURE_2D, texture->mipmap.tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &texture->mipmap.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, texture->mipmap.fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_TEXTURE_2D, texture->mipmap.tex, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		wlr_log(WLR_ERROR, "Failed to create mipmap FBO: 0x%X", status);
+		return false;
+	}
+
+	return true;
+}
+
+bool gles2_texture_update_mipmap(struct wlr_gles2_texture *texture,
+		struct wlr_gles2_tex_shader *shader) {
+	struct wlr_gles2_renderer *renderer = texture->renderer;
+	if (texture->mipmap.failed) {
+		return false;
+	}
+	if (texture->mipmap.tex != 0 && !texture->mipmap.dirty) {
+		return true;
+	}
+
+	// At half the size, a single bilinear fetch averages 2x2 texels
+	int width = (texture->wlr_texture.width + 1) / 2;
+	int height = (texture->wlr_texture.height + 1) / 2;
+
+	push_gles2_debug(renderer);
+
+	bool ok = true;
+	if (texture->mipmap.tex == 0) {
+		ok = texture_create_mipmap(texture, width, height);
+	} else {
+		glBindFramebuffer(GL_FRAMEBUFFER, texture->mipmap.fbo);
+	}
+
+	if (ok) {
+		static const GLfloat positions[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+		static const GLfloat texcoords[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+
+		glViewport(0, 0, width, height);
+		glDisable(GL_BLEND);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(texture->target, texture->tex);
+		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		glUseProgram(shader->program);
+		glUniform1i(shader->tex, 0);
+		glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE,
+			0, positions);
+		glVertexAttribPointer(shader->tex_attrib, 2, GL_FLOAT, GL_FALSE,
+			0, texcoords);
+		if (shader->alpha_attrib >= 0) {
+			glVertexAttrib1f(shader->alpha_attrib, 1.0);
+		}
+		glEnableVertexAttribArray(shader->pos_attrib);
+		glEnableVertexAttribArray(shader->tex_attrib);
+
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+		glDisableVertexAttribArray(shader->pos_attrib);
+		glDisableVertexAttribArray(shader->tex_attrib);
+		glBindTexture(texture->target, 0);
+
+		glBindTexture(GL_TEXTURE_2D, texture->mipmap.tex);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glViewport(0, 0, renderer->viewport_width, renderer->viewport_height);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, renderer->current_buffer->fbo);
+
+	if (ok) {
+		texture->mipmap.dirty = false;
+	} else {
+		texture_destroy_mipmap(texture);
+		texture->mipmap.failed = true;
+	}
+
+	pop_gles2_debug(renderer);
+
+	return ok;
+}
+
 void gles2_texture_destroy(struct wlr_gles2_texture *texture) {
 	wl_list_remove(&texture->link);
 	if (texture->buffer != NULL) {
@@ -137,10 +356,20 @@ void gles2_texture_destroy(struct wlr_gles2_texture *texture) {
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(texture->renderer->egl);
 
+	if (texture->renderer->batch.texture == texture) {
+		gles2_flush_batch(texture->renderer);
+	}
+
 	push_gles2_debug(texture->renderer);
 
 	glDeleteTextures(1, &texture->tex);
 	wlr_egl_destroy_image(texture->renderer->egl, texture->image);
+	glDeleteTextures(texture->chroma_planes_len, texture->chroma_texs);
+	for (size_t i = 0; i < texture->chroma_planes_len; i++) {
+		wlr_egl_destroy_image(texture->renderer->egl,
+			texture->chroma_images[i]);
+	}
+	texture_destroy_mipmap(texture);
 
 	pop_gles2_debug(texture->renderer);
 
@@ -163,6 +392,7 @@ static void gles2_texture_unref(struct wlr_texture *wlr_texture) {
 static const struct wlr_texture_impl texture_impl = {
 	.is_opaque = gles2_texture_is_opaque,
 	.write_pixels = gles2_texture_write_pixels,
+	.write_pixels_rects = gles2_texture_write_pixels_rects,
 	.destroy = gles2_texture_unref,
 };
 
@@ -240,6 +470,94 @@ static struct wlr_texture *gles2_texture_from_pixels(
 	return &texture->wlr_texture;
 }
 
+// Single-plane formats the planes of YUV DMA-BUFs are imported as
+static size_t get_yuv_import_plane_formats(uint32_t format,
+		uint32_t plane_formats[static 3]) {
+	switch (format) {
+	case DRM_FORMAT_NV12:
+		plane_formats[0] = DRM_FORMAT_R8;
+		plane_formats[1] = DRM_FORMAT_GR88;
+		return 2;
+	case DRM_FORMAT_YUV420:
+		plane_formats[0] = DRM_FORMAT_R8;
+		plane_formats[1] = DRM_FORMAT_R8;
+		plane_formats[2] = DRM_FORMAT_R8;
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Import each plane of a YUV DMA-BUF as its own 2D texture. Drivers usually
+ * only expose these formats as GL_TEXTURE_EXTERNAL_OES, which can't be used
+ * for the downscaled copy and hides the cost of the conversion; the planes
+ * are converted by our own shader instead. Must be called with the context
+ * current.
+ */
+static bool import_dmabuf_planes(struct wlr_gles2_texture *texture,
+		struct wlr_dmabuf_attributes *attribs) {
+	struct wlr_gles2_renderer *renderer = texture->renderer;
+
+	uint32_t plane_formats[3];
+	size_t planes_len = get_yuv_import_plane_formats(attribs->format,
+		plane_formats);
+	if (planes_len == 0 || (size_t)attribs->n_planes != planes_len) {
+		return false;
+	}
+	GLuint program = planes_len == 2 ? renderer->shaders.tex_nv12.program :
+		renderer->shaders.tex_yuv420.program;
+	if (program == 0) {
+		return false;
+	}
+
+	EGLImageKHR images[3] = {0};
+	for (size_t i = 0; i < planes_len; i++) {
+		// Chroma planes are subsampled horizontally and vertically
+		struct wlr_dmabuf_attributes plane = {
+			.width = i == 0 ? attribs->width : (attribs->width + 1) / 2,
+			.height = i == 0 ? attribs->height : (attribs->height + 1) / 2,
+			.format = plane_formats[i],
+			.modifier = attribs->modifier,
+			.n_planes = 1,
+			.offset[0] = attribs->offset[i],
+			.stride[0] = attribs->stride[i],
+			.fd[0] = attribs->fd[i],
+		};
+		bool external_only;
+		images[i] = wlr_egl_create_image_from_dmabuf(renderer->egl, &plane,
+			&external_only);
+		if (images[i] == EGL_NO_IMAGE_KHR || external_only) {
+			wlr_log(WLR_DEBUG, "Failed to import DMA-BUF plane %zu", i);
+			for (size_t j = 0; j <= i; j++) {
+				wlr_egl_destroy_image(renderer->egl, images[j]);
+			}
+			return false;
+		}
+	}
+
+	GLuint texs[3];
+	glGenTextures(planes_len, texs);
+	for (size_t i = 0; i < planes_len; i++) {
+		glBindTexture(GL_TEXTURE_2D, texs[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		renderer->procs.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, images[i]);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	texture->target = GL_TEXTURE_2D;
+	texture->tex = texs[0];
+	texture->image = images[0];
+	texture->chroma_planes_len = planes_len - 1;
+	for (size_t i = 1; i < planes_len; i++) {
+		texture->chroma_texs[i - 1] = texs[i];
+		texture->chroma_images[i - 1] = images[i];
+	}
+	texture->has_alpha = false;
+	return true;
+}
+
 static struct wlr_texture *gles2_texture_from_dmabuf(
 		struct wlr_renderer *wlr_renderer,
 		struct wlr_dmabuf_attributes *attribs) {
@@ -269,6 +587,20 @@ static struct wlr_texture *gles2_texture_from_dmabuf(
 	wlr_egl_save_context(&prev_ctx);
 	wlr_egl_make_current(renderer->egl);
 
+	// Only split YUV DMA-BUFs the driver would import as external textures
+	const struct wlr_drm_format_set *render_formats =
+		wlr_egl_get_dmabuf_render_formats(renderer->egl);
+	if (!wlr_drm_format_set_has(render_formats, attribs->format,
+			attribs->modifier)) {
+		push_gles2_debug(renderer);
+		bool ok = import_dmabuf_planes(texture, attribs);
+		pop_gles2_debug(renderer);
+		if (ok) {
+			wlr_egl_restore_context(&prev_ctx);
+			return &texture->wlr_texture;
+		}
+	}
+
 	bool external_only;
 	texture->image =
 		wlr_egl_create_image_from_dmabuf(renderer->egl, attribs, &external_only);
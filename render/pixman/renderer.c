@@ -1,7 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <math.h>
 #include <pixman.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <wayland-server.h>
 #include <wlr/render/interface.h>
 #include <wlr/types/wlr_matrix.h>
@@ -9,7 +13,9 @@
 #include <wlr/util/log.h>
 
 #include "render/pixman.h"
+#include "render/wlr_renderer.h"
 #include "types/wlr_buffer.h"
+#include "util/time.h"
 
 static const struct wlr_renderer_impl renderer_impl;
 
@@ -53,6 +59,11 @@ static bool texture_is_opaque(struct wlr_texture *wlr_texture) {
 
 static void texture_destroy(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+	if (texture->renderer->recording) {
+		pixman_flush_draws(texture->renderer);
+	}
+	// Deferred frames may still read from the texture's memory
+	pixman_wait_frames(texture->renderer);
 	wl_list_remove(&texture->link);
 	pixman_image_unref(texture->image);
 	wlr_buffer_unlock(texture->buffer);
@@ -73,6 +84,10 @@ static void destroy_buffer(struct wlr_pixman_buffer *buffer) {
 	wl_list_remove(&buffer->buffer_destroy.link);
 
 	pixman_image_unref(buffer->image);
+	if (buffer->target != NULL) {
+		pixman_image_unref(buffer->target);
+	}
+	free(buffer->shadow_data);
 
 	free(buffer);
 }
@@ -83,6 +98,39 @@ static void handle_destroy_buffer(struct wl_listener *listener, void *data) {
 	destroy_buffer(buffer);
 }
 
+/**
+ * Move the image of the buffer's memory to buffer->target and render into a
+ * copy in system memory instead. Must be called with data pointer access.
+ */
+static bool buffer_create_shadow(struct wlr_pixman_buffer *buffer) {
+	pixman_image_t *target = buffer->image;
+	int width = pixman_image_get_width(target);
+	int height = pixman_image_get_height(target);
+	int stride = pixman_image_get_stride(target);
+
+	void *data = malloc((size_t)height * stride);
+	if (data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	pixman_image_t *shadow = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(target), width, height, data, stride);
+	if (shadow == NULL) {
+		wlr_log(WLR_ERROR, "Failed to allocate pixman image");
+		free(data);
+		return false;
+	}
+
+	// Passes only redraw the damaged parts of the previous contents
+	pixman_image_composite32(PIXMAN_OP_SRC, target, NULL, shadow,
+		0, 0, 0, 0, 0, 0, width, height);
+
+	buffer->image = shadow;
+	buffer->target = target;
+	buffer->shadow_data = data;
+	return true;
+}
+
 static struct wlr_pixman_buffer *create_buffer(
 		struct wlr_pixman_renderer *renderer, struct wlr_buffer *wlr_buffer) {
 	struct wlr_pixman_buffer *buffer = calloc(1, sizeof(*buffer));
@@ -102,22 +150,30 @@ static struct wlr_pixman_buffer *create_buffer(
 		wlr_log(WLR_ERROR, "Failed to get buffer data");
 		goto error_buffer;
 	}
-	wlr_buffer_end_data_ptr_access(wlr_buffer);
 
 	pixman_format_code_t format = get_pixman_format_from_drm(drm_format);
 	if (format == 0) {
 		wlr_log(WLR_ERROR, "Unsupported pixman drm format 0x%"PRIX32,
 				drm_format);
-		goto error_buffer;
+		goto error_access;
 	}
 
 	buffer->image = pixman_image_create_bits(format, wlr_buffer->width,
 			wlr_buffer->height, data, stride);
 	if (!buffer->image) {
 		wlr_log(WLR_ERROR, "Failed to allocate pixman image");
-		goto error_buffer;
+		goto error_access;
 	}
 
+	struct wlr_dmabuf_attributes dmabuf;
+	if (renderer->shadow_enabled &&
+			wlr_buffer_get_dmabuf(wlr_buffer, &dmabuf) &&
+			!buffer_create_shadow(buffer)) {
+		pixman_image_unref(buffer->image);
+		goto error_access;
+	}
+	wlr_buffer_end_data_ptr_access(wlr_buffer);
+
 	buffer->buffer_destroy.notify = handle_destroy_buffer;
 	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
 
@@ -128,16 +184,65 @@ static struct wlr_pixman_buffer *create_buffer(
 
 	return buffer;
 
+error_access:
+	wlr_buffer_end_data_ptr_access(wlr_buffer);
 error_buffer:
 	free(buffer);
 	return NULL;
 }
 
+// Record a part of the buffer drawn into, clipped to the scissor box
+static void add_shadow_damage(struct wlr_pixman_renderer *renderer,
+		const pixman_box32_t *bounds) {
+	if (renderer->current_buffer->shadow_data == NULL) {
+		return;
+	}
+
+	pixman_region32_t region;
+	pixman_region32_init_rects(&region, bounds, 1);
+	if (renderer->scissor.enabled) {
+		const pixman_box32_t *box = &renderer->scissor.box;
+		pixman_region32_intersect_rect(&region, &region, box->x1, box->y1,
+			box->x2 - box->x1, box->y2 - box->y1);
+	}
+	pixman_region32_union(&renderer->shadow_damage,
+		&renderer->shadow_damage, &region);
+	pixman_region32_fini(&region);
+}
+
+// Copy the damaged parts of the shadow copy to the buffer
+static void buffer_flush_shadow(struct wlr_pixman_renderer *renderer,
+		struct wlr_pixman_buffer *buffer) {
+	pixman_region32_t *damage = &renderer->shadow_damage;
+	pixman_region32_intersect_rect(damage, damage, 0, 0,
+		buffer->buffer->width, buffer->buffer->height);
+
+	pixman_image_set_clip_region32(buffer->image, NULL);
+
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage,
+		&rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		pixman_image_composite32(PIXMAN_OP_SRC, buffer->image, NULL,
+			buffer->target, rect->x1, rect->y1, 0, 0, rect->x1, rect->y1,
+			rect->x2 - rect->x1, rect->y2 - rect->y1);
+	}
+
+	pixman_region32_clear(damage);
+}
+
 static void pixman_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 		uint32_t height) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	assert(renderer->deferred_frame == NULL);
 	renderer->width = width;
 	renderer->height = height;
+	renderer->recording = renderer->workers != NULL || renderer->defer_pass;
+
+	if (wlr_renderer->timer != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &renderer->pass_start);
+	}
 
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 	assert(buffer != NULL);
@@ -151,14 +256,18 @@ static void pixman_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 
 	// If the data pointer has changed, re-create the Pixman image. This can
 	// happen if it's a client buffer and the wl_shm_pool has been resized.
-	if (data != pixman_image_get_data(buffer->image)) {
+	pixman_image_t **image =
+		buffer->shadow_data != NULL ? &buffer->target : &buffer->image;
+	if (data != pixman_image_get_data(*image)) {
 		pixman_format_code_t format = get_pixman_format_from_drm(drm_format);
 		assert(format != 0);
 
-		pixman_image_unref(buffer->image);
-		buffer->image = pixman_image_create_bits_no_clear(format,
+		pixman_image_unref(*image);
+		*image = pixman_image_create_bits_no_clear(format,
 			buffer->buffer->width, buffer->buffer->height, data, stride);
 	}
+
+	pixman_region32_clear(&renderer->shadow_damage);
 }
 
 static void pixman_end(struct wlr_renderer *wlr_renderer) {
@@ -166,7 +275,34 @@ static void pixman_end(struct wlr_renderer *wlr_renderer) {
 
 	assert(renderer->current_buffer != NULL);
 
-	wlr_buffer_end_data_ptr_access(renderer->current_buffer->buffer);
+	if (renderer->defer_pass) {
+		// The frame takes over the data pointer access
+		renderer->deferred_frame = pixman_frame_create(renderer);
+	}
+	if (renderer->deferred_frame == NULL) {
+		if (renderer->recording) {
+			pixman_flush_draws(renderer);
+		}
+
+		struct wlr_pixman_buffer *buffer = renderer->current_buffer;
+		if (buffer->shadow_data != NULL) {
+			buffer_flush_shadow(renderer, buffer);
+		}
+
+		wlr_buffer_end_data_ptr_access(buffer->buffer);
+	}
+	renderer->scissor.enabled = false;
+	renderer->recording = false;
+	renderer->defer_pass = false;
+
+	if (wlr_renderer->timer != NULL) {
+		struct wlr_pixman_render_timer *timer =
+			wl_container_of(wlr_renderer->timer, timer, base);
+		struct timespec now, diff;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timespec_sub(&diff, &now, &renderer->pass_start);
+		timer->duration = timespec_to_nsec(&diff);
+	}
 }
 
 static void pixman_clear(struct wlr_renderer *wlr_renderer,
@@ -181,6 +317,18 @@ static void pixman_clear(struct wlr_renderer *wlr_renderer,
 		.alpha = color[3] * 0xFFFF,
 	};
 
+	pixman_box32_t bounds = { 0, 0, renderer->width, renderer->height };
+	add_shadow_damage(renderer, &bounds);
+
+	if (renderer->recording) {
+		struct wlr_pixman_draw *draw =
+			pixman_add_draw(renderer, PIXMAN_OP_SRC, &bounds);
+		if (draw != NULL) {
+			draw->color = colour;
+		}
+		return;
+	}
+
 	pixman_image_t *fill = pixman_image_create_solid_fill(&colour);
 
 	pixman_image_composite32(PIXMAN_OP_SRC, fill, NULL, buffer->image, 0, 0, 0,
@@ -194,6 +342,19 @@ static void pixman_scissor(struct wlr_renderer *wlr_renderer,
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 
+	renderer->scissor.enabled = box != NULL;
+	if (box != NULL) {
+		renderer->scissor.box = (pixman_box32_t){
+			.x1 = box->x,
+			.y1 = box->y,
+			.x2 = box->x + box->width,
+			.y2 = box->y + box->height,
+		};
+	}
+	if (renderer->recording) {
+		return;
+	}
+
 	if (box != NULL) {
 		struct pixman_region32 region = {0};
 		pixman_region32_init_rect(&region, box->x, box->y, box->width,
@@ -221,6 +382,22 @@ static void matrix_to_pixman_transform(struct pixman_transform *transform,
 	pixman_transform_from_pixman_f_transform(transform, &ftr);
 }
 
+/**
+ * Check whether the matrix only translates by whole pixels, in which case
+ * pixman can use its untransformed composite paths.
+ */
+static bool matrix_get_int_translation(const float mat[static 9],
+		int32_t *dx, int32_t *dy) {
+	if (mat[0] != 1.0 || mat[1] != 0.0 || mat[3] != 0.0 || mat[4] != 1.0 ||
+			mat[6] != 0.0 || mat[7] != 0.0 || mat[8] != 1.0 ||
+			mat[2] != floorf(mat[2]) || mat[5] != floorf(mat[5])) {
+		return false;
+	}
+	*dx = mat[2];
+	*dy = mat[5];
+	return true;
+}
+
 static bool pixman_render_subtexture_with_matrix(
 		struct wlr_renderer *wlr_renderer, struct wlr_texture *wlr_texture,
 		const struct wlr_fbox *fbox, const float matrix[static 9],
@@ -229,7 +406,10 @@ static bool pixman_render_subtexture_with_matrix(
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 
-	if (texture->buffer != NULL) {
+	// Recorded draws keep data pointer access until they are flushed
+	bool has_access = texture->buffer != NULL &&
+		renderer->recording && texture->buffer->accessing_data_ptr;
+	if (texture->buffer != NULL && !has_access) {
 		void *data;
 		uint32_t drm_format;
 		size_t stride;
@@ -251,31 +431,81 @@ static bool pixman_render_subtexture_with_matrix(
 		}
 	}
 
-	// TODO: don't create a mask if alpha == 1.0
-	struct pixman_color mask_colour = {0};
-	mask_colour.alpha = 0xFFFF * alpha;
-	pixman_image_t *mask = pixman_image_create_solid_fill(&mask_colour);
-
 	float m[9];
 	memcpy(m, matrix, sizeof(m));
 	wlr_matrix_scale(m, 1.0 / fbox->width, 1.0 / fbox->height);
 
+	int32_t dx = 0, dy = 0;
+	bool translate_only = matrix_get_int_translation(m, &dx, &dy);
+
 	struct pixman_transform transform = {0};
-	matrix_to_pixman_transform(&transform, m);
-	pixman_transform_invert(&transform, &transform);
+	if (!translate_only) {
+		matrix_to_pixman_transform(&transform, m);
+		pixman_transform_invert(&transform, &transform);
+	}
 
-	pixman_image_set_transform(texture->image, &transform);
+	pixman_box32_t bounds;
+	if (translate_only) {
+		bounds = (pixman_box32_t){
+			.x1 = dx,
+			.y1 = dy,
+			.x2 = dx + texture->wlr_texture.width,
+			.y2 = dy + texture->wlr_texture.height,
+		};
+	} else {
+		pixman_get_transformed_bounds(&bounds, m,
+			texture->wlr_texture.width, texture->wlr_texture.height);
+	}
+	add_shadow_damage(renderer, &bounds);
+
+	if (renderer->recording) {
+		struct wlr_pixman_draw *draw =
+			pixman_add_draw(renderer, PIXMAN_OP_OVER, &bounds);
+		if (draw != NULL) {
+			draw->image = pixman_image_ref(texture->image);
+			draw->transform = transform;
+			draw->translate_only = translate_only;
+			draw->dx = dx;
+			draw->dy = dy;
+			draw->mask_alpha = 0xFFFF * alpha;
+			if (texture->buffer != NULL && !has_access) {
+				draw->buffer = wlr_buffer_lock(texture->buffer);
+				has_access = true;
+			}
+		}
+		if (texture->buffer != NULL && !has_access) {
+			wlr_buffer_end_data_ptr_access(texture->buffer);
+		}
+		return true;
+	}
+
+	pixman_image_t *mask = NULL;
+	if (alpha != 1.0) {
+		struct pixman_color mask_colour = {0};
+		mask_colour.alpha = 0xFFFF * alpha;
+		mask = pixman_image_create_solid_fill(&mask_colour);
+	}
 
 	// TODO clip properly with src_x and src_y
-	pixman_image_composite32(PIXMAN_OP_OVER, texture->image, mask,
+	if (translate_only) {
+		pixman_image_set_transform(texture->image, NULL);
+		pixman_image_composite32(PIXMAN_OP_OVER, texture->image, mask,
+			buffer->image, 0, 0, 0, 0, dx, dy, texture->wlr_texture.width,
+			texture->wlr_texture.height);
+	} else {
+		pixman_image_set_transform(texture->image, &transform);
+		pixman_image_composite32(PIXMAN_OP_OVER, texture->image, mask,
 			buffer->image, 0, 0, 0, 0, 0, 0, renderer->width,
 			renderer->height);
+	}
 
 	if (texture->buffer != NULL) {
 		wlr_buffer_end_data_ptr_access(texture->buffer);
 	}
 
-	pixman_image_unref(mask);
+	if (mask != NULL) {
+		pixman_image_unref(mask);
+	}
 
 	return true;
 }
@@ -321,6 +551,22 @@ static void pixman_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 	matrix_to_pixman_transform(&transform, m);
 	pixman_transform_invert(&transform, &transform);
 
+	pixman_box32_t bounds;
+	pixman_get_transformed_bounds(&bounds, m, width, height);
+	add_shadow_damage(renderer, &bounds);
+
+	if (renderer->recording) {
+		struct wlr_pixman_draw *draw =
+			pixman_add_draw(renderer, PIXMAN_OP_OVER, &bounds);
+		if (draw != NULL) {
+			draw->image = image;
+			draw->transform = transform;
+		} else {
+			pixman_image_unref(image);
+		}
+		return;
+	}
+
 	pixman_image_set_transform(image, &transform);
 
 	pixman_image_composite32(PIXMAN_OP_OVER, image, NULL, buffer->image,
@@ -329,6 +575,67 @@ static void pixman_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 	pixman_image_unref(image);
 }
 
+// Fill all rectangles of the region in one go, instead of one clipped
+// composite per rectangle
+static void fill_region(struct wlr_pixman_renderer *renderer, pixman_op_t op,
+		const float color[static 4], const pixman_region32_t *clip) {
+	struct pixman_color colour = {
+		.red = color[0] * 0xFFFF,
+		.green = color[1] * 0xFFFF,
+		.blue = color[2] * 0xFFFF,
+		.alpha = color[3] * 0xFFFF,
+	};
+
+	pixman_region32_t region;
+	pixman_region32_init_rect(&region, 0, 0,
+		renderer->width, renderer->height);
+	pixman_region32_intersect(&region, &region, (pixman_region32_t *)clip);
+
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&region,
+		&rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		add_shadow_damage(renderer, &rects[i]);
+	}
+	if (renderer->recording) {
+		for (int i = 0; i < rects_len; i++) {
+			struct wlr_pixman_draw *draw =
+				pixman_add_draw(renderer, op, &rects[i]);
+			if (draw != NULL) {
+				draw->color = colour;
+			}
+		}
+	} else if (rects_len > 0) {
+		pixman_image_fill_boxes(op, renderer->current_buffer->image, &colour,
+			rects_len, rects);
+	}
+
+	pixman_region32_fini(&region);
+}
+
+static bool pixman_submit_ops(struct wlr_renderer *wlr_renderer,
+		const struct wlr_render_op *ops, size_t ops_len) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+
+	bool ok = true;
+	for (size_t i = 0; i < ops_len; i++) {
+		const struct wlr_render_op *op = &ops[i];
+		if (op->type == WLR_RENDER_OP_CLEAR && op->clip != NULL) {
+			pixman_scissor(wlr_renderer, NULL);
+			fill_region(renderer, PIXMAN_OP_SRC, op->clear.color, op->clip);
+		} else if (op->type == WLR_RENDER_OP_FILL) {
+			pixman_scissor(wlr_renderer, NULL);
+			fill_region(renderer, op->fill.color[3] == 1.0 ?
+				PIXMAN_OP_SRC : PIXMAN_OP_OVER, op->fill.color, op->clip);
+		} else {
+			ok = render_op_draw_clipped(wlr_renderer, op) && ok;
+		}
+	}
+	pixman_scissor(wlr_renderer, NULL);
+
+	return ok;
+}
+
 static const uint32_t *pixman_get_shm_texture_formats(
 		struct wlr_renderer *wlr_renderer, size_t *len) {
 	return get_pixman_drm_formats(len);
@@ -446,7 +753,12 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 		wlr_texture_destroy(&tex->wlr_texture);
 	}
 
+	pixman_frames_finish(renderer);
 	wlr_drm_format_set_finish(&renderer->drm_formats);
+	pixman_region32_fini(&renderer->shadow_damage);
+
+	pixman_workers_destroy(renderer->workers);
+	wl_array_release(&renderer->draws);
 
 	free(renderer);
 }
@@ -462,6 +774,51 @@ static uint32_t pixman_preferred_read_format(
 	return get_drm_format_from_pixman(pixman_format);
 }
 
+/**
+ * Copy pixels between 8-bit per channel formats with the same channel order,
+ * which only differ in whether the high byte is alpha or padding, e.g.
+ * XRGB8888 and ARGB8888. This is the common case for screencopy and needs no
+ * conversion, the loops are simple enough for the compiler to vectorize.
+ *
+ * Returns false if the formats aren't compatible.
+ */
+static bool read_pixels_copy(pixman_image_t *src_image, pixman_format_code_t fmt,
+		uint32_t stride, uint32_t width, uint32_t height, uint32_t src_x,
+		uint32_t src_y, uint32_t dst_x, uint32_t dst_y, void *data) {
+	pixman_format_code_t src_fmt = pixman_image_get_format(src_image);
+	int type = PIXMAN_FORMAT_TYPE(fmt);
+	if ((type != PIXMAN_TYPE_ARGB && type != PIXMAN_TYPE_ABGR) ||
+			PIXMAN_FORMAT_TYPE(src_fmt) != type ||
+			PIXMAN_FORMAT_BPP(fmt) != 32 || PIXMAN_FORMAT_BPP(src_fmt) != 32 ||
+			PIXMAN_FORMAT_RGB(fmt) != PIXMAN_FORMAT_RGB(src_fmt) ||
+			PIXMAN_FORMAT_R(fmt) != 8) {
+		return false;
+	}
+	// The padding byte of the source must become opaque alpha
+	bool fill_alpha = PIXMAN_FORMAT_A(fmt) != 0 &&
+		PIXMAN_FORMAT_A(src_fmt) == 0;
+
+	const uint8_t *src = (const uint8_t *)pixman_image_get_data(src_image) +
+		(size_t)src_y * pixman_image_get_stride(src_image) +
+		(size_t)src_x * 4;
+	uint8_t *dst = (uint8_t *)data + (size_t)dst_y * stride +
+		(size_t)dst_x * 4;
+	for (uint32_t y = 0; y < height; y++) {
+		if (fill_alpha) {
+			const uint32_t *src_row = (const uint32_t *)src;
+			uint32_t *dst_row = (uint32_t *)dst;
+			for (uint32_t x = 0; x < width; x++) {
+				dst_row[x] = src_row[x] | 0xFF000000;
+			}
+		} else {
+			memcpy(dst, src, (size_t)width * 4);
+		}
+		src += pixman_image_get_stride(src_image);
+		dst += stride;
+	}
+	return true;
+}
+
 static bool pixman_read_pixels(struct wlr_renderer *wlr_renderer,
 		uint32_t drm_format, uint32_t *flags, uint32_t stride,
 		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
@@ -469,6 +826,10 @@ static bool pixman_read_pixels(struct wlr_renderer *wlr_renderer,
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 
+	if (renderer->recording) {
+		pixman_flush_draws(renderer);
+	}
+
 	pixman_format_code_t fmt = get_pixman_format_from_drm(drm_format);
 	if (fmt == 0) {
 		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format");
@@ -479,6 +840,11 @@ static bool pixman_read_pixels(struct wlr_renderer *wlr_renderer,
 		drm_get_pixel_format_info(drm_format);
 	assert(drm_fmt);
 
+	if (read_pixels_copy(buffer->image, fmt, stride, width, height,
+			src_x, src_y, dst_x, dst_y, data)) {
+		return true;
+	}
+
 	pixman_image_t *dst = pixman_image_create_bits_no_clear(fmt, width, height,
 			data, stride);
 
@@ -494,6 +860,38 @@ static uint32_t pixman_get_render_buffer_caps(struct wlr_renderer *renderer) {
 	return WLR_BUFFER_CAP_DATA_PTR;
 }
 
+static const struct wlr_render_timer_impl render_timer_impl;
+
+static int64_t pixman_render_timer_get_duration_ns(
+		struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer =
+		wl_container_of(wlr_timer, timer, base);
+	return timer->duration;
+}
+
+static void pixman_render_timer_destroy(struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer =
+		wl_container_of(wlr_timer, timer, base);
+	free(timer);
+}
+
+static const struct wlr_render_timer_impl render_timer_impl = {
+	.get_duration_ns = pixman_render_timer_get_duration_ns,
+	.destroy = pixman_render_timer_destroy,
+};
+
+static struct wlr_render_timer *pixman_render_timer_create(
+		struct wlr_renderer *wlr_renderer) {
+	struct wlr_pixman_render_timer *timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_render_timer_init(&timer->base, &render_timer_impl, wlr_renderer);
+	timer->duration = -1;
+	return &timer->base;
+}
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.begin = pixman_begin,
 	.end = pixman_end,
@@ -501,6 +899,7 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.scissor = pixman_scissor,
 	.render_subtexture_with_matrix = pixman_render_subtexture_with_matrix,
 	.render_quad_with_matrix = pixman_render_quad_with_matrix,
+	.submit_ops = pixman_submit_ops,
 	.get_shm_texture_formats = pixman_get_shm_texture_formats,
 	.get_render_formats = pixman_get_render_formats,
 	.texture_from_buffer = pixman_texture_from_buffer,
@@ -509,6 +908,7 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.preferred_read_format = pixman_preferred_read_format,
 	.read_pixels = pixman_read_pixels,
 	.get_render_buffer_caps = pixman_get_render_buffer_caps,
+	.render_timer_create = pixman_render_timer_create,
 };
 
 struct wlr_renderer *wlr_pixman_renderer_create(void) {
@@ -522,6 +922,14 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 	wlr_renderer_init(&renderer->wlr_renderer, &renderer_impl);
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_array_init(&renderer->draws);
+	wl_list_init(&renderer->frames);
+	renderer->workers = pixman_workers_create();
+	pixman_region32_init(&renderer->shadow_damage);
+
+	const char *shadow_env = getenv("WLR_PIXMAN_SHADOW");
+	renderer->shadow_enabled = shadow_env == NULL ||
+		strcmp(shadow_env, "0") != 0;
 
 	size_t len = 0;
 	const uint32_t *formats = get_pixman_drm_formats(&len);
@@ -534,6 +942,20 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 	return &renderer->wlr_renderer;
 }
 
+void pixman_renderer_defer_pass(struct wlr_renderer *wlr_renderer) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	assert(!wlr_renderer->rendering);
+	renderer->defer_pass = true;
+}
+
+struct wlr_pixman_frame *pixman_renderer_take_frame(
+		struct wlr_renderer *wlr_renderer) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	struct wlr_pixman_frame *frame = renderer->deferred_frame;
+	renderer->deferred_frame = NULL;
+	return frame;
+}
+
 pixman_image_t *wlr_pixman_texture_get_image(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	return texture->image;
@@ -543,5 +965,11 @@ pixman_image_t *wlr_pixman_renderer_get_current_image(
 		struct wlr_renderer *wlr_renderer) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 	assert(renderer->current_buffer);
+	if (renderer->recording) {
+		pixman_flush_draws(renderer);
+	}
+	// The caller may draw anywhere
+	pixman_box32_t bounds = { 0, 0, renderer->width, renderer->height };
+	add_shadow_damage(renderer, &bounds);
 	return renderer->current_buffer->image;
 }
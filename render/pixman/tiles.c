@@ -0,0 +1,452 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+#include "render/pixman.h"
+#include "types/wlr_buffer.h"
+
+// Height of the horizontal bands the output is split into. Each band is
+// composited by a single thread, in draw order, so the result doesn't depend
+// on the number of threads.
+#define BAND_HEIGHT 32
+#define MAX_THREADS 64
+
+struct wlr_pixman_frame {
+	struct wl_list link; // wlr_pixman_renderer.frames
+
+	// Draw buffers are only locked: data pointer access can't be nested, and
+	// must not outlive the pass
+	struct wl_array draws; // struct wlr_pixman_draw
+	// Locked, with data pointer access until the frame is destroyed
+	struct wlr_buffer *buffer;
+	pixman_image_t *image; // referenced
+	pixman_image_t *target; // referenced, if the buffer has a shadow copy
+	pixman_region32_t shadow_damage;
+	int32_t width, height;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool composited; // protected by mutex
+};
+
+struct wlr_pixman_workers {
+	pthread_t threads[MAX_THREADS];
+	int n_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+	bool stop;
+
+	// current job, protected by mutex
+	struct wlr_pixman_renderer *renderer;
+	int next_band, n_bands, pending_bands;
+};
+
+static void box_intersect(pixman_box32_t *dst, const pixman_box32_t *a,
+		const pixman_box32_t *b) {
+	dst->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+	dst->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+	dst->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+	dst->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+}
+
+static bool box_empty(const pixman_box32_t *box) {
+	return box->x1 >= box->x2 || box->y1 >= box->y2;
+}
+
+// Images are private to the thread: pixman updates its internal image state
+// lazily, even for sources
+static pixman_image_t *image_alias(pixman_image_t *image) {
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+		pixman_image_get_width(image), pixman_image_get_height(image),
+		pixman_image_get_data(image), pixman_image_get_stride(image));
+}
+
+static void composite_draw(struct wlr_pixman_draw *draw, pixman_image_t *dst,
+		const pixman_box32_t *band) {
+	pixman_box32_t box;
+	box_intersect(&box, &draw->bounds, band);
+	if (box_empty(&box)) {
+		return;
+	}
+
+	pixman_image_t *src;
+	if (draw->image == NULL) {
+		src = pixman_image_create_solid_fill(&draw->color);
+	} else {
+		src = image_alias(draw->image);
+		if (!draw->translate_only) {
+			pixman_image_set_transform(src, &draw->transform);
+		}
+	}
+
+	pixman_image_t *mask = NULL;
+	if (draw->mask_alpha != 0xFFFF) {
+		pixman_color_t mask_color = { .alpha = draw->mask_alpha };
+		mask = pixman_image_create_solid_fill(&mask_color);
+	}
+
+	int32_t width = box.x2 - box.x1;
+	int32_t height = box.y2 - box.y1;
+	int32_t src_x = box.x1, src_y = box.y1;
+	if (draw->translate_only) {
+		src_x -= draw->dx;
+		src_y -= draw->dy;
+	}
+	pixman_image_composite32(draw->op, src, mask, dst, src_x, src_y,
+		box.x1, box.y1, box.x1, box.y1, width, height);
+
+	if (mask != NULL) {
+		pixman_image_unref(mask);
+	}
+	pixman_image_unref(src);
+}
+
+static void composite_draws(struct wl_array *draws, pixman_image_t *image,
+		const pixman_box32_t *box) {
+	pixman_image_t *dst = image_alias(image);
+	struct wlr_pixman_draw *draw;
+	wl_array_for_each(draw, draws) {
+		composite_draw(draw, dst, box);
+	}
+	pixman_image_unref(dst);
+}
+
+static void composite_band(struct wlr_pixman_renderer *renderer, int band) {
+	pixman_box32_t band_box = {
+		.x1 = 0,
+		.y1 = band * BAND_HEIGHT,
+		.x2 = renderer->width,
+		.y2 = (band + 1) * BAND_HEIGHT,
+	};
+	composite_draws(&renderer->draws, renderer->current_buffer->image,
+		&band_box);
+}
+
+static void release_draws(struct wl_array *draws, bool accessing) {
+	struct wlr_pixman_draw *draw;
+	wl_array_for_each(draw, draws) {
+		if (draw->image != NULL) {
+			pixman_image_unref(draw->image);
+		}
+		if (draw->buffer != NULL) {
+			if (accessing) {
+				wlr_buffer_end_data_ptr_access(draw->buffer);
+			}
+			wlr_buffer_unlock(draw->buffer);
+		}
+	}
+	draws->size = 0;
+}
+
+// Processes bands until none are left, with the mutex held
+static void run_bands(struct wlr_pixman_workers *workers) {
+	while (workers->next_band < workers->n_bands) {
+		int band = workers->next_band++;
+		pthread_mutex_unlock(&workers->mutex);
+		composite_band(workers->renderer, band);
+		pthread_mutex_lock(&workers->mutex);
+
+		if (--workers->pending_bands == 0) {
+			pthread_cond_signal(&workers->done_cond);
+		}
+	}
+}
+
+static void *worker_run(void *data) {
+	struct wlr_pixman_workers *workers = data;
+
+	pthread_mutex_lock(&workers->mutex);
+	while (!workers->stop) {
+		run_bands(workers);
+		pthread_cond_wait(&workers->work_cond, &workers->mutex);
+	}
+	pthread_mutex_unlock(&workers->mutex);
+
+	return NULL;
+}
+
+static int get_thread_count(void) {
+	const char *env = getenv("WLR_PIXMAN_THREADS");
+	if (env == NULL || env[0] == '\0') {
+		return 1;
+	}
+
+	char *end;
+	errno = 0;
+	long n = strtol(env, &end, 10);
+	if (errno != 0 || *end != '\0' || n < 0) {
+		wlr_log(WLR_ERROR, "Invalid WLR_PIXMAN_THREADS value: %s", env);
+		return 1;
+	}
+	if (n == 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (n > MAX_THREADS) {
+		n = MAX_THREADS;
+	}
+	return n > 1 ? n : 1;
+}
+
+struct wlr_pixman_workers *pixman_workers_create(void) {
+	int n_threads = get_thread_count();
+	if (n_threads <= 1) {
+		return NULL;
+	}
+
+	struct wlr_pixman_workers *workers = calloc(1, sizeof(*workers));
+	if (workers == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	pthread_mutex_init(&workers->mutex, NULL);
+	pthread_cond_init(&workers->work_cond, NULL);
+	pthread_cond_init(&workers->done_cond, NULL);
+
+	// The thread flushing the draws works as well
+	for (int i = 0; i < n_threads - 1; ++i) {
+		int ret = pthread_create(&workers->threads[i], NULL, worker_run,
+			workers);
+		if (ret != 0) {
+			wlr_log(WLR_ERROR, "pthread_create failed: %s", strerror(ret));
+			break;
+		}
+		workers->n_threads++;
+	}
+	if (workers->n_threads == 0) {
+		pixman_workers_destroy(workers);
+		return NULL;
+	}
+
+	wlr_log(WLR_INFO, "Compositing with %d pixman threads",
+		workers->n_threads + 1);
+	return workers;
+}
+
+void pixman_workers_destroy(struct wlr_pixman_workers *workers) {
+	if (workers == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&workers->mutex);
+	workers->stop = true;
+	pthread_cond_broadcast(&workers->work_cond);
+	pthread_mutex_unlock(&workers->mutex);
+
+	for (int i = 0; i < workers->n_threads; ++i) {
+		pthread_join(workers->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&workers->done_cond);
+	pthread_cond_destroy(&workers->work_cond);
+	pthread_mutex_destroy(&workers->mutex);
+	free(workers);
+}
+
+struct wlr_pixman_draw *pixman_add_draw(struct wlr_pixman_renderer *renderer,
+		pixman_op_t op, const pixman_box32_t *bounds) {
+	pixman_box32_t box = {
+		.x1 = 0,
+		.y1 = 0,
+		.x2 = renderer->width,
+		.y2 = renderer->height,
+	};
+	box_intersect(&box, &box, bounds);
+	if (renderer->scissor.enabled) {
+		box_intersect(&box, &box, &renderer->scissor.box);
+	}
+	if (box_empty(&box)) {
+		return NULL;
+	}
+
+	struct wlr_pixman_draw *draw =
+		wl_array_add(&renderer->draws, sizeof(*draw));
+	if (draw == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	*draw = (struct wlr_pixman_draw){
+		.op = op,
+		.bounds = box,
+		.mask_alpha = 0xFFFF,
+	};
+	return draw;
+}
+
+void pixman_get_transformed_bounds(pixman_box32_t *bounds,
+		const float mat[static 9], float width, float height) {
+	const float corners[4][2] = {
+		{ 0, 0 }, { width, 0 }, { 0, height }, { width, height },
+	};
+
+	float x1 = INFINITY, y1 = INFINITY, x2 = -INFINITY, y2 = -INFINITY;
+	for (size_t i = 0; i < 4; ++i) {
+		float x = mat[0] * corners[i][0] + mat[1] * corners[i][1] + mat[2];
+		float y = mat[3] * corners[i][0] + mat[4] * corners[i][1] + mat[5];
+		x1 = fminf(x1, x);
+		y1 = fminf(y1, y);
+		x2 = fmaxf(x2, x);
+		y2 = fmaxf(y2, y);
+	}
+
+	// Leave room for bilinear filtering at the edges
+	bounds->x1 = floorf(x1) - 1;
+	bounds->y1 = floorf(y1) - 1;
+	bounds->x2 = ceilf(x2) + 1;
+	bounds->y2 = ceilf(y2) + 1;
+}
+
+void pixman_flush_draws(struct wlr_pixman_renderer *renderer) {
+	if (renderer->draws.size == 0) {
+		return;
+	}
+
+	struct wlr_pixman_workers *workers = renderer->workers;
+	if (workers == NULL) {
+		pixman_box32_t box = { 0, 0, renderer->width, renderer->height };
+		composite_draws(&renderer->draws, renderer->current_buffer->image,
+			&box);
+		release_draws(&renderer->draws, true);
+		return;
+	}
+
+	int n_bands = (renderer->height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+	pthread_mutex_lock(&workers->mutex);
+	workers->renderer = renderer;
+	workers->next_band = 0;
+	workers->n_bands = n_bands;
+	workers->pending_bands = n_bands;
+	pthread_cond_broadcast(&workers->work_cond);
+
+	run_bands(workers);
+	while (workers->pending_bands > 0) {
+		pthread_cond_wait(&workers->done_cond, &workers->mutex);
+	}
+	workers->renderer = NULL;
+	pthread_mutex_unlock(&workers->mutex);
+
+	release_draws(&renderer->draws, true);
+}
+
+struct wlr_pixman_frame *pixman_frame_create(
+		struct wlr_pixman_renderer *renderer) {
+	struct wlr_pixman_frame *frame = calloc(1, sizeof(*frame));
+	if (frame == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
+	frame->draws = renderer->draws;
+	wl_array_init(&renderer->draws);
+	struct wlr_pixman_draw *draw;
+	wl_array_for_each(draw, &frame->draws) {
+		if (draw->buffer != NULL) {
+			wlr_buffer_end_data_ptr_access(draw->buffer);
+		}
+	}
+	frame->buffer = wlr_buffer_lock(buffer->buffer);
+	frame->image = pixman_image_ref(buffer->image);
+	if (buffer->target != NULL) {
+		frame->target = pixman_image_ref(buffer->target);
+	}
+	frame->width = renderer->width;
+	frame->height = renderer->height;
+
+	pixman_region32_init(&frame->shadow_damage);
+	pixman_region32_intersect_rect(&frame->shadow_damage,
+		&renderer->shadow_damage, 0, 0,
+		buffer->buffer->width, buffer->buffer->height);
+	pixman_region32_clear(&renderer->shadow_damage);
+
+	pthread_mutex_init(&frame->mutex, NULL);
+	pthread_cond_init(&frame->cond, NULL);
+	wl_list_insert(&renderer->frames, &frame->link);
+	return frame;
+}
+
+void pixman_frame_composite(struct wlr_pixman_frame *frame) {
+	pixman_box32_t box = { 0, 0, frame->width, frame->height };
+	composite_draws(&frame->draws, frame->image, &box);
+
+	if (frame->target != NULL) {
+		pixman_image_t *src = image_alias(frame->image);
+		pixman_image_t *dst = image_alias(frame->target);
+		int rects_len;
+		const pixman_box32_t *rects =
+			pixman_region32_rectangles(&frame->shadow_damage, &rects_len);
+		for (int i = 0; i < rects_len; i++) {
+			const pixman_box32_t *rect = &rects[i];
+			pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, dst,
+				rect->x1, rect->y1, 0, 0, rect->x1, rect->y1,
+				rect->x2 - rect->x1, rect->y2 - rect->y1);
+		}
+		pixman_image_unref(dst);
+		pixman_image_unref(src);
+	}
+
+	pthread_mutex_lock(&frame->mutex);
+	frame->composited = true;
+	pthread_cond_broadcast(&frame->cond);
+	pthread_mutex_unlock(&frame->mutex);
+}
+
+void pixman_frame_wait(struct wlr_pixman_frame *frame) {
+	pthread_mutex_lock(&frame->mutex);
+	while (!frame->composited) {
+		pthread_cond_wait(&frame->cond, &frame->mutex);
+	}
+	pthread_mutex_unlock(&frame->mutex);
+}
+
+void pixman_frame_destroy(struct wlr_pixman_frame *frame) {
+	if (frame == NULL) {
+		return;
+	}
+
+	pixman_frame_wait(frame);
+
+	wl_list_remove(&frame->link);
+	release_draws(&frame->draws, false);
+	wl_array_release(&frame->draws);
+	pixman_image_unref(frame->image);
+	if (frame->target != NULL) {
+		pixman_image_unref(frame->target);
+	}
+	pixman_region32_fini(&frame->shadow_damage);
+	wlr_buffer_end_data_ptr_access(frame->buffer);
+	wlr_buffer_unlock(frame->buffer);
+
+	pthread_cond_destroy(&frame->cond);
+	pthread_mutex_destroy(&frame->mutex);
+	free(frame);
+}
+
+void pixman_wait_frames(struct wlr_pixman_renderer *renderer) {
+	struct wlr_pixman_frame *frame;
+	wl_list_for_each(frame, &renderer->frames, link) {
+		pixman_frame_wait(frame);
+	}
+}
+
+void pixman_frames_finish(struct wlr_pixman_renderer *renderer) {
+	if (renderer->deferred_frame != NULL) {
+		pixman_frame_composite(renderer->deferred_frame);
+		pixman_frame_destroy(renderer->deferred_frame);
+		renderer->deferred_frame = NULL;
+	}
+
+	// Frames still owned by their callers outlive the renderer
+	struct wlr_pixman_frame *frame, *tmp;
+	wl_list_for_each_safe(frame, tmp, &renderer->frames, link) {
+		pixman_frame_wait(frame);
+		wl_list_remove(&frame->link);
+		wl_list_init(&frame->link);
+	}
+}
@@ -23,6 +23,7 @@ struct wlr_swapchain *wlr_swapchain_create(
 	swapchain->allocator = alloc;
 	swapchain->width = width;
 	swapchain->height = height;
+	swapchain->len = WLR_SWAPCHAIN_CAP;
 
 	swapchain->format = wlr_drm_format_dup(format);
 	if (swapchain->format == NULL) {
@@ -36,6 +37,16 @@ struct wlr_swapchain *wlr_swapchain_create(
 	return swapchain;
 }
 
+void wlr_swapchain_set_depth(struct wlr_swapchain *swapchain, size_t len,
+		bool strict) {
+	assert(len >= 1 && len <= WLR_SWAPCHAIN_CAP);
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		assert(swapchain->slots[i].buffer == NULL);
+	}
+	swapchain->len = len;
+	swapchain->strict = strict;
+}
+
 static void slot_reset(struct wlr_swapchain_slot *slot) {
 	if (slot->acquired) {
 		wl_list_remove(&slot->release.link);
@@ -56,6 +67,15 @@ void wlr_swapchain_destroy(struct wlr_swapchain *swapchain) {
 	free(swapchain);
 }
 
+void wlr_swapchain_trim(struct wlr_swapchain *swapchain) {
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+		if (slot->buffer != NULL && !slot->acquired) {
+			slot_reset(slot);
+		}
+	}
+}
+
 static void slot_handle_release(struct wl_listener *listener, void *data) {
 	struct wlr_swapchain_slot *slot =
 		wl_container_of(listener, slot, release);
@@ -82,16 +102,27 @@ static struct wlr_buffer *slot_acquire(struct wlr_swapchain *swapchain,
 
 struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain,
 		int *age) {
-	struct wlr_swapchain_slot *free_slot = NULL;
-	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+	struct wlr_swapchain_slot *free_slot = NULL, *oldest_slot = NULL;
+	for (size_t i = 0; i < swapchain->len; i++) {
 		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
 		if (slot->acquired) {
 			continue;
 		}
-		if (slot->buffer != NULL) {
+		if (slot->buffer == NULL) {
+			free_slot = slot;
+			continue;
+		}
+		if (!swapchain->strict) {
 			return slot_acquire(swapchain, slot, age);
 		}
-		free_slot = slot;
+		// Buffers which have never been submitted have an age of zero
+		if (oldest_slot == NULL || slot->age == 0 ||
+				(oldest_slot->age != 0 && slot->age > oldest_slot->age)) {
+			oldest_slot = slot;
+		}
+	}
+	if (oldest_slot != NULL && (free_slot == NULL || oldest_slot->age == 0)) {
+		return slot_acquire(swapchain, oldest_slot, age);
 	}
 	if (free_slot == NULL) {
 		wlr_log(WLR_ERROR, "No free output buffer slot");
@@ -0,0 +1,313 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/render/wlr_texture_atlas.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/log.h>
+#include "render/pixel_format.h"
+#include "util/signal.h"
+
+// Transparent pixels between regions, on each side
+#define ATLAS_GUTTER 1
+
+/**
+ * Pages are split into horizontal shelves, filled from left to right. The
+ * space of a shelf is only reused once all of its regions are destroyed.
+ */
+struct wlr_texture_atlas_shelf {
+	struct wl_list link; // wlr_texture_atlas_page.shelves, top to bottom
+	int y, height;
+	int x; // start of the free space
+	size_t regions_len;
+};
+
+struct wlr_texture_atlas_page {
+	struct wlr_texture_atlas *atlas;
+	struct wl_list link; // wlr_texture_atlas.pages
+	struct wlr_texture *texture;
+	struct wl_list shelves; // wlr_texture_atlas_shelf.link
+	int height; // used by shelves
+	size_t regions_len;
+};
+
+struct wlr_texture_atlas *wlr_texture_atlas_create(
+		struct wlr_renderer *renderer, uint32_t format, int page_size) {
+	assert(page_size > 0);
+
+	const struct wlr_pixel_format_info *info =
+		drm_get_pixel_format_info(format);
+	if (info == NULL) {
+		wlr_log(WLR_ERROR, "Unsupported texture atlas format 0x%"PRIX32,
+			format);
+		return NULL;
+	}
+
+	struct wlr_texture_atlas *atlas = calloc(1, sizeof(*atlas));
+	if (atlas == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	atlas->renderer = renderer;
+	atlas->format = format;
+	atlas->page_size = page_size;
+	atlas->max_region_size = page_size / 4;
+	atlas->bpp = info->bpp / 8;
+	wl_list_init(&atlas->pages);
+	wl_signal_init(&atlas->events.destroy);
+	return atlas;
+}
+
+static void page_destroy(struct wlr_texture_atlas_page *page) {
+	struct wlr_texture_atlas_shelf *shelf, *tmp;
+	wl_list_for_each_safe(shelf, tmp, &page->shelves, link) {
+		wl_list_remove(&shelf->link);
+		free(shelf);
+	}
+	wl_list_remove(&page->link);
+	wlr_texture_destroy(page->texture);
+	free(page);
+}
+
+void wlr_texture_atlas_destroy(struct wlr_texture_atlas *atlas) {
+	if (atlas == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&atlas->events.destroy, atlas);
+
+	struct wlr_texture_atlas_page *page, *tmp;
+	wl_list_for_each_safe(page, tmp, &atlas->pages, link) {
+		if (page->regions_len == 0) {
+			page_destroy(page);
+		}
+	}
+
+	if (wl_list_empty(&atlas->pages)) {
+		free(atlas);
+	} else {
+		atlas->destroyed = true;
+	}
+}
+
+static struct wlr_texture_atlas_page *page_create(
+		struct wlr_texture_atlas *atlas) {
+	struct wlr_texture_atlas_page *page = calloc(1, sizeof(*page));
+	if (page == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	uint32_t stride = atlas->page_size * atlas->bpp;
+	void *data = calloc(atlas->page_size, stride);
+	if (data == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		free(page);
+		return NULL;
+	}
+	page->texture = wlr_texture_from_pixels(atlas->renderer, atlas->format,
+		stride, atlas->page_size, atlas->page_size, data);
+	free(data);
+	if (page->texture == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create texture atlas page");
+		free(page);
+		return NULL;
+	}
+
+	page->atlas = atlas;
+	wl_list_init(&page->shelves);
+	wl_list_insert(atlas->pages.prev, &page->link);
+	return page;
+}
+
+// Find a shelf for a region of the given size, including gutters
+static struct wlr_texture_atlas_shelf *page_get_shelf(
+		struct wlr_texture_atlas_page *page, int width, int height) {
+	int page_size = page->atlas->page_size;
+
+	struct wlr_texture_atlas_shelf *best = NULL, *shelf;
+	wl_list_for_each(shelf, &page->shelves, link) {
+		if (shelf->height < height || shelf->x + width > page_size) {
+			continue;
+		}
+		if (best == NULL || shelf->height < best->height) {
+			best = shelf;
+		}
+	}
+
+	// Don't waste a tall shelf on a short region if there is room left
+	bool has_room = page->height + height <= page_size;
+	if (best != NULL && (best->height <= 2 * height || !has_room)) {
+		return best;
+	}
+	if (!has_room) {
+		return NULL;
+	}
+
+	shelf = calloc(1, sizeof(*shelf));
+	if (shelf == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	shelf->y = page->height;
+	shelf->height = height;
+	page->height += height;
+	wl_list_insert(page->shelves.prev, &shelf->link);
+	return shelf;
+}
+
+static bool region_upload(struct wlr_texture_atlas_region *region,
+		struct wlr_buffer *buffer) {
+	struct wlr_texture_atlas *atlas = region->page->atlas;
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+		return false;
+	}
+	if (format != atlas->format) {
+		wlr_buffer_end_data_ptr_access(buffer);
+		return false;
+	}
+
+	// Upload the gutters along with the contents, the space may have been
+	// used by another region before
+	int width = region->box.width + 2 * ATLAS_GUTTER;
+	int height = region->box.height + 2 * ATLAS_GUTTER;
+	size_t padded_stride = width * atlas->bpp;
+	uint8_t *padded = calloc(height, padded_stride);
+	if (padded == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		wlr_buffer_end_data_ptr_access(buffer);
+		return false;
+	}
+	for (int y = 0; y < region->box.height; y++) {
+		memcpy(padded + (y + ATLAS_GUTTER) * padded_stride +
+			ATLAS_GUTTER * atlas->bpp, (uint8_t *)data + y * stride,
+			region->box.width * atlas->bpp);
+	}
+	wlr_buffer_end_data_ptr_access(buffer);
+
+	// Gutters past the edges of the page are clipped
+	int x = region->box.x - ATLAS_GUTTER, y = region->box.y - ATLAS_GUTTER;
+	int src_x = 0, src_y = 0;
+	if (x < 0) {
+		src_x = -x;
+		x = 0;
+	}
+	if (y < 0) {
+		src_y = -y;
+		y = 0;
+	}
+	if (x + width - src_x > atlas->page_size) {
+		width = atlas->page_size - x + src_x;
+	}
+	if (y + height - src_y > atlas->page_size) {
+		height = atlas->page_size - y + src_y;
+	}
+
+	bool ok = wlr_texture_write_pixels(region->texture, padded_stride,
+		width - src_x, height - src_y, src_x, src_y, x, y, padded);
+	free(padded);
+	return ok;
+}
+
+struct wlr_texture_atlas_region *wlr_texture_atlas_add_buffer(
+		struct wlr_texture_atlas *atlas, struct wlr_buffer *buffer) {
+	assert(!atlas->destroyed);
+
+	if (buffer->width > atlas->max_region_size ||
+			buffer->height > atlas->max_region_size) {
+		return NULL;
+	}
+
+	// Gutters are shared between neighbours
+	int width = buffer->width + ATLAS_GUTTER;
+	int height = buffer->height + ATLAS_GUTTER;
+
+	struct wlr_texture_atlas_page *page;
+	struct wlr_texture_atlas_shelf *shelf = NULL;
+	wl_list_for_each(page, &atlas->pages, link) {
+		shelf = page_get_shelf(page, width, height);
+		if (shelf != NULL) {
+			break;
+		}
+	}
+	if (shelf == NULL) {
+		page = page_create(atlas);
+		if (page == NULL) {
+			return NULL;
+		}
+		shelf = page_get_shelf(page, width, height);
+		if (shelf == NULL) {
+			page_destroy(page);
+			return NULL;
+		}
+	}
+
+	struct wlr_texture_atlas_region *region = calloc(1, sizeof(*region));
+	if (region == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		if (page->regions_len == 0) {
+			page_destroy(page);
+		}
+		return NULL;
+	}
+	region->page = page;
+	region->shelf = shelf;
+	region->texture = page->texture;
+	region->box = (struct wlr_box){
+		.x = shelf->x + ATLAS_GUTTER,
+		.y = shelf->y + ATLAS_GUTTER,
+		.width = buffer->width,
+		.height = buffer->height,
+	};
+	shelf->x += width;
+	shelf->regions_len++;
+	page->regions_len++;
+
+	if (!region_upload(region, buffer)) {
+		wlr_texture_atlas_region_destroy(region);
+		return NULL;
+	}
+
+	return region;
+}
+
+void wlr_texture_atlas_region_destroy(struct wlr_texture_atlas_region *region) {
+	if (region == NULL) {
+		return;
+	}
+
+	struct wlr_texture_atlas_page *page = region->page;
+	struct wlr_texture_atlas_shelf *shelf = region->shelf;
+	struct wlr_texture_atlas *atlas = page->atlas;
+	free(region);
+
+	shelf->regions_len--;
+	if (shelf->regions_len == 0) {
+		shelf->x = 0;
+	}
+
+	// Give the space of empty shelves at the bottom back to the page
+	while (!wl_list_empty(&page->shelves)) {
+		shelf = wl_container_of(page->shelves.prev, shelf, link);
+		if (shelf->regions_len > 0) {
+			break;
+		}
+		page->height = shelf->y;
+		wl_list_remove(&shelf->link);
+		free(shelf);
+	}
+
+	page->regions_len--;
+	if (page->regions_len == 0) {
+		page_destroy(page);
+		if (atlas->destroyed && wl_list_empty(&atlas->pages)) {
+			free(atlas);
+		}
+	}
+}
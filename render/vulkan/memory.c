@@ -0,0 +1,346 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "render/vulkan.h"
+
+/*
+ * Device memory is suballocated from large blocks with a buddy allocator, one
+ * set of blocks per memory type. Drivers limit the number of allocations
+ * (maxMemoryAllocationCount can be as low as 4096) and allocating is slow, so
+ * shm textures and staging buffers shouldn't each get their own.
+ *
+ * Buddies are powers of two, which keeps them aligned to their size and thus
+ * satisfies any alignment up to their size. Linear and optimal resources are
+ * kept in separate blocks so that bufferImageGranularity never applies.
+ */
+
+#define WLR_VK_MEMORY_BLOCK_SIZE ((VkDeviceSize)64 * 1024 * 1024)
+#define WLR_VK_MEMORY_MIN_SIZE ((VkDeviceSize)4096)
+// Number of buddy orders, from WLR_VK_MEMORY_MIN_SIZE to the block size
+#define WLR_VK_MEMORY_ORDERS 15
+// Larger allocations waste too much of a block and get their own memory
+#define WLR_VK_MEMORY_MAX_SUBALLOC (WLR_VK_MEMORY_BLOCK_SIZE / 2)
+
+static_assert(WLR_VK_MEMORY_MIN_SIZE << (WLR_VK_MEMORY_ORDERS - 1) ==
+	WLR_VK_MEMORY_BLOCK_SIZE, "Buddy orders must cover the block size");
+
+struct wlr_vk_memory_range {
+	struct wl_list link; // wlr_vk_memory_block.free
+	VkDeviceSize offset;
+};
+
+struct wlr_vk_memory_block {
+	struct wl_list link; // wlr_vk_renderer.memory_blocks
+	VkDeviceMemory memory;
+	uint32_t mem_type;
+	bool linear;
+	void *cpu_mapping; // if the memory type is host-visible
+
+	// wlr_vk_memory_range.link, free buddies of each order
+	struct wl_list free[WLR_VK_MEMORY_ORDERS];
+	size_t allocs_len;
+};
+
+static VkDeviceSize order_size(int order) {
+	return WLR_VK_MEMORY_MIN_SIZE << order;
+}
+
+static int order_for_size(VkDeviceSize size) {
+	int order = 0;
+	while (order_size(order) < size) {
+		order++;
+	}
+	return order;
+}
+
+static bool add_free_range(struct wlr_vk_memory_block *block, int order,
+		VkDeviceSize offset) {
+	struct wlr_vk_memory_range *range = calloc(1, sizeof(*range));
+	if (range == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	range->offset = offset;
+	wl_list_insert(&block->free[order], &range->link);
+	return true;
+}
+
+static void block_destroy(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_memory_block *block) {
+	if (block->allocs_len > 0) {
+		wlr_log(WLR_ERROR, "Destroying Vulkan memory block with %zu "
+			"allocations left", block->allocs_len);
+	}
+
+	for (int i = 0; i < WLR_VK_MEMORY_ORDERS; i++) {
+		struct wlr_vk_memory_range *range, *tmp;
+		wl_list_for_each_safe(range, tmp, &block->free[i], link) {
+			wl_list_remove(&range->link);
+			free(range);
+		}
+	}
+
+	VkDevice dev = renderer->dev->dev;
+	if (block->cpu_mapping != NULL) {
+		vkUnmapMemory(dev, block->memory);
+	}
+	vkFreeMemory(dev, block->memory, NULL);
+	wl_list_remove(&block->link);
+	free(block);
+}
+
+static bool is_host_visible(struct wlr_vk_renderer *renderer,
+		uint32_t mem_type) {
+	VkPhysicalDeviceMemoryProperties props;
+	vkGetPhysicalDeviceMemoryProperties(renderer->dev->phdev, &props);
+	return props.memoryTypes[mem_type].propertyFlags &
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+static struct wlr_vk_memory_block *block_create(
+		struct wlr_vk_renderer *renderer, uint32_t mem_type, bool linear) {
+	struct wlr_vk_memory_block *block = calloc(1, sizeof(*block));
+	if (block == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	block->mem_type = mem_type;
+	block->linear = linear;
+	for (int i = 0; i < WLR_VK_MEMORY_ORDERS; i++) {
+		wl_list_init(&block->free[i]);
+	}
+	wl_list_init(&block->link);
+
+	VkDevice dev = renderer->dev->dev;
+	VkMemoryAllocateInfo mem_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = WLR_VK_MEMORY_BLOCK_SIZE,
+		.memoryTypeIndex = mem_type,
+	};
+	VkResult res = vkAllocateMemory(dev, &mem_info, NULL, &block->memory);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkAllocateMemory", res);
+		free(block);
+		return NULL;
+	}
+
+	if (is_host_visible(renderer, mem_type)) {
+		res = vkMapMemory(dev, block->memory, 0, VK_WHOLE_SIZE, 0,
+			&block->cpu_mapping);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkMapMemory", res);
+			block->cpu_mapping = NULL;
+			block_destroy(renderer, block);
+			return NULL;
+		}
+	}
+
+	if (!add_free_range(block, WLR_VK_MEMORY_ORDERS - 1, 0)) {
+		block_destroy(renderer, block);
+		return NULL;
+	}
+
+	wl_list_insert(&renderer->memory_blocks, &block->link);
+	wlr_log(WLR_DEBUG, "Created Vulkan memory block for memory type %"PRIu32
+		" (%s)", mem_type, linear ? "linear" : "optimal");
+	return block;
+}
+
+static bool block_alloc(struct wlr_vk_memory_block *block, int order,
+		VkDeviceSize *offset) {
+	int found = order;
+	while (found < WLR_VK_MEMORY_ORDERS && wl_list_empty(&block->free[found])) {
+		found++;
+	}
+	if (found == WLR_VK_MEMORY_ORDERS) {
+		return false;
+	}
+
+	// Split larger buddies until one has the requested order
+	while (found > order) {
+		struct wlr_vk_memory_range *range =
+			wl_container_of(block->free[found].next, range, link);
+		if (!add_free_range(block, found - 1, range->offset + order_size(found - 1))) {
+			return false;
+		}
+		wl_list_remove(&range->link);
+		found--;
+		wl_list_insert(&block->free[found], &range->link);
+	}
+
+	struct wlr_vk_memory_range *range =
+		wl_container_of(block->free[order].next, range, link);
+	*offset = range->offset;
+	wl_list_remove(&range->link);
+	free(range);
+	block->allocs_len++;
+	return true;
+}
+
+static void block_free(struct wlr_vk_memory_block *block, int order,
+		VkDeviceSize offset) {
+	assert(block->allocs_len > 0);
+	block->allocs_len--;
+
+	// Merge with the free buddy of each order
+	while (order < WLR_VK_MEMORY_ORDERS - 1) {
+		VkDeviceSize buddy_offset = offset ^ order_size(order);
+		struct wlr_vk_memory_range *range, *buddy = NULL;
+		wl_list_for_each(range, &block->free[order], link) {
+			if (range->offset == buddy_offset) {
+				buddy = range;
+				break;
+			}
+		}
+		if (buddy == NULL) {
+			break;
+		}
+		wl_list_remove(&buddy->link);
+		free(buddy);
+		if (buddy_offset < offset) {
+			offset = buddy_offset;
+		}
+		order++;
+	}
+
+	if (!add_free_range(block, order, offset)) {
+		// The range is leaked until the block is destroyed
+		return;
+	}
+}
+
+static bool alloc_dedicated(struct wlr_vk_renderer *renderer,
+		VkDeviceSize size, uint32_t mem_type, VkImage dedicated_image,
+		struct wlr_vk_memory *mem) {
+	VkDevice dev = renderer->dev->dev;
+
+	VkMemoryDedicatedAllocateInfo dedicated_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+		.image = dedicated_image,
+	};
+	VkMemoryAllocateInfo mem_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = size,
+		.memoryTypeIndex = mem_type,
+	};
+	if (dedicated_image != VK_NULL_HANDLE) {
+		mem_info.pNext = &dedicated_info;
+	}
+	VkResult res = vkAllocateMemory(dev, &mem_info, NULL, &mem->memory);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkAllocateMemory", res);
+		return false;
+	}
+
+	if (is_host_visible(renderer, mem_type)) {
+		res = vkMapMemory(dev, mem->memory, 0, VK_WHOLE_SIZE, 0,
+			&mem->cpu_mapping);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkMapMemory", res);
+			vkFreeMemory(dev, mem->memory, NULL);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool vulkan_alloc_memory(struct wlr_vk_renderer *renderer,
+		const VkMemoryRequirements *reqs, VkMemoryPropertyFlags flags,
+		bool linear, VkImage dedicated_image, struct wlr_vk_memory *mem) {
+	*mem = (struct wlr_vk_memory){0};
+
+	int mem_type = vulkan_find_mem_type(renderer->dev, flags,
+		reqs->memoryTypeBits);
+	if (mem_type < 0) {
+		wlr_log(WLR_ERROR, "Failed to find a suitable memory type");
+		return false;
+	}
+
+	VkDeviceSize size = reqs->size;
+	if (size < reqs->alignment) {
+		size = reqs->alignment;
+	}
+	if (dedicated_image != VK_NULL_HANDLE || size > WLR_VK_MEMORY_MAX_SUBALLOC) {
+		return alloc_dedicated(renderer, reqs->size, mem_type,
+			dedicated_image, mem);
+	}
+
+	int order = order_for_size(size);
+	VkDeviceSize offset = 0;
+	struct wlr_vk_memory_block *block, *found = NULL;
+	wl_list_for_each(block, &renderer->memory_blocks, link) {
+		if (block->mem_type == (uint32_t)mem_type && block->linear == linear &&
+				block_alloc(block, order, &offset)) {
+			found = block;
+			break;
+		}
+	}
+	if (found == NULL) {
+		found = block_create(renderer, mem_type, linear);
+		if (found == NULL || !block_alloc(found, order, &offset)) {
+			return false;
+		}
+	}
+
+	mem->block = found;
+	mem->memory = found->memory;
+	mem->offset = offset;
+	mem->order = order;
+	if (found->cpu_mapping != NULL) {
+		mem->cpu_mapping = (char *)found->cpu_mapping + offset;
+	}
+	return true;
+}
+
+void vulkan_free_memory(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_memory *mem) {
+	if (mem->memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	struct wlr_vk_memory_block *block = mem->block;
+	if (block == NULL) {
+		if (mem->cpu_mapping != NULL) {
+			vkUnmapMemory(renderer->dev->dev, mem->memory);
+		}
+		vkFreeMemory(renderer->dev->dev, mem->memory, NULL);
+		*mem = (struct wlr_vk_memory){0};
+		return;
+	}
+
+	block_free(block, mem->order, mem->offset);
+	*mem = (struct wlr_vk_memory){0};
+
+	if (block->allocs_len > 0) {
+		return;
+	}
+
+	// Keep a single empty block of each kind around to avoid re-allocating
+	// it for textures which are created and destroyed repeatedly
+	struct wlr_vk_memory_block *other;
+	wl_list_for_each(other, &renderer->memory_blocks, link) {
+		if (other != block && other->mem_type == block->mem_type &&
+				other->linear == block->linear && other->allocs_len == 0) {
+			block_destroy(renderer, block);
+			return;
+		}
+	}
+}
+
+void vulkan_memory_trim(struct wlr_vk_renderer *renderer) {
+	struct wlr_vk_memory_block *block, *tmp;
+	wl_list_for_each_safe(block, tmp, &renderer->memory_blocks, link) {
+		if (block->allocs_len == 0) {
+			block_destroy(renderer, block);
+		}
+	}
+}
+
+void vulkan_memory_finish(struct wlr_vk_renderer *renderer) {
+	struct wlr_vk_memory_block *block, *tmp;
+	wl_list_for_each_safe(block, tmp, &renderer->memory_blocks, link) {
+		block_destroy(renderer, block);
+	}
+}
@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <wlr/util/log.h>
+#include "render/vulkan.h"
+#include "util/cache_file.h"
+
+#define PIPELINE_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+// Pipeline caches are only valid for the driver which created them. Vulkan
+// validates the cache header itself, but keying the file by the cache UUID
+// and driver version keeps caches of multiple GPUs or drivers apart.
+static char *get_cache_path(struct wlr_vk_device *dev, bool create_dir) {
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(dev->phdev, &props);
+
+	char uuid[2 * VK_UUID_SIZE + 1];
+	for (size_t i = 0; i < VK_UUID_SIZE; ++i) {
+		snprintf(&uuid[2 * i], 3, "%02x", props.pipelineCacheUUID[i]);
+	}
+
+	char name[128];
+	snprintf(name, sizeof(name), "vk-pipeline-cache-%s-%08x", uuid,
+		props.driverVersion);
+	return cache_file_get_path(name, create_dir);
+}
+
+bool vulkan_pipeline_cache_init(struct wlr_vk_renderer *renderer) {
+	VkDevice dev = renderer->dev->dev;
+
+	size_t data_size = 0;
+	void *data = NULL;
+	char *path = get_cache_path(renderer->dev, false);
+	if (path != NULL) {
+		data = cache_file_read(path, PIPELINE_CACHE_MAX_SIZE, &data_size);
+	}
+
+	VkPipelineCacheCreateInfo cache_info = {0};
+	cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cache_info.initialDataSize = data_size;
+	cache_info.pInitialData = data;
+	VkResult res = vkCreatePipelineCache(dev, &cache_info, NULL,
+		&renderer->pipeline_cache.cache);
+	if (res != VK_SUCCESS && data != NULL) {
+		// Drivers should ignore incompatible data, but be safe and start
+		// over with an empty cache
+		wlr_log(WLR_DEBUG, "Discarding vulkan pipeline cache %s", path);
+		cache_info.initialDataSize = 0;
+		cache_info.pInitialData = NULL;
+		data_size = 0;
+		res = vkCreatePipelineCache(dev, &cache_info, NULL,
+			&renderer->pipeline_cache.cache);
+	}
+	free(data);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreatePipelineCache", res);
+		renderer->pipeline_cache.cache = VK_NULL_HANDLE;
+		free(path);
+		return false;
+	}
+
+	if (data_size > 0) {
+		wlr_log(WLR_DEBUG, "Loaded vulkan pipeline cache from %s (%zu bytes)",
+			path, data_size);
+	}
+	renderer->pipeline_cache.saved_size = data_size;
+	free(path);
+	return true;
+}
+
+void vulkan_pipeline_cache_save(struct wlr_vk_renderer *renderer) {
+	VkDevice dev = renderer->dev->dev;
+	VkPipelineCache cache = renderer->pipeline_cache.cache;
+	if (cache == VK_NULL_HANDLE) {
+		return;
+	}
+
+	size_t size = 0;
+	VkResult res = vkGetPipelineCacheData(dev, cache, &size, NULL);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetPipelineCacheData", res);
+		return;
+	}
+	// Caches only grow, so there is nothing new to store
+	if (size == 0 || size == renderer->pipeline_cache.saved_size) {
+		return;
+	}
+
+	void *data = malloc(size);
+	if (data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	char *path = NULL;
+	res = vkGetPipelineCacheData(dev, cache, &size, data);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetPipelineCacheData", res);
+		goto out;
+	}
+
+	path = get_cache_path(renderer->dev, true);
+	struct cache_writer w;
+	if (path == NULL || !cache_writer_open(&w, path)) {
+		goto out;
+	}
+	cache_write_bytes(&w, data, size);
+	if (!cache_writer_finish(&w)) {
+		goto out;
+	}
+
+	wlr_log(WLR_DEBUG, "Saved vulkan pipeline cache to %s (%zu bytes)",
+		path, size);
+	renderer->pipeline_cache.saved_size = size;
+
+out:
+	free(path);
+	free(data);
+}
+
+void vulkan_pipeline_cache_finish(struct wlr_vk_renderer *renderer) {
+	if (renderer->pipeline_cache.cache == VK_NULL_HANDLE) {
+		return;
+	}
+
+	vulkan_pipeline_cache_save(renderer);
+	vkDestroyPipelineCache(renderer->dev->dev, renderer->pipeline_cache.cache,
+		NULL);
+	renderer->pipeline_cache.cache = VK_NULL_HANDLE;
+}
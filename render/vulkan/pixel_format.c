@@ -22,6 +22,18 @@ static const struct wlr_vk_format formats[] = {
 		.drm_format = DRM_FORMAT_ABGR8888,
 		.vk_format = VK_FORMAT_R8G8B8A8_SRGB,
 	},
+	// YUV formats, only imported from DMA-BUFs and sampled through a YCbCr
+	// conversion
+	{
+		.drm_format = DRM_FORMAT_NV12,
+		.vk_format = VK_FORMAT_G8_B8R8_2PLANE_420_UNORM,
+		.is_ycbcr = true,
+	},
+	{
+		.drm_format = DRM_FORMAT_YUV420,
+		.vk_format = VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM,
+		.is_ycbcr = true,
+	},
 };
 
 const struct wlr_vk_format *vulkan_get_format_list(size_t *len) {
@@ -61,6 +73,11 @@ static const VkFormatFeatureFlags dma_tex_features =
 	// NOTE: we don't strictly require this, we could create a NEAREST
 	// sampler for formats that need it, in case this ever makes problems.
 	VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+// Required by the YCbCr conversion created in vulkan_get_ycbcr_layout()
+static const VkFormatFeatureFlags dma_tex_ycbcr_features =
+	VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+	VK_FORMAT_FEATURE_MIDPOINT_CHROMA_SAMPLES_BIT |
+	VK_FORMAT_FEATURE_SAMPLED_IMAGE_YCBCR_CONVERSION_LINEAR_FILTER_BIT;
 
 static bool query_modifier_support(struct wlr_vk_device *dev,
 		struct wlr_vk_format_props *props, size_t modifier_count,
@@ -130,6 +147,8 @@ static bool query_modifier_support(struct wlr_vk_device *dev,
 	const VkExternalMemoryProperties *emp = &efmtp.externalMemoryProperties;
 
 	bool found = false;
+	VkFormatFeatureFlags tex_mod_features = props->format.is_ycbcr ?
+		dma_tex_ycbcr_features : dma_tex_features;
 
 	for (unsigned i = 0u; i < modp.drmFormatModifierCount; ++i) {
 		VkDrmFormatModifierPropertiesEXT m =
@@ -139,7 +158,9 @@ static bool query_modifier_support(struct wlr_vk_device *dev,
 			m.drmFormatModifierPlaneCount);
 
 		// check that specific modifier for render usage
-		if ((m.drmFormatModifierTilingFeatures & render_features) == render_features) {
+		if (props->format.is_ycbcr) {
+			wlr_log(WLR_DEBUG, "    >> rendering: YUV format not supported");
+		} else if ((m.drmFormatModifierTilingFeatures & render_features) == render_features) {
 			fmti.usage = render_usage;
 
 			modi.drmFormatModifier = m.drmFormatModifier;
@@ -179,7 +200,7 @@ static bool query_modifier_support(struct wlr_vk_device *dev,
 		}
 
 		// check that specific modifier for texture usage
-		if ((m.drmFormatModifierTilingFeatures & dma_tex_features) == dma_tex_features) {
+		if ((m.drmFormatModifierTilingFeatures & tex_mod_features) == tex_mod_features) {
 			fmti.usage = dma_tex_usage;
 
 			modi.drmFormatModifier = m.drmFormatModifier;
@@ -230,6 +251,11 @@ void vulkan_format_props_query(struct wlr_vk_device *dev,
 		(const char *)&format->drm_format, format->drm_format);
 	VkResult res;
 
+	if (format->is_ycbcr && !dev->sampler_ycbcr_conversion) {
+		wlr_log(WLR_DEBUG, "  YCbCr sampler conversion not supported");
+		return;
+	}
+
 	// get general features and modifiers
 	VkFormatProperties2 fmtp = {0};
 	fmtp.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2;
@@ -260,8 +286,11 @@ void vulkan_format_props_query(struct wlr_vk_device *dev,
 			modp.drmFormatModifierCount, fmti);
 	}
 
-	// non-dmabuf texture properties
-	if (fmtp.formatProperties.optimalTilingFeatures & tex_features) {
+	// non-dmabuf texture properties, uploads of multi-planar formats aren't
+	// implemented
+	if (format->is_ycbcr) {
+		wlr_log(WLR_DEBUG, " >> shmtex: YUV format not supported");
+	} else if (fmtp.formatProperties.optimalTilingFeatures & tex_features) {
 		fmti.pNext = NULL;
 		ifmtp.pNext = NULL;
 		fmti.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -17,8 +17,10 @@
 #include <wlr/backend/interface.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
 
+#include "render/dmabuf.h"
 #include "render/pixel_format.h"
 #include "render/vulkan.h"
+#include "render/wlr_renderer.h"
 #include "render/vulkan/shaders/common.vert.h"
 #include "render/vulkan/shaders/texture.frag.h"
 #include "render/vulkan/shaders/quad.frag.h"
@@ -26,9 +28,6 @@
 #include "types/wlr_matrix.h"
 
 // TODO:
-// - simplify stage allocation, don't track allocations but use ringbuffer-like
-// - use a pipeline cache (not sure when to save though, after every pipeline
-//   creation?)
 // - create pipelines as derivatives of each other
 // - evaluate if creating VkDeviceMemory pools is a good idea.
 //   We can expect wayland client images to be fairly large (and shouldn't
@@ -37,7 +36,11 @@
 
 static const VkDeviceSize min_stage_size = 1024 * 1024; // 1MB
 static const VkDeviceSize max_stage_size = 64 * min_stage_size; // 64MB
+static const VkDeviceSize stage_alignment = 16; // covers all texel sizes
+static const uint32_t stage_buffer_max_idle_frames = 256;
+static const size_t default_frames_in_flight = 2;
 static const size_t start_descriptor_pool_size = 256u;
+static const size_t max_descriptor_pool_size = 4096u;
 static bool default_debug = true;
 
 static const struct wlr_renderer_impl renderer_impl;
@@ -49,6 +52,9 @@ struct wlr_vk_renderer *vulkan_get_renderer(struct wlr_renderer *wlr_renderer) {
 
 static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 		struct wlr_vk_renderer *renderer, VkFormat format);
+static VkPipeline get_ycbcr_pipeline(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_render_format_setup *setup,
+		const struct wlr_vk_ycbcr_layout *layout);
 
 // vertex shader push constant range data
 struct vert_pcr_data {
@@ -80,73 +86,131 @@ static void mat3_to_mat4(const float mat3[9], float mat4[4][4]) {
 	mat4[3][3] = 1.f;
 }
 
-struct wlr_vk_descriptor_pool *vulkan_alloc_texture_ds(
-		struct wlr_vk_renderer *renderer, VkDescriptorSet *ds) {
-	VkResult res;
-	VkDescriptorSetAllocateInfo ds_info = {0};
-	ds_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	ds_info.descriptorSetCount = 1;
-	ds_info.pSetLayouts = &renderer->ds_layout;
-
-	bool found = false;
-	struct wlr_vk_descriptor_pool *pool;
-	wl_list_for_each(pool, &renderer->descriptor_pools, link) {
-		if (pool->free > 0) {
-			found = true;
-			break;
+static void log_descriptor_pools(struct wlr_vk_renderer *renderer,
+		const char *action) {
+	size_t pools = 0, capacity = 0, used = 0;
+	struct wl_list *lists[] = {
+		&renderer->descriptor_pools,
+		&renderer->full_descriptor_pools,
+	};
+	for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+		struct wlr_vk_descriptor_pool *pool;
+		wl_list_for_each(pool, lists[i], link) {
+			++pools;
+			capacity += pool->size;
+			used += pool->size - pool->free;
 		}
 	}
 
-	if (!found) { // create new pool
-		pool = calloc(1, sizeof(*pool));
-		if (!pool) {
-			wlr_log_errno(WLR_ERROR, "allocation failed");
-			return NULL;
-		}
+	wlr_log(WLR_DEBUG, "%s vk descriptor pool: %zu/%zu descriptor sets "
+		"in use across %zu pools", action, used, capacity, pools);
+}
 
-		size_t count = renderer->last_pool_size;
-		if (!count) {
-			count = start_descriptor_pool_size;
-		}
+static void destroy_descriptor_pool(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_descriptor_pool *pool) {
+	vkDestroyDescriptorPool(renderer->dev->dev, pool->pool, NULL);
+	wl_list_remove(&pool->link);
+	free(pool);
+}
 
-		pool->free = count;
-		VkDescriptorPoolSize pool_size = {0};
-		pool_size.descriptorCount = count;
-		pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+static struct wlr_vk_descriptor_pool *create_descriptor_pool(
+		struct wlr_vk_renderer *renderer) {
+	struct wlr_vk_descriptor_pool *pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		wlr_log_errno(WLR_ERROR, "allocation failed");
+		return NULL;
+	}
 
-		VkDescriptorPoolCreateInfo dpool_info = {0};
-		dpool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		dpool_info.maxSets = count;
-		dpool_info.poolSizeCount = 1;
-		dpool_info.pPoolSizes = &pool_size;
-		dpool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	// Grow geometrically so that many textures only need a few pools
+	size_t count = renderer->last_pool_size * 2;
+	if (count < start_descriptor_pool_size) {
+		count = start_descriptor_pool_size;
+	} else if (count > max_descriptor_pool_size) {
+		count = max_descriptor_pool_size;
+	}
 
-		res = vkCreateDescriptorPool(renderer->dev->dev, &dpool_info, NULL,
-			&pool->pool);
-		if (res != VK_SUCCESS) {
-			wlr_vk_error("vkCreateDescriptorPool", res);
-			free(pool);
+	// Sets of multi-planar textures consume one descriptor per plane
+	VkDescriptorPoolSize pool_size = {0};
+	pool_size.descriptorCount = 3 * count;
+	pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	VkDescriptorPoolCreateInfo dpool_info = {0};
+	dpool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	dpool_info.maxSets = count;
+	dpool_info.poolSizeCount = 1;
+	dpool_info.pPoolSizes = &pool_size;
+	dpool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+
+	VkResult res = vkCreateDescriptorPool(renderer->dev->dev, &dpool_info,
+		NULL, &pool->pool);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreateDescriptorPool", res);
+		free(pool);
+		return NULL;
+	}
+
+	pool->size = count;
+	pool->free = count;
+	renderer->last_pool_size = count;
+	wl_list_insert(&renderer->descriptor_pools, &pool->link);
+	log_descriptor_pools(renderer, "Created");
+	return pool;
+}
+
+struct wlr_vk_descriptor_pool *vulkan_alloc_texture_ds(
+		struct wlr_vk_renderer *renderer, VkDescriptorSetLayout ds_layout,
+		VkDescriptorSet *ds) {
+	// Only pools with free descriptor sets are in renderer->descriptor_pools
+	struct wlr_vk_descriptor_pool *pool;
+	if (wl_list_empty(&renderer->descriptor_pools)) {
+		pool = create_descriptor_pool(renderer);
+		if (!pool) {
 			return NULL;
 		}
-
-		wl_list_insert(&renderer->descriptor_pools, &pool->link);
+	} else {
+		pool = wl_container_of(renderer->descriptor_pools.next, pool, link);
 	}
 
+	VkDescriptorSetAllocateInfo ds_info = {0};
+	ds_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	ds_info.descriptorSetCount = 1;
+	ds_info.pSetLayouts = &ds_layout;
 	ds_info.descriptorPool = pool->pool;
-	res = vkAllocateDescriptorSets(renderer->dev->dev, &ds_info, ds);
+	VkResult res = vkAllocateDescriptorSets(renderer->dev->dev, &ds_info, ds);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkAllocateDescriptorSets", res);
 		return NULL;
 	}
 
 	--pool->free;
+	if (pool->free == 0) {
+		wl_list_remove(&pool->link);
+		wl_list_insert(&renderer->full_descriptor_pools, &pool->link);
+	}
 	return pool;
 }
 
 void vulkan_free_ds(struct wlr_vk_renderer *renderer,
 		struct wlr_vk_descriptor_pool *pool, VkDescriptorSet ds) {
 	vkFreeDescriptorSets(renderer->dev->dev, pool->pool, 1, &ds);
+	if (renderer->bound_ds == ds) {
+		// The handle may be reused by the next allocation
+		renderer->bound_ds = VK_NULL_HANDLE;
+	}
+
+	if (pool->free == 0) {
+		wl_list_remove(&pool->link);
+		wl_list_insert(&renderer->descriptor_pools, &pool->link);
+	}
 	++pool->free;
+
+	// Reclaim empty pools, but keep one around to absorb bursts of texture
+	// creation and destruction
+	if (pool->free == pool->size &&
+			renderer->descriptor_pools.next != renderer->descriptor_pools.prev) {
+		destroy_descriptor_pool(renderer, pool);
+		log_descriptor_pools(renderer, "Destroyed");
+	}
 }
 
 static void destroy_render_format_setup(struct wlr_vk_renderer *renderer,
@@ -159,6 +223,24 @@ static void destroy_render_format_setup(struct wlr_vk_renderer *renderer,
 	vkDestroyRenderPass(dev, setup->render_pass, NULL);
 	vkDestroyPipeline(dev, setup->tex_pipe, NULL);
 	vkDestroyPipeline(dev, setup->quad_pipe, NULL);
+
+	struct wlr_vk_ycbcr_pipeline *pipe, *tmp_pipe;
+	wl_list_for_each_safe(pipe, tmp_pipe, &setup->ycbcr_pipes, link) {
+		vkDestroyPipeline(dev, pipe->pipe, NULL);
+		wl_list_remove(&pipe->link);
+		free(pipe);
+	}
+}
+
+static void destroy_ycbcr_layout(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_ycbcr_layout *layout) {
+	VkDevice dev = renderer->dev->dev;
+	vkDestroyPipelineLayout(dev, layout->pipe_layout, NULL);
+	vkDestroyDescriptorSetLayout(dev, layout->ds_layout, NULL);
+	vkDestroySampler(dev, layout->sampler, NULL);
+	vkDestroySamplerYcbcrConversion(dev, layout->conversion, NULL);
+	wl_list_remove(&layout->link);
+	free(layout);
 }
 
 static void shared_buffer_destroy(struct wlr_vk_renderer *r,
@@ -167,93 +249,191 @@ static void shared_buffer_destroy(struct wlr_vk_renderer *r,
 		return;
 	}
 
-	if (buffer->allocs_size > 0) {
-		wlr_log(WLR_ERROR, "shared_buffer_finish: %d allocations left",
-			(unsigned) buffer->allocs_size);
+	if (buffer->offset > 0) {
+		wlr_log(WLR_ERROR, "shared_buffer_finish: %" PRIu64 " bytes "
+			"still allocated", (uint64_t)buffer->offset);
 	}
 
-	free(buffer->allocs);
 	if (buffer->buffer) {
 		vkDestroyBuffer(r->dev->dev, buffer->buffer, NULL);
 	}
-	if (buffer->memory) {
-		vkFreeMemory(r->dev->dev, buffer->memory, NULL);
-	}
+	vulkan_free_memory(r, &buffer->memory);
 
 	wl_list_remove(&buffer->link);
 	free(buffer);
 }
 
-static void release_stage_allocations(struct wlr_vk_renderer *renderer) {
-	struct wlr_vk_shared_buffer *buf;
-	wl_list_for_each(buf, &renderer->stage.buffers, link) {
-		buf->allocs_size = 0u;
+// Recycles the buffers which were last used by frames older than the given
+// id. Those must have finished execution.
+static void release_stage_allocations(struct wlr_vk_renderer *renderer,
+		uint32_t finished_frame) {
+	struct wlr_vk_shared_buffer *buf, *tmp_buf;
+	wl_list_for_each_safe(buf, tmp_buf, &renderer->stage.buffers, link) {
+		if ((int32_t)(buf->last_used - finished_frame) >= 0) {
+			continue;
+		}
+
+		buf->offset = 0u;
+
+		// Give back memory from bursts of uploads, but always keep one
+		// buffer around for the next frame
+		if (renderer->frame - buf->last_used > stage_buffer_max_idle_frames &&
+				buf->link.next != &renderer->stage.buffers) {
+			wlr_log(WLR_DEBUG, "Destroying idle vk staging buffer of "
+				"size %" PRIu64, (uint64_t)buf->buf_size);
+			shared_buffer_destroy(renderer, buf);
+		}
 	}
 }
 
-struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
-		VkDeviceSize size) {
-	// try to find free span
-	// simple greedy allocation algorithm - should be enough for this usecase
-	// since all allocations are freed together after the frame
-	struct wlr_vk_shared_buffer *buf;
-	wl_list_for_each_reverse(buf, &r->stage.buffers, link) {
-		VkDeviceSize start = 0u;
-		if (buf->allocs_size > 0) {
-			struct wlr_vk_allocation *last = &buf->allocs[buf->allocs_size - 1];
-			start = last->start + last->size;
-		}
+bool vulkan_frame_is_busy(struct wlr_vk_renderer *renderer, uint32_t frame) {
+	return (int32_t)(frame - renderer->finished_frame) >= 0;
+}
 
-		assert(start <= buf->buf_size);
-		if (buf->buf_size - start < size) {
-			continue;
+// Waits for a submitted frame and recycles the resources it was using
+static bool retire_frame(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_frame *frame) {
+	assert(frame->pending);
+
+	VkDevice dev = renderer->dev->dev;
+	VkResult res = vkWaitForFences(dev, 1, &frame->fence, true, UINT64_MAX);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkWaitForFences", res);
+		return false;
+	}
+	res = vkResetFences(dev, 1, &frame->fence);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkResetFences", res);
+		return false;
+	}
+
+	frame->pending = false;
+	if (frame->sync_file_fd >= 0) {
+		close(frame->sync_file_fd);
+		frame->sync_file_fd = -1;
+	}
+
+	// Frames are executed in submission order
+	renderer->finished_frame = frame->id + 1;
+	release_stage_allocations(renderer, renderer->finished_frame);
+	vulkan_prune_dmabuf_imports(renderer, false);
+
+	// destroy pending textures
+	struct wlr_vk_texture *texture, *tmp_tex;
+	wl_list_for_each_safe(texture, tmp_tex, &renderer->destroy_textures,
+			destroy_link) {
+		if (!vulkan_frame_is_busy(renderer, texture->last_used)) {
+			wl_list_remove(&texture->destroy_link);
+			vulkan_texture_destroy(texture);
 		}
+	}
+
+	return true;
+}
 
-		++buf->allocs_size;
-		if (buf->allocs_size > buf->allocs_capacity) {
-			buf->allocs_capacity = buf->allocs_size * 2;
-			void *allocs = realloc(buf->allocs,
-				buf->allocs_capacity * sizeof(*buf->allocs));
-			if (!allocs) {
-				wlr_log_errno(WLR_ERROR, "Allocation failed");
-				goto error_alloc;
+// Retires submitted frames until the given one has finished execution
+static bool wait_frame(struct wlr_vk_renderer *renderer, uint32_t id) {
+	while (vulkan_frame_is_busy(renderer, id)) {
+		struct wlr_vk_frame *oldest = NULL;
+		for (size_t i = 0; i < renderer->frames_in_flight; ++i) {
+			struct wlr_vk_frame *frame = &renderer->frames[i];
+			if (frame->pending && (oldest == NULL ||
+					(int32_t)(frame->id - oldest->id) < 0)) {
+				oldest = frame;
 			}
+		}
+		if (oldest == NULL) {
+			break; // not submitted
+		}
+		if (!retire_frame(renderer, oldest)) {
+			return false;
+		}
+	}
+	return true;
+}
 
-			buf->allocs = allocs;
+static struct wlr_vk_buffer_span stage_buffer_alloc(struct wlr_vk_renderer *r,
+		struct wlr_vk_shared_buffer *buf, VkDeviceSize size) {
+	struct wlr_vk_buffer_span span = {
+		.buffer = buf,
+		.alloc = { .start = buf->offset, .size = size },
+	};
+
+	VkDeviceSize end = buf->offset + size;
+	end = (end + stage_alignment - 1) & ~(stage_alignment - 1);
+	buf->offset = end < buf->buf_size ? end : buf->buf_size;
+	buf->last_used = r->frame;
+	return span;
+}
+
+static struct wlr_vk_buffer_span find_stage_span(struct wlr_vk_renderer *r,
+		VkDeviceSize size) {
+	struct wlr_vk_shared_buffer *buf;
+	wl_list_for_each(buf, &r->stage.buffers, link) {
+		assert(buf->offset <= buf->buf_size);
+		if (buf->buf_size - buf->offset >= size) {
+			return stage_buffer_alloc(r, buf, size);
 		}
+	}
 
-		struct wlr_vk_allocation *a = &buf->allocs[buf->allocs_size - 1];
-		a->start = start;
-		a->size = size;
-		return (struct wlr_vk_buffer_span) {
-			.buffer = buf,
-			.alloc = *a,
-		};
+	return (struct wlr_vk_buffer_span) {0};
+}
+
+struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
+		VkDeviceSize size) {
+	if (size > max_stage_size) {
+		wlr_log(WLR_ERROR, "Staging allocation of %" PRIu64 " bytes exceeds "
+			"the maximum stage size", (uint64_t)size);
+		goto error_alloc;
+	}
+
+	struct wlr_vk_buffer_span span = find_stage_span(r, size);
+	if (span.buffer) {
+		return span;
 	}
 
-	// we didn't find a free buffer - create one
 	// size = clamp(max(size * 2, prev_size * 2), min_size, max_size)
+	// The largest buffer is always the last one in the list
+	VkDeviceSize total_size = 0;
 	VkDeviceSize bsize = size * 2;
 	bsize = bsize < min_stage_size ? min_stage_size : bsize;
+	struct wlr_vk_shared_buffer *buf;
+	wl_list_for_each(buf, &r->stage.buffers, link) {
+		total_size += buf->buf_size;
+	}
 	if (!wl_list_empty(&r->stage.buffers)) {
-		struct wl_list *last_link = r->stage.buffers.prev;
-		struct wlr_vk_shared_buffer *prev = wl_container_of(
-			last_link, prev, link);
-		VkDeviceSize last_size = 2 * prev->buf_size;
+		struct wlr_vk_shared_buffer *last = wl_container_of(
+			r->stage.buffers.prev, last, link);
+		VkDeviceSize last_size = 2 * last->buf_size;
 		bsize = bsize < last_size ? last_size : bsize;
 	}
-
 	if (bsize > max_stage_size) {
-		wlr_log(WLR_INFO, "vulkan stage buffers have reached max size");
 		bsize = max_stage_size;
 	}
 
+	// Instead of growing without bounds under heavy upload traffic, flush
+	// the uploads recorded so far and wait for the frames in flight. Once
+	// they have finished execution all spans handed out until now can be
+	// reused.
+	if (total_size + bsize > max_stage_size) {
+		bool flushed = (!r->stage.recording && !r->stage.transfer_recording) ||
+			vulkan_submit_stage_wait(r);
+		if (flushed && wait_frame(r, r->frame - 1)) {
+			release_stage_allocations(r, r->frame + 1);
+			span = find_stage_span(r, size);
+			if (span.buffer) {
+				return span;
+			}
+		}
+	}
+
 	// create buffer
 	buf = calloc(1, sizeof(*buf));
 	if (!buf) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
 		goto error_alloc;
 	}
+	wl_list_init(&buf->link);
 
 	VkResult res;
 	VkBufferCreateInfo buf_info = {0};
@@ -261,7 +441,8 @@ struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
 	buf_info.size = bsize;
 	buf_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	buf_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	vulkan_set_sharing_mode(r, &buf_info.sharingMode,
+		&buf_info.queueFamilyIndexCount, &buf_info.pQueueFamilyIndices);
 	res = vkCreateBuffer(r->dev->dev, &buf_info, NULL, &buf->buffer);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkCreateBuffer", res);
@@ -271,43 +452,28 @@ struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
 	VkMemoryRequirements mem_reqs;
 	vkGetBufferMemoryRequirements(r->dev->dev, buf->buffer, &mem_reqs);
 
-	VkMemoryAllocateInfo mem_info = {0};
-	mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	mem_info.allocationSize = mem_reqs.size;
-	mem_info.memoryTypeIndex = vulkan_find_mem_type(r->dev,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mem_reqs.memoryTypeBits);
-	res = vkAllocateMemory(r->dev->dev, &mem_info, NULL, &buf->memory);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkAllocatorMemory", res);
+	if (!vulkan_alloc_memory(r, &mem_reqs,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			true, VK_NULL_HANDLE, &buf->memory)) {
 		goto error;
 	}
 
-	res = vkBindBufferMemory(r->dev->dev, buf->buffer, buf->memory, 0);
+	res = vkBindBufferMemory(r->dev->dev, buf->buffer, buf->memory.memory,
+		buf->memory.offset);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkBindBufferMemory", res);
 		goto error;
 	}
 
-	size_t start_count = 8u;
-	buf->allocs = calloc(start_count, sizeof(*buf->allocs));
-	if (!buf->allocs) {
-		wlr_log_errno(WLR_ERROR, "Allocation failed");
-		goto error;
-	}
+	buf->cpu_mapping = buf->memory.cpu_mapping;
 
 	wlr_log(WLR_DEBUG, "Created new vk staging buffer of size %" PRIu64, bsize);
 	buf->buf_size = bsize;
-	wl_list_insert(&r->stage.buffers, &buf->link);
+	wl_list_remove(&buf->link);
+	wl_list_insert(r->stage.buffers.prev, &buf->link);
 
-	buf->allocs_capacity = start_count;
-	buf->allocs_size = 1u;
-	buf->allocs[0].start = 0u;
-	buf->allocs[0].size = size;
-	return (struct wlr_vk_buffer_span) {
-		.buffer = buf,
-		.alloc = buf->allocs[0],
-	};
+	return stage_buffer_alloc(r, buf, size);
 
 error:
 	shared_buffer_destroy(r, buf);
@@ -320,45 +486,69 @@ error_alloc:
 }
 
 VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer) {
+	VkCommandBuffer cb = renderer->current_frame->stage_cb;
 	if (!renderer->stage.recording) {
 		VkCommandBufferBeginInfo begin_info = {0};
 		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		vkBeginCommandBuffer(renderer->stage.cb, &begin_info);
+		vkBeginCommandBuffer(cb, &begin_info);
 		renderer->stage.recording = true;
 	}
 
-	return renderer->stage.cb;
+	return cb;
 }
 
-bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer) {
-	if (!renderer->stage.recording) {
-		return false;
+VkCommandBuffer vulkan_record_transfer_cb(struct wlr_vk_renderer *renderer) {
+	if (renderer->transfer_command_pool == VK_NULL_HANDLE) {
+		return VK_NULL_HANDLE;
 	}
 
-	vkEndCommandBuffer(renderer->stage.cb);
-	renderer->stage.recording = false;
+	VkCommandBuffer cb = renderer->current_frame->transfer_cb;
+	if (!renderer->stage.transfer_recording) {
+		VkCommandBufferBeginInfo begin_info = {0};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		vkBeginCommandBuffer(cb, &begin_info);
+		renderer->stage.transfer_recording = true;
+	}
+
+	return cb;
+}
+
+void vulkan_set_sharing_mode(struct wlr_vk_renderer *renderer,
+		VkSharingMode *mode, uint32_t *family_count, const uint32_t **families) {
+	if (renderer->transfer_command_pool == VK_NULL_HANDLE) {
+		*mode = VK_SHARING_MODE_EXCLUSIVE;
+		return;
+	}
+
+	// Concurrent sharing preserves the contents of textures updated on both
+	// queues, which exclusive ownership would need a release on the
+	// graphics queue for every partial upload to achieve
+	*mode = VK_SHARING_MODE_CONCURRENT;
+	*family_count = 2;
+	*families = renderer->concurrent_queue_families;
+}
+
+static bool submit_wait(struct wlr_vk_renderer *renderer, VkQueue queue,
+		VkCommandBuffer cb, VkFence fence) {
+	vkEndCommandBuffer(cb);
 
 	VkSubmitInfo submit_info = {0};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submit_info.commandBufferCount = 1u;
-	submit_info.pCommandBuffers = &renderer->stage.cb;
-	VkResult res = vkQueueSubmit(renderer->dev->queue, 1,
-		&submit_info, renderer->fence);
+	submit_info.pCommandBuffers = &cb;
+	VkResult res = vkQueueSubmit(queue, 1, &submit_info, fence);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkQueueSubmit", res);
 		return false;
 	}
 
-	res = vkWaitForFences(renderer->dev->dev, 1, &renderer->fence, true,
-		UINT64_MAX);
+	res = vkWaitForFences(renderer->dev->dev, 1, &fence, true, UINT64_MAX);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkWaitForFences", res);
 		return false;
 	}
 
-	// NOTE: don't release stage allocations here since they may still be
-	// used for reading. Will be done next frame.
-	res = vkResetFences(renderer->dev->dev, 1, &renderer->fence);
+	res = vkResetFences(renderer->dev->dev, 1, &fence);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkResetFences", res);
 		return false;
@@ -367,12 +557,39 @@ bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer) {
 	return true;
 }
 
+bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer) {
+	if (!renderer->stage.recording && !renderer->stage.transfer_recording) {
+		return false;
+	}
+
+	// NOTE: don't release stage allocations here since they may still be
+	// used for reading. Will be done next frame.
+	// The fence of the current frame is unused until the frame is submitted
+	struct wlr_vk_frame *frame = renderer->current_frame;
+	bool ok = true;
+	if (renderer->stage.transfer_recording) {
+		renderer->stage.transfer_recording = false;
+		ok = submit_wait(renderer, renderer->dev->transfer_queue,
+			frame->transfer_cb, frame->fence);
+	}
+	if (ok && renderer->stage.recording) {
+		renderer->stage.recording = false;
+		ok = submit_wait(renderer, renderer->dev->queue, frame->stage_cb,
+			frame->fence);
+	}
+
+	return ok;
+}
+
 struct wlr_vk_format_props *vulkan_format_props_from_drm(
 		struct wlr_vk_device *dev, uint32_t drm_fmt) {
-	for (size_t i = 0u; i < dev->format_prop_count; ++i) {
-		if (dev->format_props[i].format.drm_format == drm_fmt) {
-			return &dev->format_props[i];
+	uint32_t slot = vulkan_format_table_hash(drm_fmt);
+	struct wlr_vk_format_props *props;
+	while ((props = dev->format_props_table[slot]) != NULL) {
+		if (props->format.drm_format == drm_fmt) {
+			return props;
 		}
+		slot = (slot + 1) & (WLR_VK_FORMAT_TABLE_SIZE - 1);
 	}
 	return NULL;
 }
@@ -380,38 +597,47 @@ struct wlr_vk_format_props *vulkan_format_props_from_drm(
 // buffer import
 static void destroy_render_buffer(struct wlr_vk_render_buffer *buffer) {
 	wl_list_remove(&buffer->link);
-	wl_list_remove(&buffer->buffer_destroy.link);
+	wlr_addon_finish(&buffer->addon);
 
 	assert(buffer->renderer->current_render_buffer != buffer);
 
+	// The framebuffer may still be in use by a frame in flight
+	if (buffer->transitioned) {
+		wait_frame(buffer->renderer, buffer->last_used);
+	}
+
 	VkDevice dev = buffer->renderer->dev->dev;
 
 	vkDestroyFramebuffer(dev, buffer->framebuffer, NULL);
 	vkDestroyImageView(dev, buffer->image_view, NULL);
-	vkDestroyImage(dev, buffer->image, NULL);
-
-	for (size_t i = 0u; i < buffer->mem_count; ++i) {
-		vkFreeMemory(dev, buffer->memories[i], NULL);
-	}
+	vulkan_release_dmabuf_import(buffer->renderer, &buffer->dmabuf_key,
+		buffer->image, buffer->memories, buffer->mem_count,
+		buffer->transitioned);
 
 	free(buffer);
 }
 
+static void handle_render_buffer_destroy(struct wlr_addon *addon) {
+	struct wlr_vk_render_buffer *buffer =
+		wl_container_of(addon, buffer, addon);
+	destroy_render_buffer(buffer);
+}
+
+static const struct wlr_addon_interface render_buffer_addon_impl = {
+	.name = "wlr_vk_render_buffer",
+	.destroy = handle_render_buffer_destroy,
+};
+
 static struct wlr_vk_render_buffer *get_render_buffer(
 		struct wlr_vk_renderer *renderer, struct wlr_buffer *wlr_buffer) {
-	struct wlr_vk_render_buffer *buffer;
-	wl_list_for_each(buffer, &renderer->render_buffers, link) {
-		if (buffer->wlr_buffer == wlr_buffer) {
-			return buffer;
-		}
+	struct wlr_addon *addon = wlr_addon_find(&wlr_buffer->addons, renderer,
+		&render_buffer_addon_impl);
+	if (addon == NULL) {
+		return NULL;
 	}
-	return NULL;
-}
 
-static void handle_render_buffer_destroy(struct wl_listener *listener, void *data) {
-	struct wlr_vk_render_buffer *buffer =
-		wl_container_of(listener, buffer, buffer_destroy);
-	destroy_render_buffer(buffer);
+	struct wlr_vk_render_buffer *buffer = wl_container_of(addon, buffer, addon);
+	return buffer;
 }
 
 static struct wlr_vk_render_buffer *create_render_buffer(
@@ -425,6 +651,8 @@ static struct wlr_vk_render_buffer *create_render_buffer(
 	}
 	buffer->wlr_buffer = wlr_buffer;
 	buffer->renderer = renderer;
+	// not used by any frame yet
+	buffer->last_used = renderer->finished_frame - 1;
 
 	struct wlr_dmabuf_attributes dmabuf = {0};
 	if (!wlr_buffer_get_dmabuf(wlr_buffer, &dmabuf)) {
@@ -435,7 +663,8 @@ static struct wlr_vk_render_buffer *create_render_buffer(
 		(const char*) &dmabuf.format, dmabuf.width, dmabuf.height);
 
 	buffer->image = vulkan_import_dmabuf(renderer, &dmabuf,
-		buffer->memories, &buffer->mem_count, true);
+		buffer->memories, &buffer->mem_count, true, &buffer->dmabuf_key,
+		&buffer->transitioned);
 	if (!buffer->image) {
 		goto error_buffer;
 	}
@@ -446,7 +675,7 @@ static struct wlr_vk_render_buffer *create_render_buffer(
 	if (fmt == NULL) {
 		wlr_log(WLR_ERROR, "Unsupported pixel format %"PRIx32 " (%.4s)",
 			dmabuf.format, (const char*) &dmabuf.format);
-		goto error_buffer;
+		goto error_view;
 	}
 
 	VkImageViewCreateInfo view_info = {0};
@@ -490,8 +719,8 @@ static struct wlr_vk_render_buffer *create_render_buffer(
 		goto error_view;
 	}
 
-	buffer->buffer_destroy.notify = handle_render_buffer_destroy;
-	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
+	wlr_addon_init(&buffer->addon, &wlr_buffer->addons, renderer,
+		&render_buffer_addon_impl);
 	wl_list_insert(&renderer->render_buffers, &buffer->link);
 
 	return buffer;
@@ -499,10 +728,9 @@ static struct wlr_vk_render_buffer *create_render_buffer(
 error_view:
 	vkDestroyFramebuffer(dev, buffer->framebuffer, NULL);
 	vkDestroyImageView(dev, buffer->image_view, NULL);
-	vkDestroyImage(dev, buffer->image, NULL);
-	for (size_t i = 0u; i < buffer->mem_count; ++i) {
-		vkFreeMemory(dev, buffer->memories[i], NULL);
-	}
+	vulkan_release_dmabuf_import(renderer, &buffer->dmabuf_key,
+		buffer->image, buffer->memories, buffer->mem_count,
+		buffer->transitioned);
 error_buffer:
 	wlr_dmabuf_attributes_finish(&dmabuf);
 	free(buffer);
@@ -514,8 +742,16 @@ static bool vulkan_bind_buffer(struct wlr_renderer *wlr_renderer,
 		struct wlr_buffer *wlr_buffer) {
 	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
 
-	if (renderer->current_render_buffer) {
-		wlr_buffer_unlock(renderer->current_render_buffer->wlr_buffer);
+	struct wlr_vk_render_buffer *current = renderer->current_render_buffer;
+	if (current) {
+		// Unbinding is an implicit synchronization point: consumers may
+		// access the buffer right away. Frames in flight are fine as long as
+		// their fence has been attached to the DMA-BUF.
+		if (current->needs_wait) {
+			wait_frame(renderer, current->last_used);
+			current->needs_wait = false;
+		}
+		wlr_buffer_unlock(current->wlr_buffer);
 		renderer->current_render_buffer = NULL;
 	}
 
@@ -541,11 +777,20 @@ static void vulkan_begin(struct wlr_renderer *wlr_renderer,
 	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
 	assert(renderer->current_render_buffer);
 
-	VkCommandBuffer cb = renderer->cb;
+	VkCommandBuffer cb = renderer->current_frame->cb;
 	VkCommandBufferBeginInfo begin_info = {0};
 	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	vkBeginCommandBuffer(cb, &begin_info);
 
+	if (wlr_renderer->timer != NULL) {
+		struct wlr_vk_render_timer *timer =
+			wl_container_of(wlr_renderer->timer, timer, base);
+		// Queries can't be reset inside of a render pass
+		vkCmdResetQueryPool(cb, timer->query_pool, 0, 2);
+		vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			timer->query_pool, 0);
+	}
+
 	// begin render pass
 	VkFramebuffer fb = renderer->current_render_buffer->framebuffer;
 
@@ -573,18 +818,121 @@ static void vulkan_begin(struct wlr_renderer *wlr_renderer,
 	renderer->render_width = width;
 	renderer->render_height = height;
 	renderer->bound_pipe = VK_NULL_HANDLE;
+	renderer->bound_ds = VK_NULL_HANDLE;
+}
+
+static int vulkan_export_sync_file(struct wlr_renderer *wlr_renderer) {
+	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
+	uint32_t last = renderer->frame - 1;
+	struct wlr_vk_frame *frame =
+		&renderer->frames[last % renderer->frames_in_flight];
+	if (!frame->pending || frame->id != last || frame->sync_file_fd < 0) {
+		// Nothing to wait for
+		return -1;
+	}
+
+	int fd = fcntl(frame->sync_file_fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0) {
+		wlr_log_errno(WLR_ERROR, "fcntl(F_DUPFD_CLOEXEC) failed");
+	}
+	return fd;
+}
+
+// Exports the render semaphore of a submitted frame as sync_file. Returns
+// false if the frame can't be waited on this way.
+static bool export_frame_sync_file(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_frame *frame) {
+	if (frame->semaphore == VK_NULL_HANDLE) {
+		return false;
+	}
+
+	VkSemaphoreGetFdInfoKHR get_fd_info = {0};
+	get_fd_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+	get_fd_info.semaphore = frame->semaphore;
+	get_fd_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+	VkResult res = renderer->dev->api.getSemaphoreFdKHR(renderer->dev->dev,
+		&get_fd_info, &frame->sync_file_fd);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetSemaphoreFdKHR", res);
+		frame->sync_file_fd = -1;
+		return false;
+	}
+
+	// May be -1 if the submission has already completed
+	return true;
+}
+
+// Makes the frame wait for the implicit fences of a DMA-BUF on the GPU,
+// instead of relying on the driver to synchronize with other users of the
+// buffer. flags is DMA_BUF_SYNC_READ to wait for writers, or
+// DMA_BUF_SYNC_WRITE to wait for all users.
+static void frame_wait_dmabuf(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_frame *frame, const struct wlr_dmabuf_attributes *dmabuf,
+		uint32_t flags) {
+	struct wlr_vk_device *dev = renderer->dev;
+	if (!dev->sync_file_import) {
+		return;
+	}
+
+	int sync_file_fd = dmabuf_export_sync_file(dmabuf, flags);
+	if (sync_file_fd < 0) {
+		return;
+	}
+
+	size_t len = frame->wait_semaphores.size / sizeof(VkSemaphore);
+	if (frame->wait_semaphores_len == len) {
+		VkSemaphore *semaphore =
+			wl_array_add(&frame->wait_semaphores, sizeof(*semaphore));
+		if (semaphore == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			close(sync_file_fd);
+			return;
+		}
+		VkSemaphoreCreateInfo sem_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		};
+		VkResult res = vkCreateSemaphore(dev->dev, &sem_info, NULL, semaphore);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkCreateSemaphore", res);
+			frame->wait_semaphores.size -= sizeof(*semaphore);
+			close(sync_file_fd);
+			return;
+		}
+	}
+	VkSemaphore *semaphores = frame->wait_semaphores.data;
+
+	// The temporary payload is consumed by the wait, the semaphore can be
+	// re-used for the next submission of the frame
+	VkImportSemaphoreFdInfoKHR import_info = {
+		.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+		.semaphore = semaphores[frame->wait_semaphores_len],
+		.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT,
+		.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+		.fd = sync_file_fd,
+	};
+	VkResult res = dev->api.importSemaphoreFdKHR(dev->dev, &import_info);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkImportSemaphoreFdKHR", res);
+		close(sync_file_fd);
+		return;
+	}
+	frame->wait_semaphores_len++;
 }
 
 static void vulkan_end(struct wlr_renderer *wlr_renderer) {
 	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
 	assert(renderer->current_render_buffer);
 
-	VkCommandBuffer render_cb = renderer->cb;
+	struct wlr_vk_frame *frame = renderer->current_frame;
+	struct wlr_vk_render_buffer *render_buffer =
+		renderer->current_render_buffer;
+	VkCommandBuffer render_cb = frame->cb;
 	VkCommandBuffer pre_cb = vulkan_record_stage_cb(renderer);
 
 	renderer->render_width = 0u;
 	renderer->render_height = 0u;
 	renderer->bound_pipe = VK_NULL_HANDLE;
+	renderer->bound_ds = VK_NULL_HANDLE;
 
 	vkCmdEndRenderPass(render_cb);
 
@@ -596,13 +944,12 @@ static void vulkan_end(struct wlr_renderer *wlr_renderer) {
 	struct wlr_vk_texture *texture, *tmp_tex;
 	unsigned idx = 0;
 
-	wl_list_for_each_safe(texture, tmp_tex, &renderer->foreign_textures, foreign_link) {
+	wl_list_for_each(texture, &renderer->foreign_textures, foreign_link) {
 		VkImageLayout src_layout = VK_IMAGE_LAYOUT_GENERAL;
 		if (!texture->transitioned) {
 			src_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 			texture->transitioned = true;
 		}
-
 		// acquire
 		acquire_barriers[idx].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 		acquire_barriers[idx].srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
@@ -630,8 +977,6 @@ static void vulkan_end(struct wlr_renderer *wlr_renderer) {
 		release_barriers[idx].subresourceRange.levelCount = 1;
 		++idx;
 
-		wl_list_remove(&texture->foreign_link);
-		texture->owned = false;
 	}
 
 	// also add acquire/release barriers for the current render buffer
@@ -670,7 +1015,9 @@ static void vulkan_end(struct wlr_renderer *wlr_renderer) {
 	release_barriers[idx].subresourceRange.levelCount = 1;
 	++idx;
 
-	vkCmdPipelineBarrier(pre_cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+	// The previous frame may still be in flight and release the same
+	// images, so wait for all prior commands before transitioning them
+	vkCmdPipelineBarrier(pre_cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
 		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
 		0, 0, NULL, 0, NULL, barrier_count, acquire_barriers);
 
@@ -681,70 +1028,171 @@ static void vulkan_end(struct wlr_renderer *wlr_renderer) {
 	free(acquire_barriers);
 	free(release_barriers);
 
-	vkEndCommandBuffer(renderer->cb);
+	struct wlr_vk_render_timer *timer = NULL;
+	if (wlr_renderer->timer != NULL) {
+		timer = wl_container_of(wlr_renderer->timer, timer, base);
+		vkCmdWriteTimestamp(render_cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			timer->query_pool, 1);
+	}
+
+	vkEndCommandBuffer(render_cb);
+
+	// Uploads on the transfer queue run while the previous frame is still
+	// being rendered. The graphics submission waits for them, so the frame
+	// fence covers the transfer as well.
+	VkPipelineStageFlags transfer_wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	bool transfer_submitted = false;
+	if (renderer->stage.transfer_recording) {
+		vkEndCommandBuffer(frame->transfer_cb);
+		renderer->stage.transfer_recording = false;
+
+		VkSubmitInfo transfer_sub = {0};
+		transfer_sub.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		transfer_sub.commandBufferCount = 1u;
+		transfer_sub.pCommandBuffers = &frame->transfer_cb;
+		transfer_sub.signalSemaphoreCount = 1u;
+		transfer_sub.pSignalSemaphores = &frame->transfer_semaphore;
+		VkResult res = vkQueueSubmit(renderer->dev->transfer_queue, 1,
+			&transfer_sub, VK_NULL_HANDLE);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkQueueSubmit", res);
+		} else {
+			transfer_submitted = true;
+		}
+	}
 
-	unsigned submit_count = 0u;
-	VkSubmitInfo submit_infos[2] = {0};
+	// Stage and render commands are submitted as one batch, so that they
+	// both wait for the transfer queue and the signal covers both.
+	// We don't need a semaphore from the stage to the render commands
+	// since they are on the same queue and we have a renderpass
+	// dependency for that.
+	vkEndCommandBuffer(pre_cb);
+	renderer->stage.recording = false;
 
-	// No semaphores needed here.
-	// We don't need a semaphore from the stage/transfer submission
-	// to the render submissions since they are on the same queue
-	// and we have a renderpass dependency for that.
-	if (renderer->stage.recording) {
-		vkEndCommandBuffer(renderer->stage.cb);
-		renderer->stage.recording = false;
+	// Wait for clients to finish writing the sampled buffers, and for
+	// previous users of the render buffer, only at the stages accessing them
+	struct wlr_dmabuf_attributes dmabuf;
+	frame->wait_semaphores_len = 0;
+	wl_list_for_each(texture, &renderer->foreign_textures, foreign_link) {
+		if (texture->buffer != NULL &&
+				wlr_buffer_get_dmabuf(texture->buffer, &dmabuf)) {
+			frame_wait_dmabuf(renderer, frame, &dmabuf, DMA_BUF_SYNC_READ);
+		}
+	}
+	size_t texture_waits_len = frame->wait_semaphores_len;
+	if (wlr_buffer_get_dmabuf(render_buffer->wlr_buffer, &dmabuf)) {
+		frame_wait_dmabuf(renderer, frame, &dmabuf, DMA_BUF_SYNC_WRITE);
+	}
 
-		VkSubmitInfo *stage_sub = &submit_infos[submit_count];
-		stage_sub->sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		stage_sub->commandBufferCount = 1u;
-		stage_sub->pCommandBuffers = &pre_cb;
-		++submit_count;
+	size_t waits_len = frame->wait_semaphores_len + 1;
+	VkSemaphore *wait_semaphores = calloc(waits_len, sizeof(*wait_semaphores));
+	VkPipelineStageFlags *wait_stages = calloc(waits_len, sizeof(*wait_stages));
+	uint32_t wait_count = 0;
+	if (wait_semaphores != NULL && wait_stages != NULL) {
+		if (transfer_submitted) {
+			wait_semaphores[wait_count] = frame->transfer_semaphore;
+			wait_stages[wait_count] = transfer_wait_stage;
+			wait_count++;
+		}
+		const VkSemaphore *dmabuf_semaphores = frame->wait_semaphores.data;
+		for (size_t i = 0; i < frame->wait_semaphores_len; i++) {
+			wait_semaphores[wait_count] = dmabuf_semaphores[i];
+			wait_stages[wait_count] = i < texture_waits_len ?
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT :
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			wait_count++;
+		}
+	} else {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		if (transfer_submitted) {
+			// Waiting on the transfer is required, the others are not
+			free(wait_semaphores);
+			free(wait_stages);
+			wait_semaphores = &frame->transfer_semaphore;
+			wait_stages = &transfer_wait_stage;
+			wait_count = 1;
+		}
 	}
 
-	VkSubmitInfo *render_sub = &submit_infos[submit_count];
-	render_sub->sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	render_sub->pCommandBuffers = &render_cb;
-	render_sub->commandBufferCount = 1u;
-	++submit_count;
+	VkCommandBuffer cbs[] = { pre_cb, render_cb };
+	VkSubmitInfo submit_info = {0};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 2u;
+	submit_info.pCommandBuffers = cbs;
+	submit_info.waitSemaphoreCount = wait_count;
+	submit_info.pWaitSemaphores = wait_semaphores;
+	submit_info.pWaitDstStageMask = wait_stages;
 
-	VkResult res = vkQueueSubmit(renderer->dev->queue, submit_count,
-		submit_infos, renderer->fence);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkQueueSubmit", res);
-		return;
+	// Signal the frame semaphore so that consumers of the render buffer can
+	// wait for this submission via a sync_file
+	if (frame->semaphore != VK_NULL_HANDLE) {
+		submit_info.signalSemaphoreCount = 1u;
+		submit_info.pSignalSemaphores = &frame->semaphore;
 	}
 
-	// sadly this is required due to the current api/rendering model of wlr
-	// ideally we could use gpu and cpu in parallel (_without_ the
-	// implicit synchronization overhead and mess of opengl drivers)
-	res = vkWaitForFences(renderer->dev->dev, 1, &renderer->fence, true,
-		UINT64_MAX);
+	VkResult res = vkQueueSubmit(renderer->dev->queue, 1, &submit_info,
+		frame->fence);
 	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkWaitForFences", res);
-		return;
+		wlr_vk_error("vkQueueSubmit", res);
+	} else {
+		frame->id = renderer->frame;
+		frame->pending = true;
+		render_buffer->last_used = frame->id;
+	}
+	if (wait_semaphores != &frame->transfer_semaphore) {
+		free(wait_semaphores);
+		free(wait_stages);
+	}
+
+	// Instead of waiting for the frame to finish, attach its fence to the
+	// DMA-BUFs it accesses so implicitly synchronized consumers wait for
+	// the GPU. Fall back to a CPU wait when the render buffer is unbound.
+	bool exported = frame->pending && export_frame_sync_file(renderer, frame);
+	render_buffer->needs_wait = frame->pending;
+	if (exported && frame->sync_file_fd < 0) {
+		render_buffer->needs_wait = false;
+	} else if (exported &&
+			wlr_buffer_get_dmabuf(render_buffer->wlr_buffer, &dmabuf)) {
+		render_buffer->needs_wait = !dmabuf_import_sync_file(&dmabuf,
+			DMA_BUF_SYNC_WRITE, frame->sync_file_fd);
+	}
+
+	// Clients must not write to sampled buffers before we're done reading
+	wl_list_for_each_safe(texture, tmp_tex, &renderer->foreign_textures, foreign_link) {
+		if (exported && frame->sync_file_fd >= 0 && texture->buffer != NULL &&
+				wlr_buffer_get_dmabuf(texture->buffer, &dmabuf)) {
+			dmabuf_import_sync_file(&dmabuf, DMA_BUF_SYNC_READ,
+				frame->sync_file_fd);
+		}
+		wl_list_remove(&texture->foreign_link);
+		texture->owned = false;
 	}
 
-	++renderer->frame;
-	release_stage_allocations(renderer);
-
-	// destroy pending textures
-	wl_list_for_each_safe(texture, tmp_tex, &renderer->destroy_textures, destroy_link) {
-		wlr_texture_destroy(&texture->wlr_texture);
+	if (timer != NULL) {
+		timer->pending = frame->pending;
+		timer->frame = renderer->frame;
+		timer->duration = -1;
 	}
 
-	wl_list_init(&renderer->destroy_textures); // reset the list
-	res = vkResetFences(renderer->dev->dev, 1, &renderer->fence);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkResetFences", res);
+	if (!frame->pending) {
 		return;
 	}
+
+	// Move on to the next frame, its resources can only be reused once its
+	// previous submission has finished
+	++renderer->frame;
+	renderer->current_frame =
+		&renderer->frames[renderer->frame % renderer->frames_in_flight];
+	if (renderer->current_frame->pending) {
+		retire_frame(renderer, renderer->current_frame);
+	}
 }
 
-static bool vulkan_render_subtexture_with_matrix(struct wlr_renderer *wlr_renderer,
+// Records the state needed to draw a texture, the caller issues the draws
+static bool bind_texture(struct wlr_vk_renderer *renderer,
 		struct wlr_texture *wlr_texture, const struct wlr_fbox *box,
 		const float matrix[static 9], float alpha) {
-	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
-	VkCommandBuffer cb = renderer->cb;
+	VkCommandBuffer cb = renderer->current_frame->cb;
 
 	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
 	assert(texture->renderer == renderer);
@@ -761,14 +1209,30 @@ static bool vulkan_render_subtexture_with_matrix(struct wlr_renderer *wlr_render
 		wl_list_insert(&renderer->foreign_textures, &texture->foreign_link);
 	}
 
-	VkPipeline pipe = renderer->current_render_buffer->render_setup->tex_pipe;
+	struct wlr_vk_render_format_setup *setup =
+		renderer->current_render_buffer->render_setup;
+	VkPipeline pipe = setup->tex_pipe;
+	VkPipelineLayout pipe_layout = renderer->pipe_layout;
+	if (texture->ycbcr_layout != NULL) {
+		pipe = get_ycbcr_pipeline(renderer, setup, texture->ycbcr_layout);
+		if (pipe == VK_NULL_HANDLE) {
+			return false;
+		}
+		pipe_layout = texture->ycbcr_layout->pipe_layout;
+	}
+
 	if (pipe != renderer->bound_pipe) {
 		vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipe);
 		renderer->bound_pipe = pipe;
 	}
 
-	vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-		renderer->pipe_layout, 0, 1, &texture->ds, 0, NULL);
+	// All pipeline layouts share the same push constant ranges, so pushed
+	// constants stay valid across layouts
+	if (texture->ds != renderer->bound_ds) {
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			pipe_layout, 0, 1, &texture->ds, 0, NULL);
+		renderer->bound_ds = texture->ds;
+	}
 
 	float final_matrix[9];
 	wlr_matrix_multiply(final_matrix, renderer->projection, matrix);
@@ -781,21 +1245,30 @@ static bool vulkan_render_subtexture_with_matrix(struct wlr_renderer *wlr_render
 	vert_pcr_data.uv_size[0] = box->width / wlr_texture->width;
 	vert_pcr_data.uv_size[1] = box->height / wlr_texture->height;
 
-	vkCmdPushConstants(cb, renderer->pipe_layout,
+	vkCmdPushConstants(cb, pipe_layout,
 		VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vert_pcr_data), &vert_pcr_data);
-	vkCmdPushConstants(cb, renderer->pipe_layout,
+	vkCmdPushConstants(cb, pipe_layout,
 		VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(vert_pcr_data), sizeof(float),
 		&alpha);
-	vkCmdDraw(cb, 4, 1, 0, 0);
 	texture->last_used = renderer->frame;
-
 	return true;
 }
 
-static void vulkan_clear(struct wlr_renderer *wlr_renderer,
-		const float color[static 4]) {
+static bool vulkan_render_subtexture_with_matrix(struct wlr_renderer *wlr_renderer,
+		struct wlr_texture *wlr_texture, const struct wlr_fbox *box,
+		const float matrix[static 9], float alpha) {
 	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
-	VkCommandBuffer cb = renderer->cb;
+	if (!bind_texture(renderer, wlr_texture, box, matrix, alpha)) {
+		return false;
+	}
+	vkCmdDraw(renderer->current_frame->cb, 4, 1, 0, 0);
+	return true;
+}
+
+static void clear_rects(struct wlr_vk_renderer *renderer,
+		const float color[static 4], const VkClearRect *rects,
+		uint32_t rects_len) {
+	VkCommandBuffer cb = renderer->current_frame->cb;
 
 	VkClearAttachment att = {0};
 	att.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -812,16 +1285,23 @@ static void vulkan_clear(struct wlr_renderer *wlr_renderer,
 	att.clearValue.color.float32[2] = color_to_linear(color[2]);
 	att.clearValue.color.float32[3] = color[3]; // no conversion for alpha
 
+	vkCmdClearAttachments(cb, 1, &att, rects_len, rects);
+}
+
+static void vulkan_clear(struct wlr_renderer *wlr_renderer,
+		const float color[static 4]) {
+	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
+
 	VkClearRect rect = {0};
 	rect.rect = renderer->scissor;
 	rect.layerCount = 1;
-	vkCmdClearAttachments(cb, 1, &att, 1, &rect);
+	clear_rects(renderer, color, &rect, 1);
 }
 
 static void vulkan_scissor(struct wlr_renderer *wlr_renderer,
 		struct wlr_box *box) {
 	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
-	VkCommandBuffer cb = renderer->cb;
+	VkCommandBuffer cb = renderer->current_frame->cb;
 
 	uint32_t w = renderer->render_width;
 	uint32_t h = renderer->render_height;
@@ -842,10 +1322,10 @@ static const uint32_t *vulkan_get_shm_texture_formats(
 	return renderer->dev->shm_formats;
 }
 
-static void vulkan_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
+// Records the state needed to draw a quad, the caller issues the draws
+static void bind_quad(struct wlr_vk_renderer *renderer,
 		const float color[static 4], const float matrix[static 9]) {
-	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
-	VkCommandBuffer cb = renderer->cb;
+	VkCommandBuffer cb = renderer->current_frame->cb;
 
 	VkPipeline pipe = renderer->current_render_buffer->render_setup->quad_pipe;
 	if (pipe != renderer->bound_pipe) {
@@ -881,7 +1361,120 @@ static void vulkan_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 	vkCmdPushConstants(cb, renderer->pipe_layout,
 		VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(vert_pcr_data), sizeof(float) * 4,
 		linear_color);
-	vkCmdDraw(cb, 4, 1, 0, 0);
+}
+
+static void vulkan_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
+		const float color[static 4], const float matrix[static 9]) {
+	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
+	bind_quad(renderer, color, matrix);
+	vkCmdDraw(renderer->current_frame->cb, 4, 1, 0, 0);
+}
+
+/**
+ * Collect the parts of the render buffer an operation touches into
+ * renderer->op_rects. Returns the number of rectangles.
+ */
+static uint32_t get_op_rects(struct wlr_vk_renderer *renderer,
+		const struct wlr_render_op *op) {
+	pixman_box32_t target = {
+		.x1 = 0,
+		.y1 = 0,
+		.x2 = renderer->render_width,
+		.y2 = renderer->render_height,
+	};
+	pixman_box32_t bounds;
+	if (render_op_get_bounds(op, &bounds)) {
+		target.x1 = bounds.x1 > target.x1 ? bounds.x1 : target.x1;
+		target.y1 = bounds.y1 > target.y1 ? bounds.y1 : target.y1;
+		target.x2 = bounds.x2 < target.x2 ? bounds.x2 : target.x2;
+		target.y2 = bounds.y2 < target.y2 ? bounds.y2 : target.y2;
+	}
+
+	int clip_len = 1;
+	const pixman_box32_t *clip = &target;
+	if (op->clip != NULL) {
+		clip = pixman_region32_rectangles((pixman_region32_t *)op->clip,
+			&clip_len);
+	}
+
+	renderer->op_rects.size = 0;
+	for (int i = 0; i < clip_len; i++) {
+		int32_t x1 = clip[i].x1 > target.x1 ? clip[i].x1 : target.x1;
+		int32_t y1 = clip[i].y1 > target.y1 ? clip[i].y1 : target.y1;
+		int32_t x2 = clip[i].x2 < target.x2 ? clip[i].x2 : target.x2;
+		int32_t y2 = clip[i].y2 < target.y2 ? clip[i].y2 : target.y2;
+		if (x1 >= x2 || y1 >= y2) {
+			continue;
+		}
+
+		VkClearRect *rect = wl_array_add(&renderer->op_rects, sizeof(*rect));
+		if (rect == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			break;
+		}
+		*rect = (VkClearRect){
+			.rect = {{x1, y1}, {x2 - x1, y2 - y1}},
+			.layerCount = 1,
+		};
+	}
+	return renderer->op_rects.size / sizeof(VkClearRect);
+}
+
+static bool vulkan_submit_ops(struct wlr_renderer *wlr_renderer,
+		const struct wlr_render_op *ops, size_t ops_len) {
+	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
+	VkCommandBuffer cb = renderer->current_frame->cb;
+
+	// Everything ends up in the frame's command buffer: state is bound once
+	// per operation, followed by one scissored draw per clip rectangle
+	for (size_t i = 0; i < ops_len; i++) {
+		const struct wlr_render_op *op = &ops[i];
+		uint32_t rects_len = get_op_rects(renderer, op);
+		if (rects_len == 0) {
+			continue;
+		}
+		const VkClearRect *rects = renderer->op_rects.data;
+
+		switch (op->type) {
+		case WLR_RENDER_OP_CLEAR:
+			clear_rects(renderer, op->clear.color, rects, rects_len);
+			continue;
+		case WLR_RENDER_OP_TEXTURE:
+			if (!bind_texture(renderer, op->texture.texture,
+					&op->texture.src_box, op->texture.matrix,
+					op->texture.alpha)) {
+				continue;
+			}
+			break;
+		case WLR_RENDER_OP_QUAD:
+			bind_quad(renderer, op->quad.color, op->quad.matrix);
+			break;
+		case WLR_RENDER_OP_FILL:
+			if (op->fill.color[3] == 1.0) {
+				// Same result as blending, without a pipeline switch
+				clear_rects(renderer, op->fill.color, rects, rects_len);
+				continue;
+			}
+			// One quad over the whole region, scissored to each rectangle
+			const pixman_box32_t *extents =
+				pixman_region32_extents((pixman_region32_t *)op->clip);
+			float matrix[9] = {
+				extents->x2 - extents->x1, 0, extents->x1,
+				0, extents->y2 - extents->y1, extents->y1,
+				0, 0, 1,
+			};
+			bind_quad(renderer, op->fill.color, matrix);
+			break;
+		}
+
+		for (uint32_t j = 0; j < rects_len; j++) {
+			vkCmdSetScissor(cb, 0, 1, &rects[j].rect);
+			vkCmdDraw(cb, 4, 1, 0, 0);
+		}
+	}
+
+	vulkan_scissor(wlr_renderer, NULL);
+	return true;
 }
 
 static const struct wlr_drm_format_set *vulkan_get_dmabuf_texture_formats(
@@ -913,7 +1506,10 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 
 	assert(!renderer->current_render_buffer);
 
-	// stage.cb automatically freed with command pool
+	// Also destroys the textures kept alive for frames in flight
+	wait_frame(renderer, renderer->frame - 1);
+
+	// command buffers automatically freed with command pool
 	struct wlr_vk_shared_buffer *buf, *tmp_buf;
 	wl_list_for_each_safe(buf, tmp_buf, &renderer->stage.buffers, link) {
 		shared_buffer_destroy(renderer, buf);
@@ -930,6 +1526,9 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 		destroy_render_buffer(render_buffer);
 	}
 
+	vulkan_prune_dmabuf_imports(renderer, true);
+	vulkan_memory_finish(renderer);
+
 	struct wlr_vk_render_format_setup *setup, *tmp_setup;
 	wl_list_for_each_safe(setup, tmp_setup,
 			&renderer->render_format_setups, link) {
@@ -938,23 +1537,47 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 
 	struct wlr_vk_descriptor_pool *pool, *tmp_pool;
 	wl_list_for_each_safe(pool, tmp_pool, &renderer->descriptor_pools, link) {
-		vkDestroyDescriptorPool(dev->dev, pool->pool, NULL);
-		free(pool);
+		destroy_descriptor_pool(renderer, pool);
 	}
+	wl_list_for_each_safe(pool, tmp_pool, &renderer->full_descriptor_pools, link) {
+		destroy_descriptor_pool(renderer, pool);
+	}
+
+	vulkan_pipeline_cache_finish(renderer);
 
 	vkDestroyShaderModule(dev->dev, renderer->vert_module, NULL);
 	vkDestroyShaderModule(dev->dev, renderer->tex_frag_module, NULL);
 	vkDestroyShaderModule(dev->dev, renderer->quad_frag_module, NULL);
 
-	vkDestroyFence(dev->dev, renderer->fence, NULL);
+	for (size_t i = 0; i < renderer->frames_in_flight; ++i) {
+		struct wlr_vk_frame *frame = &renderer->frames[i];
+		vkDestroyFence(dev->dev, frame->fence, NULL);
+		vkDestroySemaphore(dev->dev, frame->semaphore, NULL);
+		vkDestroySemaphore(dev->dev, frame->transfer_semaphore, NULL);
+		if (frame->sync_file_fd >= 0) {
+			close(frame->sync_file_fd);
+		}
+		VkSemaphore *semaphore;
+		wl_array_for_each(semaphore, &frame->wait_semaphores) {
+			vkDestroySemaphore(dev->dev, *semaphore, NULL);
+		}
+		wl_array_release(&frame->wait_semaphores);
+	}
+	struct wlr_vk_ycbcr_layout *ycbcr_layout, *tmp_ycbcr_layout;
+	wl_list_for_each_safe(ycbcr_layout, tmp_ycbcr_layout,
+			&renderer->ycbcr_layouts, link) {
+		destroy_ycbcr_layout(renderer, ycbcr_layout);
+	}
 	vkDestroyPipelineLayout(dev->dev, renderer->pipe_layout, NULL);
 	vkDestroyDescriptorSetLayout(dev->dev, renderer->ds_layout, NULL);
 	vkDestroySampler(dev->dev, renderer->sampler, NULL);
 	vkDestroyCommandPool(dev->dev, renderer->command_pool, NULL);
+	vkDestroyCommandPool(dev->dev, renderer->transfer_command_pool, NULL);
 
 	struct wlr_vk_instance *ini = dev->instance;
 	vulkan_device_destroy(dev);
 	vulkan_instance_destroy(ini);
+	wl_array_release(&renderer->op_rects);
 	free(renderer);
 }
 
@@ -976,6 +1599,106 @@ static uint32_t vulkan_get_render_buffer_caps(struct wlr_renderer *wlr_renderer)
 	return WLR_BUFFER_CAP_DMABUF;
 }
 
+static int64_t vulkan_render_timer_get_duration_ns(
+		struct wlr_render_timer *wlr_timer) {
+	struct wlr_vk_render_timer *timer =
+		wl_container_of(wlr_timer, timer, base);
+	struct wlr_vk_renderer *renderer = timer->renderer;
+	if (!timer->pending || vulkan_frame_is_busy(renderer, timer->frame)) {
+		return timer->duration;
+	}
+	timer->pending = false;
+
+	uint64_t ts[2];
+	VkResult res = vkGetQueryPoolResults(renderer->dev->dev,
+		timer->query_pool, 0, 2, sizeof(ts), ts, sizeof(ts[0]),
+		VK_QUERY_RESULT_64_BIT);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetQueryPoolResults", res);
+		return -1;
+	}
+
+	// Timestamps wrap around at their number of valid bits
+	uint64_t ticks = (ts[1] - ts[0]) & renderer->dev->timestamp_mask;
+	timer->duration = (int64_t)(ticks * (double)renderer->dev->timestamp_period);
+	return timer->duration;
+}
+
+static void vulkan_render_timer_destroy(struct wlr_render_timer *wlr_timer) {
+	struct wlr_vk_render_timer *timer =
+		wl_container_of(wlr_timer, timer, base);
+	struct wlr_vk_renderer *renderer = timer->renderer;
+	// The query pool may still be written by a frame in flight
+	if (timer->pending) {
+		wait_frame(renderer, timer->frame);
+	}
+	vkDestroyQueryPool(renderer->dev->dev, timer->query_pool, NULL);
+	free(timer);
+}
+
+static const struct wlr_render_timer_impl render_timer_impl = {
+	.get_duration_ns = vulkan_render_timer_get_duration_ns,
+	.destroy = vulkan_render_timer_destroy,
+};
+
+static struct wlr_render_timer *vulkan_render_timer_create(
+		struct wlr_renderer *wlr_renderer) {
+	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
+	if (!renderer->dev->timestamps) {
+		return NULL;
+	}
+
+	struct wlr_vk_render_timer *timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_render_timer_init(&timer->base, &render_timer_impl, wlr_renderer);
+	timer->renderer = renderer;
+	timer->duration = -1;
+
+	VkQueryPoolCreateInfo pool_info = {0};
+	pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	pool_info.queryCount = 2;
+	VkResult res = vkCreateQueryPool(renderer->dev->dev, &pool_info, NULL,
+		&timer->query_pool);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreateQueryPool", res);
+		free(timer);
+		return NULL;
+	}
+
+	return &timer->base;
+}
+
+static void vulkan_trim(struct wlr_renderer *wlr_renderer,
+		enum wlr_trim_level level) {
+	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
+
+	if (level >= WLR_TRIM_CRITICAL) {
+		// The images are re-imported the next time the buffer is bound
+		struct wlr_vk_render_buffer *buffer, *buffer_tmp;
+		wl_list_for_each_safe(buffer, buffer_tmp,
+				&renderer->render_buffers, link) {
+			if (buffer != renderer->current_render_buffer) {
+				destroy_render_buffer(buffer);
+			}
+		}
+	}
+
+	// Unlike release_stage_allocations(), don't keep a buffer around
+	struct wlr_vk_shared_buffer *buf, *tmp_buf;
+	wl_list_for_each_safe(buf, tmp_buf, &renderer->stage.buffers, link) {
+		if (buf->offset == 0 && !vulkan_frame_is_busy(renderer, buf->last_used)) {
+			shared_buffer_destroy(renderer, buf);
+		}
+	}
+
+	vulkan_prune_dmabuf_imports(renderer, true);
+	vulkan_memory_trim(renderer);
+}
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.bind_buffer = vulkan_bind_buffer,
 	.begin = vulkan_begin,
@@ -984,6 +1707,7 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.scissor = vulkan_scissor,
 	.render_subtexture_with_matrix = vulkan_render_subtexture_with_matrix,
 	.render_quad_with_matrix = vulkan_render_quad_with_matrix,
+	.submit_ops = vulkan_submit_ops,
 	.get_shm_texture_formats = vulkan_get_shm_texture_formats,
 	.get_dmabuf_texture_formats = vulkan_get_dmabuf_texture_formats,
 	.get_render_formats = vulkan_get_render_formats,
@@ -993,6 +1717,9 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.get_drm_fd = vulkan_get_drm_fd,
 	.get_render_buffer_caps = vulkan_get_render_buffer_caps,
 	.texture_from_buffer = vulkan_texture_from_buffer,
+	.export_sync_file = vulkan_export_sync_file,
+	.render_timer_create = vulkan_render_timer_create,
+	.trim = vulkan_trim,
 };
 
 // Initializes the VkDescriptorSetLayout and VkPipelineLayout needed
@@ -1135,9 +1862,7 @@ static bool init_tex_pipeline(struct wlr_vk_renderer *renderer,
 	pinfo.pDynamicState = &dynamic;
 	pinfo.pVertexInputState = &vertex;
 
-	// NOTE: use could use a cache here for faster loading
-	// store it somewhere like $XDG_CACHE_HOME/wlroots/vk_pipe_cache
-	VkPipelineCache cache = VK_NULL_HANDLE;
+	VkPipelineCache cache = renderer->pipeline_cache.cache;
 	res = vkCreateGraphicsPipelines(dev, cache, 1, &pinfo, NULL, pipe);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("failed to create vulkan pipelines:", res);
@@ -1147,6 +1872,111 @@ static bool init_tex_pipeline(struct wlr_vk_renderer *renderer,
 	return true;
 }
 
+struct wlr_vk_ycbcr_layout *vulkan_get_ycbcr_layout(
+		struct wlr_vk_renderer *renderer, const struct wlr_vk_format *format) {
+	assert(format->is_ycbcr);
+
+	struct wlr_vk_ycbcr_layout *layout;
+	wl_list_for_each(layout, &renderer->ycbcr_layouts, link) {
+		if (layout->format == format->vk_format) {
+			return layout;
+		}
+	}
+
+	layout = calloc(1, sizeof(*layout));
+	if (!layout) {
+		wlr_log_errno(WLR_ERROR, "allocation failed");
+		return NULL;
+	}
+	layout->format = format->vk_format;
+
+	VkResult res;
+	VkDevice dev = renderer->dev->dev;
+
+	// Clients don't tell us how their buffers are encoded, assume the
+	// common case of BT.601 limited range video
+	VkSamplerYcbcrConversionCreateInfo conversion_info = {0};
+	conversion_info.sType =
+		VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO;
+	conversion_info.format = format->vk_format;
+	conversion_info.ycbcrModel = VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_601;
+	conversion_info.ycbcrRange = VK_SAMPLER_YCBCR_RANGE_ITU_NARROW;
+	conversion_info.xChromaOffset = VK_CHROMA_LOCATION_MIDPOINT;
+	conversion_info.yChromaOffset = VK_CHROMA_LOCATION_MIDPOINT;
+	conversion_info.chromaFilter = VK_FILTER_LINEAR;
+
+	res = vkCreateSamplerYcbcrConversion(dev, &conversion_info, NULL,
+		&layout->conversion);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreateSamplerYcbcrConversion", res);
+		free(layout);
+		return NULL;
+	}
+
+	VkSamplerYcbcrConversionInfo conversion_ref = {0};
+	conversion_ref.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO;
+	conversion_ref.conversion = layout->conversion;
+
+	// Samplers with a YCbCr conversion must clamp to the edge
+	VkSamplerCreateInfo sampler_info = {0};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.pNext = &conversion_ref;
+	sampler_info.magFilter = VK_FILTER_LINEAR;
+	sampler_info.minFilter = VK_FILTER_LINEAR;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.maxAnisotropy = 1.f;
+	sampler_info.minLod = 0.f;
+	sampler_info.maxLod = 0.25f;
+	sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+
+	res = vkCreateSampler(dev, &sampler_info, NULL, &layout->sampler);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("Failed to create YCbCr sampler", res);
+		vkDestroySamplerYcbcrConversion(dev, layout->conversion, NULL);
+		free(layout);
+		return NULL;
+	}
+
+	wl_list_insert(&renderer->ycbcr_layouts, &layout->link);
+	if (!init_tex_layouts(renderer, layout->sampler,
+			&layout->ds_layout, &layout->pipe_layout)) {
+		destroy_ycbcr_layout(renderer, layout);
+		return NULL;
+	}
+
+	return layout;
+}
+
+static VkPipeline get_ycbcr_pipeline(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_render_format_setup *setup,
+		const struct wlr_vk_ycbcr_layout *layout) {
+	struct wlr_vk_ycbcr_pipeline *pipe;
+	wl_list_for_each(pipe, &setup->ycbcr_pipes, link) {
+		if (pipe->layout == layout) {
+			return pipe->pipe;
+		}
+	}
+
+	pipe = calloc(1, sizeof(*pipe));
+	if (!pipe) {
+		wlr_log_errno(WLR_ERROR, "allocation failed");
+		return VK_NULL_HANDLE;
+	}
+	pipe->layout = layout;
+
+	if (!init_tex_pipeline(renderer, setup->render_pass, layout->pipe_layout,
+			&pipe->pipe)) {
+		free(pipe);
+		return VK_NULL_HANDLE;
+	}
+
+	wl_list_insert(&setup->ycbcr_pipes, &pipe->link);
+	return pipe->pipe;
+}
+
 // Creates static render data, such as sampler, layouts and shader modules
 // for the given rednerer.
 // Cleanup is done by destroying the renderer.
@@ -1228,6 +2058,7 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 	}
 
 	setup->render_format = format;
+	wl_list_init(&setup->ycbcr_pipes);
 
 	// util
 	VkDevice dev = renderer->dev->dev;
@@ -1378,15 +2209,17 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 	pinfo.pDynamicState = &dynamic;
 	pinfo.pVertexInputState = &vertex;
 
-	// NOTE: use could use a cache here for faster loading
-	// store it somewhere like $XDG_CACHE_HOME/wlroots/vk_pipe_cache.bin
-	VkPipelineCache cache = VK_NULL_HANDLE;
+	VkPipelineCache cache = renderer->pipeline_cache.cache;
 	res = vkCreateGraphicsPipelines(dev, cache, 1, &pinfo, NULL, &setup->quad_pipe);
 	if (res != VK_SUCCESS) {
 		wlr_log(WLR_ERROR, "failed to create vulkan quad pipeline: %d", res);
 		goto error;
 	}
 
+	// Persist the new pipelines right away, output hotplug is the most
+	// likely reason for a new render format
+	vulkan_pipeline_cache_save(renderer);
+
 	wl_list_insert(&renderer->render_format_setups, &setup->link);
 	return setup;
 
@@ -1395,6 +2228,86 @@ error:
 	return NULL;
 }
 
+static size_t get_frames_in_flight(void) {
+	const char *env = getenv("WLR_VK_FRAMES_IN_FLIGHT");
+	if (env == NULL) {
+		return default_frames_in_flight;
+	}
+
+	char *end;
+	long n = strtol(env, &end, 10);
+	if (env[0] == '\0' || end[0] != '\0' || n < 1 ||
+			n > WLR_VK_MAX_FRAMES_IN_FLIGHT) {
+		wlr_log(WLR_ERROR, "Invalid WLR_VK_FRAMES_IN_FLIGHT value, "
+			"expected a number between 1 and %d", WLR_VK_MAX_FRAMES_IN_FLIGHT);
+		return default_frames_in_flight;
+	}
+	return n;
+}
+
+static bool init_frame(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_frame *frame) {
+	struct wlr_vk_device *dev = renderer->dev;
+	VkResult res;
+
+	VkCommandBuffer cbs[2];
+	VkCommandBufferAllocateInfo cbai = {0};
+	cbai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cbai.commandBufferCount = 2u;
+	cbai.commandPool = renderer->command_pool;
+	cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	res = vkAllocateCommandBuffers(dev->dev, &cbai, cbs);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkAllocateCommandBuffers", res);
+		return false;
+	}
+	frame->cb = cbs[0];
+	frame->stage_cb = cbs[1];
+
+	VkFenceCreateInfo fence_info = {0};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	res = vkCreateFence(dev->dev, &fence_info, NULL, &frame->fence);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreateFence", res);
+		return false;
+	}
+
+	if (dev->sync_file_export) {
+		VkExportSemaphoreCreateInfo export_info = {0};
+		export_info.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+		export_info.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+		VkSemaphoreCreateInfo sem_info = {0};
+		sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		sem_info.pNext = &export_info;
+		res = vkCreateSemaphore(dev->dev, &sem_info, NULL, &frame->semaphore);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkCreateSemaphore", res);
+			return false;
+		}
+	}
+
+	if (renderer->transfer_command_pool != VK_NULL_HANDLE) {
+		cbai.commandBufferCount = 1u;
+		cbai.commandPool = renderer->transfer_command_pool;
+		res = vkAllocateCommandBuffers(dev->dev, &cbai, &frame->transfer_cb);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkAllocateCommandBuffers", res);
+			return false;
+		}
+
+		VkSemaphoreCreateInfo sem_info = {0};
+		sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		res = vkCreateSemaphore(dev->dev, &sem_info, NULL,
+			&frame->transfer_semaphore);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkCreateSemaphore", res);
+			return false;
+		}
+	}
+
+	return true;
+}
+
 struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev) {
 	struct wlr_vk_renderer *renderer;
 	VkResult res;
@@ -1405,18 +2318,31 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 
 	renderer->dev = dev;
 	wlr_renderer_init(&renderer->wlr_renderer, &renderer_impl);
+	renderer->frames_in_flight = get_frames_in_flight();
+	for (size_t i = 0; i < renderer->frames_in_flight; ++i) {
+		renderer->frames[i].sync_file_fd = -1;
+		wl_array_init(&renderer->frames[i].wait_semaphores);
+	}
 	wl_list_init(&renderer->stage.buffers);
 	wl_list_init(&renderer->destroy_textures);
 	wl_list_init(&renderer->foreign_textures);
 	wl_list_init(&renderer->textures);
 	wl_list_init(&renderer->descriptor_pools);
+	wl_list_init(&renderer->full_descriptor_pools);
 	wl_list_init(&renderer->render_format_setups);
+	wl_list_init(&renderer->ycbcr_layouts);
 	wl_list_init(&renderer->render_buffers);
+	wl_list_init(&renderer->memory_blocks);
+	wl_array_init(&renderer->op_rects);
+	wl_list_init(&renderer->dmabuf_imports);
 
 	if (!init_static_render_data(renderer)) {
 		goto error;
 	}
 
+	// Not fatal, pipelines are just compiled from scratch without a cache
+	vulkan_pipeline_cache_init(renderer);
+
 	// command pool
 	VkCommandPoolCreateInfo cpool_info = {0};
 	cpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -1429,38 +2355,25 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 		goto error;
 	}
 
-	VkCommandBufferAllocateInfo cbai = {0};
-	cbai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cbai.commandBufferCount = 1u;
-	cbai.commandPool = renderer->command_pool;
-	cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	res = vkAllocateCommandBuffers(dev->dev, &cbai, &renderer->cb);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkAllocateCommandBuffers", res);
-		goto error;
-	}
-
-	VkFenceCreateInfo fence_info = {0};
-	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	res = vkCreateFence(dev->dev, &fence_info, NULL,
-		&renderer->fence);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkCreateFence", res);
-		goto error;
+	if (dev->has_transfer_queue) {
+		cpool_info.queueFamilyIndex = dev->transfer_queue_family;
+		res = vkCreateCommandPool(dev->dev, &cpool_info, NULL,
+			&renderer->transfer_command_pool);
+		if (res != VK_SUCCESS) {
+			// Not fatal, uploads just run on the graphics queue
+			wlr_vk_error("vkCreateCommandPool", res);
+			renderer->transfer_command_pool = VK_NULL_HANDLE;
+		}
+		renderer->concurrent_queue_families[0] = dev->queue_family;
+		renderer->concurrent_queue_families[1] = dev->transfer_queue_family;
 	}
 
-	// staging command buffer
-	VkCommandBufferAllocateInfo cmd_buf_info = {0};
-	cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cmd_buf_info.commandPool = renderer->command_pool;
-	cmd_buf_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	cmd_buf_info.commandBufferCount = 1u;
-	res = vkAllocateCommandBuffers(dev->dev, &cmd_buf_info,
-		&renderer->stage.cb);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkAllocateCommandBuffers", res);
-		goto error;
+	for (size_t i = 0; i < renderer->frames_in_flight; ++i) {
+		if (!init_frame(renderer, &renderer->frames[i])) {
+			goto error;
+		}
 	}
+	renderer->current_frame = &renderer->frames[0];
 
 	return &renderer->wlr_renderer;
 
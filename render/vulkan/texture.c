@@ -35,6 +35,9 @@ static VkImageAspectFlagBits mem_plane_aspect(unsigned i) {
 
 static bool vulkan_texture_is_opaque(struct wlr_texture *wlr_texture) {
 	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
+	if (texture->format->is_ycbcr) {
+		return true;
+	}
 	const struct wlr_pixel_format_info *format_info = drm_get_pixel_format_info(
 			texture->format->drm_format);
 	assert(format_info);
@@ -48,10 +51,8 @@ static bool write_pixels(struct wlr_texture *wlr_texture,
 		uint32_t src_y, uint32_t dst_x, uint32_t dst_y, const void *vdata,
 		VkImageLayout old_layout, VkPipelineStageFlags src_stage,
 		VkAccessFlags src_access) {
-	VkResult res;
 	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
 	struct wlr_vk_renderer *renderer = texture->renderer;
-	VkDevice dev = texture->renderer->dev->dev;
 
 	// make sure assumptions are met
 	assert(src_x + width <= texture->wlr_texture.width);
@@ -76,18 +77,25 @@ static bool write_pixels(struct wlr_texture *wlr_texture,
 		return false;
 	}
 
-	void *vmap;
-	res = vkMapMemory(dev, span.buffer->memory, span.alloc.start,
-		bsize, 0, &vmap);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkMapMemory", res);
-		return false;
-	}
-	char *map = (char *)vmap;
+	char *vmap = (char *)span.buffer->cpu_mapping + span.alloc.start;
+	char *map = vmap;
 
 	// record staging cb
 	// will be executed before next frame
-	VkCommandBuffer cb = vulkan_record_stage_cb(renderer);
+	// Textures no frame in flight uses anymore can be uploaded on the
+	// dedicated transfer queue, in parallel with rendering
+	VkCommandBuffer cb = VK_NULL_HANDLE;
+	if (!vulkan_frame_is_busy(renderer, texture->last_used)) {
+		cb = vulkan_record_transfer_cb(renderer);
+	}
+	bool async = cb != VK_NULL_HANDLE;
+	if (async) {
+		// Previous accesses are complete since the frame has finished
+		src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		src_access = 0;
+	} else {
+		cb = vulkan_record_stage_cb(renderer);
+	}
 	vulkan_change_layout(cb, texture->image,
 		old_layout, src_stage, src_access,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -97,7 +105,7 @@ static bool write_pixels(struct wlr_texture *wlr_texture,
 	const char *pdata = vdata; // data iterator
 
 	uint32_t packed_stride = bytespb * width;
-	uint32_t buf_off = span.alloc.start + (map - (char *)vmap);
+	VkDeviceSize buf_off = span.alloc.start;
 
 	// write data into staging buffer span
 	pdata += stride * src_y;
@@ -129,16 +137,19 @@ static bool write_pixels(struct wlr_texture *wlr_texture,
 	copy.imageSubresource.layerCount = 1;
 	copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 
-	assert((uint32_t)(map - (char *)vmap) == bsize);
-	vkUnmapMemory(dev, span.buffer->memory);
+	assert((uint32_t)(map - vmap) == bsize);
 
 	vkCmdCopyBufferToImage(cb, span.buffer->buffer, texture->image,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+	// Graphics stages don't exist on the transfer queue, the semaphore
+	// waited for by the frame makes the upload visible there
 	vulkan_change_layout(cb, texture->image,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
 		VK_ACCESS_TRANSFER_WRITE_BIT,
 		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, VK_ACCESS_SHADER_READ_BIT);
+		async ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT :
+			VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
+		async ? 0 : VK_ACCESS_SHADER_READ_BIT);
 	texture->last_used = renderer->frame;
 
 	return true;
@@ -158,19 +169,26 @@ void vulkan_texture_destroy(struct wlr_vk_texture *texture) {
 		return;
 	}
 
-	// when we recorded a command to fill this image _this_ frame,
-	// it has to be executed before the texture can be destroyed.
+	// when a frame which hasn't finished execution yet uses this image,
+	// the texture can't be destroyed yet.
 	// Add it to the renderer->destroy_textures list, destroying
-	// _after_ the stage command buffer has exectued
-	if (texture->last_used == texture->renderer->frame) {
+	// _after_ the frame's fence has signalled
+	if (vulkan_frame_is_busy(texture->renderer, texture->last_used)) {
 		assert(texture->destroy_link.next == NULL); // not already inserted
 		wl_list_insert(&texture->renderer->destroy_textures,
 			&texture->destroy_link);
+		// the buffer may be gone by the time the texture is destroyed
+		if (texture->buffer != NULL) {
+			wlr_addon_finish(&texture->buffer_addon);
+			texture->buffer = NULL;
+		}
 		return;
 	}
 
 	wl_list_remove(&texture->link);
-	wl_list_remove(&texture->buffer_destroy.link);
+	if (texture->buffer != NULL) {
+		wlr_addon_finish(&texture->buffer_addon);
+	}
 
 	VkDevice dev = texture->renderer->dev->dev;
 	if (texture->ds && texture->ds_pool) {
@@ -178,10 +196,13 @@ void vulkan_texture_destroy(struct wlr_vk_texture *texture) {
 	}
 
 	vkDestroyImageView(dev, texture->image_view, NULL);
-	vkDestroyImage(dev, texture->image, NULL);
-
-	for (unsigned i = 0u; i < texture->mem_count; ++i) {
-		vkFreeMemory(dev, texture->memories[i], NULL);
+	if (texture->dmabuf_imported && texture->image) {
+		vulkan_release_dmabuf_import(texture->renderer, &texture->dmabuf_key,
+			texture->image, texture->memories, texture->mem_count,
+			texture->transitioned);
+	} else {
+		vkDestroyImage(dev, texture->image, NULL);
+		vulkan_free_memory(texture->renderer, &texture->memory);
 	}
 
 	free(texture);
@@ -190,8 +211,8 @@ void vulkan_texture_destroy(struct wlr_vk_texture *texture) {
 static void vulkan_texture_unref(struct wlr_texture *wlr_texture) {
 	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
 	if (texture->buffer != NULL) {
-		// Keep the texture around, in case the buffer is re-used later. We're
-		// still listening to the buffer's destroy event.
+		// Keep the texture around, in case the buffer is re-used later. The
+		// addon destroys it along with the buffer.
 		wlr_buffer_unlock(texture->buffer);
 	} else {
 		vulkan_texture_destroy(texture);
@@ -214,8 +235,9 @@ static struct wlr_vk_texture *vulkan_texture_create(
 	}
 	wlr_texture_init(&texture->wlr_texture, &texture_impl, width, height);
 	texture->renderer = renderer;
+	// not used by any frame yet
+	texture->last_used = renderer->finished_frame - 1;
 	wl_list_insert(&renderer->textures, &texture->link);
-	wl_list_init(&texture->buffer_destroy.link);
 	return texture;
 }
 
@@ -246,8 +268,6 @@ static struct wlr_texture *vulkan_texture_from_pixels(struct wlr_renderer *wlr_r
 	texture->format = &fmt->format;
 
 	// create image
-	unsigned mem_bits = 0xFFFFFFFF;
-
 	VkImageCreateInfo img_info = {0};
 	img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	img_info.imageType = VK_IMAGE_TYPE_2D;
@@ -255,15 +275,14 @@ static struct wlr_texture *vulkan_texture_from_pixels(struct wlr_renderer *wlr_r
 	img_info.mipLevels = 1;
 	img_info.arrayLayers = 1;
 	img_info.samples = VK_SAMPLE_COUNT_1_BIT;
-	img_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	vulkan_set_sharing_mode(renderer, &img_info.sharingMode,
+		&img_info.queueFamilyIndexCount, &img_info.pQueueFamilyIndices);
 	img_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	img_info.extent = (VkExtent3D) { width, height, 1 };
 	img_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
 
 	img_info.tiling = VK_IMAGE_TILING_OPTIMAL;
 	img_info.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-	mem_bits = vulkan_find_mem_type(renderer->dev,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mem_bits);
 	VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 	res = vkCreateImage(dev, &img_info, NULL, &texture->image);
@@ -272,22 +291,30 @@ static struct wlr_texture *vulkan_texture_from_pixels(struct wlr_renderer *wlr_r
 		goto error;
 	}
 
-	// memory
-	VkMemoryRequirements mem_reqs;
-	vkGetImageMemoryRequirements(dev, texture->image, &mem_reqs);
+	// memory, suballocated unless the driver prefers otherwise
+	VkMemoryDedicatedRequirements dedicated_reqs = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+	};
+	VkMemoryRequirements2 mem_reqs = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+		.pNext = &dedicated_reqs,
+	};
+	VkImageMemoryRequirementsInfo2 mem_reqs_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+		.image = texture->image,
+	};
+	vkGetImageMemoryRequirements2(dev, &mem_reqs_info, &mem_reqs);
 
-	VkMemoryAllocateInfo mem_info = {0};
-	mem_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	mem_info.allocationSize = mem_reqs.size;
-	mem_info.memoryTypeIndex = mem_bits & mem_reqs.memoryTypeBits;
-	res = vkAllocateMemory(dev, &mem_info, NULL, &texture->memories[0]);
-	if (res != VK_SUCCESS) {
-		wlr_vk_error("vkAllocatorMemory failed", res);
+	VkImage dedicated_image = dedicated_reqs.prefersDedicatedAllocation ?
+		texture->image : VK_NULL_HANDLE;
+	if (!vulkan_alloc_memory(renderer, &mem_reqs.memoryRequirements,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, dedicated_image,
+			&texture->memory)) {
 		goto error;
 	}
 
-	texture->mem_count = 1;
-	res = vkBindImageMemory(dev, texture->image, texture->memories[0], 0);
+	res = vkBindImageMemory(dev, texture->image, texture->memory.memory,
+		texture->memory.offset);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkBindMemory failed", res);
 		goto error;
@@ -321,7 +348,8 @@ static struct wlr_texture *vulkan_texture_from_pixels(struct wlr_renderer *wlr_r
 	}
 
 	// descriptor
-	texture->ds_pool = vulkan_alloc_texture_ds(renderer, &texture->ds);
+	texture->ds_pool = vulkan_alloc_texture_ds(renderer, renderer->ds_layout,
+		&texture->ds);
 	if (!texture->ds_pool) {
 		wlr_log(WLR_ERROR, "failed to allocate descriptor");
 		goto error;
@@ -380,13 +408,149 @@ static bool is_dmabuf_disjoint(const struct wlr_dmabuf_attributes *attribs) {
 	return false;
 }
 
+// Maximum number of imports kept in the cache
+#define DMABUF_IMPORTS_MAX 16
+// Number of frames after which unused cached imports are destroyed
+#define DMABUF_IMPORT_MAX_AGE 256
+
+static void dmabuf_key_init(struct wlr_vk_dmabuf_key *key,
+		const struct wlr_dmabuf_attributes *attribs, bool for_render) {
+	memset(key, 0, sizeof(*key));
+	for (int i = 0; i < attribs->n_planes; ++i) {
+		struct stat st;
+		if (fstat(attribs->fd[i], &st) != 0) {
+			wlr_log_errno(WLR_DEBUG, "fstat failed");
+			key->n_planes = 0;
+			return;
+		}
+		key->inode[i] = st.st_ino;
+		key->offset[i] = attribs->offset[i];
+		key->stride[i] = attribs->stride[i];
+	}
+	key->n_planes = attribs->n_planes;
+	key->format = attribs->format;
+	key->modifier = attribs->modifier;
+	key->width = attribs->width;
+	key->height = attribs->height;
+	key->for_render = for_render;
+}
+
+// Struct assignment doesn't preserve padding bytes, compare field by field
+static bool dmabuf_key_equal(const struct wlr_vk_dmabuf_key *a,
+		const struct wlr_vk_dmabuf_key *b) {
+	if (a->format != b->format || a->modifier != b->modifier ||
+			a->width != b->width || a->height != b->height ||
+			a->n_planes != b->n_planes || a->for_render != b->for_render) {
+		return false;
+	}
+	for (uint32_t i = 0; i < a->n_planes; i++) {
+		if (a->inode[i] != b->inode[i] || a->offset[i] != b->offset[i] ||
+				a->stride[i] != b->stride[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void dmabuf_import_destroy(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_dmabuf_import *import) {
+	VkDevice dev = renderer->dev->dev;
+	vkDestroyImage(dev, import->image, NULL);
+	for (uint32_t i = 0u; i < import->mem_count; ++i) {
+		vkFreeMemory(dev, import->memories[i], NULL);
+	}
+	wl_list_remove(&import->link);
+	--renderer->dmabuf_import_count;
+	free(import);
+}
+
+void vulkan_release_dmabuf_import(struct wlr_vk_renderer *renderer,
+		const struct wlr_vk_dmabuf_key *key, VkImage image,
+		VkDeviceMemory mems[static WLR_DMABUF_MAX_PLANES], uint32_t n_mems,
+		bool transitioned) {
+	struct wlr_vk_dmabuf_import *import = NULL;
+	if (key->n_planes > 0) {
+		import = calloc(1, sizeof(*import));
+	}
+	if (import == NULL) {
+		VkDevice dev = renderer->dev->dev;
+		vkDestroyImage(dev, image, NULL);
+		for (uint32_t i = 0u; i < n_mems; ++i) {
+			vkFreeMemory(dev, mems[i], NULL);
+		}
+		return;
+	}
+
+	import->key = *key;
+	import->image = image;
+	import->mem_count = n_mems;
+	memcpy(import->memories, mems, n_mems * sizeof(*mems));
+	import->transitioned = transitioned;
+	import->cached_frame = renderer->frame;
+	wl_list_insert(&renderer->dmabuf_imports, &import->link);
+	++renderer->dmabuf_import_count;
+
+	if (renderer->dmabuf_import_count > DMABUF_IMPORTS_MAX) {
+		struct wlr_vk_dmabuf_import *oldest = wl_container_of(
+			renderer->dmabuf_imports.prev, oldest, link);
+		dmabuf_import_destroy(renderer, oldest);
+	}
+}
+
+void vulkan_prune_dmabuf_imports(struct wlr_vk_renderer *renderer, bool all) {
+	struct wlr_vk_dmabuf_import *import, *tmp;
+	wl_list_for_each_reverse_safe(import, tmp, &renderer->dmabuf_imports,
+			link) {
+		if (!all && renderer->frame - import->cached_frame <
+				DMABUF_IMPORT_MAX_AGE) {
+			// the list is ordered, all remaining imports are younger
+			break;
+		}
+		dmabuf_import_destroy(renderer, import);
+	}
+}
+
+static VkImage take_dmabuf_import(struct wlr_vk_renderer *renderer,
+		const struct wlr_vk_dmabuf_key *key,
+		VkDeviceMemory mems[static WLR_DMABUF_MAX_PLANES], uint32_t *n_mems,
+		bool *transitioned) {
+	if (key->n_planes == 0) {
+		return VK_NULL_HANDLE;
+	}
+
+	struct wlr_vk_dmabuf_import *import;
+	wl_list_for_each(import, &renderer->dmabuf_imports, link) {
+		if (!dmabuf_key_equal(&import->key, key)) {
+			continue;
+		}
+
+		VkImage image = import->image;
+		*n_mems = import->mem_count;
+		memcpy(mems, import->memories, import->mem_count * sizeof(*mems));
+		*transitioned = import->transitioned;
+		wl_list_remove(&import->link);
+		--renderer->dmabuf_import_count;
+		free(import);
+		return image;
+	}
+	return VK_NULL_HANDLE;
+}
+
 VkImage vulkan_import_dmabuf(struct wlr_vk_renderer *renderer,
 		const struct wlr_dmabuf_attributes *attribs,
 		VkDeviceMemory mems[static WLR_DMABUF_MAX_PLANES], uint32_t *n_mems,
-		bool for_render) {
+		bool for_render, struct wlr_vk_dmabuf_key *key, bool *transitioned) {
 	VkResult res;
 	VkDevice dev = renderer->dev->dev;
 	*n_mems = 0u;
+	*transitioned = false;
+
+	dmabuf_key_init(key, attribs, for_render);
+	VkImage cached = take_dmabuf_import(renderer, key, mems, n_mems,
+		transitioned);
+	if (cached != VK_NULL_HANDLE) {
+		return cached;
+	}
 
 	wlr_log(WLR_DEBUG, "vulkan_import_dmabuf: %.4s (mod %"PRIx64"), %dx%d, %d planes",
 		(const char *)&attribs->format, attribs->modifier,
@@ -604,14 +768,23 @@ static struct wlr_texture *vulkan_texture_from_dmabuf(struct wlr_renderer *wlr_r
 	}
 
 	texture->format = &fmt->format;
+	VkDescriptorSetLayout ds_layout = renderer->ds_layout;
+	if (texture->format->is_ycbcr) {
+		texture->ycbcr_layout = vulkan_get_ycbcr_layout(renderer,
+			texture->format);
+		if (!texture->ycbcr_layout) {
+			goto error;
+		}
+		ds_layout = texture->ycbcr_layout->ds_layout;
+	}
+
 	texture->image = vulkan_import_dmabuf(renderer, attribs,
-		texture->memories, &texture->mem_count, false);
+		texture->memories, &texture->mem_count, false, &texture->dmabuf_key,
+		&texture->transitioned);
 	if (!texture->image) {
 		goto error;
 	}
-
-	const struct wlr_pixel_format_info *format_info = drm_get_pixel_format_info(attribs->format);
-	assert(format_info);
+	texture->dmabuf_imported = true;
 
 	// view
 	VkImageViewCreateInfo view_info = {0};
@@ -621,9 +794,24 @@ static struct wlr_texture *vulkan_texture_from_dmabuf(struct wlr_renderer *wlr_r
 	view_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
 	view_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
 	view_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-	view_info.components.a = format_info->has_alpha
-		? VK_COMPONENT_SWIZZLE_IDENTITY
-		: VK_COMPONENT_SWIZZLE_ONE;
+	view_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+	// Views of multi-planar formats must use the sampler's conversion,
+	// which yields opaque RGB
+	VkSamplerYcbcrConversionInfo conversion_info = {0};
+	if (texture->ycbcr_layout) {
+		conversion_info.sType =
+			VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO;
+		conversion_info.conversion = texture->ycbcr_layout->conversion;
+		view_info.pNext = &conversion_info;
+	} else {
+		const struct wlr_pixel_format_info *format_info =
+			drm_get_pixel_format_info(attribs->format);
+		assert(format_info);
+		if (!format_info->has_alpha) {
+			view_info.components.a = VK_COMPONENT_SWIZZLE_ONE;
+		}
+	}
 
 	view_info.subresourceRange = (VkImageSubresourceRange) {
 		VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1
@@ -637,7 +825,8 @@ static struct wlr_texture *vulkan_texture_from_dmabuf(struct wlr_renderer *wlr_r
 	}
 
 	// descriptor
-	texture->ds_pool = vulkan_alloc_texture_ds(renderer, &texture->ds);
+	texture->ds_pool = vulkan_alloc_texture_ds(renderer, ds_layout,
+		&texture->ds);
 	if (!texture->ds_pool) {
 		wlr_log(WLR_ERROR, "failed to allocate descriptor");
 		goto error;
@@ -655,7 +844,6 @@ static struct wlr_texture *vulkan_texture_from_dmabuf(struct wlr_renderer *wlr_r
 	ds_write.pImageInfo = &ds_img_info;
 
 	vkUpdateDescriptorSets(dev, 1, &ds_write, 0, NULL);
-	texture->dmabuf_imported = true;
 
 	return &texture->wlr_texture;
 
@@ -664,22 +852,27 @@ error:
 	return NULL;
 }
 
-static void texture_handle_buffer_destroy(struct wl_listener *listener,
-		void *data) {
+static void texture_handle_buffer_destroy(struct wlr_addon *addon) {
 	struct wlr_vk_texture *texture =
-		wl_container_of(listener, texture, buffer_destroy);
+		wl_container_of(addon, texture, buffer_addon);
 	vulkan_texture_destroy(texture);
 }
 
+static const struct wlr_addon_interface buffer_addon_impl = {
+	.name = "wlr_vk_texture",
+	.destroy = texture_handle_buffer_destroy,
+};
+
 static struct wlr_texture *vulkan_texture_from_dmabuf_buffer(
 		struct wlr_vk_renderer *renderer, struct wlr_buffer *buffer,
 		struct wlr_dmabuf_attributes *dmabuf) {
-	struct wlr_vk_texture *texture;
-	wl_list_for_each(texture, &renderer->textures, link) {
-		if (texture->buffer == buffer) {
-			wlr_buffer_lock(texture->buffer);
-			return &texture->wlr_texture;
-		}
+	struct wlr_addon *addon =
+		wlr_addon_find(&buffer->addons, renderer, &buffer_addon_impl);
+	if (addon != NULL) {
+		struct wlr_vk_texture *texture =
+			wl_container_of(addon, texture, buffer_addon);
+		wlr_buffer_lock(texture->buffer);
+		return &texture->wlr_texture;
 	}
 
 	struct wlr_texture *wlr_texture =
@@ -688,11 +881,10 @@ static struct wlr_texture *vulkan_texture_from_dmabuf_buffer(
 		return false;
 	}
 
-	texture = vulkan_get_texture(wlr_texture);
+	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
 	texture->buffer = wlr_buffer_lock(buffer);
-
-	texture->buffer_destroy.notify = texture_handle_buffer_destroy;
-	wl_signal_add(&buffer->events.destroy, &texture->buffer_destroy);
+	wlr_addon_init(&texture->buffer_addon, &buffer->addons, renderer,
+		&buffer_addon_impl);
 
 	return &texture->wlr_texture;
 }
@@ -466,6 +466,44 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 		dev->extensions[dev->extension_count++] = names[i];
 	}
 
+	// Exporting render fences and importing DMA-BUF fences for explicit
+	// synchronization is optional
+	const char *sync_file_name = VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME;
+	if (!find_extensions(avail_ext_props, avail_extc, &sync_file_name, 1)) {
+		VkPhysicalDeviceExternalSemaphoreInfo sem_info = {0};
+		sem_info.sType =
+			VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO;
+		sem_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+		VkExternalSemaphoreProperties sem_props = {0};
+		sem_props.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES;
+		vkGetPhysicalDeviceExternalSemaphoreProperties(phdev, &sem_info,
+			&sem_props);
+		dev->sync_file_export = sem_props.externalSemaphoreFeatures &
+			VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT;
+		dev->sync_file_import = sem_props.externalSemaphoreFeatures &
+			VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT;
+		if (dev->sync_file_export || dev->sync_file_import) {
+			dev->extensions[dev->extension_count++] = sync_file_name;
+		}
+	}
+	wlr_log(WLR_DEBUG, "Vulkan sync_file export %s",
+		dev->sync_file_export ? "supported" : "not supported");
+	wlr_log(WLR_DEBUG, "Vulkan sync_file import %s",
+		dev->sync_file_import ? "supported" : "not supported");
+
+	// Sampling multi-planar YUV formats is core in vulkan 1.1 but the
+	// feature is optional
+	VkPhysicalDeviceSamplerYcbcrConversionFeatures ycbcr_features = {0};
+	ycbcr_features.sType =
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SAMPLER_YCBCR_CONVERSION_FEATURES;
+	VkPhysicalDeviceFeatures2 features = {0};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &ycbcr_features;
+	vkGetPhysicalDeviceFeatures2(phdev, &features);
+	dev->sampler_ycbcr_conversion = ycbcr_features.samplerYcbcrConversion;
+	wlr_log(WLR_DEBUG, "Vulkan sampler YCbCr conversion %s",
+		dev->sampler_ycbcr_conversion ? "supported" : "not supported");
+
 	// queue families
 	{
 		uint32_t qfam_count;
@@ -485,23 +523,57 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 		}
 
 		assert(graphics_found);
+
+		VkPhysicalDeviceProperties phdev_props;
+		vkGetPhysicalDeviceProperties(phdev, &phdev_props);
+		dev->timestamps =
+			queue_props[dev->queue_family].timestampValidBits > 0 &&
+			phdev_props.limits.timestampPeriod > 0;
+		dev->timestamp_period = phdev_props.limits.timestampPeriod;
+		uint32_t valid_bits = queue_props[dev->queue_family].timestampValidBits;
+		dev->timestamp_mask = valid_bits >= 64 ?
+			UINT64_MAX : (UINT64_C(1) << valid_bits) - 1;
+
+		// Queue families with transfer but without graphics or compute
+		// support usually map to dedicated DMA engines
+		for (unsigned i = 0u; i < qfam_count; ++i) {
+			VkQueueFlags flags = queue_props[i].queueFlags;
+			if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+					!(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+				dev->transfer_queue_family = i;
+				dev->has_transfer_queue = true;
+				break;
+			}
+		}
 	}
+	wlr_log(WLR_DEBUG, "Vulkan dedicated transfer queue %s",
+		dev->has_transfer_queue ? "found" : "not found");
 
 	const float prio = 1.f;
-	VkDeviceQueueCreateInfo qinfo = {};
-	qinfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	qinfo.queueFamilyIndex = dev->queue_family;
-	qinfo.queueCount = 1;
-	qinfo.pQueuePriorities = &prio;
+	VkDeviceQueueCreateInfo qinfos[2] = {0};
+	qinfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	qinfos[0].queueFamilyIndex = dev->queue_family;
+	qinfos[0].queueCount = 1;
+	qinfos[0].pQueuePriorities = &prio;
+	qinfos[1] = qinfos[0];
+	qinfos[1].queueFamilyIndex = dev->transfer_queue_family;
 
 	VkDeviceCreateInfo dev_info = {0};
 	dev_info.pNext = NULL;
 	dev_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	dev_info.queueCreateInfoCount = 1u;
-	dev_info.pQueueCreateInfos = &qinfo;
+	dev_info.queueCreateInfoCount = dev->has_transfer_queue ? 2u : 1u;
+	dev_info.pQueueCreateInfos = qinfos;
 	dev_info.enabledExtensionCount = dev->extension_count;
 	dev_info.ppEnabledExtensionNames = dev->extensions;
 
+	VkPhysicalDeviceSamplerYcbcrConversionFeatures ycbcr_enable = {0};
+	if (dev->sampler_ycbcr_conversion) {
+		ycbcr_enable.sType =
+			VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SAMPLER_YCBCR_CONVERSION_FEATURES;
+		ycbcr_enable.samplerYcbcrConversion = VK_TRUE;
+		dev_info.pNext = &ycbcr_enable;
+	}
+
 	res = vkCreateDevice(phdev, &dev_info, NULL, &dev->dev);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("Failed to create vulkan device", res);
@@ -510,6 +582,10 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 
 
 	vkGetDeviceQueue(dev->dev, dev->queue_family, 0, &dev->queue);
+	if (dev->has_transfer_queue) {
+		vkGetDeviceQueue(dev->dev, dev->transfer_queue_family, 0,
+			&dev->transfer_queue);
+	}
 
 	// load api
 	dev->api.getMemoryFdPropertiesKHR = (PFN_vkGetMemoryFdPropertiesKHR)
@@ -520,6 +596,23 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 		goto error;
 	}
 
+	if (dev->sync_file_export) {
+		dev->api.getSemaphoreFdKHR = (PFN_vkGetSemaphoreFdKHR)
+			vkGetDeviceProcAddr(dev->dev, "vkGetSemaphoreFdKHR");
+		if (!dev->api.getSemaphoreFdKHR) {
+			wlr_log(WLR_DEBUG, "Failed to retrieve vkGetSemaphoreFdKHR");
+			dev->sync_file_export = false;
+		}
+	}
+	if (dev->sync_file_import) {
+		dev->api.importSemaphoreFdKHR = (PFN_vkImportSemaphoreFdKHR)
+			vkGetDeviceProcAddr(dev->dev, "vkImportSemaphoreFdKHR");
+		if (!dev->api.importSemaphoreFdKHR) {
+			wlr_log(WLR_DEBUG, "Failed to retrieve vkImportSemaphoreFdKHR");
+			dev->sync_file_import = false;
+		}
+	}
+
 	// - check device format support -
 	size_t max_fmts;
 	const struct wlr_vk_format *fmts = vulkan_get_format_list(&max_fmts);
@@ -534,6 +627,17 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 		vulkan_format_props_query(dev, &fmts[i]);
 	}
 
+	// keep the table at most half full so that probe sequences stay short
+	assert(2 * dev->format_prop_count <= WLR_VK_FORMAT_TABLE_SIZE);
+	for (unsigned i = 0u; i < dev->format_prop_count; ++i) {
+		struct wlr_vk_format_props *props = &dev->format_props[i];
+		uint32_t slot = vulkan_format_table_hash(props->format.drm_format);
+		while (dev->format_props_table[slot] != NULL) {
+			slot = (slot + 1) & (WLR_VK_FORMAT_TABLE_SIZE - 1);
+		}
+		dev->format_props_table[slot] = props;
+	}
+
 	return dev;
 
 error:
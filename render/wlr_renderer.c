@@ -1,8 +1,11 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wlr/render/interface.h>
 #include <wlr/render/pixman.h>
@@ -29,6 +32,17 @@
 #include "util/signal.h"
 #include "render/pixel_format.h"
 #include "render/wlr_renderer.h"
+#include "types/wlr_shm.h"
+#include "util/trace.h"
+
+// Maximum number of released textures kept around per renderer
+#define TEXTURE_POOL_CAP 8
+
+struct wlr_pooled_texture {
+	struct wlr_texture *texture;
+	uint32_t format;
+	struct wl_list link; // wlr_renderer.texture_pool
+};
 
 void wlr_renderer_init(struct wlr_renderer *renderer,
 		const struct wlr_renderer_impl *impl) {
@@ -44,6 +58,56 @@ void wlr_renderer_init(struct wlr_renderer *renderer,
 	renderer->impl = impl;
 
 	wl_signal_init(&renderer->events.destroy);
+	wl_list_init(&renderer->texture_pool);
+	wl_list_init(&renderer->cursor_buffers);
+}
+
+static void pooled_texture_destroy(struct wlr_renderer *renderer,
+		struct wlr_pooled_texture *pooled) {
+	wl_list_remove(&pooled->link);
+	renderer->texture_pool_len--;
+	wlr_texture_destroy(pooled->texture);
+	free(pooled);
+}
+
+struct wlr_texture *renderer_texture_pool_acquire(struct wlr_renderer *renderer,
+		uint32_t format, uint32_t width, uint32_t height) {
+	struct wlr_pooled_texture *pooled;
+	wl_list_for_each(pooled, &renderer->texture_pool, link) {
+		struct wlr_texture *texture = pooled->texture;
+		if (pooled->format == format && texture->width == width &&
+				texture->height == height) {
+			wl_list_remove(&pooled->link);
+			renderer->texture_pool_len--;
+			free(pooled);
+			return texture;
+		}
+	}
+	return NULL;
+}
+
+void renderer_texture_pool_release(struct wlr_renderer *renderer,
+		struct wlr_texture *texture, uint32_t format) {
+	if (texture->impl->write_pixels == NULL) {
+		wlr_texture_destroy(texture);
+		return;
+	}
+
+	struct wlr_pooled_texture *pooled = calloc(1, sizeof(*pooled));
+	if (pooled == NULL) {
+		wlr_texture_destroy(texture);
+		return;
+	}
+	pooled->texture = texture;
+	pooled->format = format;
+
+	if (renderer->texture_pool_len == TEXTURE_POOL_CAP) {
+		struct wlr_pooled_texture *oldest =
+			wl_container_of(renderer->texture_pool.prev, oldest, link);
+		pooled_texture_destroy(renderer, oldest);
+	}
+	wl_list_insert(&renderer->texture_pool, &pooled->link);
+	renderer->texture_pool_len++;
 }
 
 void wlr_renderer_destroy(struct wlr_renderer *r) {
@@ -55,6 +119,19 @@ void wlr_renderer_destroy(struct wlr_renderer *r) {
 
 	wlr_signal_emit_safe(&r->events.destroy, r);
 
+	struct wlr_pooled_texture *pooled, *pooled_tmp;
+	wl_list_for_each_safe(pooled, pooled_tmp, &r->texture_pool, link) {
+		pooled_texture_destroy(r, pooled);
+	}
+
+	// Cursor buffers are owned by their output, which may outlive us
+	struct wl_list *link, *link_tmp;
+	for (link = r->cursor_buffers.next, link_tmp = link->next;
+			link != &r->cursor_buffers; link = link_tmp, link_tmp = link->next) {
+		wl_list_remove(link);
+		wl_list_init(link);
+	}
+
 	if (r->impl && r->impl->destroy) {
 		r->impl->destroy(r);
 	} else {
@@ -62,6 +139,22 @@ void wlr_renderer_destroy(struct wlr_renderer *r) {
 	}
 }
 
+void wlr_renderer_trim(struct wlr_renderer *r, enum wlr_trim_level level) {
+	assert(!r->rendering);
+
+	wlr_log(WLR_DEBUG, "Trimming renderer caches (%s)",
+		level == WLR_TRIM_CRITICAL ? "critical" : "moderate");
+
+	struct wlr_pooled_texture *pooled, *pooled_tmp;
+	wl_list_for_each_safe(pooled, pooled_tmp, &r->texture_pool, link) {
+		pooled_texture_destroy(r, pooled);
+	}
+
+	if (r->impl->trim) {
+		r->impl->trim(r, level);
+	}
+}
+
 bool renderer_bind_buffer(struct wlr_renderer *r, struct wlr_buffer *buffer) {
 	assert(!r->rendering);
 	if (!r->impl->bind_buffer) {
@@ -73,6 +166,7 @@ bool renderer_bind_buffer(struct wlr_renderer *r, struct wlr_buffer *buffer) {
 void wlr_renderer_begin(struct wlr_renderer *r, uint32_t width, uint32_t height) {
 	assert(!r->rendering);
 
+	trace_begin("render %ux%u", width, height);
 	r->impl->begin(r, width, height);
 
 	r->rendering = true;
@@ -96,11 +190,13 @@ void wlr_renderer_end(struct wlr_renderer *r) {
 	}
 
 	r->rendering = false;
+	r->timer = NULL;
 
 	if (r->rendering_with_buffer) {
 		renderer_bind_buffer(r, NULL);
 		r->rendering_with_buffer = false;
 	}
+	trace_end();
 }
 
 void wlr_renderer_clear(struct wlr_renderer *r, const float color[static 4]) {
@@ -168,11 +264,145 @@ void wlr_render_quad_with_matrix(struct wlr_renderer *r,
 	r->impl->render_quad_with_matrix(r, color, matrix);
 }
 
+bool render_op_get_bounds(const struct wlr_render_op *op,
+		pixman_box32_t *bounds) {
+	const float *mat;
+	switch (op->type) {
+	case WLR_RENDER_OP_CLEAR:
+	case WLR_RENDER_OP_FILL:
+		return false;
+	case WLR_RENDER_OP_TEXTURE:
+		mat = op->texture.matrix;
+		break;
+	case WLR_RENDER_OP_QUAD:
+		mat = op->quad.matrix;
+		break;
+	default:
+		abort();
+	}
+
+	// Corners of the unit square
+	float x1 = fminf(fminf(0, mat[0]), fminf(mat[1], mat[0] + mat[1]));
+	float x2 = fmaxf(fmaxf(0, mat[0]), fmaxf(mat[1], mat[0] + mat[1]));
+	float y1 = fminf(fminf(0, mat[3]), fminf(mat[4], mat[3] + mat[4]));
+	float y2 = fmaxf(fmaxf(0, mat[3]), fmaxf(mat[4], mat[3] + mat[4]));
+
+	// Leave room for filtering at the edges
+	bounds->x1 = floorf(x1 + mat[2]) - 1;
+	bounds->y1 = floorf(y1 + mat[5]) - 1;
+	bounds->x2 = ceilf(x2 + mat[2]) + 1;
+	bounds->y2 = ceilf(y2 + mat[5]) + 1;
+	return true;
+}
+
+static bool render_op_draw(struct wlr_renderer *r,
+		const struct wlr_render_op *op) {
+	switch (op->type) {
+	case WLR_RENDER_OP_CLEAR:
+		r->impl->clear(r, op->clear.color);
+		return true;
+	case WLR_RENDER_OP_TEXTURE:
+		return r->impl->render_subtexture_with_matrix(r, op->texture.texture,
+			&op->texture.src_box, op->texture.matrix, op->texture.alpha);
+	case WLR_RENDER_OP_QUAD:
+		r->impl->render_quad_with_matrix(r, op->quad.color, op->quad.matrix);
+		return true;
+	case WLR_RENDER_OP_FILL:
+		abort(); // handled by render_op_draw_clipped()
+	}
+	abort();
+}
+
+bool render_op_draw_clipped(struct wlr_renderer *r,
+		const struct wlr_render_op *op) {
+	assert(op->type != WLR_RENDER_OP_FILL || op->clip != NULL);
+	if (op->clip == NULL) {
+		r->impl->scissor(r, NULL);
+		return render_op_draw(r, op);
+	}
+
+	pixman_box32_t bounds;
+	bool bounded = render_op_get_bounds(op, &bounds);
+
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(
+		(pixman_region32_t *)op->clip, &rects_len);
+
+	// Fills are drawn as one quad per rectangle, which needs no scissor box
+	// and leaves the renderer free to batch all of them
+	if (op->type == WLR_RENDER_OP_FILL) {
+		r->impl->scissor(r, NULL);
+		for (int j = 0; j < rects_len; j++) {
+			const pixman_box32_t *rect = &rects[j];
+			float matrix[9] = {
+				rect->x2 - rect->x1, 0, rect->x1,
+				0, rect->y2 - rect->y1, rect->y1,
+				0, 0, 1,
+			};
+			r->impl->render_quad_with_matrix(r, op->fill.color, matrix);
+		}
+		return true;
+	}
+
+	bool ok = true;
+	for (int j = 0; j < rects_len; j++) {
+		const pixman_box32_t *rect = &rects[j];
+		if (bounded && (rect->x2 <= bounds.x1 || rect->x1 >= bounds.x2 ||
+				rect->y2 <= bounds.y1 || rect->y1 >= bounds.y2)) {
+			continue;
+		}
+
+		struct wlr_box box = {
+			.x = rect->x1,
+			.y = rect->y1,
+			.width = rect->x2 - rect->x1,
+			.height = rect->y2 - rect->y1,
+		};
+		r->impl->scissor(r, &box);
+		ok = render_op_draw(r, op) && ok;
+	}
+	return ok;
+}
+
+bool wlr_renderer_submit_ops(struct wlr_renderer *r,
+		const struct wlr_render_op *ops, size_t ops_len) {
+	assert(r->rendering);
+	if (r->impl->submit_ops != NULL) {
+		return r->impl->submit_ops(r, ops, ops_len);
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < ops_len; i++) {
+		ok = render_op_draw_clipped(r, &ops[i]) && ok;
+	}
+	r->impl->scissor(r, NULL);
+
+	return ok;
+}
+
 const uint32_t *wlr_renderer_get_shm_texture_formats(struct wlr_renderer *r,
 		size_t *len) {
 	return r->impl->get_shm_texture_formats(r, len);
 }
 
+const uint32_t *wlr_renderer_get_yuv_render_formats(struct wlr_renderer *r,
+		size_t *len) {
+	if (!r->impl->get_yuv_render_formats) {
+		*len = 0;
+		return NULL;
+	}
+	return r->impl->get_yuv_render_formats(r, len);
+}
+
+bool wlr_renderer_blit_to_yuv(struct wlr_renderer *r,
+		struct wlr_texture *src, struct wlr_buffer *dst) {
+	assert(!r->rendering);
+	if (!r->impl->blit_to_yuv) {
+		return false;
+	}
+	return r->impl->blit_to_yuv(r, src, dst);
+}
+
 const struct wlr_drm_format_set *wlr_renderer_get_dmabuf_texture_formats(
 		struct wlr_renderer *r) {
 	if (!r->impl->get_dmabuf_texture_formats) {
@@ -193,6 +423,51 @@ uint32_t renderer_get_render_buffer_caps(struct wlr_renderer *r) {
 	return r->impl->get_render_buffer_caps(r);
 }
 
+void wlr_render_timer_init(struct wlr_render_timer *timer,
+		const struct wlr_render_timer_impl *impl,
+		struct wlr_renderer *renderer) {
+	assert(impl->get_duration_ns);
+	assert(impl->destroy);
+
+	memset(timer, 0, sizeof(*timer));
+	timer->impl = impl;
+	timer->renderer = renderer;
+}
+
+struct wlr_render_timer *wlr_render_timer_create(struct wlr_renderer *r) {
+	if (!r->impl->render_timer_create) {
+		return NULL;
+	}
+	return r->impl->render_timer_create(r);
+}
+
+void wlr_renderer_set_timer(struct wlr_renderer *r,
+		struct wlr_render_timer *timer) {
+	assert(!r->rendering);
+	assert(timer == NULL || timer->renderer == r);
+	r->timer = timer;
+}
+
+int64_t wlr_render_timer_get_duration_ns(struct wlr_render_timer *timer) {
+	return timer->impl->get_duration_ns(timer);
+}
+
+void wlr_render_timer_destroy(struct wlr_render_timer *timer) {
+	if (timer == NULL) {
+		return;
+	}
+	assert(timer->renderer->timer != timer);
+	timer->impl->destroy(timer);
+}
+
+int renderer_export_sync_file(struct wlr_renderer *r) {
+	assert(!r->rendering);
+	if (!r->impl->export_sync_file) {
+		return -1;
+	}
+	return r->impl->export_sync_file(r);
+}
+
 bool wlr_renderer_read_pixels(struct wlr_renderer *r, uint32_t fmt,
 		uint32_t *flags, uint32_t stride, uint32_t width, uint32_t height,
 		uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y,
@@ -204,13 +479,169 @@ bool wlr_renderer_read_pixels(struct wlr_renderer *r, uint32_t fmt,
 		src_x, src_y, dst_x, dst_y, data);
 }
 
-bool wlr_renderer_init_wl_shm(struct wlr_renderer *r,
-		struct wl_display *wl_display) {
-	if (wl_display_init_shm(wl_display) != 0) {
-		wlr_log(WLR_ERROR, "Failed to initialize wl_shm");
-		return false;
+void wlr_render_readback_init(struct wlr_render_readback *readback,
+		const struct wlr_render_readback_impl *impl,
+		struct wlr_renderer *renderer) {
+	assert(impl->get_pixels);
+	assert(impl->destroy);
+
+	memset(readback, 0, sizeof(*readback));
+	readback->impl = impl;
+	readback->renderer = renderer;
+}
+
+// Used for renderers without asynchronous read-back: the pixels are read
+// right away into an intermediate copy
+struct sync_readback {
+	struct wlr_render_readback base;
+	uint32_t flags;
+	uint32_t width, height, stride;
+	uint32_t bytes_per_pixel;
+	unsigned char *pixels;
+};
+
+static struct sync_readback *sync_readback_from_readback(
+		struct wlr_render_readback *readback) {
+	struct sync_readback *sync = wl_container_of(readback, sync, base);
+	return sync;
+}
+
+static bool sync_readback_get_pixels(struct wlr_render_readback *readback,
+		uint32_t *flags, uint32_t stride, uint32_t dst_x, uint32_t dst_y,
+		void *data) {
+	struct sync_readback *sync = sync_readback_from_readback(readback);
+	unsigned char *dst = (unsigned char *)data + dst_y * stride +
+		dst_x * sync->bytes_per_pixel;
+	for (uint32_t i = 0; i < sync->height; ++i) {
+		memcpy(dst + i * stride, sync->pixels + i * sync->stride,
+			sync->stride);
+	}
+	if (flags != NULL) {
+		*flags = sync->flags;
+	}
+	return true;
+}
+
+static void sync_readback_destroy(struct wlr_render_readback *readback) {
+	struct sync_readback *sync = sync_readback_from_readback(readback);
+	free(sync->pixels);
+	free(sync);
+}
+
+static const struct wlr_render_readback_impl sync_readback_impl = {
+	.get_pixels = sync_readback_get_pixels,
+	.destroy = sync_readback_destroy,
+};
+
+static struct wlr_render_readback *sync_readback_create(
+		struct wlr_renderer *r, uint32_t fmt, uint32_t width,
+		uint32_t height, uint32_t src_x, uint32_t src_y) {
+	const struct wlr_pixel_format_info *info = drm_get_pixel_format_info(fmt);
+	if (info == NULL) {
+		wlr_log(WLR_ERROR, "Unsupported read-back format 0x%"PRIX32, fmt);
+		return NULL;
+	}
+
+	struct sync_readback *sync = calloc(1, sizeof(*sync));
+	if (sync == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_render_readback_init(&sync->base, &sync_readback_impl, r);
+	sync->width = width;
+	sync->height = height;
+	sync->bytes_per_pixel = info->bpp / 8;
+	sync->stride = width * sync->bytes_per_pixel;
+	sync->pixels = malloc((size_t)sync->stride * height);
+	if (sync->pixels == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(sync);
+		return NULL;
+	}
+
+	if (!wlr_renderer_read_pixels(r, fmt, &sync->flags, sync->stride,
+			width, height, src_x, src_y, 0, 0, sync->pixels)) {
+		sync_readback_destroy(&sync->base);
+		return NULL;
+	}
+	return &sync->base;
+}
+
+static void readback_finish(struct wlr_render_readback *readback) {
+	wl_event_source_remove(readback->event_source);
+	readback->event_source = NULL;
+	readback->done(readback, readback->data);
+}
+
+static int readback_handle_fd(int fd, uint32_t mask, void *data) {
+	readback_finish(data);
+	return 0;
+}
+
+static void readback_handle_idle(void *data) {
+	readback_finish(data);
+}
+
+struct wlr_render_readback *wlr_renderer_read_pixels_async(
+		struct wlr_renderer *r, struct wl_event_loop *loop, uint32_t fmt,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+		wlr_render_readback_func_t done, void *data) {
+	struct wlr_render_readback *readback = NULL;
+	if (r->impl->read_pixels_async) {
+		readback = r->impl->read_pixels_async(r, fmt, width, height,
+			src_x, src_y);
+	}
+	if (readback == NULL) {
+		readback = sync_readback_create(r, fmt, width, height, src_x, src_y);
+	}
+	if (readback == NULL) {
+		return NULL;
+	}
+	readback->done = done;
+	readback->data = data;
+
+	int fd = -1;
+	if (readback->impl->get_sync_file) {
+		fd = readback->impl->get_sync_file(readback);
+	}
+	if (fd >= 0) {
+		readback->event_source = wl_event_loop_add_fd(loop, fd,
+			WL_EVENT_READABLE, readback_handle_fd, readback);
+	} else {
+		// Without a fence, copying blocks until the GPU is done, but at least
+		// the compositor gets to finish the current frame first
+		readback->event_source =
+			wl_event_loop_add_idle(loop, readback_handle_idle, readback);
+	}
+	if (readback->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add read-back event source");
+		readback->impl->destroy(readback);
+		return NULL;
 	}
 
+	return readback;
+}
+
+bool wlr_render_readback_get_pixels(struct wlr_render_readback *readback,
+		uint32_t *flags, uint32_t stride, uint32_t dst_x, uint32_t dst_y,
+		void *data) {
+	assert(readback->event_source == NULL);
+	return readback->impl->get_pixels(readback, flags, stride, dst_x, dst_y,
+		data);
+}
+
+void wlr_render_readback_destroy(struct wlr_render_readback *readback) {
+	if (readback == NULL) {
+		return;
+	}
+	if (readback->event_source != NULL) {
+		wl_event_source_remove(readback->event_source);
+	}
+	readback->impl->destroy(readback);
+}
+
+bool wlr_renderer_init_wl_shm(struct wlr_renderer *r,
+		struct wl_display *wl_display) {
 	size_t len;
 	const uint32_t *formats = wlr_renderer_get_shm_texture_formats(r, &len);
 	if (formats == NULL) {
@@ -219,6 +650,22 @@ bool wlr_renderer_init_wl_shm(struct wlr_renderer *r,
 		return false;
 	}
 
+	const char *udmabuf = getenv("WLR_SHM_UDMABUF");
+	if (udmabuf && strcmp(udmabuf, "1") == 0) {
+		wlr_log(WLR_DEBUG, "WLR_SHM_UDMABUF set, "
+			"importing shm buffers via udmabuf");
+		if (shm_create(wl_display, formats, len) == NULL) {
+			wlr_log(WLR_ERROR, "Failed to initialize wl_shm");
+			return false;
+		}
+		return true;
+	}
+
+	if (wl_display_init_shm(wl_display) != 0) {
+		wlr_log(WLR_ERROR, "Failed to initialize wl_shm");
+		return false;
+	}
+
 	bool argb8888 = false, xrgb8888 = false;
 	for (size_t i = 0; i < len; ++i) {
 		// ARGB8888 and XRGB8888 must be supported and are implicitly
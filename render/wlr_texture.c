@@ -5,6 +5,7 @@
 #include <wlr/render/interface.h>
 #include <wlr/render/wlr_texture.h>
 #include "types/wlr_buffer.h"
+#include "util/trace.h"
 
 void wlr_texture_init(struct wlr_texture *texture,
 		const struct wlr_texture_impl *impl, uint32_t width, uint32_t height) {
@@ -68,7 +69,11 @@ struct wlr_texture *wlr_texture_from_buffer(struct wlr_renderer *renderer,
 	if (!renderer->impl->texture_from_buffer) {
 		return NULL;
 	}
-	return renderer->impl->texture_from_buffer(renderer, buffer);
+	trace_begin("wlr_texture_from_buffer %dx%d", buffer->width, buffer->height);
+	struct wlr_texture *texture =
+		renderer->impl->texture_from_buffer(renderer, buffer);
+	trace_end();
+	return texture;
 }
 
 bool wlr_texture_is_opaque(struct wlr_texture *texture) {
@@ -85,6 +90,31 @@ bool wlr_texture_write_pixels(struct wlr_texture *texture,
 	if (!texture->impl->write_pixels) {
 		return false;
 	}
-	return texture->impl->write_pixels(texture, stride, width, height,
+	trace_begin("wlr_texture_write_pixels %ux%u", width, height);
+	bool ok = texture->impl->write_pixels(texture, stride, width, height,
 		src_x, src_y, dst_x, dst_y, data);
+	trace_end();
+	return ok;
+}
+
+bool wlr_texture_write_pixels_rects(struct wlr_texture *texture,
+		uint32_t stride, const pixman_box32_t *rects, size_t rects_len,
+		const void *data) {
+	if (texture->impl->write_pixels_rects) {
+		trace_begin("wlr_texture_write_pixels_rects %zu", rects_len);
+		bool ok = texture->impl->write_pixels_rects(texture, stride,
+			rects, rects_len, data);
+		trace_end();
+		return ok;
+	}
+
+	for (size_t i = 0; i < rects_len; i++) {
+		const pixman_box32_t *r = &rects[i];
+		if (!wlr_texture_write_pixels(texture, stride,
+				r->x2 - r->x1, r->y2 - r->y1, r->x1, r->y1,
+				r->x1, r->y1, data)) {
+			return false;
+		}
+	}
+	return true;
 }
@@ -103,14 +103,34 @@ static void data_device_handle_resource_destroy(struct wl_resource *resource) {
 }
 
 
+static struct wlr_data_offer *find_selection_offer(struct wlr_seat *seat,
+		struct wl_resource *device_resource) {
+	struct wlr_data_offer *offer;
+	wl_list_for_each(offer, &seat->selection_offers, link) {
+		if (offer->device_resource == device_resource &&
+				offer->source == seat->selection_source &&
+				wl_resource_get_client(offer->resource) ==
+				wl_resource_get_client(device_resource)) {
+			return offer;
+		}
+	}
+	return NULL;
+}
+
 static void device_resource_send_selection(struct wl_resource *device_resource) {
 	struct wlr_seat_client *seat_client =
 		seat_client_from_data_device_resource(device_resource);
 	assert(seat_client != NULL);
 
 	struct wlr_data_source *source = seat_client->seat->selection_source;
-	if (source != NULL) {
-		struct wlr_data_offer *offer = data_offer_create(device_resource,
+	struct wlr_data_offer *offer =
+		find_selection_offer(seat_client->seat, device_resource);
+	if (offer != NULL) {
+		// The client already knows about this selection, e.g. because focus
+		// moved between two of its surfaces: don't re-send the MIME types
+		wl_data_device_send_selection(device_resource, offer->resource);
+	} else if (source != NULL) {
+		offer = data_offer_create(device_resource,
 			source, WLR_DATA_OFFER_SELECTION);
 		if (offer == NULL) {
 			wl_client_post_no_memory(seat_client->client);
@@ -129,11 +149,15 @@ void seat_client_send_selection(struct wlr_seat_client *seat_client) {
 		source->accepted = false;
 	}
 
-	// Make all current offers inert
+	// Make all current offers inert, except the ones of this client for the
+	// current selection
 	struct wlr_data_offer *offer, *tmp;
 	wl_list_for_each_safe(offer, tmp,
 			&seat_client->seat->selection_offers, link) {
-		data_offer_destroy(offer);
+		if (offer->source != source ||
+				wl_resource_get_client(offer->resource) != seat_client->client) {
+			data_offer_destroy(offer);
+		}
 	}
 
 	struct wl_resource *device_resource;
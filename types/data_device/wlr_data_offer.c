@@ -249,6 +249,7 @@ struct wlr_data_offer *data_offer_create(struct wl_resource *device_resource,
 	}
 	offer->source = source;
 	offer->type = type;
+	offer->device_resource = device_resource;
 
 	struct wl_client *client = wl_resource_get_client(device_resource);
 	uint32_t version = wl_resource_get_version(device_resource);
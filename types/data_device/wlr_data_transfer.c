@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_data_device.h>
+#include <wlr/util/log.h>
+
+#define TRANSFER_CHUNK_SIZE (64 * 1024)
+// Give other event sources a chance to run between chunks
+#define TRANSFER_MAX_CHUNKS_PER_DISPATCH 16
+
+static void transfer_finish(struct wlr_data_transfer *transfer,
+		bool success) {
+	const struct wlr_data_transfer_provider *provider = transfer->provider;
+	void *data = transfer->data;
+	wlr_data_transfer_destroy(transfer);
+	if (provider != NULL && provider->finish != NULL) {
+		provider->finish(data, success);
+	}
+}
+
+// Returns the number of bytes moved, 0 at the end of the data, -1 if fd isn't
+// writable or on error
+static ssize_t transfer_splice(struct wlr_data_transfer *transfer) {
+	size_t len = transfer->src_size - transfer->src_offset;
+	if (len > TRANSFER_CHUNK_SIZE) {
+		len = TRANSFER_CHUNK_SIZE;
+	}
+	if (len == 0) {
+		return 0;
+	}
+	return splice(transfer->src_fd, &transfer->src_offset, transfer->fd, NULL,
+		len, SPLICE_F_NONBLOCK);
+}
+
+// Refill the buffer, returns false on error
+static bool transfer_fill(struct wlr_data_transfer *transfer) {
+	// Allocated on first use, splice() doesn't need it
+	if (transfer->buf == NULL) {
+		transfer->buf = malloc(TRANSFER_CHUNK_SIZE);
+		if (transfer->buf == NULL) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+	}
+
+	ssize_t n;
+	if (transfer->src_fd >= 0) {
+		n = pread(transfer->src_fd, transfer->buf, TRANSFER_CHUNK_SIZE,
+			transfer->src_offset);
+		if (n > 0) {
+			transfer->src_offset += n;
+		}
+	} else {
+		n = transfer->provider->read(transfer->data, transfer->buf,
+			TRANSFER_CHUNK_SIZE);
+	}
+	if (n < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to read transfer data");
+		return false;
+	}
+
+	assert((size_t)n <= TRANSFER_CHUNK_SIZE);
+	transfer->buf_start = 0;
+	transfer->buf_end = n;
+	transfer->eof = n == 0;
+	return true;
+}
+
+static int transfer_handle_writable(int fd, uint32_t mask, void *data) {
+	struct wlr_data_transfer *transfer = data;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		wlr_log(WLR_DEBUG, "Data transfer target closed");
+		transfer_finish(transfer, false);
+		return 0;
+	}
+
+	for (int i = 0; i < TRANSFER_MAX_CHUNKS_PER_DISPATCH; i++) {
+		if (transfer->splice) {
+			ssize_t n = transfer_splice(transfer);
+			if (n > 0) {
+				transfer->transferred += n;
+				continue;
+			} else if (n == 0) {
+				transfer_finish(transfer, true);
+				return 0;
+			} else if (errno == EAGAIN) {
+				return 0;
+			} else if (errno != EINVAL && errno != ENOSYS) {
+				wlr_log_errno(WLR_ERROR, "Data transfer splice failed");
+				transfer_finish(transfer, false);
+				return 0;
+			}
+			// Not a pipe, copy through userspace instead
+			transfer->splice = false;
+		}
+
+		if (transfer->buf_start == transfer->buf_end) {
+			if (transfer->eof) {
+				transfer_finish(transfer, true);
+				return 0;
+			}
+			if (!transfer_fill(transfer)) {
+				transfer_finish(transfer, false);
+				return 0;
+			}
+			continue;
+		}
+
+		ssize_t n = write(transfer->fd, transfer->buf + transfer->buf_start,
+			transfer->buf_end - transfer->buf_start);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				return 0;
+			}
+			wlr_log_errno(WLR_ERROR, "Data transfer write failed");
+			transfer_finish(transfer, false);
+			return 0;
+		}
+		transfer->buf_start += n;
+		transfer->transferred += n;
+	}
+
+	return 0;
+}
+
+static void transfer_handle_event_loop_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_data_transfer *transfer =
+		wl_container_of(listener, transfer, event_loop_destroy);
+	transfer_finish(transfer, false);
+}
+
+static struct wlr_data_transfer *transfer_create(struct wl_event_loop *loop,
+		int fd, const struct wlr_data_transfer_provider *provider, void *data) {
+	struct wlr_data_transfer *transfer = calloc(1, sizeof(*transfer));
+	if (transfer == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		close(fd);
+		return NULL;
+	}
+	transfer->fd = fd;
+	transfer->src_fd = -1;
+	transfer->provider = provider;
+	transfer->data = data;
+	wl_list_init(&transfer->event_loop_destroy.link);
+
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to make data transfer fd non-blocking");
+		goto error;
+	}
+
+	transfer->event_source = wl_event_loop_add_fd(loop, fd, WL_EVENT_WRITABLE,
+		transfer_handle_writable, transfer);
+	if (transfer->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add data transfer event source");
+		goto error;
+	}
+
+	transfer->event_loop_destroy.notify = transfer_handle_event_loop_destroy;
+	wl_event_loop_add_destroy_listener(loop, &transfer->event_loop_destroy);
+
+	return transfer;
+
+error:
+	wlr_data_transfer_destroy(transfer);
+	return NULL;
+}
+
+struct wlr_data_transfer *wlr_data_transfer_create(
+		struct wl_event_loop *loop, int fd,
+		const struct wlr_data_transfer_provider *provider, void *data) {
+	assert(provider->read != NULL);
+	return transfer_create(loop, fd, provider, data);
+}
+
+struct wlr_data_transfer *wlr_data_transfer_create_from_fd(
+		struct wl_event_loop *loop, int fd, int src_fd,
+		const struct wlr_data_transfer_provider *provider, void *data) {
+	struct stat st;
+	if (fstat(src_fd, &st) != 0) {
+		wlr_log_errno(WLR_ERROR, "fstat failed");
+		close(fd);
+		return NULL;
+	}
+
+	int dup_fd = fcntl(src_fd, F_DUPFD_CLOEXEC, 0);
+	if (dup_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "fcntl(F_DUPFD_CLOEXEC) failed");
+		close(fd);
+		return NULL;
+	}
+
+	struct wlr_data_transfer *transfer =
+		transfer_create(loop, fd, provider, data);
+	if (transfer == NULL) {
+		close(dup_fd);
+		return NULL;
+	}
+	transfer->src_fd = dup_fd;
+	transfer->src_size = st.st_size;
+	transfer->splice = true;
+	return transfer;
+}
+
+void wlr_data_transfer_destroy(struct wlr_data_transfer *transfer) {
+	if (transfer == NULL) {
+		return;
+	}
+	if (transfer->event_source != NULL) {
+		wl_event_source_remove(transfer->event_source);
+	}
+	wl_list_remove(&transfer->event_loop_destroy.link);
+	close(transfer->fd);
+	if (transfer->src_fd >= 0) {
+		close(transfer->src_fd);
+	}
+	free(transfer->buf);
+	free(transfer);
+}
@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/util/log.h>
+#include "types/wlr_output.h"
+#include "util/signal.h"
+
+struct wlr_output_capture *wlr_output_capture_create(struct wlr_output *output,
+		struct wlr_buffer *buffer) {
+	struct wlr_output_capture *capture = calloc(1, sizeof(*capture));
+	if (capture == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	capture->output = output;
+	capture->buffer = wlr_buffer_lock(buffer);
+	wl_signal_init(&capture->events.done);
+	wl_signal_init(&capture->events.destroy);
+	wl_list_insert(output->captures.prev, &capture->link);
+
+	return capture;
+}
+
+void wlr_output_capture_destroy(struct wlr_output_capture *capture) {
+	if (capture == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&capture->events.destroy, capture);
+
+	wl_list_remove(&capture->link);
+	wlr_buffer_unlock(capture->buffer);
+	free(capture);
+}
+
+static void capture_finish(struct wlr_output_capture *capture, bool success) {
+	struct wlr_output_event_capture event = {
+		.capture = capture,
+		.success = success,
+	};
+	wlr_signal_emit_safe(&capture->events.done, &event);
+	wlr_output_capture_destroy(capture);
+}
+
+static bool capture_buffer_fits(struct wlr_output *output,
+		const struct wlr_output_state *state, struct wlr_buffer *buffer) {
+	int width, height;
+	output_pending_resolution(output, state, &width, &height);
+	return buffer->width == width && buffer->height == height;
+}
+
+/**
+ * Test a state with a capture buffer attached. The result is re-used for
+ * buffers with the same format, so that a client capturing every frame
+ * doesn't cost a test commit per frame.
+ */
+static bool capture_test(struct wlr_output *output,
+		const struct wlr_output_state *state, struct wlr_buffer *buffer) {
+	if (!capture_buffer_fits(output, state, buffer)) {
+		return false;
+	}
+
+	// Modesets may accept captures which regular frames can't
+	struct wlr_dmabuf_attributes dmabuf;
+	bool cacheable = wlr_buffer_get_dmabuf(buffer, &dmabuf) &&
+		!(state->committed & (WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED));
+	if (cacheable && output->capture_tested &&
+			output->capture_tested_format == dmabuf.format &&
+			output->capture_tested_modifier == dmabuf.modifier) {
+		return output->capture_accepted;
+	}
+
+	bool accepted = output->impl->test(output, state);
+	if (cacheable) {
+		output->capture_tested = true;
+		output->capture_accepted = accepted;
+		output->capture_tested_format = dmabuf.format;
+		output->capture_tested_modifier = dmabuf.modifier;
+	}
+	return accepted;
+}
+
+bool wlr_output_test_capture(struct wlr_output *output,
+		struct wlr_buffer *buffer) {
+	if (!output->enabled || output->impl->test == NULL) {
+		return false;
+	}
+
+	struct wlr_output_state state = {0};
+	wlr_output_state_set_capture_buffer(&state, buffer);
+	return capture_test(output, &state, buffer);
+}
+
+struct wlr_buffer *output_state_add_capture(struct wlr_output *output,
+		struct wlr_output_state *state) {
+	if (!(state->committed & WLR_OUTPUT_STATE_BUFFER) ||
+			(state->committed & WLR_OUTPUT_STATE_CAPTURE) ||
+			output->impl->test == NULL) {
+		return NULL;
+	}
+
+	// Backends can capture a single buffer per commit
+	struct wlr_output_capture *capture, *tmp;
+	wl_list_for_each_safe(capture, tmp, &output->captures, link) {
+		if (capture->submitted) {
+			continue;
+		}
+
+		wlr_output_state_set_capture_buffer(state, capture->buffer);
+		if (capture_test(output, state, capture->buffer)) {
+			return wlr_buffer_lock(capture->buffer);
+		}
+
+		state->committed &= ~WLR_OUTPUT_STATE_CAPTURE;
+		state->capture_buffer = NULL;
+		wlr_log(WLR_DEBUG, "Backend rejected capture on output '%s'",
+			output->name);
+		capture_finish(capture, false);
+	}
+
+	return NULL;
+}
+
+void output_captures_handle_commit(struct wlr_output *output,
+		const struct wlr_output_state *state, const struct timespec *when) {
+	if (state->committed & (WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED |
+			WLR_OUTPUT_STATE_TRANSFORM | WLR_OUTPUT_STATE_RENDER_FORMAT |
+			WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED)) {
+		output->capture_tested = false;
+	}
+
+	if (!(state->committed & WLR_OUTPUT_STATE_CAPTURE)) {
+		return;
+	}
+
+	struct wlr_output_capture *capture;
+	wl_list_for_each(capture, &output->captures, link) {
+		if (!capture->submitted && capture->buffer == state->capture_buffer) {
+			capture->submitted = true;
+			capture->commit_time = *when;
+			break;
+		}
+	}
+}
+
+void output_captures_handle_commit_failure(struct wlr_output *output,
+		const struct wlr_output_state *state) {
+	// The cached test result may be wrong, test the next capture again
+	if (state->committed & WLR_OUTPUT_STATE_CAPTURE) {
+		output->capture_tested = false;
+	}
+}
+
+void output_captures_finish(struct wlr_output *output) {
+	struct wlr_output_capture *capture, *tmp;
+	wl_list_for_each_safe(capture, tmp, &output->captures, link) {
+		wlr_output_capture_destroy(capture);
+	}
+}
+
+void wlr_output_send_capture_done(struct wlr_output *output,
+		struct wlr_buffer *buffer, bool success) {
+	struct wlr_output_capture *capture;
+	wl_list_for_each(capture, &output->captures, link) {
+		if (capture->submitted && capture->buffer == buffer) {
+			capture_finish(capture, success);
+			return;
+		}
+	}
+}
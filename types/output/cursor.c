@@ -1,17 +1,38 @@
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <math.h>
 #include <stdlib.h>
 #include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/dmabuf.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/util/log.h>
 #include "render/allocator/allocator.h"
-#include "render/swapchain.h"
+#include "render/buffer_pool.h"
+#include "render/drm_format_set.h"
+#include "render/pixel_format.h"
 #include "types/wlr_buffer.h"
 #include "types/wlr_output.h"
 #include "util/signal.h"
 
+// Number of released cursor buffers kept for re-use
+#define CURSOR_BUFFER_POOL_CAP 4
+// Number of rendered cursor images kept by default, see
+// output_cursor_buffer_cache_reserve() for animated cursors
+#define CURSOR_BUFFER_CACHE_CAP 8
+
+struct output_cursor_cache_entry {
+	struct wlr_output *output;
+	struct wl_list link; // wlr_output.cursor_buffer_cache
+	struct wl_list renderer_link; // wlr_renderer.cursor_buffers
+	struct wlr_buffer *buffer; // locked
+
+	uint64_t image_hash;
+	float scale;
+	enum wl_output_transform transform;
+};
+
 static bool output_set_hardware_cursor(struct wlr_output *output,
 		struct wlr_buffer *buffer, int hotspot_x, int hotspot_y) {
 	if (!output->impl->set_cursor) {
@@ -77,44 +98,108 @@ static void output_scissor(struct wlr_output *output, pixman_box32_t *rect) {
 	wlr_renderer_scissor(renderer, &box);
 }
 
+static struct wlr_texture *output_cursor_get_texture(
+		struct wlr_output_cursor *cursor) {
+	if (cursor->surface != NULL) {
+		return wlr_surface_get_texture(cursor->surface);
+	}
+	return cursor->texture;
+}
+
+static struct wlr_texture *output_cursor_get_drag_icon_texture(
+		struct wlr_output_cursor *cursor) {
+	if (cursor->drag_icon == NULL) {
+		return NULL;
+	}
+	return wlr_surface_get_texture(cursor->drag_icon);
+}
+
 /**
- * Returns the cursor box, scaled for its output.
+ * Returns the boxes of the cursor image and of the drag icon, relative to
+ * the cursor position and scaled for its output. The drag icon box is empty
+ * if there is none.
+ */
+static void output_cursor_get_image_boxes(struct wlr_output_cursor *cursor,
+		struct wlr_box *image_box, struct wlr_box *icon_box) {
+	*image_box = (struct wlr_box){
+		.x = -cursor->hotspot_x,
+		.y = -cursor->hotspot_y,
+		.width = cursor->width,
+		.height = cursor->height,
+	};
+
+	*icon_box = (struct wlr_box){0};
+	struct wlr_surface *icon = cursor->drag_icon;
+	if (icon != NULL && wlr_surface_has_buffer(icon)) {
+		float scale = cursor->output->scale;
+		*icon_box = (struct wlr_box){
+			.x = icon->sx * scale,
+			.y = icon->sy * scale,
+			.width = icon->current.width * scale,
+			.height = icon->current.height * scale,
+		};
+	}
+}
+
+/**
+ * Returns the box containing the cursor image and the drag icon, relative to
+ * the cursor position and scaled for its output.
+ */
+static void output_cursor_get_bounds(struct wlr_output_cursor *cursor,
+		struct wlr_box *box) {
+	struct wlr_box image_box, icon_box;
+	output_cursor_get_image_boxes(cursor, &image_box, &icon_box);
+	if (wlr_box_empty(&icon_box)) {
+		*box = image_box;
+	} else if (wlr_box_empty(&image_box)) {
+		*box = icon_box;
+	} else {
+		int x1 = image_box.x < icon_box.x ? image_box.x : icon_box.x;
+		int y1 = image_box.y < icon_box.y ? image_box.y : icon_box.y;
+		int x2 = image_box.x + image_box.width;
+		int y2 = image_box.y + image_box.height;
+		if (icon_box.x + icon_box.width > x2) {
+			x2 = icon_box.x + icon_box.width;
+		}
+		if (icon_box.y + icon_box.height > y2) {
+			y2 = icon_box.y + icon_box.height;
+		}
+		*box = (struct wlr_box){
+			.x = x1,
+			.y = y1,
+			.width = x2 - x1,
+			.height = y2 - y1,
+		};
+	}
+}
+
+/**
+ * Returns the cursor box, including the drag icon, scaled for its output.
  */
 static void output_cursor_get_box(struct wlr_output_cursor *cursor,
 		struct wlr_box *box) {
-	box->x = cursor->x - cursor->hotspot_x;
-	box->y = cursor->y - cursor->hotspot_y;
-	box->width = cursor->width;
-	box->height = cursor->height;
+	output_cursor_get_bounds(cursor, box);
+	box->x += cursor->x;
+	box->y += cursor->y;
 }
 
-static void output_cursor_render(struct wlr_output_cursor *cursor,
+static void output_cursor_render_texture(struct wlr_output_cursor *cursor,
+		struct wlr_texture *texture, const struct wlr_box *box,
 		pixman_region32_t *damage) {
 	struct wlr_renderer *renderer = cursor->output->renderer;
 	assert(renderer);
 
-	struct wlr_texture *texture = cursor->texture;
-	if (cursor->surface != NULL) {
-		texture = wlr_surface_get_texture(cursor->surface);
-	}
-	if (texture == NULL) {
-		return;
-	}
-
-	struct wlr_box box;
-	output_cursor_get_box(cursor, &box);
-
 	pixman_region32_t surface_damage;
 	pixman_region32_init(&surface_damage);
-	pixman_region32_union_rect(&surface_damage, &surface_damage, box.x, box.y,
-		box.width, box.height);
+	pixman_region32_union_rect(&surface_damage, &surface_damage, box->x, box->y,
+		box->width, box->height);
 	pixman_region32_intersect(&surface_damage, &surface_damage, damage);
 	if (!pixman_region32_not_empty(&surface_damage)) {
 		goto surface_damage_finish;
 	}
 
 	float matrix[9];
-	wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
+	wlr_matrix_project_box(matrix, box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
 		cursor->output->transform_matrix);
 
 	int nrects;
@@ -129,6 +214,34 @@ surface_damage_finish:
 	pixman_region32_fini(&surface_damage);
 }
 
+static void output_cursor_render(struct wlr_output_cursor *cursor,
+		pixman_region32_t *damage) {
+	struct wlr_box image_box, icon_box;
+	output_cursor_get_image_boxes(cursor, &image_box, &icon_box);
+
+	struct wlr_texture *texture = output_cursor_get_texture(cursor);
+	if (cursor->enabled && texture != NULL) {
+		struct wlr_box box = image_box;
+		box.x += cursor->x;
+		box.y += cursor->y;
+		output_cursor_render_texture(cursor, texture, &box, damage);
+	}
+
+	texture = output_cursor_get_drag_icon_texture(cursor);
+	if (texture != NULL && !wlr_box_empty(&icon_box)) {
+		struct wlr_box box = icon_box;
+		box.x += cursor->x;
+		box.y += cursor->y;
+		output_cursor_render_texture(cursor, texture, &box, damage);
+	}
+}
+
+// Whether the cursor image or the drag icon needs to be displayed
+static bool output_cursor_has_content(struct wlr_output_cursor *cursor) {
+	return cursor->enabled ||
+		(cursor->drag_icon != NULL && wlr_surface_has_buffer(cursor->drag_icon));
+}
+
 void wlr_output_render_software_cursors(struct wlr_output *output,
 		pixman_region32_t *damage) {
 	int width, height;
@@ -146,7 +259,7 @@ void wlr_output_render_software_cursors(struct wlr_output *output,
 	if (pixman_region32_not_empty(&render_damage)) {
 		struct wlr_output_cursor *cursor;
 		wl_list_for_each(cursor, &output->cursors, link) {
-			if (!cursor->enabled || !cursor->visible ||
+			if (!output_cursor_has_content(cursor) || !cursor->visible ||
 					output->hardware_cursor == cursor) {
 				continue;
 			}
@@ -200,12 +313,16 @@ static void output_cursor_update_visible(struct wlr_output_cursor *cursor) {
 	bool visible =
 		wlr_box_intersection(&intersection, &output_box, &cursor_box);
 
-	if (cursor->surface != NULL) {
+	struct wlr_surface *surfaces[] = { cursor->surface, cursor->drag_icon };
+	for (size_t i = 0; i < sizeof(surfaces) / sizeof(surfaces[0]); i++) {
+		if (surfaces[i] == NULL) {
+			continue;
+		}
 		if (cursor->visible && !visible) {
-			wlr_surface_send_leave(cursor->surface, cursor->output);
+			wlr_surface_send_leave(surfaces[i], cursor->output);
 		}
 		if (!cursor->visible && visible) {
-			wlr_surface_send_enter(cursor->surface, cursor->output);
+			wlr_surface_send_enter(surfaces[i], cursor->output);
 		}
 	}
 
@@ -229,18 +346,173 @@ static struct wlr_drm_format *output_pick_cursor_format(struct wlr_output *outpu
 	return output_pick_format(output, display_formats, DRM_FORMAT_ARGB8888);
 }
 
+static void cursor_cache_entry_destroy(struct output_cursor_cache_entry *entry) {
+	wl_list_remove(&entry->link);
+	wl_list_remove(&entry->renderer_link);
+	wlr_buffer_unlock(entry->buffer);
+	free(entry);
+}
+
+void output_cursor_buffer_cache_finish(struct wlr_output *output) {
+	struct output_cursor_cache_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &output->cursor_buffer_cache, link) {
+		cursor_cache_entry_destroy(entry);
+	}
+}
+
+static size_t cursor_cache_cap(struct wlr_output *output) {
+	return output->cursor_buffer_cache_cap > CURSOR_BUFFER_CACHE_CAP ?
+		output->cursor_buffer_cache_cap : CURSOR_BUFFER_CACHE_CAP;
+}
+
+static void cursor_cache_trim(struct wlr_output *output) {
+	size_t len = wl_list_length(&output->cursor_buffer_cache);
+	for (size_t cap = cursor_cache_cap(output); len > cap; len--) {
+		struct output_cursor_cache_entry *last =
+			wl_container_of(output->cursor_buffer_cache.prev, last, link);
+		cursor_cache_entry_destroy(last);
+	}
+}
+
+void output_cursor_buffer_cache_reserve(struct wlr_output *output,
+		size_t cap) {
+	output->cursor_buffer_cache_cap = cap;
+	cursor_cache_trim(output);
+}
+
+static bool buffer_has_format(struct wlr_buffer *buffer,
+		const struct wlr_drm_format *format) {
+	struct wlr_dmabuf_attributes dmabuf;
+	struct wlr_shm_attributes shm;
+	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		return dmabuf.format == format->format &&
+			(format->len == 0 || wlr_drm_format_has(format, dmabuf.modifier));
+	} else if (wlr_buffer_get_shm(buffer, &shm)) {
+		return shm.format == format->format;
+	}
+	return false;
+}
+
+static bool cursor_cache_entry_matches(struct output_cursor_cache_entry *entry,
+		struct wlr_output_cursor *cursor, int width, int height) {
+	struct wlr_output *output = cursor->output;
+	return entry->image_hash == cursor->image_hash &&
+		entry->scale == output->scale &&
+		entry->transform == output->transform &&
+		entry->buffer->width == width &&
+		entry->buffer->height == height;
+}
+
+static void cursor_cache_add(struct wlr_output_cursor *cursor,
+		struct wlr_buffer *buffer) {
+	struct wlr_output *output = cursor->output;
+
+	struct output_cursor_cache_entry *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		return;
+	}
+	entry->output = output;
+	entry->buffer = wlr_buffer_lock(buffer);
+	entry->image_hash = cursor->image_hash;
+	entry->scale = output->scale;
+	entry->transform = output->transform;
+	wl_list_insert(&output->cursor_buffer_cache, &entry->link);
+	wl_list_insert(&output->renderer->cursor_buffers, &entry->renderer_link);
+
+	cursor_cache_trim(output);
+}
+
+static struct wlr_buffer *cursor_cache_get(struct wlr_output_cursor *cursor,
+		int width, int height) {
+	struct wlr_output *output = cursor->output;
+	struct output_cursor_cache_entry *entry;
+	wl_list_for_each(entry, &output->cursor_buffer_cache, link) {
+		if (cursor_cache_entry_matches(entry, cursor, width, height)) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&output->cursor_buffer_cache, &entry->link);
+			return wlr_buffer_lock(entry->buffer);
+		}
+	}
+
+	// Outputs with the same scale and transform need the same image, re-use
+	// a buffer rendered for another one if this output's backend can display
+	// it. It's imported on this output's device rather than re-rendered.
+	struct wlr_drm_format *format = NULL;
+	wl_list_for_each(entry, &output->renderer->cursor_buffers, renderer_link) {
+		if (entry->output == output ||
+				entry->output->allocator != output->allocator ||
+				!cursor_cache_entry_matches(entry, cursor, width, height)) {
+			continue;
+		}
+		if (format == NULL) {
+			format = output_pick_cursor_format(output);
+			if (format == NULL) {
+				return NULL;
+			}
+		}
+		if (buffer_has_format(entry->buffer, format)) {
+			struct wlr_buffer *buffer = wlr_buffer_lock(entry->buffer);
+			free(format);
+			cursor_cache_add(cursor, buffer);
+			return buffer;
+		}
+	}
+	free(format);
+	return NULL;
+}
+
+/**
+ * Compute a hash of the buffer contents, so that images set again later can
+ * be recognized even if they come in a different buffer.
+ */
+static bool hash_buffer_contents(struct wlr_buffer *buffer, uint64_t *hash) {
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+		return false;
+	}
+
+	const struct wlr_pixel_format_info *info = drm_get_pixel_format_info(format);
+	if (info == NULL) {
+		wlr_buffer_end_data_ptr_access(buffer);
+		return false;
+	}
+
+	// FNV-1a
+	uint64_t h = 0xcbf29ce484222325;
+	uint32_t params[] = { format, buffer->width, buffer->height };
+	const uint8_t *bytes = (const uint8_t *)params;
+	for (size_t i = 0; i < sizeof(params); i++) {
+		h = (h ^ bytes[i]) * 0x100000001b3;
+	}
+	size_t row_len = (size_t)buffer->width * info->bpp / 8;
+	for (int y = 0; y < buffer->height; y++) {
+		const uint8_t *row = (const uint8_t *)data + y * stride;
+		for (size_t i = 0; i < row_len; i++) {
+			h = (h ^ row[i]) * 0x100000001b3;
+		}
+	}
+
+	wlr_buffer_end_data_ptr_access(buffer);
+	*hash = h;
+	return true;
+}
+
 static struct wlr_buffer *render_cursor_buffer(struct wlr_output_cursor *cursor) {
 	struct wlr_output *output = cursor->output;
 
 	float scale = output->scale;
 	enum wl_output_transform transform = WL_OUTPUT_TRANSFORM_NORMAL;
-	struct wlr_texture *texture = cursor->texture;
+	struct wlr_texture *texture = output_cursor_get_texture(cursor);
 	if (cursor->surface != NULL) {
-		texture = wlr_surface_get_texture(cursor->surface);
 		scale = cursor->surface->current.scale;
 		transform = cursor->surface->current.transform;
 	}
-	if (texture == NULL) {
+	struct wlr_texture *icon_texture =
+		output_cursor_get_drag_icon_texture(cursor);
+	if (texture == NULL && icon_texture == NULL) {
 		return NULL;
 	}
 
@@ -248,49 +520,73 @@ static struct wlr_buffer *render_cursor_buffer(struct wlr_output_cursor *cursor)
 	struct wlr_renderer *renderer = output->renderer;
 	assert(allocator != NULL && renderer != NULL);
 
-	int width = texture->width;
-	int height = texture->height;
+	// The cursor image and the drag icon are drawn within these bounds
+	struct wlr_box bounds, image_box, icon_box;
+	output_cursor_get_bounds(cursor, &bounds);
+	output_cursor_get_image_boxes(cursor, &image_box, &icon_box);
+
+	int width = 0, height = 0;
+	if (texture != NULL) {
+		width = texture->width;
+		height = texture->height;
+		// Ask for the size needed to draw the image on HiDPI outputs
+		int image_width = ceil(texture->width * output->scale / scale);
+		int image_height = ceil(texture->height * output->scale / scale);
+		width = image_width > width ? image_width : width;
+		height = image_height > height ? image_height : height;
+	}
+	if (icon_texture != NULL) {
+		width = bounds.width > width ? bounds.width : width;
+		height = bounds.height > height ? bounds.height : height;
+	}
 	if (output->impl->get_cursor_size) {
 		// Apply hardware limitations on buffer size
+		int needed_width = width, needed_height = height;
 		output->impl->get_cursor_size(cursor->output, &width, &height);
-		if ((int)texture->width > width || (int)texture->height > height) {
-			wlr_log(WLR_DEBUG, "Cursor texture too large (%dx%d), "
-				"exceeds hardware limitations (%dx%d)", texture->width,
-				texture->height, width, height);
+		if ((texture != NULL && ((int)texture->width > width ||
+				(int)texture->height > height)) ||
+				(icon_texture != NULL && (needed_width > width ||
+				needed_height > height))) {
+			wlr_log(WLR_DEBUG, "Cursor image too large (%dx%d), "
+				"exceeds hardware limitations (%dx%d)", needed_width,
+				needed_height, width, height);
 			return NULL;
 		}
 	}
 
-	if (output->cursor_swapchain == NULL ||
-			output->cursor_swapchain->width != width ||
-			output->cursor_swapchain->height != height) {
-		struct wlr_drm_format *format =
-			output_pick_cursor_format(output);
-		if (format == NULL) {
-			wlr_log(WLR_ERROR, "Failed to pick cursor format");
-			return NULL;
+	// Switching back to a recently used image doesn't need re-rendering
+	bool use_cache = cursor->surface == NULL && cursor->has_image_hash &&
+		icon_texture == NULL;
+	if (use_cache) {
+		struct wlr_buffer *buffer = cursor_cache_get(cursor, width, height);
+		if (buffer != NULL) {
+			return buffer;
 		}
+	}
 
-		wlr_swapchain_destroy(output->cursor_swapchain);
-		output->cursor_swapchain = wlr_swapchain_create(allocator,
-			width, height, format);
-		free(format);
-		if (output->cursor_swapchain == NULL) {
-			wlr_log(WLR_ERROR, "Failed to create cursor swapchain");
+	if (output->cursor_buffer_pool == NULL) {
+		output->cursor_buffer_pool = wlr_buffer_pool_create(allocator,
+			CURSOR_BUFFER_POOL_CAP);
+		if (output->cursor_buffer_pool == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create cursor buffer pool");
 			return NULL;
 		}
 	}
 
-	struct wlr_buffer *buffer =
-		wlr_swapchain_acquire(output->cursor_swapchain, NULL);
-	if (buffer == NULL) {
+	struct wlr_drm_format *format = output_pick_cursor_format(output);
+	if (format == NULL) {
+		wlr_log(WLR_ERROR, "Failed to pick cursor format");
 		return NULL;
 	}
 
-	struct wlr_box cursor_box = {
-		.width = texture->width * output->scale / scale,
-		.height = texture->height * output->scale / scale,
-	};
+	// Cursor images of different sizes come and go, keep their buffers
+	// around rather than re-allocating every time the size changes
+	struct wlr_buffer *buffer = wlr_buffer_pool_acquire(
+		output->cursor_buffer_pool, width, height, format);
+	free(format);
+	if (buffer == NULL) {
+		return NULL;
+	}
 
 	float output_matrix[9];
 	wlr_matrix_identity(output_matrix);
@@ -308,19 +604,39 @@ static struct wlr_buffer *render_cursor_buffer(struct wlr_output_cursor *cursor)
 			- tr_size.height / 2.0);
 	}
 
-	float matrix[9];
-	wlr_matrix_project_box(matrix, &cursor_box, transform, 0, output_matrix);
-
 	if (!wlr_renderer_begin_with_buffer(renderer, buffer)) {
 		wlr_buffer_unlock(buffer);
 		return NULL;
 	}
 
 	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
-	wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0);
+
+	float matrix[9];
+	if (texture != NULL) {
+		struct wlr_box cursor_box = {
+			.x = image_box.x - bounds.x,
+			.y = image_box.y - bounds.y,
+			.width = texture->width * output->scale / scale,
+			.height = texture->height * output->scale / scale,
+		};
+		wlr_matrix_project_box(matrix, &cursor_box, transform, 0,
+			output_matrix);
+		wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0);
+	}
+	if (icon_texture != NULL) {
+		icon_box.x -= bounds.x;
+		icon_box.y -= bounds.y;
+		wlr_matrix_project_box(matrix, &icon_box,
+			cursor->drag_icon->current.transform, 0, output_matrix);
+		wlr_render_texture_with_matrix(renderer, icon_texture, matrix, 1.0);
+	}
 
 	wlr_renderer_end(renderer);
 
+	if (use_cache) {
+		cursor_cache_add(cursor, buffer);
+	}
+
 	return buffer;
 }
 
@@ -337,11 +653,10 @@ static bool output_cursor_attempt_hardware(struct wlr_output_cursor *cursor) {
 		return false;
 	}
 
-	struct wlr_texture *texture = cursor->texture;
-	if (cursor->surface != NULL) {
-		// TODO: try using the surface buffer directly
-		texture = wlr_surface_get_texture(cursor->surface);
-	}
+	// TODO: try using the surface buffer directly
+	struct wlr_texture *texture = output_cursor_get_texture(cursor);
+	struct wlr_texture *icon_texture =
+		output_cursor_get_drag_icon_texture(cursor);
 
 	// If the cursor was hidden or was a software cursor, the hardware
 	// cursor position is outdated
@@ -349,7 +664,7 @@ static bool output_cursor_attempt_hardware(struct wlr_output_cursor *cursor) {
 		(int)cursor->x, (int)cursor->y);
 
 	struct wlr_buffer *buffer = NULL;
-	if (texture != NULL) {
+	if (texture != NULL || icon_texture != NULL) {
 		buffer = render_cursor_buffer(cursor);
 		if (buffer == NULL) {
 			wlr_log(WLR_ERROR, "Failed to render cursor buffer");
@@ -357,9 +672,12 @@ static bool output_cursor_attempt_hardware(struct wlr_output_cursor *cursor) {
 		}
 	}
 
+	// The drag icon may be above or left of the cursor image
+	struct wlr_box bounds;
+	output_cursor_get_bounds(cursor, &bounds);
 	struct wlr_box hotspot = {
-		.x = cursor->hotspot_x,
-		.y = cursor->hotspot_y,
+		.x = -bounds.x,
+		.y = -bounds.y,
 	};
 	wlr_box_transform(&hotspot, &hotspot,
 		wlr_output_transform_invert(output->transform),
@@ -373,6 +691,21 @@ static bool output_cursor_attempt_hardware(struct wlr_output_cursor *cursor) {
 	return ok;
 }
 
+/**
+ * Update the hardware cursor after the image or the drag icon has changed,
+ * falling back to a software cursor.
+ */
+static void output_cursor_refresh(struct wlr_output_cursor *cursor) {
+	if (output_cursor_attempt_hardware(cursor)) {
+		return;
+	}
+	if (cursor->output->hardware_cursor == cursor) {
+		output_set_hardware_cursor(cursor->output, NULL, 0, 0);
+		cursor->output->hardware_cursor = NULL;
+	}
+	output_cursor_damage_whole(cursor);
+}
+
 bool wlr_output_cursor_set_image(struct wlr_output_cursor *cursor,
 		const uint8_t *pixels, int32_t stride, uint32_t width, uint32_t height,
 		int32_t hotspot_x, int32_t hotspot_y) {
@@ -414,6 +747,8 @@ bool wlr_output_cursor_set_buffer(struct wlr_output_cursor *cursor,
 	cursor->texture = NULL;
 
 	cursor->enabled = false;
+	cursor->has_image_hash = buffer != NULL &&
+		hash_buffer_contents(buffer, &cursor->image_hash);
 	if (buffer != NULL) {
 		cursor->texture = wlr_texture_from_buffer(renderer, buffer);
 		if (cursor->texture == NULL) {
@@ -488,6 +823,9 @@ void wlr_output_cursor_set_surface(struct wlr_output_cursor *cursor,
 		cursor->hotspot_y = hotspot_y;
 		if (cursor->output->hardware_cursor != cursor) {
 			output_cursor_damage_whole(cursor);
+		} else if (cursor->drag_icon != NULL) {
+			// The drag icon position in the buffer depends on the hotspot
+			output_cursor_refresh(cursor);
 		} else {
 			struct wlr_buffer *buffer = cursor->output->cursor_front_buffer;
 
@@ -522,12 +860,71 @@ void wlr_output_cursor_set_surface(struct wlr_output_cursor *cursor,
 		cursor->width = 0;
 		cursor->height = 0;
 
-		if (cursor->output->hardware_cursor == cursor) {
+		if (cursor->drag_icon != NULL) {
+			output_cursor_refresh(cursor);
+		} else if (cursor->output->hardware_cursor == cursor) {
 			output_set_hardware_cursor(cursor->output, NULL, 0, 0);
 		}
 	}
 }
 
+static void output_cursor_reset_drag_icon(struct wlr_output_cursor *cursor) {
+	if (cursor->drag_icon == NULL) {
+		return;
+	}
+	if (cursor->output->hardware_cursor != cursor) {
+		output_cursor_damage_whole(cursor);
+	}
+	wl_list_remove(&cursor->drag_icon_commit.link);
+	wl_list_remove(&cursor->drag_icon_destroy.link);
+	wl_list_init(&cursor->drag_icon_commit.link);
+	wl_list_init(&cursor->drag_icon_destroy.link);
+	if (cursor->visible) {
+		wlr_surface_send_leave(cursor->drag_icon, cursor->output);
+	}
+	cursor->drag_icon = NULL;
+}
+
+static void output_cursor_handle_drag_icon_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_cursor *cursor =
+		wl_container_of(listener, cursor, drag_icon_commit);
+	if (cursor->output->hardware_cursor != cursor) {
+		output_cursor_damage_whole(cursor);
+	}
+	output_cursor_update_visible(cursor);
+	output_cursor_refresh(cursor);
+}
+
+static void output_cursor_handle_drag_icon_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_cursor *cursor =
+		wl_container_of(listener, cursor, drag_icon_destroy);
+	output_cursor_reset_drag_icon(cursor);
+	output_cursor_update_visible(cursor);
+	output_cursor_refresh(cursor);
+}
+
+void wlr_output_cursor_set_drag_icon(struct wlr_output_cursor *cursor,
+		struct wlr_surface *icon) {
+	if (icon == cursor->drag_icon) {
+		return;
+	}
+
+	output_cursor_reset_drag_icon(cursor);
+	cursor->drag_icon = icon;
+	if (icon != NULL) {
+		wl_signal_add(&icon->events.commit, &cursor->drag_icon_commit);
+		wl_signal_add(&icon->events.destroy, &cursor->drag_icon_destroy);
+		if (cursor->visible) {
+			wlr_surface_send_enter(icon, cursor->output);
+		}
+	}
+
+	output_cursor_update_visible(cursor);
+	output_cursor_refresh(cursor);
+}
+
 bool wlr_output_cursor_move(struct wlr_output_cursor *cursor,
 		double x, double y) {
 	if (cursor->x == x && cursor->y == y) {
@@ -570,6 +967,10 @@ struct wlr_output_cursor *wlr_output_cursor_create(struct wlr_output *output) {
 	cursor->surface_commit.notify = output_cursor_handle_commit;
 	wl_list_init(&cursor->surface_destroy.link);
 	cursor->surface_destroy.notify = output_cursor_handle_destroy;
+	wl_list_init(&cursor->drag_icon_commit.link);
+	cursor->drag_icon_commit.notify = output_cursor_handle_drag_icon_commit;
+	wl_list_init(&cursor->drag_icon_destroy.link);
+	cursor->drag_icon_destroy.notify = output_cursor_handle_drag_icon_destroy;
 	wl_list_insert(&output->cursors, &cursor->link);
 	cursor->visible = true; // default position is at (0, 0)
 	return cursor;
@@ -580,6 +981,7 @@ void wlr_output_cursor_destroy(struct wlr_output_cursor *cursor) {
 		return;
 	}
 	output_cursor_reset(cursor);
+	output_cursor_reset_drag_icon(cursor);
 	if (cursor->output->hardware_cursor == cursor) {
 		// If this cursor was the hardware cursor, disable it
 		output_set_hardware_cursor(cursor->output, NULL, 0, 0);
@@ -0,0 +1,373 @@
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/util/log.h>
+#include "types/wlr_output.h"
+#include "util/signal.h"
+#include "util/time.h"
+
+static int64_t get_now_nsec(struct wlr_output *output) {
+	clockid_t clock = wlr_backend_get_presentation_clock(output->backend);
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return timespec_to_nsec(&now);
+}
+
+static void send_delayed_frame(struct wlr_output *output) {
+	output->frame_scheduling.frame_delayed = false;
+	wl_event_source_timer_update(output->frame_scheduling.timer, 0);
+	if (output->enabled && !output->frame_pending) {
+		output_frame_scheduling_handle_frame(output);
+		wlr_signal_emit_safe(&output->events.frame, output);
+	}
+}
+
+static int handle_timer(void *data) {
+	struct wlr_output *output = data;
+	send_delayed_frame(output);
+	return 0;
+}
+
+static void coordinator_schedule(
+		struct wlr_output_frame_coordinator *coordinator);
+
+void wlr_output_set_frame_scheduling(struct wlr_output *output, bool enabled,
+		int safety_margin) {
+	output->frame_scheduling.safety_margin = safety_margin;
+	if (output->frame_scheduling.enabled == enabled) {
+		return;
+	}
+
+	if (enabled) {
+		struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+		output->frame_scheduling.timer =
+			wl_event_loop_add_timer(ev, handle_timer, output);
+		if (output->frame_scheduling.timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create frame scheduling timer");
+			return;
+		}
+		output->frame_scheduling.enabled = true;
+	} else {
+		// Don't leave the compositor waiting for a frame which won't come
+		bool frame_delayed = output->frame_scheduling.frame_delayed;
+		struct wlr_output_frame_coordinator *coordinator =
+			output->frame_scheduling.coordinator;
+		output_frame_scheduling_finish(output);
+		wlr_output_set_frame_coordinator(output, coordinator);
+		if (frame_delayed && output->enabled && !output->frame_pending) {
+			wlr_signal_emit_safe(&output->events.frame, output);
+		}
+	}
+}
+
+void output_frame_scheduling_finish(struct wlr_output *output) {
+	if (output->frame_scheduling.coordinator != NULL) {
+		wl_list_remove(&output->frame_scheduling.coordinator_link);
+	}
+	if (output->frame_scheduling.timer != NULL) {
+		wl_event_source_remove(output->frame_scheduling.timer);
+	}
+
+	int safety_margin = output->frame_scheduling.safety_margin;
+	uint64_t missed = output->frame_scheduling.missed;
+	memset(&output->frame_scheduling, 0, sizeof(output->frame_scheduling));
+	output->frame_scheduling.safety_margin = safety_margin;
+	output->frame_scheduling.missed = missed;
+}
+
+bool output_frame_scheduling_delay_frame(struct wlr_output *output) {
+	if (!output->frame_scheduling.enabled) {
+		return false;
+	}
+	if (output->frame_scheduling.frame_delayed) {
+		return true;
+	}
+
+	int64_t refresh = output->frame_scheduling.refresh;
+	int64_t last_present = output->frame_scheduling.last_present;
+	if (refresh <= 0 || last_present == 0) {
+		output->frame_scheduling.target = 0;
+		return false;
+	}
+
+	// Predict the first vblank which is still ahead of us
+	int64_t now = get_now_nsec(output);
+	int64_t next_vblank = last_present;
+	if (now >= last_present) {
+		next_vblank += ((now - last_present) / refresh + 1) * refresh;
+	}
+	output->frame_scheduling.target = next_vblank;
+
+	int64_t deadline = next_vblank - output->frame_scheduling.render_time -
+		(int64_t)output->frame_scheduling.safety_margin * 1000000;
+
+	struct wlr_output_frame_coordinator *coordinator =
+		output->frame_scheduling.coordinator;
+	if (coordinator != NULL) {
+		// Even a frame which is already due goes through the coordinator,
+		// other outputs may have an earlier vblank
+		output->frame_scheduling.frame_delayed = true;
+		output->frame_scheduling.deadline = deadline;
+		coordinator_schedule(coordinator);
+		return true;
+	}
+
+	int64_t delay_ms = (deadline - now) / 1000000;
+	if (delay_ms <= 0) {
+		return false;
+	}
+
+	output->frame_scheduling.frame_delayed = true;
+	wl_event_source_timer_update(output->frame_scheduling.timer, delay_ms);
+	return true;
+}
+
+void output_frame_scheduling_handle_frame(struct wlr_output *output) {
+	if (!output->frame_scheduling.enabled) {
+		return;
+	}
+	output->frame_scheduling.frame_sent = get_now_nsec(output);
+}
+
+void output_frame_scheduling_handle_commit(struct wlr_output *output) {
+	if (!output->frame_scheduling.enabled) {
+		return;
+	}
+
+	if (output->frame_scheduling.frame_delayed) {
+		// The compositor didn't wait for the frame event
+		output->frame_scheduling.frame_delayed = false;
+		wl_event_source_timer_update(output->frame_scheduling.timer, 0);
+	}
+
+	int64_t frame_sent = output->frame_scheduling.frame_sent;
+	if (frame_sent != 0) {
+		int64_t render_time = get_now_nsec(output) - frame_sent;
+		// GPU work is still executing after the commit, account for it with
+		// the latest measurement
+		if (output->render_time > 0) {
+			render_time += output->render_time;
+		}
+
+		// Rise immediately to avoid missing more frames, decay slowly to
+		// avoid reacting to a single fast frame
+		int64_t predicted = output->frame_scheduling.render_time;
+		predicted -= predicted / 16;
+		if (render_time > predicted) {
+			predicted = render_time;
+		}
+		output->frame_scheduling.render_time = predicted;
+	}
+	output->frame_scheduling.frame_sent = 0;
+
+	output->frame_scheduling.committed_target = output->frame_scheduling.target;
+	output->frame_scheduling.committed_seq = output->commit_seq;
+	output->frame_scheduling.target = 0;
+}
+
+void output_frame_scheduling_handle_present(struct wlr_output *output,
+		const struct wlr_output_event_present *event) {
+	if (!output->frame_scheduling.enabled || !event->presented) {
+		return;
+	}
+
+	int64_t when = timespec_to_nsec(event->when);
+	output->frame_scheduling.last_present = when;
+	output->frame_scheduling.refresh = event->refresh;
+
+	int64_t target = output->frame_scheduling.committed_target;
+	if (target == 0 || event->commit_seq != output->frame_scheduling.committed_seq) {
+		return;
+	}
+	output->frame_scheduling.committed_target = 0;
+
+	// Allow for some jitter in the presentation timestamps
+	if (when > target + event->refresh / 2) {
+		output->frame_scheduling.missed++;
+		wlr_log(WLR_DEBUG, "Output %s missed a frame (%"PRIu64" so far), "
+			"predicted render time: %"PRId64" us", output->name,
+			output->frame_scheduling.missed,
+			output->frame_scheduling.render_time / 1000);
+	}
+}
+
+static void coordinator_dispatch(
+		struct wlr_output_frame_coordinator *coordinator) {
+	while (true) {
+		// Outputs may use different presentation clocks, only compare times
+		// relative to each output's clock
+
+		// Frames due now would block other frames for their render time
+		bool due = false;
+		int64_t horizon = 0;
+		struct wlr_output *output;
+		wl_list_for_each(output, &coordinator->outputs,
+				frame_scheduling.coordinator_link) {
+			if (!output->frame_scheduling.frame_delayed) {
+				continue;
+			}
+			int64_t now = get_now_nsec(output);
+			if (output->frame_scheduling.deadline <= now) {
+				due = true;
+				if (output->frame_scheduling.render_time > horizon) {
+					horizon = output->frame_scheduling.render_time;
+				}
+			}
+		}
+		if (!due) {
+			break;
+		}
+
+		// Among the frames which would be blocked, send the one with the
+		// earliest vblank first
+		struct wlr_output *next = NULL;
+		int64_t next_vblank = 0, next_slack = 0;
+		wl_list_for_each(output, &coordinator->outputs,
+				frame_scheduling.coordinator_link) {
+			if (!output->frame_scheduling.frame_delayed) {
+				continue;
+			}
+			int64_t now = get_now_nsec(output);
+			int64_t slack = output->frame_scheduling.deadline - now;
+			int64_t vblank = output->frame_scheduling.target - now;
+			if (slack <= horizon && (next == NULL || vblank < next_vblank)) {
+				next = output;
+				next_vblank = vblank;
+				next_slack = slack;
+			}
+		}
+
+		if (next_slack > 0) {
+			coordinator->reordered++;
+		}
+		// The compositor renders the frame right away, this may remove
+		// outputs from the list
+		send_delayed_frame(next);
+	}
+
+	// Wake up for the next deadline
+	int64_t min_slack = INT64_MAX;
+	struct wlr_output *output;
+	wl_list_for_each(output, &coordinator->outputs,
+			frame_scheduling.coordinator_link) {
+		if (!output->frame_scheduling.frame_delayed) {
+			continue;
+		}
+		int64_t slack = output->frame_scheduling.deadline - get_now_nsec(output);
+		if (slack < min_slack) {
+			min_slack = slack;
+		}
+	}
+	int delay_ms = 0;
+	if (min_slack != INT64_MAX) {
+		// Round up, a timer firing before the deadline is wasted
+		delay_ms = min_slack > 0 ? (min_slack + 999999) / 1000000 : 1;
+	}
+	wl_event_source_timer_update(coordinator->timer, delay_ms);
+}
+
+static int coordinator_handle_timer(void *data) {
+	struct wlr_output_frame_coordinator *coordinator = data;
+	coordinator_dispatch(coordinator);
+	return 0;
+}
+
+static void coordinator_handle_idle(void *data) {
+	struct wlr_output_frame_coordinator *coordinator = data;
+	coordinator->idle = NULL;
+	coordinator_dispatch(coordinator);
+}
+
+static void coordinator_schedule(
+		struct wlr_output_frame_coordinator *coordinator) {
+	// Dispatch from an idle source, so that all frames which become due
+	// during this event loop iteration are ordered together
+	if (coordinator->idle != NULL) {
+		return;
+	}
+	coordinator->idle = wl_event_loop_add_idle(coordinator->event_loop,
+		coordinator_handle_idle, coordinator);
+}
+
+static void coordinator_handle_display_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_frame_coordinator *coordinator =
+		wl_container_of(listener, coordinator, display_destroy);
+	wlr_output_frame_coordinator_destroy(coordinator);
+}
+
+struct wlr_output_frame_coordinator *wlr_output_frame_coordinator_create(
+		struct wl_display *display) {
+	struct wlr_output_frame_coordinator *coordinator =
+		calloc(1, sizeof(*coordinator));
+	if (coordinator == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	coordinator->event_loop = wl_display_get_event_loop(display);
+	coordinator->timer = wl_event_loop_add_timer(coordinator->event_loop,
+		coordinator_handle_timer, coordinator);
+	if (coordinator->timer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create frame coordinator timer");
+		free(coordinator);
+		return NULL;
+	}
+	wl_list_init(&coordinator->outputs);
+
+	coordinator->display_destroy.notify = coordinator_handle_display_destroy;
+	wl_display_add_destroy_listener(display, &coordinator->display_destroy);
+
+	return coordinator;
+}
+
+void wlr_output_frame_coordinator_destroy(
+		struct wlr_output_frame_coordinator *coordinator) {
+	if (coordinator == NULL) {
+		return;
+	}
+
+	struct wlr_output *output, *tmp;
+	wl_list_for_each_safe(output, tmp, &coordinator->outputs,
+			frame_scheduling.coordinator_link) {
+		wlr_output_set_frame_coordinator(output, NULL);
+	}
+
+	wl_event_source_remove(coordinator->timer);
+	if (coordinator->idle != NULL) {
+		wl_event_source_remove(coordinator->idle);
+	}
+	wl_list_remove(&coordinator->display_destroy.link);
+	free(coordinator);
+}
+
+void wlr_output_set_frame_coordinator(struct wlr_output *output,
+		struct wlr_output_frame_coordinator *coordinator) {
+	if (output->frame_scheduling.coordinator == coordinator) {
+		return;
+	}
+
+	if (output->frame_scheduling.coordinator != NULL) {
+		wl_list_remove(&output->frame_scheduling.coordinator_link);
+	}
+	output->frame_scheduling.coordinator = coordinator;
+	if (coordinator != NULL) {
+		wl_list_insert(&coordinator->outputs,
+			&output->frame_scheduling.coordinator_link);
+	}
+
+	// Hand over a frame which is already delayed
+	if (output->frame_scheduling.frame_delayed) {
+		if (coordinator != NULL) {
+			wl_event_source_timer_update(output->frame_scheduling.timer, 0);
+			coordinator_schedule(coordinator);
+		} else {
+			wl_event_source_timer_update(output->frame_scheduling.timer, 1);
+		}
+	}
+}
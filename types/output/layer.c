@@ -0,0 +1,38 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+struct wlr_output_layer *wlr_output_layer_create(struct wlr_output *output) {
+	struct wlr_output_layer *layer = calloc(1, sizeof(*layer));
+	if (layer == NULL) {
+		return NULL;
+	}
+
+	wl_list_insert(&output->layers, &layer->link);
+	wlr_addon_set_init(&layer->addons);
+
+	return layer;
+}
+
+void wlr_output_layer_destroy(struct wlr_output_layer *layer) {
+	if (layer == NULL) {
+		return;
+	}
+
+	wlr_addon_set_finish(&layer->addons);
+	wl_list_remove(&layer->link);
+	free(layer);
+}
+
+void wlr_output_lock_layers(struct wlr_output *output, bool lock) {
+	if (lock) {
+		++output->layer_locks;
+	} else {
+		assert(output->layer_locks > 0);
+		--output->layer_locks;
+	}
+	wlr_log(WLR_DEBUG, "%s output layers on output '%s' (locks: %d)",
+		lock ? "Disabling" : "Enabling", output->name,
+		output->layer_locks);
+}
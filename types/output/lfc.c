@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pixman.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/log.h>
+#include "types/wlr_output.h"
+#include "util/time.h"
+
+// Longer intervals are considered idle periods rather than a frame rate
+#define MAX_INTERVAL_NSEC 1000000000
+
+static int64_t get_now_nsec(struct wlr_output *output) {
+	clockid_t clock = wlr_backend_get_presentation_clock(output->backend);
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return timespec_to_nsec(&now);
+}
+
+static void lfc_reset(struct wlr_output *output) {
+	if (output->lfc.timer != NULL) {
+		wl_event_source_timer_update(output->lfc.timer, 0);
+	}
+	wlr_buffer_unlock(output->lfc.buffer);
+	output->lfc.buffer = NULL;
+	output->lfc.last_commit = 0;
+	output->lfc.interval = 0;
+	output->lfc.repeat_interval = 0;
+}
+
+/**
+ * Pick the interval to repeat buffers at: the interval between buffers divided
+ * by the smallest integer which brings it within the adaptive sync range.
+ * Returns zero if no compensation is needed or possible.
+ */
+static int64_t get_repeat_interval(struct wlr_output *output) {
+	int32_t min_refresh = output->adaptive_sync_min_refresh;
+	int32_t max_refresh = output->adaptive_sync_max_refresh;
+	if (output->refresh > 0 &&
+			(max_refresh <= 0 || output->refresh < max_refresh)) {
+		max_refresh = output->refresh;
+	}
+	if (min_refresh <= 0 || max_refresh <= min_refresh) {
+		return 0;
+	}
+
+	int64_t max_frame = 1000000000000LL / min_refresh;
+	int64_t min_frame = 1000000000000LL / max_refresh;
+	int64_t interval = output->lfc.interval;
+	if (interval <= max_frame) {
+		return 0;
+	}
+
+	int64_t n = (interval + max_frame - 1) / max_frame;
+	int64_t repeat = interval / n;
+	if (repeat < min_frame) {
+		// The range is too narrow for this frame rate
+		return 0;
+	}
+	return repeat;
+}
+
+static void lfc_repeat(struct wlr_output *output) {
+	if (!output->enabled || output->frame_pending || output->needs_frame ||
+			output->lfc.buffer == NULL ||
+			output->adaptive_sync_status != WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+		return;
+	}
+
+	struct wlr_output_state state = {
+		.committed = WLR_OUTPUT_STATE_BUFFER | WLR_OUTPUT_STATE_DAMAGE,
+		.buffer = output->lfc.buffer,
+	};
+	pixman_region32_init(&state.damage);
+
+	output->lfc.repeating = true;
+	if (!wlr_output_commit_state(output, &state)) {
+		wlr_log(WLR_DEBUG, "Failed to repeat buffer on output %s",
+			output->name);
+	}
+	output->lfc.repeating = false;
+
+	pixman_region32_fini(&state.damage);
+}
+
+static int handle_timer(void *data) {
+	struct wlr_output *output = data;
+	lfc_repeat(output);
+	return 0;
+}
+
+void wlr_output_set_low_framerate_compensation(struct wlr_output *output,
+		bool enabled) {
+	if (output->lfc.enabled == enabled) {
+		return;
+	}
+
+	if (enabled) {
+		struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+		output->lfc.timer = wl_event_loop_add_timer(ev, handle_timer, output);
+		if (output->lfc.timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create LFC timer");
+			return;
+		}
+		output->lfc.enabled = true;
+	} else {
+		output_lfc_finish(output);
+	}
+}
+
+void output_lfc_finish(struct wlr_output *output) {
+	lfc_reset(output);
+	if (output->lfc.timer != NULL) {
+		wl_event_source_remove(output->lfc.timer);
+		output->lfc.timer = NULL;
+	}
+	output->lfc.enabled = false;
+}
+
+void output_lfc_handle_commit(struct wlr_output *output,
+		const struct wlr_output_state *state) {
+	if (!output->lfc.enabled) {
+		return;
+	}
+
+	if (!output->enabled ||
+			output->adaptive_sync_status != WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+		lfc_reset(output);
+		return;
+	}
+
+	if (!(state->committed & WLR_OUTPUT_STATE_BUFFER) ||
+			output->lfc.repeating) {
+		return;
+	}
+
+	// A new buffer is on its way, the pending repeat isn't needed anymore
+	wl_event_source_timer_update(output->lfc.timer, 0);
+
+	wlr_buffer_unlock(output->lfc.buffer);
+	output->lfc.buffer = wlr_buffer_lock(state->buffer);
+
+	int64_t now = get_now_nsec(output);
+	if (output->lfc.last_commit != 0) {
+		int64_t interval = now - output->lfc.last_commit;
+		if (interval > MAX_INTERVAL_NSEC) {
+			interval = MAX_INTERVAL_NSEC;
+		}
+		if (output->lfc.interval == 0) {
+			output->lfc.interval = interval;
+		} else {
+			output->lfc.interval += (interval - output->lfc.interval) / 8;
+		}
+	}
+	output->lfc.last_commit = now;
+
+	int64_t repeat_interval = get_repeat_interval(output);
+	if ((repeat_interval != 0) != (output->lfc.repeat_interval != 0)) {
+		wlr_log(WLR_DEBUG, "%s low framerate compensation on output %s",
+			repeat_interval != 0 ? "Starting" : "Stopping", output->name);
+	}
+	output->lfc.repeat_interval = repeat_interval;
+}
+
+void output_lfc_handle_present(struct wlr_output *output,
+		const struct wlr_output_event_present *event) {
+	if (!output->lfc.enabled || !event->presented ||
+			output->lfc.repeat_interval == 0 || output->lfc.buffer == NULL) {
+		return;
+	}
+
+	// The display refreshes as soon as a buffer arrives, schedule the next
+	// repeat relative to the page-flip timestamp
+	int64_t next = timespec_to_nsec(event->when) + output->lfc.repeat_interval;
+	int64_t delay_ms = (next - get_now_nsec(output)) / 1000000;
+	if (delay_ms < 1) {
+		delay_ms = 1;
+	}
+	wl_event_source_timer_update(output->lfc.timer, delay_ms);
+}
@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <pixman.h>
+#include <stdlib.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_mirror.h>
+#include <wlr/util/box.h>
+#include <wlr/util/log.h>
+#include "util/signal.h"
+
+/**
+ * Get the transform taking the source buffer to the buffer coordinates of
+ * the mirror output, and the box it covers there: the largest one with the
+ * aspect ratio of the source buffer, centered.
+ */
+static enum wl_output_transform get_geometry(
+		struct wlr_output_mirror_output *mirror_output,
+		struct wlr_buffer *buffer, struct wlr_box *box) {
+	struct wlr_output *source = mirror_output->mirror->source;
+	struct wlr_output *output = mirror_output->output;
+
+	enum wl_output_transform transform = wlr_output_transform_compose(
+		wlr_output_transform_invert(source->transform), output->transform);
+
+	int width = buffer->width, height = buffer->height;
+	if (transform & WL_OUTPUT_TRANSFORM_90) {
+		width = buffer->height;
+		height = buffer->width;
+	}
+
+	if ((int64_t)width * output->height > (int64_t)height * output->width) {
+		box->width = output->width;
+		box->height = (int64_t)height * output->width / width;
+	} else {
+		box->width = (int64_t)width * output->height / height;
+		box->height = output->height;
+	}
+	box->x = (output->width - box->width) / 2;
+	box->y = (output->height - box->height) / 2;
+
+	return transform;
+}
+
+static bool present_direct(struct wlr_output_mirror_output *mirror_output,
+		struct wlr_buffer *buffer, const struct wlr_box *box,
+		enum wl_output_transform transform) {
+	struct wlr_output *output = mirror_output->output;
+
+	struct wlr_output_state state = {
+		.committed = WLR_OUTPUT_STATE_BUFFER,
+		.buffer = buffer,
+	};
+	pixman_region32_init(&state.damage);
+
+	if (transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+			box->width != output->width || box->height != output->height) {
+		wlr_output_state_set_buffer_geometry(&state, NULL, box, transform);
+	}
+
+	bool ok = wlr_output_test_state(output, &state) &&
+		wlr_output_commit_state(output, &state);
+
+	pixman_region32_fini(&state.damage);
+	return ok;
+}
+
+static bool present_blit(struct wlr_output_mirror_output *mirror_output,
+		struct wlr_buffer *buffer, const struct wlr_box *box,
+		enum wl_output_transform transform) {
+	struct wlr_output *output = mirror_output->output;
+	struct wlr_renderer *renderer = output->renderer;
+	if (renderer == NULL) {
+		wlr_log(WLR_ERROR, "Output %s has no renderer to mirror into",
+			output->name);
+		return false;
+	}
+
+	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, buffer);
+	if (texture == NULL) {
+		wlr_log(WLR_ERROR, "Failed to import buffer mirrored to output %s",
+			output->name);
+		return false;
+	}
+
+	if (!wlr_output_attach_render(output, NULL)) {
+		wlr_texture_destroy(texture);
+		return false;
+	}
+
+	float projection[9];
+	wlr_matrix_identity(projection);
+	float matrix[9];
+	wlr_matrix_project_box(matrix, box, transform, 0, projection);
+
+	wlr_renderer_begin(renderer, output->width, output->height);
+	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 1.0 });
+	wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0);
+	wlr_renderer_end(renderer);
+
+	wlr_texture_destroy(texture);
+	return wlr_output_commit(output);
+}
+
+static void mirror_output_present(
+		struct wlr_output_mirror_output *mirror_output) {
+	struct wlr_output *output = mirror_output->output;
+	struct wlr_buffer *buffer = mirror_output->pending_buffer;
+	if (buffer == NULL || !output->enabled || output->frame_pending) {
+		return;
+	}
+	mirror_output->pending_buffer = NULL;
+
+	struct wlr_box box;
+	enum wl_output_transform transform =
+		get_geometry(mirror_output, buffer, &box);
+
+	bool direct = present_direct(mirror_output, buffer, &box, transform);
+	if (direct != mirror_output->direct) {
+		wlr_log(WLR_DEBUG, "Direct scan-out of mirrored buffers %s on "
+			"output %s", direct ? "enabled" : "disabled", output->name);
+		mirror_output->direct = direct;
+	}
+	if (!direct && !present_blit(mirror_output, buffer, &box, transform)) {
+		wlr_log(WLR_ERROR, "Failed to present mirrored buffer on output %s",
+			output->name);
+	}
+
+	wlr_buffer_unlock(buffer);
+}
+
+static void mirror_output_handle_output_frame(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_mirror_output *mirror_output =
+		wl_container_of(listener, mirror_output, output_frame);
+	mirror_output_present(mirror_output);
+}
+
+static void mirror_output_handle_output_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_mirror_output *mirror_output =
+		wl_container_of(listener, mirror_output, output_destroy);
+	wlr_output_mirror_output_destroy(mirror_output);
+}
+
+struct wlr_output_mirror_output *wlr_output_mirror_add_output(
+		struct wlr_output_mirror *mirror, struct wlr_output *output) {
+	assert(output != mirror->source);
+
+	struct wlr_output_mirror_output *mirror_output =
+		calloc(1, sizeof(*mirror_output));
+	if (mirror_output == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	mirror_output->mirror = mirror;
+	mirror_output->output = output;
+	mirror_output->direct = true;
+	wl_list_insert(mirror->outputs.prev, &mirror_output->link);
+
+	mirror_output->output_frame.notify = mirror_output_handle_output_frame;
+	wl_signal_add(&output->events.frame, &mirror_output->output_frame);
+	mirror_output->output_destroy.notify = mirror_output_handle_output_destroy;
+	wl_signal_add(&output->events.destroy, &mirror_output->output_destroy);
+
+	return mirror_output;
+}
+
+void wlr_output_mirror_output_destroy(
+		struct wlr_output_mirror_output *mirror_output) {
+	if (mirror_output == NULL) {
+		return;
+	}
+	wlr_buffer_unlock(mirror_output->pending_buffer);
+	wl_list_remove(&mirror_output->output_frame.link);
+	wl_list_remove(&mirror_output->output_destroy.link);
+	wl_list_remove(&mirror_output->link);
+	free(mirror_output);
+}
+
+static void mirror_handle_source_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_mirror *mirror =
+		wl_container_of(listener, mirror, source_commit);
+	struct wlr_output_event_commit *event = data;
+	if (event->buffer == NULL) {
+		return;
+	}
+
+	struct wlr_output_mirror_output *mirror_output, *tmp;
+	wl_list_for_each_safe(mirror_output, tmp, &mirror->outputs, link) {
+		// Outputs still busy with a frame skip to the latest buffer
+		wlr_buffer_unlock(mirror_output->pending_buffer);
+		mirror_output->pending_buffer = wlr_buffer_lock(event->buffer);
+		mirror_output_present(mirror_output);
+	}
+}
+
+static void mirror_handle_source_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_output_mirror *mirror =
+		wl_container_of(listener, mirror, source_destroy);
+	wlr_output_mirror_destroy(mirror);
+}
+
+struct wlr_output_mirror *wlr_output_mirror_create(struct wlr_output *source) {
+	struct wlr_output_mirror *mirror = calloc(1, sizeof(*mirror));
+	if (mirror == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	mirror->source = source;
+	wl_list_init(&mirror->outputs);
+	wl_signal_init(&mirror->events.destroy);
+
+	mirror->source_commit.notify = mirror_handle_source_commit;
+	wl_signal_add(&source->events.commit, &mirror->source_commit);
+	mirror->source_destroy.notify = mirror_handle_source_destroy;
+	wl_signal_add(&source->events.destroy, &mirror->source_destroy);
+
+	return mirror;
+}
+
+void wlr_output_mirror_destroy(struct wlr_output_mirror *mirror) {
+	if (mirror == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&mirror->events.destroy, mirror);
+
+	struct wlr_output_mirror_output *mirror_output, *tmp;
+	wl_list_for_each_safe(mirror_output, tmp, &mirror->outputs, link) {
+		wlr_output_mirror_output_destroy(mirror_output);
+	}
+
+	wl_list_remove(&mirror->source_commit.link);
+	wl_list_remove(&mirror->source_destroy.link);
+	free(mirror);
+}
@@ -3,15 +3,20 @@
 #include <backend/backend.h>
 #include <drm_fourcc.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/util/log.h>
 #include "render/allocator/allocator.h"
+#include "render/buffer_pool.h"
 #include "render/swapchain.h"
+#include "render/wlr_renderer.h"
 #include "types/wlr_output.h"
 #include "util/global.h"
 #include "util/signal.h"
+#include "util/trace.h"
 
 #define OUTPUT_VERSION 4
 
@@ -351,8 +356,13 @@ void wlr_output_init(struct wlr_output *output, struct wlr_backend *backend,
 	output->render_format = DRM_FORMAT_XRGB8888;
 	output->transform = WL_OUTPUT_TRANSFORM_NORMAL;
 	output->scale = 1;
+	output->background_color[3] = 1;
 	output->commit_seq = 0;
+	output->render_time = -1;
 	wl_list_init(&output->cursors);
+	wl_list_init(&output->cursor_buffer_cache);
+	wl_list_init(&output->layers);
+	wl_list_init(&output->captures);
 	wl_list_init(&output->resources);
 	wl_signal_init(&output->events.frame);
 	wl_signal_init(&output->events.damage);
@@ -392,6 +402,8 @@ void wlr_output_destroy(struct wlr_output *output) {
 	wlr_signal_emit_safe(&output->events.destroy, output);
 	wlr_addon_set_finish(&output->addons);
 
+	output_captures_finish(output);
+
 	// The backend is responsible for free-ing the list of modes
 
 	struct wlr_output_cursor *cursor, *tmp_cursor;
@@ -399,7 +411,13 @@ void wlr_output_destroy(struct wlr_output *output) {
 		wlr_output_cursor_destroy(cursor);
 	}
 
-	wlr_swapchain_destroy(output->cursor_swapchain);
+	struct wlr_output_layer *layer, *tmp_layer;
+	wl_list_for_each_safe(layer, tmp_layer, &output->layers, link) {
+		wlr_output_layer_destroy(layer);
+	}
+
+	output_cursor_buffer_cache_finish(output);
+	wlr_buffer_pool_destroy(output->cursor_buffer_pool);
 	wlr_buffer_unlock(output->cursor_front_buffer);
 
 	wlr_swapchain_destroy(output->swapchain);
@@ -412,6 +430,10 @@ void wlr_output_destroy(struct wlr_output *output) {
 		wl_event_source_remove(output->idle_done);
 	}
 
+	output_frame_scheduling_finish(output);
+	output_lfc_finish(output);
+	output_render_timing_finish(output);
+
 	free(output->name);
 	free(output->description);
 	free(output->make);
@@ -488,7 +510,9 @@ static void output_state_clear_gamma_lut(struct wlr_output_state *state) {
 static void output_state_clear(struct wlr_output_state *state) {
 	output_state_clear_buffer(state);
 	output_state_clear_gamma_lut(state);
-	pixman_region32_clear(&state->damage);
+	// The damage is only read if WLR_OUTPUT_STATE_DAMAGE is set. Keep the
+	// region's storage around for the next frame instead of freeing it.
+	state->tearing_page_flip = false;
 	state->committed = 0;
 }
 
@@ -566,6 +590,15 @@ static uint32_t output_compare_state(struct wlr_output *output,
 			output->subpixel == state->subpixel) {
 		fields |= WLR_OUTPUT_STATE_SUBPIXEL;
 	}
+	if ((state->committed & WLR_OUTPUT_STATE_CONTENT_TYPE) &&
+			output->content_type == state->content_type) {
+		fields |= WLR_OUTPUT_STATE_CONTENT_TYPE;
+	}
+	if ((state->committed & WLR_OUTPUT_STATE_BACKGROUND_COLOR) &&
+			memcmp(output->background_color, state->background_color,
+			sizeof(output->background_color)) == 0) {
+		fields |= WLR_OUTPUT_STATE_BACKGROUND_COLOR;
+	}
 	return fields;
 }
 
@@ -595,19 +628,71 @@ static bool output_basic_test(struct wlr_output *output,
 				}
 			}
 
-			// If the size doesn't match, reject buffer (scaling is not
-			// supported)
+			// If the size doesn't match, reject buffer (scaling is only
+			// supported with an explicit geometry)
 			int pending_width, pending_height;
 			output_pending_resolution(output, state,
 				&pending_width, &pending_height);
-			if (state->buffer->width != pending_width ||
-					state->buffer->height != pending_height) {
+			if (!(state->committed & WLR_OUTPUT_STATE_BUFFER_GEOMETRY) &&
+					(state->buffer->width != pending_width ||
+					state->buffer->height != pending_height)) {
 				wlr_log(WLR_DEBUG, "Direct scan-out buffer size mismatch");
 				return false;
 			}
 		}
 	}
 
+	if ((state->committed & WLR_OUTPUT_STATE_BUFFER_GEOMETRY) &&
+			(!(state->committed & WLR_OUTPUT_STATE_BUFFER) ||
+			output->back_buffer != NULL)) {
+		wlr_log(WLR_DEBUG, "Tried to set a buffer geometry without a "
+			"scan-out buffer");
+		return false;
+	}
+
+	if ((state->committed & WLR_OUTPUT_STATE_CAPTURE) &&
+			!(state->committed & WLR_OUTPUT_STATE_BUFFER) &&
+			output->back_buffer == NULL) {
+		wlr_log(WLR_DEBUG, "Tried to capture without a buffer");
+		return false;
+	}
+
+	if ((state->committed & WLR_OUTPUT_STATE_IN_FENCE) &&
+			!(state->committed & WLR_OUTPUT_STATE_BUFFER) &&
+			output->back_buffer == NULL) {
+		wlr_log(WLR_DEBUG, "Tried to set an in-fence without a buffer");
+		return false;
+	}
+
+	if (state->committed & WLR_OUTPUT_STATE_LAYERS) {
+		// Backends which don't support layers leave them rejected
+		for (size_t i = 0; i < state->layers_len; i++) {
+			state->layers[i].accepted = false;
+		}
+
+		bool has_layer_buffer = false;
+		for (size_t i = 0; i < state->layers_len; i++) {
+			has_layer_buffer |= state->layers[i].buffer != NULL;
+		}
+
+		if (has_layer_buffer && (output->attach_render_locks > 0 ||
+				output->layer_locks > 0)) {
+			wlr_log(WLR_DEBUG, "Output layers disabled by lock");
+			return false;
+		}
+
+		// Software cursors are rendered in the primary buffer, which is
+		// displayed below the layers
+		struct wlr_output_cursor *cursor;
+		wl_list_for_each(cursor, &output->cursors, link) {
+			if (has_layer_buffer && cursor->enabled && cursor->visible &&
+					cursor != output->hardware_cursor) {
+				wlr_log(WLR_DEBUG, "Output layers disabled by software cursor");
+				return false;
+			}
+		}
+	}
+
 	if (state->committed & WLR_OUTPUT_STATE_RENDER_FORMAT) {
 		struct wlr_allocator *allocator = output->allocator;
 		assert(allocator != NULL);
@@ -664,6 +749,10 @@ static bool output_basic_test(struct wlr_output *output,
 		wlr_log(WLR_DEBUG, "Tried to set the subpixel layout on a disabled output");
 		return false;
 	}
+	if (!enabled && state->committed & WLR_OUTPUT_STATE_LAYERS) {
+		wlr_log(WLR_DEBUG, "Tried to set layers on a disabled output");
+		return false;
+	}
 
 	return true;
 }
@@ -705,100 +794,154 @@ bool wlr_output_test(struct wlr_output *output) {
 	return wlr_output_test_state(output, &output->pending);
 }
 
-bool wlr_output_commit_state(struct wlr_output *output,
-		const struct wlr_output_state *state) {
+bool output_commit_prepare(struct output_commit *commit,
+		struct wlr_output *output, const struct wlr_output_state *state,
+		bool test) {
+	memset(commit, 0, sizeof(*commit));
+	commit->output = output;
+	commit->test = test;
+	commit->render_fence_fd = -1;
+
 	uint32_t unchanged = output_compare_state(output, state);
 
 	// Create a shallow copy of the state with only the fields which have been
 	// changed and potentially a new buffer.
-	struct wlr_output_state pending = *state;
-	pending.committed &= ~unchanged;
-
-	if (!output_basic_test(output, &pending)) {
-		wlr_log(WLR_ERROR, "Basic output test failed for %s", output->name);
+	struct wlr_output_state *pending = &commit->pending;
+	*pending = *state;
+	pending->committed &= ~unchanged;
+
+	if (!output_basic_test(output, pending)) {
+		if (!test) {
+			wlr_log(WLR_ERROR, "Basic output test failed for %s",
+				output->name);
+		}
 		output_clear_back_buffer(output);
 		return false;
 	}
 
-	bool new_back_buffer = false;
-	if (!output_ensure_buffer(output, &pending, &new_back_buffer)) {
+	if (!output_ensure_buffer(output, pending, &commit->new_back_buffer)) {
 		output_clear_back_buffer(output);
 		return false;
 	}
-	if (new_back_buffer) {
-		assert((pending.committed & WLR_OUTPUT_STATE_BUFFER) == 0);
-		pending.committed |= WLR_OUTPUT_STATE_BUFFER;
+	if (commit->new_back_buffer) {
+		assert((pending->committed & WLR_OUTPUT_STATE_BUFFER) == 0);
+		pending->committed |= WLR_OUTPUT_STATE_BUFFER;
 		// Lock the buffer to ensure it stays valid past the
 		// output_clear_back_buffer() call below.
-		pending.buffer = wlr_buffer_lock(output->back_buffer);
+		pending->buffer = wlr_buffer_lock(output->back_buffer);
+	}
+
+	if (test) {
+		return true;
 	}
 
-	if ((pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
+	if ((pending->committed & WLR_OUTPUT_STATE_BUFFER) &&
 			output->idle_frame != NULL) {
 		wl_event_source_remove(output->idle_frame);
 		output->idle_frame = NULL;
 	}
 
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_MONOTONIC, &commit->now);
+
+	if (!wl_list_empty(&output->captures)) {
+		commit->capture_buffer = output_state_add_capture(output, pending);
+	}
 
 	struct wlr_output_event_precommit pre_event = {
 		.output = output,
-		.when = &now,
-		.state = &pending,
+		.when = &commit->now,
+		.state = pending,
 	};
 	wlr_signal_emit_safe(&output->events.precommit, &pre_event);
 
 	// output_clear_back_buffer detaches the buffer from the renderer. This is
 	// important to do before calling impl->commit(), because this marks an
 	// implicit rendering synchronization point. The backend needs it to avoid
-	// displaying a buffer when asynchronous GPU work isn't finished.
-	struct wlr_buffer *back_buffer = NULL;
-	if ((pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
+	// displaying a buffer when asynchronous GPU work isn't finished. Backends
+	// supporting explicit synchronization can wait on the render fence instead.
+	if ((pending->committed & WLR_OUTPUT_STATE_BUFFER) &&
 			output->back_buffer != NULL) {
-		back_buffer = wlr_buffer_lock(output->back_buffer);
+		if (!(pending->committed & WLR_OUTPUT_STATE_IN_FENCE)) {
+			commit->render_fence_fd =
+				renderer_export_sync_file(output->renderer);
+			if (commit->render_fence_fd >= 0) {
+				wlr_output_state_set_in_fence(pending,
+					commit->render_fence_fd);
+			}
+		}
+		commit->back_buffer = wlr_buffer_lock(output->back_buffer);
 		output_clear_back_buffer(output);
 	}
 
-	if (!output->impl->commit(output, &pending)) {
+	return true;
+}
+
+void output_commit_finish(struct output_commit *commit, bool committed) {
+	struct wlr_output *output = commit->output;
+	struct wlr_output_state *pending = &commit->pending;
+	struct wlr_buffer *back_buffer = commit->back_buffer;
+
+	if (commit->test) {
+		if (commit->new_back_buffer) {
+			wlr_buffer_unlock(pending->buffer);
+			output_clear_back_buffer(output);
+		}
+		return;
+	}
+
+	if (commit->render_fence_fd >= 0) {
+		close(commit->render_fence_fd);
+	}
+	if (!committed) {
+		output_captures_handle_commit_failure(output, pending);
+		wlr_buffer_unlock(commit->capture_buffer);
 		wlr_buffer_unlock(back_buffer);
-		if (new_back_buffer) {
-			wlr_buffer_unlock(pending.buffer);
+		if (commit->new_back_buffer) {
+			wlr_buffer_unlock(pending->buffer);
 		}
-		return false;
+		return;
 	}
 
-	if (pending.committed & WLR_OUTPUT_STATE_BUFFER) {
+	if (pending->committed & WLR_OUTPUT_STATE_BUFFER) {
 		struct wlr_output_cursor *cursor;
 		wl_list_for_each(cursor, &output->cursors, link) {
 			if (!cursor->enabled || !cursor->visible || cursor->surface == NULL) {
 				continue;
 			}
-			wlr_surface_send_frame_done(cursor->surface, &now);
+			wlr_surface_send_frame_done(cursor->surface, &commit->now);
 		}
 	}
 
-	if (pending.committed & WLR_OUTPUT_STATE_RENDER_FORMAT) {
-		output->render_format = pending.render_format;
+	if (pending->committed & WLR_OUTPUT_STATE_RENDER_FORMAT) {
+		output->render_format = pending->render_format;
 	}
 
-	if (pending.committed & WLR_OUTPUT_STATE_SUBPIXEL) {
-		output->subpixel = pending.subpixel;
+	if (pending->committed & WLR_OUTPUT_STATE_SUBPIXEL) {
+		output->subpixel = pending->subpixel;
+	}
+
+	if (pending->committed & WLR_OUTPUT_STATE_CONTENT_TYPE) {
+		output->content_type = pending->content_type;
+	}
+
+	if (pending->committed & WLR_OUTPUT_STATE_BACKGROUND_COLOR) {
+		memcpy(output->background_color, pending->background_color,
+			sizeof(output->background_color));
 	}
 
 	output->commit_seq++;
 
-	bool scale_updated = pending.committed & WLR_OUTPUT_STATE_SCALE;
+	bool scale_updated = pending->committed & WLR_OUTPUT_STATE_SCALE;
 	if (scale_updated) {
-		output->scale = pending.scale;
+		output->scale = pending->scale;
 	}
 
-	if (pending.committed & WLR_OUTPUT_STATE_TRANSFORM) {
-		output->transform = pending.transform;
+	if (pending->committed & WLR_OUTPUT_STATE_TRANSFORM) {
+		output->transform = pending->transform;
 		output_update_matrix(output);
 	}
 
-	bool geometry_updated = pending.committed &
+	bool geometry_updated = pending->committed &
 		(WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_TRANSFORM |
 		WLR_OUTPUT_STATE_SUBPIXEL);
 	if (geometry_updated || scale_updated) {
@@ -814,18 +957,26 @@ bool wlr_output_commit_state(struct wlr_output *output,
 		wlr_output_schedule_done(output);
 	}
 
-	// Destroy the swapchains when an output is disabled
-	if ((pending.committed & WLR_OUTPUT_STATE_ENABLED) && !pending.enabled) {
+	// Destroy the swapchain and cursor buffers when an output is disabled
+	if ((pending->committed & WLR_OUTPUT_STATE_ENABLED) && !pending->enabled) {
 		wlr_swapchain_destroy(output->swapchain);
 		output->swapchain = NULL;
-		wlr_swapchain_destroy(output->cursor_swapchain);
-		output->cursor_swapchain = NULL;
+		output_cursor_buffer_cache_finish(output);
+		wlr_buffer_pool_destroy(output->cursor_buffer_pool);
+		output->cursor_buffer_pool = NULL;
 	}
 
-	if (pending.committed & WLR_OUTPUT_STATE_BUFFER) {
+	if (pending->committed & WLR_OUTPUT_STATE_BUFFER) {
 		output->frame_pending = true;
 		output->needs_frame = false;
+		output_poll_render_time(output);
+		// Repeated buffers don't say anything about the compositor's timings
+		if (!output->lfc.repeating) {
+			output_frame_scheduling_handle_commit(output);
+		}
 	}
+	output_lfc_handle_commit(output, pending);
+	output_captures_handle_commit(output, pending, &commit->now);
 
 	if (back_buffer != NULL) {
 		wlr_swapchain_set_buffer_submitted(output->swapchain, back_buffer);
@@ -833,18 +984,38 @@ bool wlr_output_commit_state(struct wlr_output *output,
 
 	struct wlr_output_event_commit event = {
 		.output = output,
-		.committed = pending.committed,
-		.when = &now,
+		.committed = pending->committed,
+		.when = &commit->now,
 		.buffer = back_buffer,
+		.render_time = output->render_time,
 	};
 	wlr_signal_emit_safe(&output->events.commit, &event);
 
+	wlr_buffer_unlock(commit->capture_buffer);
 	wlr_buffer_unlock(back_buffer);
-	if (new_back_buffer) {
-		wlr_buffer_unlock(pending.buffer);
+	if (commit->new_back_buffer) {
+		wlr_buffer_unlock(pending->buffer);
 	}
+}
 
-	return true;
+static bool output_commit_state(struct wlr_output *output,
+		const struct wlr_output_state *state) {
+	struct output_commit commit;
+	if (!output_commit_prepare(&commit, output, state, false)) {
+		return false;
+	}
+
+	bool ok = output->impl->commit(output, &commit.pending);
+	output_commit_finish(&commit, ok);
+	return ok;
+}
+
+bool wlr_output_commit_state(struct wlr_output *output,
+		const struct wlr_output_state *state) {
+	trace_begin("wlr_output_commit_state %s", output->name);
+	bool ok = output_commit_state(output, state);
+	trace_end();
+	return ok;
 }
 
 bool wlr_output_commit(struct wlr_output *output) {
@@ -852,6 +1023,15 @@ bool wlr_output_commit(struct wlr_output *output) {
 	struct wlr_output_state state = {0};
 	output_state_move(&state, &output->pending);
 	bool ok = wlr_output_commit_state(output, &state);
+
+	// Hand the damage region back to the pending state, so that the next
+	// frame re-uses its storage instead of allocating a new one. The damage
+	// is only read if WLR_OUTPUT_STATE_DAMAGE is set, stale contents are fine.
+	if (!(output->pending.committed & WLR_OUTPUT_STATE_DAMAGE)) {
+		pixman_region32_t damage = output->pending.damage;
+		output->pending.damage = state.damage;
+		state.damage = damage;
+	}
 	output_state_finish(&state);
 	return ok;
 }
@@ -875,7 +1055,8 @@ void wlr_output_attach_buffer(struct wlr_output *output,
 
 void wlr_output_send_frame(struct wlr_output *output) {
 	output->frame_pending = false;
-	if (output->enabled) {
+	if (output->enabled && !output_frame_scheduling_delay_frame(output)) {
+		output_frame_scheduling_handle_frame(output);
 		wlr_signal_emit_safe(&output->events.frame, output);
 	}
 }
@@ -894,7 +1075,8 @@ void wlr_output_schedule_frame(struct wlr_output *output) {
 	// work.
 	wlr_output_update_needs_frame(output);
 
-	if (output->frame_pending || output->idle_frame != NULL) {
+	if (output->frame_pending || output->idle_frame != NULL ||
+			output->frame_scheduling.frame_delayed) {
 		return;
 	}
 
@@ -922,9 +1104,21 @@ void wlr_output_send_present(struct wlr_output *output,
 		event->when = &now;
 	}
 
+	output_frame_scheduling_handle_present(output, event);
+	output_lfc_handle_present(output, event);
 	wlr_signal_emit_safe(&output->events.present, event);
 }
 
+bool wlr_output_get_present_stats(struct wlr_output *output,
+		struct wlr_output_present_stats *stats) {
+	if (!output->impl->get_present_stats) {
+		return false;
+	}
+	memset(stats, 0, sizeof(*stats));
+	output->impl->get_present_stats(output, stats);
+	return true;
+}
+
 void wlr_output_set_gamma(struct wlr_output *output, size_t size,
 		const uint16_t *r, const uint16_t *g, const uint16_t *b) {
 	output_state_clear_gamma_lut(&output->pending);
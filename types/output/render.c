@@ -6,6 +6,7 @@
 #include <wlr/util/log.h>
 #include "backend/backend.h"
 #include "render/allocator/allocator.h"
+#include "render/buffer_pool.h"
 #include "render/drm_format_set.h"
 #include "render/swapchain.h"
 #include "render/wlr_renderer.h"
@@ -36,15 +37,26 @@ bool wlr_output_init_render(struct wlr_output *output,
 	return true;
 }
 
+enum output_swapchain_modifiers {
+	// Only the best ranked modifiers, see wlr_drm_modifier_get_rank()
+	OUTPUT_SWAPCHAIN_MODIFIERS_PREFERRED,
+	// Any modifier supported by both the renderer and the output
+	OUTPUT_SWAPCHAIN_MODIFIERS_ANY,
+	// No modifiers
+	OUTPUT_SWAPCHAIN_MODIFIERS_NONE,
+};
+
 /**
  * Ensure the output has a suitable swapchain. The swapchain is re-created if
  * necessary.
  *
- * If allow_modifiers is set to true, the swapchain's format may use modifiers.
- * If set to false, the swapchain's format is guaranteed to not use modifiers.
+ * With OUTPUT_SWAPCHAIN_MODIFIERS_PREFERRED, an existing swapchain using any
+ * modifier is kept. With OUTPUT_SWAPCHAIN_MODIFIERS_NONE, the swapchain's
+ * format is guaranteed to not use modifiers.
  */
 static bool output_create_swapchain(struct wlr_output *output,
-		const struct wlr_output_state *state, bool allow_modifiers) {
+		const struct wlr_output_state *state,
+		enum output_swapchain_modifiers modifiers) {
 	int width, height;
 	output_pending_resolution(output, state, &width, &height);
 
@@ -61,19 +73,51 @@ static bool output_create_swapchain(struct wlr_output *output,
 		return false;
 	}
 
+	bool keep_modifiers;
+	switch (modifiers) {
+	case OUTPUT_SWAPCHAIN_MODIFIERS_PREFERRED:
+		keep_modifiers = true;
+		break;
+	case OUTPUT_SWAPCHAIN_MODIFIERS_ANY:
+		// Don't keep a swapchain restricted to the preferred modifiers
+		keep_modifiers = output->swapchain != NULL &&
+			output->swapchain->format->len == format->len;
+		break;
+	case OUTPUT_SWAPCHAIN_MODIFIERS_NONE:
+		keep_modifiers = output->swapchain != NULL &&
+			output->swapchain->format->len == 0;
+		break;
+	}
+
+	size_t depth = output->swapchain_depth != 0 ?
+		(size_t)output->swapchain_depth : WLR_SWAPCHAIN_CAP;
 	if (output->swapchain != NULL && output->swapchain->width == width &&
 			output->swapchain->height == height &&
+			output->swapchain->len == depth &&
+			output->swapchain->strict == output->swapchain_strict &&
 			output->swapchain->format->format == format->format &&
-			(allow_modifiers || output->swapchain->format->len == 0)) {
+			keep_modifiers) {
 		// no change, keep existing swapchain
 		free(format);
 		return true;
 	}
 
+	if (modifiers == OUTPUT_SWAPCHAIN_MODIFIERS_PREFERRED) {
+		// Compressed and tiled buffers save memory bandwidth during both
+		// rendering and scan-out
+		struct wlr_drm_format *preferred =
+			wlr_drm_format_pick_preferred(format);
+		free(format);
+		if (preferred == NULL) {
+			return false;
+		}
+		format = preferred;
+	}
+
 	wlr_log(WLR_DEBUG, "Choosing primary buffer format 0x%"PRIX32" for output '%s'",
 		format->format, output->name);
 
-	if (!allow_modifiers && (format->len != 1 || format->modifiers[0] != DRM_FORMAT_MOD_LINEAR)) {
+	if (modifiers == OUTPUT_SWAPCHAIN_MODIFIERS_NONE && (format->len != 1 || format->modifiers[0] != DRM_FORMAT_MOD_LINEAR)) {
 		if (!wlr_drm_format_has(format, DRM_FORMAT_MOD_INVALID)) {
 			wlr_log(WLR_DEBUG, "Implicit modifiers not supported");
 			free(format);
@@ -91,6 +135,7 @@ static bool output_create_swapchain(struct wlr_output *output,
 		wlr_log(WLR_ERROR, "Failed to create output swapchain");
 		return false;
 	}
+	wlr_swapchain_set_depth(swapchain, depth, output->swapchain_strict);
 
 	wlr_swapchain_destroy(output->swapchain);
 	output->swapchain = swapchain;
@@ -98,11 +143,37 @@ static bool output_create_swapchain(struct wlr_output *output,
 	return true;
 }
 
+void wlr_output_set_swapchain_depth(struct wlr_output *output, int depth,
+		bool strict) {
+	assert(depth >= 2 && depth <= WLR_SWAPCHAIN_CAP);
+	if (output->swapchain_depth == depth &&
+			output->swapchain_strict == strict) {
+		return;
+	}
+	// The swapchain is re-created with the new configuration on the next
+	// frame
+	output->swapchain_depth = depth;
+	output->swapchain_strict = strict;
+}
+
+void wlr_output_trim(struct wlr_output *output, enum wlr_trim_level level) {
+	// Disabled outputs have already released their buffers
+	output_cursor_buffer_cache_finish(output);
+	if (output->cursor_buffer_pool != NULL) {
+		wlr_buffer_pool_trim(output->cursor_buffer_pool, 0);
+	}
+
+	if (level >= WLR_TRIM_CRITICAL && output->swapchain != NULL) {
+		wlr_swapchain_trim(output->swapchain);
+	}
+}
+
 static bool output_attach_back_buffer(struct wlr_output *output,
 		const struct wlr_output_state *state, int *buffer_age) {
 	assert(output->back_buffer == NULL);
 
-	if (!output_create_swapchain(output, state, true)) {
+	if (!output_create_swapchain(output, state,
+			OUTPUT_SWAPCHAIN_MODIFIERS_PREFERRED)) {
 		return false;
 	}
 
@@ -121,6 +192,7 @@ static bool output_attach_back_buffer(struct wlr_output *output,
 	}
 
 	output->back_buffer = buffer;
+	output_arm_render_timer(output);
 	return true;
 }
 
@@ -134,10 +206,61 @@ void output_clear_back_buffer(struct wlr_output *output) {
 
 	renderer_bind_buffer(renderer, NULL);
 
+	// Don't measure unrelated rendering if nothing has been rendered
+	if (renderer->timer != NULL &&
+			renderer->timer == output->render_timers[output->next_render_timer]) {
+		wlr_renderer_set_timer(renderer, NULL);
+	}
+
 	wlr_buffer_unlock(output->back_buffer);
 	output->back_buffer = NULL;
 }
 
+void output_arm_render_timer(struct wlr_output *output) {
+	size_t i = output->next_render_timer;
+	if (output->render_timers[i] == NULL) {
+		output->render_timers[i] = wlr_render_timer_create(output->renderer);
+		if (output->render_timers[i] == NULL) {
+			return;
+		}
+	}
+	wlr_renderer_set_timer(output->renderer, output->render_timers[i]);
+}
+
+void output_poll_render_time(struct wlr_output *output) {
+	// The timer attached for the committed frame has been used, move on
+	size_t armed = output->next_render_timer;
+	output->next_render_timer = (armed + 1) % WLR_OUTPUT_RENDER_TIMERS;
+
+	// Look for the most recent result, starting at the committed frame
+	for (size_t n = 0; n < WLR_OUTPUT_RENDER_TIMERS; ++n) {
+		size_t i = (armed + WLR_OUTPUT_RENDER_TIMERS - n) %
+			WLR_OUTPUT_RENDER_TIMERS;
+		if (output->render_timers[i] == NULL) {
+			continue;
+		}
+		int64_t duration =
+			wlr_render_timer_get_duration_ns(output->render_timers[i]);
+		if (duration >= 0) {
+			output->render_time = duration;
+			return;
+		}
+	}
+}
+
+void output_render_timing_finish(struct wlr_output *output) {
+	for (size_t i = 0; i < WLR_OUTPUT_RENDER_TIMERS; ++i) {
+		if (output->render_timers[i] == NULL) {
+			continue;
+		}
+		if (output->renderer->timer == output->render_timers[i]) {
+			wlr_renderer_set_timer(output->renderer, NULL);
+		}
+		wlr_render_timer_destroy(output->render_timers[i]);
+		output->render_timers[i] = NULL;
+	}
+}
+
 static bool output_attach_render(struct wlr_output *output,
 		struct wlr_output_state *state, int *buffer_age) {
 	if (!output_attach_back_buffer(output, state, buffer_age)) {
@@ -227,6 +350,29 @@ bool output_ensure_buffer(struct wlr_output *output,
 
 	output_clear_back_buffer(output);
 
+	// The compressed or tiled modifiers may not work with this mode, try all
+	// of the modifiers supported by the output
+	struct wlr_swapchain *prev_swapchain = output->swapchain;
+	if (!output_create_swapchain(output, state,
+			OUTPUT_SWAPCHAIN_MODIFIERS_ANY)) {
+		return false;
+	}
+	if (output->swapchain != prev_swapchain) {
+		wlr_log(WLR_DEBUG, "Output modeset test failed, retrying with "
+			"all modifiers");
+
+		if (!output_attach_empty_back_buffer(output, state)) {
+			return false;
+		}
+
+		if (output_test_with_back_buffer(output, state)) {
+			*new_back_buffer = true;
+			return true;
+		}
+
+		output_clear_back_buffer(output);
+	}
+
 	if (output->swapchain->format->len == 0) {
 		return false;
 	}
@@ -235,7 +381,8 @@ bool output_ensure_buffer(struct wlr_output *output,
 	// modifiers to see if that makes a difference.
 	wlr_log(WLR_DEBUG, "Output modeset test failed, retrying without modifiers");
 
-	if (!output_create_swapchain(output, state, false)) {
+	if (!output_create_swapchain(output, state,
+			OUTPUT_SWAPCHAIN_MODIFIERS_NONE)) {
 		return false;
 	}
 
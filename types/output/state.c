@@ -1,3 +1,4 @@
+#include <string.h>
 #include "types/wlr_output.h"
 
 void wlr_output_state_set_enabled(struct wlr_output_state *state,
@@ -50,3 +51,44 @@ void wlr_output_state_set_subpixel(struct wlr_output_state *state,
 	state->committed |= WLR_OUTPUT_STATE_SUBPIXEL;
 	state->subpixel = subpixel;
 }
+
+void wlr_output_state_set_content_type(struct wlr_output_state *state,
+		enum wlr_output_content_type content_type) {
+	state->committed |= WLR_OUTPUT_STATE_CONTENT_TYPE;
+	state->content_type = content_type;
+}
+
+void wlr_output_state_set_background_color(struct wlr_output_state *state,
+		const float color[static 4]) {
+	state->committed |= WLR_OUTPUT_STATE_BACKGROUND_COLOR;
+	memcpy(state->background_color, color, sizeof(state->background_color));
+	state->background_color[3] = 1;
+}
+
+void wlr_output_state_set_layers(struct wlr_output_state *state,
+		struct wlr_output_layer_state *layers, size_t layers_len) {
+	state->committed |= WLR_OUTPUT_STATE_LAYERS;
+	state->layers = layers;
+	state->layers_len = layers_len;
+}
+
+void wlr_output_state_set_in_fence(struct wlr_output_state *state, int fd) {
+	state->committed |= WLR_OUTPUT_STATE_IN_FENCE;
+	state->in_fence_fd = fd;
+}
+
+void wlr_output_state_set_buffer_geometry(struct wlr_output_state *state,
+		const struct wlr_fbox *src_box, const struct wlr_box *dst_box,
+		enum wl_output_transform transform) {
+	state->committed |= WLR_OUTPUT_STATE_BUFFER_GEOMETRY;
+	state->buffer_src_box = src_box != NULL ?
+		*src_box : (struct wlr_fbox){0};
+	state->buffer_dst_box = dst_box != NULL ? *dst_box : (struct wlr_box){0};
+	state->buffer_transform = transform;
+}
+
+void wlr_output_state_set_capture_buffer(struct wlr_output_state *state,
+		struct wlr_buffer *buffer) {
+	state->committed |= WLR_OUTPUT_STATE_CAPTURE;
+	state->capture_buffer = buffer;
+}
@@ -33,6 +33,8 @@ static void scene_layer_surface_handle_layer_surface_unmap(
 	struct wlr_scene_layer_surface_v1 *scene_layer_surface =
 		wl_container_of(listener, scene_layer_surface, layer_surface_unmap);
 	wlr_scene_node_set_enabled(&scene_layer_surface->tree->node, false);
+	// Clients need a new initial configure once unmapped
+	scene_layer_surface->arranged.valid = false;
 }
 
 static void layer_surface_exclusive_zone(
@@ -68,12 +70,48 @@ static void layer_surface_exclusive_zone(
 	}
 }
 
+static bool box_equal(const struct wlr_box *a, const struct wlr_box *b) {
+	return a->x == b->x && a->y == b->y &&
+		a->width == b->width && a->height == b->height;
+}
+
+bool wlr_scene_layer_surface_v1_needs_configure(
+		const struct wlr_scene_layer_surface_v1 *scene_layer_surface) {
+	const struct wlr_layer_surface_v1_state *state =
+		&scene_layer_surface->layer_surface->current;
+	return !scene_layer_surface->arranged.valid ||
+		scene_layer_surface->arranged.anchor != state->anchor ||
+		scene_layer_surface->arranged.exclusive_zone != state->exclusive_zone ||
+		scene_layer_surface->arranged.margin.top != state->margin.top ||
+		scene_layer_surface->arranged.margin.right != state->margin.right ||
+		scene_layer_surface->arranged.margin.bottom != state->margin.bottom ||
+		scene_layer_surface->arranged.margin.left != state->margin.left ||
+		scene_layer_surface->arranged.desired_width != state->desired_width ||
+		scene_layer_surface->arranged.desired_height != state->desired_height ||
+		scene_layer_surface->arranged.layer != state->layer;
+}
+
 void wlr_scene_layer_surface_v1_configure(
 		struct wlr_scene_layer_surface_v1 *scene_layer_surface,
 		const struct wlr_box *full_area, struct wlr_box *usable_area) {
 	struct wlr_layer_surface_v1 *layer_surface =
 		scene_layer_surface->layer_surface;
 	struct wlr_layer_surface_v1_state *state = &layer_surface->current;
+	struct wlr_box *arranged_box = &scene_layer_surface->arranged.box;
+
+	if (!wlr_scene_layer_surface_v1_needs_configure(scene_layer_surface) &&
+			box_equal(&scene_layer_surface->arranged.full_area, full_area) &&
+			box_equal(&scene_layer_surface->arranged.usable_area,
+			usable_area)) {
+		// Keep the position in case the node was moved meanwhile
+		wlr_scene_node_set_position(&scene_layer_surface->tree->node,
+			arranged_box->x, arranged_box->y);
+		*usable_area = scene_layer_surface->arranged.next_usable_area;
+		return;
+	}
+
+	scene_layer_surface->arranged.full_area = *full_area;
+	scene_layer_surface->arranged.usable_area = *usable_area;
 
 	// If the exclusive zone is set to -1, the layer surface will use the
 	// full area of the output, otherwise it is constrained to the
@@ -128,6 +166,19 @@ void wlr_scene_layer_surface_v1_configure(
 	if (state->exclusive_zone > 0) {
 		layer_surface_exclusive_zone(state, usable_area);
 	}
+
+	scene_layer_surface->arranged.valid = true;
+	scene_layer_surface->arranged.anchor = state->anchor;
+	scene_layer_surface->arranged.exclusive_zone = state->exclusive_zone;
+	scene_layer_surface->arranged.margin.top = state->margin.top;
+	scene_layer_surface->arranged.margin.right = state->margin.right;
+	scene_layer_surface->arranged.margin.bottom = state->margin.bottom;
+	scene_layer_surface->arranged.margin.left = state->margin.left;
+	scene_layer_surface->arranged.desired_width = state->desired_width;
+	scene_layer_surface->arranged.desired_height = state->desired_height;
+	scene_layer_surface->arranged.layer = state->layer;
+	scene_layer_surface->arranged.box = box;
+	scene_layer_surface->arranged.next_usable_area = *usable_area;
 }
 
 struct wlr_scene_layer_surface_v1 *wlr_scene_layer_surface_v1_create(
@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+#include "types/wlr_scene.h"
+
+/**
+ * Composites the frames of a scene output in a dedicated thread, so that a
+ * slow output doesn't delay the frames of the others.
+ *
+ * The scene is walked and the frame recorded on the main thread, the pixman
+ * renderer turning the frame into a list of self-contained draws. There is at
+ * most one frame in flight: it is handed over through an atomic slot in each
+ * direction, the receiving side being woken up by an eventfd. The thread
+ * never calls into wlroots, it only composites.
+ */
+struct scene_render_thread {
+	struct wlr_scene_output *scene_output;
+
+	pthread_t thread;
+	int stop_fd; // written to by the main thread to stop the render thread
+	int wake_fd; // written to by the main thread when a frame is queued
+	int done_fd; // written to by the render thread when a frame is composited
+	struct wl_event_source *done_source;
+
+	_Atomic(struct wlr_pixman_frame *) queued;
+	_Atomic(struct wlr_pixman_frame *) composited;
+	struct wlr_pixman_frame *in_flight; // owned by the main thread
+};
+
+static void *render_thread_run(void *data) {
+	struct scene_render_thread *thread = data;
+
+	struct pollfd fds[] = {
+		{ .fd = thread->wake_fd, .events = POLLIN },
+		{ .fd = thread->stop_fd, .events = POLLIN },
+	};
+	while (true) {
+		if (poll(fds, sizeof(fds) / sizeof(fds[0]), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (fds[1].revents != 0) {
+			break;
+		}
+
+		uint64_t count;
+		if (read(thread->wake_fd, &count, sizeof(count)) < 0 &&
+				errno != EAGAIN) {
+			break;
+		}
+		struct wlr_pixman_frame *frame = atomic_exchange(&thread->queued, NULL);
+		if (frame == NULL) {
+			continue;
+		}
+
+		pixman_frame_composite(frame);
+		atomic_store(&thread->composited, frame);
+
+		uint64_t one = 1;
+		if (write(thread->done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int handle_done_fd_readable(int fd, uint32_t mask, void *data) {
+	struct scene_render_thread *thread = data;
+
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		wlr_log_errno(WLR_ERROR, "Failed to read from render thread eventfd");
+	}
+
+	struct wlr_pixman_frame *frame = atomic_exchange(&thread->composited, NULL);
+	if (frame == NULL) {
+		return 0;
+	}
+	assert(frame == thread->in_flight);
+	thread->in_flight = NULL;
+	pixman_frame_destroy(frame);
+
+	// May destroy the thread
+	scene_output_handle_frame_composited(thread->scene_output);
+	return 0;
+}
+
+struct scene_render_thread *scene_render_thread_create(
+		struct wlr_scene_output *scene_output) {
+	struct scene_render_thread *thread = calloc(1, sizeof(*thread));
+	if (thread == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	thread->scene_output = scene_output;
+
+	thread->stop_fd = eventfd(0, EFD_CLOEXEC);
+	thread->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thread->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->stop_fd < 0 || thread->wake_fd < 0 || thread->done_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "eventfd failed");
+		goto error;
+	}
+
+	struct wl_event_loop *event_loop =
+		wl_display_get_event_loop(scene_output->output->display);
+	thread->done_source = wl_event_loop_add_fd(event_loop, thread->done_fd,
+		WL_EVENT_READABLE, handle_done_fd_readable, thread);
+	if (thread->done_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create render thread event source");
+		goto error;
+	}
+
+	int ret = pthread_create(&thread->thread, NULL, render_thread_run, thread);
+	if (ret != 0) {
+		wlr_log(WLR_ERROR, "pthread_create failed: %s", strerror(ret));
+		goto error;
+	}
+
+	wlr_log(WLR_INFO, "Compositing output %s in a dedicated thread",
+		scene_output->output->name);
+	return thread;
+
+error:
+	if (thread->done_source != NULL) {
+		wl_event_source_remove(thread->done_source);
+	}
+	if (thread->stop_fd >= 0) {
+		close(thread->stop_fd);
+	}
+	if (thread->wake_fd >= 0) {
+		close(thread->wake_fd);
+	}
+	if (thread->done_fd >= 0) {
+		close(thread->done_fd);
+	}
+	free(thread);
+	return NULL;
+}
+
+void scene_render_thread_destroy(struct scene_render_thread *thread) {
+	if (thread == NULL) {
+		return;
+	}
+
+	uint64_t one = 1;
+	if (write(thread->stop_fd, &one, sizeof(one)) < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to stop render thread");
+	}
+	pthread_join(thread->thread, NULL);
+
+	// The thread may have stopped before picking up the last frame
+	struct wlr_pixman_frame *frame = atomic_exchange(&thread->queued, NULL);
+	if (frame != NULL) {
+		pixman_frame_composite(frame);
+	}
+	pixman_frame_destroy(thread->in_flight);
+
+	wl_event_source_remove(thread->done_source);
+	close(thread->stop_fd);
+	close(thread->wake_fd);
+	close(thread->done_fd);
+	free(thread);
+}
+
+bool scene_render_thread_busy(struct scene_render_thread *thread) {
+	return thread->in_flight != NULL;
+}
+
+void scene_render_thread_submit(struct scene_render_thread *thread,
+		struct wlr_pixman_frame *frame) {
+	assert(thread->in_flight == NULL);
+	thread->in_flight = frame;
+	atomic_store(&thread->queued, frame);
+
+	uint64_t one = 1;
+	if (write(thread->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		wlr_log_errno(WLR_ERROR, "Failed to wake up render thread");
+		// Composite on the main thread instead, unless the thread has
+		// picked up the frame anyways
+		if (atomic_exchange(&thread->queued, NULL) == frame) {
+			pixman_frame_composite(frame);
+			atomic_store(&thread->composited, frame);
+			if (write(thread->done_fd, &one, sizeof(one)) < 0 &&
+					errno != EAGAIN) {
+				wlr_log_errno(WLR_ERROR,
+					"Failed to write to render thread eventfd");
+			}
+		}
+	}
+}
+
+void scene_render_thread_wait(struct scene_render_thread *thread) {
+	if (thread->in_flight != NULL) {
+		pixman_frame_wait(thread->in_flight);
+	}
+}
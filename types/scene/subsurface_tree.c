@@ -16,7 +16,7 @@ struct wlr_scene_subsurface_tree {
 
 	struct wl_listener tree_destroy;
 	struct wl_listener surface_destroy;
-	struct wl_listener surface_commit;
+	struct wl_listener surface_subsurfaces_changed;
 	struct wl_listener surface_new_subsurface;
 
 	struct wlr_scene_subsurface_tree *parent; // NULL for the top-level surface
@@ -43,7 +43,7 @@ static void subsurface_tree_handle_tree_destroy(struct wl_listener *listener,
 	}
 	wl_list_remove(&subsurface_tree->tree_destroy.link);
 	wl_list_remove(&subsurface_tree->surface_destroy.link);
-	wl_list_remove(&subsurface_tree->surface_commit.link);
+	wl_list_remove(&subsurface_tree->surface_subsurfaces_changed.link);
 	wl_list_remove(&subsurface_tree->surface_new_subsurface.link);
 	free(subsurface_tree);
 }
@@ -104,12 +104,10 @@ static void subsurface_tree_handle_surface_destroy(struct wl_listener *listener,
 	wlr_scene_node_destroy(&subsurface_tree->tree->node);
 }
 
-static void subsurface_tree_handle_surface_commit(struct wl_listener *listener,
-		void *data) {
+static void subsurface_tree_handle_surface_subsurfaces_changed(
+		struct wl_listener *listener, void *data) {
 	struct wlr_scene_subsurface_tree *subsurface_tree =
-		wl_container_of(listener, subsurface_tree, surface_commit);
-
-	// TODO: only do this on subsurface order or position change
+		wl_container_of(listener, subsurface_tree, surface_subsurfaces_changed);
 	subsurface_tree_reconfigure(subsurface_tree);
 }
 
@@ -231,8 +229,10 @@ static struct wlr_scene_subsurface_tree *scene_surface_tree_create(
 	subsurface_tree->surface_destroy.notify = subsurface_tree_handle_surface_destroy;
 	wl_signal_add(&surface->events.destroy, &subsurface_tree->surface_destroy);
 
-	subsurface_tree->surface_commit.notify = subsurface_tree_handle_surface_commit;
-	wl_signal_add(&surface->events.commit, &subsurface_tree->surface_commit);
+	subsurface_tree->surface_subsurfaces_changed.notify =
+		subsurface_tree_handle_surface_subsurfaces_changed;
+	wl_signal_add(&surface->events.subsurfaces_changed,
+		&subsurface_tree->surface_subsurfaces_changed);
 
 	subsurface_tree->surface_new_subsurface.notify =
 		subsurface_tree_handle_surface_new_subsurface;
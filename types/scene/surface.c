@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <wlr/types/wlr_content_type_v1.h>
+#include <wlr/types/wlr_fractional_scale_v1.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include "types/wlr_scene.h"
@@ -32,7 +34,7 @@ static void handle_scene_buffer_output_present(
 		struct wlr_presentation *presentation = root->presentation;
 
 		if (presentation) {
-			wlr_presentation_surface_sampled_on_output(
+			wlr_presentation_surface_committed_on_output(
 				presentation, surface->surface, scene_output->output);
 		}
 	}
@@ -47,6 +49,18 @@ static void handle_scene_buffer_frame_done(
 	wlr_surface_send_frame_done(surface->surface, now);
 }
 
+static void handle_scene_buffer_preferred_scale(
+		struct wl_listener *listener, void *data) {
+	struct wlr_scene_surface *surface =
+		wl_container_of(listener, surface, preferred_scale);
+
+	// Keep the last scale while the surface is hidden
+	if (surface->buffer->preferred_scale > 0) {
+		wlr_fractional_scale_v1_notify_scale(surface->surface,
+			surface->buffer->preferred_scale);
+	}
+}
+
 static void scene_surface_handle_surface_destroy(
 		struct wl_listener *listener, void *data) {
 	struct wlr_scene_surface *surface =
@@ -55,6 +69,21 @@ static void scene_surface_handle_surface_destroy(
 	wlr_scene_node_destroy(&surface->buffer->node);
 }
 
+static enum wlr_output_content_type convert_content_type(
+		enum wp_content_type_v1_type type) {
+	switch (type) {
+	case WP_CONTENT_TYPE_V1_TYPE_NONE:
+		return WLR_OUTPUT_CONTENT_TYPE_NONE;
+	case WP_CONTENT_TYPE_V1_TYPE_PHOTO:
+		return WLR_OUTPUT_CONTENT_TYPE_PHOTO;
+	case WP_CONTENT_TYPE_V1_TYPE_VIDEO:
+		return WLR_OUTPUT_CONTENT_TYPE_VIDEO;
+	case WP_CONTENT_TYPE_V1_TYPE_GAME:
+		return WLR_OUTPUT_CONTENT_TYPE_GAME;
+	}
+	return WLR_OUTPUT_CONTENT_TYPE_NONE;
+}
+
 static void set_buffer_with_surface_state(struct wlr_scene_buffer *scene_buffer,
 		struct wlr_surface *surface) {
 	struct wlr_surface_state *state = &surface->current;
@@ -65,6 +94,9 @@ static void set_buffer_with_surface_state(struct wlr_scene_buffer *scene_buffer,
 
 	wlr_scene_buffer_set_dest_size(scene_buffer, state->width, state->height);
 	wlr_scene_buffer_set_transform(scene_buffer, state->transform);
+	wlr_scene_buffer_set_opaque_region(scene_buffer, &surface->opaque_region);
+	wlr_scene_buffer_set_content_type(scene_buffer,
+		convert_content_type(wlr_surface_get_content_type_v1(surface)));
 
 	if (surface->buffer) {
 		wlr_scene_buffer_set_buffer_with_damage(scene_buffer,
@@ -112,6 +144,7 @@ static void surface_addon_destroy(struct wlr_addon *addon) {
 	wl_list_remove(&surface->output_leave.link);
 	wl_list_remove(&surface->output_present.link);
 	wl_list_remove(&surface->frame_done.link);
+	wl_list_remove(&surface->preferred_scale.link);
 	wl_list_remove(&surface->surface_destroy.link);
 	wl_list_remove(&surface->surface_commit.link);
 
@@ -164,6 +197,10 @@ struct wlr_scene_surface *wlr_scene_surface_create(struct wlr_scene_tree *parent
 	surface->frame_done.notify = handle_scene_buffer_frame_done;
 	wl_signal_add(&scene_buffer->events.frame_done, &surface->frame_done);
 
+	surface->preferred_scale.notify = handle_scene_buffer_preferred_scale;
+	wl_signal_add(&scene_buffer->events.preferred_scale,
+		&surface->preferred_scale);
+
 	surface->surface_destroy.notify = scene_surface_handle_surface_destroy;
 	wl_signal_add(&wlr_surface->events.destroy, &surface->surface_destroy);
 
@@ -1,21 +1,36 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wlr/backend.h>
+#include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture_atlas.h>
 #include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
 #include <wlr/types/wlr_matrix.h>
-#include <wlr/types/wlr_output_damage.h>
+#include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_single_pixel_buffer_v1.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
+#include "render/pixman.h"
+#include "render/wlr_renderer.h"
+#include "types/wlr_buffer.h"
 #include "types/wlr_scene.h"
 #include "util/signal.h"
 #include "util/time.h"
+#include "util/trace.h"
 
 #define HIGHLIGHT_DAMAGE_FADEOUT_TIME 250
+// Damage with more rectangles is repainted as the bounding boxes of a few
+// clusters of rectangles
+#define SCENE_OUTPUT_MAX_DAMAGE_RECTS 20
+#define SCENE_OUTPUT_DAMAGE_CLUSTERS 4
+#define SCENE_HIDDEN_FRAME_DONE_INTERVAL 1000 // ms
+#define SCENE_BUFFER_MAX_TEXTURES 4
 
 static struct wlr_scene_tree *scene_tree_from_node(struct wlr_scene_node *node) {
 	assert(node->type == WLR_SCENE_NODE_TREE);
@@ -48,6 +63,28 @@ struct wlr_scene *scene_node_get_root(struct wlr_scene_node *node) {
 	return (struct wlr_scene *)tree;
 }
 
+// Must be called whenever a node is added, removed, enabled, disabled, moved,
+// resized or restacked, so that the bounding boxes of its ancestors and the
+// render lists of the outputs get recomputed.
+static void scene_node_invalidate(struct wlr_scene_node *node) {
+	if (node->parent == NULL) {
+		// The root node itself
+		return;
+	}
+
+	// If a tree is dirty, all of its ancestors are dirty as well
+	for (struct wlr_scene_tree *tree = node->parent;
+			tree != NULL && !tree->bounds_dirty; tree = tree->node.parent) {
+		tree->bounds_dirty = true;
+	}
+
+	struct wlr_scene *scene = scene_node_get_root(node);
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		scene_output->render_list_dirty = true;
+	}
+}
+
 static void scene_node_init(struct wlr_scene_node *node,
 		enum wlr_scene_node_type type, struct wlr_scene_tree *parent) {
 	memset(node, 0, sizeof(*node));
@@ -64,10 +101,160 @@ static void scene_node_init(struct wlr_scene_node *node,
 	}
 
 	wlr_addon_set_init(&node->addons);
+
+	scene_node_invalidate(node);
 }
 
 static void scene_node_damage_whole(struct wlr_scene_node *node);
 
+static void scene_output_damage(struct wlr_scene_output *scene_output,
+		const pixman_region32_t *damage) {
+	if (wlr_damage_ring_add(&scene_output->damage_ring, damage)) {
+		wlr_output_schedule_frame(scene_output->output);
+	}
+}
+
+static void scene_output_damage_whole(struct wlr_scene_output *scene_output) {
+	wlr_damage_ring_add_whole(&scene_output->damage_ring);
+	wlr_output_schedule_frame(scene_output->output);
+}
+
+/**
+ * Add the pending layout damage to every output. This is done once per event
+ * loop iteration and before an output renders, so that the cost of damaging
+ * the scene doesn't depend on the number of outputs.
+ */
+static void scene_flush_damage(struct wlr_scene *scene) {
+	if (scene->pending_damage_idle != NULL) {
+		wl_event_source_remove(scene->pending_damage_idle);
+		scene->pending_damage_idle = NULL;
+	}
+	if (!pixman_region32_not_empty(&scene->pending_damage)) {
+		return;
+	}
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		// Round up, the last layout pixel may be partially visible
+		struct wlr_output *output = scene_output->output;
+		int width, height;
+		wlr_output_transformed_resolution(output, &width, &height);
+		pixman_region32_intersect_rect(&damage, &scene->pending_damage,
+			scene_output->x, scene_output->y,
+			ceil(width / output->scale), ceil(height / output->scale));
+		if (!pixman_region32_not_empty(&damage)) {
+			continue;
+		}
+		pixman_region32_translate(&damage, -scene_output->x, -scene_output->y);
+		wlr_region_scale(&damage, &damage, scene_output->output->scale);
+		scene_output_damage(scene_output, &damage);
+	}
+	pixman_region32_fini(&damage);
+	pixman_region32_clear(&scene->pending_damage);
+}
+
+static void scene_handle_pending_damage_idle(void *data) {
+	struct wlr_scene *scene = data;
+	scene->pending_damage_idle = NULL;
+	scene_flush_damage(scene);
+}
+
+static void scene_schedule_damage_flush(struct wlr_scene *scene) {
+	if (scene->pending_damage_idle != NULL) {
+		return;
+	}
+	struct wlr_scene_output *scene_output =
+		wl_container_of(scene->outputs.next, scene_output, link);
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(scene_output->output->display);
+	scene->pending_damage_idle = wl_event_loop_add_idle(loop,
+		scene_handle_pending_damage_idle, scene);
+	if (scene->pending_damage_idle == NULL) {
+		wlr_log(WLR_ERROR, "Failed to schedule scene damage");
+		scene_flush_damage(scene);
+	}
+}
+
+/**
+ * Damage the outputs showing a region in layout coordinates.
+ */
+static void scene_damage_outputs(struct wlr_scene *scene,
+		const pixman_region32_t *damage) {
+	if (wl_list_empty(&scene->outputs) || !pixman_region32_not_empty(damage)) {
+		return;
+	}
+	pixman_region32_union(&scene->pending_damage, &scene->pending_damage,
+		damage);
+	scene_schedule_damage_flush(scene);
+}
+
+static void scene_damage_outputs_box(struct wlr_scene *scene,
+		const struct wlr_box *box) {
+	if (wl_list_empty(&scene->outputs) || wlr_box_empty(box)) {
+		return;
+	}
+	pixman_region32_union_rect(&scene->pending_damage, &scene->pending_damage,
+		box->x, box->y, box->width, box->height);
+	scene_schedule_damage_flush(scene);
+}
+
+/**
+ * Damage tracking for the renders of a node with
+ * wlr_scene_node_render_to_buffer(), attached to the node.
+ */
+struct scene_render_cache {
+	struct wlr_scene_node *node;
+	struct wl_list link; // wlr_scene.render_caches
+	float scale;
+	struct wlr_damage_ring damage_ring; // in buffer-local coordinates
+
+	struct wlr_addon addon;
+};
+
+static bool scene_node_is_descendant(struct wlr_scene_node *node,
+		struct wlr_scene_node *ancestor) {
+	for (; node != NULL; node = node->parent ? &node->parent->node : NULL) {
+		if (node == ancestor) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Add damage in layout coordinates to the render caches. If the damage comes
+ * from a single node, caches of unrelated sub-trees are left alone.
+ */
+static void scene_damage_render_caches(struct wlr_scene *scene,
+		struct wlr_scene_node *node, const pixman_region32_t *damage) {
+	if (wl_list_empty(&scene->render_caches)) {
+		return;
+	}
+
+	pixman_region32_t cache_damage;
+	pixman_region32_init(&cache_damage);
+	struct scene_render_cache *cache;
+	wl_list_for_each(cache, &scene->render_caches, link) {
+		if (node != NULL && !scene_node_is_descendant(node, cache->node)) {
+			continue;
+		}
+
+		int lx, ly;
+		if (!wlr_scene_node_coords(cache->node, &lx, &ly)) {
+			// The whole node is damaged when it's enabled again
+			continue;
+		}
+
+		pixman_region32_copy(&cache_damage, damage);
+		pixman_region32_translate(&cache_damage, -lx, -ly);
+		wlr_region_scale(&cache_damage, &cache_damage, cache->scale);
+		wlr_damage_ring_add(&cache->damage_ring, &cache_damage);
+	}
+	pixman_region32_fini(&cache_damage);
+}
+
 struct highlight_region {
 	pixman_region32_t region;
 	struct timespec when;
@@ -80,6 +267,55 @@ static void highlight_region_destroy(struct highlight_region *damage) {
 	free(damage);
 }
 
+struct scene_buffer_texture {
+	struct wl_list link; // wlr_scene_buffer.textures
+	struct wlr_buffer *buffer;
+	struct wlr_renderer *renderer;
+	struct wlr_texture *texture;
+	// Non-NULL if the texture is shared, see wlr_scene_set_texture_atlas()
+	struct wlr_texture_atlas_region *region;
+
+	struct wl_listener buffer_destroy;
+	struct wl_listener renderer_destroy;
+};
+
+static void scene_buffer_texture_destroy(struct scene_buffer_texture *entry) {
+	wl_list_remove(&entry->link);
+	wl_list_remove(&entry->buffer_destroy.link);
+	wl_list_remove(&entry->renderer_destroy.link);
+	if (entry->region != NULL) {
+		wlr_texture_atlas_region_destroy(entry->region);
+	} else {
+		wlr_texture_destroy(entry->texture);
+	}
+	free(entry);
+}
+
+static void scene_buffer_texture_handle_buffer_destroy(
+		struct wl_listener *listener, void *data) {
+	struct scene_buffer_texture *entry =
+		wl_container_of(listener, entry, buffer_destroy);
+	scene_buffer_texture_destroy(entry);
+}
+
+static void scene_buffer_texture_handle_renderer_destroy(
+		struct wl_listener *listener, void *data) {
+	struct scene_buffer_texture *entry =
+		wl_container_of(listener, entry, renderer_destroy);
+	scene_buffer_texture_destroy(entry);
+}
+
+// Drops the textures of the buffer, or all of them if NULL
+static void scene_buffer_clear_textures(struct wlr_scene_buffer *scene_buffer,
+		struct wlr_buffer *buffer) {
+	struct scene_buffer_texture *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &scene_buffer->textures, link) {
+		if (buffer == NULL || entry->buffer == buffer) {
+			scene_buffer_texture_destroy(entry);
+		}
+	}
+}
+
 void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	if (node == NULL) {
 		return;
@@ -107,8 +343,20 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 			}
 		}
 
-		wlr_texture_destroy(scene_buffer->texture);
+		// Don't emit output_present for a commit still in flight
+		struct wlr_scene_output *scene_output;
+		wl_list_for_each(scene_output, &scene->outputs, link) {
+			struct wlr_scene_buffer **present;
+			wl_array_for_each(present, &scene_output->present_buffers) {
+				if (*present == scene_buffer) {
+					*present = NULL;
+				}
+			}
+		}
+
+		scene_buffer_clear_textures(scene_buffer, NULL);
 		wlr_buffer_unlock(scene_buffer->buffer);
+		pixman_region32_fini(&scene_buffer->opaque_region);
 	} else if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = scene_tree_from_node(node);
 
@@ -125,6 +373,10 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 			}
 
 			wl_list_remove(&scene->presentation_destroy.link);
+			wl_list_remove(&scene->linux_dmabuf_v1_destroy.link);
+			wl_list_remove(&scene->texture_atlas_destroy.link);
+			pixman_region32_fini(&scene->update_damage);
+			pixman_region32_fini(&scene->pending_damage);
 		} else {
 			assert(node->parent);
 		}
@@ -136,6 +388,8 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 		}
 	}
 
+	scene_node_invalidate(node);
+
 	wlr_addon_set_finish(&node->addons);
 	wl_list_remove(&node->link);
 	free(node);
@@ -158,7 +412,13 @@ struct wlr_scene *wlr_scene_create(void) {
 
 	wl_list_init(&scene->outputs);
 	wl_list_init(&scene->presentation_destroy.link);
+	wl_list_init(&scene->linux_dmabuf_v1_destroy.link);
+	wl_list_init(&scene->texture_atlas_destroy.link);
 	wl_list_init(&scene->damage_highlight_regions);
+	wl_list_init(&scene->render_caches);
+	scene->hidden_frame_done_interval = SCENE_HIDDEN_FRAME_DONE_INTERVAL;
+	pixman_region32_init(&scene->update_damage);
+	pixman_region32_init(&scene->pending_damage);
 
 	char *debug_damage = getenv("WLR_SCENE_DEBUG_DAMAGE");
 	if (debug_damage) {
@@ -176,6 +436,13 @@ struct wlr_scene *wlr_scene_create(void) {
 		scene->debug_damage_option = WLR_SCENE_DEBUG_DAMAGE_NONE;
 	}
 
+	char *debug_scanout = getenv("WLR_SCENE_DEBUG_SCANOUT");
+	scene->debug_scanout = debug_scanout && strcmp(debug_scanout, "1") == 0;
+	if (scene->debug_scanout) {
+		wlr_log(WLR_INFO, "WLR_SCENE_DEBUG_SCANOUT set, "
+			"showing direct scan-out failures");
+	}
+
 	return scene;
 }
 
@@ -193,6 +460,96 @@ struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent) {
 
 static void scene_node_get_size(struct wlr_scene_node *node, int *lx, int *ly);
 
+static void scene_buffer_set_dmabuf_feedback(struct wlr_scene *scene,
+		struct wlr_scene_buffer *scene_buffer,
+		struct wlr_output *scanout_output) {
+	if (scene->linux_dmabuf_v1 == NULL ||
+			scene_buffer->dmabuf_feedback_output == scanout_output) {
+		return;
+	}
+
+	struct wlr_scene_surface *scene_surface =
+		wlr_scene_surface_from_buffer(scene_buffer);
+	if (scene_surface == NULL) {
+		return;
+	}
+
+	if (!wlr_linux_dmabuf_v1_set_surface_scanout_feedback(
+			scene->linux_dmabuf_v1, scene_surface->surface, scanout_output)) {
+		wlr_log(WLR_ERROR, "Failed to send DMA-BUF feedback");
+		return;
+	}
+	scene_buffer->dmabuf_feedback_output = scanout_output;
+}
+
+static void scene_schedule_hidden_frame_done(struct wlr_scene *scene) {
+	if (scene->hidden_frame_done_timer == NULL ||
+			scene->hidden_frame_done_interval <= 0 ||
+			scene->hidden_frame_done_scheduled) {
+		return;
+	}
+	wl_event_source_timer_update(scene->hidden_frame_done_timer,
+		scene->hidden_frame_done_interval);
+	scene->hidden_frame_done_scheduled = true;
+}
+
+static bool scene_buffer_is_hidden(struct wlr_scene_buffer *scene_buffer) {
+	return scene_buffer->primary_output == NULL || scene_buffer->occluded;
+}
+
+// Returns true if some buffers are still hidden
+static bool scene_node_send_hidden_frame_done(struct wlr_scene_node *node,
+		struct timespec *now) {
+	if (!node->enabled) {
+		return false;
+	}
+
+	bool hidden = false;
+	if (node->type == WLR_SCENE_NODE_BUFFER) {
+		struct wlr_scene_buffer *scene_buffer =
+			wlr_scene_buffer_from_node(node);
+		if (scene_buffer_is_hidden(scene_buffer)) {
+			wlr_scene_buffer_send_frame_done(scene_buffer, now);
+			hidden = true;
+		}
+	} else if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = scene_tree_from_node(node);
+		struct wlr_scene_node *child, *child_tmp;
+		wl_list_for_each_safe(child, child_tmp, &scene_tree->children, link) {
+			if (scene_node_send_hidden_frame_done(child, now)) {
+				hidden = true;
+			}
+		}
+	}
+	return hidden;
+}
+
+static int scene_handle_hidden_frame_done_timer(void *data) {
+	struct wlr_scene *scene = data;
+	scene->hidden_frame_done_scheduled = false;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (scene_node_send_hidden_frame_done(&scene->tree.node, &now)) {
+		scene_schedule_hidden_frame_done(scene);
+	}
+	return 0;
+}
+
+void wlr_scene_set_hidden_frame_done_interval(struct wlr_scene *scene,
+		int interval_ms) {
+	if (interval_ms < 0) {
+		interval_ms = 0;
+	}
+	scene->hidden_frame_done_interval = interval_ms;
+
+	if (scene->hidden_frame_done_timer != NULL) {
+		wl_event_source_timer_update(scene->hidden_frame_done_timer, 0);
+	}
+	scene->hidden_frame_done_scheduled = false;
+	scene_schedule_hidden_frame_done(scene);
+}
+
 // This function must be called whenever the coordinates/dimensions of a scene
 // buffer or scene output change. It is not necessary to call when a scene
 // buffer's node is enabled/disabled or obscured by other nodes.
@@ -203,9 +560,14 @@ static void scene_buffer_update_outputs(struct wlr_scene_buffer *scene_buffer,
 	scene_node_get_size(&scene_buffer->node, &buffer_box.width, &buffer_box.height);
 
 	int largest_overlap = 0;
+	int highest_refresh = 0;
+	bool by_refresh = scene->primary_output_policy ==
+		WLR_SCENE_PRIMARY_OUTPUT_HIGHEST_REFRESH;
+	struct wlr_scene_output *old_primary_output = scene_buffer->primary_output;
 	scene_buffer->primary_output = NULL;
 
 	uint64_t active_outputs = 0;
+	float preferred_scale = 0;
 
 	// let's update the outputs in two steps:
 	//  - the primary outputs
@@ -215,7 +577,8 @@ static void scene_buffer_update_outputs(struct wlr_scene_buffer *scene_buffer,
 	// the middle of a calculation.
 	struct wlr_scene_output *scene_output;
 	wl_list_for_each(scene_output, &scene->outputs, link) {
-		if (scene_output == ignore) {
+		// Buffers only shown on disabled outputs don't need frame events
+		if (scene_output == ignore || !scene_output->output->enabled) {
 			continue;
 		}
 
@@ -231,15 +594,32 @@ static void scene_buffer_update_outputs(struct wlr_scene_buffer *scene_buffer,
 
 		if (intersects) {
 			int overlap = intersection.width * intersection.height;
-			if (overlap > largest_overlap) {
+			// Unknown refresh rates are 0, so they lose against known ones
+			int refresh = by_refresh ? scene_output->output->refresh : 0;
+			if (refresh > highest_refresh ||
+					(refresh == highest_refresh &&
+					overlap > largest_overlap)) {
+				highest_refresh = refresh;
 				largest_overlap = overlap;
 				scene_buffer->primary_output = scene_output;
 			}
 
 			active_outputs |= 1ull << scene_output->index;
+			if (scene_output->output->scale > preferred_scale) {
+				preferred_scale = scene_output->output->scale;
+			}
 		}
 	}
 
+	if (scene_buffer->primary_output != old_primary_output) {
+		// Computed again when the new primary output renders
+		scene_buffer->occluded = false;
+		scene_buffer_set_dmabuf_feedback(scene, scene_buffer, NULL);
+	}
+	if (scene_buffer->primary_output == NULL) {
+		scene_schedule_hidden_frame_done(scene);
+	}
+
 	uint64_t old_active = scene_buffer->active_outputs;
 	scene_buffer->active_outputs = active_outputs;
 
@@ -254,6 +634,11 @@ static void scene_buffer_update_outputs(struct wlr_scene_buffer *scene_buffer,
 			wlr_signal_emit_safe(&scene_buffer->events.output_leave, scene_output);
 		}
 	}
+
+	if (scene_buffer->preferred_scale != preferred_scale) {
+		scene_buffer->preferred_scale = preferred_scale;
+		wlr_signal_emit_safe(&scene_buffer->events.preferred_scale, NULL);
+	}
 }
 
 static void _scene_node_update_outputs(struct wlr_scene_node *node,
@@ -276,11 +661,26 @@ static void _scene_node_update_outputs(struct wlr_scene_node *node,
 static void scene_node_update_outputs(struct wlr_scene_node *node,
 		struct wlr_scene_output *ignore) {
 	struct wlr_scene *scene = scene_node_get_root(node);
+	if (scene->update_depth > 0 && ignore == NULL) {
+		// The whole scene is updated by wlr_scene_commit_update()
+		scene->update_outputs_pending = true;
+		return;
+	}
+
 	int lx, ly;
 	wlr_scene_node_coords(node, &lx, &ly);
 	_scene_node_update_outputs(node, lx, ly, scene, ignore);
 }
 
+void wlr_scene_set_primary_output_policy(struct wlr_scene *scene,
+		enum wlr_scene_primary_output_policy policy) {
+	if (scene->primary_output_policy == policy) {
+		return;
+	}
+	scene->primary_output_policy = policy;
+	scene_node_update_outputs(&scene->tree.node, NULL);
+}
+
 struct wlr_scene_rect *wlr_scene_rect_create(struct wlr_scene_tree *parent,
 		int width, int height, const float color[static 4]) {
 	struct wlr_scene_rect *scene_rect =
@@ -308,6 +708,7 @@ void wlr_scene_rect_set_size(struct wlr_scene_rect *rect, int width, int height)
 	scene_node_damage_whole(&rect->node);
 	rect->width = width;
 	rect->height = height;
+	scene_node_invalidate(&rect->node);
 	scene_node_damage_whole(&rect->node);
 }
 
@@ -333,10 +734,13 @@ struct wlr_scene_buffer *wlr_scene_buffer_create(struct wlr_scene_tree *parent,
 		scene_buffer->buffer = wlr_buffer_lock(buffer);
 	}
 
+	wl_list_init(&scene_buffer->textures);
 	wl_signal_init(&scene_buffer->events.output_enter);
 	wl_signal_init(&scene_buffer->events.output_leave);
 	wl_signal_init(&scene_buffer->events.output_present);
 	wl_signal_init(&scene_buffer->events.frame_done);
+	wl_signal_init(&scene_buffer->events.preferred_scale);
+	pixman_region32_init(&scene_buffer->opaque_region);
 
 	scene_node_damage_whole(&scene_buffer->node);
 
@@ -357,8 +761,8 @@ void wlr_scene_buffer_set_buffer_with_damage(struct wlr_scene_buffer *scene_buff
 			scene_node_damage_whole(&scene_buffer->node);
 		}
 
-		wlr_texture_destroy(scene_buffer->texture);
-		scene_buffer->texture = NULL;
+		// Textures of the previous buffer are kept until it's destroyed, in
+		// case it's displayed again
 		wlr_buffer_unlock(scene_buffer->buffer);
 
 		if (buffer) {
@@ -367,11 +771,15 @@ void wlr_scene_buffer_set_buffer_with_damage(struct wlr_scene_buffer *scene_buff
 			scene_buffer->buffer = NULL;
 		}
 
+		scene_node_invalidate(&scene_buffer->node);
 		scene_node_update_outputs(&scene_buffer->node, NULL);
 
 		if (!damage) {
 			scene_node_damage_whole(&scene_buffer->node);
 		}
+	} else if (damage) {
+		// The contents changed, imported copies are outdated
+		scene_buffer_clear_textures(scene_buffer, buffer);
 	}
 
 	if (!damage) {
@@ -414,17 +822,15 @@ void wlr_scene_buffer_set_buffer_with_damage(struct wlr_scene_buffer *scene_buff
 		box.x, box.y, box.width, box.height);
 
 	struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
-	struct wlr_scene_output *scene_output;
-	wl_list_for_each(scene_output, &scene->outputs, link) {
-		float output_scale = scene_output->output->scale;
-		pixman_region32_t output_damage;
-		pixman_region32_init(&output_damage);
-		wlr_region_scale_xy(&output_damage, &trans_damage,
-			output_scale * scale_x, output_scale * scale_y);
-		pixman_region32_translate(&output_damage,
-			(lx - scene_output->x) * output_scale, (ly - scene_output->y) * output_scale);
-		wlr_output_damage_add(scene_output->damage, &output_damage);
-		pixman_region32_fini(&output_damage);
+	if (!wl_list_empty(&scene->outputs) ||
+			!wl_list_empty(&scene->render_caches)) {
+		pixman_region32_t layout_damage;
+		pixman_region32_init(&layout_damage);
+		wlr_region_scale_xy(&layout_damage, &trans_damage, scale_x, scale_y);
+		pixman_region32_translate(&layout_damage, lx, ly);
+		scene_damage_outputs(scene, &layout_damage);
+		scene_damage_render_caches(scene, &scene_buffer->node, &layout_damage);
+		pixman_region32_fini(&layout_damage);
 	}
 
 	pixman_region32_fini(&trans_damage);
@@ -435,6 +841,15 @@ void wlr_scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	wlr_scene_buffer_set_buffer_with_damage(scene_buffer, buffer, NULL);
 }
 
+void wlr_scene_buffer_set_opaque_region(struct wlr_scene_buffer *scene_buffer,
+		pixman_region32_t *region) {
+	if (region == NULL) {
+		pixman_region32_clear(&scene_buffer->opaque_region);
+	} else {
+		pixman_region32_copy(&scene_buffer->opaque_region, region);
+	}
+}
+
 void wlr_scene_buffer_set_source_box(struct wlr_scene_buffer *scene_buffer,
 		const struct wlr_fbox *box) {
 	struct wlr_fbox *cur = &scene_buffer->src_box;
@@ -449,6 +864,8 @@ void wlr_scene_buffer_set_source_box(struct wlr_scene_buffer *scene_buffer,
 		memset(cur, 0, sizeof(*cur));
 	}
 
+	// Cropped buffers can't be displayed on an output layer as is
+	scene_node_invalidate(&scene_buffer->node);
 	scene_node_damage_whole(&scene_buffer->node);
 }
 
@@ -461,6 +878,7 @@ void wlr_scene_buffer_set_dest_size(struct wlr_scene_buffer *scene_buffer,
 	scene_node_damage_whole(&scene_buffer->node);
 	scene_buffer->dst_width = width;
 	scene_buffer->dst_height = height;
+	scene_node_invalidate(&scene_buffer->node);
 	scene_node_damage_whole(&scene_buffer->node);
 
 	scene_node_update_outputs(&scene_buffer->node, NULL);
@@ -474,31 +892,123 @@ void wlr_scene_buffer_set_transform(struct wlr_scene_buffer *scene_buffer,
 
 	scene_node_damage_whole(&scene_buffer->node);
 	scene_buffer->transform = transform;
+	scene_node_invalidate(&scene_buffer->node);
 	scene_node_damage_whole(&scene_buffer->node);
 
 	scene_node_update_outputs(&scene_buffer->node, NULL);
 }
 
+void wlr_scene_buffer_set_content_type(struct wlr_scene_buffer *scene_buffer,
+		enum wlr_output_content_type content_type) {
+	scene_buffer->content_type = content_type;
+}
+
 void wlr_scene_buffer_send_frame_done(struct wlr_scene_buffer *scene_buffer,
 		struct timespec *now) {
 	wlr_signal_emit_safe(&scene_buffer->events.frame_done, now);
 }
 
+/**
+ * Get the color of buffers holding a single pixel, which are drawn as color
+ * fills without a texture.
+ */
+static bool scene_buffer_get_color(struct wlr_scene_buffer *scene_buffer,
+		float color[static 4]) {
+	struct wlr_buffer *buffer = scene_buffer->buffer;
+	if (buffer == NULL) {
+		return false;
+	}
+	struct wlr_client_buffer *client_buffer = wlr_client_buffer_get(buffer);
+	if (client_buffer != NULL) {
+		return client_buffer_get_color(client_buffer, color);
+	}
+	return wlr_single_pixel_buffer_v1_get_color(buffer, color);
+}
+
+/**
+ * Get the texture of the current buffer for the renderer. If the buffer was
+ * packed into the scene's texture atlas, region is set to its location in the
+ * shared texture.
+ */
 static struct wlr_texture *scene_buffer_get_texture(
-		struct wlr_scene_buffer *scene_buffer, struct wlr_renderer *renderer) {
-	struct wlr_client_buffer *client_buffer =
-		wlr_client_buffer_get(scene_buffer->buffer);
+		struct wlr_scene_buffer *scene_buffer, struct wlr_renderer *renderer,
+		const struct wlr_texture_atlas_region **region) {
+	*region = NULL;
+
+	struct wlr_buffer *buffer = scene_buffer->buffer;
+	struct wlr_client_buffer *client_buffer = wlr_client_buffer_get(buffer);
+	if (client_buffer != NULL && client_buffer->renderer == renderer) {
+		return client_buffer_get_texture(client_buffer);
+	}
+
+	struct scene_buffer_texture *entry;
+	wl_list_for_each(entry, &scene_buffer->textures, link) {
+		if (entry->buffer == buffer && entry->renderer == renderer) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&scene_buffer->textures, &entry->link);
+			*region = entry->region;
+			return entry->texture;
+		}
+	}
+
+	// Only compositor-side buffers are packed, clients buffers may be updated
+	// every frame
+	struct wlr_texture_atlas *atlas =
+		scene_node_get_root(&scene_buffer->node)->texture_atlas;
+	struct wlr_texture_atlas_region *atlas_region = NULL;
+	if (client_buffer == NULL && atlas != NULL &&
+			atlas->renderer == renderer) {
+		atlas_region = wlr_texture_atlas_add_buffer(atlas, buffer);
+	}
+
+	// Client buffers only hold a texture for the compositor's renderer, other
+	// GPUs import the client's buffer
+	struct wlr_buffer *source = buffer;
 	if (client_buffer != NULL) {
-		return client_buffer->texture;
+		source = client_buffer->source;
+		if (source == NULL) {
+			return NULL;
+		}
 	}
 
-	if (scene_buffer->texture != NULL) {
-		return scene_buffer->texture;
+	struct wlr_texture *texture;
+	if (atlas_region != NULL) {
+		texture = atlas_region->texture;
+	} else {
+		texture = wlr_texture_from_buffer(renderer, source);
+		if (texture == NULL) {
+			return NULL;
+		}
 	}
 
-	scene_buffer->texture =
-		wlr_texture_from_buffer(renderer, scene_buffer->buffer);
-	return scene_buffer->texture;
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		if (atlas_region != NULL) {
+			wlr_texture_atlas_region_destroy(atlas_region);
+		} else {
+			wlr_texture_destroy(texture);
+		}
+		return NULL;
+	}
+	entry->buffer = buffer;
+	entry->renderer = renderer;
+	entry->texture = texture;
+	entry->region = atlas_region;
+	entry->buffer_destroy.notify = scene_buffer_texture_handle_buffer_destroy;
+	wl_signal_add(&buffer->events.destroy, &entry->buffer_destroy);
+	entry->renderer_destroy.notify =
+		scene_buffer_texture_handle_renderer_destroy;
+	wl_signal_add(&renderer->events.destroy, &entry->renderer_destroy);
+	wl_list_insert(&scene_buffer->textures, &entry->link);
+
+	if (wl_list_length(&scene_buffer->textures) > SCENE_BUFFER_MAX_TEXTURES) {
+		struct scene_buffer_texture *oldest =
+			wl_container_of(scene_buffer->textures.prev, oldest, link);
+		scene_buffer_texture_destroy(oldest);
+	}
+
+	*region = atlas_region;
+	return texture;
 }
 
 static void scene_node_get_size(struct wlr_scene_node *node,
@@ -561,24 +1071,29 @@ static void _scene_node_damage_whole(struct wlr_scene_node *node,
 	int width, height;
 	scene_node_get_size(node, &width, &height);
 
-	struct wlr_scene_output *scene_output;
-	wl_list_for_each(scene_output, &scene->outputs, link) {
-		struct wlr_box box = {
-			.x = lx - scene_output->x,
-			.y = ly - scene_output->y,
-			.width = width,
-			.height = height,
-		};
-
-		scale_box(&box, scene_output->output->scale);
+	if (scene->update_depth > 0) {
+		if (width > 0 && height > 0) {
+			pixman_region32_union_rect(&scene->update_damage,
+				&scene->update_damage, lx, ly, width, height);
+		}
+		return;
+	}
 
-		wlr_output_damage_add_box(scene_output->damage, &box);
+	if (width > 0 && height > 0 && !wl_list_empty(&scene->render_caches)) {
+		pixman_region32_t damage;
+		pixman_region32_init_rect(&damage, lx, ly, width, height);
+		scene_damage_render_caches(scene, node, &damage);
+		pixman_region32_fini(&damage);
 	}
+
+	struct wlr_box box = { .x = lx, .y = ly, .width = width, .height = height };
+	scene_damage_outputs_box(scene, &box);
 }
 
 static void scene_node_damage_whole(struct wlr_scene_node *node) {
 	struct wlr_scene *scene = scene_node_get_root(node);
-	if (wl_list_empty(&scene->outputs)) {
+	if (wl_list_empty(&scene->outputs) &&
+			wl_list_empty(&scene->render_caches)) {
 		return;
 	}
 
@@ -590,6 +1105,28 @@ static void scene_node_damage_whole(struct wlr_scene_node *node) {
 	_scene_node_damage_whole(node, scene, lx, ly);
 }
 
+void wlr_scene_begin_update(struct wlr_scene *scene) {
+	scene->update_depth++;
+}
+
+void wlr_scene_commit_update(struct wlr_scene *scene) {
+	assert(scene->update_depth > 0);
+	if (--scene->update_depth > 0) {
+		return;
+	}
+
+	if (pixman_region32_not_empty(&scene->update_damage)) {
+		scene_damage_outputs(scene, &scene->update_damage);
+		scene_damage_render_caches(scene, NULL, &scene->update_damage);
+		pixman_region32_clear(&scene->update_damage);
+	}
+
+	if (scene->update_outputs_pending) {
+		scene->update_outputs_pending = false;
+		scene_node_update_outputs(&scene->tree.node, NULL);
+	}
+}
+
 void wlr_scene_node_set_enabled(struct wlr_scene_node *node, bool enabled) {
 	if (node->enabled == enabled) {
 		return;
@@ -598,7 +1135,14 @@ void wlr_scene_node_set_enabled(struct wlr_scene_node *node, bool enabled) {
 	// One of these damage_whole() calls will short-circuit and be a no-op
 	scene_node_damage_whole(node);
 	node->enabled = enabled;
+	scene_node_invalidate(node);
 	scene_node_damage_whole(node);
+
+	if (enabled) {
+		// The node's buffers might not be displayed on any output
+		struct wlr_scene *scene = scene_node_get_root(node);
+		scene_schedule_hidden_frame_done(scene);
+	}
 }
 
 void wlr_scene_node_set_position(struct wlr_scene_node *node, int x, int y) {
@@ -609,6 +1153,7 @@ void wlr_scene_node_set_position(struct wlr_scene_node *node, int x, int y) {
 	scene_node_damage_whole(node);
 	node->x = x;
 	node->y = y;
+	scene_node_invalidate(node);
 	scene_node_damage_whole(node);
 
 	scene_node_update_outputs(node, NULL);
@@ -625,6 +1170,7 @@ void wlr_scene_node_place_above(struct wlr_scene_node *node,
 
 	wl_list_remove(&node->link);
 	wl_list_insert(&sibling->link, &node->link);
+	scene_node_invalidate(node);
 
 	scene_node_damage_whole(node);
 	scene_node_damage_whole(sibling);
@@ -641,6 +1187,7 @@ void wlr_scene_node_place_below(struct wlr_scene_node *node,
 
 	wl_list_remove(&node->link);
 	wl_list_insert(sibling->link.prev, &node->link);
+	scene_node_invalidate(node);
 
 	scene_node_damage_whole(node);
 	scene_node_damage_whole(sibling);
@@ -679,11 +1226,13 @@ void wlr_scene_node_reparent(struct wlr_scene_node *node,
 	}
 
 	scene_node_damage_whole(node);
+	scene_node_invalidate(node);
 
 	wl_list_remove(&node->link);
 	node->parent = new_parent;
 	wl_list_insert(new_parent->children.prev, &node->link);
 
+	scene_node_invalidate(node);
 	scene_node_damage_whole(node);
 
 	scene_node_update_outputs(node, NULL);
@@ -738,13 +1287,79 @@ void wlr_scene_node_for_each_buffer(struct wlr_scene_node *node,
 	scene_node_for_each_scene_buffer(node, 0, 0, user_iterator, user_data);
 }
 
+static void scene_node_get_bounds(struct wlr_scene_node *node,
+		struct wlr_box *box);
+
+static void scene_tree_update_bounds(struct wlr_scene_tree *tree) {
+	if (!tree->bounds_dirty) {
+		return;
+	}
+
+	int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+	bool empty = true;
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &tree->children, link) {
+		if (!child->enabled) {
+			continue;
+		}
+
+		struct wlr_box child_box;
+		scene_node_get_bounds(child, &child_box);
+		if (wlr_box_empty(&child_box)) {
+			continue;
+		}
+
+		child_box.x += child->x;
+		child_box.y += child->y;
+		if (empty) {
+			x1 = child_box.x;
+			y1 = child_box.y;
+			x2 = child_box.x + child_box.width;
+			y2 = child_box.y + child_box.height;
+			empty = false;
+			continue;
+		}
+
+		x1 = child_box.x < x1 ? child_box.x : x1;
+		y1 = child_box.y < y1 ? child_box.y : y1;
+		x2 = child_box.x + child_box.width > x2 ?
+			child_box.x + child_box.width : x2;
+		y2 = child_box.y + child_box.height > y2 ?
+			child_box.y + child_box.height : y2;
+	}
+
+	tree->bounds = (struct wlr_box){
+		.x = x1,
+		.y = y1,
+		.width = x2 - x1,
+		.height = y2 - y1,
+	};
+	tree->bounds_dirty = false;
+}
+
+/**
+ * Get the bounding box of the node and its descendants, relative to the node
+ * position. Disabled descendants are left out.
+ */
+static void scene_node_get_bounds(struct wlr_scene_node *node,
+		struct wlr_box *box) {
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = scene_tree_from_node(node);
+		scene_tree_update_bounds(scene_tree);
+		*box = scene_tree->bounds;
+		return;
+	}
+
+	*box = (struct wlr_box){0};
+	scene_node_get_size(node, &box->width, &box->height);
+}
+
 struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 		double lx, double ly, double *nx, double *ny) {
 	if (!node->enabled) {
 		return NULL;
 	}
 
-	// TODO: optimize by storing a bounding box in each node?
 	lx -= node->x;
 	ly -= node->y;
 
@@ -752,6 +1367,11 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:;
 		struct wlr_scene_tree *scene_tree = scene_tree_from_node(node);
+		scene_tree_update_bounds(scene_tree);
+		if (!wlr_box_contains_point(&scene_tree->bounds, lx, ly)) {
+			break;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each_reverse(child, &scene_tree->children, link) {
 			struct wlr_scene_node *node =
@@ -792,134 +1412,411 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 	return NULL;
 }
 
-static void scissor_output(struct wlr_output *output, pixman_box32_t *rect) {
-	struct wlr_renderer *renderer = output->renderer;
-	assert(renderer);
+struct render_list_entry {
+	struct wlr_scene_node *node;
+	int x, y; // in layout coordinates
+	struct wlr_box box; // in output-buffer-local coordinates
+
+	// Per-frame state, reset by render_list_reset()
+	bool composite; // false if hidden or displayed on an output layer
+	struct wlr_texture *texture; // only for buffer nodes
+	// Single-pixel buffer nodes are drawn as a fill of this color
+	bool fill;
+	float fill_color[4];
+	// Location of the buffer in the texture, NULL if it covers the texture
+	const struct wlr_texture_atlas_region *atlas_region;
+	pixman_region32_t damage;
 
-	struct wlr_box box = {
-		.x = rect->x1,
-		.y = rect->y1,
-		.width = rect->x2 - rect->x1,
-		.height = rect->y2 - rect->y1,
-	};
+	// Matrix of the last texture op, kept across frames while the list isn't
+	// rebuilt and reused as long as its inputs stay the same
+	bool matrix_valid;
+	enum wl_output_transform matrix_transform;
+	float matrix_projection[9];
+	float matrix[9];
+};
 
-	int ow, oh;
-	wlr_output_transformed_resolution(output, &ow, &oh);
+struct render_list_data {
+	struct wlr_scene_output *scene_output;
+	struct wl_array *render_list;
+};
 
-	enum wl_output_transform transform =
-		wlr_output_transform_invert(output->transform);
-	wlr_box_transform(&box, &box, transform, ow, oh);
+static void render_list_iterator(struct wlr_scene_node *node,
+		int x, int y, void *_data) {
+	struct render_list_data *data = _data;
+	struct wlr_output *output = data->scene_output->output;
 
-	wlr_renderer_scissor(renderer, &box);
-}
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		/* Root or tree node has nothing to render itself */
+		return;
+	}
 
-static void render_rect(struct wlr_output *output,
-		pixman_region32_t *output_damage, const float color[static 4],
-		const struct wlr_box *box, const float matrix[static 9]) {
-	struct wlr_renderer *renderer = output->renderer;
-	assert(renderer);
+	struct wlr_box box = {
+		.x = x - data->scene_output->x,
+		.y = y - data->scene_output->y,
+	};
+	scene_node_get_size(node, &box.width, &box.height);
+	scale_box(&box, output->scale);
 
-	pixman_region32_t damage;
-	pixman_region32_init(&damage);
-	pixman_region32_init_rect(&damage, box->x, box->y, box->width, box->height);
-	pixman_region32_intersect(&damage, &damage, output_damage);
+	struct wlr_box output_box = {0};
+	wlr_output_transformed_resolution(output,
+		&output_box.width, &output_box.height);
 
-	int nrects;
-	pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
-	for (int i = 0; i < nrects; ++i) {
-		scissor_output(output, &rects[i]);
-		wlr_render_rect(renderer, box, color, matrix);
+	struct wlr_box intersection;
+	if (!wlr_box_intersection(&intersection, &output_box, &box)) {
+		return;
 	}
 
-	pixman_region32_fini(&damage);
+	struct render_list_entry *entry =
+		wl_array_add(data->render_list, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	*entry = (struct render_list_entry){
+		.node = node,
+		.x = x,
+		.y = y,
+		.box = box,
+	};
+	pixman_region32_init(&entry->damage);
 }
 
-static void render_texture(struct wlr_output *output,
-		pixman_region32_t *output_damage, struct wlr_texture *texture,
-		const struct wlr_fbox *src_box, const struct wlr_box *dst_box,
-		const float matrix[static 9]) {
-	struct wlr_renderer *renderer = output->renderer;
-	assert(renderer);
+static void render_list_finish(struct wl_array *render_list) {
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, render_list) {
+		pixman_region32_fini(&entry->damage);
+	}
+	wl_array_release(render_list);
+}
 
-	struct wlr_fbox default_src_box = {0};
-	if (wlr_fbox_empty(src_box)) {
-		default_src_box.width = texture->width;
-		default_src_box.height = texture->height;
-		src_box = &default_src_box;
+static void render_list_reset(struct wl_array *render_list) {
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, render_list) {
+		entry->composite = true;
+		entry->texture = NULL;
+		entry->fill = false;
+		entry->atlas_region = NULL;
+		pixman_region32_clear(&entry->damage);
 	}
+}
 
-	pixman_region32_t damage;
-	pixman_region32_init(&damage);
-	pixman_region32_init_rect(&damage, dst_box->x, dst_box->y,
-		dst_box->width, dst_box->height);
-	pixman_region32_intersect(&damage, &damage, output_damage);
+static void scene_node_for_each_node(struct wlr_scene_node *node,
+	int lx, int ly, wlr_scene_node_iterator_func_t user_iterator,
+	void *user_data);
 
-	int nrects;
-	pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
-	for (int i = 0; i < nrects; ++i) {
-		scissor_output(output, &rects[i]);
-		wlr_render_subtexture_with_matrix(renderer, texture, src_box, matrix, 1.0);
+/**
+ * Get the flattened list of enabled non-tree nodes intersecting the output, in
+ * rendering order. The list is only rebuilt when the scene-graph or the output
+ * geometry has changed since the last call.
+ */
+static struct wl_array *scene_output_get_render_list(
+		struct wlr_scene_output *scene_output) {
+	struct wl_array *render_list = &scene_output->render_list;
+	if (!scene_output->render_list_dirty) {
+		return render_list;
 	}
 
-	pixman_region32_fini(&damage);
+	// Keep the allocation around, the list usually keeps the same size
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, render_list) {
+		pixman_region32_fini(&entry->damage);
+	}
+	render_list->size = 0;
+
+	struct render_list_data list_data = {
+		.scene_output = scene_output,
+		.render_list = render_list,
+	};
+	scene_node_for_each_node(&scene_output->scene->tree.node, 0, 0,
+		render_list_iterator, &list_data);
+
+	scene_output->render_list_dirty = false;
+	scene_output->layers_dirty = true;
+	return render_list;
 }
 
-struct render_data {
-	struct wlr_scene_output *scene_output;
-	pixman_region32_t *damage;
-};
+/**
+ * Get the opaque region of a node, in output-buffer-local coordinates.
+ */
+static void render_list_entry_get_opaque_region(
+		const struct render_list_entry *entry, float scale,
+		pixman_region32_t *opaque) {
+	struct wlr_scene_node *node = entry->node;
+	const struct wlr_box *box = &entry->box;
+	switch (node->type) {
+	case WLR_SCENE_NODE_TREE:
+		return;
+	case WLR_SCENE_NODE_RECT:;
+		struct wlr_scene_rect *scene_rect = scene_rect_from_node(node);
+		if (scene_rect->color[3] == 1.0) {
+			pixman_region32_union_rect(opaque, opaque,
+				box->x, box->y, box->width, box->height);
+		}
+		return;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+		bool is_opaque = entry->fill ? entry->fill_color[3] == 1.0 :
+			entry->texture != NULL && wlr_texture_is_opaque(entry->texture);
+		if (is_opaque) {
+			pixman_region32_union_rect(opaque, opaque,
+				box->x, box->y, box->width, box->height);
+			return;
+		}
+		if (!pixman_region32_not_empty(&scene_buffer->opaque_region)) {
+			return;
+		}
 
-static void render_node_iterator(struct wlr_scene_node *node,
-		int x, int y, void *_data) {
-	struct render_data *data = _data;
-	struct wlr_scene_output *scene_output = data->scene_output;
+		pixman_region32_t region;
+		pixman_region32_init(&region);
+		wlr_region_scale(&region, &scene_buffer->opaque_region, scale);
+		if (floor(scale) != scale) {
+			// Scaling rounds outwards, so shrink the region to make sure we
+			// never cull pixels which are only partially covered
+			wlr_region_expand(&region, &region, -1);
+		}
+		pixman_region32_translate(&region, box->x, box->y);
+		pixman_region32_intersect_rect(&region, &region,
+			box->x, box->y, box->width, box->height);
+		pixman_region32_union(opaque, opaque, &region);
+		pixman_region32_fini(&region);
+		return;
+	}
+}
+
+/**
+ * Walk the render list front-to-back and compute the damage each entry needs
+ * to repaint, leaving out the parts hidden by opaque nodes above it. Entries
+ * which are completely hidden are left out of composition. The damage which
+ * isn't covered by any opaque node is left in the damage argument.
+ */
+static void render_list_cull(struct wlr_scene_output *scene_output,
+		struct wl_array *render_list, pixman_region32_t *damage) {
 	struct wlr_output *output = scene_output->output;
-	pixman_region32_t *output_damage = data->damage;
 
-	struct wlr_box dst_box = {
-		.x = x,
-		.y = y,
-	};
-	scene_node_get_size(node, &dst_box.width, &dst_box.height);
-	scale_box(&dst_box, output->scale);
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+
+	struct render_list_entry *entries = render_list->data;
+	size_t len = render_list->size / sizeof(*entries);
+	for (size_t i = len; i-- > 0;) {
+		struct render_list_entry *entry = &entries[i];
+		if (!entry->composite) {
+			// Displayed on an output layer
+			if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
+				struct wlr_scene_buffer *scene_buffer =
+					wlr_scene_buffer_from_node(entry->node);
+				if (scene_buffer->primary_output == scene_output) {
+					scene_buffer->occluded = false;
+				}
+			}
+			continue;
+		}
+
+		pixman_region32_t visible;
+		pixman_region32_init_rect(&visible, entry->box.x, entry->box.y,
+			entry->box.width, entry->box.height);
+		pixman_region32_subtract(&visible, &visible, &opaque);
+		bool occluded = !pixman_region32_not_empty(&visible);
+
+		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
+			struct wlr_scene_buffer *scene_buffer =
+				wlr_scene_buffer_from_node(entry->node);
+			if (scene_buffer->primary_output == scene_output) {
+				scene_buffer->occluded = occluded;
+				if (occluded) {
+					scene_schedule_hidden_frame_done(scene_output->scene);
+				}
+			}
+		}
+
+		if (occluded) {
+			pixman_region32_fini(&visible);
+			entry->composite = false;
+			continue;
+		}
+
+		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
+			struct wlr_scene_buffer *scene_buffer =
+				wlr_scene_buffer_from_node(entry->node);
+			entry->fill = scene_buffer_get_color(scene_buffer,
+				entry->fill_color);
+			if (!entry->fill && scene_buffer->buffer != NULL) {
+				entry->texture = scene_buffer_get_texture(scene_buffer,
+					output->renderer, &entry->atlas_region);
+			}
+			if (!entry->fill && entry->texture == NULL) {
+				pixman_region32_fini(&visible);
+				entry->composite = false;
+				continue;
+			}
+		}
+
+		pixman_region32_intersect(&entry->damage, &visible, damage);
+		pixman_region32_fini(&visible);
+
+		render_list_entry_get_opaque_region(entry, output->scale, &opaque);
+	}
+
+	pixman_region32_subtract(damage, damage, &opaque);
+	pixman_region32_fini(&opaque);
+}
+
+/**
+ * Transform damage from output-local to output-buffer-local coordinates, as
+ * expected by the renderer.
+ */
+static void output_damage_to_buffer(struct wlr_output *output,
+		pixman_region32_t *damage) {
+	int ow, oh;
+	wlr_output_transformed_resolution(output, &ow, &oh);
+	wlr_region_transform(damage, damage,
+		wlr_output_transform_invert(output->transform), ow, oh);
+}
+
+static int64_t box_area(const pixman_box32_t *box) {
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+/**
+ * Replace fragmented damage with the bounding boxes of a few clusters of its
+ * rectangles. Every node overlapping the damage is drawn once per rectangle,
+ * so a little overdraw is cheaper than many small draws.
+ *
+ * Rectangles are visited in band order and join the cluster which grows the
+ * least, unless that would add more overdraw than the rectangle's own area
+ * and there is room for another cluster.
+ */
+static void damage_simplify(pixman_region32_t *damage) {
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage,
+		&rects_len);
+	if (rects_len <= SCENE_OUTPUT_MAX_DAMAGE_RECTS) {
+		return;
+	}
+
+	pixman_box32_t clusters[SCENE_OUTPUT_DAMAGE_CLUSTERS];
+	size_t clusters_len = 0;
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+
+		size_t best = 0;
+		int64_t best_growth = INT64_MAX;
+		for (size_t j = 0; j < clusters_len; j++) {
+			const pixman_box32_t *c = &clusters[j];
+			pixman_box32_t merged = {
+				.x1 = c->x1 < rect->x1 ? c->x1 : rect->x1,
+				.y1 = c->y1 < rect->y1 ? c->y1 : rect->y1,
+				.x2 = c->x2 > rect->x2 ? c->x2 : rect->x2,
+				.y2 = c->y2 > rect->y2 ? c->y2 : rect->y2,
+			};
+			int64_t growth = box_area(&merged) - box_area(c);
+			if (growth < best_growth) {
+				best = j;
+				best_growth = growth;
+			}
+		}
+
+		if (clusters_len < SCENE_OUTPUT_DAMAGE_CLUSTERS &&
+				best_growth - box_area(rect) > box_area(rect)) {
+			clusters[clusters_len++] = *rect;
+			continue;
+		}
+
+		pixman_box32_t *c = &clusters[best];
+		c->x1 = c->x1 < rect->x1 ? c->x1 : rect->x1;
+		c->y1 = c->y1 < rect->y1 ? c->y1 : rect->y1;
+		c->x2 = c->x2 > rect->x2 ? c->x2 : rect->x2;
+		c->y2 = c->y2 > rect->y2 ? c->y2 : rect->y2;
+	}
+
+	for (size_t i = 0; i < clusters_len; i++) {
+		const pixman_box32_t *c = &clusters[i];
+		pixman_region32_union_rect(damage, damage, c->x1, c->y1,
+			c->x2 - c->x1, c->y2 - c->y1);
+	}
+}
+
+/**
+ * Append the operation drawing an entry, clipped to its damage in
+ * buffer-local coordinates. The projection is applied to the entry's box.
+ */
+static void render_list_entry_push_op(struct render_list_entry *entry,
+		const float projection[static 9], struct wl_array *ops) {
+	struct wlr_scene_node *node = entry->node;
+
+	struct wlr_render_op *op = wl_array_add(ops, sizeof(*op));
+	if (op == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	*op = (struct wlr_render_op){ .clip = &entry->damage };
 
-	struct wlr_texture *texture;
-	float matrix[9];
 	enum wl_output_transform transform;
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:
-		/* Root or tree node has nothing to render itself */
-		break;
+		abort(); // unreachable
 	case WLR_SCENE_NODE_RECT:;
 		struct wlr_scene_rect *scene_rect = scene_rect_from_node(node);
 
-		render_rect(output, output_damage, scene_rect->color, &dst_box,
-			output->transform_matrix);
+		// The damage is already restricted to the visible part of the rect
+		op->type = WLR_RENDER_OP_FILL;
+		memcpy(op->fill.color, scene_rect->color, sizeof(op->fill.color));
 		break;
 	case WLR_SCENE_NODE_BUFFER:;
 		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
-		if (!scene_buffer->buffer) {
-			return;
+
+		if (entry->fill) {
+			// The source box and transform don't matter for a single pixel
+			op->type = WLR_RENDER_OP_FILL;
+			memcpy(op->fill.color, entry->fill_color, sizeof(op->fill.color));
+			break;
 		}
 
-		struct wlr_renderer *renderer = output->renderer;
-		texture = scene_buffer_get_texture(scene_buffer, renderer);
-		if (texture == NULL) {
-			return;
+		op->type = WLR_RENDER_OP_TEXTURE;
+		op->texture.texture = entry->texture;
+		op->texture.alpha = 1.0;
+		op->texture.src_box = scene_buffer->src_box;
+		if (wlr_fbox_empty(&op->texture.src_box)) {
+			op->texture.src_box = (struct wlr_fbox){
+				.width = scene_buffer->buffer->width,
+				.height = scene_buffer->buffer->height,
+			};
+		}
+		if (entry->atlas_region != NULL) {
+			op->texture.src_box.x += entry->atlas_region->box.x;
+			op->texture.src_box.y += entry->atlas_region->box.y;
 		}
 
+		// The box only changes when the list is rebuilt
 		transform = wlr_output_transform_invert(scene_buffer->transform);
-		wlr_matrix_project_box(matrix, &dst_box, transform, 0.0,
-			output->transform_matrix);
-
-		render_texture(output, output_damage, texture, &scene_buffer->src_box,
-			&dst_box, matrix);
-
-		wlr_signal_emit_safe(&scene_buffer->events.output_present, scene_output);
+		if (!entry->matrix_valid || entry->matrix_transform != transform ||
+				memcmp(entry->matrix_projection, projection,
+				sizeof(entry->matrix_projection)) != 0) {
+			wlr_matrix_project_box(entry->matrix, &entry->box, transform,
+				0.0, projection);
+			entry->matrix_valid = true;
+			entry->matrix_transform = transform;
+			memcpy(entry->matrix_projection, projection,
+				sizeof(entry->matrix_projection));
+		}
+		memcpy(op->texture.matrix, entry->matrix, sizeof(op->texture.matrix));
 		break;
 	}
 }
 
+static void render_list_entry_add_op(struct wlr_scene_output *scene_output,
+		struct render_list_entry *entry, struct wl_array *ops) {
+	struct wlr_output *output = scene_output->output;
+	if (entry->node->type == WLR_SCENE_NODE_TREE) {
+		return;
+	}
+
+	output_damage_to_buffer(output, &entry->damage);
+	render_list_entry_push_op(entry, output->transform_matrix, ops);
+}
+
 static void scene_node_for_each_node(struct wlr_scene_node *node,
 		int lx, int ly, wlr_scene_node_iterator_func_t user_iterator,
 		void *user_data) {
@@ -958,6 +1855,68 @@ void wlr_scene_set_presentation(struct wlr_scene *scene,
 	wl_signal_add(&presentation->events.destroy, &scene->presentation_destroy);
 }
 
+static void scene_handle_linux_dmabuf_v1_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene *scene =
+		wl_container_of(listener, scene, linux_dmabuf_v1_destroy);
+	wl_list_remove(&scene->linux_dmabuf_v1_destroy.link);
+	wl_list_init(&scene->linux_dmabuf_v1_destroy.link);
+	scene->linux_dmabuf_v1 = NULL;
+}
+
+void wlr_scene_set_linux_dmabuf_v1(struct wlr_scene *scene,
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf_v1) {
+	assert(scene->linux_dmabuf_v1 == NULL);
+	scene->linux_dmabuf_v1 = linux_dmabuf_v1;
+	scene->linux_dmabuf_v1_destroy.notify =
+		scene_handle_linux_dmabuf_v1_destroy;
+	wl_signal_add(&linux_dmabuf_v1->events.destroy,
+		&scene->linux_dmabuf_v1_destroy);
+}
+
+static void scene_handle_texture_atlas_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene *scene =
+		wl_container_of(listener, scene, texture_atlas_destroy);
+	wl_list_remove(&scene->texture_atlas_destroy.link);
+	wl_list_init(&scene->texture_atlas_destroy.link);
+	scene->texture_atlas = NULL;
+}
+
+void wlr_scene_set_texture_atlas(struct wlr_scene *scene,
+		struct wlr_texture_atlas *atlas) {
+	assert(scene->texture_atlas == NULL);
+	scene->texture_atlas = atlas;
+	scene->texture_atlas_destroy.notify = scene_handle_texture_atlas_destroy;
+	wl_signal_add(&atlas->events.destroy, &scene->texture_atlas_destroy);
+}
+
+static void scene_node_trim(struct wlr_scene_node *node,
+		enum wlr_trim_level level) {
+	if (node->type == WLR_SCENE_NODE_BUFFER) {
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+		// Textures of hidden buffers are imported again once displayed
+		bool hidden = scene_buffer->active_outputs == 0;
+		struct scene_buffer_texture *entry, *tmp;
+		wl_list_for_each_safe(entry, tmp, &scene_buffer->textures, link) {
+			if (entry->buffer != scene_buffer->buffer ||
+					(hidden && level >= WLR_TRIM_CRITICAL)) {
+				scene_buffer_texture_destroy(entry);
+			}
+		}
+	} else if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_node_trim(child, level);
+		}
+	}
+}
+
+void wlr_scene_trim(struct wlr_scene *scene, enum wlr_trim_level level) {
+	scene_node_trim(&scene->tree.node, level);
+}
+
 static void scene_output_handle_destroy(struct wlr_addon *addon) {
 	struct wlr_scene_output *scene_output =
 		wl_container_of(addon, scene_output, addon);
@@ -969,14 +1928,112 @@ static const struct wlr_addon_interface output_addon_impl = {
 	.destroy = scene_output_handle_destroy,
 };
 
+static void scene_output_update_damage_bounds(
+		struct wlr_scene_output *scene_output) {
+	int width, height;
+	wlr_output_transformed_resolution(scene_output->output, &width, &height);
+	wlr_damage_ring_set_bounds(&scene_output->damage_ring, width, height);
+}
+
+/**
+ * Free the state which is only needed while rendering, when the output is
+ * disabled. It's re-created on the next frame.
+ */
+static void scene_output_release(struct wlr_scene_output *scene_output) {
+	render_list_finish(&scene_output->render_list);
+	wl_array_init(&scene_output->render_list);
+	scene_output->render_list_dirty = true;
+
+	// The output layers are kept, they don't hold any buffer once the
+	// output is disabled
+	wl_array_release(&scene_output->layer_nodes);
+	wl_array_init(&scene_output->layer_nodes);
+	wl_array_release(&scene_output->present_buffers);
+	wl_array_init(&scene_output->present_buffers);
+
+	wlr_damage_ring_finish(&scene_output->damage_ring);
+	wlr_damage_ring_init(&scene_output->damage_ring);
+	scene_output->prev_scanout = false;
+}
+
+static void scene_output_add_present(struct wlr_scene_output *scene_output,
+		struct wlr_scene_buffer *scene_buffer) {
+	struct wlr_scene_buffer **present =
+		wl_array_add(&scene_output->present_buffers, sizeof(*present));
+	if (present == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	*present = scene_buffer;
+}
+
+/**
+ * Emit the output_present event of the buffers displayed by the commit which
+ * has just succeeded.
+ */
+static void scene_output_send_present(struct wlr_scene_output *scene_output) {
+	// Destroyed nodes are replaced with NULL, the array stays in place
+	struct wlr_scene_buffer **present = scene_output->present_buffers.data;
+	size_t present_len =
+		scene_output->present_buffers.size / sizeof(*present);
+	for (size_t i = 0; i < present_len; i++) {
+		if (present[i] != NULL) {
+			wlr_signal_emit_safe(&present[i]->events.output_present,
+				scene_output);
+		}
+	}
+	scene_output->present_buffers.size = 0;
+}
+
+static void scene_output_destroy_render_thread(
+		struct wlr_scene_output *scene_output) {
+	if (scene_output->render_thread == NULL) {
+		return;
+	}
+
+	// Waits for the frame in flight, which is then committed right away
+	scene_render_thread_destroy(scene_output->render_thread);
+	scene_output->render_thread = NULL;
+	wl_list_remove(&scene_output->output_precommit.link);
+	wl_list_init(&scene_output->output_precommit.link);
+	scene_output_handle_frame_composited(scene_output);
+}
+
+static void scene_output_handle_precommit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_output *scene_output = wl_container_of(listener,
+		scene_output, output_precommit);
+	const struct wlr_output_event_precommit *event = data;
+
+	// Another commit picks up the frame still being composited
+	if (scene_output->commit_pending &&
+			(event->state->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		scene_render_thread_wait(scene_output->render_thread);
+		scene_output->commit_pending = false;
+	}
+}
+
 static void scene_output_handle_commit(struct wl_listener *listener, void *data) {
 	struct wlr_scene_output *scene_output = wl_container_of(listener,
 		scene_output, output_commit);
 	struct wlr_output_event_commit *event = data;
 
+	if (event->committed & WLR_OUTPUT_STATE_BUFFER) {
+		scene_output_send_present(scene_output);
+	}
+
+	if ((event->committed & WLR_OUTPUT_STATE_ENABLED) &&
+			!scene_output->output->enabled) {
+		scene_output_release(scene_output);
+	}
+
 	if (event->committed & (WLR_OUTPUT_STATE_MODE |
 			WLR_OUTPUT_STATE_TRANSFORM |
-			WLR_OUTPUT_STATE_SCALE)) {
+			WLR_OUTPUT_STATE_SCALE |
+			WLR_OUTPUT_STATE_ENABLED)) {
+		scene_output_update_damage_bounds(scene_output);
+		scene_output_damage_whole(scene_output);
+		scene_output->render_list_dirty = true;
 		scene_node_update_outputs(&scene_output->scene->tree.node, NULL);
 	}
 }
@@ -984,9 +2041,27 @@ static void scene_output_handle_commit(struct wl_listener *listener, void *data)
 static void scene_output_handle_mode(struct wl_listener *listener, void *data) {
 	struct wlr_scene_output *scene_output = wl_container_of(listener,
 		scene_output, output_mode);
+	scene_output_update_damage_bounds(scene_output);
+	scene_output_damage_whole(scene_output);
+	scene_output->render_list_dirty = true;
 	scene_node_update_outputs(&scene_output->scene->tree.node, NULL);
 }
 
+static void scene_output_handle_damage(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_output *scene_output = wl_container_of(listener,
+		scene_output, output_damage);
+	struct wlr_output_event_damage *event = data;
+	scene_output_damage(scene_output, event->damage);
+}
+
+static void scene_output_handle_needs_frame(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_output *scene_output = wl_container_of(listener,
+		scene_output, output_needs_frame);
+	wlr_output_schedule_frame(scene_output->output);
+}
+
 struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 		struct wlr_output *output) {
 	struct wlr_scene_output *scene_output = calloc(1, sizeof(*scene_output));
@@ -994,12 +2069,6 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 		return NULL;
 	}
 
-	scene_output->damage = wlr_output_damage_create(output);
-	if (scene_output->damage == NULL) {
-		free(scene_output);
-		return NULL;
-	}
-
 	scene_output->output = output;
 	scene_output->scene = scene;
 	wlr_addon_init(&scene_output->addon, &output->addons, scene, &output_addon_impl);
@@ -1023,13 +2092,41 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 
 	wl_signal_init(&scene_output->events.destroy);
 
+	wlr_damage_ring_init(&scene_output->damage_ring);
+	scene_output_update_damage_bounds(scene_output);
+
+	wl_array_init(&scene_output->render_list);
+	scene_output->render_list_dirty = true;
+	wl_array_init(&scene_output->layers);
+	wl_array_init(&scene_output->layer_nodes);
+	wl_array_init(&scene_output->present_buffers);
+
+	scene_output->output_precommit.notify = scene_output_handle_precommit;
+	wl_list_init(&scene_output->output_precommit.link);
+
 	scene_output->output_commit.notify = scene_output_handle_commit;
 	wl_signal_add(&output->events.commit, &scene_output->output_commit);
 
 	scene_output->output_mode.notify = scene_output_handle_mode;
 	wl_signal_add(&output->events.mode, &scene_output->output_mode);
 
-	wlr_output_damage_add_whole(scene_output->damage);
+	scene_output->output_damage.notify = scene_output_handle_damage;
+	wl_signal_add(&output->events.damage, &scene_output->output_damage);
+
+	scene_output->output_needs_frame.notify = scene_output_handle_needs_frame;
+	wl_signal_add(&output->events.needs_frame,
+		&scene_output->output_needs_frame);
+
+	if (scene->hidden_frame_done_timer == NULL) {
+		struct wl_event_loop *loop = wl_display_get_event_loop(output->display);
+		scene->hidden_frame_done_timer = wl_event_loop_add_timer(loop,
+			scene_handle_hidden_frame_done_timer, scene);
+		if (scene->hidden_frame_done_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create frame done timer");
+		}
+	}
+
+	scene_output_damage_whole(scene_output);
 	scene_node_update_outputs(&scene->tree.node, NULL);
 
 	return scene_output;
@@ -1042,12 +2139,46 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 
 	wlr_signal_emit_safe(&scene_output->events.destroy, NULL);
 
+	// Drop the frame in flight, if any
+	scene_output->commit_pending = false;
+	scene_output_destroy_render_thread(scene_output);
+
+	wlr_scene_output_set_content_type_policy(scene_output, false);
+
 	scene_node_update_outputs(&scene_output->scene->tree.node, scene_output);
 
 	wlr_addon_finish(&scene_output->addon);
 	wl_list_remove(&scene_output->link);
 	wl_list_remove(&scene_output->output_commit.link);
 	wl_list_remove(&scene_output->output_mode.link);
+	wl_list_remove(&scene_output->output_damage.link);
+	wl_list_remove(&scene_output->output_needs_frame.link);
+
+	struct wlr_output_layer_state *layer_state;
+	wl_array_for_each(layer_state, &scene_output->layers) {
+		wlr_output_layer_destroy(layer_state->layer);
+	}
+	wl_array_release(&scene_output->layers);
+	wl_array_release(&scene_output->layer_nodes);
+	wl_array_release(&scene_output->present_buffers);
+	render_list_finish(&scene_output->render_list);
+	wlr_damage_ring_finish(&scene_output->damage_ring);
+
+	// The timer's event loop might go away with the last output
+	struct wlr_scene *scene = scene_output->scene;
+	if (wl_list_empty(&scene->outputs)) {
+		if (scene->pending_damage_idle != NULL) {
+			wl_event_source_remove(scene->pending_damage_idle);
+			scene->pending_damage_idle = NULL;
+		}
+		pixman_region32_clear(&scene->pending_damage);
+	}
+	if (wl_list_empty(&scene->outputs) &&
+			scene->hidden_frame_done_timer != NULL) {
+		wl_event_source_remove(scene->hidden_frame_done_timer);
+		scene->hidden_frame_done_timer = NULL;
+		scene->hidden_frame_done_scheduled = false;
+	}
 
 	free(scene_output);
 }
@@ -1072,117 +2203,715 @@ void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 
 	scene_output->x = lx;
 	scene_output->y = ly;
-	wlr_output_damage_add_whole(scene_output->damage);
+	scene_output->render_list_dirty = true;
+	scene_output_damage_whole(scene_output);
 
 	scene_node_update_outputs(&scene_output->scene->tree.node, NULL);
 }
 
-struct check_scanout_data {
-	// in
-	struct wlr_box viewport_box;
-	// out
-	struct wlr_scene_node *node;
-	size_t n;
-};
-
-static void check_scanout_iterator(struct wlr_scene_node *node,
-		int x, int y, void *_data) {
-	struct check_scanout_data *data = _data;
+void wlr_scene_output_set_allow_tearing(struct wlr_scene_output *scene_output,
+		bool allow_tearing) {
+	scene_output->allow_tearing = allow_tearing;
+}
 
-	struct wlr_box node_box = { .x = x, .y = y };
-	scene_node_get_size(node, &node_box.width, &node_box.height);
+// Used when the compositor doesn't schedule frames itself, in ms
+#define CONTENT_TYPE_POLICY_SAFETY_MARGIN 2
 
-	struct wlr_box intersection;
-	if (!wlr_box_intersection(&intersection, &data->viewport_box, &node_box)) {
+static void output_request_adaptive_sync(struct wlr_output *output,
+		bool enabled) {
+	bool current =
+		output->adaptive_sync_status != WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
+	if (enabled == current) {
 		return;
 	}
 
-	data->n++;
+	// Frames would fail on outputs without adaptive sync support
+	struct wlr_output_state state = {0};
+	wlr_output_state_set_adaptive_sync_enabled(&state, enabled);
+	if (enabled && !wlr_output_test_state(output, &state)) {
+		wlr_log(WLR_DEBUG, "Adaptive sync not supported on %s", output->name);
+		return;
+	}
+	wlr_output_state_set_adaptive_sync_enabled(&output->pending, enabled);
+}
 
-	if (data->viewport_box.x == node_box.x &&
-			data->viewport_box.y == node_box.y &&
-			data->viewport_box.width == node_box.width &&
-			data->viewport_box.height == node_box.height) {
-		data->node = node;
+static void scene_output_apply_content_type_policy(
+		struct wlr_scene_output *scene_output,
+		enum wlr_output_content_type content_type) {
+	if (content_type == scene_output->content_type_policy.applied) {
+		return;
 	}
+	scene_output->content_type_policy.applied = content_type;
+
+	bool game = content_type == WLR_OUTPUT_CONTENT_TYPE_GAME;
+	bool video = content_type == WLR_OUTPUT_CONTENT_TYPE_VIDEO;
+	bool adaptive_sync =
+		scene_output->content_type_policy.adaptive_sync || game || video;
+	bool lfc = scene_output->content_type_policy.lfc || game || video;
+	bool frame_scheduling =
+		scene_output->content_type_policy.frame_scheduling || game;
+
+	struct wlr_output *output = scene_output->output;
+	output_request_adaptive_sync(output, adaptive_sync);
+	wlr_output_set_low_framerate_compensation(output, lfc);
+	wlr_output_set_frame_scheduling(output, frame_scheduling,
+		scene_output->content_type_policy.safety_margin);
 }
 
-static bool scene_output_scanout(struct wlr_scene_output *scene_output) {
-	if (scene_output->scene->debug_damage_option ==
-			WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
-		// We don't want to enter direct scan out if we have highlight regions
-		// enabled. Otherwise, we won't be able to render the damage regions.
-		return false;
+void wlr_scene_output_set_content_type_policy(
+		struct wlr_scene_output *scene_output, bool enabled) {
+	if (enabled == scene_output->content_type_policy.enabled) {
+		return;
 	}
 
 	struct wlr_output *output = scene_output->output;
+	if (enabled) {
+		scene_output->content_type_policy.adaptive_sync =
+			output->adaptive_sync_status != WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
+		scene_output->content_type_policy.lfc = output->lfc.enabled;
+		scene_output->content_type_policy.frame_scheduling =
+			output->frame_scheduling.enabled;
+		scene_output->content_type_policy.safety_margin =
+			output->frame_scheduling.enabled ?
+			output->frame_scheduling.safety_margin :
+			CONTENT_TYPE_POLICY_SAFETY_MARGIN;
+		// The compositor's settings are those of untyped content
+		scene_output->content_type_policy.applied =
+			WLR_OUTPUT_CONTENT_TYPE_NONE;
+		scene_output->content_type_policy.enabled = true;
+		scene_output_apply_content_type_policy(scene_output,
+			output->content_type);
+	} else {
+		scene_output_apply_content_type_policy(scene_output,
+			WLR_OUTPUT_CONTENT_TYPE_NONE);
+		scene_output->content_type_policy.enabled = false;
+	}
+}
 
-	struct wlr_box viewport_box = { .x = scene_output->x, .y = scene_output->y };
-	wlr_output_effective_resolution(output,
-		&viewport_box.width, &viewport_box.height);
+bool wlr_scene_output_set_render_thread(struct wlr_scene_output *scene_output,
+		bool enabled) {
+	if (enabled == (scene_output->render_thread != NULL)) {
+		return true;
+	}
+	if (!enabled) {
+		scene_output_destroy_render_thread(scene_output);
+		return true;
+	}
 
-	struct check_scanout_data check_scanout_data = {
-		.viewport_box = viewport_box,
-	};
-	scene_node_for_each_node(&scene_output->scene->tree.node, 0, 0,
-		check_scanout_iterator, &check_scanout_data);
-	if (check_scanout_data.n != 1 || check_scanout_data.node == NULL) {
+	struct wlr_output *output = scene_output->output;
+	if (output->renderer == NULL || !wlr_renderer_is_pixman(output->renderer)) {
+		wlr_log(WLR_ERROR, "Render threads are only supported with the "
+			"pixman renderer");
 		return false;
 	}
 
-	struct wlr_scene_node *node = check_scanout_data.node;
-	struct wlr_buffer *buffer;
-	switch (node->type) {
-	case WLR_SCENE_NODE_BUFFER:;
-		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
-		if (scene_buffer->buffer == NULL ||
-				!wlr_fbox_empty(&scene_buffer->src_box) ||
-				scene_buffer->transform != output->transform) {
-			return false;
-		}
-		buffer = scene_buffer->buffer;
-		break;
-	default:
+	scene_output->render_thread = scene_render_thread_create(scene_output);
+	if (scene_output->render_thread == NULL) {
 		return false;
 	}
+	wl_signal_add(&output->events.precommit, &scene_output->output_precommit);
+	return true;
+}
 
-	wlr_output_attach_buffer(output, buffer);
-	if (!wlr_output_test(output)) {
-		wlr_output_rollback(output);
-		return false;
+void scene_output_handle_frame_composited(
+		struct wlr_scene_output *scene_output) {
+	if (!scene_output->commit_pending) {
+		return;
 	}
+	scene_output->commit_pending = false;
 
-	if (node->type == WLR_SCENE_NODE_BUFFER) {
-		struct wlr_scene_buffer *scene_buffer =
-			wlr_scene_buffer_from_node(node);
-		wlr_signal_emit_safe(&scene_buffer->events.output_present, scene_output);
+	// The frame's damage has already been consumed, start over if it doesn't
+	// make it to the screen
+	struct wlr_output *output = scene_output->output;
+	if (output->back_buffer == NULL || !wlr_output_commit(output)) {
+		scene_output->present_buffers.size = 0;
+		scene_output->layers_dirty = true;
+		scene_output_damage_whole(scene_output);
+		return;
 	}
+	scene_output->scanout_stats.composited_frames++;
 
-	return wlr_output_commit(output);
+	if (scene_output->scene->debug_damage_option ==
+			WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT &&
+			!wl_list_empty(&scene_output->scene->damage_highlight_regions)) {
+		wlr_output_schedule_frame(output);
+	}
 }
 
-bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
-	struct wlr_output *output = scene_output->output;
-	enum wlr_scene_debug_damage_option debug_damage =
-		scene_output->scene->debug_damage_option;
+#define SCENE_OUTPUT_MAX_LAYERS 4
 
-	struct wlr_renderer *renderer = output->renderer;
-	assert(renderer != NULL);
+static bool scene_output_ensure_layers(struct wlr_scene_output *scene_output) {
+	while (scene_output->layers.size <
+			SCENE_OUTPUT_MAX_LAYERS * sizeof(struct wlr_output_layer_state)) {
+		struct wlr_output_layer *layer =
+			wlr_output_layer_create(scene_output->output);
+		if (layer == NULL) {
+			return false;
+		}
 
-	bool scanout = scene_output_scanout(scene_output);
-	if (scanout != scene_output->prev_scanout) {
-		wlr_log(WLR_DEBUG, "Direct scan-out %s",
-			scanout ? "enabled" : "disabled");
-		// When exiting direct scan-out, damage everything
-		wlr_output_damage_add_whole(scene_output->damage);
+		struct wlr_output_layer_state *layer_state =
+			wl_array_add(&scene_output->layers, sizeof(*layer_state));
+		if (layer_state == NULL) {
+			wlr_output_layer_destroy(layer);
+			return false;
+		}
+		*layer_state = (struct wlr_output_layer_state){ .layer = layer };
+	}
+	return true;
+}
+
+/**
+ * Disable all output layers in the pending output state, if any of them was
+ * in use.
+ */
+static void scene_output_clear_layers(struct wlr_scene_output *scene_output) {
+	if (scene_output->layer_nodes.size == 0) {
+		return;
+	}
+
+	struct wlr_output_layer_state *layer_state;
+	wl_array_for_each(layer_state, &scene_output->layers) {
+		layer_state->buffer = NULL;
+	}
+	wlr_output_state_set_layers(&scene_output->output->pending,
+		scene_output->layers.data,
+		scene_output->layers.size / sizeof(*layer_state));
+	scene_output->layers_dirty = true;
+}
+
+/**
+ * Check whether a render list entry can be displayed on an output layer as is,
+ * ie. without cropping, scaling or transforming its buffer. If so, compute
+ * its position in output-buffer-local coordinates.
+ */
+static bool render_list_entry_get_layer_box(struct wlr_scene_output *scene_output,
+		const struct render_list_entry *entry, struct wlr_box *buffer_box) {
+	struct wlr_output *output = scene_output->output;
+	if (entry->node->type != WLR_SCENE_NODE_BUFFER) {
+		return false;
+	}
+
+	struct wlr_scene_buffer *scene_buffer =
+		wlr_scene_buffer_from_node(entry->node);
+	if (scene_buffer->buffer == NULL ||
+			!wlr_fbox_empty(&scene_buffer->src_box) ||
+			scene_buffer->transform != output->transform) {
+		return false;
+	}
+
+	int ow, oh;
+	wlr_output_transformed_resolution(output, &ow, &oh);
+
+	const struct wlr_box *box = &entry->box;
+	if (box->x < 0 || box->y < 0 ||
+			box->x + box->width > ow || box->y + box->height > oh) {
+		return false;
+	}
+
+	wlr_box_transform(buffer_box, box,
+		wlr_output_transform_invert(output->transform), ow, oh);
+	return buffer_box->width == scene_buffer->buffer->width &&
+		buffer_box->height == scene_buffer->buffer->height;
+}
+
+/**
+ * Display the same nodes on output layers as in the previous frame, without
+ * testing them again. Fails if the last commit rejected any of them.
+ */
+static bool scene_output_reuse_layers(struct wlr_scene_output *scene_output,
+		struct wl_array *render_list) {
+	struct wlr_scene_node **layer_nodes = scene_output->layer_nodes.data;
+	size_t layer_nodes_len =
+		scene_output->layer_nodes.size / sizeof(*layer_nodes);
+	if (layer_nodes_len == 0) {
+		return true;
+	}
+
+	struct wlr_output_layer_state *layer_state;
+	wl_array_for_each(layer_state, &scene_output->layers) {
+		if (layer_state->buffer != NULL && !layer_state->accepted) {
+			return false;
+		}
+	}
+
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, render_list) {
+		for (size_t i = 0; i < layer_nodes_len; i++) {
+			if (entry->node == layer_nodes[i]) {
+				entry->composite = false;
+				break;
+			}
+		}
+	}
+
+	wlr_output_state_set_layers(&scene_output->output->pending,
+		scene_output->layers.data,
+		scene_output->layers.size / sizeof(*layer_state));
+	return true;
+}
+
+/**
+ * Try to display the topmost buffer nodes which aren't covered by any other
+ * node on output layers. The nodes accepted by the backend are removed from
+ * the render list, they don't need to be composited.
+ *
+ * The assignment is only tested when the render list has changed, the
+ * previous one is kept otherwise.
+ */
+static void scene_output_assign_layers(struct wlr_scene_output *scene_output,
+		struct wl_array *render_list) {
+	struct wlr_output *output = scene_output->output;
+
+	if (!scene_output->layers_dirty &&
+			scene_output_reuse_layers(scene_output, render_list)) {
+		return;
+	}
+
+	struct render_list_entry *entries = render_list->data;
+	size_t entries_len = render_list->size / sizeof(*entries);
+
+	size_t candidates[SCENE_OUTPUT_MAX_LAYERS];
+	size_t candidates_len = 0;
+	if (scene_output->scene->debug_damage_option !=
+			WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT &&
+			scene_output_ensure_layers(scene_output)) {
+		struct wlr_output_layer_state *layers = scene_output->layers.data;
+
+		// Output layers are displayed above the composited buffer, so only
+		// nodes which aren't covered by anything can be moved to a layer
+		pixman_region32_t above;
+		pixman_region32_init(&above);
+		for (size_t i = entries_len; i-- > 0 &&
+				candidates_len < SCENE_OUTPUT_MAX_LAYERS;) {
+			struct render_list_entry *entry = &entries[i];
+			pixman_box32_t rect = {
+				.x1 = entry->box.x,
+				.y1 = entry->box.y,
+				.x2 = entry->box.x + entry->box.width,
+				.y2 = entry->box.y + entry->box.height,
+			};
+
+			struct wlr_box buffer_box;
+			if (pixman_region32_contains_rectangle(&above, &rect) ==
+					PIXMAN_REGION_OUT &&
+					render_list_entry_get_layer_box(scene_output, entry,
+					&buffer_box)) {
+				struct wlr_scene_buffer *scene_buffer =
+					wlr_scene_buffer_from_node(entry->node);
+				struct wlr_output_layer_state *layer_state =
+					&layers[candidates_len];
+				layer_state->buffer = scene_buffer->buffer;
+				layer_state->x = buffer_box.x;
+				layer_state->y = buffer_box.y;
+				candidates[candidates_len++] = i;
+			}
+
+			pixman_region32_union_rect(&above, &above, rect.x1, rect.y1,
+				entry->box.width, entry->box.height);
+		}
+		pixman_region32_fini(&above);
+	}
+
+	if (candidates_len == 0) {
+		scene_output_clear_layers(scene_output);
+		scene_output->layer_nodes.size = 0;
+		scene_output->layers_dirty = false;
+		return;
+	}
+
+	struct wlr_output_layer_state *layers = scene_output->layers.data;
+	size_t layers_len = scene_output->layers.size / sizeof(*layers);
+	for (size_t i = candidates_len; i < layers_len; i++) {
+		layers[i].buffer = NULL;
+	}
+
+	wlr_output_state_set_layers(&output->pending, layers, layers_len);
+	if (!wlr_output_test(output)) {
+		for (size_t i = 0; i < candidates_len; i++) {
+			layers[i].accepted = false;
+		}
+	}
+
+	struct wl_array layer_nodes;
+	wl_array_init(&layer_nodes);
+	for (size_t i = 0; i < candidates_len; i++) {
+		struct wlr_output_layer_state *layer_state = &layers[i];
+		struct render_list_entry *entry = &entries[candidates[i]];
+		if (!layer_state->accepted) {
+			// Composite this node instead
+			layer_state->buffer = NULL;
+			continue;
+		}
+
+		struct wlr_scene_node **node_ptr =
+			wl_array_add(&layer_nodes, sizeof(*node_ptr));
+		if (node_ptr == NULL) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			layer_state->buffer = NULL;
+			continue;
+		}
+		*node_ptr = entry->node;
+		entry->composite = false;
+	}
+
+	if (layer_nodes.size != scene_output->layer_nodes.size ||
+			memcmp(layer_nodes.data, scene_output->layer_nodes.data,
+			layer_nodes.size) != 0) {
+		wlr_log(WLR_DEBUG, "Displaying %zu nodes on output layers",
+			layer_nodes.size / sizeof(struct wlr_scene_node *));
+		// Nodes moved to or from a layer need to be re-composited
+		scene_output_damage_whole(scene_output);
+	}
+
+	wl_array_release(&scene_output->layer_nodes);
+	scene_output->layer_nodes = layer_nodes;
+	scene_output->layers_dirty = false;
+}
+
+static bool render_list_entry_get_color(const struct render_list_entry *entry,
+		float color[static 4]) {
+	if (entry->node->type == WLR_SCENE_NODE_RECT) {
+		struct wlr_scene_rect *scene_rect = scene_rect_from_node(entry->node);
+		memcpy(color, scene_rect->color, 4 * sizeof(float));
+		return true;
+	}
+	return entry->node->type == WLR_SCENE_NODE_BUFFER &&
+		scene_buffer_get_color(wlr_scene_buffer_from_node(entry->node), color);
+}
+
+/**
+ * Check whether the bottom-most entry of the render list is an opaque solid
+ * color covering the whole output, which can be displayed by filling the
+ * background instead of being drawn.
+ */
+static bool render_list_get_background(struct wlr_scene_output *scene_output,
+		const struct render_list_entry *entries, size_t entries_len,
+		float color[static 4]) {
+	if (entries_len == 0 || !render_list_entry_get_color(&entries[0], color) ||
+			color[3] != 1) {
+		return false;
+	}
+
+	int width, height;
+	wlr_output_transformed_resolution(scene_output->output, &width, &height);
+	const struct wlr_box *box = &entries[0].box;
+	return box->x <= 0 && box->y <= 0 &&
+		box->x + box->width >= width && box->y + box->height >= height;
+}
+
+/**
+ * Check whether the nodes below the scanned-out node can be left out, ie.
+ * they have the color of the background of the CRTC.
+ */
+static bool render_list_entry_matches_background(
+		const struct render_list_entry *entry, const float background[static 4]) {
+	float color[4];
+	if (!render_list_entry_get_color(entry, color)) {
+		return false;
+	}
+	bool black = background[0] == 0 && background[1] == 0 &&
+		background[2] == 0;
+	if (black && color[0] == 0 && color[1] == 0 && color[2] == 0) {
+		return true;
+	}
+	return color[0] == background[0] && color[1] == background[1] &&
+		color[2] == background[2] && color[3] == 1;
+}
+
+static const struct {
+	const char *name;
+	float color[4];
+} scanout_failures[WLR_SCENE_SCANOUT_FAILURE_COUNT] = {
+	[WLR_SCENE_SCANOUT_FAILURE_NONE] = { "none", { 0, 0, 0, 0 } },
+	[WLR_SCENE_SCANOUT_FAILURE_DEBUG_DAMAGE] =
+		{ "damage highlighting enabled", { .5, .5, .5, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_NO_BUFFER] =
+		{ "no buffer on top", { 0, 0, .5, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_MULTIPLE_NODES] =
+		{ "multiple nodes visible", { 0, 0, 1, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_OUT_OF_BOUNDS] =
+		{ "buffer out of the output bounds", { 0, 1, 1, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_INCAPABLE] =
+		{ "buffer can't be scanned out", { 1, 0, 1, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_SRC_BOX] =
+		{ "source box set", { 1, 1, 0, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_TRANSFORM] =
+		{ "transform mismatch", { 1, .5, 0, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_SIZE] =
+		{ "size mismatch", { 0, 1, 0, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_TEST] =
+		{ "test commit failed", { 1, 0, 0, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_COMMIT] =
+		{ "commit failed", { .5, 0, 0, 1 } },
+	[WLR_SCENE_SCANOUT_FAILURE_BACKGROUND] =
+		{ "background color unsupported", { .5, 0, .5, 1 } },
+};
+
+const char *wlr_scene_scanout_failure_name(
+		enum wlr_scene_scanout_failure failure) {
+	assert(failure < WLR_SCENE_SCANOUT_FAILURE_COUNT);
+	return scanout_failures[failure].name;
+}
+
+static enum wlr_scene_scanout_failure scene_output_scanout(
+		struct wlr_scene_output *scene_output) {
+	if (scene_output->scene->debug_damage_option ==
+			WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+		// We don't want to enter direct scan out if we have highlight regions
+		// enabled. Otherwise, we won't be able to render the damage regions.
+		return WLR_SCENE_SCANOUT_FAILURE_DEBUG_DAMAGE;
+	}
+
+	struct wlr_output *output = scene_output->output;
+
+	// Only a single buffer node, over rects and single-pixel buffers of the
+	// CRTC background color, can be scanned out
+	struct wl_array *render_list = scene_output_get_render_list(scene_output);
+	struct render_list_entry *entries = render_list->data;
+	size_t entries_len = render_list->size / sizeof(*entries);
+	if (entries_len == 0) {
+		return WLR_SCENE_SCANOUT_FAILURE_NO_BUFFER;
+	}
+
+	struct render_list_entry *entry = &entries[entries_len - 1];
+	struct wlr_scene_node *node = entry->node;
+	if (node->type != WLR_SCENE_NODE_BUFFER) {
+		return WLR_SCENE_SCANOUT_FAILURE_NO_BUFFER;
+	}
+	struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+	struct wlr_buffer *buffer = scene_buffer->buffer;
+	if (buffer == NULL) {
+		return WLR_SCENE_SCANOUT_FAILURE_NO_BUFFER;
+	}
+
+	// The background is black unless a solid color fills the whole output
+	float background[4] = { 0, 0, 0, 1 };
+	float color[4];
+	if (render_list_get_background(scene_output, entries, entries_len - 1,
+			color)) {
+		memcpy(background, color, sizeof(background));
+	}
+	for (size_t i = 0; i < entries_len - 1; i++) {
+		if (!render_list_entry_matches_background(&entries[i], background)) {
+			return WLR_SCENE_SCANOUT_FAILURE_MULTIPLE_NODES;
+		}
+	}
+
+	// A buffer exactly covering the output can be scanned out by any
+	// backend, others need the backend to crop, scale or rotate it
+	struct wlr_box output_box = {0};
+	wlr_output_transformed_resolution(output,
+		&output_box.width, &output_box.height);
+	const struct wlr_box *box = &entry->box;
+	bool exact_size = entries_len == 1 &&
+		box->x == output_box.x && box->y == output_box.y &&
+		box->width == output_box.width && box->height == output_box.height;
+	bool exact_src_box = wlr_fbox_empty(&scene_buffer->src_box);
+	bool exact_transform = scene_buffer->transform == output->transform;
+	bool exact = exact_size && exact_src_box && exact_transform;
+	struct wlr_box dst_box;
+	if (!exact) {
+		if (box->x < 0 || box->y < 0 ||
+				box->x + box->width > output_box.width ||
+				box->y + box->height > output_box.height) {
+			return WLR_SCENE_SCANOUT_FAILURE_OUT_OF_BOUNDS;
+		}
+		wlr_box_transform(&dst_box, box,
+			wlr_output_transform_invert(output->transform),
+			output_box.width, output_box.height);
+	}
+
+	// Already known not to be importable, don't bother with a test commit
+	if (buffer->scanout == WLR_BUFFER_SCANOUT_INCAPABLE) {
+		return WLR_SCENE_SCANOUT_FAILURE_INCAPABLE;
+	}
+
+	wlr_output_attach_buffer(output, buffer);
+	if (!exact) {
+		wlr_output_state_set_buffer_geometry(&output->pending,
+			&scene_buffer->src_box, &dst_box,
+			wlr_output_transform_compose(
+			wlr_output_transform_invert(scene_buffer->transform),
+			output->transform));
+	}
+	// Composited frames cover the background, only update it when needed
+	bool set_background = !exact_size && memcmp(background,
+		output->background_color, sizeof(background)) != 0;
+	if (set_background) {
+		wlr_output_state_set_background_color(&output->pending, background);
+	}
+	scene_output_clear_layers(scene_output);
+
+	bool ok = false;
+	if (scene_output->allow_tearing) {
+		output->pending.tearing_page_flip = true;
+		ok = wlr_output_test(output);
+		if (!ok) {
+			output->pending.tearing_page_flip = false;
+		}
+	}
+	if (!ok && !wlr_output_test(output)) {
+		wlr_output_rollback(output);
+		// The backend most likely can't crop, rotate or scale the buffer
+		if (!exact_src_box) {
+			return WLR_SCENE_SCANOUT_FAILURE_SRC_BOX;
+		} else if (!exact_transform) {
+			return WLR_SCENE_SCANOUT_FAILURE_TRANSFORM;
+		} else if (set_background) {
+			// Few CRTCs support background colors, unlike buffer geometry
+			return WLR_SCENE_SCANOUT_FAILURE_BACKGROUND;
+		} else if (!exact_size) {
+			return WLR_SCENE_SCANOUT_FAILURE_SIZE;
+		}
+		return WLR_SCENE_SCANOUT_FAILURE_TEST;
+	}
+
+	scene_output_add_present(scene_output, scene_buffer);
+	if (!wlr_output_commit(output)) {
+		scene_output->present_buffers.size = 0;
+		return WLR_SCENE_SCANOUT_FAILURE_COMMIT;
+	}
+	// The swapchain buffers didn't get this frame's damage
+	wlr_damage_ring_rotate_buffer(&scene_output->damage_ring, buffer);
+	scene_output->layer_nodes.size = 0;
+	return WLR_SCENE_SCANOUT_FAILURE_NONE;
+}
+
+/**
+ * Ask the topmost buffer covering the whole output to allocate buffers which
+ * can be scanned out, and the other buffers displayed on the output to go
+ * back to the default feedback.
+ */
+static void scene_output_update_dmabuf_feedback(
+		struct wlr_scene_output *scene_output) {
+	struct wlr_scene *scene = scene_output->scene;
+	if (scene->linux_dmabuf_v1 == NULL) {
+		return;
+	}
+
+	struct wlr_box output_box = {0};
+	wlr_output_transformed_resolution(scene_output->output,
+		&output_box.width, &output_box.height);
+
+	bool found = false;
+	struct wl_array *render_list = scene_output_get_render_list(scene_output);
+	struct render_list_entry *entries = render_list->data;
+	size_t len = render_list->size / sizeof(*entries);
+	for (size_t i = len; i-- > 0;) {
+		struct render_list_entry *entry = &entries[i];
+		if (entry->node->type != WLR_SCENE_NODE_BUFFER) {
+			continue;
+		}
+
+		struct wlr_scene_buffer *scene_buffer =
+			wlr_scene_buffer_from_node(entry->node);
+		if (scene_buffer->primary_output != scene_output) {
+			continue;
+		}
+
+		bool fullscreen = !found &&
+			entry->box.x == output_box.x && entry->box.y == output_box.y &&
+			entry->box.width == output_box.width &&
+			entry->box.height == output_box.height;
+		found = found || fullscreen;
+		scene_buffer_set_dmabuf_feedback(scene, scene_buffer,
+			fullscreen ? scene_output->output : NULL);
+	}
+}
+
+// Forward the content type of the top-most buffer covering the whole output
+static void scene_output_update_content_type(
+		struct wlr_scene_output *scene_output) {
+	struct wlr_output *output = scene_output->output;
+
+	struct wlr_box output_box = {0};
+	wlr_output_transformed_resolution(output,
+		&output_box.width, &output_box.height);
+
+	enum wlr_output_content_type content_type = WLR_OUTPUT_CONTENT_TYPE_NONE;
+	struct wl_array *render_list = scene_output_get_render_list(scene_output);
+	struct render_list_entry *entries = render_list->data;
+	size_t len = render_list->size / sizeof(*entries);
+	for (size_t i = len; i-- > 0;) {
+		struct render_list_entry *entry = &entries[i];
+		if (entry->node->type != WLR_SCENE_NODE_BUFFER) {
+			continue;
+		}
+
+		if (entry->box.x <= output_box.x && entry->box.y <= output_box.y &&
+				entry->box.x + entry->box.width >=
+					output_box.x + output_box.width &&
+				entry->box.y + entry->box.height >=
+					output_box.y + output_box.height) {
+			struct wlr_scene_buffer *scene_buffer =
+				wlr_scene_buffer_from_node(entry->node);
+			content_type = scene_buffer->content_type;
+			break;
+		}
+	}
+
+	if (content_type != output->content_type) {
+		wlr_output_state_set_content_type(&output->pending, content_type);
+	}
+	if (scene_output->content_type_policy.enabled) {
+		scene_output_apply_content_type_policy(scene_output, content_type);
+	}
+}
+
+static bool scene_output_commit(struct wlr_scene_output *scene_output) {
+	struct wlr_output *output = scene_output->output;
+	enum wlr_scene_debug_damage_option debug_damage =
+		scene_output->scene->debug_damage_option;
+
+	struct wlr_renderer *renderer = output->renderer;
+	assert(renderer != NULL);
+
+	// The next frame is rendered once the one in flight has been committed
+	if (scene_output->render_thread != NULL &&
+			scene_render_thread_busy(scene_output->render_thread)) {
+		return true;
+	}
+
+	// Left over if another commit picked up the last frame and failed
+	scene_output->present_buffers.size = 0;
+
+	scene_flush_damage(scene_output->scene);
+
+	scene_output_update_dmabuf_feedback(scene_output);
+	scene_output_update_content_type(scene_output);
+
+	struct wlr_scene_output_scanout_stats *stats =
+		&scene_output->scanout_stats;
+	enum wlr_scene_scanout_failure failure =
+		scene_output_scanout(scene_output);
+	bool scanout = failure == WLR_SCENE_SCANOUT_FAILURE_NONE;
+	if (scanout != scene_output->prev_scanout) {
+		if (scanout) {
+			wlr_log(WLR_DEBUG, "Direct scan-out enabled");
+		} else {
+			wlr_log(WLR_DEBUG, "Direct scan-out disabled: %s",
+				wlr_scene_scanout_failure_name(failure));
+		}
+		// When exiting direct scan-out, damage everything
+		scene_output_damage_whole(scene_output);
+	} else if (!scanout && failure != stats->last_failure) {
+		wlr_log(WLR_DEBUG, "Direct scan-out still disabled: %s",
+			wlr_scene_scanout_failure_name(failure));
+		if (scene_output->scene->debug_scanout) {
+			// Update the overlay
+			scene_output_damage_whole(scene_output);
+		}
 	}
 	scene_output->prev_scanout = scanout;
+	stats->last_failure = failure;
 	if (scanout) {
+		stats->scanout_frames++;
 		return true;
 	}
+	stats->failures[failure]++;
 
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_RERENDER) {
-		wlr_output_damage_add_whole(scene_output->damage);
+		scene_output_damage_whole(scene_output);
 	}
 
 	struct timespec now;
@@ -1191,13 +2920,13 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
 		// add the current frame's damage if there is damage
-		if (pixman_region32_not_empty(&scene_output->damage->current)) {
+		if (pixman_region32_not_empty(&scene_output->damage_ring.current)) {
 			struct highlight_region *current_damage =
 				calloc(1, sizeof(*current_damage));
 			if (current_damage) {
 				pixman_region32_init(&current_damage->region);
 				pixman_region32_copy(&current_damage->region,
-					&scene_output->damage->current);
+					&scene_output->damage_ring.current);
 				memcpy(&current_damage->when, &now, sizeof(now));
 				wl_list_insert(regions, &current_damage->link);
 			}
@@ -1220,42 +2949,98 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 			}
 		}
 
-		wlr_output_damage_add(scene_output->damage, &acc_damage);
+		scene_output_damage(scene_output, &acc_damage);
 		pixman_region32_fini(&acc_damage);
 	}
 
-	bool needs_frame;
-	pixman_region32_t damage;
-	pixman_region32_init(&damage);
-	if (!wlr_output_damage_attach_render(scene_output->damage,
-			&needs_frame, &damage)) {
-		pixman_region32_fini(&damage);
+	struct wl_array *render_list = scene_output_get_render_list(scene_output);
+	render_list_reset(render_list);
+
+	if (!wlr_output_attach_render(output, NULL)) {
 		return false;
 	}
 
+	bool needs_frame = output->needs_frame ||
+		pixman_region32_not_empty(&scene_output->damage_ring.current);
 	if (!needs_frame) {
-		pixman_region32_fini(&damage);
 		wlr_output_rollback(output);
 		return true;
 	}
 
-	wlr_renderer_begin(renderer, output->width, output->height);
+	// May damage the whole output if the set of layer nodes changes
+	scene_output_assign_layers(scene_output, render_list);
 
-	int nrects;
-	pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
-	for (int i = 0; i < nrects; ++i) {
-		scissor_output(output, &rects[i]);
-		wlr_renderer_clear(renderer, (float[4]){ 0.0, 0.0, 0.0, 1.0 });
+	// Swapchain buffers are tracked individually, so the damage is exact
+	// whatever the buffer age
+	struct wlr_buffer *buffer = wlr_buffer_lock(output->back_buffer);
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	wlr_damage_ring_get_buffer_damage(&scene_output->damage_ring, buffer,
+		&damage);
+	damage_simplify(&damage);
+
+	// Only the damage which isn't covered by an opaque node needs clearing
+	pixman_region32_t background;
+	pixman_region32_init(&background);
+	pixman_region32_copy(&background, &damage);
+	render_list_cull(scene_output, render_list, &background);
+
+	// A solid color filling the output is drawn as part of the clear
+	float clear_color[4] = { 0.0, 0.0, 0.0, 1.0 };
+	float bg_color[4];
+	struct render_list_entry *entries = render_list->data;
+	size_t entries_len = render_list->size / sizeof(*entries);
+	if (entries_len > 0 && entries[0].composite &&
+			render_list_get_background(scene_output, entries, entries_len,
+			bg_color)) {
+		memcpy(clear_color, bg_color, sizeof(clear_color));
+		pixman_region32_union(&background, &background, &entries[0].damage);
+		entries[0].composite = false;
+	}
+
+	// Submit the whole frame at once so that the renderer can batch it
+	struct wl_array ops;
+	wl_array_init(&ops);
+
+	output_damage_to_buffer(output, &background);
+	if (pixman_region32_not_empty(&background)) {
+		struct wlr_render_op *op = wl_array_add(&ops, sizeof(*op));
+		if (op != NULL) {
+			*op = (struct wlr_render_op){
+				.type = WLR_RENDER_OP_CLEAR,
+				.clip = &background,
+			};
+			memcpy(op->clear.color, clear_color, sizeof(clear_color));
+		}
 	}
 
-	struct render_data data = {
-		.scene_output = scene_output,
-		.damage = &damage,
-	};
-	scene_node_for_each_node(&scene_output->scene->tree.node,
-		-scene_output->x, -scene_output->y,
-		render_node_iterator, &data);
-	wlr_renderer_scissor(renderer, NULL);
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, render_list) {
+		if (entry->composite) {
+			render_list_entry_add_op(scene_output, entry, &ops);
+		}
+	}
+
+	if (scene_output->render_thread != NULL) {
+		pixman_renderer_defer_pass(renderer);
+	}
+	wlr_renderer_begin(renderer, output->width, output->height);
+	wlr_renderer_submit_ops(renderer, ops.data,
+		ops.size / sizeof(struct wlr_render_op));
+	wl_array_release(&ops);
+	pixman_region32_fini(&background);
+
+	struct wlr_scene_node **layer_node;
+	wl_array_for_each(layer_node, &scene_output->layer_nodes) {
+		scene_output_add_present(scene_output,
+			wlr_scene_buffer_from_node(*layer_node));
+	}
+	wl_array_for_each(entry, render_list) {
+		if (entry->composite && entry->node->type == WLR_SCENE_NODE_BUFFER) {
+			scene_output_add_present(scene_output,
+				wlr_scene_buffer_from_node(entry->node));
+		}
+	}
 
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
 		struct highlight_region *damage;
@@ -1281,11 +3066,23 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 		}
 	}
 
+	if (scene_output->scene->debug_scanout) {
+		// Show why the output isn't directly scanned out in the corner
+		struct wlr_box box = { .width = 32, .height = 32 };
+		wlr_render_rect(renderer, &box, scanout_failures[failure].color,
+			output->transform_matrix);
+	}
+
 	wlr_output_render_software_cursors(output, &damage);
 
 	wlr_renderer_end(renderer);
 	pixman_region32_fini(&damage);
 
+	struct wlr_pixman_frame *frame = NULL;
+	if (scene_output->render_thread != NULL) {
+		frame = pixman_renderer_take_frame(renderer);
+	}
+
 	int tr_width, tr_height;
 	wlr_output_transformed_resolution(output, &tr_width, &tr_height);
 
@@ -1294,12 +3091,33 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 
 	pixman_region32_t frame_damage;
 	pixman_region32_init(&frame_damage);
-	wlr_region_transform(&frame_damage, &scene_output->damage->current,
+	wlr_region_transform(&frame_damage, &scene_output->damage_ring.current,
 		transform, tr_width, tr_height);
 	wlr_output_set_damage(output, &frame_damage);
 	pixman_region32_fini(&frame_damage);
 
+	if (frame != NULL) {
+		// The output is committed once the frame has been composited. Its
+		// damage is consumed right away, damage accumulated in the meantime
+		// goes to the next frame.
+		wlr_damage_ring_rotate_buffer(&scene_output->damage_ring, buffer);
+		wlr_buffer_unlock(buffer);
+		// Let the other outputs render in the meantime
+		renderer_bind_buffer(renderer, NULL);
+		scene_output->commit_pending = true;
+		scene_render_thread_submit(scene_output->render_thread, frame);
+		return true;
+	}
+
 	bool success = wlr_output_commit(output);
+	if (success) {
+		wlr_damage_ring_rotate_buffer(&scene_output->damage_ring, buffer);
+		stats->composited_frames++;
+	} else {
+		scene_output->present_buffers.size = 0;
+		scene_output->layers_dirty = true;
+	}
+	wlr_buffer_unlock(buffer);
 
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT &&
 			!wl_list_empty(&scene_output->scene->damage_highlight_regions)) {
@@ -1309,69 +3127,284 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 	return success;
 }
 
-static void scene_node_send_frame_done(struct wlr_scene_node *node,
-		struct wlr_scene_output *scene_output, struct timespec *now) {
-	if (!node->enabled) {
-		return;
-	}
+bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
+	trace_begin("wlr_scene_output_commit %s", scene_output->output->name);
+	bool ok = scene_output_commit(scene_output);
+	trace_end();
+	return ok;
+}
 
-	if (node->type == WLR_SCENE_NODE_BUFFER) {
-		struct wlr_scene_buffer *scene_buffer =
-			wlr_scene_buffer_from_node(node);
+void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
+		struct timespec *now) {
+	struct wl_array *render_list = scene_output_get_render_list(scene_output);
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, render_list) {
+		if (entry->node->type != WLR_SCENE_NODE_BUFFER) {
+			continue;
+		}
 
-		if (scene_buffer->primary_output == scene_output) {
-			wlr_scene_buffer_send_frame_done(scene_buffer, now);
+		struct wlr_scene_buffer *scene_buffer =
+			wlr_scene_buffer_from_node(entry->node);
+		if (scene_buffer->primary_output != scene_output) {
+			continue;
 		}
-	} else if (node->type == WLR_SCENE_NODE_TREE) {
-		struct wlr_scene_tree *scene_tree = scene_tree_from_node(node);
-		struct wlr_scene_node *child;
-		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_node_send_frame_done(child, scene_output, now);
+		if (scene_buffer->occluded &&
+				scene_output->scene->hidden_frame_done_interval > 0) {
+			// Throttled by scene_handle_hidden_frame_done_timer()
+			continue;
 		}
+		wlr_scene_buffer_send_frame_done(scene_buffer, now);
 	}
 }
 
-void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
-		struct timespec *now) {
-	scene_node_send_frame_done(&scene_output->scene->tree.node,
-		scene_output, now);
+void wlr_scene_output_for_each_buffer(struct wlr_scene_output *scene_output,
+		wlr_scene_buffer_iterator_func_t iterator, void *user_data) {
+	struct wl_array *render_list = scene_output_get_render_list(scene_output);
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, render_list) {
+		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
+			struct wlr_scene_buffer *scene_buffer =
+				wlr_scene_buffer_from_node(entry->node);
+			iterator(scene_buffer, entry->x, entry->y, user_data);
+		}
+	}
 }
 
-static void scene_output_for_each_scene_buffer(const struct wlr_box *output_box,
-		struct wlr_scene_node *node, int lx, int ly,
-		wlr_scene_buffer_iterator_func_t user_iterator, void *user_data) {
-	if (!node->enabled) {
+struct node_capture_data {
+	struct wl_array *entries; // struct render_list_entry
+	float scale;
+	int width, height;
+};
+
+static void node_capture_iterator(struct wlr_scene_node *node,
+		int x, int y, void *_data) {
+	struct node_capture_data *data = _data;
+	if (node->type == WLR_SCENE_NODE_TREE) {
 		return;
 	}
 
-	lx += node->x;
-	ly += node->y;
+	struct wlr_box box = { .x = x, .y = y };
+	scene_node_get_size(node, &box.width, &box.height);
+	scale_box(&box, data->scale);
 
-	if (node->type == WLR_SCENE_NODE_BUFFER) {
-		struct wlr_box node_box = { .x = lx, .y = ly };
-		scene_node_get_size(node, &node_box.width, &node_box.height);
+	struct wlr_box buffer_box = { .width = data->width, .height = data->height };
+	struct wlr_box intersection;
+	if (!wlr_box_intersection(&intersection, &buffer_box, &box)) {
+		return;
+	}
 
-		struct wlr_box intersection;
-		if (wlr_box_intersection(&intersection, output_box, &node_box)) {
+	struct render_list_entry *entry =
+		wl_array_add(data->entries, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	*entry = (struct render_list_entry){
+		.node = node,
+		.x = x,
+		.y = y,
+		.box = box,
+		.composite = true,
+	};
+	pixman_region32_init_rect(&entry->damage, intersection.x, intersection.y,
+		intersection.width, intersection.height);
+}
+
+// Only the damaged part of the buffer is drawn, if damage isn't NULL
+static bool scene_node_render(struct wlr_scene_node *node,
+		struct wlr_renderer *renderer, struct wlr_buffer *buffer, float scale,
+		const pixman_region32_t *damage) {
+	// The node is drawn at the origin of the buffer, whatever its position
+	struct wl_array entries;
+	wl_array_init(&entries);
+	struct node_capture_data data = {
+		.entries = &entries,
+		.scale = scale,
+		.width = buffer->width,
+		.height = buffer->height,
+	};
+	scene_node_for_each_node(node, -node->x, -node->y,
+		node_capture_iterator, &data);
+
+	struct wl_array ops;
+	wl_array_init(&ops);
+
+	struct wlr_render_op *clear = wl_array_add(&ops, sizeof(*clear));
+	if (clear != NULL) {
+		*clear = (struct wlr_render_op){
+			.type = WLR_RENDER_OP_CLEAR,
+			.clip = damage,
+			.clear.color = { 0.0, 0.0, 0.0, 0.0 },
+		};
+	}
+
+	float projection[9];
+	wlr_matrix_identity(projection);
+
+	struct render_list_entry *entry;
+	wl_array_for_each(entry, &entries) {
+		if (damage != NULL) {
+			pixman_region32_intersect(&entry->damage, &entry->damage, damage);
+			if (!pixman_region32_not_empty(&entry->damage)) {
+				continue;
+			}
+		}
+
+		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
 			struct wlr_scene_buffer *scene_buffer =
-				wlr_scene_buffer_from_node(node);
-			user_iterator(scene_buffer, lx, ly, user_data);
+				wlr_scene_buffer_from_node(entry->node);
+			entry->fill = scene_buffer_get_color(scene_buffer,
+				entry->fill_color);
+			if (!entry->fill && scene_buffer->buffer != NULL) {
+				entry->texture = scene_buffer_get_texture(scene_buffer,
+					renderer, &entry->atlas_region);
+			}
+			if (!entry->fill && entry->texture == NULL) {
+				continue;
+			}
 		}
-	} else if (node->type == WLR_SCENE_NODE_TREE) {
-		struct wlr_scene_tree *scene_tree = scene_tree_from_node(node);
-		struct wlr_scene_node *child;
-		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_output_for_each_scene_buffer(output_box, child, lx, ly,
-				user_iterator, user_data);
+		render_list_entry_push_op(entry, projection, &ops);
+	}
+
+	bool ok = wlr_renderer_begin_with_buffer(renderer, buffer);
+	if (ok) {
+		wlr_renderer_submit_ops(renderer, ops.data,
+			ops.size / sizeof(struct wlr_render_op));
+		wlr_renderer_end(renderer);
+	}
+
+	wl_array_release(&ops);
+	render_list_finish(&entries);
+	return ok;
+}
+
+bool wlr_scene_node_render(struct wlr_scene_node *node,
+		struct wlr_renderer *renderer, struct wlr_buffer *buffer, float scale) {
+	return scene_node_render(node, renderer, buffer, scale, NULL);
+}
+
+static void render_cache_destroy(struct scene_render_cache *cache) {
+	wlr_addon_finish(&cache->addon);
+	wl_list_remove(&cache->link);
+	wlr_damage_ring_finish(&cache->damage_ring);
+	free(cache);
+}
+
+static void render_cache_handle_addon_destroy(struct wlr_addon *addon) {
+	struct scene_render_cache *cache = wl_container_of(addon, cache, addon);
+	render_cache_destroy(cache);
+}
+
+static const struct wlr_addon_interface render_cache_addon_impl = {
+	.name = "scene_render_cache",
+	.destroy = render_cache_handle_addon_destroy,
+};
+
+static struct scene_render_cache *render_cache_get_or_create(
+		struct wlr_scene_node *node) {
+	struct wlr_addon *addon = wlr_addon_find(&node->addons,
+		&render_cache_addon_impl, &render_cache_addon_impl);
+	if (addon != NULL) {
+		struct scene_render_cache *cache =
+			wl_container_of(addon, cache, addon);
+		return cache;
+	}
+
+	struct scene_render_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	cache->node = node;
+	cache->scale = 1;
+	wlr_damage_ring_init(&cache->damage_ring);
+	wlr_addon_init(&cache->addon, &node->addons, &render_cache_addon_impl,
+		&render_cache_addon_impl);
+
+	struct wlr_scene *scene = scene_node_get_root(node);
+	wl_list_insert(&scene->render_caches, &cache->link);
+	return cache;
+}
+
+bool wlr_scene_node_render_to_buffer(struct wlr_scene_node *node,
+		struct wlr_renderer *renderer, struct wlr_buffer *buffer, float scale,
+		pixman_region32_t *damage) {
+	struct scene_render_cache *cache = render_cache_get_or_create(node);
+	if (cache == NULL) {
+		return false;
+	}
+
+	wlr_damage_ring_set_bounds(&cache->damage_ring,
+		buffer->width, buffer->height);
+	if (cache->scale != scale) {
+		cache->scale = scale;
+		wlr_damage_ring_add_whole(&cache->damage_ring);
+	}
+
+	pixman_region32_t buffer_damage;
+	pixman_region32_init(&buffer_damage);
+	wlr_damage_ring_get_buffer_damage(&cache->damage_ring, buffer,
+		&buffer_damage);
+
+	bool ok = true;
+	if (pixman_region32_not_empty(&buffer_damage)) {
+		ok = scene_node_render(node, renderer, buffer, scale, &buffer_damage);
+	}
+	if (ok) {
+		wlr_damage_ring_rotate_buffer(&cache->damage_ring, buffer);
+		if (damage != NULL) {
+			pixman_region32_copy(damage, &buffer_damage);
 		}
 	}
+
+	pixman_region32_fini(&buffer_damage);
+	return ok;
 }
 
-void wlr_scene_output_for_each_buffer(struct wlr_scene_output *scene_output,
-		wlr_scene_buffer_iterator_func_t iterator, void *user_data) {
-	struct wlr_box box = { .x = scene_output->x, .y = scene_output->y };
-	wlr_output_effective_resolution(scene_output->output,
-		&box.width, &box.height);
-	scene_output_for_each_scene_buffer(&box, &scene_output->scene->tree.node, 0, 0,
-		iterator, user_data);
+struct single_buffer_data {
+	struct wlr_scene_buffer *found;
+	size_t nodes_len;
+};
+
+static void single_buffer_iterator(struct wlr_scene_node *node,
+		int x, int y, void *_data) {
+	struct single_buffer_data *data = _data;
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		return;
+	}
+
+	data->nodes_len++;
+	if (node->type != WLR_SCENE_NODE_BUFFER || x != 0 || y != 0) {
+		return;
+	}
+	data->found = wlr_scene_buffer_from_node(node);
+}
+
+struct wlr_buffer *wlr_scene_node_get_single_buffer(
+		struct wlr_scene_node *node) {
+	struct single_buffer_data data = {0};
+	scene_node_for_each_node(node, -node->x, -node->y,
+		single_buffer_iterator, &data);
+	if (data.nodes_len != 1 || data.found == NULL) {
+		return NULL;
+	}
+
+	struct wlr_scene_buffer *scene_buffer = data.found;
+	struct wlr_buffer *buffer = scene_buffer->buffer;
+	if (buffer == NULL || scene_buffer->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+			!wlr_fbox_empty(&scene_buffer->src_box)) {
+		return NULL;
+	}
+	if ((scene_buffer->dst_width != 0 &&
+			scene_buffer->dst_width != buffer->width) ||
+			(scene_buffer->dst_height != 0 &&
+			scene_buffer->dst_height != buffer->height)) {
+		return NULL;
+	}
+
+	struct wlr_dmabuf_attributes dmabuf;
+	if (!wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		return NULL;
+	}
+	return buffer;
 }
@@ -9,12 +9,65 @@
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/util/log.h>
+#include "types/wlr_input_latency.h"
 #include "types/wlr_seat.h"
 #include "util/global.h"
 #include "util/signal.h"
 
 #define SEAT_VERSION 7
 
+#define MIN_CLIENT_BUCKETS 16
+
+static size_t client_bucket(struct wlr_seat *seat,
+		struct wl_client *client) {
+	// Fibonacci hashing, the low bits of pointers are mostly zero
+	uint64_t hash = (uint64_t)(uintptr_t)client * 0x9E3779B97F4A7C15ull;
+	return (size_t)(hash >> 32) & (seat->client_buckets_len - 1);
+}
+
+static void seat_resize_client_buckets(struct wlr_seat *seat, size_t len) {
+	struct wl_list *buckets = calloc(len, sizeof(*buckets));
+	if (buckets == NULL) {
+		// Keep the current table, lookups just get slower
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	for (size_t i = 0; i < len; i++) {
+		wl_list_init(&buckets[i]);
+	}
+
+	free(seat->client_buckets);
+	seat->client_buckets = buckets;
+	seat->client_buckets_len = len;
+
+	struct wlr_seat_client *seat_client;
+	wl_list_for_each(seat_client, &seat->clients, link) {
+		wl_list_insert(&buckets[client_bucket(seat, seat_client->client)],
+			&seat_client->bucket_link);
+	}
+}
+
+static void seat_add_client(struct wlr_seat *seat,
+		struct wlr_seat_client *seat_client) {
+	wl_list_insert(&seat->clients, &seat_client->link);
+	seat->clients_len++;
+
+	size_t len = seat->client_buckets_len;
+	if (len == 0 || seat->clients_len > len) {
+		seat_resize_client_buckets(seat,
+			len == 0 ? MIN_CLIENT_BUCKETS : len * 2);
+	}
+
+	if (seat->client_buckets_len > 0) {
+		// The resize may have already inserted the new client
+		if (wl_list_empty(&seat_client->bucket_link)) {
+			wl_list_insert(
+				&seat->client_buckets[client_bucket(seat, seat_client->client)],
+				&seat_client->bucket_link);
+		}
+	}
+}
+
 static void seat_handle_get_pointer(struct wl_client *client,
 		struct wl_resource *seat_resource, uint32_t id) {
 	struct wlr_seat_client *seat_client =
@@ -96,6 +149,8 @@ static void seat_client_handle_resource_destroy(
 	}
 
 	wl_list_remove(&client->link);
+	wl_list_remove(&client->bucket_link);
+	client->seat->clients_len--;
 	free(client);
 }
 
@@ -141,8 +196,9 @@ static void seat_handle_bind(struct wl_client *client, void *_wlr_seat,
 		wl_list_init(&seat_client->touches);
 		wl_list_init(&seat_client->data_devices);
 		wl_signal_init(&seat_client->events.destroy);
+		wl_list_init(&seat_client->bucket_link);
 
-		wl_list_insert(&wlr_seat->clients, &seat_client->link);
+		seat_add_client(wlr_seat, seat_client);
 
 		struct wlr_surface *pointer_focus =
 			wlr_seat->pointer_state.focused_surface;
@@ -168,6 +224,12 @@ static void seat_handle_bind(struct wl_client *client, void *_wlr_seat,
 	wl_seat_send_capabilities(wl_resource, wlr_seat->capabilities);
 }
 
+void seat_handle_input_delivery(struct wlr_seat *seat) {
+	if (seat->input_latency != NULL) {
+		input_latency_handle_delivery(seat->input_latency);
+	}
+}
+
 void wlr_seat_destroy(struct wlr_seat *seat) {
 	if (!seat) {
 		return;
@@ -209,6 +271,7 @@ void wlr_seat_destroy(struct wlr_seat *seat) {
 	free(seat->pointer_state.default_grab);
 	free(seat->keyboard_state.default_grab);
 	free(seat->touch_state.default_grab);
+	free(seat->client_buckets);
 	free(seat->name);
 	free(seat);
 }
@@ -322,6 +385,17 @@ struct wlr_seat *wlr_seat_create(struct wl_display *display, const char *name) {
 struct wlr_seat_client *wlr_seat_client_for_wl_client(struct wlr_seat *wlr_seat,
 		struct wl_client *wl_client) {
 	struct wlr_seat_client *seat_client;
+	if (wlr_seat->client_buckets_len > 0) {
+		struct wl_list *bucket =
+			&wlr_seat->client_buckets[client_bucket(wlr_seat, wl_client)];
+		wl_list_for_each(seat_client, bucket, bucket_link) {
+			if (seat_client->client == wl_client) {
+				return seat_client;
+			}
+		}
+		return NULL;
+	}
+
 	wl_list_for_each(seat_client, &wlr_seat->clients, link) {
 		if (seat_client->client == wl_client) {
 			return seat_client;
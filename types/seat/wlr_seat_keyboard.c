@@ -81,6 +81,7 @@ void wlr_seat_keyboard_send_key(struct wlr_seat *wlr_seat, uint32_t time,
 
 		wl_keyboard_send_key(resource, serial, time, key, state);
 	}
+	seat_handle_input_delivery(wlr_seat);
 }
 
 static void seat_client_send_keymap(struct wlr_seat_client *client,
@@ -377,8 +378,11 @@ static void seat_client_send_repeat_info(struct wlr_seat_client *client,
 
 		if (wl_resource_get_version(resource) >=
 				WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION) {
+			// A rate of zero disables client-side repeat
+			int32_t rate = keyboard->repeater != NULL ?
+				0 : keyboard->repeat_info.rate;
 			wl_keyboard_send_repeat_info(resource,
-				keyboard->repeat_info.rate, keyboard->repeat_info.delay);
+				rate, keyboard->repeat_info.delay);
 		}
 	}
 }
@@ -245,6 +245,7 @@ void wlr_seat_pointer_send_motion(struct wlr_seat *wlr_seat, uint32_t time,
 
 			wl_pointer_send_motion(resource, time, sx_fixed, sy_fixed);
 		}
+		seat_handle_input_delivery(wlr_seat);
 	}
 
 	wlr_seat_pointer_warp(wlr_seat, sx, sy);
@@ -266,6 +267,7 @@ uint32_t wlr_seat_pointer_send_button(struct wlr_seat *wlr_seat, uint32_t time,
 
 		wl_pointer_send_button(resource, serial, time, button, state);
 	}
+	seat_handle_input_delivery(wlr_seat);
 	return serial;
 }
 
@@ -310,6 +312,7 @@ void wlr_seat_pointer_send_axis(struct wlr_seat *wlr_seat, uint32_t time,
 			wl_pointer_send_axis_stop(resource, time, orientation);
 		}
 	}
+	seat_handle_input_delivery(wlr_seat);
 }
 
 void wlr_seat_pointer_send_frame(struct wlr_seat *wlr_seat) {
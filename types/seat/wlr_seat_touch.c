@@ -107,9 +107,20 @@ static void touch_point_clear_focus(struct wlr_touch_point *point) {
 	}
 }
 
+static size_t touch_slot(int32_t touch_id) {
+	return (uint32_t)touch_id % WLR_SEAT_TOUCH_SLOTS;
+}
+
 static void touch_point_destroy(struct wlr_touch_point *point) {
 	wlr_signal_emit_safe(&point->events.destroy, point);
 
+	struct wlr_seat_touch_state *state = &point->client->seat->touch_state;
+	struct wlr_touch_point **slot = &state->point_slots[touch_slot(point->touch_id)];
+	if (*slot == point) {
+		*slot = NULL;
+	}
+	state->num_points--;
+
 	touch_point_clear_focus(point);
 	wl_list_remove(&point->surface_destroy.link);
 	wl_list_remove(&point->client_destroy.link);
@@ -166,12 +177,25 @@ static struct wlr_touch_point *touch_point_create(
 	point->client_destroy.notify = touch_point_handle_client_destroy;
 	wl_list_insert(&seat->touch_state.touch_points, &point->link);
 
+	struct wlr_touch_point **slot =
+		&seat->touch_state.point_slots[touch_slot(touch_id)];
+	if (*slot == NULL) {
+		*slot = point;
+	}
+	seat->touch_state.num_points++;
+
 	return point;
 }
 
 struct wlr_touch_point *wlr_seat_touch_get_point(
 		struct wlr_seat *seat, int32_t touch_id) {
-	struct wlr_touch_point *point = NULL;
+	struct wlr_touch_point *point =
+		seat->touch_state.point_slots[touch_slot(touch_id)];
+	if (point != NULL && point->touch_id == touch_id) {
+		return point;
+	}
+
+	// The slot was taken by another point when this one went down
 	wl_list_for_each(point, &seat->touch_state.touch_points, link) {
 		if (point->touch_id == touch_id) {
 			return point;
@@ -342,12 +366,31 @@ uint32_t wlr_seat_touch_send_down(struct wlr_seat *seat,
 		wl_touch_send_down(resource, serial, time, surface->resource,
 			touch_id, wl_fixed_from_double(sx), wl_fixed_from_double(sy));
 	}
+	seat_handle_input_delivery(seat);
 
 	point->client->needs_touch_frame = true;
 
 	return serial;
 }
 
+static void touch_point_flush_motion(struct wlr_touch_point *point) {
+	if (!point->motion_pending) {
+		return;
+	}
+	point->motion_pending = false;
+
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &point->client->touches) {
+		if (seat_client_from_touch_resource(resource) == NULL) {
+			continue;
+		}
+		wl_touch_send_motion(resource, point->motion_time, point->touch_id,
+			wl_fixed_from_double(point->motion_sx),
+			wl_fixed_from_double(point->motion_sy));
+	}
+	seat_handle_input_delivery(point->client->seat);
+}
+
 void wlr_seat_touch_send_up(struct wlr_seat *seat, uint32_t time, int32_t touch_id) {
 	struct wlr_touch_point *point = wlr_seat_touch_get_point(seat, touch_id);
 	if (!point) {
@@ -355,6 +398,8 @@ void wlr_seat_touch_send_up(struct wlr_seat *seat, uint32_t time, int32_t touch_
 		return;
 	}
 
+	touch_point_flush_motion(point);
+
 	uint32_t serial = wlr_seat_client_next_serial(point->client);
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &point->client->touches) {
@@ -363,6 +408,7 @@ void wlr_seat_touch_send_up(struct wlr_seat *seat, uint32_t time, int32_t touch_
 		}
 		wl_touch_send_up(resource, serial, time, touch_id);
 	}
+	seat_handle_input_delivery(seat);
 
 	point->client->needs_touch_frame = true;
 }
@@ -375,19 +421,21 @@ void wlr_seat_touch_send_motion(struct wlr_seat *seat, uint32_t time, int32_t to
 		return;
 	}
 
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &point->client->touches) {
-		if (seat_client_from_touch_resource(resource) == NULL) {
-			continue;
-		}
-		wl_touch_send_motion(resource, time, touch_id, wl_fixed_from_double(sx),
-			wl_fixed_from_double(sy));
-	}
+	// Only the last motion of each point within a frame is sent
+	point->motion_pending = true;
+	point->motion_time = time;
+	point->motion_sx = sx;
+	point->motion_sy = sy;
 
 	point->client->needs_touch_frame = true;
 }
 
 void wlr_seat_touch_send_frame(struct wlr_seat *seat) {
+	struct wlr_touch_point *point;
+	wl_list_for_each(point, &seat->touch_state.touch_points, link) {
+		touch_point_flush_motion(point);
+	}
+
 	struct wlr_seat_client *seat_client;
 	wl_list_for_each(seat_client, &seat->clients, link) {
 		if (!seat_client->needs_touch_frame) {
@@ -409,6 +457,14 @@ void wlr_seat_touch_send_cancel(struct wlr_seat *seat, struct wlr_surface *surfa
 		return;
 	}
 
+	// The client discards the whole touch sequence anyway
+	struct wlr_touch_point *point;
+	wl_list_for_each(point, &seat->touch_state.touch_points, link) {
+		if (point->client == seat_client) {
+			point->motion_pending = false;
+		}
+	}
+
 	struct wl_resource *resource;
 	wl_resource_for_each(resource, &seat_client->touches) {
 		if (seat_client_from_touch_resource(resource) == NULL) {
@@ -419,7 +475,7 @@ void wlr_seat_touch_send_cancel(struct wlr_seat *seat, struct wlr_surface *surfa
 }
 
 int wlr_seat_touch_num_points(struct wlr_seat *seat) {
-	return wl_list_length(&seat->touch_state.touch_points);
+	return seat->touch_state.num_points;
 }
 
 bool wlr_seat_touch_has_grab(struct wlr_seat *seat) {
@@ -321,6 +321,16 @@ static void queue_tool_frame(struct wlr_tablet_tool_client_v2 *tool) {
 	}
 }
 
+static bool tool_client_update_axis(struct wlr_tablet_tool_client_v2 *client,
+		enum wlr_tablet_tool_axes axis, int32_t *sent, int32_t value) {
+	if ((client->sent_axes & axis) && *sent == value) {
+		return false;
+	}
+	client->sent_axes |= axis;
+	*sent = value;
+	return true;
+}
+
 static void handle_tablet_tool_surface_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_tablet_v2_tablet_tool *tool =
@@ -378,6 +388,7 @@ void wlr_send_tablet_v2_tablet_tool_proximity_in(
 	tool->surface_destroy.notify = handle_tablet_tool_surface_destroy;
 
 	tool->current_client = tool_client;
+	tool_client->sent_axes = 0;
 
 	uint32_t serial = wlr_seat_client_next_serial(tool_client->seat->seat_client);
 	tool->focused_surface = surface;
@@ -404,10 +415,19 @@ void wlr_send_tablet_v2_tablet_tool_motion(
 		return;
 	}
 
-	zwp_tablet_tool_v2_send_motion(tool->current_client->resource,
-		wl_fixed_from_double(x), wl_fixed_from_double(y));
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	wl_fixed_t fx = wl_fixed_from_double(x);
+	wl_fixed_t fy = wl_fixed_from_double(y);
+	bool changed =
+		tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_X, &client->sent_x, fx) |
+		tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_Y, &client->sent_y, fy);
+	if (!changed) {
+		return;
+	}
+
+	zwp_tablet_tool_v2_send_motion(client->resource, fx, fy);
 
-	queue_tool_frame(tool->current_client);
+	queue_tool_frame(client);
 }
 
 void wlr_send_tablet_v2_tablet_tool_proximity_out(
@@ -438,22 +458,38 @@ void wlr_send_tablet_v2_tablet_tool_proximity_out(
 
 void wlr_send_tablet_v2_tablet_tool_pressure(
 		struct wlr_tablet_v2_tablet_tool *tool, double pressure) {
-	if (tool->current_client) {
-		zwp_tablet_tool_v2_send_pressure(tool->current_client->resource,
-			pressure * 65535);
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (!client) {
+		return;
+	}
 
-		queue_tool_frame(tool->current_client);
+	uint32_t value = pressure * 65535;
+	if (!tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_PRESSURE,
+			&client->sent_pressure, (int32_t)value)) {
+		return;
 	}
+
+	zwp_tablet_tool_v2_send_pressure(client->resource, value);
+
+	queue_tool_frame(client);
 }
 
 void wlr_send_tablet_v2_tablet_tool_distance(
 		struct wlr_tablet_v2_tablet_tool *tool, double distance) {
-	if (tool->current_client) {
-		zwp_tablet_tool_v2_send_distance(tool->current_client->resource,
-			distance * 65535);
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	if (!client) {
+		return;
+	}
 
-		queue_tool_frame(tool->current_client);
+	uint32_t value = distance * 65535;
+	if (!tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_DISTANCE,
+			&client->sent_distance, (int32_t)value)) {
+		return;
 	}
+
+	zwp_tablet_tool_v2_send_distance(client->resource, value);
+
+	queue_tool_frame(client);
 }
 
 void wlr_send_tablet_v2_tablet_tool_tilt(
@@ -462,10 +498,21 @@ void wlr_send_tablet_v2_tablet_tool_tilt(
 		return;
 	}
 
-	zwp_tablet_tool_v2_send_tilt(tool->current_client->resource,
-		wl_fixed_from_double(x), wl_fixed_from_double(y));
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	wl_fixed_t fx = wl_fixed_from_double(x);
+	wl_fixed_t fy = wl_fixed_from_double(y);
+	bool changed =
+		tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_TILT_X,
+			&client->sent_tilt_x, fx) |
+		tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_TILT_Y,
+			&client->sent_tilt_y, fy);
+	if (!changed) {
+		return;
+	}
+
+	zwp_tablet_tool_v2_send_tilt(client->resource, fx, fy);
 
-	queue_tool_frame(tool->current_client);
+	queue_tool_frame(client);
 }
 
 void wlr_send_tablet_v2_tablet_tool_rotation(
@@ -474,10 +521,16 @@ void wlr_send_tablet_v2_tablet_tool_rotation(
 		return;
 	}
 
-	zwp_tablet_tool_v2_send_rotation(tool->current_client->resource,
-		wl_fixed_from_double(degrees));
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	wl_fixed_t value = wl_fixed_from_double(degrees);
+	if (!tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_ROTATION,
+			&client->sent_rotation, value)) {
+		return;
+	}
+
+	zwp_tablet_tool_v2_send_rotation(client->resource, value);
 
-	queue_tool_frame(tool->current_client);
+	queue_tool_frame(client);
 }
 
 void wlr_send_tablet_v2_tablet_tool_slider(
@@ -486,10 +539,16 @@ void wlr_send_tablet_v2_tablet_tool_slider(
 		return;
 	}
 
-	zwp_tablet_tool_v2_send_slider(tool->current_client->resource,
-		position * 65535);
+	struct wlr_tablet_tool_client_v2 *client = tool->current_client;
+	int32_t value = position * 65535;
+	if (!tool_client_update_axis(client, WLR_TABLET_TOOL_AXIS_SLIDER,
+			&client->sent_slider, value)) {
+		return;
+	}
 
-	queue_tool_frame(tool->current_client);
+	zwp_tablet_tool_v2_send_slider(client->resource, value);
+
+	queue_tool_frame(client);
 }
 
 void wlr_send_tablet_v2_tablet_tool_button(
@@ -520,6 +579,37 @@ void wlr_send_tablet_v2_tablet_tool_wheel(
 	}
 }
 
+void wlr_send_tablet_v2_tablet_tool_axes(
+		struct wlr_tablet_v2_tablet_tool *tool,
+		const struct wlr_tablet_v2_tool_axes *axes) {
+	if (!tool->current_client) {
+		return;
+	}
+
+	if (axes->updated & (WLR_TABLET_TOOL_AXIS_X | WLR_TABLET_TOOL_AXIS_Y)) {
+		wlr_send_tablet_v2_tablet_tool_motion(tool, axes->x, axes->y);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_PRESSURE) {
+		wlr_send_tablet_v2_tablet_tool_pressure(tool, axes->pressure);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_DISTANCE) {
+		wlr_send_tablet_v2_tablet_tool_distance(tool, axes->distance);
+	}
+	if (axes->updated & (WLR_TABLET_TOOL_AXIS_TILT_X | WLR_TABLET_TOOL_AXIS_TILT_Y)) {
+		wlr_send_tablet_v2_tablet_tool_tilt(tool, axes->tilt_x, axes->tilt_y);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_ROTATION) {
+		wlr_send_tablet_v2_tablet_tool_rotation(tool, axes->rotation);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_SLIDER) {
+		wlr_send_tablet_v2_tablet_tool_slider(tool, axes->slider);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_WHEEL) {
+		wlr_send_tablet_v2_tablet_tool_wheel(tool, axes->wheel_delta,
+			axes->wheel_clicks);
+	}
+}
+
 void wlr_send_tablet_v2_tablet_tool_down(struct wlr_tablet_v2_tablet_tool *tool) {
 	if (tool->is_down) {
 		return;
@@ -621,6 +711,33 @@ void wlr_tablet_v2_tablet_tool_notify_wheel(
 	}
 }
 
+void wlr_tablet_v2_tablet_tool_notify_axes(
+		struct wlr_tablet_v2_tablet_tool *tool,
+		const struct wlr_tablet_v2_tool_axes *axes) {
+	if (axes->updated & (WLR_TABLET_TOOL_AXIS_X | WLR_TABLET_TOOL_AXIS_Y)) {
+		wlr_tablet_v2_tablet_tool_notify_motion(tool, axes->x, axes->y);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_PRESSURE) {
+		wlr_tablet_v2_tablet_tool_notify_pressure(tool, axes->pressure);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_DISTANCE) {
+		wlr_tablet_v2_tablet_tool_notify_distance(tool, axes->distance);
+	}
+	if (axes->updated & (WLR_TABLET_TOOL_AXIS_TILT_X | WLR_TABLET_TOOL_AXIS_TILT_Y)) {
+		wlr_tablet_v2_tablet_tool_notify_tilt(tool, axes->tilt_x, axes->tilt_y);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_ROTATION) {
+		wlr_tablet_v2_tablet_tool_notify_rotation(tool, axes->rotation);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_SLIDER) {
+		wlr_tablet_v2_tablet_tool_notify_slider(tool, axes->slider);
+	}
+	if (axes->updated & WLR_TABLET_TOOL_AXIS_WHEEL) {
+		wlr_tablet_v2_tablet_tool_notify_wheel(tool, axes->wheel_delta,
+			axes->wheel_clicks);
+	}
+}
+
 void wlr_tablet_v2_tablet_tool_notify_proximity_out(
 	struct wlr_tablet_v2_tablet_tool *tool) {
 	if (tool->grab->interface->proximity_out) {
@@ -1,14 +1,19 @@
 #include <assert.h>
 #include <drm_fourcc.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/interfaces/wlr_buffer.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_drm.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_single_pixel_buffer_v1.h>
 #include <wlr/util/log.h>
 #include "render/pixel_format.h"
+#include "render/wlr_renderer.h"
 #include "types/wlr_buffer.h"
+#include "types/wlr_client_usage.h"
+#include "types/wlr_shm.h"
 #include "util/signal.h"
 
 void wlr_buffer_init(struct wlr_buffer *buffer,
@@ -128,7 +133,16 @@ static struct wlr_client_buffer *client_buffer_from_buffer(
 static void client_buffer_destroy(struct wlr_buffer *buffer) {
 	struct wlr_client_buffer *client_buffer = client_buffer_from_buffer(buffer);
 	wl_list_remove(&client_buffer->source_destroy.link);
-	wlr_texture_destroy(client_buffer->texture);
+	wl_list_remove(&client_buffer->renderer_destroy.link);
+	client_buffer_discard_pending(client_buffer, NULL);
+	pixman_region32_fini(&client_buffer->pending_damage);
+	if (client_buffer->renderer != NULL &&
+			client_buffer->shm_source_format != DRM_FORMAT_INVALID) {
+		renderer_texture_pool_release(client_buffer->renderer,
+			client_buffer->texture, client_buffer->shm_source_format);
+	} else {
+		wlr_texture_destroy(client_buffer->texture);
+	}
 	free(client_buffer);
 }
 
@@ -157,6 +171,48 @@ static void client_buffer_handle_source_destroy(struct wl_listener *listener,
 	client_buffer->source = NULL;
 }
 
+static void client_buffer_handle_renderer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_client_buffer *client_buffer =
+		wl_container_of(listener, client_buffer, renderer_destroy);
+	wl_list_remove(&client_buffer->renderer_destroy.link);
+	wl_list_init(&client_buffer->renderer_destroy.link);
+	client_buffer->renderer = NULL;
+}
+
+/**
+ * Upload the pixels of a buffer to a released texture of the same format and
+ * size, if any. This saves allocating a new texture when clients rotate
+ * through buffers.
+ */
+static struct wlr_texture *texture_from_pool(struct wlr_renderer *renderer,
+		struct wlr_buffer *buffer) {
+	struct wlr_dmabuf_attributes dmabuf;
+	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		// Importing the buffer is cheaper than uploading its pixels
+		return NULL;
+	}
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+		return NULL;
+	}
+
+	struct wlr_texture *texture = renderer_texture_pool_acquire(renderer,
+		format, buffer->width, buffer->height);
+	if (texture != NULL && !wlr_texture_write_pixels(texture, stride,
+			buffer->width, buffer->height, 0, 0, 0, 0, data)) {
+		wlr_texture_destroy(texture);
+		texture = NULL;
+	}
+
+	wlr_buffer_end_data_ptr_access(buffer);
+	return texture;
+}
+
 static struct wlr_shm_client_buffer *shm_client_buffer_get_or_create(
 	struct wl_resource *resource);
 static bool buffer_is_shm_client_buffer(struct wlr_buffer *buffer);
@@ -234,13 +290,33 @@ struct wlr_buffer *wlr_buffer_from_resource(struct wl_resource *resource) {
 		buffer = wlr_buffer_lock(custom_buffer);
 	}
 
+	client_usage_add_buffer(wl_resource_get_client(resource), buffer);
+
 	return buffer;
 }
 
 struct wlr_client_buffer *wlr_client_buffer_create(struct wlr_buffer *buffer,
 		struct wlr_renderer *renderer) {
-	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, buffer);
-	if (texture == NULL) {
+	// Single-pixel buffers are drawn as color fills, the texture is only
+	// created if someone asks for it
+	float color[4] = {0};
+	bool has_color = wlr_single_pixel_buffer_v1_get_color(buffer, color);
+
+	struct wlr_texture *texture = NULL;
+	if (!has_color) {
+		texture = texture_from_pool(renderer, buffer);
+	}
+	if (texture == NULL && !has_color) {
+		texture = wlr_texture_from_buffer(renderer, buffer);
+	}
+	if (texture == NULL && !has_color &&
+			shm_buffer_disable_dmabuf(buffer)) {
+		// The udmabuf couldn't be imported, copy the pixels instead
+		wlr_log(WLR_DEBUG, "Failed to import shm buffer as DMA-BUF, "
+			"falling back to copying");
+		texture = wlr_texture_from_buffer(renderer, buffer);
+	}
+	if (texture == NULL && !has_color) {
 		wlr_log(WLR_ERROR, "Failed to create texture");
 		return NULL;
 	}
@@ -252,21 +328,40 @@ struct wlr_client_buffer *wlr_client_buffer_create(struct wlr_buffer *buffer,
 		return NULL;
 	}
 	wlr_buffer_init(&client_buffer->base, &client_buffer_impl,
-		texture->width, texture->height);
+		buffer->width, buffer->height);
 	client_buffer->source = buffer;
 	client_buffer->texture = texture;
+	client_buffer->has_color = has_color;
+	memcpy(client_buffer->color, color, sizeof(color));
+	pixman_region32_init(&client_buffer->pending_damage);
+	// The client buffer is imported from the same DMA-BUF, if any
+	client_buffer->base.scanout = buffer->scanout;
 
 	wl_signal_add(&buffer->events.destroy, &client_buffer->source_destroy);
 	client_buffer->source_destroy.notify = client_buffer_handle_source_destroy;
 
+	client_buffer->renderer = renderer;
+	wl_signal_add(&renderer->events.destroy, &client_buffer->renderer_destroy);
+	client_buffer->renderer_destroy.notify =
+		client_buffer_handle_renderer_destroy;
+
+	struct wlr_dmabuf_attributes dmabuf;
+	struct wlr_shm_attributes shm;
 	if (buffer_is_shm_client_buffer(buffer)) {
 		struct wlr_shm_client_buffer *shm_client_buffer =
 			shm_client_buffer_from_buffer(buffer);
 		client_buffer->shm_source_format = shm_client_buffer->format;
+	} else if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		// The texture samples the client's memory, there's nothing to upload
+		client_buffer->shm_source_format = DRM_FORMAT_INVALID;
+	} else if (wlr_buffer_get_shm(buffer, &shm)) {
+		client_buffer->shm_source_format = shm.format;
 	} else {
 		client_buffer->shm_source_format = DRM_FORMAT_INVALID;
 	}
 
+	client_usage_add_client_buffer(client_buffer);
+
 	// Ensure the buffer will be released before being destroyed
 	wlr_buffer_lock(&client_buffer->base);
 	wlr_buffer_drop(&client_buffer->base);
@@ -274,13 +369,86 @@ struct wlr_client_buffer *wlr_client_buffer_create(struct wlr_buffer *buffer,
 	return client_buffer;
 }
 
-bool wlr_client_buffer_apply_damage(struct wlr_client_buffer *client_buffer,
-		struct wlr_buffer *next, pixman_region32_t *damage) {
+// Above this many rectangles, the bounding box of the damage is uploaded
+#define UPLOAD_DAMAGE_MAX_RECTS 16
+// Rectangles are merged if this doesn't upload more undamaged pixels
+#define UPLOAD_DAMAGE_MAX_WASTE (64 * 64)
+
+static int64_t box_area(const pixman_box32_t *box) {
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+/**
+ * Reduce the number of rectangles to upload, at the cost of uploading some
+ * undamaged pixels. Rectangles are merged when their bounding box doesn't
+ * waste too many pixels, and the bounding box of the whole damage is used
+ * when many rectangles remain. Returns the number of boxes written, which may
+ * overlap.
+ */
+static size_t coalesce_upload_damage(pixman_region32_t *damage,
+		pixman_box32_t boxes[static UPLOAD_DAMAGE_MAX_RECTS]) {
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
+	if (rects_len == 0) {
+		return 0;
+	}
+
+	// Number of damaged pixels in each box
+	int64_t areas[UPLOAD_DAMAGE_MAX_RECTS];
+	size_t boxes_len = 0;
+	for (int i = 0; i < rects_len; i++) {
+		pixman_box32_t box = rects[i];
+		int64_t area = box_area(&box);
+
+		// Pixman rectangles are sorted in bands, nearby rectangles are
+		// usually found among the latest boxes
+		size_t j = boxes_len;
+		while (j > 0) {
+			j--;
+			pixman_box32_t *b = &boxes[j];
+			pixman_box32_t u = {
+				.x1 = b->x1 < box.x1 ? b->x1 : box.x1,
+				.y1 = b->y1 < box.y1 ? b->y1 : box.y1,
+				.x2 = b->x2 > box.x2 ? b->x2 : box.x2,
+				.y2 = b->y2 > box.y2 ? b->y2 : box.y2,
+			};
+			if (box_area(&u) - areas[j] - area <= UPLOAD_DAMAGE_MAX_WASTE) {
+				*b = u;
+				areas[j] += area;
+				area = -1;
+				break;
+			}
+		}
+		if (area < 0) {
+			continue;
+		}
+
+		if (boxes_len == UPLOAD_DAMAGE_MAX_RECTS) {
+			boxes[0] = *pixman_region32_extents(damage);
+			return 1;
+		}
+		boxes[boxes_len] = box;
+		areas[boxes_len] = area;
+		boxes_len++;
+	}
+
+	return boxes_len;
+}
+
+static bool client_buffer_can_update(struct wlr_client_buffer *client_buffer,
+		struct wlr_buffer *next) {
 	if (client_buffer->base.n_locks > 1) {
 		// Someone else still has a reference to the buffer
 		return false;
 	}
 
+	float color[4];
+	if (client_buffer->texture == NULL ||
+			wlr_single_pixel_buffer_v1_get_color(next, color)) {
+		// Single-pixel buffers are never uploaded
+		return false;
+	}
+
 	if ((uint32_t)next->width != client_buffer->texture->width ||
 			(uint32_t)next->height != client_buffer->texture->height) {
 		return false;
@@ -292,6 +460,17 @@ bool wlr_client_buffer_apply_damage(struct wlr_client_buffer *client_buffer,
 		return false;
 	}
 
+	struct wlr_dmabuf_attributes dmabuf;
+	if (wlr_buffer_get_dmabuf(next, &dmabuf)) {
+		// Importing the next buffer is cheaper than uploading its pixels
+		return false;
+	}
+
+	return true;
+}
+
+static bool client_buffer_upload(struct wlr_client_buffer *client_buffer,
+		struct wlr_buffer *next, pixman_region32_t *damage) {
 	void *data;
 	uint32_t format;
 	size_t stride;
@@ -306,20 +485,108 @@ bool wlr_client_buffer_apply_damage(struct wlr_client_buffer *client_buffer,
 		return false;
 	}
 
-	int n;
-	pixman_box32_t *rects = pixman_region32_rectangles(damage, &n);
-	for (int i = 0; i < n; ++i) {
-		pixman_box32_t *r = &rects[i];
-		if (!wlr_texture_write_pixels(client_buffer->texture, stride,
-				r->x2 - r->x1, r->y2 - r->y1, r->x1, r->y1,
-				r->x1, r->y1, data)) {
-			wlr_buffer_end_data_ptr_access(next);
-			return false;
-		}
+	pixman_box32_t boxes[UPLOAD_DAMAGE_MAX_RECTS];
+	size_t boxes_len = coalesce_upload_damage(damage, boxes);
+	bool ok = wlr_texture_write_pixels_rects(client_buffer->texture, stride,
+		boxes, boxes_len, data);
+
+	wlr_buffer_end_data_ptr_access(next);
+
+	return ok;
+}
+
+bool wlr_client_buffer_apply_damage(struct wlr_client_buffer *client_buffer,
+		struct wlr_buffer *next, pixman_region32_t *damage) {
+	if (!client_buffer_can_update(client_buffer, next)) {
+		return false;
+	}
+
+	if (client_buffer->pending_source == NULL) {
+		return client_buffer_upload(client_buffer, next, damage);
 	}
 
+	// The deferred damage is up-to-date in the next buffer as well
+	pixman_region32_t full_damage;
+	pixman_region32_init(&full_damage);
+	pixman_region32_union(&full_damage, damage, &client_buffer->pending_damage);
+	bool ok = client_buffer_upload(client_buffer, next, &full_damage);
+	pixman_region32_fini(&full_damage);
+	if (ok) {
+		client_buffer_discard_pending(client_buffer, NULL);
+	}
+	return ok;
+}
+
+bool client_buffer_defer_damage(struct wlr_client_buffer *client_buffer,
+		struct wlr_buffer *next, const pixman_region32_t *damage) {
+	if (!client_buffer_can_update(client_buffer, next)) {
+		return false;
+	}
+
+	// Check the format now, so that the upload doesn't fail later on
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(next, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+			&data, &format, &stride)) {
+		return false;
+	}
 	wlr_buffer_end_data_ptr_access(next);
+	if (format != client_buffer->shm_source_format) {
+		return false;
+	}
+
+	// Damage accumulates across commits, uploading it from the latest buffer
+	// brings the texture up-to-date
+	pixman_region32_union(&client_buffer->pending_damage,
+		&client_buffer->pending_damage, damage);
+	if (client_buffer->pending_source != next) {
+		wlr_buffer_unlock(client_buffer->pending_source);
+		client_buffer->pending_source = wlr_buffer_lock(next);
+	}
+	return true;
+}
+
+void client_buffer_discard_pending(struct wlr_client_buffer *client_buffer,
+		pixman_region32_t *damage) {
+	if (client_buffer->pending_source == NULL) {
+		return;
+	}
+	if (damage != NULL) {
+		pixman_region32_union(damage, damage, &client_buffer->pending_damage);
+	}
+	wlr_buffer_unlock(client_buffer->pending_source);
+	client_buffer->pending_source = NULL;
+	pixman_region32_clear(&client_buffer->pending_damage);
+}
 
+struct wlr_texture *client_buffer_get_texture(
+		struct wlr_client_buffer *client_buffer) {
+	if (client_buffer->pending_source != NULL) {
+		if (!client_buffer_upload(client_buffer, client_buffer->pending_source,
+				&client_buffer->pending_damage)) {
+			wlr_log(WLR_ERROR, "Failed to upload deferred buffer damage");
+		}
+		client_buffer_discard_pending(client_buffer, NULL);
+	}
+	if (client_buffer->texture == NULL && client_buffer->has_color &&
+			client_buffer->renderer != NULL) {
+		const float *color = client_buffer->color;
+		uint8_t argb8888[4] = {
+			color[2] * 0xFF, color[1] * 0xFF, color[0] * 0xFF, color[3] * 0xFF,
+		};
+		client_buffer->texture = wlr_texture_from_pixels(client_buffer->renderer,
+			DRM_FORMAT_ARGB8888, sizeof(argb8888), 1, 1, argb8888);
+	}
+	return client_buffer->texture;
+}
+
+bool client_buffer_get_color(struct wlr_client_buffer *client_buffer,
+		float color[static 4]) {
+	if (!client_buffer->has_color) {
+		return false;
+	}
+	memcpy(color, client_buffer->color, sizeof(client_buffer->color));
 	return true;
 }
 
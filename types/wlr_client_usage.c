@@ -0,0 +1,273 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/log.h>
+#include "render/pixel_format.h"
+#include "types/wlr_client_usage.h"
+#include "util/signal.h"
+
+enum client_usage_entry_kind {
+	CLIENT_USAGE_BUFFER,
+	CLIENT_USAGE_DMABUF,
+	CLIENT_USAGE_TEXTURE,
+};
+
+/**
+ * A buffer or a texture accounted to a client. Attached to the wlr_buffer (or
+ * the wlr_client_buffer for textures) as an addon, so that it's removed from
+ * the totals when the buffer is destroyed.
+ */
+struct client_usage_entry {
+	struct wlr_client_usage *usage;
+	enum client_usage_entry_kind kind;
+	size_t bytes;
+	struct wlr_renderer *renderer; // only used as a key, may be destroyed
+
+	struct wlr_addon addon;
+	struct wl_list link; // wlr_client_usage.entries
+};
+
+static void usage_account(struct wlr_client_usage *usage,
+		enum client_usage_entry_kind kind, size_t bytes, bool add) {
+	size_t *count, *total;
+	switch (kind) {
+	case CLIENT_USAGE_DMABUF:
+		if (add) {
+			usage->dmabuf_buffers++;
+			usage->dmabuf_bytes += bytes;
+		} else {
+			usage->dmabuf_buffers--;
+			usage->dmabuf_bytes -= bytes;
+		}
+		// fallthrough
+	case CLIENT_USAGE_BUFFER:
+		count = &usage->buffers;
+		total = &usage->buffer_bytes;
+		break;
+	case CLIENT_USAGE_TEXTURE:
+		count = &usage->textures;
+		total = &usage->texture_bytes;
+		break;
+	default:
+		abort(); // unreachable
+	}
+
+	if (add) {
+		(*count)++;
+		*total += bytes;
+	} else {
+		assert(*count > 0 && *total >= bytes);
+		(*count)--;
+		*total -= bytes;
+	}
+}
+
+static void entry_destroy(struct client_usage_entry *entry) {
+	wlr_addon_finish(&entry->addon);
+	wl_list_remove(&entry->link);
+	free(entry);
+}
+
+static void entry_addon_destroy(struct wlr_addon *addon) {
+	struct client_usage_entry *entry = wl_container_of(addon, entry, addon);
+	struct wlr_client_usage *usage = entry->usage;
+	usage_account(usage, entry->kind, entry->bytes, false);
+	entry_destroy(entry);
+	wlr_signal_emit_safe(&usage->events.update, usage);
+}
+
+static const struct wlr_addon_interface entry_addon_impl = {
+	.name = "client_usage_entry",
+	.destroy = entry_addon_destroy,
+};
+
+static struct client_usage_entry *entry_from_buffer(
+		struct wlr_buffer *buffer) {
+	struct wlr_addon *addon =
+		wlr_addon_find(&buffer->addons, &entry_addon_impl, &entry_addon_impl);
+	if (addon == NULL) {
+		return NULL;
+	}
+	struct client_usage_entry *entry = wl_container_of(addon, entry, addon);
+	return entry;
+}
+
+static void entry_create(struct wlr_client_usage *usage,
+		struct wlr_buffer *buffer, enum client_usage_entry_kind kind,
+		size_t bytes, struct wlr_renderer *renderer) {
+	struct client_usage_entry *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	entry->usage = usage;
+	entry->kind = kind;
+	entry->bytes = bytes;
+	entry->renderer = renderer;
+	wlr_addon_init(&entry->addon, &buffer->addons, &entry_addon_impl,
+		&entry_addon_impl);
+	wl_list_insert(&usage->entries, &entry->link);
+
+	usage_account(usage, kind, bytes, true);
+	wlr_signal_emit_safe(&usage->events.update, usage);
+}
+
+static void usage_handle_client_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_client_usage *usage =
+		wl_container_of(listener, usage, client_destroy);
+	wlr_signal_emit_safe(&usage->events.destroy, usage);
+
+	// Buffers may outlive the client, e.g. while they are being scanned out
+	struct client_usage_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &usage->entries, link) {
+		entry_destroy(entry);
+	}
+
+	wl_list_remove(&usage->client_destroy.link);
+	free(usage);
+}
+
+static struct wlr_client_usage *usage_find(struct wl_client *client) {
+	struct wl_listener *listener =
+		wl_client_get_destroy_listener(client, usage_handle_client_destroy);
+	if (listener == NULL) {
+		return NULL;
+	}
+	struct wlr_client_usage *usage =
+		wl_container_of(listener, usage, client_destroy);
+	return usage;
+}
+
+struct wlr_client_usage *wlr_client_usage_get(struct wl_client *client) {
+	struct wlr_client_usage *usage = usage_find(client);
+	if (usage != NULL) {
+		return usage;
+	}
+
+	usage = calloc(1, sizeof(*usage));
+	if (usage == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	usage->client = client;
+	wl_list_init(&usage->entries);
+	wl_signal_init(&usage->events.update);
+	wl_signal_init(&usage->events.destroy);
+
+	usage->client_destroy.notify = usage_handle_client_destroy;
+	wl_client_add_destroy_listener(client, &usage->client_destroy);
+
+	return usage;
+}
+
+void wlr_client_usage_get_renderer_textures(struct wlr_client_usage *usage,
+		struct wlr_renderer *renderer, size_t *textures, size_t *bytes) {
+	*textures = 0;
+	*bytes = 0;
+
+	struct client_usage_entry *entry;
+	wl_list_for_each(entry, &usage->entries, link) {
+		if (entry->kind == CLIENT_USAGE_TEXTURE &&
+				entry->renderer == renderer) {
+			(*textures)++;
+			*bytes += entry->bytes;
+		}
+	}
+}
+
+static size_t get_bpp(uint32_t format) {
+	const struct wlr_pixel_format_info *info =
+		drm_get_pixel_format_info(format);
+	// Assume 32-bit pixels for formats we don't know about, e.g. YUV
+	return info != NULL ? info->bpp / 8 : 4;
+}
+
+void client_usage_add_buffer(struct wl_client *client,
+		struct wlr_buffer *buffer) {
+	if (entry_from_buffer(buffer) != NULL) {
+		return;
+	}
+
+	struct wlr_client_usage *usage = wlr_client_usage_get(client);
+	if (usage == NULL) {
+		return;
+	}
+
+	enum client_usage_entry_kind kind = CLIENT_USAGE_BUFFER;
+	size_t bytes;
+	struct wlr_dmabuf_attributes dmabuf;
+	struct wlr_shm_attributes shm;
+	// shm buffers may also be exposed as udmabufs, check them first
+	if (wlr_buffer_get_shm(buffer, &shm)) {
+		bytes = (size_t)shm.stride * shm.height;
+	} else if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		kind = CLIENT_USAGE_DMABUF;
+		bytes = 0;
+		for (int i = 0; i < dmabuf.n_planes; i++) {
+			bytes += (size_t)dmabuf.stride[i] * dmabuf.height;
+		}
+	} else {
+		void *data;
+		uint32_t format;
+		size_t stride;
+		if (wlr_buffer_begin_data_ptr_access(buffer,
+				WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+			wlr_buffer_end_data_ptr_access(buffer);
+			bytes = stride * buffer->height;
+		} else {
+			// e.g. single-pixel buffers
+			bytes = 0;
+		}
+	}
+
+	entry_create(usage, buffer, kind, bytes, NULL);
+}
+
+void client_usage_add_client_buffer(struct wlr_client_buffer *client_buffer) {
+	if (client_buffer->texture == NULL || client_buffer->source == NULL) {
+		return;
+	}
+
+	struct client_usage_entry *source_entry =
+		entry_from_buffer(client_buffer->source);
+	if (source_entry == NULL) {
+		// Not created from a wl_buffer
+		return;
+	}
+
+	// Imported DMA-BUFs don't take any memory besides the client's
+	size_t bytes = 0;
+	if (client_buffer->shm_source_format != DRM_FORMAT_INVALID) {
+		struct wlr_texture *texture = client_buffer->texture;
+		bytes = (size_t)texture->width * texture->height *
+			get_bpp(client_buffer->shm_source_format);
+	}
+
+	entry_create(source_entry->usage, &client_buffer->base,
+		CLIENT_USAGE_TEXTURE, bytes, client_buffer->renderer);
+}
+
+void client_usage_update_shm_pool(struct wl_client *client, size_t old_size,
+		size_t new_size) {
+	// The usage is already gone if the pool is destroyed with the client
+	struct wlr_client_usage *usage = old_size == 0 ?
+		wlr_client_usage_get(client) : usage_find(client);
+	if (usage == NULL) {
+		return;
+	}
+
+	if (old_size == 0) {
+		usage->shm_pools++;
+	} else if (new_size == 0) {
+		assert(usage->shm_pools > 0);
+		usage->shm_pools--;
+	}
+	assert(usage->shm_pool_bytes >= old_size);
+	usage->shm_pool_bytes = usage->shm_pool_bytes - old_size + new_size;
+
+	wlr_signal_emit_safe(&usage->events.update, usage);
+}
@@ -1,6 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <drm_fourcc.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <wayland-server-core.h>
+#include <wlr/render/drm_syncobj.h>
 #include <wlr/render/interface.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_compositor.h>
@@ -10,12 +15,19 @@
 #include <wlr/types/wlr_output.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
+#include "types/wlr_buffer.h"
+#include "types/wlr_compositor.h"
 #include "types/wlr_region.h"
 #include "util/signal.h"
 #include "util/time.h"
+#include "util/trace.h"
 
 #define COMPOSITOR_VERSION 4
 #define CALLBACK_VERSION 1
+// Maximum number of released cached states kept around per surface
+#define CACHED_STATE_POOL_CAP 4
+// Default maximum number of damage rectangles per surface
+#define DEFAULT_MAX_DAMAGE_RECTS 256
 
 static int min(int fst, int snd) {
 	if (fst < snd) {
@@ -60,6 +72,30 @@ static void surface_handle_attach(struct wl_client *client,
 	surface->pending.buffer = buffer;
 }
 
+/**
+ * Collapse the damage to its extents if it is made of too many rectangles,
+ * pixman region operations and per-rectangle uploads are quadratic.
+ */
+static void surface_cap_damage(struct wlr_surface *surface,
+		pixman_region32_t *damage) {
+	if (surface->max_damage_rects == 0 ||
+			(size_t)pixman_region32_n_rects(damage) <=
+			surface->max_damage_rects) {
+		return;
+	}
+
+	if (surface->damage_overflows == 0) {
+		wlr_log(WLR_DEBUG, "Surface %p damage exceeds %zu rectangles, "
+			"collapsing it", surface, surface->max_damage_rects);
+	}
+	surface->damage_overflows++;
+
+	pixman_box32_t extents = *pixman_region32_extents(damage);
+	pixman_region32_fini(damage);
+	pixman_region32_init_rect(damage, extents.x1, extents.y1,
+		extents.x2 - extents.x1, extents.y2 - extents.y1);
+}
+
 static void surface_handle_damage(struct wl_client *client,
 		struct wl_resource *resource,
 		int32_t x, int32_t y, int32_t width, int32_t height) {
@@ -71,6 +107,7 @@ static void surface_handle_damage(struct wl_client *client,
 	pixman_region32_union_rect(&surface->pending.surface_damage,
 		&surface->pending.surface_damage,
 		x, y, width, height);
+	surface_cap_damage(surface, &surface->pending.surface_damage);
 }
 
 static void callback_handle_resource_destroy(struct wl_resource *resource) {
@@ -314,12 +351,21 @@ static void surface_state_move(struct wlr_surface_state *state,
 	if (next->committed & WLR_SURFACE_STATE_VIEWPORT) {
 		memcpy(&state->viewport, &next->viewport, sizeof(state->viewport));
 	}
+	if (next->committed & WLR_SURFACE_STATE_CONTENT_TYPE) {
+		state->content_type = next->content_type;
+	}
 	if (next->committed & WLR_SURFACE_STATE_FRAME_CALLBACK_LIST) {
 		wl_list_insert_list(&state->frame_callback_list,
 			&next->frame_callback_list);
 		wl_list_init(&next->frame_callback_list);
 	}
 
+	// Synchronization points only apply to the buffer of their own commit
+	wlr_drm_syncobj_timeline_unref(state->syncobj.acquire_timeline);
+	wlr_drm_syncobj_timeline_unref(state->syncobj.release_timeline);
+	state->syncobj = next->syncobj;
+	memset(&next->syncobj, 0, sizeof(next->syncobj));
+
 	state->committed |= next->committed;
 	next->committed = 0;
 
@@ -329,6 +375,45 @@ static void surface_state_move(struct wlr_surface_state *state,
 	next->cached_state_locks = 0;
 }
 
+static void surface_drop_spare_buffer(struct wlr_surface *surface) {
+	if (surface->spare_buffer != NULL) {
+		wlr_buffer_unlock(&surface->spare_buffer->base);
+	}
+	surface->spare_buffer = NULL;
+	pixman_region32_clear(&surface->spare_damage);
+}
+
+/**
+ * Replace the current client buffer, keeping the previous one around as the
+ * spare buffer if its texture can be updated later on.
+ */
+static void surface_set_client_buffer(struct wlr_surface *surface,
+		struct wlr_client_buffer *buffer) {
+	surface_drop_spare_buffer(surface);
+	if (surface->buffer != NULL &&
+			surface->buffer->shm_source_format != DRM_FORMAT_INVALID) {
+		// The previous texture misses the damage of this commit, and the
+		// damage it deferred. That damage is uploaded if it's re-used.
+		surface->spare_buffer = surface->buffer;
+		pixman_region32_copy(&surface->spare_damage, &surface->buffer_damage);
+		client_buffer_discard_pending(surface->spare_buffer,
+			&surface->spare_damage);
+	} else if (surface->buffer != NULL) {
+		wlr_buffer_unlock(&surface->buffer->base);
+	}
+	surface->buffer = buffer;
+}
+
+static bool surface_update_client_buffer(struct wlr_surface *surface,
+		struct wlr_client_buffer *buffer, pixman_region32_t *damage) {
+	if (surface->lazy_texture_upload) {
+		return client_buffer_defer_damage(buffer, surface->current.buffer,
+			damage);
+	}
+	return wlr_client_buffer_apply_damage(buffer, surface->current.buffer,
+		damage);
+}
+
 static void surface_apply_damage(struct wlr_surface *surface) {
 	if (surface->current.buffer == NULL) {
 		// NULL commit
@@ -336,14 +421,36 @@ static void surface_apply_damage(struct wlr_surface *surface) {
 			wlr_buffer_unlock(&surface->buffer->base);
 		}
 		surface->buffer = NULL;
+		surface_drop_spare_buffer(surface);
 		return;
 	}
 
+	if (surface->spare_buffer != NULL) {
+		pixman_region32_union(&surface->spare_damage, &surface->spare_damage,
+			&surface->buffer_damage);
+	}
+
 	if (surface->buffer != NULL) {
-		if (wlr_client_buffer_apply_damage(surface->buffer,
-				surface->current.buffer, &surface->buffer_damage)) {
+		if (surface_update_client_buffer(surface, surface->buffer,
+				&surface->buffer_damage)) {
+			wlr_buffer_unlock(surface->current.buffer);
+			surface->current.buffer = NULL;
+			return;
+		}
+	}
+
+	// The current texture is still in use, e.g. by a double-buffered client
+	// whose previous buffer is still displayed. The texture before it might
+	// be free by now.
+	if (surface->spare_buffer != NULL) {
+		if (surface_update_client_buffer(surface, surface->spare_buffer,
+				&surface->spare_damage)) {
 			wlr_buffer_unlock(surface->current.buffer);
 			surface->current.buffer = NULL;
+
+			struct wlr_client_buffer *buffer = surface->spare_buffer;
+			surface->spare_buffer = NULL;
+			surface_set_client_buffer(surface, buffer);
 			return;
 		}
 	}
@@ -359,14 +466,27 @@ static void surface_apply_damage(struct wlr_surface *surface) {
 		return;
 	}
 
-	if (surface->buffer != NULL) {
-		wlr_buffer_unlock(&surface->buffer->base);
-	}
-	surface->buffer = buffer;
+	surface_set_client_buffer(surface, buffer);
 }
 
 static void surface_update_opaque_region(struct wlr_surface *surface) {
-	struct wlr_texture *texture = wlr_surface_get_texture(surface);
+	float color[4];
+	if (surface->buffer != NULL &&
+			client_buffer_get_color(surface->buffer, color)) {
+		if (color[3] == 1.0) {
+			pixman_region32_init_rect(&surface->opaque_region,
+				0, 0, surface->current.width, surface->current.height);
+		} else {
+			pixman_region32_intersect_rect(&surface->opaque_region,
+				&surface->current.opaque,
+				0, 0, surface->current.width, surface->current.height);
+		}
+		return;
+	}
+
+	// Opacity doesn't depend on the contents, don't upload deferred damage
+	struct wlr_texture *texture =
+		surface->buffer != NULL ? surface->buffer->texture : NULL;
 	if (texture == NULL) {
 		pixman_region32_clear(&surface->opaque_region);
 		return;
@@ -391,27 +511,89 @@ static void surface_update_input_region(struct wlr_surface *surface) {
 
 static void surface_state_init(struct wlr_surface_state *state);
 
-static void subsurface_parent_commit(struct wlr_subsurface *subsurface);
+static bool subsurface_parent_commit(struct wlr_subsurface *subsurface);
+
+static struct wlr_surface_state *surface_get_cached_state(
+		struct wlr_surface *surface) {
+	if (wl_list_empty(&surface->cached_pool)) {
+		struct wlr_surface_state *state = calloc(1, sizeof(*state));
+		if (state == NULL) {
+			return NULL;
+		}
+		surface_state_init(state);
+		return state;
+	}
+
+	struct wlr_surface_state *state = wl_container_of(surface->cached_pool.next,
+		state, cached_state_link);
+	wl_list_remove(&state->cached_state_link);
+	surface->cached_pool_len--;
+
+	// The state has been moved into the current state, which left its buffer,
+	// damage and frame callbacks empty. The other regions keep their storage
+	// around, they are only read if the matching committed bit is set.
+	assert(state->buffer == NULL);
+	assert(wl_list_empty(&state->frame_callback_list));
+	state->committed = 0;
+	state->seq = 0;
+	state->dx = state->dy = 0;
+	state->scale = 1;
+	state->transform = WL_OUTPUT_TRANSFORM_NORMAL;
+	memset(&state->viewport, 0, sizeof(state->viewport));
+	state->cached_state_locks = 0;
+	return state;
+}
 
 static void surface_cache_pending(struct wlr_surface *surface) {
-	struct wlr_surface_state *cached = calloc(1, sizeof(*cached));
+	struct wlr_surface_state *cached = surface_get_cached_state(surface);
 	if (!cached) {
 		wl_resource_post_no_memory(surface->resource);
 		return;
 	}
 
-	surface_state_init(cached);
 	surface_state_move(cached, &surface->pending);
 
 	wl_list_insert(surface->cached.prev, &cached->cached_state_link);
 
+	size_t depth = wl_list_length(&surface->cached);
+	if (depth > surface->cached_max_depth) {
+		surface->cached_max_depth = depth;
+	}
+
 	surface->pending.seq++;
 }
 
+static void surface_stats_add(struct wlr_surface_stats *stats,
+		bool buffer, uint64_t damage_area, int64_t commit_time_ns) {
+	stats->commits++;
+	if (buffer) {
+		stats->buffers++;
+	}
+	stats->damage_area += damage_area;
+	stats->commit_time_ns += commit_time_ns;
+}
+
+static uint64_t region_area(pixman_region32_t *region) {
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_len);
+	uint64_t area = 0;
+	for (int i = 0; i < rects_len; i++) {
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(uint64_t)(rects[i].y2 - rects[i].y1);
+	}
+	return area;
+}
+
 static void surface_commit_state(struct wlr_surface *surface,
 		struct wlr_surface_state *next) {
 	assert(next->cached_state_locks == 0);
 
+	trace_begin("surface commit");
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool attached_buffer = (next->committed & WLR_SURFACE_STATE_BUFFER) &&
+		next->buffer != NULL;
+
 	if (surface->role && surface->role->precommit) {
 		surface->role->precommit(surface, next);
 	}
@@ -421,6 +603,7 @@ static void surface_commit_state(struct wlr_surface *surface,
 	surface->sx += next->dx;
 	surface->sy += next->dy;
 	surface_update_damage(&surface->buffer_damage, &surface->current, next);
+	surface_cap_damage(surface, &surface->buffer_damage);
 
 	pixman_region32_clear(&surface->external_damage);
 	if (surface->current.width > next->width ||
@@ -447,6 +630,7 @@ static void surface_commit_state(struct wlr_surface *surface,
 	surface_update_input_region(surface);
 
 	// commit subsurface order
+	bool subsurfaces_changed = false;
 	struct wlr_subsurface *subsurface;
 	wl_list_for_each_reverse(subsurface, &surface->pending.subsurfaces_above,
 			pending.link) {
@@ -454,7 +638,7 @@ static void surface_commit_state(struct wlr_surface *surface,
 		wl_list_insert(&surface->current.subsurfaces_above,
 			&subsurface->current.link);
 
-		subsurface_parent_commit(subsurface);
+		subsurfaces_changed |= subsurface_parent_commit(subsurface);
 	}
 	wl_list_for_each_reverse(subsurface, &surface->pending.subsurfaces_below,
 			pending.link) {
@@ -462,7 +646,7 @@ static void surface_commit_state(struct wlr_surface *surface,
 		wl_list_insert(&surface->current.subsurfaces_below,
 			&subsurface->current.link);
 
-		subsurface_parent_commit(subsurface);
+		subsurfaces_changed |= subsurface_parent_commit(subsurface);
 	}
 
 	// If we're committing the pending state, bump the pending sequence number
@@ -475,7 +659,23 @@ static void surface_commit_state(struct wlr_surface *surface,
 		surface->role->commit(surface);
 	}
 
+	if (subsurfaces_changed) {
+		wlr_signal_emit_safe(&surface->events.subsurfaces_changed, surface);
+	}
 	wlr_signal_emit_safe(&surface->events.commit, surface);
+
+	struct timespec end, duration;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	timespec_sub(&duration, &end, &start);
+	int64_t duration_ns = timespec_to_nsec(&duration);
+	uint64_t damage_area = region_area(&surface->buffer_damage);
+	surface_stats_add(&surface->stats, attached_buffer, damage_area,
+		duration_ns);
+	if (surface->client_stats != NULL) {
+		surface_stats_add(&surface->client_stats->stats, attached_buffer,
+			damage_area, duration_ns);
+	}
+	trace_end();
 }
 
 static void collect_subsurface_damage_iter(struct wlr_surface *surface,
@@ -489,11 +689,13 @@ static void collect_subsurface_damage_iter(struct wlr_surface *surface,
 }
 
 // TODO: untangle from wlr_surface
-static void subsurface_parent_commit(struct wlr_subsurface *subsurface) {
+// Returns true if the sub-surface was added, moved or reordered
+static bool subsurface_parent_commit(struct wlr_subsurface *subsurface) {
 	struct wlr_surface *surface = subsurface->surface;
 
 	bool moved = subsurface->current.x != subsurface->pending.x ||
 		subsurface->current.y != subsurface->pending.y;
+	bool changed = moved || subsurface->reordered || !subsurface->added;
 	if (subsurface->mapped && moved) {
 		wlr_surface_for_each_surface(surface,
 			collect_subsurface_damage_iter, subsurface);
@@ -504,6 +706,10 @@ static void subsurface_parent_commit(struct wlr_subsurface *subsurface) {
 		subsurface->has_cache = false;
 	}
 
+	if (moved || subsurface->reordered) {
+		surface_invalidate_subsurface_tree(subsurface->parent);
+	}
+
 	subsurface->current.x = subsurface->pending.x;
 	subsurface->current.y = subsurface->pending.y;
 	if (subsurface->mapped && (moved || subsurface->reordered)) {
@@ -517,6 +723,8 @@ static void subsurface_parent_commit(struct wlr_subsurface *subsurface) {
 		wlr_signal_emit_safe(&subsurface->parent->events.new_subsurface,
 			subsurface);
 	}
+
+	return changed;
 }
 
 static void surface_handle_commit(struct wl_client *client,
@@ -570,6 +778,7 @@ static void surface_handle_damage_buffer(struct wl_client *client,
 	pixman_region32_union_rect(&surface->pending.buffer_damage,
 		&surface->pending.buffer_damage,
 		x, y, width, height);
+	surface_cap_damage(surface, &surface->pending.buffer_damage);
 }
 
 static const struct wl_surface_interface surface_implementation = {
@@ -611,6 +820,8 @@ static void surface_state_init(struct wlr_surface_state *state) {
 
 static void surface_state_finish(struct wlr_surface_state *state) {
 	wlr_buffer_unlock(state->buffer);
+	wlr_drm_syncobj_timeline_unref(state->syncobj.acquire_timeline);
+	wlr_drm_syncobj_timeline_unref(state->syncobj.release_timeline);
 
 	struct wl_resource *resource, *tmp;
 	wl_resource_for_each_safe(resource, tmp, &state->frame_callback_list) {
@@ -629,8 +840,74 @@ static void surface_state_destroy_cached(struct wlr_surface_state *state) {
 	free(state);
 }
 
+/**
+ * Release a cached state which has been committed, keeping it around for the
+ * next cached commit if the pool isn't full.
+ */
+static void surface_release_cached_state(struct wlr_surface *surface,
+		struct wlr_surface_state *state) {
+	size_t cap = surface->cached_max_depth;
+	if (cap > CACHED_STATE_POOL_CAP) {
+		cap = CACHED_STATE_POOL_CAP;
+	}
+	if (surface->cached_pool_len >= cap) {
+		surface_state_destroy_cached(state);
+		return;
+	}
+
+	wl_list_remove(&state->cached_state_link);
+	wl_list_insert(&surface->cached_pool, &state->cached_state_link);
+	surface->cached_pool_len++;
+}
+
 static void surface_output_destroy(struct wlr_surface_output *surface_output);
 
+static void client_stats_unref(struct wlr_compositor_client_stats *client_stats) {
+	if (client_stats == NULL) {
+		return;
+	}
+	assert(client_stats->n_refs > 0);
+	client_stats->n_refs--;
+	if (client_stats->n_refs > 0) {
+		return;
+	}
+	free(client_stats);
+}
+
+static void client_stats_handle_client_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_compositor_client_stats *client_stats =
+		wl_container_of(listener, client_stats, client_destroy);
+	// The surfaces of the client are destroyed afterwards
+	wl_list_remove(&client_stats->client_destroy.link);
+	wl_list_remove(&client_stats->link);
+	wl_list_init(&client_stats->link);
+	client_stats->client = NULL;
+	client_stats_unref(client_stats);
+}
+
+static struct wlr_compositor_client_stats *client_stats_get(
+		struct wlr_compositor *compositor, struct wl_client *client) {
+	struct wlr_compositor_client_stats *client_stats;
+	wl_list_for_each(client_stats, &compositor->client_stats, link) {
+		if (client_stats->client == client) {
+			client_stats->n_refs++;
+			return client_stats;
+		}
+	}
+
+	client_stats = calloc(1, sizeof(*client_stats));
+	if (client_stats == NULL) {
+		return NULL;
+	}
+	client_stats->client = client;
+	client_stats->n_refs = 2; // the client and the caller
+	client_stats->client_destroy.notify = client_stats_handle_client_destroy;
+	wl_client_add_destroy_listener(client, &client_stats->client_destroy);
+	wl_list_insert(compositor->client_stats.prev, &client_stats->link);
+	return client_stats;
+}
+
 static void surface_handle_resource_destroy(struct wl_resource *resource) {
 	struct wlr_surface *surface = wlr_surface_from_resource(resource);
 
@@ -648,14 +925,22 @@ static void surface_handle_resource_destroy(struct wl_resource *resource) {
 	wl_list_for_each_safe(cached, cached_tmp, &surface->cached, cached_state_link) {
 		surface_state_destroy_cached(cached);
 	}
+	wl_list_for_each_safe(cached, cached_tmp, &surface->cached_pool,
+			cached_state_link) {
+		surface_state_destroy_cached(cached);
+	}
 
 	wl_list_remove(&surface->renderer_destroy.link);
+	client_stats_unref(surface->client_stats);
 	surface_state_finish(&surface->pending);
 	surface_state_finish(&surface->current);
 	pixman_region32_fini(&surface->buffer_damage);
 	pixman_region32_fini(&surface->external_damage);
 	pixman_region32_fini(&surface->opaque_region);
 	pixman_region32_fini(&surface->input_region);
+	surface_drop_spare_buffer(surface);
+	pixman_region32_fini(&surface->spare_damage);
+	wl_array_release(&surface->subsurface_tree);
 	if (surface->buffer != NULL) {
 		wlr_buffer_unlock(&surface->buffer->base);
 	}
@@ -670,7 +955,7 @@ static void surface_handle_renderer_destroy(struct wl_listener *listener,
 }
 
 static struct wlr_surface *surface_create(struct wl_client *client,
-		uint32_t version, uint32_t id, struct wlr_renderer *renderer) {
+		uint32_t version, uint32_t id, struct wlr_compositor *compositor) {
 	struct wlr_surface *surface = calloc(1, sizeof(struct wlr_surface));
 	if (!surface) {
 		wl_client_post_no_memory(client);
@@ -688,7 +973,11 @@ static struct wlr_surface *surface_create(struct wl_client *client,
 
 	wlr_log(WLR_DEBUG, "New wlr_surface %p (res %p)", surface, surface->resource);
 
-	surface->renderer = renderer;
+	surface->renderer = compositor->renderer;
+	surface->max_damage_rects = compositor->max_damage_rects;
+	surface->lazy_texture_upload = compositor->lazy_texture_upload;
+	// Statistics are best-effort, don't fail if they can't be allocated
+	surface->client_stats = client_stats_get(compositor, client);
 
 	surface_state_init(&surface->current);
 	surface_state_init(&surface->pending);
@@ -698,15 +987,21 @@ static struct wlr_surface *surface_create(struct wl_client *client,
 	wl_signal_init(&surface->events.commit);
 	wl_signal_init(&surface->events.destroy);
 	wl_signal_init(&surface->events.new_subsurface);
+	wl_signal_init(&surface->events.subsurfaces_changed);
 	wl_list_init(&surface->current_outputs);
 	wl_list_init(&surface->cached);
+	wl_list_init(&surface->cached_pool);
+	wl_array_init(&surface->subsurface_tree);
+	surface->subsurface_tree_dirty = true;
 	pixman_region32_init(&surface->buffer_damage);
 	pixman_region32_init(&surface->external_damage);
 	pixman_region32_init(&surface->opaque_region);
 	pixman_region32_init(&surface->input_region);
+	pixman_region32_init(&surface->spare_damage);
 	wlr_addon_set_init(&surface->addons);
 
-	wl_signal_add(&renderer->events.destroy, &surface->renderer_destroy);
+	wl_signal_add(&compositor->renderer->events.destroy,
+		&surface->renderer_destroy);
 	surface->renderer_destroy.notify = surface_handle_renderer_destroy;
 
 	return surface;
@@ -716,11 +1011,12 @@ struct wlr_texture *wlr_surface_get_texture(struct wlr_surface *surface) {
 	if (surface->buffer == NULL) {
 		return NULL;
 	}
-	return surface->buffer->texture;
+	return client_buffer_get_texture(surface->buffer);
 }
 
 bool wlr_surface_has_buffer(struct wlr_surface *surface) {
-	return wlr_surface_get_texture(surface) != NULL;
+	return surface->buffer != NULL && (surface->buffer->texture != NULL ||
+		surface->buffer->has_color);
 }
 
 bool wlr_surface_set_role(struct wlr_surface *surface,
@@ -793,8 +1089,71 @@ void wlr_surface_unlock_cached(struct wlr_surface *surface, uint32_t seq) {
 		}
 
 		surface_commit_state(surface, next);
-		surface_state_destroy_cached(next);
+		surface_release_cached_state(surface, next);
+	}
+}
+
+void surface_invalidate_subsurface_tree(struct wlr_surface *surface) {
+	// Don't stop at the first dirty ancestor: re-building a tree doesn't
+	// re-build the trees of its subsurfaces
+	while (surface != NULL) {
+		surface->subsurface_tree_dirty = true;
+		if (!wlr_surface_is_subsurface(surface)) {
+			break;
+		}
+		struct wlr_subsurface *subsurface =
+			wlr_subsurface_from_wlr_surface(surface);
+		if (subsurface == NULL) {
+			break;
+		}
+		surface = subsurface->parent;
+	}
+}
+
+static bool subsurface_tree_append(struct wlr_surface *surface,
+		struct wl_array *tree, int x, int y) {
+	struct wlr_subsurface *subsurface;
+	wl_list_for_each(subsurface, &surface->current.subsurfaces_below, current.link) {
+		if (subsurface->mapped && !subsurface_tree_append(subsurface->surface,
+				tree, x + subsurface->current.x, y + subsurface->current.y)) {
+			return false;
+		}
+	}
+
+	struct wlr_surface_tree_entry *entry = wl_array_add(tree, sizeof(*entry));
+	if (entry == NULL) {
+		return false;
+	}
+	*entry = (struct wlr_surface_tree_entry){
+		.surface = surface,
+		.x = x,
+		.y = y,
+	};
+
+	wl_list_for_each(subsurface, &surface->current.subsurfaces_above, current.link) {
+		if (subsurface->mapped && !subsurface_tree_append(subsurface->surface,
+				tree, x + subsurface->current.x, y + subsurface->current.y)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void surface_update_subsurface_tree(struct wlr_surface *surface) {
+	if (!surface->subsurface_tree_dirty) {
+		return;
+	}
+
+	// wl_array never shrinks, so re-building keeps the allocation
+	surface->subsurface_tree.size = 0;
+	if (!subsurface_tree_append(surface, &surface->subsurface_tree, 0, 0)) {
+		// Keep the partial tree and retry next time
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
 	}
+
+	surface->subsurface_tree_dirty = false;
 }
 
 struct wlr_surface *wlr_surface_get_root_surface(struct wlr_surface *surface) {
@@ -818,44 +1177,23 @@ bool wlr_surface_point_accepts_input(struct wlr_surface *surface,
 
 struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
 		double sx, double sy, double *sub_x, double *sub_y) {
-	struct wlr_subsurface *subsurface;
-	wl_list_for_each_reverse(subsurface, &surface->current.subsurfaces_above,
-			current.link) {
-		if (!subsurface->mapped) {
-			continue;
-		}
-
-		double _sub_x = subsurface->current.x;
-		double _sub_y = subsurface->current.y;
-		struct wlr_surface *sub = wlr_surface_surface_at(subsurface->surface,
-			sx - _sub_x, sy - _sub_y, sub_x, sub_y);
-		if (sub != NULL) {
-			return sub;
-		}
-	}
-
-	if (wlr_surface_point_accepts_input(surface, sx, sy)) {
-		if (sub_x) {
-			*sub_x = sx;
-		}
-		if (sub_y) {
-			*sub_y = sy;
-		}
-		return surface;
-	}
-
-	wl_list_for_each_reverse(subsurface, &surface->current.subsurfaces_below,
-			current.link) {
-		if (!subsurface->mapped) {
-			continue;
-		}
-
-		double _sub_x = subsurface->current.x;
-		double _sub_y = subsurface->current.y;
-		struct wlr_surface *sub = wlr_surface_surface_at(subsurface->surface,
-			sx - _sub_x, sy - _sub_y, sub_x, sub_y);
-		if (sub != NULL) {
-			return sub;
+	surface_update_subsurface_tree(surface);
+
+	// Walk the tree from the top-most surface down
+	const struct wlr_surface_tree_entry *entries = surface->subsurface_tree.data;
+	size_t len = surface->subsurface_tree.size / sizeof(entries[0]);
+	for (size_t i = len; i-- > 0;) {
+		const struct wlr_surface_tree_entry *entry = &entries[i];
+		double _sub_x = sx - entry->x;
+		double _sub_y = sy - entry->y;
+		if (wlr_surface_point_accepts_input(entry->surface, _sub_x, _sub_y)) {
+			if (sub_x) {
+				*sub_x = _sub_x;
+			}
+			if (sub_y) {
+				*sub_y = _sub_y;
+			}
+			return entry->surface;
 		}
 	}
 
@@ -952,43 +1290,19 @@ void wlr_surface_send_frame_done(struct wlr_surface *surface,
 	}
 }
 
-static void surface_for_each_surface(struct wlr_surface *surface, int x, int y,
+void wlr_surface_for_each_surface(struct wlr_surface *surface,
 		wlr_surface_iterator_func_t iterator, void *user_data) {
-	struct wlr_subsurface *subsurface;
-	wl_list_for_each(subsurface, &surface->current.subsurfaces_below, current.link) {
-		if (!subsurface->mapped) {
-			continue;
-		}
-
-		struct wlr_subsurface_parent_state *state = &subsurface->current;
-		int sx = state->x;
-		int sy = state->y;
+	surface_update_subsurface_tree(surface);
 
-		surface_for_each_surface(subsurface->surface, x + sx, y + sy,
-			iterator, user_data);
-	}
-
-	iterator(surface, x, y, user_data);
-
-	wl_list_for_each(subsurface, &surface->current.subsurfaces_above, current.link) {
-		if (!subsurface->mapped) {
-			continue;
-		}
-
-		struct wlr_subsurface_parent_state *state = &subsurface->current;
-		int sx = state->x;
-		int sy = state->y;
-
-		surface_for_each_surface(subsurface->surface, x + sx, y + sy,
-			iterator, user_data);
+	// The iterator may re-build the tree, so don't keep pointers into it
+	for (size_t i = 0; i < surface->subsurface_tree.size /
+			sizeof(struct wlr_surface_tree_entry); i++) {
+		const struct wlr_surface_tree_entry *entry =
+			(struct wlr_surface_tree_entry *)surface->subsurface_tree.data + i;
+		iterator(entry->surface, entry->x, entry->y, user_data);
 	}
 }
 
-void wlr_surface_for_each_surface(struct wlr_surface *surface,
-		wlr_surface_iterator_func_t iterator, void *user_data) {
-	surface_for_each_surface(surface, 0, 0, iterator, user_data);
-}
-
 struct bound_acc {
 	int32_t min_x, min_y;
 	int32_t max_x, max_y;
@@ -1093,7 +1407,7 @@ static void compositor_create_surface(struct wl_client *client,
 	struct wlr_compositor *compositor = compositor_from_resource(resource);
 
 	struct wlr_surface *surface = surface_create(client,
-		wl_resource_get_version(resource), id, compositor->renderer);
+		wl_resource_get_version(resource), id, compositor);
 	if (surface == NULL) {
 		wl_client_post_no_memory(client);
 		return;
@@ -1130,6 +1444,13 @@ static void compositor_handle_display_destroy(
 	struct wlr_compositor *compositor =
 		wl_container_of(listener, compositor, display_destroy);
 	wlr_signal_emit_safe(&compositor->events.destroy, NULL);
+	// Entries are kept alive by their clients and surfaces
+	struct wlr_compositor_client_stats *client_stats, *client_stats_tmp;
+	wl_list_for_each_safe(client_stats, client_stats_tmp,
+			&compositor->client_stats, link) {
+		wl_list_remove(&client_stats->link);
+		wl_list_init(&client_stats->link);
+	}
 	wl_list_remove(&compositor->display_destroy.link);
 	wl_global_destroy(compositor->global);
 	free(compositor);
@@ -1149,6 +1470,8 @@ struct wlr_compositor *wlr_compositor_create(struct wl_display *display,
 		return NULL;
 	}
 	compositor->renderer = renderer;
+	compositor->max_damage_rects = DEFAULT_MAX_DAMAGE_RECTS;
+	wl_list_init(&compositor->client_stats);
 
 	wl_signal_init(&compositor->events.new_surface);
 	wl_signal_init(&compositor->events.destroy);
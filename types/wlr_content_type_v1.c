@@ -0,0 +1,204 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_content_type_v1.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+#include "util/signal.h"
+
+#define CONTENT_TYPE_VERSION 1
+
+/**
+ * Attached to surfaces as an addon, to reject a second object for the same
+ * surface.
+ */
+struct wlr_content_type_v1_surface {
+	struct wl_resource *resource;
+	struct wlr_surface *surface;
+	struct wlr_addon addon;
+};
+
+static const struct wp_content_type_v1_interface content_type_surface_impl;
+
+// Returns NULL if the surface has been destroyed
+static struct wlr_content_type_v1_surface *content_type_surface_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource, &wp_content_type_v1_interface,
+		&content_type_surface_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static void content_type_surface_set_pending(
+		struct wlr_content_type_v1_surface *content_type, uint32_t type) {
+	struct wlr_surface_state *pending = &content_type->surface->pending;
+	pending->content_type = type;
+	pending->committed |= WLR_SURFACE_STATE_CONTENT_TYPE;
+}
+
+static void content_type_surface_destroy(
+		struct wlr_content_type_v1_surface *content_type) {
+	if (content_type == NULL) {
+		return;
+	}
+	wl_resource_set_user_data(content_type->resource, NULL);
+	wlr_addon_finish(&content_type->addon);
+	free(content_type);
+}
+
+static void content_type_surface_handle_resource_destroy(
+		struct wl_resource *resource) {
+	struct wlr_content_type_v1_surface *content_type =
+		content_type_surface_from_resource(resource);
+	if (content_type == NULL) {
+		return;
+	}
+	// Destroying the object resets the content type on the next commit
+	content_type_surface_set_pending(content_type,
+		WP_CONTENT_TYPE_V1_TYPE_NONE);
+	content_type_surface_destroy(content_type);
+}
+
+static void content_type_surface_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void content_type_surface_handle_set_content_type(
+		struct wl_client *client, struct wl_resource *resource,
+		uint32_t type) {
+	struct wlr_content_type_v1_surface *content_type =
+		content_type_surface_from_resource(resource);
+	if (content_type == NULL) {
+		return;
+	}
+
+	switch (type) {
+	case WP_CONTENT_TYPE_V1_TYPE_NONE:
+	case WP_CONTENT_TYPE_V1_TYPE_PHOTO:
+	case WP_CONTENT_TYPE_V1_TYPE_VIDEO:
+	case WP_CONTENT_TYPE_V1_TYPE_GAME:
+		break;
+	default:
+		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_METHOD,
+			"Invalid content type %"PRIu32, type);
+		return;
+	}
+
+	content_type_surface_set_pending(content_type, type);
+}
+
+static const struct wp_content_type_v1_interface content_type_surface_impl = {
+	.destroy = content_type_surface_handle_destroy,
+	.set_content_type = content_type_surface_handle_set_content_type,
+};
+
+static void content_type_surface_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_content_type_v1_surface *content_type =
+		wl_container_of(addon, content_type, addon);
+	content_type_surface_destroy(content_type);
+}
+
+static const struct wlr_addon_interface content_type_surface_addon_impl = {
+	.name = "wlr_content_type_v1_surface",
+	.destroy = content_type_surface_addon_destroy,
+};
+
+enum wp_content_type_v1_type wlr_surface_get_content_type_v1(
+		struct wlr_surface *surface) {
+	return surface->current.content_type;
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void manager_handle_get_surface_content_type(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+
+	if (wlr_addon_find(&surface->addons, NULL,
+			&content_type_surface_addon_impl) != NULL) {
+		wl_resource_post_error(resource,
+			WP_CONTENT_TYPE_MANAGER_V1_ERROR_ALREADY_CONSTRUCTED,
+			"wp_content_type_v1 already constructed for this surface");
+		return;
+	}
+
+	struct wlr_content_type_v1_surface *content_type =
+		calloc(1, sizeof(*content_type));
+	if (content_type == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	uint32_t version = wl_resource_get_version(resource);
+	content_type->resource = wl_resource_create(client,
+		&wp_content_type_v1_interface, version, id);
+	if (content_type->resource == NULL) {
+		wl_client_post_no_memory(client);
+		free(content_type);
+		return;
+	}
+	wl_resource_set_implementation(content_type->resource,
+		&content_type_surface_impl, content_type,
+		content_type_surface_handle_resource_destroy);
+
+	content_type->surface = surface;
+	wlr_addon_init(&content_type->addon, &surface->addons, NULL,
+		&content_type_surface_addon_impl);
+}
+
+static const struct wp_content_type_manager_v1_interface manager_impl = {
+	.destroy = manager_handle_destroy,
+	.get_surface_content_type = manager_handle_get_surface_content_type,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_content_type_manager_v1 *manager = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&wp_content_type_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, manager, NULL);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_content_type_manager_v1 *manager =
+		wl_container_of(listener, manager, display_destroy);
+	wlr_signal_emit_safe(&manager->events.destroy, NULL);
+	wl_list_remove(&manager->display_destroy.link);
+	wl_global_destroy(manager->global);
+	free(manager);
+}
+
+struct wlr_content_type_manager_v1 *wlr_content_type_manager_v1_create(
+		struct wl_display *display, uint32_t version) {
+	assert(version <= CONTENT_TYPE_VERSION);
+
+	struct wlr_content_type_manager_v1 *manager = calloc(1, sizeof(*manager));
+	if (manager == NULL) {
+		return NULL;
+	}
+
+	manager->global = wl_global_create(display,
+		&wp_content_type_manager_v1_interface, version, manager,
+		manager_bind);
+	if (manager->global == NULL) {
+		free(manager);
+		return NULL;
+	}
+
+	wl_signal_init(&manager->events.destroy);
+
+	manager->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &manager->display_destroy);
+
+	return manager;
+}
@@ -12,7 +12,10 @@
 #include <wlr/types/wlr_touch.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
+#include <wlr/xcursor.h>
+#include "types/wlr_output.h"
 #include "util/signal.h"
+#include "util/time.h"
 
 struct wlr_cursor_device {
 	struct wlr_cursor *cursor;
@@ -21,6 +24,10 @@ struct wlr_cursor_device {
 	struct wlr_output *mapped_output;
 	struct wlr_box mapped_box; // empty if unset
 
+	// Cached result of get_mapping()
+	struct wlr_box mapping;
+	bool mapping_valid;
+
 	struct wl_listener motion;
 	struct wl_listener motion_absolute;
 	struct wl_listener button;
@@ -52,8 +59,18 @@ struct wlr_cursor_device {
 struct wlr_cursor_output_cursor {
 	struct wlr_cursor *cursor;
 	struct wlr_output_cursor *output_cursor;
+	struct wlr_output_layout_output *l_output;
 	struct wl_list link;
 
+	// XCursor the image was set from, NULL if none
+	struct wlr_xcursor *xcursor;
+	int xcursor_index;
+	// Only for animated XCursors
+	uint32_t xcursor_start; // ms
+	bool xcursor_paused; // waiting for the cursor to become visible
+	struct wl_event_source *xcursor_timer;
+	struct wl_listener output_frame;
+
 	struct wl_listener layout_output_destroy;
 };
 
@@ -65,6 +82,11 @@ struct wlr_cursor_state {
 	struct wlr_output *mapped_output;
 	struct wlr_box mapped_box; // empty if unset
 
+	// Cached layout extents, empty if invalid
+	struct wlr_box layout_box;
+	// Layout box of an output which contained the cursor, empty if invalid
+	struct wlr_box hint_box;
+
 	struct wl_listener layout_add;
 	struct wl_listener layout_change;
 	struct wl_listener layout_destroy;
@@ -124,14 +146,43 @@ struct wlr_cursor *wlr_cursor_create(void) {
 	return cur;
 }
 
+static void output_cursor_stop_animation(
+		struct wlr_cursor_output_cursor *output_cursor) {
+	if (output_cursor->xcursor == NULL ||
+			output_cursor->xcursor->image_count <= 1) {
+		return;
+	}
+	wl_list_remove(&output_cursor->output_frame.link);
+	wl_event_source_remove(output_cursor->xcursor_timer);
+	output_cursor->xcursor_timer = NULL;
+	output_cursor_buffer_cache_reserve(output_cursor->output_cursor->output, 0);
+}
+
+static void output_cursor_reset_xcursor(
+		struct wlr_cursor_output_cursor *output_cursor) {
+	output_cursor_stop_animation(output_cursor);
+	output_cursor->xcursor = NULL;
+}
+
 static void output_cursor_destroy(
 		struct wlr_cursor_output_cursor *output_cursor) {
+	output_cursor_reset_xcursor(output_cursor);
 	wl_list_remove(&output_cursor->layout_output_destroy.link);
 	wl_list_remove(&output_cursor->link);
 	wlr_output_cursor_destroy(output_cursor->output_cursor);
 	free(output_cursor);
 }
 
+static void cursor_invalidate_mapping(struct wlr_cursor_state *state) {
+	state->layout_box.width = state->layout_box.height = 0;
+	state->hint_box.width = state->hint_box.height = 0;
+
+	struct wlr_cursor_device *c_device;
+	wl_list_for_each(c_device, &state->devices, link) {
+		c_device->mapping_valid = false;
+	}
+}
+
 static void cursor_detach_output_layout(struct wlr_cursor *cur) {
 	if (!cur->state->layout) {
 		return;
@@ -148,6 +199,7 @@ static void cursor_detach_output_layout(struct wlr_cursor *cur) {
 	wl_list_remove(&cur->state->layout_add.link);
 
 	cur->state->layout = NULL;
+	cursor_invalidate_mapping(cur->state);
 }
 
 static void cursor_device_destroy(struct wlr_cursor_device *c_device) {
@@ -215,11 +267,15 @@ static void cursor_warp_unchecked(struct wlr_cursor *cur,
 
 	struct wlr_cursor_output_cursor *output_cursor;
 	wl_list_for_each(output_cursor, &cur->state->output_cursors, link) {
-		double output_x = lx, output_y = ly;
-		wlr_output_layout_output_coords(cur->state->layout,
-			output_cursor->output_cursor->output, &output_x, &output_y);
 		wlr_output_cursor_move(output_cursor->output_cursor,
-			output_x, output_y);
+			lx - output_cursor->l_output->x, ly - output_cursor->l_output->y);
+
+		if (output_cursor->xcursor_paused &&
+				output_cursor->output_cursor->visible) {
+			// Resume the animation on the next frame
+			output_cursor->xcursor_paused = false;
+			wlr_output_schedule_frame(output_cursor->output_cursor->output);
+		}
 	}
 
 	cur->x = lx;
@@ -240,11 +296,8 @@ static void cursor_warp_unchecked(struct wlr_cursor *cur,
  * If none of these are set, empties the box and absolute movement should be
  * relative to the extents of the layout.
  */
-static void get_mapping(struct wlr_cursor *cur,
-		struct wlr_input_device *dev, struct wlr_box *box) {
-	assert(cur->state->layout);
-	struct wlr_cursor_device *c_device = get_cursor_device(cur, dev);
-
+static void compute_mapping(struct wlr_cursor *cur,
+		struct wlr_cursor_device *c_device, struct wlr_box *box) {
 	if (c_device) {
 		if (!wlr_box_empty(&c_device->mapped_box)) {
 			*box = c_device->mapped_box;
@@ -266,6 +319,58 @@ static void get_mapping(struct wlr_cursor *cur,
 	}
 }
 
+/**
+ * Same as compute_mapping(), but cached per device. The cache is invalidated
+ * whenever the mappings or the layout change.
+ */
+static void get_mapping(struct wlr_cursor *cur,
+		struct wlr_input_device *dev, struct wlr_box *box) {
+	assert(cur->state->layout);
+	struct wlr_cursor_device *c_device = get_cursor_device(cur, dev);
+	if (c_device == NULL) {
+		compute_mapping(cur, NULL, box);
+		return;
+	}
+
+	if (!c_device->mapping_valid) {
+		compute_mapping(cur, c_device, &c_device->mapping);
+		c_device->mapping_valid = true;
+	}
+	*box = c_device->mapping;
+}
+
+static void get_layout_box(struct wlr_cursor *cur, struct wlr_box *box) {
+	struct wlr_cursor_state *state = cur->state;
+	if (wlr_box_empty(&state->layout_box)) {
+		wlr_output_layout_get_box(state->layout, NULL, &state->layout_box);
+	}
+	*box = state->layout_box;
+}
+
+static void layout_closest_point(struct wlr_cursor *cur, double lx, double ly,
+		double *dest_lx, double *dest_ly) {
+	struct wlr_cursor_state *state = cur->state;
+
+	// A point inside an output is its own closest point. The cursor mostly
+	// stays on the same output, so check that one before walking the layout.
+	if (wlr_box_contains_point(&state->hint_box, lx, ly)) {
+		*dest_lx = lx;
+		*dest_ly = ly;
+		return;
+	}
+
+	wlr_output_layout_closest_point(state->layout, NULL, lx, ly,
+		dest_lx, dest_ly);
+
+	if (!wlr_box_contains_point(&state->hint_box, *dest_lx, *dest_ly)) {
+		struct wlr_output *output = wlr_output_layout_output_at(state->layout,
+			*dest_lx, *dest_ly);
+		if (output != NULL) {
+			wlr_output_layout_get_box(state->layout, output, &state->hint_box);
+		}
+	}
+}
+
 bool wlr_cursor_warp(struct wlr_cursor *cur, struct wlr_input_device *dev,
 		double lx, double ly) {
 	assert(cur->state->layout);
@@ -298,8 +403,7 @@ void wlr_cursor_warp_closest(struct wlr_cursor *cur,
 			ly = 0;
 		}
 	} else {
-		wlr_output_layout_closest_point(cur->state->layout, NULL, lx, ly,
-			&lx, &ly);
+		layout_closest_point(cur, lx, ly, &lx, &ly);
 	}
 
 	cursor_warp_unchecked(cur, lx, ly);
@@ -313,7 +417,7 @@ void wlr_cursor_absolute_to_layout_coords(struct wlr_cursor *cur,
 	struct wlr_box mapping;
 	get_mapping(cur, dev, &mapping);
 	if (wlr_box_empty(&mapping)) {
-		wlr_output_layout_get_box(cur->state->layout, NULL, &mapping);
+		get_layout_box(cur, &mapping);
 	}
 
 	*lx = !isnan(x) ? mapping.width * x + mapping.x : cur->x;
@@ -350,20 +454,126 @@ void wlr_cursor_set_image(struct wlr_cursor *cur, const uint8_t *pixels,
 			continue;
 		}
 
+		output_cursor_reset_xcursor(output_cursor);
 		wlr_output_cursor_set_image(output_cursor->output_cursor, pixels,
 			stride, width, height, hotspot_x, hotspot_y);
 	}
 }
 
+static void output_cursor_set_xcursor_image(
+		struct wlr_cursor_output_cursor *output_cursor, int index) {
+	struct wlr_xcursor_image *image = output_cursor->xcursor->images[index];
+	wlr_output_cursor_set_image(output_cursor->output_cursor, image->buffer,
+		image->width * 4, image->width, image->height, image->hotspot_x,
+		image->hotspot_y);
+	output_cursor->xcursor_index = index;
+}
+
+static void output_cursor_handle_output_frame(struct wl_listener *listener,
+		void *data) {
+	struct wlr_cursor_output_cursor *output_cursor =
+		wl_container_of(listener, output_cursor, output_frame);
+
+	if (!output_cursor->output_cursor->visible) {
+		// Don't request any frame until the cursor moves back on the output
+		output_cursor->xcursor_paused = true;
+		wl_event_source_timer_update(output_cursor->xcursor_timer, 0);
+		return;
+	}
+
+	uint32_t duration;
+	int index = wlr_xcursor_frame_and_duration(output_cursor->xcursor,
+		get_current_time_msec() - output_cursor->xcursor_start, &duration);
+	if (index != output_cursor->xcursor_index) {
+		output_cursor_set_xcursor_image(output_cursor, index);
+	}
+
+	// Ask for a frame when the next image is due, the output may not render
+	// any frame in the meantime
+	wl_event_source_timer_update(output_cursor->xcursor_timer, duration);
+}
+
+static int output_cursor_handle_xcursor_timer(void *data) {
+	struct wlr_cursor_output_cursor *output_cursor = data;
+	wlr_output_schedule_frame(output_cursor->output_cursor->output);
+	return 0;
+}
+
+static void output_cursor_start_animation(
+		struct wlr_cursor_output_cursor *output_cursor) {
+	struct wlr_output *output = output_cursor->output_cursor->output;
+	struct wlr_xcursor *xcursor = output_cursor->xcursor;
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(output->display);
+	output_cursor->xcursor_timer = wl_event_loop_add_timer(loop,
+		output_cursor_handle_xcursor_timer, output_cursor);
+	if (output_cursor->xcursor_timer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create cursor animation timer");
+		output_cursor->xcursor = NULL;
+		return;
+	}
+
+	output_cursor->output_frame.notify = output_cursor_handle_output_frame;
+	wl_signal_add(&output->events.frame, &output_cursor->output_frame);
+
+	// Render all frames upfront, the animation then cycles through the cached
+	// cursor buffers
+	output_cursor_buffer_cache_reserve(output, xcursor->image_count);
+	if (output->hardware_cursor == output_cursor->output_cursor) {
+		for (int i = xcursor->image_count - 1; i > 0; i--) {
+			output_cursor_set_xcursor_image(output_cursor, i);
+		}
+		output_cursor_set_xcursor_image(output_cursor, 0);
+	}
+
+	output_cursor->xcursor_start = get_current_time_msec();
+	output_cursor->xcursor_paused = !output_cursor->output_cursor->visible;
+	if (!output_cursor->xcursor_paused) {
+		wl_event_source_timer_update(output_cursor->xcursor_timer,
+			xcursor->images[0]->delay > 0 ? xcursor->images[0]->delay : 1);
+	}
+}
+
+void wlr_cursor_set_xcursor(struct wlr_cursor *cur,
+		struct wlr_xcursor *xcursor, float scale) {
+	struct wlr_cursor_output_cursor *output_cursor;
+	wl_list_for_each(output_cursor, &cur->state->output_cursors, link) {
+		float output_scale = output_cursor->output_cursor->output->scale;
+		if (scale > 0 && output_scale != scale) {
+			continue;
+		}
+		if (output_cursor->xcursor == xcursor) {
+			// Don't restart the animation
+			continue;
+		}
+
+		output_cursor_reset_xcursor(output_cursor);
+		output_cursor->xcursor = xcursor;
+		output_cursor_set_xcursor_image(output_cursor, 0);
+		if (xcursor->image_count > 1) {
+			output_cursor_start_animation(output_cursor);
+		}
+	}
+}
+
 void wlr_cursor_set_surface(struct wlr_cursor *cur, struct wlr_surface *surface,
 		int32_t hotspot_x, int32_t hotspot_y) {
 	struct wlr_cursor_output_cursor *output_cursor;
 	wl_list_for_each(output_cursor, &cur->state->output_cursors, link) {
+		output_cursor_reset_xcursor(output_cursor);
 		wlr_output_cursor_set_surface(output_cursor->output_cursor, surface,
 			hotspot_x, hotspot_y);
 	}
 }
 
+void wlr_cursor_set_drag_icon(struct wlr_cursor *cur,
+		struct wlr_surface *icon) {
+	struct wlr_cursor_output_cursor *output_cursor;
+	wl_list_for_each(output_cursor, &cur->state->output_cursors, link) {
+		wlr_output_cursor_set_drag_icon(output_cursor->output_cursor, icon);
+	}
+}
+
 static void handle_pointer_motion(struct wl_listener *listener, void *data) {
 	struct wlr_event_pointer_motion *event = data;
 	struct wlr_cursor_device *device =
@@ -785,6 +995,7 @@ static void layout_add(struct wlr_cursor_state *state,
 		return;
 	}
 	output_cursor->cursor = state->cursor;
+	output_cursor->l_output = l_output;
 
 	output_cursor->output_cursor = wlr_output_cursor_create(l_output->output);
 	if (output_cursor->output_cursor == NULL) {
@@ -812,6 +1023,8 @@ static void handle_layout_change(struct wl_listener *listener, void *data) {
 		wl_container_of(listener, state, layout_change);
 	struct wlr_output_layout *layout = data;
 
+	cursor_invalidate_mapping(state);
+
 	if (!wlr_output_layout_contains_point(layout, NULL, state->cursor->x,
 			state->cursor->y)) {
 		// the output we were on has gone away so go to the closest boundary
@@ -840,6 +1053,7 @@ void wlr_cursor_attach_output_layout(struct wlr_cursor *cur,
 	cur->state->layout_destroy.notify = handle_layout_destroy;
 
 	cur->state->layout = l;
+	cursor_invalidate_mapping(cur->state);
 
 	struct wlr_output_layout_output *l_output;
 	wl_list_for_each(l_output, &l->outputs, link) {
@@ -850,6 +1064,7 @@ void wlr_cursor_attach_output_layout(struct wlr_cursor *cur,
 void wlr_cursor_map_to_output(struct wlr_cursor *cur,
 		struct wlr_output *output) {
 	cur->state->mapped_output = output;
+	cursor_invalidate_mapping(cur->state);
 }
 
 void wlr_cursor_map_input_to_output(struct wlr_cursor *cur,
@@ -862,6 +1077,7 @@ void wlr_cursor_map_input_to_output(struct wlr_cursor *cur,
 	}
 
 	c_device->mapped_output = output;
+	c_device->mapping_valid = false;
 }
 
 void wlr_cursor_map_to_region(struct wlr_cursor *cur,
@@ -875,6 +1091,7 @@ void wlr_cursor_map_to_region(struct wlr_cursor *cur,
 	} else {
 		cur->state->mapped_box.width = cur->state->mapped_box.height = 0;
 	}
+	cursor_invalidate_mapping(cur->state);
 }
 
 void wlr_cursor_map_input_to_region(struct wlr_cursor *cur,
@@ -897,4 +1114,5 @@ void wlr_cursor_map_input_to_region(struct wlr_cursor *cur,
 	} else {
 		c_device->mapped_box.width = c_device->mapped_box.height = 0;
 	}
+	c_device->mapping_valid = false;
 }
@@ -0,0 +1,155 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_damage_ring.h>
+#include <wlr/util/box.h>
+
+static void ring_buffer_reset(struct wlr_damage_ring_buffer *entry) {
+	if (entry->buffer == NULL) {
+		return;
+	}
+	wl_list_remove(&entry->destroy.link);
+	entry->buffer = NULL;
+	pixman_region32_clear(&entry->damage);
+	entry->last_used = 0;
+}
+
+static void ring_buffer_handle_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_damage_ring_buffer *entry =
+		wl_container_of(listener, entry, destroy);
+	ring_buffer_reset(entry);
+}
+
+void wlr_damage_ring_init(struct wlr_damage_ring *ring) {
+	memset(ring, 0, sizeof(*ring));
+	ring->width = INT_MAX;
+	ring->height = INT_MAX;
+
+	pixman_region32_init(&ring->current);
+	for (size_t i = 0; i < WLR_DAMAGE_RING_BUFFERS_LEN; i++) {
+		struct wlr_damage_ring_buffer *entry = &ring->buffers[i];
+		pixman_region32_init(&entry->damage);
+	}
+}
+
+void wlr_damage_ring_finish(struct wlr_damage_ring *ring) {
+	pixman_region32_fini(&ring->current);
+	for (size_t i = 0; i < WLR_DAMAGE_RING_BUFFERS_LEN; i++) {
+		struct wlr_damage_ring_buffer *entry = &ring->buffers[i];
+		ring_buffer_reset(entry);
+		pixman_region32_fini(&entry->damage);
+	}
+}
+
+void wlr_damage_ring_set_bounds(struct wlr_damage_ring *ring,
+		int32_t width, int32_t height) {
+	if (width == 0 || height == 0) {
+		width = INT_MAX;
+		height = INT_MAX;
+	}
+
+	if (ring->width == width && ring->height == height) {
+		return;
+	}
+
+	ring->width = width;
+	ring->height = height;
+	wlr_damage_ring_add_whole(ring);
+}
+
+bool wlr_damage_ring_add(struct wlr_damage_ring *ring,
+		const pixman_region32_t *damage) {
+	pixman_region32_t clipped;
+	pixman_region32_init(&clipped);
+	pixman_region32_intersect_rect(&clipped, (pixman_region32_t *)damage,
+		0, 0, ring->width, ring->height);
+	bool intersects = pixman_region32_not_empty(&clipped);
+	if (intersects) {
+		pixman_region32_union(&ring->current, &ring->current, &clipped);
+	}
+	pixman_region32_fini(&clipped);
+	return intersects;
+}
+
+bool wlr_damage_ring_add_box(struct wlr_damage_ring *ring,
+		const struct wlr_box *box) {
+	struct wlr_box clipped = {
+		.x = 0,
+		.y = 0,
+		.width = ring->width,
+		.height = ring->height,
+	};
+	if (!wlr_box_intersection(&clipped, &clipped, box)) {
+		return false;
+	}
+	pixman_region32_union_rect(&ring->current, &ring->current,
+		clipped.x, clipped.y, clipped.width, clipped.height);
+	return true;
+}
+
+void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring) {
+	pixman_region32_union_rect(&ring->current, &ring->current,
+		0, 0, ring->width, ring->height);
+}
+
+static struct wlr_damage_ring_buffer *ring_find_buffer(
+		struct wlr_damage_ring *ring, struct wlr_buffer *buffer) {
+	for (size_t i = 0; i < WLR_DAMAGE_RING_BUFFERS_LEN; i++) {
+		struct wlr_damage_ring_buffer *entry = &ring->buffers[i];
+		if (entry->buffer == buffer) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+void wlr_damage_ring_get_buffer_damage(struct wlr_damage_ring *ring,
+		struct wlr_buffer *buffer, pixman_region32_t *damage) {
+	struct wlr_damage_ring_buffer *entry = ring_find_buffer(ring, buffer);
+	if (entry == NULL) {
+		pixman_region32_union_rect(damage, damage,
+			0, 0, ring->width, ring->height);
+		return;
+	}
+
+	pixman_region32_union(damage, damage, &ring->current);
+	pixman_region32_union(damage, damage, &entry->damage);
+}
+
+void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
+		struct wlr_buffer *buffer) {
+	struct wlr_damage_ring_buffer *entry = ring_find_buffer(ring, buffer);
+	if (entry == NULL) {
+		// Replace an unused entry, or the least recently rendered buffer
+		entry = &ring->buffers[0];
+		for (size_t i = 0; i < WLR_DAMAGE_RING_BUFFERS_LEN; i++) {
+			struct wlr_damage_ring_buffer *other = &ring->buffers[i];
+			if (other->buffer == NULL) {
+				entry = other;
+				break;
+			}
+			if (other->last_used < entry->last_used) {
+				entry = other;
+			}
+		}
+		ring_buffer_reset(entry);
+
+		entry->buffer = buffer;
+		entry->destroy.notify = ring_buffer_handle_destroy;
+		wl_signal_add(&buffer->events.destroy, &entry->destroy);
+	}
+
+	for (size_t i = 0; i < WLR_DAMAGE_RING_BUFFERS_LEN; i++) {
+		struct wlr_damage_ring_buffer *other = &ring->buffers[i];
+		if (other->buffer != NULL && other != entry) {
+			pixman_region32_union(&other->damage, &other->damage,
+				&ring->current);
+		}
+	}
+
+	pixman_region32_clear(&entry->damage);
+	entry->last_used = ++ring->counter;
+	pixman_region32_clear(&ring->current);
+}
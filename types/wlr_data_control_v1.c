@@ -1,5 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -7,11 +9,18 @@
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_primary_selection.h>
 #include <wlr/util/log.h>
+#include "util/shm.h"
 #include "util/signal.h"
 #include "wlr-data-control-unstable-v1-protocol.h"
 
 #define DATA_CONTROL_MANAGER_VERSION 2
 
+// Selection data read once for all data-control clients is held up to this
+// size, larger data is requested from the source for each client instead
+#define MAX_READ_CACHE_SIZE (32 * 1024 * 1024)
+// Give up on a source which doesn't send anything for this long
+#define READ_TIMEOUT_MS 5000
+
 struct data_control_source {
 	struct wl_resource *resource;
 	struct wl_array mime_types;
@@ -237,6 +246,239 @@ static struct data_offer *data_offer_from_offer_resource(
 	return wl_resource_get_user_data(resource);
 }
 
+/**
+ * Clipboard managers all read the new selection as soon as it's set. The
+ * selection is read from its source once per MIME type, then served to all
+ * data-control clients from a memfd.
+ */
+struct selection_cache {
+	struct wlr_data_control_manager_v1 *manager;
+	struct wl_list link; // wlr_data_control_manager_v1.selection_caches
+
+	struct wlr_seat *seat;
+	bool is_primary;
+	char *mime_type;
+
+	int pipe_fd; // read end of the pipe to the source, -1 once read
+	int memfd;
+	size_t size;
+	struct wl_array readers; // int, fds waiting for the data
+
+	struct wl_event_source *pipe_source;
+	struct wl_event_source *timer;
+
+	struct wl_listener seat_set_selection;
+	struct wl_listener seat_destroy;
+};
+
+static bool seat_send_selection(struct wlr_seat *seat, bool is_primary,
+		const char *mime_type, int fd) {
+	if (is_primary) {
+		if (seat->primary_selection_source == NULL) {
+			return false;
+		}
+		wlr_primary_selection_source_send(seat->primary_selection_source,
+			mime_type, fd);
+	} else {
+		if (seat->selection_source == NULL) {
+			return false;
+		}
+		wlr_data_source_send(seat->selection_source, mime_type, fd);
+	}
+	return true;
+}
+
+static void cache_close_pipe(struct selection_cache *cache) {
+	if (cache->pipe_source != NULL) {
+		wl_event_source_remove(cache->pipe_source);
+		cache->pipe_source = NULL;
+	}
+	if (cache->timer != NULL) {
+		wl_event_source_remove(cache->timer);
+		cache->timer = NULL;
+	}
+	if (cache->pipe_fd >= 0) {
+		close(cache->pipe_fd);
+		cache->pipe_fd = -1;
+	}
+}
+
+/**
+ * Destroy the cache. If fallback is set, waiting readers are handed to the
+ * selection source, otherwise they get no data.
+ */
+static void cache_destroy(struct selection_cache *cache, bool fallback) {
+	int *fd_ptr;
+	wl_array_for_each(fd_ptr, &cache->readers) {
+		if (!fallback || !seat_send_selection(cache->seat, cache->is_primary,
+				cache->mime_type, *fd_ptr)) {
+			close(*fd_ptr);
+		}
+	}
+	wl_array_release(&cache->readers);
+
+	cache_close_pipe(cache);
+	if (cache->memfd >= 0) {
+		close(cache->memfd);
+	}
+	wl_list_remove(&cache->seat_set_selection.link);
+	wl_list_remove(&cache->seat_destroy.link);
+	wl_list_remove(&cache->link);
+	free(cache->mime_type);
+	free(cache);
+}
+
+static void cache_serve(struct selection_cache *cache, int fd) {
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(cache->seat->display);
+	wlr_data_transfer_create_from_fd(loop, fd, cache->memfd, NULL, NULL);
+}
+
+static void cache_complete(struct selection_cache *cache) {
+	cache_close_pipe(cache);
+
+	int *fd_ptr;
+	wl_array_for_each(fd_ptr, &cache->readers) {
+		cache_serve(cache, *fd_ptr);
+	}
+	wl_array_release(&cache->readers);
+	wl_array_init(&cache->readers);
+}
+
+static bool write_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static int cache_handle_readable(int fd, uint32_t mask, void *data) {
+	struct selection_cache *cache = data;
+
+	char buf[16384];
+	ssize_t n = read(fd, buf, sizeof(buf));
+	if (n < 0) {
+		if (errno == EAGAIN) {
+			return 0;
+		}
+		wlr_log_errno(WLR_ERROR, "Failed to cache selection from source");
+		cache_destroy(cache, true);
+		return 0;
+	} else if (n == 0) {
+		cache_complete(cache);
+		return 0;
+	}
+
+	if (cache->size + n > MAX_READ_CACHE_SIZE) {
+		wlr_log(WLR_DEBUG, "Selection too large to be shared between "
+			"data-control clients");
+		cache_destroy(cache, true);
+		return 0;
+	}
+	if (!write_all(cache->memfd, buf, n)) {
+		wlr_log_errno(WLR_ERROR, "Failed to write selection to memfd");
+		cache_destroy(cache, true);
+		return 0;
+	}
+	cache->size += n;
+
+	wl_event_source_timer_update(cache->timer, READ_TIMEOUT_MS);
+	return 0;
+}
+
+static int cache_handle_timeout(void *data) {
+	struct selection_cache *cache = data;
+	wlr_log(WLR_INFO, "Selection source timed out sending %s",
+		cache->mime_type);
+	cache_destroy(cache, false);
+	return 0;
+}
+
+static void cache_handle_seat_set_selection(struct wl_listener *listener,
+		void *data) {
+	struct selection_cache *cache =
+		wl_container_of(listener, cache, seat_set_selection);
+	cache_destroy(cache, false);
+}
+
+static void cache_handle_seat_destroy(struct wl_listener *listener,
+		void *data) {
+	struct selection_cache *cache =
+		wl_container_of(listener, cache, seat_destroy);
+	cache_destroy(cache, false);
+}
+
+static struct selection_cache *cache_create(
+		struct wlr_data_control_manager_v1 *manager, struct wlr_seat *seat,
+		bool is_primary, const char *mime_type) {
+	struct selection_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->manager = manager;
+	cache->seat = seat;
+	cache->is_primary = is_primary;
+	cache->pipe_fd = -1;
+	wl_array_init(&cache->readers);
+	wl_list_init(&cache->seat_set_selection.link);
+	wl_list_init(&cache->seat_destroy.link);
+	wl_list_insert(&manager->selection_caches, &cache->link);
+
+	int fds[2];
+	cache->mime_type = strdup(mime_type);
+	cache->memfd = allocate_shm_file(0);
+	if (cache->mime_type == NULL || cache->memfd < 0 || pipe(fds) != 0) {
+		wlr_log(WLR_ERROR, "Failed to set up selection read");
+		cache_destroy(cache, false);
+		return NULL;
+	}
+	cache->pipe_fd = fds[0];
+	// Only our end is non-blocking, the source may expect a blocking fd
+	if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) != 0 ||
+			fcntl(fds[1], F_SETFD, FD_CLOEXEC) != 0 ||
+			fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0) {
+		wlr_log_errno(WLR_ERROR, "fcntl failed");
+		close(fds[1]);
+		cache_destroy(cache, false);
+		return NULL;
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(seat->display);
+	cache->pipe_source = wl_event_loop_add_fd(loop, cache->pipe_fd,
+		WL_EVENT_READABLE, cache_handle_readable, cache);
+	cache->timer = wl_event_loop_add_timer(loop, cache_handle_timeout, cache);
+	if (cache->pipe_source == NULL || cache->timer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to set up selection read");
+		close(fds[1]);
+		cache_destroy(cache, false);
+		return NULL;
+	}
+	wl_event_source_timer_update(cache->timer, READ_TIMEOUT_MS);
+
+	cache->seat_set_selection.notify = cache_handle_seat_set_selection;
+	wl_signal_add(is_primary ? &seat->events.set_primary_selection :
+		&seat->events.set_selection, &cache->seat_set_selection);
+	cache->seat_destroy.notify = cache_handle_seat_destroy;
+	wl_signal_add(&seat->events.destroy, &cache->seat_destroy);
+
+	// The source takes ownership of the write end
+	if (!seat_send_selection(seat, is_primary, mime_type, fds[1])) {
+		close(fds[1]);
+		cache_destroy(cache, false);
+		return NULL;
+	}
+
+	return cache;
+}
+
 static void offer_handle_receive(struct wl_client *client,
 		struct wl_resource *resource, const char *mime_type, int fd) {
 	struct data_offer *offer = data_offer_from_offer_resource(resource);
@@ -251,21 +493,40 @@ static void offer_handle_receive(struct wl_client *client,
 		return;
 	}
 
-	if (offer->is_primary) {
-		if (device->seat->primary_selection_source == NULL) {
-			close(fd);
-			return;
+	struct wlr_data_control_manager_v1 *manager = device->manager;
+	struct selection_cache *cache, *found = NULL;
+	wl_list_for_each(cache, &manager->selection_caches, link) {
+		if (cache->seat == device->seat &&
+				cache->is_primary == offer->is_primary &&
+				strcmp(cache->mime_type, mime_type) == 0) {
+			found = cache;
+			break;
 		}
-		wlr_primary_selection_source_send(
-			device->seat->primary_selection_source,
-			mime_type, fd);
-	} else {
-		if (device->seat->selection_source == NULL) {
+	}
+	if (found == NULL) {
+		found = cache_create(manager, device->seat, offer->is_primary,
+			mime_type);
+	}
+	if (found == NULL) {
+		// Fall back to a direct transfer
+		if (!seat_send_selection(device->seat, offer->is_primary,
+				mime_type, fd)) {
 			close(fd);
-			return;
 		}
-		wlr_data_source_send(device->seat->selection_source, mime_type, fd);
+		return;
+	}
+
+	if (found->pipe_fd < 0) {
+		cache_serve(found, fd);
+		return;
 	}
+
+	int *fd_ptr = wl_array_add(&found->readers, sizeof(*fd_ptr));
+	if (fd_ptr == NULL) {
+		close(fd);
+		return;
+	}
+	*fd_ptr = fd;
 }
 
 static void offer_handle_destroy(struct wl_client *client,
@@ -667,6 +928,11 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_data_control_manager_v1 *manager =
 		wl_container_of(listener, manager, display_destroy);
 	wlr_signal_emit_safe(&manager->events.destroy, manager);
+	struct selection_cache *cache, *cache_tmp;
+	wl_list_for_each_safe(cache, cache_tmp, &manager->selection_caches,
+			link) {
+		cache_destroy(cache, false);
+	}
 	wl_list_remove(&manager->display_destroy.link);
 	wl_global_destroy(manager->global);
 	free(manager);
@@ -680,6 +946,7 @@ struct wlr_data_control_manager_v1 *wlr_data_control_manager_v1_create(
 		return NULL;
 	}
 	wl_list_init(&manager->devices);
+	wl_list_init(&manager->selection_caches);
 	wl_signal_init(&manager->events.destroy);
 	wl_signal_init(&manager->events.new_device);
 
@@ -1,11 +1,16 @@
 #include <assert.h>
+#include <drm_fourcc.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/allocator.h>
 #include <wlr/render/dmabuf.h>
 #include <wlr/types/wlr_export_dmabuf_v1.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/util/addon.h>
 #include <wlr/util/log.h>
+#include "render/drm_format_set.h"
+#include "render/swapchain.h"
 #include "util/signal.h"
 #include "wlr-export-dmabuf-unstable-v1-protocol.h"
 
@@ -30,16 +35,92 @@ static const struct zwlr_export_dmabuf_frame_v1_interface frame_impl = {
 	.destroy = frame_handle_destroy,
 };
 
+// Buffers the display hardware captures an output into
+struct export_dmabuf_output {
+	struct wlr_addon addon; // wlr_output.addons, owned by the manager
+	struct wlr_swapchain *swapchain;
+};
+
+static void export_dmabuf_output_handle_addon_destroy(struct wlr_addon *addon) {
+	struct export_dmabuf_output *export_output =
+		wl_container_of(addon, export_output, addon);
+	wlr_addon_finish(&export_output->addon);
+	wlr_swapchain_destroy(export_output->swapchain);
+	free(export_output);
+}
+
+static const struct wlr_addon_interface export_dmabuf_output_addon_impl = {
+	.name = "wlr_export_dmabuf_v1_output",
+	.destroy = export_dmabuf_output_handle_addon_destroy,
+};
+
+/**
+ * Acquire a buffer to capture the output into. Display engines write
+ * linear buffers, in the render format since that's what they scan out.
+ */
+static struct wlr_buffer *export_dmabuf_output_acquire(
+		struct wlr_export_dmabuf_manager_v1 *manager,
+		struct wlr_output *output) {
+	if (output->allocator == NULL ||
+			!(output->allocator->buffer_caps & WLR_BUFFER_CAP_DMABUF)) {
+		return NULL;
+	}
+
+	struct export_dmabuf_output *export_output;
+	struct wlr_addon *addon = wlr_addon_find(&output->addons, manager,
+		&export_dmabuf_output_addon_impl);
+	if (addon != NULL) {
+		export_output = wl_container_of(addon, export_output, addon);
+	} else {
+		export_output = calloc(1, sizeof(*export_output));
+		if (export_output == NULL) {
+			return NULL;
+		}
+		wlr_addon_init(&export_output->addon, &output->addons, manager,
+			&export_dmabuf_output_addon_impl);
+	}
+
+	struct wlr_swapchain *swapchain = export_output->swapchain;
+	if (swapchain == NULL || swapchain->width != output->width ||
+			swapchain->height != output->height ||
+			swapchain->format->format != output->render_format) {
+		wlr_swapchain_destroy(swapchain);
+		export_output->swapchain = NULL;
+
+		struct wlr_drm_format *format =
+			wlr_drm_format_create(output->render_format);
+		if (format == NULL ||
+				!wlr_drm_format_add(&format, DRM_FORMAT_MOD_LINEAR)) {
+			free(format);
+			return NULL;
+		}
+		export_output->swapchain = wlr_swapchain_create(output->allocator,
+			output->width, output->height, format);
+		free(format);
+		if (export_output->swapchain == NULL) {
+			return NULL;
+		}
+	}
+
+	return wlr_swapchain_acquire(export_output->swapchain, NULL);
+}
+
 static void frame_destroy(struct wlr_export_dmabuf_frame_v1 *frame) {
 	if (frame == NULL) {
 		return;
 	}
-	if (frame->output != NULL) {
-		wlr_output_lock_attach_render(frame->output, false);
-		if (frame->cursor_locked) {
-			wlr_output_lock_software_cursors(frame->output, false);
-		}
+	if (frame->layers_locked) {
+		wlr_output_lock_layers(frame->output, false);
+	}
+	if (frame->cursor_locked) {
+		wlr_output_lock_software_cursors(frame->output, false);
+	}
+	if (frame->capture != NULL) {
+		wl_list_remove(&frame->capture_done.link);
+		wl_list_remove(&frame->capture_destroy.link);
+		wlr_output_capture_destroy(frame->capture);
 	}
+	wlr_buffer_unlock(frame->capture_buffer);
 	wl_list_remove(&frame->link);
 	wl_list_remove(&frame->output_commit.link);
 	// Make the frame resource inert
@@ -52,21 +133,10 @@ static void frame_handle_resource_destroy(struct wl_resource *resource) {
 	frame_destroy(frame);
 }
 
-static void frame_output_handle_commit(struct wl_listener *listener,
-		void *data) {
-	struct wlr_export_dmabuf_frame_v1 *frame =
-		wl_container_of(listener, frame, output_commit);
-	struct wlr_output_event_commit *event = data;
-
-	if (!(event->committed & WLR_OUTPUT_STATE_BUFFER)) {
-		return;
-	}
-
-	wl_list_remove(&frame->output_commit.link);
-	wl_list_init(&frame->output_commit.link);
-
+static void frame_export(struct wlr_export_dmabuf_frame_v1 *frame,
+		struct wlr_buffer *buffer, const struct timespec *when) {
 	struct wlr_dmabuf_attributes attribs = {0};
-	if (!wlr_buffer_get_dmabuf(event->buffer, &attribs)) {
+	if (!wlr_buffer_get_dmabuf(buffer, &attribs)) {
 		zwlr_export_dmabuf_frame_v1_send_cancel(frame->resource,
 			ZWLR_EXPORT_DMABUF_FRAME_V1_CANCEL_REASON_TEMPORARY);
 		frame_destroy(frame);
@@ -86,14 +156,133 @@ static void frame_output_handle_commit(struct wl_listener *listener,
 			attribs.fd[i], size, attribs.offset[i], attribs.stride[i], i);
 	}
 
-	time_t tv_sec = event->when->tv_sec;
+	time_t tv_sec = when->tv_sec;
 	uint32_t tv_sec_hi = (sizeof(tv_sec) > 4) ? tv_sec >> 32 : 0;
 	uint32_t tv_sec_lo = tv_sec & 0xFFFFFFFF;
 	zwlr_export_dmabuf_frame_v1_send_ready(frame->resource,
-		tv_sec_hi, tv_sec_lo, event->when->tv_nsec);
+		tv_sec_hi, tv_sec_lo, when->tv_nsec);
 	frame_destroy(frame);
 }
 
+static void frame_output_handle_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_export_dmabuf_frame_v1 *frame =
+		wl_container_of(listener, frame, output_commit);
+	struct wlr_output_event_commit *event = data;
+
+	if (!(event->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		return;
+	}
+	if (frame->skip_commit &&
+			frame->output->commit_seq == frame->skip_commit_seq) {
+		// Prepared before the layers were locked
+		return;
+	}
+
+	wl_list_remove(&frame->output_commit.link);
+	wl_list_init(&frame->output_commit.link);
+
+	frame_export(frame, event->buffer, event->when);
+}
+
+// Export the next committed buffer
+static void frame_start_export(struct wlr_export_dmabuf_frame_v1 *frame,
+		bool overlay_cursor) {
+	struct wlr_output *output = frame->output;
+
+	// The committed buffer is exported as-is, which works as well with a
+	// client buffer in direct scan-out. Output layers would be missing.
+	wlr_output_lock_layers(output, true);
+	frame->layers_locked = true;
+	if (overlay_cursor) {
+		wlr_output_lock_software_cursors(output, true);
+		frame->cursor_locked = true;
+	}
+
+	wl_list_remove(&frame->output_commit.link);
+	wl_signal_add(&output->events.commit, &frame->output_commit);
+	frame->output_commit.notify = frame_output_handle_commit;
+
+	wlr_output_schedule_frame(output);
+}
+
+static void frame_handle_capture_done(struct wl_listener *listener,
+		void *data) {
+	struct wlr_export_dmabuf_frame_v1 *frame =
+		wl_container_of(listener, frame, capture_done);
+	const struct wlr_output_event_capture *event = data;
+	struct timespec commit_time = event->capture->commit_time;
+
+	// The capture is destroyed right after this event
+	wl_list_remove(&frame->capture_done.link);
+	wl_list_remove(&frame->capture_destroy.link);
+	frame->capture = NULL;
+
+	if (event->success) {
+		frame_export(frame, frame->capture_buffer, &commit_time);
+		return;
+	}
+
+	// A failed capture may belong to a commit which is being prepared,
+	// before the locks can apply
+	wlr_buffer_unlock(frame->capture_buffer);
+	frame->capture_buffer = NULL;
+	frame->skip_commit = true;
+	frame->skip_commit_seq = frame->output->commit_seq + 1;
+	frame_start_export(frame, frame->overlay_cursor);
+}
+
+static void frame_handle_capture_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_export_dmabuf_frame_v1 *frame =
+		wl_container_of(listener, frame, capture_destroy);
+	// The output is being destroyed
+	wl_list_remove(&frame->capture_done.link);
+	wl_list_remove(&frame->capture_destroy.link);
+	frame->capture = NULL;
+	zwlr_export_dmabuf_frame_v1_send_cancel(frame->resource,
+		ZWLR_EXPORT_DMABUF_FRAME_V1_CANCEL_REASON_PERMANENT);
+	frame_destroy(frame);
+}
+
+/**
+ * Capture the next frame with the display hardware, including the cursor and
+ * the output layers.
+ */
+static bool frame_start_capture(struct wlr_export_dmabuf_frame_v1 *frame,
+		bool overlay_cursor) {
+	struct wlr_output *output = frame->output;
+	if (!overlay_cursor && output->hardware_cursor != NULL) {
+		return false;
+	}
+
+	struct wlr_buffer *buffer =
+		export_dmabuf_output_acquire(frame->manager, output);
+	if (buffer == NULL) {
+		return false;
+	}
+	if (!wlr_output_test_capture(output, buffer)) {
+		wlr_buffer_unlock(buffer);
+		return false;
+	}
+
+	frame->capture = wlr_output_capture_create(output, buffer);
+	if (frame->capture == NULL) {
+		wlr_buffer_unlock(buffer);
+		return false;
+	}
+	frame->capture_buffer = buffer;
+	// Remembered in case of a fallback
+	frame->overlay_cursor = overlay_cursor;
+	frame->capture_done.notify = frame_handle_capture_done;
+	wl_signal_add(&frame->capture->events.done, &frame->capture_done);
+	frame->capture_destroy.notify = frame_handle_capture_destroy;
+	wl_signal_add(&frame->capture->events.destroy, &frame->capture_destroy);
+
+	wlr_output_schedule_frame(output);
+	return true;
+}
+
 
 static const struct zwlr_export_dmabuf_manager_v1_interface manager_impl;
 
@@ -142,17 +331,9 @@ static void manager_handle_capture_output(struct wl_client *client,
 
 	frame->output = output;
 
-	wlr_output_lock_attach_render(frame->output, true);
-	if (overlay_cursor) {
-		wlr_output_lock_software_cursors(frame->output, true);
-		frame->cursor_locked = true;
+	if (!frame_start_capture(frame, overlay_cursor)) {
+		frame_start_export(frame, overlay_cursor);
 	}
-
-	wl_list_remove(&frame->output_commit.link);
-	wl_signal_add(&output->events.commit, &frame->output_commit);
-	frame->output_commit.notify = frame_output_handle_commit;
-
-	wlr_output_schedule_frame(output);
 }
 
 static void manager_handle_destroy(struct wl_client *client,
@@ -175,14 +175,37 @@ static const struct zwlr_foreign_toplevel_handle_v1_interface toplevel_handle_im
 	.unset_fullscreen = foreign_toplevel_handle_unset_fullscreen,
 };
 
+static void toplevel_send_state(struct wlr_foreign_toplevel_handle_v1 *toplevel);
+
 static void toplevel_idle_send_done(void *data) {
 	struct wlr_foreign_toplevel_handle_v1 *toplevel = data;
+	toplevel->idle_source = NULL;
+
+	// Only the latest value of properties changed since the last done event
+	// is sent
 	struct wl_resource *resource;
+	if (toplevel->title_pending) {
+		toplevel->title_pending = false;
+		wl_resource_for_each(resource, &toplevel->resources) {
+			zwlr_foreign_toplevel_handle_v1_send_title(resource,
+				toplevel->title);
+		}
+	}
+	if (toplevel->app_id_pending) {
+		toplevel->app_id_pending = false;
+		wl_resource_for_each(resource, &toplevel->resources) {
+			zwlr_foreign_toplevel_handle_v1_send_app_id(resource,
+				toplevel->app_id);
+		}
+	}
+	if (toplevel->state_pending) {
+		toplevel->state_pending = false;
+		toplevel_send_state(toplevel);
+	}
+
 	wl_resource_for_each(resource, &toplevel->resources) {
 		zwlr_foreign_toplevel_handle_v1_send_done(resource);
 	}
-
-	toplevel->idle_source = NULL;
 }
 
 static void toplevel_update_idle_source(
@@ -197,35 +220,37 @@ static void toplevel_update_idle_source(
 
 void wlr_foreign_toplevel_handle_v1_set_title(
 		struct wlr_foreign_toplevel_handle_v1 *toplevel, const char *title) {
+	if (toplevel->title != NULL && strcmp(toplevel->title, title) == 0) {
+		return;
+	}
+
 	free(toplevel->title);
 	toplevel->title = strdup(title);
 	if (toplevel->title == NULL) {
 		wlr_log(WLR_ERROR, "failed to allocate memory for toplevel title");
+		toplevel->title_pending = false;
 		return;
 	}
 
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &toplevel->resources) {
-		zwlr_foreign_toplevel_handle_v1_send_title(resource, title);
-	}
-
+	toplevel->title_pending = true;
 	toplevel_update_idle_source(toplevel);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_app_id(
 		struct wlr_foreign_toplevel_handle_v1 *toplevel, const char *app_id) {
+	if (toplevel->app_id != NULL && strcmp(toplevel->app_id, app_id) == 0) {
+		return;
+	}
+
 	free(toplevel->app_id);
 	toplevel->app_id = strdup(app_id);
 	if (toplevel->app_id == NULL) {
 		wlr_log(WLR_ERROR, "failed to allocate memory for toplevel app_id");
+		toplevel->app_id_pending = false;
 		return;
 	}
 
-	struct wl_resource *resource;
-	wl_resource_for_each(resource, &toplevel->resources) {
-		zwlr_foreign_toplevel_handle_v1_send_app_id(resource, app_id);
-	}
-
+	toplevel->app_id_pending = true;
 	toplevel_update_idle_source(toplevel);
 }
 
@@ -395,6 +420,11 @@ static void toplevel_send_state(struct wlr_foreign_toplevel_handle_v1 *toplevel)
 	}
 
 	wl_array_release(&states);
+}
+
+static void toplevel_update_state(
+		struct wlr_foreign_toplevel_handle_v1 *toplevel) {
+	toplevel->state_pending = true;
 	toplevel_update_idle_source(toplevel);
 }
 
@@ -409,7 +439,7 @@ void wlr_foreign_toplevel_handle_v1_set_maximized(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MAXIMIZED;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_update_state(toplevel);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_minimized(
@@ -423,7 +453,7 @@ void wlr_foreign_toplevel_handle_v1_set_minimized(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MINIMIZED;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_update_state(toplevel);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_activated(
@@ -437,7 +467,7 @@ void wlr_foreign_toplevel_handle_v1_set_activated(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_ACTIVATED;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_update_state(toplevel);
 }
 
 void wlr_foreign_toplevel_handle_v1_set_fullscreen(
@@ -451,7 +481,7 @@ void wlr_foreign_toplevel_handle_v1_set_fullscreen(
 	} else {
 		toplevel->state &= ~WLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN;
 	}
-	toplevel_send_state(toplevel);
+	toplevel_update_state(toplevel);
 }
 
 static void toplevel_resource_send_parent(
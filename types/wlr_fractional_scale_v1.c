@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_fractional_scale_v1.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+#include "fractional-scale-v1-protocol.h"
+#include "util/signal.h"
+
+#define FRACTIONAL_SCALE_VERSION 1
+
+/**
+ * Attached to surfaces as an addon. It's created before the client asks for
+ * it if the compositor notifies of a scale first, without a resource.
+ */
+struct wlr_fractional_scale_v1 {
+	struct wl_resource *resource; // NULL if not requested yet
+	struct wlr_addon addon;
+	double scale; // 0 if unknown
+};
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl;
+
+// Returns NULL if the surface has been destroyed
+static struct wlr_fractional_scale_v1 *fractional_scale_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource, &wp_fractional_scale_v1_interface,
+		&fractional_scale_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static void fractional_scale_destroy(struct wlr_fractional_scale_v1 *info) {
+	if (info == NULL) {
+		return;
+	}
+	if (info->resource != NULL) {
+		wl_resource_set_user_data(info->resource, NULL);
+	}
+	wlr_addon_finish(&info->addon);
+	free(info);
+}
+
+static void fractional_scale_handle_resource_destroy(
+		struct wl_resource *resource) {
+	fractional_scale_destroy(fractional_scale_from_resource(resource));
+}
+
+static void fractional_scale_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_fractional_scale_v1_interface fractional_scale_impl = {
+	.destroy = fractional_scale_handle_destroy,
+};
+
+static void fractional_scale_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_fractional_scale_v1 *info =
+		wl_container_of(addon, info, addon);
+	fractional_scale_destroy(info);
+}
+
+static const struct wlr_addon_interface fractional_scale_addon_impl = {
+	.name = "wlr_fractional_scale_v1",
+	.destroy = fractional_scale_addon_destroy,
+};
+
+static struct wlr_fractional_scale_v1 *fractional_scale_get_or_create(
+		struct wlr_surface *surface) {
+	struct wlr_addon *addon = wlr_addon_find(&surface->addons, NULL,
+		&fractional_scale_addon_impl);
+	if (addon != NULL) {
+		struct wlr_fractional_scale_v1 *info =
+			wl_container_of(addon, info, addon);
+		return info;
+	}
+
+	struct wlr_fractional_scale_v1 *info = calloc(1, sizeof(*info));
+	if (info == NULL) {
+		return NULL;
+	}
+	wlr_addon_init(&info->addon, &surface->addons, NULL,
+		&fractional_scale_addon_impl);
+	return info;
+}
+
+static uint32_t scale_to_v120(double scale) {
+	// The scale is sent as a numerator over 120
+	return round(scale * 120);
+}
+
+void wlr_fractional_scale_v1_notify_scale(struct wlr_surface *surface,
+		double scale) {
+	struct wlr_fractional_scale_v1 *info =
+		fractional_scale_get_or_create(surface);
+	if (info == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	if (info->scale == scale) {
+		return;
+	}
+	info->scale = scale;
+
+	if (info->resource != NULL) {
+		wp_fractional_scale_v1_send_preferred_scale(info->resource,
+			scale_to_v120(scale));
+	}
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void manager_handle_get_fractional_scale(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+
+	struct wlr_addon *addon = wlr_addon_find(&surface->addons, NULL,
+		&fractional_scale_addon_impl);
+	if (addon != NULL) {
+		struct wlr_fractional_scale_v1 *info =
+			wl_container_of(addon, info, addon);
+		if (info->resource != NULL) {
+			wl_resource_post_error(resource,
+				WP_FRACTIONAL_SCALE_MANAGER_V1_ERROR_FRACTIONAL_SCALE_EXISTS,
+				"a fractional scale object for that surface already exists");
+			return;
+		}
+	}
+
+	struct wlr_fractional_scale_v1 *info =
+		fractional_scale_get_or_create(surface);
+	if (info == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	uint32_t version = wl_resource_get_version(resource);
+	info->resource = wl_resource_create(client,
+		&wp_fractional_scale_v1_interface, version, id);
+	if (info->resource == NULL) {
+		wl_client_post_no_memory(client);
+		fractional_scale_destroy(info);
+		return;
+	}
+	wl_resource_set_implementation(info->resource, &fractional_scale_impl,
+		info, fractional_scale_handle_resource_destroy);
+
+	if (info->scale != 0) {
+		wp_fractional_scale_v1_send_preferred_scale(info->resource,
+			scale_to_v120(info->scale));
+	}
+}
+
+static const struct wp_fractional_scale_manager_v1_interface manager_impl = {
+	.destroy = manager_handle_destroy,
+	.get_fractional_scale = manager_handle_get_fractional_scale,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_fractional_scale_manager_v1 *manager = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&wp_fractional_scale_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, manager, NULL);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_fractional_scale_manager_v1 *manager =
+		wl_container_of(listener, manager, display_destroy);
+	wlr_signal_emit_safe(&manager->events.destroy, NULL);
+	wl_list_remove(&manager->display_destroy.link);
+	wl_global_destroy(manager->global);
+	free(manager);
+}
+
+struct wlr_fractional_scale_manager_v1 *wlr_fractional_scale_manager_v1_create(
+		struct wl_display *display, uint32_t version) {
+	assert(version <= FRACTIONAL_SCALE_VERSION);
+
+	struct wlr_fractional_scale_manager_v1 *manager =
+		calloc(1, sizeof(*manager));
+	if (manager == NULL) {
+		return NULL;
+	}
+
+	manager->global = wl_global_create(display,
+		&wp_fractional_scale_manager_v1_interface, version, manager,
+		manager_bind);
+	if (manager->global == NULL) {
+		free(manager);
+		return NULL;
+	}
+
+	wl_signal_init(&manager->events.destroy);
+
+	manager->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &manager->display_destroy);
+
+	return manager;
+}
@@ -26,6 +26,9 @@ static void gamma_control_destroy(struct wlr_gamma_control_v1 *gamma_control) {
 	// Gamma LUT will be applied on next output commit
 	wlr_output_schedule_frame(gamma_control->output);
 
+	if (gamma_control->idle_apply != NULL) {
+		wl_event_source_remove(gamma_control->idle_apply);
+	}
 	wl_resource_set_user_data(gamma_control->resource, NULL);
 	wl_list_remove(&gamma_control->output_destroy_listener.link);
 	wl_list_remove(&gamma_control->output_commit_listener.link);
@@ -41,19 +44,40 @@ static void gamma_control_send_failed(
 }
 
 static void gamma_control_apply(struct wlr_gamma_control_v1 *gamma_control) {
+	struct wlr_output *output = gamma_control->output;
 	uint16_t *r = gamma_control->table;
 	uint16_t *g = gamma_control->table + gamma_control->ramp_size;
 	uint16_t *b = gamma_control->table + 2 * gamma_control->ramp_size;
 
-	wlr_output_set_gamma(gamma_control->output, gamma_control->ramp_size, r, g, b);
-	if (!wlr_output_test(gamma_control->output)) {
-		wlr_output_rollback(gamma_control->output);
+	// A ramp of the same size replacing one which has already been tested
+	// and is still pending doesn't need another test commit
+	bool tested = gamma_control->tested &&
+		gamma_control->tested_commit_seq == output->commit_seq &&
+		(output->pending.committed & WLR_OUTPUT_STATE_GAMMA_LUT) &&
+		output->pending.gamma_lut_size == gamma_control->ramp_size;
+
+	wlr_output_set_gamma(output, gamma_control->ramp_size, r, g, b);
+	if (tested) {
+		return;
+	}
+	if (!wlr_output_test(output)) {
+		wlr_output_rollback(output);
 		gamma_control_send_failed(gamma_control);
 		return;
 	}
+	gamma_control->tested = true;
+	gamma_control->tested_commit_seq = output->commit_seq;
 
 	// Gamma LUT will be applied on next output commit
-	wlr_output_schedule_frame(gamma_control->output);
+	wlr_output_schedule_frame(output);
+}
+
+static void gamma_control_handle_idle_apply(void *data) {
+	struct wlr_gamma_control_v1 *gamma_control = data;
+	gamma_control->idle_apply = NULL;
+	if (gamma_control->output->enabled) {
+		gamma_control_apply(gamma_control);
+	}
 }
 
 static const struct zwlr_gamma_control_v1_interface gamma_control_impl;
@@ -138,8 +162,16 @@ static void gamma_control_handle_set_gamma(struct wl_client *client,
 	gamma_control->table = table;
 	gamma_control->ramp_size = ramp_size;
 
-	if (gamma_control->output->enabled) {
-		gamma_control_apply(gamma_control);
+	// Only the latest ramp matters, e.g. during night light transitions
+	if (gamma_control->idle_apply == NULL) {
+		struct wl_event_loop *event_loop = wl_display_get_event_loop(
+			wl_client_get_display(client));
+		gamma_control->idle_apply = wl_event_loop_add_idle(event_loop,
+			gamma_control_handle_idle_apply, gamma_control);
+		if (gamma_control->idle_apply == NULL &&
+				gamma_control->output->enabled) {
+			gamma_control_apply(gamma_control);
+		}
 	}
 
 	return;
@@ -1,11 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_idle.h>
 #include <wlr/util/log.h>
 #include "idle-protocol.h"
 #include "util/signal.h"
+#include "util/time.h"
 
 static const struct org_kde_kwin_idle_timeout_interface idle_timeout_impl;
 
@@ -16,10 +19,15 @@ static struct wlr_idle_timeout *idle_timeout_from_resource(
 	return wl_resource_get_user_data(resource);
 }
 
-static int idle_notify(void *data) {
-	struct wlr_idle_timeout *timer = data;
+static int64_t get_current_time_msec64(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_msec(&now);
+}
+
+static void idle_notify(struct wlr_idle_timeout *timer) {
 	if (timer->idle_state) {
-		return 0;
+		return;
 	}
 	timer->idle_state = true;
 	wlr_signal_emit_safe(&timer->events.idle, timer);
@@ -27,7 +35,59 @@ static int idle_notify(void *data) {
 	if (timer->resource) {
 		org_kde_kwin_idle_timeout_send_idle(timer->resource);
 	}
-	return 1;
+}
+
+static void idle_arm(struct wlr_idle *idle, int64_t deadline, int64_t now) {
+	if (idle->armed_deadline_msec != 0 &&
+			idle->armed_deadline_msec <= deadline) {
+		// Fires early, handle_timer() will rearm
+		return;
+	}
+
+	int64_t delay = deadline - now;
+	if (delay < 1) {
+		delay = 1; // 0 would disarm the timer
+	}
+	wl_event_source_timer_update(idle->timer_source, delay);
+	idle->armed_deadline_msec = deadline;
+}
+
+static int handle_timer(void *data) {
+	struct wlr_idle *idle = data;
+	idle->armed_deadline_msec = 0;
+
+	// Activity doesn't rearm the timer, it only records a timestamp: check
+	// which timers really expired and rearm for the next deadline
+	int64_t now = get_current_time_msec64();
+	int64_t next_deadline = 0;
+	struct wlr_idle_timeout *timer, *tmp;
+	wl_list_for_each_safe(timer, tmp, &idle->idle_timers, link) {
+		if (!timer->enabled || timer->idle_state) {
+			continue;
+		}
+
+		int64_t deadline = timer->last_activity_msec + timer->timeout;
+		if (deadline <= now) {
+			// May destroy the timer
+			idle_notify(timer);
+		} else if (next_deadline == 0 || deadline < next_deadline) {
+			next_deadline = deadline;
+		}
+	}
+
+	if (next_deadline != 0) {
+		idle_arm(idle, next_deadline, now);
+	}
+	return 0;
+}
+
+static void timer_start(struct wlr_idle_timeout *timer, int64_t now) {
+	timer->last_activity_msec = now;
+	if (timer->timeout == 0) {
+		idle_notify(timer);
+		return;
+	}
+	idle_arm(timer->idle, now + timer->timeout, now);
 }
 
 static void handle_activity(struct wlr_idle_timeout *timer) {
@@ -35,6 +95,8 @@ static void handle_activity(struct wlr_idle_timeout *timer) {
 		return;
 	}
 
+	int64_t now = get_current_time_msec64();
+
 	// in case the previous state was sleeping send a resume event and switch state
 	if (timer->idle_state) {
 		timer->idle_state = false;
@@ -43,10 +105,13 @@ static void handle_activity(struct wlr_idle_timeout *timer) {
 		if (timer->resource) {
 			org_kde_kwin_idle_timeout_send_resumed(timer->resource);
 		}
+
+		timer_start(timer, now);
+		return;
 	}
 
-	// rearm the timer
-	wl_event_source_timer_update(timer->idle_source, timer->timeout);
+	// The deadline only moves later, the timer is armed already
+	timer->last_activity_msec = now;
 	if (timer->timeout == 0) {
 		idle_notify(timer);
 	}
@@ -109,6 +174,7 @@ static struct wlr_idle_timeout *create_timer(struct wlr_idle *idle,
 	}
 
 	timer->seat = seat;
+	timer->idle = idle;
 	timer->timeout = timeout;
 	timer->idle_state = false;
 	timer->enabled = idle->enabled;
@@ -123,16 +189,6 @@ static struct wlr_idle_timeout *create_timer(struct wlr_idle *idle,
 
 	timer->input_listener.notify = handle_input_notification;
 	wl_signal_add(&idle->events.activity_notify, &timer->input_listener);
-	// create the timer
-	timer->idle_source =
-		wl_event_loop_add_timer(idle->event_loop, idle_notify, timer);
-	if (timer->idle_source == NULL) {
-		wl_list_remove(&timer->link);
-		wl_list_remove(&timer->input_listener.link);
-		wl_list_remove(&timer->seat_destroy.link);
-		free(timer);
-		return NULL;
-	}
 
 	if (resource) {
 		timer->resource = resource;
@@ -140,11 +196,7 @@ static struct wlr_idle_timeout *create_timer(struct wlr_idle *idle,
 	}
 
 	if (timer->enabled) {
-		// arm the timer
-		wl_event_source_timer_update(timer->idle_source, timer->timeout);
-		if (timer->timeout == 0) {
-			idle_notify(timer);
-		}
+		timer_start(timer, get_current_time_msec64());
 	}
 
 	return timer;
@@ -185,14 +237,17 @@ void wlr_idle_set_enabled(struct wlr_idle *idle, struct wlr_seat *seat,
 		enabled ? "Enabling" : "Disabling",
 		seat ? seat->name : "all seats");
 	idle->enabled = enabled;
-	struct wlr_idle_timeout *timer;
-	wl_list_for_each(timer, &idle->idle_timers, link) {
+	int64_t now = get_current_time_msec64();
+	struct wlr_idle_timeout *timer, *tmp;
+	wl_list_for_each_safe(timer, tmp, &idle->idle_timers, link) {
 		if (seat != NULL && timer->seat != seat) {
 			continue;
 		}
-		int timeout = enabled ? timer->timeout : 0;
-		wl_event_source_timer_update(timer->idle_source, timeout);
+		// Disabled timers are skipped when the shared timer fires
 		timer->enabled = enabled;
+		if (enabled && !timer->idle_state) {
+			timer_start(timer, now);
+		}
 	}
 }
 
@@ -214,6 +269,7 @@ static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_idle *idle = wl_container_of(listener, idle, display_destroy);
 	wlr_signal_emit_safe(&idle->events.destroy, idle);
 	wl_list_remove(&idle->display_destroy.link);
+	wl_event_source_remove(idle->timer_source);
 	wl_global_destroy(idle->global);
 	free(idle);
 }
@@ -234,6 +290,13 @@ struct wlr_idle *wlr_idle_create(struct wl_display *display) {
 		return NULL;
 	}
 
+	idle->timer_source =
+		wl_event_loop_add_timer(idle->event_loop, handle_timer, idle);
+	if (idle->timer_source == NULL) {
+		free(idle);
+		return NULL;
+	}
+
 	idle->display_destroy.notify = handle_display_destroy;
 	wl_display_add_destroy_listener(display, &idle->display_destroy);
 
@@ -241,6 +304,7 @@ struct wlr_idle *wlr_idle_create(struct wl_display *display) {
 		1, idle, idle_bind);
 	if (idle->global == NULL) {
 		wl_list_remove(&idle->display_destroy.link);
+		wl_event_source_remove(idle->timer_source);
 		free(idle);
 		return NULL;
 	}
@@ -262,7 +326,6 @@ void wlr_idle_timeout_destroy(struct wlr_idle_timeout *timer) {
 
 	wl_list_remove(&timer->input_listener.link);
 	wl_list_remove(&timer->seat_destroy.link);
-	wl_event_source_remove(timer->idle_source);
 	wl_list_remove(&timer->link);
 
 	if (timer->resource) {
@@ -0,0 +1,239 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/types/wlr_input_latency.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+#include "types/wlr_input_latency.h"
+#include "util/signal.h"
+
+struct wlr_input_latency_output {
+	struct wlr_input_latency *latency;
+	struct wlr_output *output;
+	struct wl_list link; // wlr_input_latency.outputs
+
+	// Oldest input delivered since the last commit, 0 if none
+	uint64_t pending_usec;
+	// Oldest input delivered before the last tracked commit, 0 if none
+	uint64_t committed_usec;
+	uint32_t committed_seq;
+
+	struct wl_listener commit;
+	struct wl_listener present;
+	struct wl_listener destroy;
+};
+
+void wlr_latency_histogram_add(struct wlr_latency_histogram *hist,
+		uint64_t usec) {
+	size_t i = 0;
+	while (i + 1 < WLR_LATENCY_HISTOGRAM_BUCKETS && usec >> (i + 1) != 0) {
+		i++;
+	}
+	hist->buckets[i]++;
+
+	if (hist->count == 0 || usec < hist->min_usec) {
+		hist->min_usec = usec;
+	}
+	if (usec > hist->max_usec) {
+		hist->max_usec = usec;
+	}
+	hist->count++;
+	hist->sum_usec += usec;
+}
+
+void wlr_latency_histogram_reset(struct wlr_latency_histogram *hist) {
+	*hist = (struct wlr_latency_histogram){0};
+}
+
+uint64_t wlr_latency_histogram_get_percentile(
+		const struct wlr_latency_histogram *hist, double percentile) {
+	if (hist->count == 0) {
+		return 0;
+	}
+
+	uint64_t target = percentile * hist->count;
+	if (target >= hist->count) {
+		target = hist->count - 1;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < WLR_LATENCY_HISTOGRAM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen > target) {
+			uint64_t upper = ((uint64_t)1 << (i + 1)) - 1;
+			return upper < hist->max_usec ? upper : hist->max_usec;
+		}
+	}
+	return hist->max_usec;
+}
+
+static uint64_t timespec_to_usec(const struct timespec *ts) {
+	return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static void record_latency(struct wlr_latency_histogram *hist,
+		uint64_t start_usec, uint64_t end_usec) {
+	// Clocks may not match exactly, don't record bogus huge values
+	wlr_latency_histogram_add(hist,
+		end_usec > start_usec ? end_usec - start_usec : 0);
+}
+
+void input_latency_handle_delivery(struct wlr_input_latency *latency) {
+	if (latency->input_usec == 0) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record_latency(&latency->delivery, latency->input_usec,
+		timespec_to_usec(&now));
+
+	struct wlr_input_latency_output *l_output;
+	wl_list_for_each(l_output, &latency->outputs, link) {
+		if (l_output->pending_usec == 0) {
+			l_output->pending_usec = latency->input_usec;
+		}
+	}
+
+	latency->input_usec = 0;
+}
+
+void wlr_input_latency_notify_input(struct wlr_input_latency *latency,
+		uint64_t time_usec) {
+	// Only the latest input is tracked: an input which never reaches a
+	// client, e.g. because nothing is focused, must not skew later samples
+	latency->input_usec = time_usec;
+}
+
+static void output_destroy(struct wlr_input_latency_output *l_output) {
+	wl_list_remove(&l_output->link);
+	wl_list_remove(&l_output->commit.link);
+	wl_list_remove(&l_output->present.link);
+	wl_list_remove(&l_output->destroy.link);
+	free(l_output);
+}
+
+static void output_handle_commit(struct wl_listener *listener, void *data) {
+	struct wlr_input_latency_output *l_output =
+		wl_container_of(listener, l_output, commit);
+	const struct wlr_output_event_commit *event = data;
+
+	if (!(event->committed & WLR_OUTPUT_STATE_BUFFER) ||
+			l_output->pending_usec == 0 || l_output->committed_usec != 0) {
+		return;
+	}
+
+	l_output->committed_usec = l_output->pending_usec;
+	l_output->committed_seq = l_output->output->commit_seq;
+	l_output->pending_usec = 0;
+}
+
+static void output_handle_present(struct wl_listener *listener, void *data) {
+	struct wlr_input_latency_output *l_output =
+		wl_container_of(listener, l_output, present);
+	const struct wlr_output_event_present *event = data;
+
+	if (l_output->committed_usec == 0 ||
+			event->commit_seq != l_output->committed_seq) {
+		return;
+	}
+
+	if (event->presented && event->when != NULL) {
+		record_latency(&l_output->latency->presentation,
+			l_output->committed_usec, timespec_to_usec(event->when));
+	}
+	l_output->committed_usec = 0;
+}
+
+static void output_handle_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_input_latency_output *l_output =
+		wl_container_of(listener, l_output, destroy);
+	output_destroy(l_output);
+}
+
+static struct wlr_input_latency_output *get_output(
+		struct wlr_input_latency *latency, struct wlr_output *output) {
+	struct wlr_input_latency_output *l_output;
+	wl_list_for_each(l_output, &latency->outputs, link) {
+		if (l_output->output == output) {
+			return l_output;
+		}
+	}
+	return NULL;
+}
+
+void wlr_input_latency_add_output(struct wlr_input_latency *latency,
+		struct wlr_output *output) {
+	if (get_output(latency, output) != NULL) {
+		return;
+	}
+
+	struct wlr_input_latency_output *l_output = calloc(1, sizeof(*l_output));
+	if (l_output == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	l_output->latency = latency;
+	l_output->output = output;
+
+	l_output->commit.notify = output_handle_commit;
+	wl_signal_add(&output->events.commit, &l_output->commit);
+	l_output->present.notify = output_handle_present;
+	wl_signal_add(&output->events.present, &l_output->present);
+	l_output->destroy.notify = output_handle_destroy;
+	wl_signal_add(&output->events.destroy, &l_output->destroy);
+
+	wl_list_insert(&latency->outputs, &l_output->link);
+}
+
+void wlr_input_latency_remove_output(struct wlr_input_latency *latency,
+		struct wlr_output *output) {
+	struct wlr_input_latency_output *l_output = get_output(latency, output);
+	if (l_output != NULL) {
+		output_destroy(l_output);
+	}
+}
+
+static void handle_seat_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_input_latency *latency =
+		wl_container_of(listener, latency, seat_destroy);
+	wlr_input_latency_destroy(latency);
+}
+
+struct wlr_input_latency *wlr_input_latency_create(struct wlr_seat *seat) {
+	assert(seat->input_latency == NULL);
+
+	struct wlr_input_latency *latency = calloc(1, sizeof(*latency));
+	if (latency == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	latency->seat = seat;
+	wl_list_init(&latency->outputs);
+	wl_signal_init(&latency->events.destroy);
+
+	latency->seat_destroy.notify = handle_seat_destroy;
+	wl_signal_add(&seat->events.destroy, &latency->seat_destroy);
+
+	seat->input_latency = latency;
+	return latency;
+}
+
+void wlr_input_latency_destroy(struct wlr_input_latency *latency) {
+	if (latency == NULL) {
+		return;
+	}
+
+	wlr_signal_emit_safe(&latency->events.destroy, latency);
+
+	struct wlr_input_latency_output *l_output, *tmp;
+	wl_list_for_each_safe(l_output, tmp, &latency->outputs, link) {
+		output_destroy(l_output);
+	}
+
+	latency->seat->input_latency = NULL;
+	wl_list_remove(&latency->seat_destroy.link);
+	free(latency);
+}
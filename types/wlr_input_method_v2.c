@@ -3,7 +3,6 @@
 #endif
 #include <assert.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <wayland-util.h>
 #include <wlr/types/wlr_compositor.h>
@@ -11,7 +10,6 @@
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 #include "input-method-unstable-v2-protocol.h"
-#include "util/shm.h"
 #include "util/signal.h"
 
 static const struct zwp_input_method_v2_interface input_method_impl;
@@ -320,39 +318,25 @@ void wlr_input_method_keyboard_grab_v2_send_modifiers(
 static bool keyboard_grab_send_keymap(
 		struct wlr_input_method_keyboard_grab_v2 *keyboard_grab,
 		struct wlr_keyboard *keyboard) {
-	int keymap_fd = allocate_shm_file(keyboard->keymap_size);
-	if (keymap_fd < 0) {
-		wlr_log(WLR_ERROR, "creating a keymap file for %zu bytes failed",
-			keyboard->keymap_size);
+	if (keyboard->keymap_fd < 0) {
+		wlr_log(WLR_ERROR, "keyboard has no keymap file");
 		return false;
 	}
 
-	void *ptr = mmap(NULL, keyboard->keymap_size, PROT_READ | PROT_WRITE,
-		MAP_SHARED, keymap_fd, 0);
-	if (ptr == MAP_FAILED) {
-		wlr_log(WLR_ERROR, "failed to mmap() %zu bytes",
-			keyboard->keymap_size);
-		close(keymap_fd);
-		return false;
-	}
-
-	memcpy(ptr, keyboard->keymap_string, keyboard->keymap_size);
-	munmap(ptr, keyboard->keymap_size);
-
+	// The keymap file is read-only and shared by all clients
 	zwp_input_method_keyboard_grab_v2_send_keymap(keyboard_grab->resource,
-		WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keymap_fd,
+		WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keyboard->keymap_fd,
 		keyboard->keymap_size);
-
-	close(keymap_fd);
 	return true;
 }
 
 static void keyboard_grab_send_repeat_info(
 		struct wlr_input_method_keyboard_grab_v2 *keyboard_grab,
 		struct wlr_keyboard *keyboard) {
+	// A rate of zero disables client-side repeat
+	int32_t rate = keyboard->repeater != NULL ? 0 : keyboard->repeat_info.rate;
 	zwp_input_method_keyboard_grab_v2_send_repeat_info(
-		keyboard_grab->resource, keyboard->repeat_info.rate,
-		keyboard->repeat_info.delay);
+		keyboard_grab->resource, rate, keyboard->repeat_info.delay);
 }
 
 static void handle_keyboard_keymap(struct wl_listener *listener, void *data) {
@@ -390,8 +374,10 @@ void wlr_input_method_keyboard_grab_v2_set_keyboard(
 
 	if (keyboard) {
 		if (keyboard_grab->keyboard == NULL ||
+				(keyboard_grab->keyboard->keymap_string !=
+				keyboard->keymap_string &&
 				strcmp(keyboard_grab->keyboard->keymap_string,
-				keyboard->keymap_string) != 0) {
+				keyboard->keymap_string) != 0)) {
 			// send keymap only if it is changed, or if input method is not
 			// aware that it did not change and blindly send it back with
 			// virtual keyboard, it may cause an infinite recursion.
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,11 +9,143 @@
 #include <wlr/util/log.h>
 #include "interfaces/wlr_input_device.h"
 #include "types/wlr_keyboard.h"
-#include "util/array.h"
 #include "util/shm.h"
 #include "util/signal.h"
 #include "util/time.h"
 
+/**
+ * Keyboards using the same keymap share a single serialized copy of it, in a
+ * read-only shm file which is sent to all clients. This avoids serializing and
+ * copying the keymap again for each keyboard, e.g. for keyboard groups.
+ *
+ * Keymaps uploaded by clients keep their source text, so that uploading the
+ * same keymap again doesn't compile it again.
+ */
+struct wlr_keyboard_keymap_file {
+	struct xkb_keymap *keymap;
+	char *string;
+	size_t size;
+	uint64_t hash; // of string
+	int fd; // read-only
+	size_t n_refs;
+	struct wl_list link; // keymap_files
+
+	// if compiled by keyboard_set_keymap_from_string()
+	char *source;
+	size_t source_size;
+	uint64_t source_hash;
+};
+
+static struct wl_list keymap_files = { &keymap_files, &keymap_files };
+
+static uint64_t hash_keymap_string(const char *string, size_t size) {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ (unsigned char)string[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+static struct wlr_keyboard_keymap_file *keymap_file_create(
+		struct xkb_keymap *keymap, char *string, size_t size, uint64_t hash) {
+	struct wlr_keyboard_keymap_file *file = calloc(1, sizeof(*file));
+	if (file == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	int rw_fd = -1, ro_fd = -1;
+	if (!allocate_shm_file_pair(size, &rw_fd, &ro_fd)) {
+		wlr_log(WLR_ERROR, "Failed to allocate shm file for keymap");
+		free(file);
+		return NULL;
+	}
+
+	void *dst = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, rw_fd, 0);
+	if (dst == MAP_FAILED) {
+		wlr_log_errno(WLR_ERROR, "mmap failed");
+		close(rw_fd);
+		close(ro_fd);
+		free(file);
+		return NULL;
+	}
+
+	memcpy(dst, string, size);
+	munmap(dst, size);
+	close(rw_fd);
+
+	file->keymap = xkb_keymap_ref(keymap);
+	file->string = string;
+	file->size = size;
+	file->hash = hash;
+	file->fd = ro_fd;
+	file->n_refs = 1;
+	wl_list_insert(&keymap_files, &file->link);
+	return file;
+}
+
+static struct wlr_keyboard_keymap_file *keymap_file_get(
+		struct xkb_keymap *keymap) {
+	struct wlr_keyboard_keymap_file *file;
+	wl_list_for_each(file, &keymap_files, link) {
+		if (file->keymap == keymap) {
+			file->n_refs++;
+			return file;
+		}
+	}
+
+	char *string = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+	if (string == NULL) {
+		wlr_log(WLR_ERROR, "Failed to get string version of keymap");
+		return NULL;
+	}
+	size_t size = strlen(string) + 1;
+	uint64_t hash = hash_keymap_string(string, size);
+
+	// Separately compiled but identical keymaps can share the file as well
+	wl_list_for_each(file, &keymap_files, link) {
+		if (file->hash == hash && file->size == size &&
+				memcmp(file->string, string, size) == 0) {
+			free(string);
+			file->n_refs++;
+			return file;
+		}
+	}
+
+	file = keymap_file_create(keymap, string, size, hash);
+	if (file == NULL) {
+		free(string);
+	}
+	return file;
+}
+
+static void keymap_file_unref(struct wlr_keyboard_keymap_file *file) {
+	if (file == NULL) {
+		return;
+	}
+	assert(file->n_refs > 0);
+	file->n_refs--;
+	if (file->n_refs > 0) {
+		return;
+	}
+
+	wl_list_remove(&file->link);
+	close(file->fd);
+	free(file->string);
+	free(file->source);
+	xkb_keymap_unref(file->keymap);
+	free(file);
+}
+
+static void keyboard_clear_keymap_file(struct wlr_keyboard *kb) {
+	keymap_file_unref(kb->keymap_file);
+	kb->keymap_file = NULL;
+	kb->keymap_string = NULL;
+	kb->keymap_size = 0;
+	kb->keymap_fd = -1;
+}
+
 void keyboard_led_update(struct wlr_keyboard *keyboard) {
 	if (keyboard->xkb_state == NULL) {
 		return;
@@ -60,15 +193,56 @@ bool keyboard_modifier_update(struct wlr_keyboard *keyboard) {
 	return true;
 }
 
+static bool keyboard_find_keycode(struct wlr_keyboard *keyboard,
+		uint32_t keycode, size_t *index) {
+	if (keycode < WLR_KEYBOARD_BITMAP_KEYCODES) {
+		if (!(keyboard->pressed_keys[keycode / 32] & (1u << (keycode % 32)))) {
+			return false;
+		}
+		*index = keyboard->keycode_indexes[keycode];
+		return true;
+	}
+
+	for (size_t i = 0; i < keyboard->num_keycodes; i++) {
+		if (keyboard->keycodes[i] == keycode) {
+			*index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void keyboard_set_keycode(struct wlr_keyboard *keyboard, size_t index,
+		uint32_t keycode) {
+	keyboard->keycodes[index] = keycode;
+	if (keycode < WLR_KEYBOARD_BITMAP_KEYCODES) {
+		keyboard->pressed_keys[keycode / 32] |= 1u << (keycode % 32);
+		keyboard->keycode_indexes[keycode] = index;
+	}
+}
+
 void keyboard_key_update(struct wlr_keyboard *keyboard,
 		struct wlr_keyboard_key_event *event) {
-	if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-		set_add(keyboard->keycodes, &keyboard->num_keycodes,
-			WLR_KEYBOARD_KEYS_CAP, event->keycode);
+	uint32_t keycode = event->keycode;
+	size_t index;
+	bool pressed = keyboard_find_keycode(keyboard, keycode, &index);
+
+	if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED && !pressed &&
+			keyboard->num_keycodes < WLR_KEYBOARD_KEYS_CAP) {
+		keyboard_set_keycode(keyboard, keyboard->num_keycodes, keycode);
+		keyboard->num_keycodes++;
 	}
-	if (event->state == WL_KEYBOARD_KEY_STATE_RELEASED) {
-		set_remove(keyboard->keycodes, &keyboard->num_keycodes,
-			WLR_KEYBOARD_KEYS_CAP, event->keycode);
+	if (event->state == WL_KEYBOARD_KEY_STATE_RELEASED && pressed) {
+		if (keycode < WLR_KEYBOARD_BITMAP_KEYCODES) {
+			keyboard->pressed_keys[keycode / 32] &= ~(1u << (keycode % 32));
+		}
+		// Move the last pressed key into the hole, the order of keycodes
+		// doesn't matter
+		keyboard->num_keycodes--;
+		if (index < keyboard->num_keycodes) {
+			keyboard_set_keycode(keyboard, index,
+				keyboard->keycodes[keyboard->num_keycodes]);
+		}
 	}
 
 	assert(keyboard->num_keycodes <= WLR_KEYBOARD_KEYS_CAP);
@@ -91,9 +265,164 @@ void wlr_keyboard_notify_modifiers(struct wlr_keyboard *keyboard,
 	keyboard_led_update(keyboard);
 }
 
+static int64_t current_time_msec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_msec(&now);
+}
+
+static void repeater_schedule(struct wlr_keyboard_repeater *repeater) {
+	int64_t next = INT64_MAX;
+	struct wlr_keyboard *kb;
+	wl_list_for_each(kb, &repeater->keyboards, repeat_link) {
+		if (kb->repeating && kb->repeat_next_msec < next) {
+			next = kb->repeat_next_msec;
+		}
+	}
+
+	if (next == INT64_MAX) {
+		wl_event_source_timer_update(repeater->timer, 0);
+		return;
+	}
+
+	int64_t delay = next - current_time_msec();
+	if (delay < 1) {
+		delay = 1;
+	} else if (delay > INT32_MAX) {
+		delay = INT32_MAX;
+	}
+	wl_event_source_timer_update(repeater->timer, (int)delay);
+}
+
+static int repeater_handle_timer(void *data) {
+	struct wlr_keyboard_repeater *repeater = data;
+	int64_t now = current_time_msec();
+
+	struct wlr_keyboard *kb, *tmp;
+	wl_list_for_each_safe(kb, tmp, &repeater->keyboards, repeat_link) {
+		if (!kb->repeating || kb->repeat_next_msec > now) {
+			continue;
+		}
+		if (kb->repeat_info.rate <= 0) {
+			kb->repeating = false;
+			continue;
+		}
+
+		int64_t interval = 1000 / kb->repeat_info.rate;
+		if (interval < 1) {
+			interval = 1;
+		}
+		kb->repeat_next_msec += interval;
+		if (kb->repeat_next_msec <= now) {
+			// We're late, drop the missed repeats
+			kb->repeat_next_msec = now + interval;
+		}
+
+		struct wlr_keyboard_key_event event = {
+			.time_msec = (uint32_t)now,
+			.keycode = kb->repeat_keycode,
+			.update_state = false,
+			.state = WL_KEYBOARD_KEY_STATE_PRESSED,
+		};
+		wlr_signal_emit_safe(&kb->events.repeat, &event);
+	}
+
+	repeater_schedule(repeater);
+	return 0;
+}
+
+static void keyboard_update_repeat(struct wlr_keyboard *kb,
+		const struct wlr_keyboard_key_event *event) {
+	if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+		// Keys which don't repeat (e.g. modifiers) don't interrupt the
+		// repeat of the previously pressed key
+		if (kb->keymap == NULL || kb->repeat_info.rate <= 0 ||
+				!xkb_keymap_key_repeats(kb->keymap, event->keycode + 8)) {
+			return;
+		}
+		kb->repeating = true;
+		kb->repeat_keycode = event->keycode;
+		kb->repeat_next_msec = current_time_msec() + kb->repeat_info.delay;
+	} else if (kb->repeating && event->keycode == kb->repeat_keycode) {
+		kb->repeating = false;
+	} else {
+		return;
+	}
+
+	repeater_schedule(kb->repeater);
+}
+
+struct wlr_keyboard_repeater *wlr_keyboard_repeater_create(
+		struct wl_event_loop *loop) {
+	struct wlr_keyboard_repeater *repeater = calloc(1, sizeof(*repeater));
+	if (repeater == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	repeater->timer = wl_event_loop_add_timer(loop, repeater_handle_timer,
+		repeater);
+	if (repeater->timer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create key repeat timer");
+		free(repeater);
+		return NULL;
+	}
+
+	wl_list_init(&repeater->keyboards);
+	return repeater;
+}
+
+void wlr_keyboard_repeater_destroy(struct wlr_keyboard_repeater *repeater) {
+	if (repeater == NULL) {
+		return;
+	}
+
+	struct wlr_keyboard *kb, *tmp;
+	wl_list_for_each_safe(kb, tmp, &repeater->keyboards, repeat_link) {
+		wlr_keyboard_set_repeater(kb, NULL);
+	}
+
+	wl_event_source_remove(repeater->timer);
+	free(repeater);
+}
+
+static void keyboard_detach_repeater(struct wlr_keyboard *kb) {
+	struct wlr_keyboard_repeater *repeater = kb->repeater;
+	if (repeater == NULL) {
+		return;
+	}
+
+	wl_list_remove(&kb->repeat_link);
+	wl_list_init(&kb->repeat_link);
+	kb->repeater = NULL;
+	if (kb->repeating) {
+		kb->repeating = false;
+		repeater_schedule(repeater);
+	}
+}
+
+void wlr_keyboard_set_repeater(struct wlr_keyboard *kb,
+		struct wlr_keyboard_repeater *repeater) {
+	if (kb->repeater == repeater) {
+		return;
+	}
+
+	keyboard_detach_repeater(kb);
+	if (repeater != NULL) {
+		kb->repeater = repeater;
+		wl_list_insert(&repeater->keyboards, &kb->repeat_link);
+	}
+
+	// Let clients know whether they should repeat keys themselves
+	wlr_signal_emit_safe(&kb->events.repeat_info, kb);
+}
+
 void wlr_keyboard_notify_key(struct wlr_keyboard *keyboard,
 		struct wlr_keyboard_key_event *event) {
 	keyboard_key_update(keyboard, event);
+	if (keyboard->repeater != NULL) {
+		keyboard_update_repeat(keyboard, event);
+	}
 	wlr_signal_emit_safe(&keyboard->events.key, event);
 
 	if (keyboard->xkb_state == NULL) {
@@ -125,8 +454,10 @@ void wlr_keyboard_init(struct wlr_keyboard *kb,
 	wl_signal_init(&kb->events.modifiers);
 	wl_signal_init(&kb->events.keymap);
 	wl_signal_init(&kb->events.repeat_info);
+	wl_signal_init(&kb->events.repeat);
 
 	kb->keymap_fd = -1;
+	wl_list_init(&kb->repeat_link);
 
 	// Sane defaults
 	kb->repeat_info.rate = 25;
@@ -147,15 +478,13 @@ void wlr_keyboard_finish(struct wlr_keyboard *kb) {
 		wlr_keyboard_notify_key(kb, &event);  // updates num_keycodes
 	}
 
+	keyboard_detach_repeater(kb);
 	wlr_input_device_finish(&kb->base);
 
 	/* Finish xkbcommon resources */
 	xkb_state_unref(kb->xkb_state);
 	xkb_keymap_unref(kb->keymap);
-	free(kb->keymap_string);
-	if (kb->keymap_fd >= 0) {
-		close(kb->keymap_fd);
-	}
+	keyboard_clear_keymap_file(kb);
 }
 
 void wlr_keyboard_led_update(struct wlr_keyboard *kb, uint32_t leds) {
@@ -200,39 +529,15 @@ bool wlr_keyboard_set_keymap(struct wlr_keyboard *kb,
 		kb->mod_indexes[i] = xkb_map_mod_get_index(kb->keymap, mod_names[i]);
 	}
 
-	char *tmp_keymap_string = xkb_keymap_get_as_string(kb->keymap,
-		XKB_KEYMAP_FORMAT_TEXT_V1);
-	if (tmp_keymap_string == NULL) {
-		wlr_log(WLR_ERROR, "Failed to get string version of keymap");
+	struct wlr_keyboard_keymap_file *keymap_file = keymap_file_get(kb->keymap);
+	if (keymap_file == NULL) {
 		goto err;
 	}
-	free(kb->keymap_string);
-	kb->keymap_string = tmp_keymap_string;
-	kb->keymap_size = strlen(kb->keymap_string) + 1;
-
-	int rw_fd = -1, ro_fd = -1;
-	if (!allocate_shm_file_pair(kb->keymap_size, &rw_fd, &ro_fd)) {
-		wlr_log(WLR_ERROR, "Failed to allocate shm file for keymap");
-		goto err;
-	}
-
-	void *dst = mmap(NULL, kb->keymap_size, PROT_READ | PROT_WRITE,
-		MAP_SHARED, rw_fd, 0);
-	if (dst == MAP_FAILED) {
-		wlr_log_errno(WLR_ERROR, "mmap failed");
-		close(rw_fd);
-		close(ro_fd);
-		goto err;
-	}
-
-	memcpy(dst, kb->keymap_string, kb->keymap_size);
-	munmap(dst, kb->keymap_size);
-	close(rw_fd);
-
-	if (kb->keymap_fd >= 0) {
-		close(kb->keymap_fd);
-	}
-	kb->keymap_fd = ro_fd;
+	keymap_file_unref(kb->keymap_file);
+	kb->keymap_file = keymap_file;
+	kb->keymap_string = keymap_file->string;
+	kb->keymap_size = keymap_file->size;
+	kb->keymap_fd = keymap_file->fd;
 
 	for (size_t i = 0; i < kb->num_keycodes; ++i) {
 		xkb_keycode_t keycode = kb->keycodes[i] + 8;
@@ -249,8 +554,7 @@ err:
 	kb->xkb_state = NULL;
 	xkb_keymap_unref(keymap);
 	kb->keymap = NULL;
-	free(kb->keymap_string);
-	kb->keymap_string = NULL;
+	keyboard_clear_keymap_file(kb);
 	return false;
 }
 
@@ -276,6 +580,71 @@ uint32_t wlr_keyboard_get_modifiers(struct wlr_keyboard *kb) {
 	return modifiers;
 }
 
+bool keyboard_set_keymap_from_string(struct wlr_keyboard *kb,
+		const char *source, size_t size) {
+	// Clients usually upload the keymap with a NUL terminator, or even
+	// padding, which isn't part of the text
+	size = strnlen(source, size);
+	uint64_t hash = hash_keymap_string(source, size);
+
+	struct wlr_keyboard_keymap_file *file;
+	wl_list_for_each(file, &keymap_files, link) {
+		if (file->source != NULL && file->source_hash == hash &&
+				file->source_size == size &&
+				memcmp(file->source, source, size) == 0) {
+			return wlr_keyboard_set_keymap(kb, file->keymap);
+		}
+	}
+
+	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	if (context == NULL) {
+		return false;
+	}
+	struct xkb_keymap *keymap = xkb_keymap_new_from_buffer(context, source,
+		size, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	xkb_context_unref(context);
+	if (keymap == NULL) {
+		return false;
+	}
+
+	bool ok = wlr_keyboard_set_keymap(kb, keymap);
+	xkb_keymap_unref(keymap);
+	if (!ok) {
+		return false;
+	}
+
+	file = kb->keymap_file;
+	if (file->source == NULL) {
+		file->source = malloc(size);
+		if (file->source != NULL) {
+			memcpy(file->source, source, size);
+			file->source_size = size;
+			file->source_hash = hash;
+		}
+	}
+	return true;
+}
+
+bool keyboard_keymaps_match(struct wlr_keyboard *kb1,
+		struct wlr_keyboard *kb2) {
+	// Identical keymaps share their file
+	if (kb1->keymap_file != NULL && kb2->keymap_file != NULL) {
+		return kb1->keymap_file == kb2->keymap_file;
+	}
+	return wlr_keyboard_keymaps_match(kb1->keymap, kb2->keymap);
+}
+
+static struct wlr_keyboard_keymap_file *keymap_file_find(
+		struct xkb_keymap *keymap) {
+	struct wlr_keyboard_keymap_file *file;
+	wl_list_for_each(file, &keymap_files, link) {
+		if (file->keymap == keymap) {
+			return file;
+		}
+	}
+	return NULL;
+}
+
 bool wlr_keyboard_keymaps_match(struct xkb_keymap *km1,
 		struct xkb_keymap *km2) {
 	if (!km1 && !km2) {
@@ -284,6 +653,14 @@ bool wlr_keyboard_keymaps_match(struct xkb_keymap *km1,
 	if (!km1 || !km2) {
 		return false;
 	}
+	if (km1 == km2) {
+		return true;
+	}
+	struct wlr_keyboard_keymap_file *file1 = keymap_file_find(km1);
+	struct wlr_keyboard_keymap_file *file2 = keymap_file_find(km2);
+	if (file1 != NULL && file2 != NULL) {
+		return file1 == file2;
+	}
 	char *km1_str = xkb_keymap_get_as_string(km1, XKB_KEYMAP_FORMAT_TEXT_V1);
 	char *km2_str = xkb_keymap_get_as_string(km2, XKB_KEYMAP_FORMAT_TEXT_V1);
 	bool result = strcmp(km1_str, km2_str) == 0;
@@ -72,6 +72,19 @@ static bool process_key(struct keyboard_group_device *group_device,
 		struct wlr_keyboard_key_event *event) {
 	struct wlr_keyboard_group *group = group_device->keyboard->group;
 
+	if (event->keycode < WLR_KEYBOARD_BITMAP_KEYCODES) {
+		size_t *count = &group->key_counts[event->keycode];
+		if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+			(*count)++;
+			return *count == 1;
+		}
+		// Releases of keys which aren't pressed are passed on as well
+		if (*count > 0) {
+			(*count)--;
+		}
+		return *count == 0;
+	}
+
 	struct keyboard_group_key *key, *tmp;
 	wl_list_for_each_safe(key, tmp, &group->keys, link) {
 		if (key->keycode != event->keycode) {
@@ -144,12 +157,10 @@ static void handle_keyboard_keymap(struct wl_listener *listener, void *data) {
 		wl_container_of(listener, group_device, keymap);
 	struct wlr_keyboard *keyboard = group_device->keyboard;
 
-	if (!wlr_keyboard_keymaps_match(keyboard->group->keyboard.keymap,
-				keyboard->keymap)) {
+	if (!keyboard_keymaps_match(&keyboard->group->keyboard, keyboard)) {
 		struct keyboard_group_device *device;
 		wl_list_for_each(device, &keyboard->group->devices, link) {
-			if (!wlr_keyboard_keymaps_match(keyboard->keymap,
-						device->keyboard->keymap)) {
+			if (!keyboard_keymaps_match(keyboard, device->keyboard)) {
 				wlr_keyboard_set_keymap(device->keyboard, keyboard->keymap);
 				return;
 			}
@@ -251,7 +262,7 @@ bool wlr_keyboard_group_add_keyboard(struct wlr_keyboard_group *group,
 		return false;
 	}
 
-	if (!wlr_keyboard_keymaps_match(group->keyboard.keymap, keyboard->keymap)) {
+	if (!keyboard_keymaps_match(&group->keyboard, keyboard)) {
 		wlr_log(WLR_ERROR, "Device keymap does not match keyboard group's");
 		return false;
 	}
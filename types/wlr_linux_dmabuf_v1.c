@@ -2,12 +2,16 @@
 #include <assert.h>
 #include <drm_fourcc.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <wlr/backend.h>
+#include <wlr/backend/drm.h>
 #include <wlr/interfaces/wlr_buffer.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_output.h>
 #include <wlr/util/log.h>
 #include "linux-dmabuf-unstable-v1-protocol.h"
 #include "render/drm_format_set.h"
@@ -29,10 +33,25 @@ struct wlr_linux_dmabuf_feedback_v1_compiled_tranche {
 	struct wl_array indices; // uint16_t
 };
 
+// Format tables are shared by all compiled feedbacks with the same formats
+struct wlr_linux_dmabuf_feedback_v1_table {
+	struct wl_list link; // wlr_linux_dmabuf_v1.feedback_tables
+	size_t n_refs;
+	uint64_t hash;
+
+	struct wl_array entries; // struct wlr_linux_dmabuf_feedback_v1_table_entry
+	int fd; // read-only
+};
+
+// Compiled feedbacks are shared by the default feedback and all surfaces with
+// the same feedback
 struct wlr_linux_dmabuf_feedback_v1_compiled {
+	struct wl_list link; // wlr_linux_dmabuf_v1.compiled_feedbacks
+	size_t n_refs;
+	uint64_t hash;
+
 	dev_t main_device;
-	int table_fd;
-	size_t table_size;
+	struct wlr_linux_dmabuf_feedback_v1_table *table;
 
 	size_t tranches_len;
 	struct wlr_linux_dmabuf_feedback_v1_compiled_tranche tranches[];
@@ -352,6 +371,11 @@ static void params_create_common(struct wl_resource *params_resource,
 
 	buffer->attributes = attribs;
 
+	if (linux_dmabuf->scanout_backend != NULL) {
+		wlr_drm_backend_check_buffer_scanout(linux_dmabuf->scanout_backend,
+			&buffer->base);
+	}
+
 	buffer->release.notify = buffer_handle_release;
 	wl_signal_add(&buffer->base.events.release, &buffer->release);
 
@@ -490,7 +514,143 @@ static ssize_t get_drm_format_set_index(const struct wlr_drm_format_set *set,
 	return -1;
 }
 
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+	// FNV-1a
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+#define HASH_INIT 0xcbf29ce484222325
+
+static void feedback_table_unref(struct wlr_linux_dmabuf_feedback_v1_table *table) {
+	assert(table->n_refs > 0);
+	table->n_refs--;
+	if (table->n_refs > 0) {
+		return;
+	}
+	wl_list_remove(&table->link);
+	wl_array_release(&table->entries);
+	close(table->fd);
+	free(table);
+}
+
+/**
+ * Get a format table with the given entries, taking ownership of the array.
+ */
+static struct wlr_linux_dmabuf_feedback_v1_table *feedback_table_get_or_create(
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf, struct wl_array *entries) {
+	uint64_t hash = hash_bytes(HASH_INIT, entries->data, entries->size);
+
+	struct wlr_linux_dmabuf_feedback_v1_table *table;
+	wl_list_for_each(table, &linux_dmabuf->feedback_tables, link) {
+		if (table->hash == hash && table->entries.size == entries->size &&
+				memcmp(table->entries.data, entries->data, entries->size) == 0) {
+			wl_array_release(entries);
+			table->n_refs++;
+			return table;
+		}
+	}
+
+	int rw_fd, ro_fd;
+	if (!allocate_shm_file_pair(entries->size, &rw_fd, &ro_fd)) {
+		wlr_log(WLR_ERROR, "Failed to allocate shm file for format table");
+		goto error_entries;
+	}
+
+	void *data = mmap(NULL, entries->size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, rw_fd, 0);
+	close(rw_fd);
+	if (data == MAP_FAILED) {
+		wlr_log_errno(WLR_ERROR, "mmap failed");
+		close(ro_fd);
+		goto error_entries;
+	}
+	memcpy(data, entries->data, entries->size);
+	munmap(data, entries->size);
+
+	table = calloc(1, sizeof(*table));
+	if (table == NULL) {
+		close(ro_fd);
+		goto error_entries;
+	}
+	table->n_refs = 1;
+	table->hash = hash;
+	table->entries = *entries;
+	table->fd = ro_fd;
+	wl_list_insert(&linux_dmabuf->feedback_tables, &table->link);
+	return table;
+
+error_entries:
+	wl_array_release(entries);
+	return NULL;
+}
+
+static void compiled_feedback_unref(
+		struct wlr_linux_dmabuf_feedback_v1_compiled *feedback) {
+	if (feedback == NULL) {
+		return;
+	}
+	assert(feedback->n_refs > 0);
+	feedback->n_refs--;
+	if (feedback->n_refs > 0) {
+		return;
+	}
+	wl_list_remove(&feedback->link);
+	for (size_t i = 0; i < feedback->tranches_len; i++) {
+		wl_array_release(&feedback->tranches[i].indices);
+	}
+	feedback_table_unref(feedback->table);
+	free(feedback);
+}
+
+static uint64_t compiled_feedback_hash(
+		const struct wlr_linux_dmabuf_feedback_v1_compiled *feedback) {
+	uint64_t hash = hash_bytes(HASH_INIT, &feedback->main_device,
+		sizeof(feedback->main_device));
+	hash = hash_bytes(hash, &feedback->table, sizeof(feedback->table));
+	for (size_t i = 0; i < feedback->tranches_len; i++) {
+		const struct wlr_linux_dmabuf_feedback_v1_compiled_tranche *tranche =
+			&feedback->tranches[i];
+		hash = hash_bytes(hash, &tranche->target_device,
+			sizeof(tranche->target_device));
+		hash = hash_bytes(hash, &tranche->flags, sizeof(tranche->flags));
+		hash = hash_bytes(hash, tranche->indices.data, tranche->indices.size);
+	}
+	return hash;
+}
+
+static bool compiled_feedback_equal(
+		const struct wlr_linux_dmabuf_feedback_v1_compiled *a,
+		const struct wlr_linux_dmabuf_feedback_v1_compiled *b) {
+	if (a->hash != b->hash || a->main_device != b->main_device ||
+			a->table != b->table || a->tranches_len != b->tranches_len) {
+		return false;
+	}
+	for (size_t i = 0; i < a->tranches_len; i++) {
+		const struct wlr_linux_dmabuf_feedback_v1_compiled_tranche *ta =
+			&a->tranches[i];
+		const struct wlr_linux_dmabuf_feedback_v1_compiled_tranche *tb =
+			&b->tranches[i];
+		if (ta->target_device != tb->target_device ||
+				ta->flags != tb->flags ||
+				ta->indices.size != tb->indices.size ||
+				memcmp(ta->indices.data, tb->indices.data,
+					ta->indices.size) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Compile a feedback, or get a reference to an identical compiled feedback.
+ */
 static struct wlr_linux_dmabuf_feedback_v1_compiled *feedback_compile(
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf,
 		const struct wlr_linux_dmabuf_feedback_v1 *feedback) {
 	assert(feedback->tranches_len > 0);
 
@@ -506,25 +666,15 @@ static struct wlr_linux_dmabuf_feedback_v1_compiled *feedback_compile(
 	}
 	assert(table_len > 0);
 
-	size_t table_size =
-		table_len * sizeof(struct wlr_linux_dmabuf_feedback_v1_table_entry);
-	int rw_fd, ro_fd;
-	if (!allocate_shm_file_pair(table_size, &rw_fd, &ro_fd)) {
-		wlr_log(WLR_ERROR, "Failed to allocate shm file for format table");
-		return NULL;
-	}
-
-	struct wlr_linux_dmabuf_feedback_v1_table_entry *table =
-		mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, rw_fd, 0);
-	if (table == MAP_FAILED) {
-		wlr_log_errno(WLR_ERROR, "mmap failed");
-		close(rw_fd);
-		close(ro_fd);
+	struct wl_array entries;
+	wl_array_init(&entries);
+	struct wlr_linux_dmabuf_feedback_v1_table_entry *table = wl_array_add(
+		&entries, table_len * sizeof(struct wlr_linux_dmabuf_feedback_v1_table_entry));
+	if (table == NULL) {
+		wlr_log(WLR_ERROR, "Failed to allocate format table");
 		return NULL;
 	}
 
-	close(rw_fd);
-
 	size_t n = 0;
 	for (size_t i = 0; i < fallback_tranche->formats->len; i++) {
 		const struct wlr_drm_format *fmt = fallback_tranche->formats->formats[i];
@@ -539,20 +689,27 @@ static struct wlr_linux_dmabuf_feedback_v1_compiled *feedback_compile(
 	}
 	assert(n == table_len);
 
-	munmap(table, table_size);
-
 	struct wlr_linux_dmabuf_feedback_v1_compiled *compiled = calloc(1,
 		sizeof(struct wlr_linux_dmabuf_feedback_v1_compiled) +
 		feedback->tranches_len * sizeof(struct wlr_linux_dmabuf_feedback_v1_compiled_tranche));
 	if (compiled == NULL) {
-		close(ro_fd);
+		wl_array_release(&entries);
 		return NULL;
 	}
 
+	compiled->n_refs = 1;
 	compiled->main_device = feedback->main_device;
 	compiled->tranches_len = feedback->tranches_len;
-	compiled->table_fd = ro_fd;
-	compiled->table_size = table_size;
+	wl_list_init(&compiled->link);
+	for (size_t i = 0; i < compiled->tranches_len; i++) {
+		wl_array_init(&compiled->tranches[i].indices);
+	}
+
+	compiled->table = feedback_table_get_or_create(linux_dmabuf, &entries);
+	if (compiled->table == NULL) {
+		free(compiled);
+		return NULL;
+	}
 
 	// Build the indices lists for all but the last (fallback) tranches
 	for (size_t i = 0; i < feedback->tranches_len - 1; i++) {
@@ -564,7 +721,6 @@ static struct wlr_linux_dmabuf_feedback_v1_compiled *feedback_compile(
 		compiled_tranche->target_device = tranche->target_device;
 		compiled_tranche->flags = tranche->flags;
 
-		wl_array_init(&compiled_tranche->indices);
 		if (!wl_array_add(&compiled_tranche->indices, table_len * sizeof(uint16_t))) {
 			wlr_log(WLR_ERROR, "Failed to allocate tranche indices array");
 			goto error_compiled;
@@ -597,7 +753,6 @@ static struct wlr_linux_dmabuf_feedback_v1_compiled *feedback_compile(
 	fallback_compiled_tranche->flags = fallback_tranche->flags;
 
 	// Build the indices list for the last (fallback) tranche
-	wl_array_init(&fallback_compiled_tranche->indices);
 	if (!wl_array_add(&fallback_compiled_tranche->indices,
 			table_len * sizeof(uint16_t))) {
 		wlr_log(WLR_ERROR, "Failed to allocate fallback tranche indices array");
@@ -611,26 +766,25 @@ static struct wlr_linux_dmabuf_feedback_v1_compiled *feedback_compile(
 		n++;
 	}
 
+	compiled->hash = compiled_feedback_hash(compiled);
+
+	struct wlr_linux_dmabuf_feedback_v1_compiled *existing;
+	wl_list_for_each(existing, &linux_dmabuf->compiled_feedbacks, link) {
+		if (compiled_feedback_equal(existing, compiled)) {
+			existing->n_refs++;
+			compiled_feedback_unref(compiled);
+			return existing;
+		}
+	}
+
+	wl_list_insert(&linux_dmabuf->compiled_feedbacks, &compiled->link);
 	return compiled;
 
 error_compiled:
-	close(compiled->table_fd);
-	free(compiled);
+	compiled_feedback_unref(compiled);
 	return NULL;
 }
 
-static void compiled_feedback_destroy(
-		struct wlr_linux_dmabuf_feedback_v1_compiled *feedback) {
-	if (feedback == NULL) {
-		return;
-	}
-	for (size_t i = 0; i < feedback->tranches_len; i++) {
-		wl_array_release(&feedback->tranches[i].indices);
-	}
-	close(feedback->table_fd);
-	free(feedback);
-}
-
 static bool feedback_tranche_init_with_renderer(
 		struct wlr_linux_dmabuf_feedback_v1_tranche *tranche,
 		struct wlr_renderer *renderer) {
@@ -659,19 +813,37 @@ static bool feedback_tranche_init_with_renderer(
 }
 
 static struct wlr_linux_dmabuf_feedback_v1_compiled *compile_default_feedback(
-		struct wlr_renderer *renderer) {
-	struct wlr_linux_dmabuf_feedback_v1_tranche tranche = {0};
-	if (!feedback_tranche_init_with_renderer(&tranche, renderer)) {
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf) {
+	struct wlr_linux_dmabuf_feedback_v1_tranche render_tranche = {0};
+	if (!feedback_tranche_init_with_renderer(&render_tranche,
+			linux_dmabuf->renderer)) {
 		return NULL;
 	}
 
+	// Advertise compressed or tiled buffers first, they save memory
+	// bandwidth when the compositor samples from them
+	struct wlr_drm_format_set preferred_formats = {0};
+	struct wlr_linux_dmabuf_feedback_v1_tranche tranches[2];
+	size_t tranches_len = 0;
+	if (wlr_drm_format_set_pick_preferred(&preferred_formats,
+			render_tranche.formats)) {
+		tranches[tranches_len++] = (struct wlr_linux_dmabuf_feedback_v1_tranche){
+			.target_device = render_tranche.target_device,
+			.formats = &preferred_formats,
+		};
+	}
+	tranches[tranches_len++] = render_tranche;
+
 	const struct wlr_linux_dmabuf_feedback_v1 feedback = {
-		.main_device = tranche.target_device,
-		.tranches = &tranche,
-		.tranches_len = 1,
+		.main_device = render_tranche.target_device,
+		.tranches = tranches,
+		.tranches_len = tranches_len,
 	};
 
-	return feedback_compile(&feedback);
+	struct wlr_linux_dmabuf_feedback_v1_compiled *compiled =
+		feedback_compile(linux_dmabuf, &feedback);
+	wlr_drm_format_set_finish(&preferred_formats);
+	return compiled;
 }
 
 static void feedback_tranche_send(
@@ -697,7 +869,7 @@ static void feedback_send(const struct wlr_linux_dmabuf_feedback_v1_compiled *fe
 	zwp_linux_dmabuf_feedback_v1_send_main_device(resource, &dev_array);
 
 	zwp_linux_dmabuf_feedback_v1_send_format_table(resource,
-		feedback->table_fd, feedback->table_size);
+		feedback->table->fd, feedback->table->entries.size);
 
 	for (size_t i = 0; i < feedback->tranches_len; i++) {
 		feedback_tranche_send(&feedback->tranches[i], resource);
@@ -732,7 +904,7 @@ static void surface_destroy(struct wlr_linux_dmabuf_v1_surface *surface) {
 		wl_list_init(link);
 	}
 
-	compiled_feedback_destroy(surface->feedback);
+	compiled_feedback_unref(surface->feedback);
 
 	wlr_addon_finish(&surface->addon);
 	wl_list_remove(&surface->link);
@@ -894,10 +1066,13 @@ static void linux_dmabuf_v1_destroy(struct wlr_linux_dmabuf_v1 *linux_dmabuf) {
 		surface_destroy(surface);
 	}
 
-	compiled_feedback_destroy(linux_dmabuf->default_feedback);
+	compiled_feedback_unref(linux_dmabuf->default_feedback);
+	assert(wl_list_empty(&linux_dmabuf->compiled_feedbacks));
+	assert(wl_list_empty(&linux_dmabuf->feedback_tables));
 
 	wl_list_remove(&linux_dmabuf->display_destroy.link);
 	wl_list_remove(&linux_dmabuf->renderer_destroy.link);
+	wl_list_remove(&linux_dmabuf->scanout_backend_destroy.link);
 
 	wl_global_destroy(linux_dmabuf->global);
 	free(linux_dmabuf);
@@ -926,6 +1101,9 @@ struct wlr_linux_dmabuf_v1 *wlr_linux_dmabuf_v1_create(struct wl_display *displa
 	linux_dmabuf->renderer = renderer;
 
 	wl_list_init(&linux_dmabuf->surfaces);
+	wl_list_init(&linux_dmabuf->compiled_feedbacks);
+	wl_list_init(&linux_dmabuf->feedback_tables);
+	wl_list_init(&linux_dmabuf->scanout_backend_destroy.link);
 	wl_signal_init(&linux_dmabuf->events.destroy);
 
 	linux_dmabuf->global =
@@ -937,7 +1115,7 @@ struct wlr_linux_dmabuf_v1 *wlr_linux_dmabuf_v1_create(struct wl_display *displa
 		return NULL;
 	}
 
-	linux_dmabuf->default_feedback = compile_default_feedback(renderer);
+	linux_dmabuf->default_feedback = compile_default_feedback(linux_dmabuf);
 	if (linux_dmabuf->default_feedback == NULL) {
 		wlr_log(WLR_ERROR, "Failed to init default linux-dmabuf feedback");
 		wl_global_destroy(linux_dmabuf->global);
@@ -966,13 +1144,20 @@ bool wlr_linux_dmabuf_v1_set_surface_feedback(
 
 	struct wlr_linux_dmabuf_feedback_v1_compiled *compiled = NULL;
 	if (feedback != NULL) {
-		compiled = feedback_compile(feedback);
+		compiled = feedback_compile(linux_dmabuf, feedback);
 		if (compiled == NULL) {
 			return false;
 		}
 	}
 
-	compiled_feedback_destroy(surface->feedback);
+	if (compiled == surface->feedback) {
+		// Identical feedbacks share the same compiled feedback, there's
+		// nothing new to send
+		compiled_feedback_unref(compiled);
+		return true;
+	}
+
+	compiled_feedback_unref(surface->feedback);
 	surface->feedback = compiled;
 
 	struct wl_resource *resource;
@@ -982,3 +1167,100 @@ bool wlr_linux_dmabuf_v1_set_surface_feedback(
 
 	return true;
 }
+
+bool wlr_linux_dmabuf_v1_set_surface_scanout_feedback(
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf, struct wlr_surface *surface,
+		struct wlr_output *output) {
+	if (output == NULL) {
+		return wlr_linux_dmabuf_v1_set_surface_feedback(linux_dmabuf,
+			surface, NULL);
+	}
+
+	struct wlr_linux_dmabuf_feedback_v1_tranche render_tranche;
+	if (!feedback_tranche_init_with_renderer(&render_tranche,
+			linux_dmabuf->renderer)) {
+		return false;
+	}
+
+	// Scanning out buffers allocated on another device isn't supported
+	int backend_drm_fd = wlr_backend_get_drm_fd(output->backend);
+	struct stat stat;
+	if (backend_drm_fd < 0 || fstat(backend_drm_fd, &stat) != 0 ||
+			stat.st_rdev != render_tranche.target_device) {
+		return wlr_linux_dmabuf_v1_set_surface_feedback(linux_dmabuf,
+			surface, NULL);
+	}
+
+	const struct wlr_drm_format_set *primary_formats =
+		wlr_output_get_primary_formats(output, WLR_BUFFER_CAP_DMABUF);
+	if (primary_formats == NULL) {
+		return wlr_linux_dmabuf_v1_set_surface_feedback(linux_dmabuf,
+			surface, NULL);
+	}
+
+	// Buffers must still be importable in case the compositor needs to
+	// composite them
+	struct wlr_drm_format_set scanout_formats = {0};
+	if (!wlr_drm_format_set_intersect(&scanout_formats, primary_formats,
+			render_tranche.formats)) {
+		wlr_drm_format_set_finish(&scanout_formats);
+		return wlr_linux_dmabuf_v1_set_surface_feedback(linux_dmabuf,
+			surface, NULL);
+	}
+
+	// Tranches are sent by order of preference: compressed or tiled buffers
+	// which can be scanned out save the most memory bandwidth
+	struct wlr_drm_format_set preferred_formats = {0};
+	bool has_preferred = wlr_drm_format_set_pick_preferred(&preferred_formats,
+		&scanout_formats);
+
+	struct wlr_linux_dmabuf_feedback_v1_tranche tranches[3];
+	size_t tranches_len = 0;
+	if (has_preferred) {
+		tranches[tranches_len++] = (struct wlr_linux_dmabuf_feedback_v1_tranche){
+			.target_device = stat.st_rdev,
+			.flags = ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT,
+			.formats = &preferred_formats,
+		};
+	}
+	tranches[tranches_len++] = (struct wlr_linux_dmabuf_feedback_v1_tranche){
+		.target_device = stat.st_rdev,
+		.flags = ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT,
+		.formats = &scanout_formats,
+	};
+	tranches[tranches_len++] = render_tranche;
+
+	const struct wlr_linux_dmabuf_feedback_v1 feedback = {
+		.main_device = render_tranche.target_device,
+		.tranches = tranches,
+		.tranches_len = tranches_len,
+	};
+	bool ok = wlr_linux_dmabuf_v1_set_surface_feedback(linux_dmabuf,
+		surface, &feedback);
+	wlr_drm_format_set_finish(&preferred_formats);
+	wlr_drm_format_set_finish(&scanout_formats);
+	return ok;
+}
+
+static void handle_scanout_backend_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_dmabuf_v1 *linux_dmabuf =
+		wl_container_of(listener, linux_dmabuf, scanout_backend_destroy);
+	wlr_linux_dmabuf_v1_set_scanout_backend(linux_dmabuf, NULL);
+}
+
+void wlr_linux_dmabuf_v1_set_scanout_backend(
+		struct wlr_linux_dmabuf_v1 *linux_dmabuf, struct wlr_backend *backend) {
+	assert(backend == NULL || wlr_backend_is_drm(backend));
+
+	wl_list_remove(&linux_dmabuf->scanout_backend_destroy.link);
+	wl_list_init(&linux_dmabuf->scanout_backend_destroy.link);
+	linux_dmabuf->scanout_backend = backend;
+
+	if (backend != NULL) {
+		linux_dmabuf->scanout_backend_destroy.notify =
+			handle_scanout_backend_destroy;
+		wl_signal_add(&backend->events.destroy,
+			&linux_dmabuf->scanout_backend_destroy);
+	}
+}
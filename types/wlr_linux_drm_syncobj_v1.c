@@ -0,0 +1,492 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/render/drm_syncobj.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_linux_drm_syncobj_v1.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+#include <xf86drm.h>
+#include "linux-drm-syncobj-v1-protocol.h"
+#include "render/wlr_renderer.h"
+#include "util/signal.h"
+
+#define LINUX_DRM_SYNCOBJ_V1_VERSION 1
+
+/**
+ * Attached to surfaces as an addon, it outlives its resource so that commits
+ * cached before the resource was destroyed are still released.
+ */
+struct wlr_linux_drm_syncobj_surface_v1 {
+	struct wl_resource *resource; // NULL if inert
+	struct wlr_surface *surface;
+	struct wlr_addon addon;
+
+	struct wl_listener client_commit;
+	struct wl_listener commit;
+};
+
+// Delays a commit until its acquire point is signalled
+struct syncobj_acquire_waiter {
+	struct wlr_surface *surface;
+	uint32_t seq;
+	struct wlr_drm_syncobj_timeline_waiter waiter;
+
+	struct wl_listener ready;
+	struct wl_listener surface_destroy;
+};
+
+// Signals a release point once the client buffer isn't used anymore
+struct syncobj_release_waiter {
+	struct wlr_drm_syncobj_timeline *timeline;
+	uint64_t point;
+
+	struct wl_listener buffer_release;
+};
+
+static const struct wp_linux_drm_syncobj_timeline_v1_interface timeline_impl;
+static const struct wp_linux_drm_syncobj_surface_v1_interface surface_impl;
+
+static struct wlr_drm_syncobj_timeline *timeline_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource,
+		&wp_linux_drm_syncobj_timeline_v1_interface, &timeline_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+// Returns NULL if the surface object is inert
+static struct wlr_linux_drm_syncobj_surface_v1 *surface_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource,
+		&wp_linux_drm_syncobj_surface_v1_interface, &surface_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static void resource_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wp_linux_drm_syncobj_timeline_v1_interface timeline_impl = {
+	.destroy = resource_handle_destroy,
+};
+
+static void timeline_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_drm_syncobj_timeline *timeline =
+		timeline_from_resource(resource);
+	wlr_drm_syncobj_timeline_unref(timeline);
+}
+
+static void set_point(struct wlr_drm_syncobj_timeline **timeline_ptr,
+		uint64_t *point_ptr, struct wl_resource *timeline_resource,
+		uint32_t point_hi, uint32_t point_lo) {
+	struct wlr_drm_syncobj_timeline *timeline =
+		timeline_from_resource(timeline_resource);
+	wlr_drm_syncobj_timeline_ref(timeline);
+	wlr_drm_syncobj_timeline_unref(*timeline_ptr);
+	*timeline_ptr = timeline;
+	*point_ptr = (uint64_t)point_hi << 32 | point_lo;
+}
+
+static void surface_handle_set_acquire_point(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *timeline_resource,
+		uint32_t point_hi, uint32_t point_lo) {
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		surface_from_resource(resource);
+	if (surface == NULL) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE,
+			"The surface has been destroyed");
+		return;
+	}
+
+	struct wlr_surface_state *pending = &surface->surface->pending;
+	set_point(&pending->syncobj.acquire_timeline,
+		&pending->syncobj.acquire_point, timeline_resource,
+		point_hi, point_lo);
+}
+
+static void surface_handle_set_release_point(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *timeline_resource,
+		uint32_t point_hi, uint32_t point_lo) {
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		surface_from_resource(resource);
+	if (surface == NULL) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE,
+			"The surface has been destroyed");
+		return;
+	}
+
+	struct wlr_surface_state *pending = &surface->surface->pending;
+	set_point(&pending->syncobj.release_timeline,
+		&pending->syncobj.release_point, timeline_resource,
+		point_hi, point_lo);
+}
+
+static const struct wp_linux_drm_syncobj_surface_v1_interface surface_impl = {
+	.destroy = resource_handle_destroy,
+	.set_acquire_point = surface_handle_set_acquire_point,
+	.set_release_point = surface_handle_set_release_point,
+};
+
+static void surface_clear_pending(struct wlr_linux_drm_syncobj_surface_v1 *surface) {
+	struct wlr_surface_state *pending = &surface->surface->pending;
+	wlr_drm_syncobj_timeline_unref(pending->syncobj.acquire_timeline);
+	wlr_drm_syncobj_timeline_unref(pending->syncobj.release_timeline);
+	memset(&pending->syncobj, 0, sizeof(pending->syncobj));
+}
+
+static void surface_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		surface_from_resource(resource);
+	if (surface == NULL) {
+		return;
+	}
+	// The next commits use implicit synchronization
+	surface_clear_pending(surface);
+	surface->resource = NULL;
+}
+
+static void surface_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		wl_container_of(addon, surface, addon);
+	if (surface->resource != NULL) {
+		wl_resource_set_user_data(surface->resource, NULL);
+	}
+	wlr_addon_finish(&surface->addon);
+	wl_list_remove(&surface->client_commit.link);
+	wl_list_remove(&surface->commit.link);
+	free(surface);
+}
+
+static const struct wlr_addon_interface surface_addon_impl = {
+	.name = "wlr_linux_drm_syncobj_surface_v1",
+	.destroy = surface_addon_destroy,
+};
+
+static struct wlr_linux_drm_syncobj_surface_v1 *surface_from_wlr_surface(
+		struct wlr_surface *wlr_surface) {
+	struct wlr_addon *addon = wlr_addon_find(&wlr_surface->addons, NULL,
+		&surface_addon_impl);
+	if (addon == NULL) {
+		return NULL;
+	}
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		wl_container_of(addon, surface, addon);
+	return surface;
+}
+
+static void acquire_waiter_destroy(struct syncobj_acquire_waiter *waiter) {
+	wlr_drm_syncobj_timeline_waiter_finish(&waiter->waiter);
+	wl_list_remove(&waiter->ready.link);
+	wl_list_remove(&waiter->surface_destroy.link);
+	free(waiter);
+}
+
+static void acquire_waiter_handle_ready(struct wl_listener *listener,
+		void *data) {
+	struct syncobj_acquire_waiter *waiter =
+		wl_container_of(listener, waiter, ready);
+	struct wlr_surface *surface = waiter->surface;
+	uint32_t seq = waiter->seq;
+	acquire_waiter_destroy(waiter);
+	wlr_surface_unlock_cached(surface, seq);
+}
+
+static void acquire_waiter_handle_surface_destroy(struct wl_listener *listener,
+		void *data) {
+	struct syncobj_acquire_waiter *waiter =
+		wl_container_of(listener, waiter, surface_destroy);
+	acquire_waiter_destroy(waiter);
+}
+
+static void surface_wait_acquire(struct wlr_linux_drm_syncobj_surface_v1 *surface) {
+	struct wlr_surface *wlr_surface = surface->surface;
+	struct wlr_surface_state *pending = &wlr_surface->pending;
+
+	struct syncobj_acquire_waiter *waiter = calloc(1, sizeof(*waiter));
+	if (waiter == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		wl_resource_post_no_memory(surface->resource);
+		return;
+	}
+
+	struct wl_client *client = wl_resource_get_client(wlr_surface->resource);
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(wl_client_get_display(client));
+	if (!wlr_drm_syncobj_timeline_waiter_init(&waiter->waiter,
+			pending->syncobj.acquire_timeline, pending->syncobj.acquire_point,
+			loop)) {
+		// Not the client's fault, apply the commit right away rather than
+		// disconnecting it. The buffer may be displayed before it's ready.
+		wlr_log(WLR_ERROR, "Failed to wait for the acquire point, "
+			"applying the commit without waiting");
+		free(waiter);
+		return;
+	}
+
+	waiter->surface = wlr_surface;
+	waiter->seq = wlr_surface_lock_pending(wlr_surface);
+
+	waiter->ready.notify = acquire_waiter_handle_ready;
+	wl_signal_add(&waiter->waiter.events.ready, &waiter->ready);
+	waiter->surface_destroy.notify = acquire_waiter_handle_surface_destroy;
+	wl_signal_add(&wlr_surface->events.destroy, &waiter->surface_destroy);
+}
+
+static void surface_handle_client_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		wl_container_of(listener, surface, client_commit);
+	struct wlr_surface_state *pending = &surface->surface->pending;
+	if (surface->resource == NULL) {
+		return;
+	}
+
+	bool has_buffer = (pending->committed & WLR_SURFACE_STATE_BUFFER) &&
+		pending->buffer != NULL;
+	bool has_acquire = pending->syncobj.acquire_timeline != NULL;
+	bool has_release = pending->syncobj.release_timeline != NULL;
+
+	if (!has_buffer) {
+		if (has_acquire || has_release) {
+			wl_resource_post_error(surface->resource,
+				WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_BUFFER,
+				"Synchronization points set without a buffer");
+		}
+		return;
+	}
+
+	struct wlr_dmabuf_attributes dmabuf;
+	if (!wlr_buffer_get_dmabuf(pending->buffer, &dmabuf)) {
+		wl_resource_post_error(surface->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_UNSUPPORTED_BUFFER,
+			"Explicit synchronization requires a DMA-BUF");
+		return;
+	}
+	if (!has_acquire) {
+		wl_resource_post_error(surface->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_ACQUIRE_POINT,
+			"Missing acquire point");
+		return;
+	}
+	if (!has_release) {
+		wl_resource_post_error(surface->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_RELEASE_POINT,
+			"Missing release point");
+		return;
+	}
+	if (pending->syncobj.acquire_timeline == pending->syncobj.release_timeline &&
+			pending->syncobj.acquire_point >= pending->syncobj.release_point) {
+		wl_resource_post_error(surface->resource,
+			WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_CONFLICTING_POINTS,
+			"Acquire point must be lower than the release point");
+		return;
+	}
+
+	surface_wait_acquire(surface);
+}
+
+static void release_waiter_handle_buffer_release(struct wl_listener *listener,
+		void *data) {
+	struct syncobj_release_waiter *waiter =
+		wl_container_of(listener, waiter, buffer_release);
+	struct wlr_client_buffer *buffer = wlr_client_buffer_get(data);
+
+	// Reads of the buffer are done once the work submitted so far is done
+	int sync_file_fd = -1;
+	if (buffer != NULL && buffer->renderer != NULL) {
+		sync_file_fd = renderer_export_sync_file(buffer->renderer);
+	}
+	if (sync_file_fd >= 0) {
+		wlr_drm_syncobj_timeline_import_sync_file(waiter->timeline,
+			waiter->point, sync_file_fd);
+		close(sync_file_fd);
+	} else {
+		wlr_drm_syncobj_timeline_signal(waiter->timeline, waiter->point);
+	}
+
+	wl_list_remove(&waiter->buffer_release.link);
+	wlr_drm_syncobj_timeline_unref(waiter->timeline);
+	free(waiter);
+}
+
+static void surface_handle_commit(struct wl_listener *listener, void *data) {
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		wl_container_of(listener, surface, commit);
+	struct wlr_surface_state *current = &surface->surface->current;
+	if (current->syncobj.release_timeline == NULL) {
+		return;
+	}
+
+	struct wlr_client_buffer *buffer = surface->surface->buffer;
+	if (buffer == NULL) {
+		// The buffer couldn't be imported, it won't be read
+		wlr_drm_syncobj_timeline_signal(current->syncobj.release_timeline,
+			current->syncobj.release_point);
+		return;
+	}
+
+	struct syncobj_release_waiter *waiter = calloc(1, sizeof(*waiter));
+	if (waiter == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	waiter->timeline =
+		wlr_drm_syncobj_timeline_ref(current->syncobj.release_timeline);
+	waiter->point = current->syncobj.release_point;
+	waiter->buffer_release.notify = release_waiter_handle_buffer_release;
+	wl_signal_add(&buffer->base.events.release, &waiter->buffer_release);
+}
+
+static void manager_handle_get_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct wlr_surface *wlr_surface = wlr_surface_from_resource(surface_resource);
+
+	struct wlr_linux_drm_syncobj_surface_v1 *surface =
+		surface_from_wlr_surface(wlr_surface);
+	if (surface != NULL && surface->resource != NULL) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_SURFACE_EXISTS,
+			"A wp_linux_drm_syncobj_surface_v1 already exists for this surface");
+		return;
+	}
+
+	bool created = false;
+	if (surface == NULL) {
+		surface = calloc(1, sizeof(*surface));
+		if (surface == NULL) {
+			wl_client_post_no_memory(client);
+			return;
+		}
+		created = true;
+	}
+
+	uint32_t version = wl_resource_get_version(resource);
+	struct wl_resource *surface_v1_resource = wl_resource_create(client,
+		&wp_linux_drm_syncobj_surface_v1_interface, version, id);
+	if (surface_v1_resource == NULL) {
+		wl_client_post_no_memory(client);
+		if (created) {
+			free(surface);
+		}
+		return;
+	}
+	wl_resource_set_implementation(surface_v1_resource, &surface_impl,
+		surface, surface_handle_resource_destroy);
+	surface->resource = surface_v1_resource;
+
+	if (!created) {
+		return;
+	}
+
+	surface->surface = wlr_surface;
+	wlr_addon_init(&surface->addon, &wlr_surface->addons, NULL,
+		&surface_addon_impl);
+
+	surface->client_commit.notify = surface_handle_client_commit;
+	wl_signal_add(&wlr_surface->events.client_commit, &surface->client_commit);
+	surface->commit.notify = surface_handle_commit;
+	wl_signal_add(&wlr_surface->events.commit, &surface->commit);
+}
+
+static void manager_handle_import_timeline(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, int drm_syncobj_fd) {
+	struct wlr_linux_drm_syncobj_manager_v1 *manager =
+		wl_resource_get_user_data(resource);
+
+	struct wlr_drm_syncobj_timeline *timeline =
+		wlr_drm_syncobj_timeline_import(manager->drm_fd, drm_syncobj_fd);
+	close(drm_syncobj_fd);
+	if (timeline == NULL) {
+		wl_resource_post_error(resource,
+			WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_INVALID_TIMELINE,
+			"Failed to import drm_syncobj timeline");
+		return;
+	}
+
+	uint32_t version = wl_resource_get_version(resource);
+	struct wl_resource *timeline_resource = wl_resource_create(client,
+		&wp_linux_drm_syncobj_timeline_v1_interface, version, id);
+	if (timeline_resource == NULL) {
+		wl_client_post_no_memory(client);
+		wlr_drm_syncobj_timeline_unref(timeline);
+		return;
+	}
+	wl_resource_set_implementation(timeline_resource, &timeline_impl,
+		timeline, timeline_handle_resource_destroy);
+}
+
+static const struct wp_linux_drm_syncobj_manager_v1_interface manager_impl = {
+	.destroy = resource_handle_destroy,
+	.get_surface = manager_handle_get_surface,
+	.import_timeline = manager_handle_import_timeline,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_linux_drm_syncobj_manager_v1 *manager = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&wp_linux_drm_syncobj_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, manager, NULL);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_linux_drm_syncobj_manager_v1 *manager =
+		wl_container_of(listener, manager, display_destroy);
+	wlr_signal_emit_safe(&manager->events.destroy, NULL);
+	wl_list_remove(&manager->display_destroy.link);
+	wl_global_destroy(manager->global);
+	free(manager);
+}
+
+struct wlr_linux_drm_syncobj_manager_v1 *wlr_linux_drm_syncobj_manager_v1_create(
+		struct wl_display *display, uint32_t version, int drm_fd) {
+	assert(version <= LINUX_DRM_SYNCOBJ_V1_VERSION);
+
+	uint64_t timeline_cap = 0;
+	if (drmGetCap(drm_fd, DRM_CAP_SYNCOBJ_TIMELINE, &timeline_cap) != 0 ||
+			timeline_cap == 0) {
+		wlr_log(WLR_INFO, "DRM device doesn't support timeline syncobjs, "
+			"disabling linux-drm-syncobj-v1");
+		return NULL;
+	}
+	if (!wlr_drm_syncobj_timeline_waiter_supported(drm_fd)) {
+		wlr_log(WLR_INFO, "DRM device doesn't support syncobj eventfds, "
+			"disabling linux-drm-syncobj-v1");
+		return NULL;
+	}
+
+	struct wlr_linux_drm_syncobj_manager_v1 *manager =
+		calloc(1, sizeof(*manager));
+	if (manager == NULL) {
+		return NULL;
+	}
+	manager->drm_fd = drm_fd;
+
+	manager->global = wl_global_create(display,
+		&wp_linux_drm_syncobj_manager_v1_interface, version, manager,
+		manager_bind);
+	if (manager->global == NULL) {
+		free(manager);
+		return NULL;
+	}
+
+	wl_signal_init(&manager->events.destroy);
+
+	manager->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &manager->display_destroy);
+
+	return manager;
+}
@@ -140,9 +140,48 @@ void matrix_projection(float mat[static 9], int width, int height,
 	mat[8] = 1.0f;
 }
 
+/**
+ * Same as the generic path of wlr_matrix_project_box() without rotation, with
+ * the products of the translation, scale and transform matrices expanded.
+ */
+static void matrix_project_box_unrotated(float mat[static 9],
+		const struct wlr_box *box, enum wl_output_transform transform,
+		const float projection[static 9]) {
+	const float *t = transforms[transform];
+	float w = box->width;
+	float h = box->height;
+
+	// The transform is applied around the center of the box
+	float model[6] = {
+		w * t[0], w * t[1], box->x + w * (0.5f - 0.5f * (t[0] + t[1])),
+		h * t[3], h * t[4], box->y + h * (0.5f - 0.5f * (t[3] + t[4])),
+	};
+
+	const float *p = projection;
+	float product[9] = {
+		p[0] * model[0] + p[1] * model[3],
+		p[0] * model[1] + p[1] * model[4],
+		p[0] * model[2] + p[1] * model[5] + p[2],
+
+		p[3] * model[0] + p[4] * model[3],
+		p[3] * model[1] + p[4] * model[4],
+		p[3] * model[2] + p[4] * model[5] + p[5],
+
+		p[6] * model[0] + p[7] * model[3],
+		p[6] * model[1] + p[7] * model[4],
+		p[6] * model[2] + p[7] * model[5] + p[8],
+	};
+	memcpy(mat, product, sizeof(product));
+}
+
 void wlr_matrix_project_box(float mat[static 9], const struct wlr_box *box,
 		enum wl_output_transform transform, float rotation,
 		const float projection[static 9]) {
+	if (rotation == 0) {
+		matrix_project_box_unrotated(mat, box, transform, projection);
+		return;
+	}
+
 	int x = box->x;
 	int y = box->y;
 	int width = box->width;
@@ -83,8 +83,17 @@ static void output_handle_commit(struct wl_listener *listener, void *data) {
 		pixman_region32_clear(&output_damage->current);
 	}
 
+	if ((event->committed & WLR_OUTPUT_STATE_ENABLED) &&
+			!output_damage->output->enabled) {
+		// The buffers are gone, the damage history is meaningless
+		pixman_region32_clear(&output_damage->current);
+		for (size_t i = 0; i < WLR_OUTPUT_DAMAGE_PREVIOUS_LEN; i++) {
+			pixman_region32_clear(&output_damage->previous[i]);
+		}
+	}
+
 	if (event->committed & (WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_SCALE |
-			WLR_OUTPUT_STATE_TRANSFORM)) {
+			WLR_OUTPUT_STATE_TRANSFORM | WLR_OUTPUT_STATE_ENABLED)) {
 		wlr_output_damage_add_whole(output_damage);
 	}
 }
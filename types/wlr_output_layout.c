@@ -13,11 +13,23 @@ struct wlr_output_layout_output_state {
 	struct wlr_output_layout_output *l_output;
 
 	bool auto_configured;
+	struct wlr_box box; // cached, see output_layout_update_index()
 
 	struct wl_listener mode;
 	struct wl_listener commit;
 };
 
+/**
+ * The output boxes are cached in an array sorted by x coordinate. Point and box
+ * queries binary search the array and only look at entries which can reach the
+ * queried x coordinate, i.e. which start less than index_max_width before it.
+ */
+struct wlr_output_layout_index_entry {
+	struct wlr_output_layout_output *l_output;
+	struct wlr_box box;
+	size_t order; // position in wlr_output_layout.outputs
+};
+
 static const struct wlr_addon_interface addon_impl;
 
 struct wlr_output_layout *wlr_output_layout_create(void) {
@@ -27,6 +39,8 @@ struct wlr_output_layout *wlr_output_layout_create(void) {
 		return NULL;
 	}
 	wl_list_init(&layout->outputs);
+	wl_array_init(&layout->index);
+	layout->index_dirty = true;
 
 	wl_signal_init(&layout->events.add);
 	wl_signal_init(&layout->events.change);
@@ -42,6 +56,7 @@ static void output_layout_output_destroy(
 	wl_list_remove(&l_output->state->mode.link);
 	wl_list_remove(&l_output->state->commit.link);
 	wl_list_remove(&l_output->link);
+	l_output->state->layout->index_dirty = true;
 	wlr_addon_finish(&l_output->addon);
 	free(l_output->state);
 	free(l_output);
@@ -59,10 +74,11 @@ void wlr_output_layout_destroy(struct wlr_output_layout *layout) {
 		output_layout_output_destroy(l_output);
 	}
 
+	wl_array_release(&layout->index);
 	free(layout);
 }
 
-static void output_layout_output_get_box(
+static void output_layout_output_compute_box(
 		struct wlr_output_layout_output *l_output,
 		struct wlr_box *box) {
 	box->x = l_output->x;
@@ -71,6 +87,110 @@ static void output_layout_output_get_box(
 		&box->width, &box->height);
 }
 
+static int index_entry_compare(const void *a, const void *b) {
+	const struct wlr_output_layout_index_entry *entry_a = a;
+	const struct wlr_output_layout_index_entry *entry_b = b;
+	if (entry_a->box.x != entry_b->box.x) {
+		return entry_a->box.x < entry_b->box.x ? -1 : 1;
+	}
+	return entry_a->order < entry_b->order ? -1 : 1;
+}
+
+static void output_layout_update_index(struct wlr_output_layout *layout) {
+	if (!layout->index_dirty) {
+		return;
+	}
+
+	int min_x = 0, max_x = 0, min_y = 0, max_y = 0;
+	if (!wl_list_empty(&layout->outputs)) {
+		min_x = min_y = INT_MAX;
+		max_x = max_y = INT_MIN;
+	}
+
+	size_t n = 0;
+	layout->index_max_width = 0;
+	struct wlr_output_layout_output *l_output;
+	wl_list_for_each(l_output, &layout->outputs, link) {
+		struct wlr_box *box = &l_output->state->box;
+		output_layout_output_compute_box(l_output, box);
+		n++;
+
+		if (box->width > layout->index_max_width) {
+			layout->index_max_width = box->width;
+		}
+		if (box->x < min_x) {
+			min_x = box->x;
+		}
+		if (box->y < min_y) {
+			min_y = box->y;
+		}
+		if (box->x + box->width > max_x) {
+			max_x = box->x + box->width;
+		}
+		if (box->y + box->height > max_y) {
+			max_y = box->y + box->height;
+		}
+	}
+
+	layout->extents = (struct wlr_box){
+		.x = min_x,
+		.y = min_y,
+		.width = max_x - min_x,
+		.height = max_y - min_y,
+	};
+
+	layout->index.size = 0;
+	struct wlr_output_layout_index_entry *entries =
+		wl_array_add(&layout->index, n * sizeof(*entries));
+	if (n > 0 && entries == NULL) {
+		// The index stays dirty and is rebuilt on the next query
+		wlr_log(WLR_ERROR, "Failed to allocate output layout index");
+		return;
+	}
+
+	size_t i = 0;
+	wl_list_for_each(l_output, &layout->outputs, link) {
+		entries[i] = (struct wlr_output_layout_index_entry){
+			.l_output = l_output,
+			.box = l_output->state->box,
+			.order = i,
+		};
+		i++;
+	}
+	qsort(entries, n, sizeof(*entries), index_entry_compare);
+
+	layout->index_dirty = false;
+}
+
+/**
+ * Returns the index entries, and in end the index of the first entry starting
+ * after x. Only entries before end can contain points with that x coordinate.
+ */
+static struct wlr_output_layout_index_entry *output_layout_index_search(
+		struct wlr_output_layout *layout, double x, size_t *end) {
+	output_layout_update_index(layout);
+
+	struct wlr_output_layout_index_entry *entries = layout->index.data;
+	size_t lo = 0, hi = layout->index.size / sizeof(*entries);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (entries[mid].box.x <= x) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*end = lo;
+	return entries;
+}
+
+static void output_layout_output_get_box(
+		struct wlr_output_layout_output *l_output,
+		struct wlr_box *box) {
+	output_layout_update_index(l_output->state->layout);
+	*box = l_output->state->box;
+}
+
 /**
  * This must be called whenever the layout changes to reconfigure the auto
  * configured outputs and emit the `changed` event.
@@ -92,7 +212,7 @@ static void output_layout_reconfigure(struct wlr_output_layout *layout) {
 			continue;
 		}
 
-		output_layout_output_get_box(l_output, &output_box);
+		output_layout_output_compute_box(l_output, &output_box);
 		if (output_box.x + output_box.width > max_x) {
 			max_x = output_box.x + output_box.width;
 			max_x_y = output_box.y;
@@ -109,12 +229,13 @@ static void output_layout_reconfigure(struct wlr_output_layout *layout) {
 		if (!l_output->state->auto_configured) {
 			continue;
 		}
-		output_layout_output_get_box(l_output, &output_box);
+		output_layout_output_compute_box(l_output, &output_box);
 		l_output->x = max_x;
 		l_output->y = max_x_y;
 		max_x += output_box.width;
 	}
 
+	layout->index_dirty = true;
 	wlr_signal_emit_safe(&layout->events.change, layout);
 }
 
@@ -173,6 +294,7 @@ static struct wlr_output_layout_output *output_layout_output_create(
 	l_output->state->l_output = l_output;
 	l_output->state->layout = layout;
 	l_output->output = output;
+	layout->index_dirty = true;
 	wl_signal_init(&l_output->events.destroy);
 
 	/*
@@ -247,11 +369,18 @@ bool wlr_output_layout_intersects(struct wlr_output_layout *layout,
 	struct wlr_box out_box;
 
 	if (reference == NULL) {
-		struct wlr_output_layout_output *l_output;
-		wl_list_for_each(l_output, &layout->outputs, link) {
-			struct wlr_box output_box;
-			output_layout_output_get_box(l_output, &output_box);
-			if (wlr_box_intersection(&out_box, &output_box, target_lbox)) {
+		if (wlr_box_empty(target_lbox)) {
+			return false;
+		}
+		size_t end;
+		struct wlr_output_layout_index_entry *entries =
+			output_layout_index_search(layout,
+				target_lbox->x + target_lbox->width - 1, &end);
+		for (size_t i = end; i-- > 0;) {
+			if (entries[i].box.x + layout->index_max_width <= target_lbox->x) {
+				break;
+			}
+			if (wlr_box_intersection(&out_box, &entries[i].box, target_lbox)) {
 				return true;
 			}
 		}
@@ -269,17 +398,31 @@ bool wlr_output_layout_intersects(struct wlr_output_layout *layout,
 	}
 }
 
-struct wlr_output *wlr_output_layout_output_at(struct wlr_output_layout *layout,
-		double lx, double ly) {
-	struct wlr_output_layout_output *l_output;
-	wl_list_for_each(l_output, &layout->outputs, link) {
-		struct wlr_box output_box;
-		output_layout_output_get_box(l_output, &output_box);
-		if (wlr_box_contains_point(&output_box, lx, ly)) {
-			return l_output->output;
+static struct wlr_output_layout_index_entry *output_layout_entry_at(
+		struct wlr_output_layout *layout, double lx, double ly) {
+	size_t end;
+	struct wlr_output_layout_index_entry *entries =
+		output_layout_index_search(layout, lx, &end);
+
+	// Overlapping outputs are resolved in layout order
+	struct wlr_output_layout_index_entry *found = NULL;
+	for (size_t i = end; i-- > 0;) {
+		if (entries[i].box.x + layout->index_max_width <= lx) {
+			break;
+		}
+		if (wlr_box_contains_point(&entries[i].box, lx, ly) &&
+				(found == NULL || entries[i].order < found->order)) {
+			found = &entries[i];
 		}
 	}
-	return NULL;
+	return found;
+}
+
+struct wlr_output *wlr_output_layout_output_at(struct wlr_output_layout *layout,
+		double lx, double ly) {
+	struct wlr_output_layout_index_entry *entry =
+		output_layout_entry_at(layout, lx, ly);
+	return entry != NULL ? entry->l_output->output : NULL;
 }
 
 void wlr_output_layout_move(struct wlr_output_layout *layout,
@@ -312,13 +455,11 @@ void wlr_output_layout_output_coords(struct wlr_output_layout *layout,
 	double src_x = *lx;
 	double src_y = *ly;
 
-	struct wlr_output_layout_output *l_output;
-	wl_list_for_each(l_output, &layout->outputs, link) {
-		if (l_output->output == reference) {
-			*lx = src_x - (double)l_output->x;
-			*ly = src_y - (double)l_output->y;
-			return;
-		}
+	struct wlr_output_layout_output *l_output =
+		wlr_output_layout_get(layout, reference);
+	if (l_output) {
+		*lx = src_x - (double)l_output->x;
+		*ly = src_y - (double)l_output->y;
 	}
 }
 
@@ -329,6 +470,17 @@ void wlr_output_layout_closest_point(struct wlr_output_layout *layout,
 		return;
 	}
 
+	// A point inside the layout is its own closest point
+	if (reference == NULL && output_layout_entry_at(layout, lx, ly) != NULL) {
+		if (dest_lx) {
+			*dest_lx = lx;
+		}
+		if (dest_ly) {
+			*dest_ly = ly;
+		}
+		return;
+	}
+
 	double min_x = 0, min_y = 0, min_distance = DBL_MAX;
 	struct wlr_output_layout_output *l_output;
 	wl_list_for_each(l_output, &layout->outputs, link) {
@@ -378,32 +530,8 @@ void wlr_output_layout_get_box(struct wlr_output_layout *layout,
 		}
 	} else {
 		// layout extents
-		int min_x = 0, max_x = 0, min_y = 0, max_y = 0;
-		if (!wl_list_empty(&layout->outputs)) {
-			min_x = min_y = INT_MAX;
-			max_x = max_y = INT_MIN;
-			wl_list_for_each(l_output, &layout->outputs, link) {
-				struct wlr_box output_box;
-				output_layout_output_get_box(l_output, &output_box);
-				if (output_box.x < min_x) {
-					min_x = output_box.x;
-				}
-				if (output_box.y < min_y) {
-					min_y = output_box.y;
-				}
-				if (output_box.x + output_box.width > max_x) {
-					max_x = output_box.x + output_box.width;
-				}
-				if (output_box.y + output_box.height > max_y) {
-					max_y = output_box.y + output_box.height;
-				}
-			}
-		}
-
-		dest_box->x = min_x;
-		dest_box->y = min_y;
-		dest_box->width = max_x - min_x;
-		dest_box->height = max_y - min_y;
+		output_layout_update_index(layout);
+		*dest_box = layout->extents;
 	}
 }
 
@@ -14,6 +14,7 @@ void wlr_pointer_init(struct wlr_pointer *pointer,
 
 	pointer->impl = impl;
 	wl_signal_init(&pointer->events.motion);
+	wl_signal_init(&pointer->events.relative_motion);
 	wl_signal_init(&pointer->events.motion_absolute);
 	wl_signal_init(&pointer->events.button);
 	wl_signal_init(&pointer->events.axis);
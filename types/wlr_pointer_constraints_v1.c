@@ -1,8 +1,10 @@
 #include <assert.h>
 #include <limits.h>
+#include <math.h>
 #include <pixman.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_pointer_constraints_v1.h>
@@ -11,6 +13,15 @@
 #include <wlr/util/log.h>
 #include "util/signal.h"
 
+/**
+ * A horizontal band of the constraint region: its rectangles all share the
+ * same y1 and y2, and are sorted by x.
+ */
+struct wlr_pointer_constraint_v1_band {
+	int32_t y1, y2;
+	size_t start, len; // range in wlr_pointer_constraint_v1.band_rects
+};
+
 static const struct zwp_locked_pointer_v1_interface locked_pointer_impl;
 static const struct zwp_confined_pointer_v1_interface confined_pointer_impl;
 static const struct zwp_pointer_constraints_v1_interface pointer_constraints_impl;
@@ -57,6 +68,8 @@ static void pointer_constraint_destroy(struct wlr_pointer_constraint_v1 *constra
 	pixman_region32_fini(&constraint->current.region);
 	pixman_region32_fini(&constraint->pending.region);
 	pixman_region32_fini(&constraint->region);
+	free(constraint->band_rects);
+	free(constraint->bands);
 	free(constraint);
 }
 
@@ -104,6 +117,88 @@ static void pointer_constraint_set_cursor_position_hint(struct wl_client *client
 	constraint->pending.committed |= WLR_POINTER_CONSTRAINT_V1_STATE_CURSOR_HINT;
 }
 
+static void pointer_constraint_update_bands(
+		struct wlr_pointer_constraint_v1 *constraint) {
+	constraint->bands_len = 0;
+
+	int nrects;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&constraint->region, &nrects);
+	if (nrects == 0) {
+		return;
+	}
+
+	// Pixman regions are y-x banded: rectangles are sorted by y then x, and
+	// those on the same row have the same y1 and y2. At worst there is one
+	// band per rectangle.
+	if ((size_t)nrects > constraint->band_rects_cap) {
+		pixman_box32_t *band_rects = realloc(constraint->band_rects,
+			nrects * sizeof(band_rects[0]));
+		if (band_rects == NULL) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			return;
+		}
+		constraint->band_rects = band_rects;
+		constraint->band_rects_cap = nrects;
+	}
+	if ((size_t)nrects > constraint->bands_cap) {
+		struct wlr_pointer_constraint_v1_band *bands = realloc(
+			constraint->bands, nrects * sizeof(bands[0]));
+		if (bands == NULL) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			return;
+		}
+		constraint->bands = bands;
+		constraint->bands_cap = nrects;
+	}
+
+	memcpy(constraint->band_rects, rects, nrects * sizeof(rects[0]));
+
+	struct wlr_pointer_constraint_v1_band *band = NULL;
+	for (int i = 0; i < nrects; i++) {
+		if (band == NULL || band->y1 != rects[i].y1) {
+			band = &constraint->bands[constraint->bands_len++];
+			band->y1 = rects[i].y1;
+			band->y2 = rects[i].y2;
+			band->start = i;
+			band->len = 0;
+		}
+		band->len++;
+	}
+}
+
+static bool pointer_constraint_contains_point(
+		struct wlr_pointer_constraint_v1 *constraint, int x, int y,
+		pixman_box32_t *box) {
+	size_t lo = 0, hi = constraint->bands_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct wlr_pointer_constraint_v1_band *band =
+			&constraint->bands[mid];
+		if (y < band->y1) {
+			hi = mid;
+		} else if (y >= band->y2) {
+			lo = mid + 1;
+		} else {
+			size_t rlo = band->start, rhi = band->start + band->len;
+			while (rlo < rhi) {
+				size_t rmid = rlo + (rhi - rlo) / 2;
+				const pixman_box32_t *rect = &constraint->band_rects[rmid];
+				if (x < rect->x1) {
+					rhi = rmid;
+				} else if (x >= rect->x2) {
+					rlo = rmid + 1;
+				} else {
+					*box = *rect;
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+	return false;
+}
+
 static void pointer_constraint_commit(
 		struct wlr_pointer_constraint_v1 *constraint) {
 	if (constraint->pending.committed &
@@ -128,6 +223,7 @@ static void pointer_constraint_commit(
 		pixman_region32_copy(&constraint->region,
 			&constraint->surface->input_region);
 	}
+	pointer_constraint_update_bands(constraint);
 
 	if (updated_region) {
 		wlr_signal_emit_safe(&constraint->events.set_region, NULL);
@@ -363,3 +459,75 @@ void wlr_pointer_constraint_v1_send_deactivated(
 		pointer_constraint_destroy(constraint);
 	}
 }
+
+// Same algorithm as region_confine() in util/region.c, with region lookups
+// going through the band cache
+static void confine_in_box(struct wlr_pointer_constraint_v1 *constraint,
+		double x1, double y1, double x2, double y2,
+		double *x2_out, double *y2_out, pixman_box32_t box) {
+	double x_clamped = fmax(fmin(x2, box.x2 - 1), box.x1);
+	double y_clamped = fmax(fmin(y2, box.y2 - 1), box.y1);
+
+	if (floor(x_clamped) == floor(x2) && floor(y_clamped) == floor(y2)) {
+		*x2_out = x2;
+		*y2_out = y2;
+		return;
+	}
+
+	double dx = x2 - x1;
+	double dy = y2 - y1;
+
+	double delta = fmin(fabs(x_clamped - x1) / fabs(dx),
+		fabs(y_clamped - y1) / fabs(dy));
+
+	double x = fmax(fmin(delta * dx + x1, box.x2 - 1), box.x1);
+	double y = fmax(fmin(delta * dy + y1, box.y2 - 1), box.y1);
+
+	// Go one unit past the boundary to find an adjacent box
+	int x_ext = floor(x) + (dx == 0 ? 0 : dx > 0 ? 1 : -1);
+	int y_ext = floor(y) + (dy == 0 ? 0 : dy > 0 ? 1 : -1);
+
+	if (pointer_constraint_contains_point(constraint, x_ext, y_ext, &box)) {
+		confine_in_box(constraint, x, y, x2, y2, x2_out, y2_out, box);
+	} else if (dx == 0 || dy == 0) {
+		*x2_out = x;
+		*y2_out = y;
+	} else {
+		bool bordering_x = x == box.x1 || x == box.x2 - 1;
+		bool bordering_y = y == box.y1 || y == box.y2 - 1;
+
+		if (bordering_x == bordering_y) {
+			double x2_potential, y2_potential;
+			double tmp1, tmp2;
+			confine_in_box(constraint, x, y, x, y2, &tmp1, &y2_potential, box);
+			confine_in_box(constraint, x, y, x2, y, &x2_potential, &tmp2, box);
+			if (fabs(x2_potential - x) > fabs(y2_potential - y)) {
+				*x2_out = x2_potential;
+				*y2_out = y;
+			} else {
+				*x2_out = x;
+				*y2_out = y2_potential;
+			}
+		} else if (bordering_x) {
+			confine_in_box(constraint, x, y, x, y2, x2_out, y2_out, box);
+		} else {
+			confine_in_box(constraint, x, y, x2, y, x2_out, y2_out, box);
+		}
+	}
+}
+
+bool wlr_pointer_constraint_v1_confine_motion(
+		struct wlr_pointer_constraint_v1 *constraint, double sx, double sy,
+		double *dx, double *dy) {
+	pixman_box32_t box;
+	if (!pointer_constraint_contains_point(constraint, floor(sx), floor(sy),
+			&box)) {
+		return false;
+	}
+
+	double x2, y2;
+	confine_in_box(constraint, sx, sy, sx + *dx, sy + *dy, &x2, &y2, box);
+	*dx = x2 - sx;
+	*dy = y2 - sy;
+	return true;
+}
@@ -10,6 +10,8 @@
 #include "util/signal.h"
 
 #define PRESENTATION_VERSION 1
+// Maximum number of destroyed feedbacks kept for reuse
+#define PRESENTATION_FEEDBACK_POOL_SIZE 64
 
 struct wlr_presentation_surface_state {
 	struct wlr_presentation_feedback *feedback;
@@ -23,6 +25,24 @@ struct wlr_presentation_surface {
 	struct wl_listener surface_commit;
 };
 
+/**
+ * Feedbacks sampled on an output, all dispatched from a single set of output
+ * listeners.
+ */
+struct wlr_presentation_output {
+	struct wlr_presentation *presentation;
+	struct wlr_output *output;
+	struct wl_list link; // wlr_presentation.outputs
+
+	// In sampling order, feedbacks waiting for a commit come last
+	struct wl_list feedbacks; // wlr_presentation_feedback.output_link
+
+	struct wlr_addon addon; // wlr_output.addons
+
+	struct wl_listener output_commit;
+	struct wl_listener output_present;
+};
+
 static void feedback_handle_resource_destroy(struct wl_resource *resource) {
 	wl_list_remove(wl_resource_get_link(resource));
 }
@@ -84,6 +104,28 @@ static void presentation_surface_handle_surface_commit(
 	p_surface->pending.feedback = NULL;
 }
 
+static struct wlr_presentation_feedback *feedback_create(
+		struct wlr_presentation *presentation) {
+	struct wlr_presentation_feedback *feedback;
+	if (!wl_list_empty(&presentation->feedback_pool)) {
+		feedback = wl_container_of(presentation->feedback_pool.next,
+			feedback, link);
+		wl_list_remove(&feedback->link);
+		presentation->feedback_pool_len--;
+		memset(feedback, 0, sizeof(*feedback));
+	} else {
+		feedback = calloc(1, sizeof(*feedback));
+		if (feedback == NULL) {
+			return NULL;
+		}
+	}
+
+	feedback->presentation = presentation;
+	wl_list_init(&feedback->resources);
+	wl_list_insert(&presentation->feedbacks, &feedback->link);
+	return feedback;
+}
+
 static const struct wp_presentation_interface presentation_impl;
 
 static struct wlr_presentation *presentation_from_resource(
@@ -121,13 +163,11 @@ static void presentation_handle_feedback(struct wl_client *client,
 
 	struct wlr_presentation_feedback *feedback = p_surface->pending.feedback;
 	if (feedback == NULL) {
-		feedback = calloc(1, sizeof(struct wlr_presentation_feedback));
+		feedback = feedback_create(presentation);
 		if (feedback == NULL) {
 			wl_client_post_no_memory(client);
 			return;
 		}
-
-		wl_list_init(&feedback->resources);
 		p_surface->pending.feedback = feedback;
 	}
 
@@ -170,10 +210,31 @@ static void presentation_bind(struct wl_client *client, void *data,
 	wp_presentation_send_clock_id(resource, (uint32_t)presentation->clock);
 }
 
+static void presentation_output_destroy(
+		struct wlr_presentation_output *p_output);
+
 static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_presentation *presentation =
 		wl_container_of(listener, presentation, display_destroy);
 	wlr_signal_emit_safe(&presentation->events.destroy, presentation);
+
+	struct wlr_presentation_output *p_output, *p_output_tmp;
+	wl_list_for_each_safe(p_output, p_output_tmp, &presentation->outputs,
+			link) {
+		presentation_output_destroy(p_output);
+	}
+
+	// Feedbacks still held by surfaces are freed with them
+	struct wlr_presentation_feedback *feedback, *tmp;
+	wl_list_for_each_safe(feedback, tmp, &presentation->feedbacks, link) {
+		feedback->presentation = NULL;
+		wl_list_remove(&feedback->link);
+		wl_list_init(&feedback->link);
+	}
+	wl_list_for_each_safe(feedback, tmp, &presentation->feedback_pool, link) {
+		free(feedback);
+	}
+
 	wl_list_remove(&presentation->display_destroy.link);
 	wl_global_destroy(presentation->global);
 	free(presentation);
@@ -196,6 +257,9 @@ struct wlr_presentation *wlr_presentation_create(struct wl_display *display,
 
 	presentation->clock = wlr_backend_get_presentation_clock(backend);
 
+	wl_list_init(&presentation->feedbacks);
+	wl_list_init(&presentation->feedback_pool);
+	wl_list_init(&presentation->outputs);
 	wl_signal_init(&presentation->events.destroy);
 
 	presentation->display_destroy.notify = handle_display_destroy;
@@ -243,7 +307,16 @@ void wlr_presentation_feedback_destroy(
 	assert(wl_list_empty(&feedback->resources));
 
 	feedback_unset_output(feedback);
-	free(feedback);
+
+	struct wlr_presentation *presentation = feedback->presentation;
+	wl_list_remove(&feedback->link);
+	if (presentation != NULL &&
+			presentation->feedback_pool_len < PRESENTATION_FEEDBACK_POOL_SIZE) {
+		wl_list_insert(&presentation->feedback_pool, &feedback->link);
+		presentation->feedback_pool_len++;
+	} else {
+		free(feedback);
+	}
 }
 
 void wlr_presentation_event_from_output(struct wlr_presentation_event *event,
@@ -263,46 +336,104 @@ static void feedback_unset_output(struct wlr_presentation_feedback *feedback) {
 	}
 
 	feedback->output = NULL;
-	wl_list_remove(&feedback->output_commit.link);
-	wl_list_remove(&feedback->output_present.link);
-	wl_list_remove(&feedback->output_destroy.link);
+	wl_list_remove(&feedback->output_link);
 }
 
-static void feedback_handle_output_commit(struct wl_listener *listener,
-		void *data) {
-	struct wlr_presentation_feedback *feedback =
-		wl_container_of(listener, feedback, output_commit);
-	if (feedback->output_committed) {
-		return;
+static void presentation_output_destroy(
+		struct wlr_presentation_output *p_output) {
+	struct wlr_presentation_feedback *feedback, *tmp;
+	wl_list_for_each_safe(feedback, tmp, &p_output->feedbacks, output_link) {
+		wlr_presentation_feedback_destroy(feedback);
 	}
-	feedback->output_committed = true;
-	feedback->output_commit_seq = feedback->output->commit_seq;
+
+	wlr_addon_finish(&p_output->addon);
+	wl_list_remove(&p_output->link);
+	wl_list_remove(&p_output->output_commit.link);
+	wl_list_remove(&p_output->output_present.link);
+	free(p_output);
 }
 
-static void feedback_handle_output_present(struct wl_listener *listener,
+static void presentation_output_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_presentation_output *p_output =
+		wl_container_of(addon, p_output, addon);
+	presentation_output_destroy(p_output);
+}
+
+static const struct wlr_addon_interface presentation_output_addon_impl = {
+	.name = "wlr_presentation_output",
+	.destroy = presentation_output_addon_destroy,
+};
+
+static void presentation_output_handle_commit(struct wl_listener *listener,
 		void *data) {
-	struct wlr_presentation_feedback *feedback =
-		wl_container_of(listener, feedback, output_present);
-	struct wlr_output_event_present *output_event = data;
+	struct wlr_presentation_output *p_output =
+		wl_container_of(listener, p_output, output_commit);
 
-	if (!feedback->output_committed ||
-			output_event->commit_seq != feedback->output_commit_seq) {
-		return;
+	// Feedbacks sampled since the previous commit are at the end
+	struct wlr_presentation_feedback *feedback;
+	wl_list_for_each_reverse(feedback, &p_output->feedbacks, output_link) {
+		if (feedback->output_committed) {
+			break;
+		}
+		feedback->output_committed = true;
+		feedback->output_commit_seq = p_output->output->commit_seq;
 	}
+}
 
+static void presentation_output_handle_present(struct wl_listener *listener,
+		void *data) {
+	struct wlr_presentation_output *p_output =
+		wl_container_of(listener, p_output, output_present);
+	struct wlr_output_event_present *output_event = data;
+
+	struct wlr_presentation_event event = {0};
 	if (output_event->presented) {
-		struct wlr_presentation_event event = {0};
 		wlr_presentation_event_from_output(&event, output_event);
-		wlr_presentation_feedback_send_presented(feedback, &event);
 	}
-	wlr_presentation_feedback_destroy(feedback);
+
+	struct wlr_presentation_feedback *feedback, *tmp;
+	wl_list_for_each_safe(feedback, tmp, &p_output->feedbacks, output_link) {
+		if (!feedback->output_committed) {
+			break;
+		}
+		if (feedback->output_commit_seq != output_event->commit_seq) {
+			continue;
+		}
+
+		if (output_event->presented) {
+			wlr_presentation_feedback_send_presented(feedback, &event);
+		}
+		wlr_presentation_feedback_destroy(feedback);
+	}
 }
 
-static void feedback_handle_output_destroy(struct wl_listener *listener,
-		void *data) {
-	struct wlr_presentation_feedback *feedback =
-		wl_container_of(listener, feedback, output_destroy);
-	wlr_presentation_feedback_destroy(feedback);
+static struct wlr_presentation_output *presentation_output_get_or_create(
+		struct wlr_presentation *presentation, struct wlr_output *output) {
+	struct wlr_addon *addon = wlr_addon_find(&output->addons, presentation,
+		&presentation_output_addon_impl);
+	if (addon != NULL) {
+		struct wlr_presentation_output *p_output =
+			wl_container_of(addon, p_output, addon);
+		return p_output;
+	}
+
+	struct wlr_presentation_output *p_output = calloc(1, sizeof(*p_output));
+	if (p_output == NULL) {
+		return NULL;
+	}
+	p_output->presentation = presentation;
+	p_output->output = output;
+	wl_list_init(&p_output->feedbacks);
+	wlr_addon_init(&p_output->addon, &output->addons, presentation,
+		&presentation_output_addon_impl);
+
+	p_output->output_commit.notify = presentation_output_handle_commit;
+	wl_signal_add(&output->events.commit, &p_output->output_commit);
+	p_output->output_present.notify = presentation_output_handle_present;
+	wl_signal_add(&output->events.present, &p_output->output_present);
+
+	wl_list_insert(&presentation->outputs, &p_output->link);
+	return p_output;
 }
 
 void wlr_presentation_surface_sampled_on_output(
@@ -315,12 +446,45 @@ void wlr_presentation_surface_sampled_on_output(
 	}
 
 	assert(feedback->output == NULL);
+	struct wlr_presentation_output *p_output =
+		presentation_output_get_or_create(presentation, output);
+	if (p_output == NULL) {
+		wlr_presentation_feedback_destroy(feedback);
+		return;
+	}
+
 	feedback->output = output;
+	wl_list_insert(p_output->feedbacks.prev, &feedback->output_link);
+}
+
+void wlr_presentation_surface_committed_on_output(
+		struct wlr_presentation *presentation, struct wlr_surface *surface,
+		struct wlr_output *output) {
+	struct wlr_presentation_feedback *feedback =
+		wlr_presentation_surface_sampled(presentation, surface);
+	if (feedback == NULL) {
+		return;
+	}
+
+	assert(feedback->output == NULL);
+	struct wlr_presentation_output *p_output =
+		presentation_output_get_or_create(presentation, output);
+	if (p_output == NULL) {
+		wlr_presentation_feedback_destroy(feedback);
+		return;
+	}
 
-	feedback->output_commit.notify = feedback_handle_output_commit;
-	wl_signal_add(&output->events.commit, &feedback->output_commit);
-	feedback->output_present.notify = feedback_handle_output_present;
-	wl_signal_add(&output->events.present, &feedback->output_present);
-	feedback->output_destroy.notify = feedback_handle_output_destroy;
-	wl_signal_add(&output->events.destroy, &feedback->output_destroy);
+	feedback->output = output;
+	feedback->output_committed = true;
+	feedback->output_commit_seq = output->commit_seq;
+
+	// Committed feedbacks are kept ahead of the ones sampled for the next
+	// commit
+	struct wlr_presentation_feedback *next;
+	wl_list_for_each(next, &p_output->feedbacks, output_link) {
+		if (!next->output_committed) {
+			break;
+		}
+	}
+	wl_list_insert(next->output_link.prev, &feedback->output_link);
 }
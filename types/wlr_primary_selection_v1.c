@@ -15,13 +15,28 @@
 
 static const struct zwp_primary_selection_offer_v1_interface offer_impl;
 
-static struct wlr_primary_selection_v1_device *device_from_offer_resource(
+static struct wlr_primary_selection_v1_device *device_from_resource(
+	struct wl_resource *resource);
+
+// Offers point to the device resource they were introduced through, NULL once
+// inert
+static struct wl_resource *device_resource_from_offer_resource(
 		struct wl_resource *resource) {
 	assert(wl_resource_instance_of(resource,
 		&zwp_primary_selection_offer_v1_interface, &offer_impl));
 	return wl_resource_get_user_data(resource);
 }
 
+static struct wlr_primary_selection_v1_device *device_from_offer_resource(
+		struct wl_resource *resource) {
+	struct wl_resource *device_resource =
+		device_resource_from_offer_resource(resource);
+	if (device_resource == NULL) {
+		return NULL;
+	}
+	return device_from_resource(device_resource);
+}
+
 static void offer_handle_receive(struct wl_client *client,
 		struct wl_resource *resource, const char *mime_type, int32_t fd) {
 	struct wlr_primary_selection_v1_device *device =
@@ -49,9 +64,6 @@ static void offer_handle_resource_destroy(struct wl_resource *resource) {
 	wl_list_remove(wl_resource_get_link(resource));
 }
 
-static struct wlr_primary_selection_v1_device *device_from_resource(
-	struct wl_resource *resource);
-
 static void create_offer(struct wl_resource *device_resource,
 		struct wlr_primary_selection_source *source) {
 	struct wlr_primary_selection_v1_device *device =
@@ -66,7 +78,7 @@ static void create_offer(struct wl_resource *device_resource,
 		wl_resource_post_no_memory(device_resource);
 		return;
 	}
-	wl_resource_set_implementation(resource, &offer_impl, device,
+	wl_resource_set_implementation(resource, &offer_impl, device_resource,
 		offer_handle_resource_destroy);
 
 	wl_list_insert(&device->offers, wl_resource_get_link(resource));
@@ -82,7 +94,7 @@ static void create_offer(struct wl_resource *device_resource,
 }
 
 static void destroy_offer(struct wl_resource *resource) {
-	if (device_from_offer_resource(resource) == NULL) {
+	if (device_resource_from_offer_resource(resource) == NULL) {
 		return;
 	}
 
@@ -234,15 +246,37 @@ static const struct zwp_primary_selection_device_v1_interface device_impl = {
 };
 
 static void device_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_primary_selection_v1_device *device =
+		device_from_resource(resource);
+	if (device != NULL) {
+		struct wl_resource *offer, *tmp;
+		wl_resource_for_each_safe(offer, tmp, &device->offers) {
+			if (device_resource_from_offer_resource(offer) == resource) {
+				destroy_offer(offer);
+			}
+		}
+	}
 	wl_list_remove(wl_resource_get_link(resource));
 }
 
 
 static void device_resource_send_selection(struct wl_resource *resource,
 		struct wlr_primary_selection_source *source) {
-	assert(device_from_resource(resource) != NULL);
+	struct wlr_primary_selection_v1_device *device =
+		device_from_resource(resource);
+	assert(device != NULL);
 
 	if (source != NULL) {
+		// Offers are made inert when the selection changes, so a live offer
+		// is for the current selection: don't re-send the MIME types when
+		// focus comes back to the client
+		struct wl_resource *offer;
+		wl_resource_for_each(offer, &device->offers) {
+			if (device_resource_from_offer_resource(offer) == resource) {
+				zwp_primary_selection_device_v1_send_selection(resource, offer);
+				return;
+			}
+		}
 		create_offer(resource, source);
 	} else {
 		zwp_primary_selection_device_v1_send_selection(resource, NULL);
@@ -192,6 +192,9 @@ void wlr_relative_pointer_manager_v1_send_relative_motion(
 
 	struct wlr_relative_pointer_v1 *pointer;
 	wl_list_for_each(pointer, &manager->relative_pointers, link) {
+		if (wl_resource_get_client(pointer->resource) != focused->client) {
+			continue;
+		}
 		struct wlr_seat_client *seat_client =
 			wlr_seat_client_from_pointer_resource(pointer->pointer_resource);
 		if (!pointer->seat || seat != pointer->seat || focused != seat_client) {
@@ -204,3 +207,11 @@ void wlr_relative_pointer_manager_v1_send_relative_motion(
 			wl_fixed_from_double(dx_unaccel), wl_fixed_from_double(dy_unaccel));
 	}
 }
+
+void wlr_relative_pointer_manager_v1_send_pointer_motion(
+		struct wlr_relative_pointer_manager_v1 *manager, struct wlr_seat *seat,
+		const struct wlr_pointer_relative_motion_event *event) {
+	wlr_relative_pointer_manager_v1_send_relative_motion(manager, seat,
+		event->time_usec, event->delta_x, event->delta_y,
+		event->unaccel_dx, event->unaccel_dy);
+}
@@ -1,5 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <drm_fourcc.h>
 #include <wlr/render/allocator.h>
 #include <wlr/render/wlr_renderer.h>
@@ -12,6 +14,7 @@
 #include <wlr/util/log.h>
 #include "wlr-screencopy-unstable-v1-protocol.h"
 #include "render/pixel_format.h"
+#include "types/wlr_shm.h"
 #include "util/signal.h"
 
 #define SCREENCOPY_MANAGER_VERSION 3
@@ -22,10 +25,49 @@ struct screencopy_damage {
 	struct pixman_region32 damage;
 	struct wl_listener output_precommit;
 	struct wl_listener output_destroy;
+
+	// Last shm buffer copied into. If the copy completed, the buffer holds
+	// the output contents up to the accumulated damage and only the damaged
+	// area needs to be copied again.
+	struct wl_resource *last_buffer;
+	bool last_buffer_valid;
+	struct wlr_box last_box;
+	struct wl_listener last_buffer_destroy;
+
+	// Commit time of the last copy, for rate limiting
+	struct timespec last_capture;
+};
+
+// A read-back of a committed output buffer, shared by all frames copying
+// the same region with the same format
+struct wlr_screencopy_v1_readback {
+	struct wlr_render_readback *readback;
+	struct wl_list link; // wlr_screencopy_manager_v1.readbacks
+
+	struct wlr_output *output;
+	uint32_t commit_seq;
+	uint32_t format;
+	struct wlr_box box;
+
+	struct wl_list frames; // wlr_screencopy_frame_v1.readback_link
+	bool done;
 };
 
 static const struct zwlr_screencopy_frame_v1_interface frame_impl;
 
+static void screencopy_readback_destroy(
+		struct wlr_screencopy_v1_readback *readback) {
+	struct wlr_screencopy_frame_v1 *frame, *tmp;
+	wl_list_for_each_safe(frame, tmp, &readback->frames, readback_link) {
+		wl_list_remove(&frame->readback_link);
+		wl_list_init(&frame->readback_link);
+		frame->readback = NULL;
+	}
+	wlr_render_readback_destroy(readback->readback);
+	wl_list_remove(&readback->link);
+	free(readback);
+}
+
 static struct screencopy_damage *screencopy_damage_find(
 		struct wlr_screencopy_v1_client *client,
 		struct wlr_output *output) {
@@ -67,7 +109,28 @@ static void screencopy_damage_handle_output_precommit(
 	screencopy_damage_accumulate(damage, event->state);
 }
 
+static void screencopy_damage_set_last_buffer(struct screencopy_damage *damage,
+		struct wl_resource *buffer, const struct wlr_box *box) {
+	wl_list_remove(&damage->last_buffer_destroy.link);
+	wl_list_init(&damage->last_buffer_destroy.link);
+	damage->last_buffer = buffer;
+	damage->last_buffer_valid = false;
+	if (buffer != NULL) {
+		damage->last_box = *box;
+		wl_resource_add_destroy_listener(buffer,
+			&damage->last_buffer_destroy);
+	}
+}
+
+static void screencopy_damage_handle_last_buffer_destroy(
+		struct wl_listener *listener, void *data) {
+	struct screencopy_damage *damage =
+		wl_container_of(listener, damage, last_buffer_destroy);
+	screencopy_damage_set_last_buffer(damage, NULL, NULL);
+}
+
 static void screencopy_damage_destroy(struct screencopy_damage *damage) {
+	wl_list_remove(&damage->last_buffer_destroy.link);
 	wl_list_remove(&damage->output_destroy.link);
 	wl_list_remove(&damage->output_precommit.link);
 	wl_list_remove(&damage->link);
@@ -103,6 +166,10 @@ static struct screencopy_damage *screencopy_damage_create(
 	wl_signal_add(&output->events.destroy, &damage->output_destroy);
 	damage->output_destroy.notify = screencopy_damage_handle_output_destroy;
 
+	wl_list_init(&damage->last_buffer_destroy.link);
+	damage->last_buffer_destroy.notify =
+		screencopy_damage_handle_last_buffer_destroy;
+
 	return damage;
 }
 
@@ -135,29 +202,57 @@ static struct wlr_screencopy_frame_v1 *frame_from_resource(
 	return wl_resource_get_user_data(resource);
 }
 
+static void frame_lock_output(struct wlr_screencopy_frame_v1 *frame,
+		bool lock) {
+	if (frame->dma_buffer != NULL) {
+		// Blitting samples from the committed buffer, a client buffer in
+		// direct scan-out works as well as a composited one
+		wlr_output_lock_layers(frame->output, lock);
+	} else {
+		wlr_output_lock_attach_render(frame->output, lock);
+	}
+}
+
 static void frame_destroy(struct wlr_screencopy_frame_v1 *frame) {
 	if (frame == NULL) {
 		return;
 	}
-	if (frame->output != NULL &&
-			(frame->shm_buffer != NULL || frame->dma_buffer != NULL)) {
-		wlr_output_lock_attach_render(frame->output, false);
-		if (frame->cursor_locked) {
-			wlr_output_lock_software_cursors(frame->output, false);
-		}
+	if (frame->output_locked) {
+		frame_lock_output(frame, false);
+	}
+	if (frame->cursor_locked) {
+		wlr_output_lock_software_cursors(frame->output, false);
+	}
+	if (frame->capture != NULL) {
+		wl_list_remove(&frame->capture_done.link);
+		wlr_output_capture_destroy(frame->capture);
+	}
+	wl_list_remove(&frame->readback_link);
+	if (frame->readback != NULL && !frame->readback->done &&
+			wl_list_empty(&frame->readback->frames)) {
+		// Nobody is interested in the pixels anymore
+		screencopy_readback_destroy(frame->readback);
+	}
+	if (frame->shm_buffer != NULL) {
+		wlr_buffer_unlock(frame->shm_buffer);
 	}
 	wl_list_remove(&frame->link);
 	wl_list_remove(&frame->output_commit.link);
 	wl_list_remove(&frame->output_destroy.link);
 	wl_list_remove(&frame->output_enable.link);
 	wl_list_remove(&frame->buffer_destroy.link);
+	if (frame->rate_limit_timer != NULL) {
+		wl_event_source_remove(frame->rate_limit_timer);
+	}
 	// Make the frame resource inert
 	wl_resource_set_user_data(frame->resource, NULL);
 	client_unref(frame->client);
 	free(frame);
 }
 
-static void frame_send_damage(struct wlr_screencopy_frame_v1 *frame) {
+// Takes the damage accumulated until the copied frame, later commits count
+// towards the next copy
+static void frame_take_damage(struct wlr_screencopy_frame_v1 *frame) {
 	if (!frame->with_damage) {
 		return;
 	}
@@ -171,16 +266,24 @@ static void frame_send_damage(struct wlr_screencopy_frame_v1 *frame) {
 	// TODO: send fine-grained damage events
 	struct pixman_box32 *damage_box =
 		pixman_region32_extents(&damage->damage);
+	frame->damage_box = (struct wlr_box){
+		.x = damage_box->x1,
+		.y = damage_box->y1,
+		.width = damage_box->x2 - damage_box->x1,
+		.height = damage_box->y2 - damage_box->y1,
+	};
 
-	int damage_x = damage_box->x1;
-	int damage_y = damage_box->y1;
-	int damage_width = damage_box->x2 - damage_box->x1;
-	int damage_height = damage_box->y2 - damage_box->y1;
+	pixman_region32_clear(&damage->damage);
+}
 
-	zwlr_screencopy_frame_v1_send_damage(frame->resource,
-		damage_x, damage_y, damage_width, damage_height);
+static void frame_send_damage(struct wlr_screencopy_frame_v1 *frame) {
+	if (!frame->with_damage) {
+		return;
+	}
 
-	pixman_region32_clear(&damage->damage);
+	zwlr_screencopy_frame_v1_send_damage(frame->resource,
+		frame->damage_box.x, frame->damage_box.y,
+		frame->damage_box.width, frame->damage_box.height);
 }
 
 static void frame_send_ready(struct wlr_screencopy_frame_v1 *frame,
@@ -192,35 +295,176 @@ static void frame_send_ready(struct wlr_screencopy_frame_v1 *frame,
 		tv_sec_hi, tv_sec_lo, when->tv_nsec);
 }
 
+static void frame_finish_shm_copy(struct wlr_screencopy_frame_v1 *frame,
+		struct wlr_render_readback *readback) {
+	struct wlr_buffer *shm_buffer = frame->shm_buffer;
+
+	void *pixels;
+	uint32_t format;
+	size_t stride;
+	uint32_t renderer_flags = 0;
+	bool ok = wlr_buffer_begin_data_ptr_access(shm_buffer,
+		WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &pixels, &format, &stride);
+	if (ok) {
+		ok = wlr_render_readback_get_pixels(readback, &renderer_flags,
+			stride, frame->copy_box.x, frame->copy_box.y, pixels);
+		wlr_buffer_end_data_ptr_access(shm_buffer);
+	}
+
+	if (!ok) {
+		zwlr_screencopy_frame_v1_send_failed(frame->resource);
+		frame_destroy(frame);
+		return;
+	}
+
+	struct screencopy_damage *damage =
+		screencopy_damage_find(frame->client, frame->output);
+	if (damage != NULL && damage->last_buffer == frame->buffer_resource) {
+		damage->last_buffer_valid = true;
+	}
+
+	uint32_t flags = renderer_flags & WLR_RENDERER_READ_PIXELS_Y_INVERT ?
+		ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT : 0;
+	zwlr_screencopy_frame_v1_send_flags(frame->resource, flags);
+	frame_send_damage(frame);
+	frame_send_ready(frame, &frame->commit_time);
+	frame_destroy(frame);
+}
+
+static void screencopy_readback_handle_done(
+		struct wlr_render_readback *wlr_readback, void *data) {
+	struct wlr_screencopy_v1_readback *readback = data;
+	readback->done = true;
+
+	struct wlr_screencopy_frame_v1 *frame, *tmp;
+	wl_list_for_each_safe(frame, tmp, &readback->frames, readback_link) {
+		frame_finish_shm_copy(frame, wlr_readback);
+	}
+
+	screencopy_readback_destroy(readback);
+}
+
+static struct wlr_screencopy_v1_readback *screencopy_readback_find(
+		struct wlr_screencopy_manager_v1 *manager, struct wlr_output *output,
+		uint32_t format, const struct wlr_box *box) {
+	struct wlr_screencopy_v1_readback *readback;
+	wl_list_for_each(readback, &manager->readbacks, link) {
+		if (readback->output == output &&
+				readback->commit_seq == output->commit_seq &&
+				readback->format == format &&
+				memcmp(&readback->box, box, sizeof(*box)) == 0) {
+			return readback;
+		}
+	}
+	return NULL;
+}
+
+static void frame_attach_readback(struct wlr_screencopy_frame_v1 *frame,
+		struct wlr_screencopy_v1_readback *readback) {
+	frame->readback = readback;
+	wl_list_insert(&readback->frames, &frame->readback_link);
+}
+
+// Starts copying the frame into the shm buffer. The GPU to CPU transfer
+// completes in a later event loop iteration, so that capturing doesn't stall
+// the compositor.
 static bool frame_shm_copy(struct wlr_screencopy_frame_v1 *frame,
-		struct wlr_buffer *src_buffer, uint32_t *flags) {
-	struct wl_shm_buffer *shm_buffer = frame->shm_buffer;
+		struct wlr_buffer *src_buffer) {
 	struct wlr_output *output = frame->output;
 	struct wlr_renderer *renderer = output->renderer;
 	assert(renderer);
 
-	int x = frame->box.x;
-	int y = frame->box.y;
+	uint32_t drm_format = convert_wl_shm_format_to_drm(frame->format);
 
-	enum wl_shm_format wl_shm_format = wl_shm_buffer_get_format(shm_buffer);
-	uint32_t drm_format = convert_wl_shm_format_to_drm(wl_shm_format);
-	int32_t width = wl_shm_buffer_get_width(shm_buffer);
-	int32_t height = wl_shm_buffer_get_height(shm_buffer);
-	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	frame->copy_box = (struct wlr_box){
+		.width = frame->shm_buffer->width,
+		.height = frame->shm_buffer->height,
+	};
 
-	wl_shm_buffer_begin_access(shm_buffer);
-	void *data = wl_shm_buffer_get_data(shm_buffer);
-	uint32_t renderer_flags = 0;
-	bool ok;
-	ok = wlr_renderer_begin_with_buffer(renderer, src_buffer);
-	ok = ok && wlr_renderer_read_pixels(renderer, drm_format,
-		&renderer_flags, stride, width, height, x, y, 0, 0, data);
+	struct screencopy_damage *damage = NULL;
+	if (frame->with_damage) {
+		damage = screencopy_damage_find(frame->client, output);
+	}
+	if (damage != NULL && damage->last_buffer == frame->buffer_resource &&
+			damage->last_buffer_valid &&
+			memcmp(&damage->last_box, &frame->box, sizeof(frame->box)) == 0) {
+		// The buffer still holds the previous copy, only read back the
+		// damaged area
+		pixman_box32_t *extents = pixman_region32_extents(&damage->damage);
+		struct wlr_box damage_box = {
+			.x = extents->x1,
+			.y = extents->y1,
+			.width = extents->x2 - extents->x1,
+			.height = extents->y2 - extents->y1,
+		};
+		struct wlr_box box;
+		if (wlr_box_intersection(&box, &damage_box, &frame->box)) {
+			box.x -= frame->box.x;
+			box.y -= frame->box.y;
+			frame->copy_box = box;
+		}
+	}
+	if (damage != NULL) {
+		screencopy_damage_set_last_buffer(damage, frame->buffer_resource,
+			&frame->box);
+	}
+
+	struct wlr_box src_box = {
+		.x = frame->box.x + frame->copy_box.x,
+		.y = frame->box.y + frame->copy_box.y,
+		.width = frame->copy_box.width,
+		.height = frame->copy_box.height,
+	};
+
+	// Other clients may be capturing the same frame
+	struct wlr_screencopy_manager_v1 *manager = frame->client->manager;
+	struct wlr_screencopy_v1_readback *readback =
+		screencopy_readback_find(manager, output, drm_format, &src_box);
+	if (readback != NULL) {
+		frame_attach_readback(frame, readback);
+		return true;
+	}
+
+	readback = calloc(1, sizeof(*readback));
+	if (readback == NULL) {
+		return false;
+	}
+	readback->output = output;
+	readback->commit_seq = output->commit_seq;
+	readback->format = drm_format;
+	readback->box = src_box;
+	wl_list_init(&readback->frames);
+
+	if (!wlr_renderer_begin_with_buffer(renderer, src_buffer)) {
+		free(readback);
+		return false;
+	}
+	readback->readback = wlr_renderer_read_pixels_async(renderer,
+		wl_display_get_event_loop(output->display), drm_format,
+		src_box.width, src_box.height, src_box.x, src_box.y,
+		screencopy_readback_handle_done, readback);
 	wlr_renderer_end(renderer);
-	*flags = renderer_flags & WLR_RENDERER_READ_PIXELS_Y_INVERT ?
-		ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT : 0;
-	wl_shm_buffer_end_access(shm_buffer);
 
-	return ok;
+	if (readback->readback == NULL) {
+		free(readback);
+		return false;
+	}
+	wl_list_insert(&manager->readbacks, &readback->link);
+
+	frame_attach_readback(frame, readback);
+	return true;
+}
+
+static bool is_yuv_format(struct wlr_renderer *renderer, uint32_t fourcc) {
+	size_t len = 0;
+	const uint32_t *formats =
+		wlr_renderer_get_yuv_render_formats(renderer, &len);
+	for (size_t i = 0; i < len; i++) {
+		if (formats[i] == fourcc) {
+			return true;
+		}
+	}
+	return false;
 }
 
 static bool blit_dmabuf(struct wlr_renderer *renderer,
@@ -234,6 +478,15 @@ static bool blit_dmabuf(struct wlr_renderer *renderer,
 		goto error_src_tex;
 	}
 
+	// Convert on the GPU, so that clients such as video encoders don't have
+	// to read back and convert RGB frames on the CPU
+	if (is_yuv_format(renderer, dst_dmabuf->attributes.format)) {
+		bool ok = wlr_renderer_blit_to_yuv(renderer, src_tex, dst_buffer);
+		wlr_texture_destroy(src_tex);
+		wlr_buffer_unlock(dst_buffer);
+		return ok;
+	}
+
 	float mat[9];
 	wlr_matrix_identity(mat);
 	wlr_matrix_scale(mat, dst_buffer->width, dst_buffer->height);
@@ -265,6 +518,15 @@ static bool frame_dma_copy(struct wlr_screencopy_frame_v1 *frame,
 	struct wlr_renderer *renderer = output->renderer;
 	assert(renderer);
 
+	// Damage is taken by this copy, the last shm buffer becomes outdated
+	struct screencopy_damage *damage = NULL;
+	if (frame->with_damage) {
+		damage = screencopy_damage_find(frame->client, output);
+	}
+	if (damage != NULL) {
+		screencopy_damage_set_last_buffer(damage, NULL, NULL);
+	}
+
 	// TODO: add support for copying regions with DMA-BUFs
 	if (frame->box.x != 0 || frame->box.y != 0 ||
 			src_buffer->width != frame->box.width ||
@@ -275,6 +537,83 @@ static bool frame_dma_copy(struct wlr_screencopy_frame_v1 *frame,
 	return blit_dmabuf(renderer, dst_buffer, src_buffer);
 }
 
+static bool frame_has_damage(struct wlr_screencopy_frame_v1 *frame,
+		struct screencopy_damage *damage) {
+	// Damage outside of the captured region doesn't need a new copy
+	pixman_box32_t box = {
+		.x1 = frame->box.x,
+		.y1 = frame->box.y,
+		.x2 = frame->box.x + frame->box.width,
+		.y2 = frame->box.y + frame->box.height,
+	};
+	return pixman_region32_contains_rectangle(&damage->damage, &box) !=
+		PIXMAN_REGION_OUT;
+}
+
+static int64_t timespec_diff_nsec(const struct timespec *a,
+		const struct timespec *b) {
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000 +
+		(a->tv_nsec - b->tv_nsec);
+}
+
+static bool frame_start_capture(struct wlr_screencopy_frame_v1 *frame);
+static void frame_start_copy(struct wlr_screencopy_frame_v1 *frame);
+
+static int frame_handle_rate_limit_timer(void *data) {
+	struct wlr_screencopy_frame_v1 *frame = data;
+	wl_event_source_remove(frame->rate_limit_timer);
+	frame->rate_limit_timer = NULL;
+	if (frame->use_capture && frame->capture == NULL) {
+		if (!frame_start_capture(frame)) {
+			frame_start_copy(frame);
+		}
+		return 0;
+	}
+	wlr_output_schedule_frame(frame->output);
+	return 0;
+}
+
+/**
+ * Returns true if the copy for a commit at the given time needs to be
+ * delayed, in which case a new frame is scheduled once the client is allowed
+ * to capture again.
+ */
+static bool frame_rate_limit(struct wlr_screencopy_frame_v1 *frame,
+		struct screencopy_damage *damage, const struct timespec *when) {
+	int max_fps = frame->client->manager->max_fps;
+	if (max_fps <= 0 || damage == NULL || (damage->last_capture.tv_sec == 0 &&
+			damage->last_capture.tv_nsec == 0)) {
+		return false;
+	}
+
+	// Allow half a refresh cycle of jitter, otherwise a limit matching a
+	// divisor of the refresh rate would drop every other frame
+	int64_t interval = 1000000000 / max_fps;
+	if (frame->output->refresh > 0) {
+		interval -= 1000000000000 / frame->output->refresh / 2;
+	}
+
+	int64_t elapsed = timespec_diff_nsec(when, &damage->last_capture);
+	if (elapsed >= interval) {
+		return false;
+	}
+
+	if (frame->rate_limit_timer == NULL) {
+		struct wl_display *display =
+			wl_client_get_display(wl_resource_get_client(frame->resource));
+		frame->rate_limit_timer = wl_event_loop_add_timer(
+			wl_display_get_event_loop(display),
+			frame_handle_rate_limit_timer, frame);
+		if (frame->rate_limit_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create rate limit timer");
+			return false;
+		}
+	}
+	int delay_ms = (interval - elapsed + 999999) / 1000000;
+	wl_event_source_timer_update(frame->rate_limit_timer, delay_ms);
+	return true;
+}
+
 static void frame_handle_output_commit(struct wl_listener *listener,
 		void *data) {
 	struct wlr_screencopy_frame_v1 *frame =
@@ -292,34 +631,158 @@ static void frame_handle_output_commit(struct wl_listener *listener,
 	if (!frame->shm_buffer && !frame->dma_buffer) {
 		return;
 	}
+	if (frame->use_capture) {
+		// Completed by frame_handle_capture_done()
+		return;
+	}
+	if (frame->skip_commit && output->commit_seq == frame->skip_commit_seq) {
+		// Prepared before the layers were locked
+		return;
+	}
 
-	if (frame->with_damage) {
-		struct screencopy_damage *damage =
-			screencopy_damage_get_or_create(frame->client, output);
-		if (damage && !pixman_region32_not_empty(&damage->damage)) {
-			return;
-		}
+	struct screencopy_damage *damage = NULL;
+	if (frame->with_damage || frame->client->manager->max_fps > 0) {
+		damage = screencopy_damage_get_or_create(frame->client, output);
+	}
+	if (frame->with_damage && damage && !frame_has_damage(frame, damage)) {
+		return;
+	}
+	if (frame_rate_limit(frame, damage, event->when)) {
+		return;
+	}
+	if (damage != NULL) {
+		damage->last_capture = *event->when;
 	}
 
 	wl_list_remove(&frame->output_commit.link);
 	wl_list_init(&frame->output_commit.link);
 
-
-	uint32_t flags = 0;
 	bool ok = frame->shm_buffer ?
-		frame_shm_copy(frame, buffer, &flags) : frame_dma_copy(frame, buffer);
+		frame_shm_copy(frame, buffer) : frame_dma_copy(frame, buffer);
 	if (!ok) {
 		zwlr_screencopy_frame_v1_send_failed(frame->resource);
 		frame_destroy(frame);
 		return;
 	}
 
-	zwlr_screencopy_frame_v1_send_flags(frame->resource, flags);
+	frame->commit_time = *event->when;
+	frame_take_damage(frame);
+
+	if (frame->shm_buffer) {
+		// Completed by screencopy_readback_handle_done()
+		return;
+	}
+
+	zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
+	frame_send_damage(frame);
+	frame_send_ready(frame, &frame->commit_time);
+	frame_destroy(frame);
+}
+
+static void frame_handle_capture_done(struct wl_listener *listener,
+		void *data) {
+	struct wlr_screencopy_frame_v1 *frame =
+		wl_container_of(listener, frame, capture_done);
+	const struct wlr_output_event_capture *event = data;
+	struct wlr_output *output = frame->output;
+	struct timespec commit_time = event->capture->commit_time;
+
+	// The capture is destroyed right after this event
+	wl_list_remove(&frame->capture_done.link);
+	frame->capture = NULL;
+
+	if (!event->success) {
+		frame_start_copy(frame);
+		return;
+	}
+
+	// Same rules as frame_handle_output_commit(), checked once the commit
+	// has been captured
+	struct screencopy_damage *damage = NULL;
+	if (frame->with_damage || frame->client->manager->max_fps > 0) {
+		damage = screencopy_damage_get_or_create(frame->client, output);
+	}
+	if (frame->with_damage && damage && !frame_has_damage(frame, damage)) {
+		if (!frame_start_capture(frame)) {
+			frame_start_copy(frame);
+		}
+		return;
+	}
+	if (frame_rate_limit(frame, damage, &commit_time)) {
+		// Captured again once the timer fires
+		return;
+	}
+	if (damage != NULL) {
+		damage->last_capture = commit_time;
+		// Damage is taken by this copy, the last shm buffer becomes outdated
+		screencopy_damage_set_last_buffer(damage, NULL, NULL);
+	}
+
+	frame->commit_time = commit_time;
+	frame_take_damage(frame);
+
+	zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
 	frame_send_damage(frame);
-	frame_send_ready(frame, event->when);
+	frame_send_ready(frame, &frame->commit_time);
 	frame_destroy(frame);
 }
 
+/**
+ * Capture the next frame with the display hardware, directly into the
+ * client's DMA-BUF.
+ */
+static bool frame_start_capture(struct wlr_screencopy_frame_v1 *frame) {
+	frame->capture = wlr_output_capture_create(frame->output,
+		&frame->dma_buffer->base);
+	if (frame->capture == NULL) {
+		return false;
+	}
+	frame->capture_done.notify = frame_handle_capture_done;
+	wl_signal_add(&frame->capture->events.done, &frame->capture_done);
+	wlr_output_schedule_frame(frame->output);
+	return true;
+}
+
+// Copy the next committed buffer with the renderer
+static void frame_start_copy(struct wlr_screencopy_frame_v1 *frame) {
+	struct wlr_output *output = frame->output;
+
+	if (frame->use_capture) {
+		// A failed capture may belong to a commit which is being prepared,
+		// before the locks below can apply
+		frame->use_capture = false;
+		frame->skip_commit = true;
+		frame->skip_commit_seq = output->commit_seq + 1;
+	}
+
+	// Schedule a buffer commit
+	wlr_output_schedule_frame(output);
+
+	frame_lock_output(frame, true);
+	frame->output_locked = true;
+	if (frame->overlay_cursor) {
+		wlr_output_lock_software_cursors(output, true);
+		frame->cursor_locked = true;
+	}
+}
+
+/**
+ * Captures include the hardware cursor and the output layers, but can only
+ * cover the whole output.
+ */
+static bool frame_can_capture(struct wlr_screencopy_frame_v1 *frame) {
+	struct wlr_output *output = frame->output;
+	if (frame->dma_buffer == NULL || frame->box.x != 0 || frame->box.y != 0 ||
+			frame->box.width != output->width ||
+			frame->box.height != output->height) {
+		return false;
+	}
+	if (!frame->overlay_cursor && output->hardware_cursor != NULL) {
+		return false;
+	}
+	return wlr_output_test_capture(output, &frame->dma_buffer->base);
+}
+
 static void frame_handle_output_enable(struct wl_listener *listener,
 		void *data) {
 	struct wlr_screencopy_frame_v1 *frame =
@@ -362,10 +825,23 @@ static void frame_handle_copy(struct wl_client *wl_client,
 		return;
 	}
 
+	if (frame->shm_buffer != NULL || frame->dma_buffer != NULL) {
+		wl_resource_post_error(frame->resource,
+			ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED,
+			"frame already used");
+		return;
+	}
+
 	struct wlr_dmabuf_v1_buffer *dma_buffer = NULL;
-	struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer_resource);
-	if (shm_buffer == NULL &&
-			wlr_dmabuf_v1_resource_is_buffer(buffer_resource)) {
+	struct wlr_buffer *shm_buffer = NULL;
+	if (wl_shm_buffer_get(buffer_resource) != NULL ||
+			shm_resource_is_buffer(buffer_resource)) {
+		shm_buffer = wlr_buffer_from_resource(buffer_resource);
+		if (shm_buffer == NULL) {
+			wl_resource_post_no_memory(frame->resource);
+			return;
+		}
+	} else if (wlr_dmabuf_v1_resource_is_buffer(buffer_resource)) {
 		dma_buffer =
 			wlr_dmabuf_v1_buffer_from_buffer_resource(buffer_resource);
 	}
@@ -381,8 +857,21 @@ static void frame_handle_copy(struct wl_client *wl_client,
 	int32_t height = 0;
 
 	if (shm_buffer) {
-		enum wl_shm_format fmt = wl_shm_buffer_get_format(shm_buffer);
-		if (fmt != frame->format) {
+		void *data;
+		uint32_t format;
+		size_t stride;
+		if (!wlr_buffer_begin_data_ptr_access(shm_buffer,
+				WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
+			wlr_buffer_unlock(shm_buffer);
+			wl_resource_post_error(frame->resource,
+				ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
+				"unsupported buffer type");
+			return;
+		}
+		wlr_buffer_end_data_ptr_access(shm_buffer);
+
+		if (format != convert_wl_shm_format_to_drm(frame->format)) {
+			wlr_buffer_unlock(shm_buffer);
 			wl_resource_post_error(frame->resource,
 				ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
 				"invalid buffer format");
@@ -390,8 +879,8 @@ static void frame_handle_copy(struct wl_client *wl_client,
 
 		}
 
-		int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
-		if (stride != frame->stride) {
+		if (stride != (size_t)frame->stride) {
+			wlr_buffer_unlock(shm_buffer);
 			wl_resource_post_error(frame->resource,
 				ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
 				"invalid buffer stride");
@@ -399,11 +888,13 @@ static void frame_handle_copy(struct wl_client *wl_client,
 
 		}
 
-		width = wl_shm_buffer_get_width(shm_buffer);
-		height = wl_shm_buffer_get_height(shm_buffer);
+		width = shm_buffer->width;
+		height = shm_buffer->height;
 	} else if (dma_buffer) {
 		uint32_t fourcc = dma_buffer->attributes.format;
-		if (fourcc != frame->fourcc) {
+		if (fourcc != frame->fourcc &&
+				(frame->output->renderer == NULL ||
+				!is_yuv_format(frame->output->renderer, fourcc))) {
 			wl_resource_post_error(frame->resource,
 				ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
 				"invalid buffer format");
@@ -418,21 +909,18 @@ static void frame_handle_copy(struct wl_client *wl_client,
 	}
 
 	if (width != frame->box.width || height != frame->box.height) {
+		if (shm_buffer != NULL) {
+			wlr_buffer_unlock(shm_buffer);
+		}
 		wl_resource_post_error(frame->resource,
 			ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
 			"invalid buffer dimensions");
 		return;
 	}
 
-	if (frame->shm_buffer != NULL || frame->dma_buffer != NULL) {
-		wl_resource_post_error(frame->resource,
-			ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED,
-			"frame already used");
-		return;
-	}
-
 	frame->shm_buffer = shm_buffer;
 	frame->dma_buffer = dma_buffer;
+	frame->buffer_resource = buffer_resource;
 
 	wl_signal_add(&output->events.commit, &frame->output_commit);
 	frame->output_commit.notify = frame_handle_output_commit;
@@ -443,14 +931,13 @@ static void frame_handle_copy(struct wl_client *wl_client,
 	wl_resource_add_destroy_listener(buffer_resource, &frame->buffer_destroy);
 	frame->buffer_destroy.notify = frame_handle_buffer_destroy;
 
-	// Schedule a buffer commit
-	wlr_output_schedule_frame(output);
-
-	wlr_output_lock_attach_render(output, true);
-	if (frame->overlay_cursor) {
-		wlr_output_lock_software_cursors(output, true);
-		frame->cursor_locked = true;
+	if (frame_can_capture(frame)) {
+		frame->use_capture = frame_start_capture(frame);
+		if (frame->use_capture) {
+			return;
+		}
 	}
+	frame_start_copy(frame);
 }
 
 static void frame_handle_copy_with_damage(struct wl_client *wl_client,
@@ -528,6 +1015,7 @@ static void capture_output(struct wl_client *wl_client,
 	wl_list_init(&frame->output_commit.link);
 	wl_list_init(&frame->output_enable.link);
 	wl_list_init(&frame->buffer_destroy.link);
+	wl_list_init(&frame->readback_link);
 
 	wl_signal_add(&output->events.destroy, &frame->output_destroy);
 	frame->output_destroy.notify = frame_handle_output_destroy;
@@ -588,6 +1076,15 @@ static void capture_output(struct wl_client *wl_client,
 			zwlr_screencopy_frame_v1_send_linux_dmabuf(
 					frame->resource, frame->fourcc,
 					buffer_box.width, buffer_box.height);
+
+			size_t yuv_formats_len = 0;
+			const uint32_t *yuv_formats = wlr_renderer_get_yuv_render_formats(
+				output->renderer, &yuv_formats_len);
+			for (size_t i = 0; i < yuv_formats_len; i++) {
+				zwlr_screencopy_frame_v1_send_linux_dmabuf(
+					frame->resource, yuv_formats[i],
+					buffer_box.width, buffer_box.height);
+			}
 		}
 
 		zwlr_screencopy_frame_v1_send_buffer_done(frame->resource);
@@ -702,6 +1199,7 @@ struct wlr_screencopy_manager_v1 *wlr_screencopy_manager_v1_create(
 		return NULL;
 	}
 	wl_list_init(&manager->frames);
+	wl_list_init(&manager->readbacks);
 
 	wl_signal_init(&manager->events.destroy);
 
@@ -710,3 +1208,8 @@ struct wlr_screencopy_manager_v1 *wlr_screencopy_manager_v1_create(
 
 	return manager;
 }
+
+void wlr_screencopy_manager_v1_set_max_fps(
+		struct wlr_screencopy_manager_v1 *manager, int max_fps) {
+	manager->max_fps = max_fps;
+}
@@ -1,7 +1,10 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-server-core.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_session_lock_v1.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_compositor.h>
@@ -455,3 +458,80 @@ struct wlr_session_lock_manager_v1 *wlr_session_lock_manager_v1_create(struct wl
 
 	return lock_manager;
 }
+
+static bool blank_render(struct wlr_session_lock_blank_v1 *blank) {
+	struct wlr_output *output = blank->output;
+	if (!wlr_output_attach_render(output, NULL)) {
+		return false;
+	}
+
+	struct wlr_renderer *renderer = output->renderer;
+	wlr_renderer_begin(renderer, output->width, output->height);
+	wlr_renderer_clear(renderer, blank->color);
+	wlr_renderer_end(renderer);
+
+	wlr_buffer_unlock(blank->buffer);
+	blank->buffer = wlr_buffer_lock(output->back_buffer);
+	return true;
+}
+
+static bool blank_is_current(struct wlr_session_lock_blank_v1 *blank) {
+	return blank->buffer != NULL &&
+		blank->buffer->width == blank->output->width &&
+		blank->buffer->height == blank->output->height;
+}
+
+static void blank_handle_output_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_session_lock_blank_v1 *blank =
+		wl_container_of(listener, blank, output_destroy);
+	wlr_session_lock_blank_v1_destroy(blank);
+}
+
+struct wlr_session_lock_blank_v1 *wlr_session_lock_blank_v1_create(
+		struct wlr_output *output, const float color[static 4]) {
+	assert(output->enabled && output->renderer != NULL);
+
+	struct wlr_session_lock_blank_v1 *blank = calloc(1, sizeof(*blank));
+	if (blank == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	blank->output = output;
+	memcpy(blank->color, color, sizeof(blank->color));
+
+	// The buffer is taken from the output's swapchain, so that it can be
+	// scanned out, but it isn't committed yet
+	bool ok = blank_render(blank);
+	wlr_output_rollback(output);
+	if (!ok) {
+		wlr_log(WLR_ERROR, "Failed to render session lock blank buffer");
+		free(blank);
+		return NULL;
+	}
+
+	blank->output_destroy.notify = blank_handle_output_destroy;
+	wl_signal_add(&output->events.destroy, &blank->output_destroy);
+
+	return blank;
+}
+
+void wlr_session_lock_blank_v1_destroy(struct wlr_session_lock_blank_v1 *blank) {
+	if (blank == NULL) {
+		return;
+	}
+	wl_list_remove(&blank->output_destroy.link);
+	wlr_buffer_unlock(blank->buffer);
+	free(blank);
+}
+
+bool wlr_session_lock_blank_v1_commit(struct wlr_session_lock_blank_v1 *blank) {
+	struct wlr_output *output = blank->output;
+	if (blank_is_current(blank)) {
+		wlr_output_attach_buffer(output, blank->buffer);
+	} else if (!blank_render(blank)) {
+		wlr_output_rollback(output);
+		return false;
+	}
+	return wlr_output_commit(output);
+}
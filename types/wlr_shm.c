@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <linux/udmabuf.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wayland-server-protocol.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/util/log.h>
+#include "render/pixel_format.h"
+#include "types/wlr_client_usage.h"
+#include "types/wlr_shm.h"
+
+#define SHM_VERSION 1
+
+// Mappings being accessed, looked up by the SIGBUS handler
+static struct wl_list accessed_mappings = {
+	.prev = &accessed_mappings,
+	.next = &accessed_mappings,
+};
+static bool sigbus_handler_installed = false;
+static struct sigaction prev_sigbus_action;
+
+static void reraise_sigbus(void) {
+	sigaction(SIGBUS, &prev_sigbus_action, NULL);
+	raise(SIGBUS);
+}
+
+static void handle_sigbus(int sig, siginfo_t *info, void *context) {
+	struct wlr_shm_mapping *found = NULL, *mapping;
+	wl_list_for_each(mapping, &accessed_mappings, link) {
+		uint8_t *data = mapping->data;
+		uint8_t *addr = info->si_addr;
+		if (addr >= data && addr < data + mapping->size) {
+			found = mapping;
+			break;
+		}
+	}
+	if (found == NULL || found->sigbus) {
+		reraise_sigbus();
+		return;
+	}
+
+	// The client has shrunk the file, replace the mapping with zeroed pages
+	// so that the access can complete, and disconnect the client later
+	found->sigbus = true;
+	if (mmap(found->data, found->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+		reraise_sigbus();
+	}
+}
+
+static bool install_sigbus_handler(void) {
+	if (sigbus_handler_installed) {
+		return true;
+	}
+
+	struct sigaction action = {
+		.sa_sigaction = handle_sigbus,
+		.sa_flags = SA_SIGINFO | SA_NODEFER,
+	};
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGBUS, &action, &prev_sigbus_action) != 0) {
+		wlr_log_errno(WLR_ERROR, "sigaction failed");
+		return false;
+	}
+	sigbus_handler_installed = true;
+	return true;
+}
+
+static struct wlr_shm_mapping *mapping_create(int fd, size_t size) {
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		wlr_log_errno(WLR_DEBUG, "mmap failed");
+		return NULL;
+	}
+
+	struct wlr_shm_mapping *mapping = calloc(1, sizeof(*mapping));
+	if (mapping == NULL) {
+		munmap(data, size);
+		return NULL;
+	}
+	mapping->data = data;
+	mapping->size = size;
+	mapping->n_refs = 1;
+	wl_list_init(&mapping->link);
+	return mapping;
+}
+
+static void mapping_unref(struct wlr_shm_mapping *mapping) {
+	assert(mapping->n_refs > 0);
+	mapping->n_refs--;
+	if (mapping->n_refs > 0) {
+		return;
+	}
+	assert(mapping->n_accesses == 0);
+	munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+static void pool_unref(struct wlr_shm_pool *pool) {
+	assert(pool->n_refs > 0);
+	pool->n_refs--;
+	if (pool->n_refs > 0) {
+		return;
+	}
+	wl_list_remove(&pool->link);
+	mapping_unref(pool->mapping);
+	close(pool->fd);
+	free(pool);
+}
+
+static const struct wlr_buffer_impl buffer_impl;
+
+static struct wlr_shm_pool_buffer *buffer_from_buffer(
+		struct wlr_buffer *wlr_buffer) {
+	assert(wlr_buffer->impl == &buffer_impl);
+	return (struct wlr_shm_pool_buffer *)wlr_buffer;
+}
+
+static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct wlr_shm_pool_buffer *buffer = buffer_from_buffer(wlr_buffer);
+	assert(buffer->resource == NULL);
+	wl_list_remove(&buffer->release.link);
+	if (buffer->dmabuf_fd >= 0) {
+		close(buffer->dmabuf_fd);
+	}
+	pool_unref(buffer->pool);
+	free(buffer);
+}
+
+static bool buffer_get_shm(struct wlr_buffer *wlr_buffer,
+		struct wlr_shm_attributes *shm) {
+	struct wlr_shm_pool_buffer *buffer = buffer_from_buffer(wlr_buffer);
+	*shm = (struct wlr_shm_attributes){
+		.fd = buffer->pool->fd,
+		.format = buffer->drm_format,
+		.width = buffer->base.width,
+		.height = buffer->base.height,
+		.stride = buffer->stride,
+		.offset = buffer->offset,
+	};
+	return true;
+}
+
+static bool buffer_create_udmabuf(struct wlr_shm_pool_buffer *buffer) {
+	struct wlr_shm_pool *pool = buffer->pool;
+
+	// udmabuf needs page-aligned ranges, wrap the pages the buffer overlaps
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t start = buffer->offset & ~(page_size - 1);
+	size_t end = (size_t)buffer->offset +
+		(size_t)buffer->stride * buffer->base.height;
+	end = (end + page_size - 1) & ~(page_size - 1);
+
+	struct stat st;
+	if (fstat(pool->fd, &st) != 0 || (size_t)st.st_size < end) {
+		return false;
+	}
+
+	struct udmabuf_create create = {
+		.memfd = pool->fd,
+		.flags = UDMABUF_FLAGS_CLOEXEC,
+		.offset = start,
+		.size = end - start,
+	};
+	int fd = ioctl(pool->shm->udmabuf_fd, UDMABUF_CREATE, &create);
+	if (fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "UDMABUF_CREATE failed");
+		return false;
+	}
+
+	buffer->dmabuf_fd = fd;
+	buffer->dmabuf_offset = buffer->offset - start;
+	return true;
+}
+
+static bool buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
+		struct wlr_dmabuf_attributes *attribs) {
+	struct wlr_shm_pool_buffer *buffer = buffer_from_buffer(wlr_buffer);
+	if (buffer->dmabuf_disabled) {
+		return false;
+	}
+	if (buffer->dmabuf_fd < 0) {
+		if (buffer->pool->shm == NULL || buffer->pool->shm->udmabuf_fd < 0 ||
+				!buffer->pool->sealed || !buffer_create_udmabuf(buffer)) {
+			buffer->dmabuf_disabled = true;
+			return false;
+		}
+	}
+
+	*attribs = (struct wlr_dmabuf_attributes){
+		.width = buffer->base.width,
+		.height = buffer->base.height,
+		.format = buffer->drm_format,
+		.modifier = DRM_FORMAT_MOD_LINEAR,
+		.n_planes = 1,
+		.offset[0] = buffer->dmabuf_offset,
+		.stride[0] = buffer->stride,
+		.fd[0] = buffer->dmabuf_fd,
+	};
+	return true;
+}
+
+static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct wlr_shm_pool_buffer *buffer = buffer_from_buffer(wlr_buffer);
+	assert(buffer->mapping == NULL);
+
+	if (!install_sigbus_handler()) {
+		return false;
+	}
+
+	// The pool may be resized while the data pointer is accessed
+	struct wlr_shm_mapping *mapping = buffer->pool->mapping;
+	mapping->n_refs++;
+	if (mapping->n_accesses == 0) {
+		wl_list_insert(&accessed_mappings, &mapping->link);
+	}
+	mapping->n_accesses++;
+	buffer->mapping = mapping;
+
+	*data = (uint8_t *)mapping->data + buffer->offset;
+	*format = buffer->drm_format;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	struct wlr_shm_pool_buffer *buffer = buffer_from_buffer(wlr_buffer);
+	struct wlr_shm_mapping *mapping = buffer->mapping;
+	assert(mapping != NULL);
+	buffer->mapping = NULL;
+
+	if (mapping->sigbus && buffer->resource != NULL) {
+		wl_resource_post_error(buffer->resource, WL_SHM_ERROR_INVALID_FD,
+			"error accessing SHM buffer");
+	}
+
+	mapping->n_accesses--;
+	if (mapping->n_accesses == 0) {
+		wl_list_remove(&mapping->link);
+		wl_list_init(&mapping->link);
+	}
+	mapping_unref(mapping);
+}
+
+static const struct wlr_buffer_impl buffer_impl = {
+	.destroy = buffer_destroy,
+	.get_shm = buffer_get_shm,
+	.get_dmabuf = buffer_get_dmabuf,
+	.begin_data_ptr_access = buffer_begin_data_ptr_access,
+	.end_data_ptr_access = buffer_end_data_ptr_access,
+};
+
+bool shm_buffer_disable_dmabuf(struct wlr_buffer *wlr_buffer) {
+	if (wlr_buffer->impl != &buffer_impl) {
+		return false;
+	}
+	struct wlr_shm_pool_buffer *buffer = buffer_from_buffer(wlr_buffer);
+	if (buffer->dmabuf_disabled) {
+		return false;
+	}
+	buffer->dmabuf_disabled = true;
+	return true;
+}
+
+static void buffer_handle_release(struct wl_listener *listener, void *data) {
+	struct wlr_shm_pool_buffer *buffer =
+		wl_container_of(listener, buffer, release);
+	if (buffer->resource != NULL) {
+		wl_buffer_send_release(buffer->resource);
+	}
+}
+
+static void buffer_handle_destroy_request(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface wl_buffer_impl = {
+	.destroy = buffer_handle_destroy_request,
+};
+
+bool shm_resource_is_buffer(struct wl_resource *resource) {
+	return wl_resource_instance_of(resource, &wl_buffer_interface,
+		&wl_buffer_impl);
+}
+
+static struct wlr_shm_pool_buffer *pool_buffer_from_resource(
+		struct wl_resource *resource) {
+	assert(shm_resource_is_buffer(resource));
+	return wl_resource_get_user_data(resource);
+}
+
+static bool buffer_resource_is_instance(struct wl_resource *resource) {
+	return shm_resource_is_buffer(resource);
+}
+
+static struct wlr_buffer *buffer_from_resource(struct wl_resource *resource) {
+	struct wlr_shm_pool_buffer *buffer = pool_buffer_from_resource(resource);
+	return &buffer->base;
+}
+
+static const struct wlr_buffer_resource_interface buffer_resource_interface = {
+	.name = "wlr_shm",
+	.is_instance = buffer_resource_is_instance,
+	.from_resource = buffer_from_resource,
+};
+
+static void buffer_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_shm_pool_buffer *buffer =
+		pool_buffer_from_resource(resource);
+	buffer->resource = NULL;
+	// This might destroy the buffer
+	wlr_buffer_drop(&buffer->base);
+}
+
+static const struct wl_shm_pool_interface pool_impl;
+
+static struct wlr_shm_pool *pool_from_resource(struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource, &wl_shm_pool_interface,
+		&pool_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static bool shm_has_format(struct wlr_shm *shm, uint32_t format) {
+	for (size_t i = 0; i < shm->formats_len; i++) {
+		if (shm->formats[i] == format) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void pool_handle_create_buffer(struct wl_client *client,
+		struct wl_resource *pool_resource, uint32_t id, int32_t offset,
+		int32_t width, int32_t height, int32_t stride, uint32_t wl_format) {
+	struct wlr_shm_pool *pool = pool_from_resource(pool_resource);
+
+	uint32_t format = convert_wl_shm_format_to_drm(wl_format);
+	const struct wlr_pixel_format_info *info = drm_get_pixel_format_info(format);
+	if (pool->shm == NULL || !shm_has_format(pool->shm, format) ||
+			info == NULL) {
+		wl_resource_post_error(pool_resource, WL_SHM_ERROR_INVALID_FORMAT,
+			"unsupported format");
+		return;
+	}
+
+	if (offset < 0 || width <= 0 || height <= 0 ||
+			stride < (int64_t)width * info->bpp / 8 ||
+			(int64_t)offset + (int64_t)stride * height >
+			(int64_t)pool->mapping->size) {
+		wl_resource_post_error(pool_resource, WL_SHM_ERROR_INVALID_STRIDE,
+			"invalid width, height or stride");
+		return;
+	}
+
+	struct wlr_shm_pool_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	buffer->resource = wl_resource_create(client, &wl_buffer_interface,
+		1, id);
+	if (buffer->resource == NULL) {
+		free(buffer);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wlr_buffer_init(&buffer->base, &buffer_impl, width, height);
+	buffer->pool = pool;
+	pool->n_refs++;
+	buffer->drm_format = format;
+	buffer->offset = offset;
+	buffer->stride = stride;
+	buffer->dmabuf_fd = -1;
+
+	buffer->release.notify = buffer_handle_release;
+	wl_signal_add(&buffer->base.events.release, &buffer->release);
+
+	wl_resource_set_implementation(buffer->resource, &wl_buffer_impl,
+		buffer, buffer_handle_resource_destroy);
+}
+
+static void pool_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void pool_handle_resize(struct wl_client *client,
+		struct wl_resource *resource, int32_t size) {
+	struct wlr_shm_pool *pool = pool_from_resource(resource);
+
+	if (size <= 0 || (size_t)size < pool->mapping->size) {
+		wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_STRIDE,
+			"shrinking pool invalid");
+		return;
+	}
+
+	struct wlr_shm_mapping *mapping = mapping_create(pool->fd, size);
+	if (mapping == NULL) {
+		wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+			"failed to mmap fd");
+		return;
+	}
+
+	client_usage_update_shm_pool(client, pool->mapping->size, mapping->size);
+
+	// Data pointer accesses in progress keep the previous mapping alive
+	mapping_unref(pool->mapping);
+	pool->mapping = mapping;
+}
+
+static const struct wl_shm_pool_interface pool_impl = {
+	.create_buffer = pool_handle_create_buffer,
+	.destroy = pool_handle_destroy,
+	.resize = pool_handle_resize,
+};
+
+static void pool_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_shm_pool *pool = pool_from_resource(resource);
+	pool->resource = NULL;
+	client_usage_update_shm_pool(wl_resource_get_client(resource),
+		pool->mapping->size, 0);
+	pool_unref(pool);
+}
+
+static const struct wl_shm_interface shm_impl;
+
+static struct wlr_shm *shm_from_resource(struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource, &wl_shm_interface, &shm_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static void shm_handle_create_pool(struct wl_client *client,
+		struct wl_resource *shm_resource, uint32_t id, int fd, int32_t size) {
+	struct wlr_shm *shm = shm_from_resource(shm_resource);
+
+	if (size <= 0) {
+		wl_resource_post_error(shm_resource, WL_SHM_ERROR_INVALID_STRIDE,
+			"invalid size (%d)", size);
+		close(fd);
+		return;
+	}
+
+	struct wlr_shm_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		wl_client_post_no_memory(client);
+		close(fd);
+		return;
+	}
+
+	pool->mapping = mapping_create(fd, size);
+	if (pool->mapping == NULL) {
+		wl_resource_post_error(shm_resource, WL_SHM_ERROR_INVALID_FD,
+			"failed to mmap fd");
+		free(pool);
+		close(fd);
+		return;
+	}
+
+	pool->resource = wl_resource_create(client, &wl_shm_pool_interface,
+		wl_resource_get_version(shm_resource), id);
+	if (pool->resource == NULL) {
+		mapping_unref(pool->mapping);
+		free(pool);
+		close(fd);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	pool->shm = shm;
+	wl_list_insert(&shm->pools, &pool->link);
+	pool->fd = fd;
+	pool->n_refs = 1;
+
+	// udmabuf only accepts memfds which can't shrink under its feet, and
+	// which can still be written to
+	int seals = fcntl(fd, F_GET_SEALS);
+	pool->sealed = seals >= 0 && (seals & F_SEAL_SHRINK) &&
+		!(seals & F_SEAL_WRITE);
+
+	wl_resource_set_implementation(pool->resource, &pool_impl, pool,
+		pool_handle_resource_destroy);
+
+	client_usage_update_shm_pool(client, 0, pool->mapping->size);
+}
+
+static const struct wl_shm_interface shm_impl = {
+	.create_pool = shm_handle_create_pool,
+};
+
+static void shm_bind(struct wl_client *client, void *data, uint32_t version,
+		uint32_t id) {
+	struct wlr_shm *shm = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&wl_shm_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &shm_impl, shm, NULL);
+
+	for (size_t i = 0; i < shm->formats_len; i++) {
+		wl_shm_send_format(resource,
+			convert_drm_format_to_wl_shm(shm->formats[i]));
+	}
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_shm *shm = wl_container_of(listener, shm, display_destroy);
+	wl_list_remove(&shm->display_destroy.link);
+
+	// Buffers may outlive the display, e.g. while they are being scanned out
+	struct wlr_shm_pool *pool, *tmp;
+	wl_list_for_each_safe(pool, tmp, &shm->pools, link) {
+		pool->shm = NULL;
+		wl_list_remove(&pool->link);
+		wl_list_init(&pool->link);
+	}
+
+	wl_global_destroy(shm->global);
+	if (shm->udmabuf_fd >= 0) {
+		close(shm->udmabuf_fd);
+	}
+	free(shm->formats);
+	free(shm);
+}
+
+struct wlr_shm *shm_create(struct wl_display *display,
+		const uint32_t *formats, size_t formats_len) {
+	struct wlr_shm *shm = calloc(1, sizeof(*shm));
+	if (shm == NULL) {
+		return NULL;
+	}
+
+	shm->formats = calloc(formats_len, sizeof(formats[0]));
+	if (shm->formats == NULL) {
+		free(shm);
+		return NULL;
+	}
+	memcpy(shm->formats, formats, formats_len * sizeof(formats[0]));
+	shm->formats_len = formats_len;
+	wl_list_init(&shm->pools);
+
+	shm->global = wl_global_create(display, &wl_shm_interface, SHM_VERSION,
+		shm, shm_bind);
+	if (shm->global == NULL) {
+		free(shm->formats);
+		free(shm);
+		return NULL;
+	}
+
+	shm->udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (shm->udmabuf_fd < 0) {
+		wlr_log_errno(WLR_INFO, "Failed to open /dev/udmabuf, "
+			"shm buffers will be copied");
+	}
+
+	shm->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &shm->display_destroy);
+
+	wlr_buffer_register_resource_interface(&buffer_resource_interface);
+
+	return shm;
+}
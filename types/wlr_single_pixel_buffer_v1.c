@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_single_pixel_buffer_v1.h>
+#include <wlr/util/log.h>
+#include "single-pixel-buffer-v1-protocol.h"
+#include "util/signal.h"
+
+#define SINGLE_PIXEL_MANAGER_VERSION 1
+
+struct wlr_single_pixel_buffer_v1 {
+	struct wlr_buffer base;
+	struct wl_resource *resource; // NULL if destroyed
+
+	// Premultiplied, as sent by the client
+	uint32_t r, g, b, a;
+	// Little-endian DRM_FORMAT_ARGB8888, for data pointer access
+	uint8_t argb8888[4];
+
+	struct wl_listener release;
+};
+
+static void buffer_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface wl_buffer_impl = {
+	.destroy = buffer_handle_destroy,
+};
+
+static bool buffer_resource_is_instance(struct wl_resource *resource) {
+	return wl_resource_instance_of(resource, &wl_buffer_interface,
+		&wl_buffer_impl);
+}
+
+static struct wlr_single_pixel_buffer_v1 *single_pixel_buffer_from_resource(
+		struct wl_resource *resource) {
+	assert(buffer_resource_is_instance(resource));
+	return wl_resource_get_user_data(resource);
+}
+
+static struct wlr_buffer *buffer_from_resource(struct wl_resource *resource) {
+	return &single_pixel_buffer_from_resource(resource)->base;
+}
+
+static const struct wlr_buffer_resource_interface buffer_resource_interface = {
+	.name = "single_pixel_buffer_v1",
+	.is_instance = buffer_resource_is_instance,
+	.from_resource = buffer_from_resource,
+};
+
+static const struct wlr_buffer_impl buffer_impl;
+
+static struct wlr_single_pixel_buffer_v1 *single_pixel_buffer_from_buffer(
+		struct wlr_buffer *buffer) {
+	assert(buffer->impl == &buffer_impl);
+	return (struct wlr_single_pixel_buffer_v1 *)buffer;
+}
+
+static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct wlr_single_pixel_buffer_v1 *buffer =
+		single_pixel_buffer_from_buffer(wlr_buffer);
+	wl_list_remove(&buffer->release.link);
+	free(buffer);
+}
+
+static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct wlr_single_pixel_buffer_v1 *buffer =
+		single_pixel_buffer_from_buffer(wlr_buffer);
+	if (flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE) {
+		return false;
+	}
+	*data = buffer->argb8888;
+	*format = DRM_FORMAT_ARGB8888;
+	*stride = sizeof(buffer->argb8888);
+	return true;
+}
+
+static void buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// This space is intentionally left blank
+}
+
+static const struct wlr_buffer_impl buffer_impl = {
+	.destroy = buffer_destroy,
+	.begin_data_ptr_access = buffer_begin_data_ptr_access,
+	.end_data_ptr_access = buffer_end_data_ptr_access,
+};
+
+bool wlr_single_pixel_buffer_v1_get_color(struct wlr_buffer *wlr_buffer,
+		float color[static 4]) {
+	if (wlr_buffer->impl != &buffer_impl) {
+		return false;
+	}
+	struct wlr_single_pixel_buffer_v1 *buffer =
+		single_pixel_buffer_from_buffer(wlr_buffer);
+	color[0] = (float)buffer->r / UINT32_MAX;
+	color[1] = (float)buffer->g / UINT32_MAX;
+	color[2] = (float)buffer->b / UINT32_MAX;
+	color[3] = (float)buffer->a / UINT32_MAX;
+	return true;
+}
+
+static void buffer_handle_release(struct wl_listener *listener, void *data) {
+	struct wlr_single_pixel_buffer_v1 *buffer =
+		wl_container_of(listener, buffer, release);
+	if (buffer->resource != NULL) {
+		wl_buffer_send_release(buffer->resource);
+	}
+}
+
+static void buffer_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_single_pixel_buffer_v1 *buffer =
+		single_pixel_buffer_from_resource(resource);
+	buffer->resource = NULL;
+	wlr_buffer_drop(&buffer->base);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void manager_handle_create_u32_rgba_buffer(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, uint32_t r, uint32_t g,
+		uint32_t b, uint32_t a) {
+	struct wlr_single_pixel_buffer_v1 *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	buffer->resource = wl_resource_create(client, &wl_buffer_interface, 1, id);
+	if (buffer->resource == NULL) {
+		wl_client_post_no_memory(client);
+		free(buffer);
+		return;
+	}
+	wl_resource_set_implementation(buffer->resource, &wl_buffer_impl,
+		buffer, buffer_handle_resource_destroy);
+
+	wlr_buffer_init(&buffer->base, &buffer_impl, 1, 1);
+
+	buffer->r = r;
+	buffer->g = g;
+	buffer->b = b;
+	buffer->a = a;
+
+	buffer->argb8888[0] = b >> 24;
+	buffer->argb8888[1] = g >> 24;
+	buffer->argb8888[2] = r >> 24;
+	buffer->argb8888[3] = a >> 24;
+
+	buffer->release.notify = buffer_handle_release;
+	wl_signal_add(&buffer->base.events.release, &buffer->release);
+}
+
+static const struct wp_single_pixel_buffer_manager_v1_interface manager_impl = {
+	.destroy = manager_handle_destroy,
+	.create_u32_rgba_buffer = manager_handle_create_u32_rgba_buffer,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_single_pixel_buffer_manager_v1 *manager = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&wp_single_pixel_buffer_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, manager, NULL);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_single_pixel_buffer_manager_v1 *manager =
+		wl_container_of(listener, manager, display_destroy);
+	wlr_signal_emit_safe(&manager->events.destroy, NULL);
+	wl_list_remove(&manager->display_destroy.link);
+	wl_global_destroy(manager->global);
+	free(manager);
+}
+
+struct wlr_single_pixel_buffer_manager_v1 *
+		wlr_single_pixel_buffer_manager_v1_create(struct wl_display *display) {
+	struct wlr_single_pixel_buffer_manager_v1 *manager =
+		calloc(1, sizeof(*manager));
+	if (manager == NULL) {
+		return NULL;
+	}
+
+	manager->global = wl_global_create(display,
+		&wp_single_pixel_buffer_manager_v1_interface,
+		SINGLE_PIXEL_MANAGER_VERSION, manager, manager_bind);
+	if (manager->global == NULL) {
+		free(manager);
+		return NULL;
+	}
+
+	wl_signal_init(&manager->events.destroy);
+
+	manager->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &manager->display_destroy);
+
+	wlr_buffer_register_resource_interface(&buffer_resource_interface);
+
+	return manager;
+}
@@ -3,6 +3,7 @@
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_subcompositor.h>
+#include "types/wlr_compositor.h"
 #include "types/wlr_region.h"
 #include "util/signal.h"
 
@@ -231,6 +232,7 @@ static void subsurface_consider_map(struct wlr_subsurface *subsurface,
 	// Now we can map the subsurface
 	wlr_signal_emit_safe(&subsurface->events.map, subsurface);
 	subsurface->mapped = true;
+	surface_invalidate_subsurface_tree(subsurface->parent);
 
 	// Try mapping all children too
 	struct wlr_subsurface *child;
@@ -251,6 +253,7 @@ static void subsurface_unmap(struct wlr_subsurface *subsurface) {
 
 	wlr_signal_emit_safe(&subsurface->events.unmap, subsurface);
 	subsurface->mapped = false;
+	surface_invalidate_subsurface_tree(subsurface->parent);
 
 	// Unmap all children
 	struct wlr_subsurface *child;
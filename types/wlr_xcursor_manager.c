@@ -55,12 +55,41 @@ bool wlr_xcursor_manager_load(struct wlr_xcursor_manager *manager,
 	return true;
 }
 
+static struct wlr_xcursor *theme_get_cursor(
+		struct wlr_xcursor_manager_theme *theme, const char *name) {
+	const size_t recent_len = sizeof(theme->recent) / sizeof(theme->recent[0]);
+
+	// Compositors switch back and forth between a few cursors, e.g. when
+	// hovering window edges
+	size_t i;
+	struct wlr_xcursor *xcursor = NULL;
+	for (i = 0; i < recent_len && theme->recent[i] != NULL; i++) {
+		if (strcmp(theme->recent[i]->name, name) == 0) {
+			xcursor = theme->recent[i];
+			break;
+		}
+	}
+	if (xcursor == NULL) {
+		xcursor = wlr_xcursor_theme_get_cursor(theme->theme, name);
+		if (xcursor == NULL) {
+			return NULL;
+		}
+		if (i == recent_len) {
+			i--;
+		}
+	}
+
+	memmove(&theme->recent[1], &theme->recent[0], i * sizeof(theme->recent[0]));
+	theme->recent[0] = xcursor;
+	return xcursor;
+}
+
 struct wlr_xcursor *wlr_xcursor_manager_get_xcursor(
 		struct wlr_xcursor_manager *manager, const char *name, float scale) {
 	struct wlr_xcursor_manager_theme *theme;
 	wl_list_for_each(theme, &manager->scaled_themes, link) {
 		if (theme->scale == scale) {
-			return wlr_xcursor_theme_get_cursor(theme->theme, name);
+			return theme_get_cursor(theme, name);
 		}
 	}
 	return NULL;
@@ -70,15 +99,11 @@ void wlr_xcursor_manager_set_cursor_image(struct wlr_xcursor_manager *manager,
 		const char *name, struct wlr_cursor *cursor) {
 	struct wlr_xcursor_manager_theme *theme;
 	wl_list_for_each(theme, &manager->scaled_themes, link) {
-		struct wlr_xcursor *xcursor =
-			wlr_xcursor_theme_get_cursor(theme->theme, name);
+		struct wlr_xcursor *xcursor = theme_get_cursor(theme, name);
 		if (xcursor == NULL) {
 			continue;
 		}
 
-		struct wlr_xcursor_image *image = xcursor->images[0];
-		wlr_cursor_set_image(cursor, image->buffer, image->width * 4,
-			image->width, image->height, image->hotspot_x, image->hotspot_y,
-			theme->scale);
+		wlr_cursor_set_xcursor(cursor, xcursor, theme->scale);
 	}
 }
@@ -25,12 +25,21 @@ static void output_handle_resource_destroy(struct wl_resource *resource) {
 	wl_list_remove(wl_resource_get_link(resource));
 }
 
+enum output_detail {
+	OUTPUT_DETAIL_POSITION = 1 << 0,
+	OUTPUT_DETAIL_SIZE = 1 << 1,
+};
+
 static void output_send_details(struct wlr_xdg_output_v1 *xdg_output,
-		struct wl_resource *resource) {
-	zxdg_output_v1_send_logical_position(resource,
-		xdg_output->x, xdg_output->y);
-	zxdg_output_v1_send_logical_size(resource,
-		xdg_output->width, xdg_output->height);
+		struct wl_resource *resource, uint32_t details) {
+	if (details & OUTPUT_DETAIL_POSITION) {
+		zxdg_output_v1_send_logical_position(resource,
+			xdg_output->x, xdg_output->y);
+	}
+	if (details & OUTPUT_DETAIL_SIZE) {
+		zxdg_output_v1_send_logical_size(resource,
+			xdg_output->width, xdg_output->height);
+	}
 	if (wl_resource_get_version(resource) < OUTPUT_DONE_DEPRECATED_SINCE_VERSION) {
 		zxdg_output_v1_send_done(resource);
 	}
@@ -38,12 +47,12 @@ static void output_send_details(struct wlr_xdg_output_v1 *xdg_output,
 
 static void output_update(struct wlr_xdg_output_v1 *xdg_output) {
 	struct wlr_output_layout_output *layout_output = xdg_output->layout_output;
-	bool updated = false;
+	uint32_t updated = 0;
 
 	if (layout_output->x != xdg_output->x || layout_output->y != xdg_output->y) {
 		xdg_output->x = layout_output->x;
 		xdg_output->y = layout_output->y;
-		updated = true;
+		updated |= OUTPUT_DETAIL_POSITION;
 	}
 
 	int width, height;
@@ -51,13 +60,13 @@ static void output_update(struct wlr_xdg_output_v1 *xdg_output) {
 	if (xdg_output->width != width || xdg_output->height != height) {
 		xdg_output->width = width;
 		xdg_output->height = height;
-		updated = true;
+		updated |= OUTPUT_DETAIL_SIZE;
 	}
 
-	if (updated) {
+	if (updated != 0) {
 		struct wl_resource *resource;
 		wl_resource_for_each(resource, &xdg_output->resources) {
-			output_send_details(xdg_output, resource);
+			output_send_details(xdg_output, resource, updated);
 		}
 
 		wlr_output_schedule_done(xdg_output->layout_output->output);
@@ -138,7 +147,8 @@ static void output_manager_handle_get_xdg_output(struct wl_client *client,
 			output->description);
 	}
 
-	output_send_details(xdg_output, xdg_output_resource);
+	output_send_details(xdg_output, xdg_output_resource,
+		OUTPUT_DETAIL_POSITION | OUTPUT_DETAIL_SIZE);
 
 	wl_output_send_done(output_resource);
 }
@@ -205,8 +215,10 @@ static void add_output(struct wlr_xdg_output_manager_v1 *manager,
 	output_update(output);
 }
 
-static void output_manager_send_details(
-		struct wlr_xdg_output_manager_v1 *manager) {
+static void output_manager_handle_idle_update(void *data) {
+	struct wlr_xdg_output_manager_v1 *manager = data;
+	manager->idle_update = NULL;
+
 	struct wlr_xdg_output_v1 *output;
 	wl_list_for_each(output, &manager->outputs, link) {
 		output_update(output);
@@ -223,7 +235,13 @@ static void handle_layout_add(struct wl_listener *listener, void *data) {
 static void handle_layout_change(struct wl_listener *listener, void *data) {
 	struct wlr_xdg_output_manager_v1 *manager =
 		wl_container_of(listener, manager, layout_change);
-	output_manager_send_details(manager);
+
+	// Outputs are often moved one after the other, only send the final
+	// layout
+	if (manager->idle_update == NULL) {
+		manager->idle_update = wl_event_loop_add_idle(manager->event_loop,
+			output_manager_handle_idle_update, manager);
+	}
 }
 
 static void manager_destroy(struct wlr_xdg_output_manager_v1 *manager) {
@@ -232,6 +250,9 @@ static void manager_destroy(struct wlr_xdg_output_manager_v1 *manager) {
 		output_destroy(output);
 	}
 	wlr_signal_emit_safe(&manager->events.destroy, manager);
+	if (manager->idle_update != NULL) {
+		wl_event_source_remove(manager->idle_update);
+	}
 	wl_list_remove(&manager->display_destroy.link);
 	wl_list_remove(&manager->layout_add.link);
 	wl_list_remove(&manager->layout_change.link);
@@ -259,6 +280,7 @@ struct wlr_xdg_output_manager_v1 *wlr_xdg_output_manager_v1_create(
 		return NULL;
 	}
 	manager->layout = layout;
+	manager->event_loop = wl_display_get_event_loop(display);
 	manager->global = wl_global_create(display,
 		&zxdg_output_manager_v1_interface, OUTPUT_MANAGER_VERSION, manager,
 		output_manager_bind);
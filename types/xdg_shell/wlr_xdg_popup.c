@@ -490,6 +490,23 @@ void wlr_xdg_popup_get_toplevel_coords(struct wlr_xdg_popup *popup,
 	*toplevel_sy = popup_sy;
 }
 
+static bool box_equal(const struct wlr_box *a, const struct wlr_box *b) {
+	return a->x == b->x && a->y == b->y &&
+		a->width == b->width && a->height == b->height;
+}
+
+static bool positioner_rules_equal(const struct wlr_xdg_positioner_rules *a,
+		const struct wlr_xdg_positioner_rules *b) {
+	return box_equal(&a->anchor_rect, &b->anchor_rect) &&
+		a->anchor == b->anchor &&
+		a->gravity == b->gravity &&
+		a->constraint_adjustment == b->constraint_adjustment &&
+		a->size.width == b->size.width &&
+		a->size.height == b->size.height &&
+		a->offset.x == b->offset.x &&
+		a->offset.y == b->offset.y;
+}
+
 void wlr_xdg_popup_unconstrain_from_box(struct wlr_xdg_popup *popup,
 		const struct wlr_box *toplevel_space_box) {
 	int toplevel_sx, toplevel_sy;
@@ -501,7 +518,24 @@ void wlr_xdg_popup_unconstrain_from_box(struct wlr_xdg_popup *popup,
 		.width = toplevel_space_box->width,
 		.height = toplevel_space_box->height,
 	};
-	wlr_xdg_positioner_rules_unconstrain_box(&popup->scheduled.rules,
-		&popup_constraint, &popup->scheduled.geometry);
+
+	// Popups tracking the pointer may be re-positioned many times with the
+	// same rules, skip the flip, slide and resize passes then
+	struct wlr_box *geometry = &popup->scheduled.geometry;
+	if (popup->unconstrain_cache.valid &&
+			box_equal(&popup->unconstrain_cache.constraint, &popup_constraint) &&
+			box_equal(&popup->unconstrain_cache.geometry, geometry) &&
+			positioner_rules_equal(&popup->unconstrain_cache.rules,
+				&popup->scheduled.rules)) {
+		*geometry = popup->unconstrain_cache.result;
+	} else {
+		popup->unconstrain_cache.valid = true;
+		popup->unconstrain_cache.rules = popup->scheduled.rules;
+		popup->unconstrain_cache.constraint = popup_constraint;
+		popup->unconstrain_cache.geometry = *geometry;
+		wlr_xdg_positioner_rules_unconstrain_box(&popup->scheduled.rules,
+			&popup_constraint, geometry);
+		popup->unconstrain_cache.result = *geometry;
+	}
 	wlr_xdg_surface_schedule_configure(popup->base);
 }
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <wlr/types/wlr_output.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include "types/wlr_xdg_shell.h"
@@ -61,6 +62,11 @@ void unmap_xdg_surface(struct wlr_xdg_surface *surface) {
 		wl_event_source_remove(surface->configure_idle);
 		surface->configure_idle = NULL;
 	}
+	if (surface->configure_frame_pending) {
+		wl_list_remove(&surface->configure_output_frame.link);
+		wl_list_init(&surface->configure_output_frame.link);
+		surface->configure_frame_pending = false;
+	}
 }
 
 static void xdg_surface_handle_ack_configure(struct wl_client *client,
@@ -157,10 +163,32 @@ static void surface_send_configure(void *user_data) {
 	xdg_surface_send_configure(surface->resource, configure->serial);
 }
 
+static void surface_handle_configure_output_frame(struct wl_listener *listener,
+		void *data) {
+	struct wlr_xdg_surface *surface =
+		wl_container_of(listener, surface, configure_output_frame);
+	wl_list_remove(&surface->configure_output_frame.link);
+	wl_list_init(&surface->configure_output_frame.link);
+	surface->configure_frame_pending = false;
+	surface_send_configure(surface);
+}
+
 uint32_t wlr_xdg_surface_schedule_configure(struct wlr_xdg_surface *surface) {
 	struct wl_display *display = wl_client_get_display(surface->client->client);
 	struct wl_event_loop *loop = wl_display_get_event_loop(display);
 
+	if (surface->configure_output != NULL) {
+		if (!surface->configure_frame_pending) {
+			surface->scheduled_serial = wl_display_next_serial(display);
+			surface->configure_frame_pending = true;
+			wl_signal_add(&surface->configure_output->events.frame,
+				&surface->configure_output_frame);
+			// Idle outputs don't emit frame events on their own
+			wlr_output_schedule_frame(surface->configure_output);
+		}
+		return surface->scheduled_serial;
+	}
+
 	if (surface->configure_idle == NULL) {
 		surface->scheduled_serial = wl_display_next_serial(display);
 		surface->configure_idle = wl_event_loop_add_idle(loop,
@@ -172,6 +200,63 @@ uint32_t wlr_xdg_surface_schedule_configure(struct wlr_xdg_surface *surface) {
 	return surface->scheduled_serial;
 }
 
+static void surface_reset_configure_output(struct wlr_xdg_surface *surface) {
+	if (surface->configure_output == NULL) {
+		return;
+	}
+
+	wl_list_remove(&surface->configure_output_destroy.link);
+	wl_list_init(&surface->configure_output_destroy.link);
+	surface->configure_output = NULL;
+
+	if (surface->configure_frame_pending) {
+		// Send the pending configure with its serial once idle instead
+		wl_list_remove(&surface->configure_output_frame.link);
+		wl_list_init(&surface->configure_output_frame.link);
+		surface->configure_frame_pending = false;
+
+		struct wl_display *display =
+			wl_client_get_display(surface->client->client);
+		struct wl_event_loop *loop = wl_display_get_event_loop(display);
+		surface->configure_idle = wl_event_loop_add_idle(loop,
+			surface_send_configure, surface);
+		if (surface->configure_idle == NULL) {
+			wl_client_post_no_memory(surface->client->client);
+		}
+	}
+}
+
+static void surface_handle_configure_output_destroy(
+		struct wl_listener *listener, void *data) {
+	struct wlr_xdg_surface *surface =
+		wl_container_of(listener, surface, configure_output_destroy);
+	surface_reset_configure_output(surface);
+}
+
+void wlr_xdg_surface_set_configure_output(struct wlr_xdg_surface *surface,
+		struct wlr_output *output) {
+	if (surface->configure_output == output) {
+		return;
+	}
+
+	surface_reset_configure_output(surface);
+	if (output == NULL) {
+		return;
+	}
+
+	surface->configure_output = output;
+	wl_signal_add(&output->events.destroy, &surface->configure_output_destroy);
+
+	if (surface->configure_idle != NULL) {
+		// Delay the already scheduled configure to the next frame
+		wl_event_source_remove(surface->configure_idle);
+		surface->configure_idle = NULL;
+		surface->configure_frame_pending = true;
+		wl_signal_add(&output->events.frame, &surface->configure_output_frame);
+		wlr_output_schedule_frame(output);
+	}
+}
+
 static void xdg_surface_handle_get_popup(struct wl_client *client,
 		struct wl_resource *resource, uint32_t id,
 		struct wl_resource *parent_resource,
@@ -371,6 +456,12 @@ struct wlr_xdg_surface *create_xdg_surface(
 
 	wl_list_init(&surface->configure_list);
 	wl_list_init(&surface->popups);
+	wl_list_init(&surface->configure_output_frame.link);
+	wl_list_init(&surface->configure_output_destroy.link);
+	surface->configure_output_frame.notify =
+		surface_handle_configure_output_frame;
+	surface->configure_output_destroy.notify =
+		surface_handle_configure_output_destroy;
 
 	wl_signal_init(&surface->events.destroy);
 	wl_signal_init(&surface->events.ping_timeout);
@@ -434,6 +525,8 @@ void destroy_xdg_surface(struct wlr_xdg_surface *surface) {
 	wl_list_remove(&surface->link);
 	wl_list_remove(&surface->surface_destroy.link);
 	wl_list_remove(&surface->surface_commit.link);
+	wl_list_remove(&surface->configure_output_frame.link);
+	wl_list_remove(&surface->configure_output_destroy.link);
 	free(surface);
 }
 
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wayland-server-core.h>
@@ -16,30 +17,54 @@ void wlr_addon_set_finish(struct wlr_addon_set *set) {
 	}
 }
 
+static size_t cache_index(const void *owner,
+		const struct wlr_addon_interface *impl) {
+	uint64_t hash = ((uint64_t)(uintptr_t)owner ^ (uintptr_t)impl) *
+		0x9E3779B97F4A7C15ull;
+	return (size_t)(hash >> 32) % WLR_ADDON_SET_CACHE_SIZE;
+}
+
 void wlr_addon_init(struct wlr_addon *addon, struct wlr_addon_set *set,
 		const void *owner, const struct wlr_addon_interface *impl) {
 	assert(owner && impl);
 	memset(addon, 0, sizeof(*addon));
+#ifndef NDEBUG
 	struct wlr_addon *iter;
 	wl_list_for_each(iter, &set->addons, link) {
-		if (iter->owner == addon->owner && iter->impl == addon->impl) {
+		if (iter->owner == owner && iter->impl == impl) {
 			assert(0 && "Can't have two addons of the same type with the same owner");
 		}
 	}
+#endif
 	wl_list_insert(&set->addons, &addon->link);
 	addon->owner = owner;
 	addon->impl = impl;
+	addon->set = set;
 }
 
 void wlr_addon_finish(struct wlr_addon *addon) {
+	struct wlr_addon **cached =
+		&addon->set->cache[cache_index(addon->owner, addon->impl)];
+	if (*cached == addon) {
+		*cached = NULL;
+	}
 	wl_list_remove(&addon->link);
 }
 
 struct wlr_addon *wlr_addon_find(struct wlr_addon_set *set, const void *owner,
 		const struct wlr_addon_interface *impl) {
+	// Buffers are looked up by each renderer, the DRM backend and the
+	// scene-graph every frame
+	struct wlr_addon **cached = &set->cache[cache_index(owner, impl)];
+	if (*cached != NULL && (*cached)->owner == owner &&
+			(*cached)->impl == impl) {
+		return *cached;
+	}
+
 	struct wlr_addon *addon;
 	wl_list_for_each(addon, &set->addons, link) {
 		if (addon->owner == owner && addon->impl == impl) {
+			*cached = addon;
 			return addon;
 		}
 	}
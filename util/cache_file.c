@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "util/cache_file.h"
+
+char *cache_file_get_path(const char *name, bool create_dir) {
+	char dir[4096];
+	const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n;
+	if (xdg_cache_home != NULL && xdg_cache_home[0] == '/') {
+		n = snprintf(dir, sizeof(dir), "%s/wlroots", xdg_cache_home);
+	} else if (home != NULL && home[0] == '/') {
+		n = snprintf(dir, sizeof(dir), "%s/.cache/wlroots", home);
+	} else {
+		return NULL;
+	}
+	if (n < 0 || (size_t)n >= sizeof(dir)) {
+		return NULL;
+	}
+
+	if (create_dir) {
+		// Create every missing component, ~/.cache may not exist yet
+		for (char *p = strchr(dir + 1, '/'); ; p = strchr(p + 1, '/')) {
+			if (p != NULL) {
+				*p = '\0';
+			}
+			if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+				wlr_log_errno(WLR_DEBUG, "Failed to create %s", dir);
+				return NULL;
+			}
+			if (p == NULL) {
+				break;
+			}
+			*p = '/';
+		}
+	}
+
+	char path[4096 + 256];
+	n = snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (n < 0 || (size_t)n >= sizeof(path)) {
+		return NULL;
+	}
+	return strdup(path);
+}
+
+void *cache_file_read(const char *path, size_t max_size, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			wlr_log_errno(WLR_DEBUG, "Failed to open %s", path);
+		}
+		return NULL;
+	}
+
+	void *data = NULL;
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0 || st.st_size <= 0 ||
+			(size_t)st.st_size > max_size) {
+		goto out;
+	}
+
+	data = malloc(st.st_size);
+	if (data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		goto out;
+	}
+	if (fread(data, 1, st.st_size, f) != (size_t)st.st_size) {
+		wlr_log(WLR_DEBUG, "Failed to read %s", path);
+		free(data);
+		data = NULL;
+		goto out;
+	}
+	*size = st.st_size;
+
+out:
+	fclose(f);
+	return data;
+}
+
+const void *cache_read_bytes(struct cache_reader *r, size_t len) {
+	if (r->failed || r->size - r->pos < len) {
+		r->failed = true;
+		return NULL;
+	}
+	const void *p = r->data + r->pos;
+	r->pos += len;
+	return p;
+}
+
+uint32_t cache_read_u32(struct cache_reader *r) {
+	uint32_t v = 0;
+	const void *p = cache_read_bytes(r, sizeof(v));
+	if (p != NULL) {
+		memcpy(&v, p, sizeof(v));
+	}
+	return v;
+}
+
+uint64_t cache_read_u64(struct cache_reader *r) {
+	uint64_t v = 0;
+	const void *p = cache_read_bytes(r, sizeof(v));
+	if (p != NULL) {
+		memcpy(&v, p, sizeof(v));
+	}
+	return v;
+}
+
+bool cache_writer_open(struct cache_writer *w, const char *path) {
+	*w = (struct cache_writer){0};
+
+	size_t len = strlen(path) + 8;
+	w->path = strdup(path);
+	w->tmp_path = malloc(len);
+	if (w->path == NULL || w->tmp_path == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		goto error;
+	}
+	snprintf(w->tmp_path, len, "%s.XXXXXX", path);
+
+	int fd = mkstemp(w->tmp_path);
+	if (fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to create %s", w->tmp_path);
+		goto error;
+	}
+	w->f = fdopen(fd, "wb");
+	if (w->f == NULL) {
+		wlr_log_errno(WLR_DEBUG, "Failed to open %s", w->tmp_path);
+		close(fd);
+		unlink(w->tmp_path);
+		goto error;
+	}
+	return true;
+
+error:
+	free(w->path);
+	free(w->tmp_path);
+	return false;
+}
+
+void cache_write_bytes(struct cache_writer *w, const void *data, size_t len) {
+	if (!w->failed && fwrite(data, 1, len, w->f) != len) {
+		w->failed = true;
+	}
+}
+
+void cache_write_u32(struct cache_writer *w, uint32_t v) {
+	cache_write_bytes(w, &v, sizeof(v));
+}
+
+void cache_write_u64(struct cache_writer *w, uint64_t v) {
+	cache_write_bytes(w, &v, sizeof(v));
+}
+
+bool cache_writer_finish(struct cache_writer *w) {
+	bool ok = fclose(w->f) == 0 && !w->failed;
+	if (ok && rename(w->tmp_path, w->path) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		wlr_log_errno(WLR_DEBUG, "Failed to write %s", w->path);
+		unlink(w->tmp_path);
+	}
+	free(w->path);
+	free(w->tmp_path);
+	return ok;
+}
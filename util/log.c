@@ -1,6 +1,14 @@
 #define _XOPEN_SOURCE 700 // for snprintf
+#include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +16,7 @@
 #include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/util/log.h>
+#include "util/log.h"
 #include "util/time.h"
 
 static bool colored = true;
@@ -35,6 +44,164 @@ static void init_start_time(void) {
 	clock_gettime(CLOCK_MONOTONIC, &start_time);
 }
 
+#define ASYNC_LINE_MAX 2048
+#define MIN_ASYNC_BUFFER_SIZE 4096
+
+/**
+ * Single-producer single-consumer ring of formatted lines. The producer is
+ * the thread which enabled asynchronous logging, the consumer is the writer
+ * thread. head and tail only ever grow, the ring only holds whole lines.
+ */
+struct log_ring {
+	char *data;
+	size_t size; // power of two
+	enum wlr_log_async_overflow overflow;
+	pthread_t producer;
+	bool colored; // colors are enabled and stderr is a TTY
+	int wake_fds[2];
+	pthread_t writer;
+
+	_Atomic size_t head; // written by the producer
+	_Atomic size_t tail; // written by the consumer
+	_Atomic uint64_t dropped;
+	_Atomic bool writer_waiting;
+	_Atomic bool stop; // the writer exits once the ring is empty
+};
+
+static struct log_ring *log_ring = NULL;
+
+static void write_all(const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(STDERR_FILENO, data, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+static void ring_write_range(struct log_ring *ring, size_t tail, size_t head) {
+	size_t start = tail & (ring->size - 1);
+	size_t len = head - tail;
+	size_t first = len < ring->size - start ? len : ring->size - start;
+	write_all(ring->data + start, first);
+	write_all(ring->data, len - first);
+}
+
+static void ring_write_dropped(struct log_ring *ring) {
+	uint64_t dropped = atomic_exchange(&ring->dropped, 0);
+	if (dropped > 0) {
+		char notice[64];
+		int n = snprintf(notice, sizeof(notice),
+			"[wlr_log] %" PRIu64 " messages dropped\n", dropped);
+		write_all(notice, n);
+	}
+}
+
+static void *log_writer_thread(void *data) {
+	struct log_ring *ring = data;
+	while (true) {
+		ring_write_dropped(ring);
+
+		size_t tail = atomic_load(&ring->tail);
+		size_t head = atomic_load(&ring->head);
+		if (head == tail) {
+			if (atomic_load(&ring->stop)) {
+				break;
+			}
+			// Ask the producer for a wake-up, and check again in case it
+			// published a line in between
+			atomic_store(&ring->writer_waiting, true);
+			if (atomic_load(&ring->head) != tail) {
+				atomic_store(&ring->writer_waiting, false);
+				continue;
+			}
+			struct pollfd pfd = { .fd = ring->wake_fds[0], .events = POLLIN };
+			if (poll(&pfd, 1, -1) > 0) {
+				char buf[64];
+				while (read(ring->wake_fds[0], buf, sizeof(buf)) > 0) {
+					// Drain the wake-ups
+				}
+			}
+			continue;
+		}
+
+		ring_write_range(ring, tail, head);
+		atomic_store(&ring->tail, head);
+	}
+	return NULL;
+}
+
+static bool ring_push(struct log_ring *ring, const char *line, size_t len) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	while (ring->size - (head - atomic_load(&ring->tail)) < len) {
+		if (ring->overflow == WLR_LOG_ASYNC_DROP) {
+			atomic_fetch_add(&ring->dropped, 1);
+			return false;
+		}
+		// WLR_LOG_ASYNC_WAIT: let the writer thread make room
+		struct timespec delay = { .tv_nsec = 100 * 1000 };
+		nanosleep(&delay, NULL);
+	}
+
+	size_t start = head & (ring->size - 1);
+	size_t first = len < ring->size - start ? len : ring->size - start;
+	memcpy(ring->data + start, line, first);
+	memcpy(ring->data, line + first, len - first);
+	atomic_store(&ring->head, head + len);
+
+	if (atomic_exchange(&ring->writer_waiting, false)) {
+		char c = 0;
+		if (write(ring->wake_fds[1], &c, 1) < 0) {
+			// The pipe is full, the writer thread will wake up anyway
+		}
+	}
+	return true;
+}
+
+static void log_async(struct log_ring *ring, enum wlr_log_importance verbosity,
+		const char *fmt, va_list args) {
+	struct timespec ts = {0};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	timespec_sub(&ts, &ts, &start_time);
+
+	unsigned c = (verbosity < WLR_LOG_IMPORTANCE_LAST) ? verbosity : WLR_LOG_IMPORTANCE_LAST - 1;
+
+	char line[ASYNC_LINE_MAX];
+	// Keep room for the color reset sequence and the newline
+	size_t max = sizeof(line) - 6;
+	int n = snprintf(line, max, "%02d:%02d:%02d.%03ld %s%s",
+		(int)(ts.tv_sec / 60 / 60), (int)(ts.tv_sec / 60 % 60),
+		(int)(ts.tv_sec % 60), ts.tv_nsec / 1000000,
+		ring->colored ? verbosity_colors[c] : verbosity_headers[c],
+		ring->colored ? "" : " ");
+	size_t len = n > 0 ? (size_t)n : 0;
+	if (len < max) {
+		n = vsnprintf(line + len, max - len, fmt, args);
+		if (n > 0) {
+			len += (size_t)n < max - len ? (size_t)n : max - len - 1;
+		}
+	} else {
+		len = max - 1;
+	}
+	if (ring->colored) {
+		memcpy(line + len, "\x1B[0m", 4);
+		len += 4;
+	}
+	line[len++] = '\n';
+
+	if (!pthread_equal(pthread_self(), ring->producer)) {
+		// Only a single thread may push to the ring
+		write_all(line, len);
+		return;
+	}
+	ring_push(ring, line, len);
+}
+
 static void log_stderr(enum wlr_log_importance verbosity, const char *fmt,
 		va_list args) {
 	init_start_time();
@@ -43,6 +210,11 @@ static void log_stderr(enum wlr_log_importance verbosity, const char *fmt,
 		return;
 	}
 
+	if (log_ring != NULL) {
+		log_async(log_ring, verbosity, fmt, args);
+		return;
+	}
+
 	struct timespec ts = {0};
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 	timespec_sub(&ts, &ts, &start_time);
@@ -91,17 +263,178 @@ void wlr_log_init(enum wlr_log_importance verbosity, wlr_log_func_t callback) {
 	wl_log_set_handler_server(log_wl);
 }
 
-void _wlr_vlog(enum wlr_log_importance verbosity, const char *fmt, va_list args) {
+struct log_capture_message {
+	enum wlr_log_importance verbosity;
+	char *text;
+};
+
+static _Thread_local struct log_capture *thread_capture = NULL;
+
+static void capture_message(struct log_capture *capture,
+		enum wlr_log_importance verbosity, const char *fmt, va_list args) {
+	va_list args_copy;
+	va_copy(args_copy, args);
+	int len = vsnprintf(NULL, 0, fmt, args_copy);
+	va_end(args_copy);
+	if (len < 0) {
+		return;
+	}
+
+	// There is nowhere to report allocation failures to
+	char *text = malloc((size_t)len + 1);
+	struct log_capture_message *msg = NULL;
+	if (text != NULL) {
+		msg = wl_array_add(&capture->messages, sizeof(*msg));
+	}
+	if (msg == NULL) {
+		free(text);
+		return;
+	}
+	vsnprintf(text, (size_t)len + 1, fmt, args);
+	*msg = (struct log_capture_message){
+		.verbosity = verbosity,
+		.text = text,
+	};
+}
+
+static void log_message(enum wlr_log_importance verbosity, const char *fmt,
+		va_list args) {
+	if (thread_capture != NULL) {
+		capture_message(thread_capture, verbosity, fmt, args);
+		return;
+	}
 	log_callback(verbosity, fmt, args);
 }
 
+void _wlr_vlog(enum wlr_log_importance verbosity, const char *fmt, va_list args) {
+	log_message(verbosity, fmt, args);
+}
+
 void _wlr_log(enum wlr_log_importance verbosity, const char *fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
-	log_callback(verbosity, fmt, args);
+	log_message(verbosity, fmt, args);
 	va_end(args);
 }
 
+void log_capture_begin(struct log_capture *capture) {
+	assert(thread_capture == NULL);
+	wl_array_init(&capture->messages);
+	thread_capture = capture;
+}
+
+void log_capture_end(void) {
+	thread_capture = NULL;
+}
+
+void log_capture_replay(struct log_capture *capture) {
+	struct log_capture_message *msg;
+	wl_array_for_each(msg, &capture->messages) {
+		_wlr_log(msg->verbosity, "%s", msg->text);
+		free(msg->text);
+	}
+	wl_array_release(&capture->messages);
+	wl_array_init(&capture->messages);
+}
+
 enum wlr_log_importance wlr_log_get_verbosity(void) {
 	return log_importance;
 }
+
+void wlr_log_flush(void) {
+	struct log_ring *ring = log_ring;
+	if (ring == NULL) {
+		return;
+	}
+
+	// Only uses async-signal-safe operations. The range is left to the
+	// writer thread, which may still be writing it: lines may be repeated,
+	// but never overwritten while being written.
+	size_t tail = atomic_load(&ring->tail);
+	size_t head = atomic_load(&ring->head);
+	if (head != tail) {
+		ring_write_range(ring, tail, head);
+	}
+}
+
+static void handle_exit(void) {
+	struct log_ring *ring = log_ring;
+
+	// Let the writer thread drain the ring, then write what the producer
+	// pushed in the meantime
+	atomic_store(&ring->stop, true);
+	char c = 0;
+	if (write(ring->wake_fds[1], &c, 1) < 0) {
+		// The pipe is full, the writer thread will wake up anyway
+	}
+	pthread_join(ring->writer, NULL);
+
+	ring_write_dropped(ring);
+	size_t tail = atomic_load(&ring->tail);
+	size_t head = atomic_load(&ring->head);
+	if (head != tail) {
+		ring_write_range(ring, tail, head);
+		atomic_store(&ring->tail, head);
+	}
+
+	// Messages logged by later exit handlers are written synchronously
+	log_ring = NULL;
+}
+
+bool wlr_log_init_async(size_t buffer_size,
+		enum wlr_log_async_overflow overflow) {
+	init_start_time();
+
+	if (log_ring != NULL) {
+		return true;
+	}
+
+	struct log_ring *ring = calloc(1, sizeof(*ring));
+	if (ring == NULL) {
+		return false;
+	}
+	ring->size = MIN_ASYNC_BUFFER_SIZE;
+	while (ring->size < buffer_size) {
+		ring->size *= 2;
+	}
+	ring->data = malloc(ring->size);
+	if (ring->data == NULL) {
+		goto error_ring;
+	}
+	ring->overflow = overflow;
+	ring->producer = pthread_self();
+	ring->colored = colored && isatty(STDERR_FILENO);
+
+	if (pipe(ring->wake_fds) != 0) {
+		goto error_data;
+	}
+	for (size_t i = 0; i < 2; i++) {
+		int flags = fcntl(ring->wake_fds[i], F_GETFD);
+		fcntl(ring->wake_fds[i], F_SETFD, flags | FD_CLOEXEC);
+		flags = fcntl(ring->wake_fds[i], F_GETFL);
+		fcntl(ring->wake_fds[i], F_SETFL, flags | O_NONBLOCK);
+	}
+
+	// The writer thread must not steal signals from the compositor
+	sigset_t all, prev;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &prev);
+	int ret = pthread_create(&ring->writer, NULL, log_writer_thread, ring);
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (ret != 0) {
+		goto error_pipe;
+	}
+
+	log_ring = ring;
+	atexit(handle_exit);
+	return true;
+
+error_pipe:
+	close(ring->wake_fds[0]);
+	close(ring->wake_fds[1]);
+error_data:
+	free(ring->data);
+error_ring:
+	free(ring);
+	return false;
+}
@@ -4,6 +4,268 @@
 #include <stdlib.h>
 #include <wlr/util/region.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Regions with up to this many rectangles are processed without allocating
+// temporary storage
+#define STACK_RECTS 32
+
+static pixman_box32_t *boxes_alloc(pixman_box32_t stack[static STACK_RECTS],
+		int nrects) {
+	if (nrects <= STACK_RECTS) {
+		return stack;
+	}
+	return malloc(nrects * sizeof(pixman_box32_t));
+}
+
+/**
+ * Replace dst with the region made of the boxes, and release their storage.
+ * dst may be the region the boxes have been computed from.
+ */
+static void boxes_finish(pixman_region32_t *dst, pixman_box32_t *boxes,
+		int nrects, pixman_box32_t stack[static STACK_RECTS]) {
+	pixman_region32_fini(dst);
+	pixman_region32_init_rects(dst, boxes, nrects);
+	if (boxes != stack) {
+		free(boxes);
+	}
+}
+
+/*
+ * Box kernels, used by the region helpers. Each box fits in a 128-bit vector,
+ * which SSE2 and NEON (part of the x86-64 and AArch64 baselines) process in
+ * one go, no build option is needed. The scalar loops are the reference the vector code must match.
+ */
+
+#if defined(__SSE2__)
+
+static __m128i mullo_epi32(__m128i a, __m128i b) {
+	// SSE2 only multiplies the even lanes, into 64 bits
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static void scale_boxes_int(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, int32_t scale_x, int32_t scale_y) {
+	__m128i scale = _mm_setr_epi32(scale_x, scale_y, scale_x, scale_y);
+	for (int i = 0; i < len; ++i) {
+		__m128i box = _mm_loadu_si128((const __m128i *)&src[i]);
+		_mm_storeu_si128((__m128i *)&dst[i], mullo_epi32(box, scale));
+	}
+}
+
+static void scale_boxes_float(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, float scale_x, float scale_y) {
+	__m128 scale = _mm_setr_ps(scale_x, scale_y, scale_x, scale_y);
+	// Round the top-left corner down and the bottom-right corner up
+	__m128i floor_mask = _mm_setr_epi32(-1, -1, 0, 0);
+	__m128i one = _mm_set1_epi32(1);
+	for (int i = 0; i < len; ++i) {
+		__m128i box = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128 v = _mm_mul_ps(_mm_cvtepi32_ps(box), scale);
+		// SSE2 can only truncate, fix up the lanes rounded the wrong way
+		__m128i t = _mm_cvttps_epi32(v);
+		__m128 tf = _mm_cvtepi32_ps(t);
+		__m128i above = _mm_castps_si128(_mm_cmpgt_ps(tf, v));
+		__m128i below = _mm_castps_si128(_mm_cmplt_ps(tf, v));
+		__m128i adjust = _mm_or_si128(
+			_mm_and_si128(floor_mask, _mm_sub_epi32(_mm_setzero_si128(),
+				_mm_and_si128(above, one))),
+			_mm_andnot_si128(floor_mask, _mm_and_si128(below, one)));
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_add_epi32(t, adjust));
+	}
+}
+
+static void transform_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, bool swap, bool flip_x, bool flip_y,
+		int32_t extent_x, int32_t extent_y) {
+	__m128i extent = _mm_setr_epi32(extent_x, extent_y, extent_x, extent_y);
+	__m128i flip = _mm_setr_epi32(flip_x ? -1 : 0, flip_y ? -1 : 0,
+		flip_x ? -1 : 0, flip_y ? -1 : 0);
+	for (int i = 0; i < len; ++i) {
+		__m128i box = _mm_loadu_si128((const __m128i *)&src[i]);
+		if (swap) {
+			box = _mm_shuffle_epi32(box, _MM_SHUFFLE(2, 3, 0, 1));
+		}
+		// Mirrored corners swap places: x1' = extent - x2
+		__m128i mirrored = _mm_sub_epi32(extent,
+			_mm_shuffle_epi32(box, _MM_SHUFFLE(1, 0, 3, 2)));
+		box = _mm_or_si128(_mm_and_si128(flip, mirrored),
+			_mm_andnot_si128(flip, box));
+		_mm_storeu_si128((__m128i *)&dst[i], box);
+	}
+}
+
+static void expand_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, int32_t distance) {
+	__m128i delta = _mm_setr_epi32(-distance, -distance, distance, distance);
+	for (int i = 0; i < len; ++i) {
+		__m128i box = _mm_loadu_si128((const __m128i *)&src[i]);
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_add_epi32(box, delta));
+	}
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static void scale_boxes_int(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, int32_t scale_x, int32_t scale_y) {
+	const int32_t scale_values[] = { scale_x, scale_y, scale_x, scale_y };
+	int32x4_t scale = vld1q_s32(scale_values);
+	for (int i = 0; i < len; ++i) {
+		int32x4_t box = vld1q_s32((const int32_t *)&src[i]);
+		vst1q_s32((int32_t *)&dst[i], vmulq_s32(box, scale));
+	}
+}
+
+static void scale_boxes_float(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, float scale_x, float scale_y) {
+	const float scale_values[] = { scale_x, scale_y, scale_x, scale_y };
+	float32x4_t scale = vld1q_f32(scale_values);
+	// Round the top-left corner down and the bottom-right corner up
+	const uint32_t floor_values[] = { UINT32_MAX, UINT32_MAX, 0, 0 };
+	uint32x4_t floor_mask = vld1q_u32(floor_values);
+	for (int i = 0; i < len; ++i) {
+		int32x4_t box = vld1q_s32((const int32_t *)&src[i]);
+		float32x4_t v = vmulq_f32(vcvtq_f32_s32(box), scale);
+		int32x4_t down = vcvtmq_s32_f32(v);
+		int32x4_t up = vcvtpq_s32_f32(v);
+		vst1q_s32((int32_t *)&dst[i], vbslq_s32(floor_mask, down, up));
+	}
+}
+
+static void transform_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, bool swap, bool flip_x, bool flip_y,
+		int32_t extent_x, int32_t extent_y) {
+	const int32_t extent_values[] = { extent_x, extent_y, extent_x, extent_y };
+	int32x4_t extent = vld1q_s32(extent_values);
+	const uint32_t flip_values[] = {
+		flip_x ? UINT32_MAX : 0, flip_y ? UINT32_MAX : 0,
+		flip_x ? UINT32_MAX : 0, flip_y ? UINT32_MAX : 0,
+	};
+	uint32x4_t flip = vld1q_u32(flip_values);
+	for (int i = 0; i < len; ++i) {
+		int32x4_t box = vld1q_s32((const int32_t *)&src[i]);
+		if (swap) {
+			box = vrev64q_s32(box);
+		}
+		// Mirrored corners swap places: x1' = extent - x2
+		int32x4_t mirrored = vsubq_s32(extent, vextq_s32(box, box, 2));
+		vst1q_s32((int32_t *)&dst[i], vbslq_s32(flip, mirrored, box));
+	}
+}
+
+static void expand_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, int32_t distance) {
+	const int32_t delta_values[] = { -distance, -distance, distance, distance };
+	int32x4_t delta = vld1q_s32(delta_values);
+	for (int i = 0; i < len; ++i) {
+		int32x4_t box = vld1q_s32((const int32_t *)&src[i]);
+		vst1q_s32((int32_t *)&dst[i], vaddq_s32(box, delta));
+	}
+}
+
+#else
+
+static void scale_boxes_int(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, int32_t scale_x, int32_t scale_y) {
+	for (int i = 0; i < len; ++i) {
+		dst[i].x1 = src[i].x1 * scale_x;
+		dst[i].x2 = src[i].x2 * scale_x;
+		dst[i].y1 = src[i].y1 * scale_y;
+		dst[i].y2 = src[i].y2 * scale_y;
+	}
+}
+
+static void scale_boxes_float(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, float scale_x, float scale_y) {
+	for (int i = 0; i < len; ++i) {
+		dst[i].x1 = floor(src[i].x1 * scale_x);
+		dst[i].x2 = ceil(src[i].x2 * scale_x);
+		dst[i].y1 = floor(src[i].y1 * scale_y);
+		dst[i].y2 = ceil(src[i].y2 * scale_y);
+	}
+}
+
+static void transform_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, bool swap, bool flip_x, bool flip_y,
+		int32_t extent_x, int32_t extent_y) {
+	// The conditions are loop-invariant, so that compilers can hoist them
+	for (int i = 0; i < len; ++i) {
+		const pixman_box32_t *r = &src[i];
+		int32_t x1 = swap ? r->y1 : r->x1, x2 = swap ? r->y2 : r->x2;
+		int32_t y1 = swap ? r->x1 : r->y1, y2 = swap ? r->x2 : r->y2;
+		dst[i].x1 = flip_x ? extent_x - x2 : x1;
+		dst[i].x2 = flip_x ? extent_x - x1 : x2;
+		dst[i].y1 = flip_y ? extent_y - y2 : y1;
+		dst[i].y2 = flip_y ? extent_y - y1 : y2;
+	}
+}
+
+static void expand_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, int32_t distance) {
+	for (int i = 0; i < len; ++i) {
+		dst[i].x1 = src[i].x1 - distance;
+		dst[i].x2 = src[i].x2 + distance;
+		dst[i].y1 = src[i].y1 - distance;
+		dst[i].y2 = src[i].y2 + distance;
+	}
+}
+
+#endif
+
+void wlr_region_scale_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, float scale_x, float scale_y) {
+	int32_t int_scale_x = scale_x, int_scale_y = scale_y;
+	if (int_scale_x == scale_x && int_scale_y == scale_y) {
+		// Integer scales don't need rounding, e.g. on HiDPI outputs
+		scale_boxes_int(dst, src, len, int_scale_x, int_scale_y);
+	} else {
+		scale_boxes_float(dst, src, len, scale_x, scale_y);
+	}
+}
+
+void wlr_region_transform_boxes(pixman_box32_t *dst,
+		const pixman_box32_t *src, int len,
+		enum wl_output_transform transform, int width, int height) {
+	// Every transform swaps the axes or not, then mirrors each axis or not
+	bool swap = transform & WL_OUTPUT_TRANSFORM_90;
+	bool flip_x, flip_y;
+	switch (transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		flip_x = true;
+		flip_y = false;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		flip_x = flip_y = true;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		flip_x = false;
+		flip_y = true;
+		break;
+	default:
+		flip_x = flip_y = false;
+		break;
+	}
+	int32_t extent_x = swap ? height : width;
+	int32_t extent_y = swap ? width : height;
+
+	transform_boxes(dst, src, len, swap, flip_x, flip_y, extent_x, extent_y);
+}
+
+void wlr_region_expand_boxes(pixman_box32_t *dst, const pixman_box32_t *src,
+		int len, int distance) {
+	expand_boxes(dst, src, len, distance);
+}
+
 void wlr_region_scale(pixman_region32_t *dst, pixman_region32_t *src,
 		float scale) {
 	wlr_region_scale_xy(dst, src, scale, scale);
@@ -19,21 +281,14 @@ void wlr_region_scale_xy(pixman_region32_t *dst, pixman_region32_t *src,
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack[STACK_RECTS];
+	pixman_box32_t *dst_rects = boxes_alloc(stack, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
 
-	for (int i = 0; i < nrects; ++i) {
-		dst_rects[i].x1 = floor(src_rects[i].x1 * scale_x);
-		dst_rects[i].x2 = ceil(src_rects[i].x2 * scale_x);
-		dst_rects[i].y1 = floor(src_rects[i].y1 * scale_y);
-		dst_rects[i].y2 = ceil(src_rects[i].y2 * scale_y);
-	}
-
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	wlr_region_scale_boxes(dst_rects, src_rects, nrects, scale_x, scale_y);
+	boxes_finish(dst, dst_rects, nrects, stack);
 }
 
 void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
@@ -46,67 +301,15 @@ void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack[STACK_RECTS];
+	pixman_box32_t *dst_rects = boxes_alloc(stack, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
 
-	for (int i = 0; i < nrects; ++i) {
-		switch (transform) {
-		case WL_OUTPUT_TRANSFORM_NORMAL:
-			dst_rects[i].x1 = src_rects[i].x1;
-			dst_rects[i].y1 = src_rects[i].y1;
-			dst_rects[i].x2 = src_rects[i].x2;
-			dst_rects[i].y2 = src_rects[i].y2;
-			break;
-		case WL_OUTPUT_TRANSFORM_90:
-			dst_rects[i].x1 = height - src_rects[i].y2;
-			dst_rects[i].y1 = src_rects[i].x1;
-			dst_rects[i].x2 = height - src_rects[i].y1;
-			dst_rects[i].y2 = src_rects[i].x2;
-			break;
-		case WL_OUTPUT_TRANSFORM_180:
-			dst_rects[i].x1 = width - src_rects[i].x2;
-			dst_rects[i].y1 = height - src_rects[i].y2;
-			dst_rects[i].x2 = width - src_rects[i].x1;
-			dst_rects[i].y2 = height - src_rects[i].y1;
-			break;
-		case WL_OUTPUT_TRANSFORM_270:
-			dst_rects[i].x1 = src_rects[i].y1;
-			dst_rects[i].y1 = width - src_rects[i].x2;
-			dst_rects[i].x2 = src_rects[i].y2;
-			dst_rects[i].y2 = width - src_rects[i].x1;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED:
-			dst_rects[i].x1 = width - src_rects[i].x2;
-			dst_rects[i].y1 = src_rects[i].y1;
-			dst_rects[i].x2 = width - src_rects[i].x1;
-			dst_rects[i].y2 = src_rects[i].y2;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-			dst_rects[i].x1 = src_rects[i].y1;
-			dst_rects[i].y1 = src_rects[i].x1;
-			dst_rects[i].x2 = src_rects[i].y2;
-			dst_rects[i].y2 = src_rects[i].x2;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-			dst_rects[i].x1 = src_rects[i].x1;
-			dst_rects[i].y1 = height - src_rects[i].y2;
-			dst_rects[i].x2 = src_rects[i].x2;
-			dst_rects[i].y2 = height - src_rects[i].y1;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-			dst_rects[i].x1 = height - src_rects[i].y2;
-			dst_rects[i].y1 = width - src_rects[i].x2;
-			dst_rects[i].x2 = height - src_rects[i].y1;
-			dst_rects[i].y2 = width - src_rects[i].x1;
-			break;
-		}
-	}
-
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	wlr_region_transform_boxes(dst_rects, src_rects, nrects, transform,
+		width, height);
+	boxes_finish(dst, dst_rects, nrects, stack);
 }
 
 void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
@@ -119,21 +322,14 @@ void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack[STACK_RECTS];
+	pixman_box32_t *dst_rects = boxes_alloc(stack, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
 
-	for (int i = 0; i < nrects; ++i) {
-		dst_rects[i].x1 = src_rects[i].x1 - distance;
-		dst_rects[i].x2 = src_rects[i].x2 + distance;
-		dst_rects[i].y1 = src_rects[i].y1 - distance;
-		dst_rects[i].y2 = src_rects[i].y2 + distance;
-	}
-
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	wlr_region_expand_boxes(dst_rects, src_rects, nrects, distance);
+	boxes_finish(dst, dst_rects, nrects, stack);
 }
 
 void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
@@ -146,7 +342,8 @@ void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack[STACK_RECTS];
+	pixman_box32_t *dst_rects = boxes_alloc(stack, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -180,9 +377,7 @@ void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,
 		dst_rects[i].y2 = ceil(oy + y2);
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	boxes_finish(dst, dst_rects, nrects, stack);
 }
 
 static void region_confine(pixman_region32_t *region, double x1, double y1, double x2,
@@ -5,6 +5,19 @@ static void handle_noop(struct wl_listener *listener, void *data) {
 }
 
 void wlr_signal_emit_safe(struct wl_signal *signal, void *data) {
+	struct wl_list *head = &signal->listener_list;
+
+	if (head->next == head) {
+		return;
+	}
+	if (head->next->next == head) {
+		/* A single listener can't remove any other listener, and listeners it
+		 * adds end up after it: they wouldn't be called either way */
+		struct wl_listener *l = wl_container_of(head->next, l, link);
+		l->notify(l, data);
+		return;
+	}
+
 	struct wl_listener cursor;
 	struct wl_listener end;
 
@@ -14,17 +27,25 @@ void wlr_signal_emit_safe(struct wl_signal *signal, void *data) {
 	 * function can remove any element it wants from the list without troubles.
 	 * wl_list_for_each_safe tries to be safe but it fails: it works fine
 	 * if the current item is removed, but not if the next one is. */
-	wl_list_insert(&signal->listener_list, &cursor.link);
+	wl_list_insert(head, &cursor.link);
 	cursor.notify = handle_noop;
-	wl_list_insert(signal->listener_list.prev, &end.link);
+	wl_list_insert(head->prev, &end.link);
 	end.notify = handle_noop;
 
 	while (cursor.link.next != &end.link) {
 		struct wl_list *pos = cursor.link.next;
 		struct wl_listener *l = wl_container_of(pos, l, link);
 
-		wl_list_remove(&cursor.link);
-		wl_list_insert(pos, &cursor.link);
+		/* Swap the cursor with the listener about to be called, which is
+		 * cheaper than removing and re-inserting it through libwayland */
+		struct wl_list *prev = cursor.link.prev;
+		struct wl_list *next = pos->next;
+		prev->next = pos;
+		pos->prev = prev;
+		pos->next = &cursor.link;
+		cursor.link.prev = pos;
+		cursor.link.next = next;
+		next->prev = &cursor.link;
 
 		l->notify(l, data);
 	}
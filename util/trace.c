@@ -0,0 +1,119 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "util/trace.h"
+
+#define TRACE_LINE_MAX 256
+
+static const char *trace_marker_paths[] = {
+	"/sys/kernel/tracing/trace_marker",
+	"/sys/kernel/debug/tracing/trace_marker",
+};
+
+static int marker_fd = -1;
+static bool initialized = false;
+static pid_t pid;
+
+static bool trace_enabled(void) {
+	if (initialized) {
+		return marker_fd >= 0;
+	}
+	initialized = true;
+
+	const char *env = getenv("WLR_TRACE");
+	if (env == NULL || strcmp(env, "1") != 0) {
+		return false;
+	}
+
+	for (size_t i = 0; i < sizeof(trace_marker_paths) / sizeof(trace_marker_paths[0]); i++) {
+		marker_fd = open(trace_marker_paths[i], O_WRONLY | O_CLOEXEC);
+		if (marker_fd >= 0) {
+			wlr_log(WLR_INFO, "Writing trace spans to %s",
+				trace_marker_paths[i]);
+			break;
+		}
+	}
+	if (marker_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to open ftrace trace_marker");
+		return false;
+	}
+	pid = getpid();
+	return true;
+}
+
+static void write_marker(const char *prefix, int cookie, bool has_cookie,
+		const char *fmt, va_list args) {
+	char line[TRACE_LINE_MAX];
+	int n = snprintf(line, sizeof(line), "%s|%d|", prefix, (int)pid);
+	if (n < 0 || (size_t)n >= sizeof(line)) {
+		return;
+	}
+	size_t len = n;
+
+	if (fmt != NULL) {
+		n = vsnprintf(line + len, sizeof(line) - len, fmt, args);
+		if (n < 0) {
+			return;
+		}
+		len += (size_t)n < sizeof(line) - len ? (size_t)n : sizeof(line) - len - 1;
+	}
+	if (has_cookie) {
+		n = snprintf(line + len, sizeof(line) - len, "|%d", cookie);
+		if (n < 0 || (size_t)n >= sizeof(line) - len) {
+			return;
+		}
+		len += n;
+	}
+
+	// A single write per marker, the kernel records it atomically
+	if (write(marker_fd, line, len) < 0) {
+		// Tracing might have been stopped, nothing to do
+	}
+}
+
+void trace_begin(const char *fmt, ...) {
+	if (!trace_enabled()) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	write_marker("B", 0, false, fmt, args);
+	va_end(args);
+}
+
+void trace_end(void) {
+	if (!trace_enabled()) {
+		return;
+	}
+	char line[32];
+	int n = snprintf(line, sizeof(line), "E|%d", (int)pid);
+	if (n > 0 && write(marker_fd, line, n) < 0) {
+		// Tracing might have been stopped, nothing to do
+	}
+}
+
+void trace_async_begin(int cookie, const char *fmt, ...) {
+	if (!trace_enabled()) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	write_marker("S", cookie, true, fmt, args);
+	va_end(args);
+}
+
+void trace_async_end(int cookie, const char *fmt, ...) {
+	if (!trace_enabled()) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	write_marker("F", cookie, true, fmt, args);
+	va_end(args);
+}
@@ -25,6 +25,8 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,9 +36,12 @@
 
 static void xcursor_destroy(struct wlr_xcursor *cursor) {
 	for (size_t i = 0; i < cursor->image_count; i++) {
-		free(cursor->images[i]->buffer);
+		if (cursor->shared_images == NULL) {
+			free(cursor->images[i]->buffer);
+		}
 		free(cursor->images[i]);
 	}
+	XcursorImagesDestroy(cursor->shared_images);
 
 	free(cursor->images);
 	free(cursor->name);
@@ -64,6 +69,7 @@ static struct wlr_xcursor *xcursor_create_from_data(
 
 	cursor->name = strdup(metadata->name);
 	cursor->total_delay = 0;
+	cursor->shared_images = NULL;
 
 	image = malloc(sizeof(*image));
 	if (!image) {
@@ -126,11 +132,15 @@ static void load_default_theme(struct wlr_xcursor_theme *theme) {
 	theme->cursor_count = i;
 }
 
+/**
+ * Takes a reference to the images, the cursor's image buffers point directly
+ * to their pixels.
+ */
 static struct wlr_xcursor *xcursor_create_from_xcursor_images(
-		XcursorImages *images, struct wlr_xcursor_theme *theme) {
+		XcursorImages *images, const char *name) {
 	struct wlr_xcursor *cursor;
 	struct wlr_xcursor_image *image;
-	int i, size;
+	int i;
 
 	cursor = malloc(sizeof(*cursor));
 	if (!cursor) {
@@ -143,7 +153,12 @@ static struct wlr_xcursor *xcursor_create_from_xcursor_images(
 		return NULL;
 	}
 
-	cursor->name = strdup(images->name);
+	cursor->name = strdup(name);
+	if (!cursor->name) {
+		free(cursor->images);
+		free(cursor);
+		return NULL;
+	}
 	cursor->total_delay = 0;
 
 	for (i = 0; i < images->nimage; i++) {
@@ -152,23 +167,13 @@ static struct wlr_xcursor *xcursor_create_from_xcursor_images(
 			break;
 		}
 
-		image->buffer = NULL;
-
 		image->width = images->images[i]->width;
 		image->height = images->images[i]->height;
 		image->hotspot_x = images->images[i]->xhot;
 		image->hotspot_y = images->images[i]->yhot;
 		image->delay = images->images[i]->delay;
+		image->buffer = (uint8_t *)images->images[i]->pixels;
 
-		size = image->width * image->height * 4;
-		image->buffer = malloc(size);
-		if (!image->buffer) {
-			free(image);
-			break;
-		}
-
-		/* copy pixels to shm pool */
-		memcpy(image->buffer, images->images[i]->pixels, size);
 		cursor->total_delay += image->delay;
 		cursor->images[i] = image;
 	}
@@ -181,37 +186,112 @@ static struct wlr_xcursor *xcursor_create_from_xcursor_images(
 		return NULL;
 	}
 
+	images->refcount++;
+	cursor->shared_images = images;
 	return cursor;
 }
 
-static void load_callback(XcursorImages *images, void *data) {
-	struct wlr_xcursor_theme *theme = data;
-	struct wlr_xcursor *cursor;
+#define NO_ENTRY UINT_MAX
+#define MIN_ENTRY_BUCKETS 64
 
-	if (wlr_xcursor_theme_get_cursor(theme, images->name)) {
-		XcursorImagesDestroy(images);
-		return;
-	}
+struct wlr_xcursor_theme_entry {
+	char *name;
+	char *path; // NULL for built-in cursors
+	bool tried; // the file has already been decoded, or failed to
+	struct wlr_xcursor *cursor; // NULL until decoded
+	unsigned int next; // next entry in the same bucket, or NO_ENTRY
+};
 
-	cursor = xcursor_create_from_xcursor_images(images, theme);
+struct theme_index {
+	struct wlr_xcursor_theme *theme;
+	size_t capacity;
+};
+
+static uint32_t hash_name(const char *name) {
+	// FNV-1a
+	uint32_t hash = 0x811c9dc5;
+	for (const unsigned char *c = (const unsigned char *)name; *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
 
-	if (cursor) {
-		struct wlr_xcursor **cursors;
-		theme->cursor_count++;
-		cursors =
-			realloc(theme->cursors,
-				theme->cursor_count * sizeof(theme->cursors[0]));
+static bool theme_add_entry(struct theme_index *index, const char *name,
+		const char *path) {
+	struct wlr_xcursor_theme *theme = index->theme;
 
-		if (cursors == NULL) {
-			theme->cursor_count--;
-			free(cursor);
-		} else {
-			theme->cursors = cursors;
-			theme->cursors[theme->cursor_count - 1] = cursor;
+	if (theme->entry_count == index->capacity) {
+		size_t capacity = index->capacity == 0 ? 64 : index->capacity * 2;
+		struct wlr_xcursor_theme_entry *entries =
+			realloc(theme->entries, capacity * sizeof(*entries));
+		if (entries == NULL) {
+			return false;
 		}
+		theme->entries = entries;
+		index->capacity = capacity;
+	}
+
+	struct wlr_xcursor_theme_entry *entry =
+		&theme->entries[theme->entry_count];
+	entry->name = strdup(name);
+	entry->path = path != NULL ? strdup(path) : NULL;
+	entry->tried = path == NULL;
+	entry->cursor = NULL;
+	entry->next = NO_ENTRY;
+	if (entry->name == NULL || (path != NULL && entry->path == NULL)) {
+		free(entry->name);
+		free(entry->path);
+		return false;
+	}
+	theme->entry_count++;
+	return true;
+}
+
+static void index_callback(const char *name, const char *path, void *data) {
+	theme_add_entry(data, name, path);
+}
+
+/**
+ * Hash the entries by name. Each bucket lists its entries in lookup order, so
+ * that inherited themes come after the themes inheriting from them.
+ */
+static void theme_build_buckets(struct wlr_xcursor_theme *theme) {
+	unsigned int len = MIN_ENTRY_BUCKETS;
+	while (len < theme->entry_count) {
+		len *= 2;
 	}
 
-	XcursorImagesDestroy(images);
+	theme->entry_buckets = malloc(len * sizeof(theme->entry_buckets[0]));
+	if (theme->entry_buckets == NULL) {
+		// Lookups fall back to scanning the entries
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	theme->entry_buckets_len = len;
+	for (unsigned int i = 0; i < len; i++) {
+		theme->entry_buckets[i] = NO_ENTRY;
+	}
+
+	for (unsigned int i = theme->entry_count; i-- > 0;) {
+		struct wlr_xcursor_theme_entry *entry = &theme->entries[i];
+		unsigned int *bucket =
+			&theme->entry_buckets[hash_name(entry->name) & (len - 1)];
+		entry->next = *bucket;
+		*bucket = i;
+	}
+}
+
+static bool theme_add_cursor(struct wlr_xcursor_theme *theme,
+		struct wlr_xcursor *cursor) {
+	struct wlr_xcursor **cursors = realloc(theme->cursors,
+		(theme->cursor_count + 1) * sizeof(theme->cursors[0]));
+	if (cursors == NULL) {
+		return false;
+	}
+	theme->cursors = cursors;
+	theme->cursors[theme->cursor_count++] = cursor;
+	return true;
 }
 
 struct wlr_xcursor_theme *wlr_xcursor_theme_load(const char *name, int size) {
@@ -233,15 +313,29 @@ struct wlr_xcursor_theme *wlr_xcursor_theme_load(const char *name, int size) {
 	theme->size = size;
 	theme->cursor_count = 0;
 	theme->cursors = NULL;
+	theme->entry_count = 0;
+	theme->entries = NULL;
+	theme->entry_buckets_len = 0;
+	theme->entry_buckets = NULL;
 
-	xcursor_load_theme(name, size, load_callback, theme);
+	// Only list the cursor files, they're decoded on first use
+	struct theme_index index = { .theme = theme };
+	xcursor_index_theme(name, index_callback, &index);
 
-	if (theme->cursor_count == 0) {
+	if (theme->entry_count == 0) {
 		load_default_theme(theme);
+		for (unsigned int i = 0; i < theme->cursor_count; i++) {
+			if (!theme_add_entry(&index, theme->cursors[i]->name, NULL)) {
+				break;
+			}
+			theme->entries[i].cursor = theme->cursors[i];
+		}
 	}
 
-	wlr_log(WLR_DEBUG, "Loaded cursor theme '%s' at size %d (%d available cursors)",
-			theme->name, size, theme->cursor_count);
+	theme_build_buckets(theme);
+
+	wlr_log(WLR_DEBUG, "Loaded cursor theme '%s' at size %d (%u available cursors)",
+			theme->name, size, theme->entry_count);
 
 	return theme;
 
@@ -256,26 +350,74 @@ void wlr_xcursor_theme_destroy(struct wlr_xcursor_theme *theme) {
 	for (i = 0; i < theme->cursor_count; i++) {
 		xcursor_destroy(theme->cursors[i]);
 	}
+	for (i = 0; i < theme->entry_count; i++) {
+		free(theme->entries[i].name);
+		free(theme->entries[i].path);
+	}
 
 	free(theme->name);
 	free(theme->cursors);
+	free(theme->entries);
+	free(theme->entry_buckets);
 	free(theme);
 }
 
+static unsigned int theme_next_entry(struct wlr_xcursor_theme *theme,
+		unsigned int i) {
+	if (theme->entry_buckets == NULL) {
+		return i + 1 < theme->entry_count ? i + 1 : NO_ENTRY;
+	}
+	return theme->entries[i].next;
+}
+
 struct wlr_xcursor *wlr_xcursor_theme_get_cursor(struct wlr_xcursor_theme *theme,
 		const char *name) {
 	unsigned int i;
+	if (theme->entry_buckets != NULL) {
+		i = theme->entry_buckets[
+			hash_name(name) & (theme->entry_buckets_len - 1)];
+	} else {
+		i = theme->entry_count > 0 ? 0 : NO_ENTRY;
+	}
 
-	for (i = 0; i < theme->cursor_count; i++) {
-		if (strcmp(name, theme->cursors[i]->name) == 0) {
-			return theme->cursors[i];
+	// Use the first file providing this cursor, an inherited theme may
+	// provide it if it fails to decode
+	for (; i != NO_ENTRY; i = theme_next_entry(theme, i)) {
+		struct wlr_xcursor_theme_entry *entry = &theme->entries[i];
+		if (strcmp(name, entry->name) != 0) {
+			continue;
+		}
+		if (entry->cursor != NULL) {
+			return entry->cursor;
+		}
+		if (entry->tried) {
+			continue;
+		}
+		entry->tried = true;
+
+		XcursorImages *images =
+			xcursor_load_images(entry->path, entry->name, theme->size);
+		if (images == NULL) {
+			continue;
+		}
+		struct wlr_xcursor *cursor =
+			xcursor_create_from_xcursor_images(images, entry->name);
+		XcursorImagesDestroy(images);
+		if (cursor == NULL) {
+			continue;
+		}
+		if (!theme_add_cursor(theme, cursor)) {
+			xcursor_destroy(cursor);
+			return NULL;
 		}
+		entry->cursor = cursor;
+		return cursor;
 	}
 
 	return NULL;
 }
 
-static int xcursor_frame_and_duration(struct wlr_xcursor *cursor,
+int wlr_xcursor_frame_and_duration(struct wlr_xcursor *cursor,
 		uint32_t time, uint32_t *duration) {
 	uint32_t t;
 	int i;
@@ -318,7 +460,7 @@ static int xcursor_frame_and_duration(struct wlr_xcursor *cursor,
 }
 
 int wlr_xcursor_frame(struct wlr_xcursor *_cursor, uint32_t time) {
-	return xcursor_frame_and_duration(_cursor, time, NULL);
+	return wlr_xcursor_frame_and_duration(_cursor, time, NULL);
 }
 
 const char *wlr_xcursor_get_resize_name(enum wlr_edges edges) {
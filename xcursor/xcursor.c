@@ -25,9 +25,13 @@
 
 #define _DEFAULT_SOURCE
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "xcursor/xcursor.h"
 
 /*
@@ -239,17 +243,34 @@ XcursorImagesCreate (int size)
     images->nimage = 0;
     images->images = (XcursorImage **) (images + 1);
     images->name = NULL;
+    images->refcount = 1;
+    images->next = NULL;
     return images;
 }
 
+/* Images loaded by xcursor_load_images and still referenced */
+static XcursorImages *loaded_images;
+
 void
 XcursorImagesDestroy (XcursorImages *images)
 {
-    int	n;
+    XcursorImages   **prev;
+    int		    n;
 
     if (!images)
         return;
 
+    if (--images->refcount > 0)
+	return;
+    for (prev = &loaded_images; *prev; prev = &(*prev)->next)
+    {
+	if (*prev == images)
+	{
+	    *prev = images->next;
+	    break;
+	}
+    }
+
     for (n = 0; n < images->nimage; n++)
 	XcursorImageDestroy (images->images[n]);
     if (images->name)
@@ -471,6 +492,10 @@ _XcursorReadImage (XcursorFile		*file,
     XcursorImage	head;
     XcursorImage	*image;
     int			n;
+    XcursorDim		y;
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    XcursorDim		x;
+#endif
     XcursorPixel	*p;
 
     if (!file || !fileHeader)
@@ -507,47 +532,43 @@ _XcursorReadImage (XcursorFile		*file,
     image->xhot = head.xhot;
     image->yhot = head.yhot;
     image->delay = head.delay;
-    n = image->width * image->height;
-    p = image->pixels;
-    while (n--)
+    /* Read whole rows, pixels are stored little-endian */
+    n = image->width * sizeof (XcursorPixel);
+    for (y = 0; y < image->height; y++)
     {
-	if (!_XcursorReadUInt (file, p))
+	p = image->pixels + y * image->width;
+	if ((*file->read) (file, (unsigned char *) p, n) != n)
 	{
 	    XcursorImageDestroy (image);
 	    return NULL;
 	}
-	p++;
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+	for (x = 0; x < image->width; x++)
+	{
+	    unsigned char *bytes = (unsigned char *) &p[x];
+	    p[x] = ((XcursorPixel)(bytes[0]) << 0) |
+		   ((XcursorPixel)(bytes[1]) << 8) |
+		   ((XcursorPixel)(bytes[2]) << 16) |
+		   ((XcursorPixel)(bytes[3]) << 24);
+	}
+#endif
     }
     return image;
 }
 
 static XcursorImages *
-XcursorXcFileLoadImages (XcursorFile *file, int size)
+XcursorXcFileLoadImages (XcursorFile		*file,
+			 XcursorFileHeader	*fileHeader,
+			 XcursorDim		bestSize,
+			 int			nsize)
 {
-    XcursorFileHeader	*fileHeader;
-    XcursorDim		bestSize;
-    int			nsize;
     XcursorImages	*images;
     int			n;
     int			toc;
 
-    if (!file || size < 0)
-	return NULL;
-    fileHeader = _XcursorReadFileHeader (file);
-    if (!fileHeader)
-	return NULL;
-    bestSize = _XcursorFindBestSize (fileHeader, (XcursorDim) size, &nsize);
-    if (!bestSize)
-    {
-        _XcursorFileHeaderDestroy (fileHeader);
-	return NULL;
-    }
     images = XcursorImagesCreate (nsize);
     if (!images)
-    {
-        _XcursorFileHeaderDestroy (fileHeader);
 	return NULL;
-    }
     for (n = 0; n < nsize; n++)
     {
 	toc = _XcursorFindImageToc (fileHeader, bestSize, n);
@@ -559,7 +580,6 @@ XcursorXcFileLoadImages (XcursorFile *file, int size)
 	    break;
 	images->nimage++;
     }
-    _XcursorFileHeaderDestroy (fileHeader);
     if (images->nimage != nsize)
     {
 	XcursorImagesDestroy (images);
@@ -568,46 +588,70 @@ XcursorXcFileLoadImages (XcursorFile *file, int size)
     return images;
 }
 
+/*
+ * Cursor files are parsed straight from a read-only mapping of the file
+ */
+
+typedef struct _XcursorMemoryFile {
+    const unsigned char	*data;
+    size_t		size;
+    size_t		pos;
+} XcursorMemoryFile;
+
 static int
-_XcursorStdioFileRead (XcursorFile *file, unsigned char *buf, int len)
+_XcursorMemoryFileRead (XcursorFile *file, unsigned char *buf, int len)
 {
-    FILE    *f = file->closure;
-    return fread (buf, 1, len, f);
+    XcursorMemoryFile	*m = file->closure;
+    size_t		n;
+
+    if (len < 0 || m->pos >= m->size)
+	return 0;
+    n = m->size - m->pos;
+    if ((size_t) len < n)
+	n = len;
+    memcpy (buf, m->data + m->pos, n);
+    m->pos += n;
+    return n;
 }
 
 static int
-_XcursorStdioFileWrite (XcursorFile *file, unsigned char *buf, int len)
+_XcursorMemoryFileWrite (XcursorFile *file, unsigned char *buf, int len)
 {
-    FILE    *f = file->closure;
-    return fwrite (buf, 1, len, f);
+    return -1;
 }
 
 static int
-_XcursorStdioFileSeek (XcursorFile *file, long offset, int whence)
+_XcursorMemoryFileSeek (XcursorFile *file, long offset, int whence)
 {
-    FILE    *f = file->closure;
-    return fseek (f, offset, whence);
+    XcursorMemoryFile	*m = file->closure;
+    long		pos;
+
+    switch (whence) {
+    case SEEK_SET:
+	pos = offset;
+	break;
+    case SEEK_CUR:
+	pos = (long) m->pos + offset;
+	break;
+    case SEEK_END:
+	pos = (long) m->size + offset;
+	break;
+    default:
+	return EOF;
+    }
+    if (pos < 0)
+	return EOF;
+    m->pos = pos;
+    return 0;
 }
 
 static void
-_XcursorStdioFileInitialize (FILE *stdfile, XcursorFile *file)
-{
-    file->closure = stdfile;
-    file->read = _XcursorStdioFileRead;
-    file->write = _XcursorStdioFileWrite;
-    file->seek = _XcursorStdioFileSeek;
-}
-
-static XcursorImages *
-XcursorFileLoadImages (FILE *file, int size)
+_XcursorMemoryFileInitialize (XcursorMemoryFile *m, XcursorFile *file)
 {
-    XcursorFile	f;
-
-    if (!file)
-        return NULL;
-
-    _XcursorStdioFileInitialize (file, &f);
-    return XcursorXcFileLoadImages (&f, size);
+    file->closure = m;
+    file->read = _XcursorMemoryFileRead;
+    file->write = _XcursorMemoryFileWrite;
+    file->seek = _XcursorMemoryFileSeek;
 }
 
 /*
@@ -821,15 +865,13 @@ _XcursorThemeInherits (const char *full)
 }
 
 static void
-load_all_cursors_from_dir(const char *path, int size,
-			  void (*load_callback)(XcursorImages *, void *),
-			  void *user_data)
+index_all_cursors_from_dir(const char *path,
+			   void (*index_callback)(const char *, const char *, void *),
+			   void *user_data)
 {
-	FILE *f;
 	DIR *dir = opendir(path);
 	struct dirent *ent;
 	char *full;
-	XcursorImages *images;
 
 	if (!dir)
 		return;
@@ -840,53 +882,37 @@ load_all_cursors_from_dir(const char *path, int size,
 		    (ent->d_type != DT_REG && ent->d_type != DT_LNK))
 			continue;
 #endif
+		if (ent->d_name[0] == '.')
+			continue;
 
 		full = _XcursorBuildFullname(path, "", ent->d_name);
 		if (!full)
 			continue;
 
-		f = fopen(full, "r");
-		if (!f) {
-			free(full);
-			continue;
-		}
-
-		images = XcursorFileLoadImages(f, size);
-
-		if (images) {
-			XcursorImagesSetName(images, ent->d_name);
-			load_callback(images, user_data);
-		}
-
-		fclose (f);
+		index_callback(ent->d_name, full, user_data);
 		free(full);
 	}
 
 	closedir(dir);
 }
 
-/** Load all the cursor of a theme
+/** List all the cursors of a theme
  *
- * This function loads all the cursor images of a given theme and its
- * inherited themes. Each cursor is loaded into an XcursorImages object
- * which is passed to the caller's load callback. If a cursor appears
- * more than once across all the inherited themes, the load callback
- * will be called multiple times, with possibly different XcursorImages
- * object which have the same name. The user is expected to destroy the
- * XcursorImages objects passed to the callback with
- * XcursorImagesDestroy().
+ * This function lists the cursor files of a given theme and its inherited
+ * themes, without opening them. The index callback is called with the name
+ * of each cursor and the path of its file, in lookup order: if a cursor
+ * appears more than once across all the inherited themes, the first file
+ * takes precedence. The images can then be loaded with
+ * xcursor_load_images().
  *
- * \param theme The name of theme that should be loaded
- * \param size The desired size of the cursor images
- * \param load_callback A callback function that will be called
- * for each cursor loaded. The first parameter is the XcursorImages
- * object representing the loaded cursor and the second is a pointer
- * to data provided by the user.
- * \param user_data The data that should be passed to the load callback
+ * \param theme The name of theme that should be indexed
+ * \param index_callback A callback function that will be called
+ * for each cursor file. The strings are only valid during the call.
+ * \param user_data The data that should be passed to the index callback
  */
 void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
+xcursor_index_theme(const char *theme,
+		    void (*index_callback)(const char *, const char *, void *),
 		    void *user_data)
 {
 	char *full, *dir;
@@ -905,8 +931,8 @@ xcursor_load_theme(const char *theme, int size,
 		full = _XcursorBuildFullname(dir, "cursors", "");
 
 		if (full) {
-			load_all_cursors_from_dir(full, size, load_callback,
-						  user_data);
+			index_all_cursors_from_dir(full, index_callback,
+						   user_data);
 			free(full);
 		}
 
@@ -922,9 +948,93 @@ xcursor_load_theme(const char *theme, int size,
 	}
 
 	for (i = inherits; i; i = _XcursorNextPath(i))
-		xcursor_load_theme(i, size, load_callback, user_data);
+		xcursor_index_theme(i, index_callback, user_data);
 
 	if (inherits)
 		free(inherits);
 	free(xcursor_path);
 }
+
+/** Load the images of a cursor file
+ *
+ * \param path The path of the cursor file
+ * \param name The name to give to the cursor
+ * \param size The desired size of the cursor images
+ * \return The images, to be destroyed with XcursorImagesDestroy(), or NULL
+ * if the file doesn't contain a valid cursor
+ *
+ * The images are shared with the other loads of the same file picking the
+ * same size, they must not be modified. Their name is the one given to the
+ * first load.
+ */
+XcursorImages *
+xcursor_load_images(const char *path, const char *name, int size)
+{
+	XcursorMemoryFile m;
+	XcursorFile f;
+	XcursorFileHeader *fileHeader;
+	XcursorImages *images = NULL;
+	XcursorDim bestSize;
+	struct stat st;
+	void *data;
+	int nsize;
+	int fd;
+
+	if (size < 0)
+		return NULL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	m.data = data;
+	m.size = st.st_size;
+	m.pos = 0;
+	_XcursorMemoryFileInitialize(&m, &f);
+
+	fileHeader = _XcursorReadFileHeader(&f);
+	if (!fileHeader)
+		goto out;
+	bestSize = _XcursorFindBestSize(fileHeader, (XcursorDim) size, &nsize);
+	if (!bestSize)
+		goto out_header;
+
+	/* Themes loaded at different sizes often pick the same images, and
+	 * many cursor names are symlinks to the same file */
+	for (images = loaded_images; images; images = images->next) {
+		if (images->dev == st.st_dev && images->ino == st.st_ino &&
+				images->file_size == st.st_size &&
+				images->mtime.tv_sec == st.st_mtim.tv_sec &&
+				images->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+				images->size == bestSize) {
+			images->refcount++;
+			goto out_header;
+		}
+	}
+
+	images = XcursorXcFileLoadImages(&f, fileHeader, bestSize, nsize);
+	if (images) {
+		XcursorImagesSetName(images, name);
+		images->dev = st.st_dev;
+		images->ino = st.st_ino;
+		images->file_size = st.st_size;
+		images->mtime = st.st_mtim;
+		images->size = bestSize;
+		images->next = loaded_images;
+		loaded_images = images;
+	}
+
+out_header:
+	_XcursorFileHeaderDestroy(fileHeader);
+out:
+	munmap(data, st.st_size);
+	return images;
+}
@@ -66,10 +66,13 @@ static bool xwm_selection_transfer_get_incoming_selection_property(
 		transfer->incoming_window,
 		xwm->atoms[WL_SELECTION],
 		XCB_GET_PROPERTY_TYPE_ANY,
-		0, // offset
-		0x1fffffff // length
+		transfer->property_offset,
+		transfer->selection->chunk_size / 4 // length
 	);
 
+	// Large properties are read one chunk at a time, so that at most a chunk
+	// is buffered while the Wayland client is slow to consume it. The X server
+	// only deletes the property along with its last chunk.
 	transfer->property_start = 0;
 	transfer->property_reply =
 		xcb_get_property_reply(xwm->xcb_conn, cookie, NULL);
@@ -79,6 +82,8 @@ static bool xwm_selection_transfer_get_incoming_selection_property(
 		return false;
 	}
 
+	transfer->property_offset +=
+		xcb_get_property_value_length(transfer->property_reply) / 4;
 	return true;
 }
 
@@ -94,6 +99,7 @@ static void xwm_notify_ready_for_next_incr_chunk(
 
 	xwm_selection_transfer_remove_event_source(transfer);
 	xwm_selection_transfer_destroy_property_reply(transfer);
+	transfer->property_offset = 0;
 }
 
 /**
@@ -123,6 +129,16 @@ static int write_selection_property_to_wl_client(int fd, uint32_t mask,
 	if (len < remainder) {
 		transfer->property_start += len;
 		return 1;
+	} else if (transfer->property_reply->bytes_after > 0) {
+		// Wait for the client to become writable again before reading the
+		// next chunk of the property
+		xwm_selection_transfer_destroy_property_reply(transfer);
+		if (!xwm_selection_transfer_get_incoming_selection_property(transfer,
+				!transfer->incr)) {
+			xwm_selection_transfer_destroy(transfer);
+			return 0;
+		}
+		return 1;
 	} else if (transfer->incr) {
 		xwm_notify_ready_for_next_incr_chunk(transfer);
 	} else {
@@ -346,6 +362,7 @@ static bool source_get_targets(struct wlr_xwm_selection *selection,
 	}
 
 	xcb_atom_t *value = xcb_get_property_value(reply);
+	xwm_cache_atom_names(xwm, value, reply->value_len);
 	for (uint32_t i = 0; i < reply->value_len; i++) {
 		char *mime_type = NULL;
 
@@ -355,25 +372,15 @@ static bool source_get_targets(struct wlr_xwm_selection *selection,
 			mime_type = strdup("text/plain");
 		} else if (value[i] != xwm->atoms[TARGETS] &&
 				value[i] != xwm->atoms[TIMESTAMP]) {
-			xcb_get_atom_name_cookie_t name_cookie =
-				xcb_get_atom_name(xwm->xcb_conn, value[i]);
-			xcb_get_atom_name_reply_t *name_reply =
-				xcb_get_atom_name_reply(xwm->xcb_conn, name_cookie, NULL);
-			if (name_reply == NULL) {
+			char *name = xwm_get_atom_name(xwm, value[i]);
+			if (name == NULL) {
 				continue;
 			}
-			size_t len = xcb_get_atom_name_name_length(name_reply);
-			char *name = xcb_get_atom_name_name(name_reply); // not a C string
-			if (memchr(name, '/', len) != NULL) {
-				mime_type = malloc((len + 1) * sizeof(char));
-				if (mime_type == NULL) {
-					free(name_reply);
-					continue;
-				}
-				memcpy(mime_type, name, len);
-				mime_type[len] = '\0';
+			if (strchr(name, '/') != NULL) {
+				mime_type = name;
+			} else {
+				free(name);
 			}
-			free(name_reply);
 		}
 
 		if (mime_type != NULL) {
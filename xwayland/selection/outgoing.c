@@ -70,10 +70,11 @@ static int xwm_data_source_read(int fd, uint32_t mask, void *data) {
 	struct wlr_xwm_selection_transfer *transfer = data;
 	struct wlr_xwm *xwm = transfer->selection->xwm;
 
+	size_t chunk_size = transfer->selection->chunk_size;
 	void *p;
 	size_t current = transfer->source_data.size;
-	if (transfer->source_data.size < INCR_CHUNK_SIZE) {
-		p = wl_array_add(&transfer->source_data, INCR_CHUNK_SIZE);
+	if (transfer->source_data.size < chunk_size) {
+		p = wl_array_add(&transfer->source_data, chunk_size);
 		if (p == NULL) {
 			wlr_log(WLR_ERROR, "Could not allocate selection source_data");
 			goto error_out;
@@ -93,12 +94,12 @@ static int xwm_data_source_read(int fd, uint32_t mask, void *data) {
 		available, mask);
 
 	transfer->source_data.size = current + len;
-	if (transfer->source_data.size >= INCR_CHUNK_SIZE) {
+	if (transfer->source_data.size >= chunk_size) {
 		if (!transfer->incr) {
 			wlr_log(WLR_DEBUG, "got %zu bytes, starting incr",
 				transfer->source_data.size);
 
-			size_t incr_chunk_size = INCR_CHUNK_SIZE;
+			uint32_t incr_chunk_size = chunk_size;
 			xcb_change_property(xwm->xcb_conn,
 				XCB_PROP_MODE_REPLACE,
 				transfer->request.requestor,
@@ -173,6 +173,20 @@ int xwm_handle_selection_event(struct wlr_xwm *xwm,
 	return 0;
 }
 
+static size_t get_chunk_size(struct wlr_xwm *xwm) {
+	// Leave room for the ChangeProperty request header, the maximum request
+	// length is in 4-byte units
+	size_t max = (size_t)xcb_get_maximum_request_length(xwm->xcb_conn) * 4;
+	size_t header = sizeof(xcb_change_property_request_t);
+	size_t size = max > header ? max - header : 0;
+	if (size > MAX_INCR_CHUNK_SIZE) {
+		size = MAX_INCR_CHUNK_SIZE;
+	} else if (size < INCR_CHUNK_SIZE) {
+		size = INCR_CHUNK_SIZE;
+	}
+	return size & ~(size_t)3;
+}
+
 void xwm_selection_init(struct wlr_xwm_selection *selection,
 		struct wlr_xwm *xwm, xcb_atom_t atom) {
 	memset(selection, 0, sizeof(*selection));
@@ -182,6 +196,7 @@ void xwm_selection_init(struct wlr_xwm_selection *selection,
 	selection->xwm = xwm;
 	selection->atom = atom;
 	selection->window = xcb_generate_id(xwm->xcb_conn);
+	selection->chunk_size = get_chunk_size(xwm);
 
 	if (atom == xwm->atoms[DND_SELECTION]) {
 		xcb_create_window(
@@ -395,9 +395,18 @@ static bool server_start(struct wlr_xwayland_server *server) {
 	return true;
 }
 
+static void server_finish_warm_timer(struct wlr_xwayland_server *server) {
+	if (server->warm_timer) {
+		wl_event_source_remove(server->warm_timer);
+		server->warm_timer = NULL;
+	}
+}
+
 static int xwayland_socket_connected(int fd, uint32_t mask, void *data) {
 	struct wlr_xwayland_server *server = data;
 
+	server_finish_warm_timer(server);
+
 	wl_event_source_remove(server->x_fd_read_event[0]);
 	wl_event_source_remove(server->x_fd_read_event[1]);
 	server->x_fd_read_event[0] = server->x_fd_read_event[1] = NULL;
@@ -407,6 +416,28 @@ static int xwayland_socket_connected(int fd, uint32_t mask, void *data) {
 	return 0;
 }
 
+static int handle_warm_timer(void *data) {
+	struct wlr_xwayland_server *server = data;
+
+	// Start Xwayland before the first client needs it, so that it doesn't
+	// have to wait for the server and the XWM to initialize
+	wlr_log(WLR_INFO, "Starting Xwayland ahead of clients (warm)");
+	xwayland_socket_connected(-1, 0, server);
+	return 0;
+}
+
+static bool server_start_warm_timer(struct wlr_xwayland_server *server) {
+	struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+	server->warm_timer = wl_event_loop_add_timer(loop, handle_warm_timer,
+		server);
+	if (server->warm_timer == NULL) {
+		return false;
+	}
+	wl_event_source_timer_update(server->warm_timer,
+		server->options.warm_delay * 1000);
+	return true;
+}
+
 static bool server_start_lazy(struct wlr_xwayland_server *server) {
 	struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
 
@@ -430,6 +461,7 @@ void wlr_xwayland_server_destroy(struct wlr_xwayland_server *server) {
 		return;
 	}
 
+	server_finish_warm_timer(server);
 	server_finish_process(server);
 	server_finish_display(server);
 	wlr_signal_emit_safe(&server->events.destroy, NULL);
@@ -472,6 +504,12 @@ struct wlr_xwayland_server *wlr_xwayland_server_create(
 		if (!server_start_lazy(server)) {
 			goto error_display;
 		}
+		// Only warm up the first start, a terminated server is restarted on
+		// demand
+		if (server->options.warm_delay > 0 &&
+				!server_start_warm_timer(server)) {
+			wlr_log(WLR_ERROR, "Failed to create Xwayland warm timer");
+		}
 	} else {
 		if (!server_start(server)) {
 			goto error_display;
@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -92,6 +93,18 @@ struct wlr_xwayland *wlr_xwayland_create(struct wl_display *wl_display,
 		.terminate_delay = lazy ? 10 : 0,
 #endif
 	};
+	const char *warm_delay = getenv("WLR_XWAYLAND_WARM_DELAY");
+	if (lazy && warm_delay != NULL) {
+		char *end;
+		long delay = strtol(warm_delay, &end, 10);
+		if (*warm_delay == '\0' || *end != '\0' || delay < 0 ||
+				delay > INT_MAX / 1000) {
+			wlr_log(WLR_ERROR, "Invalid WLR_XWAYLAND_WARM_DELAY value: %s",
+				warm_delay);
+		} else {
+			options.warm_delay = delay;
+		}
+	}
 	xwayland->server = wlr_xwayland_server_create(wl_display, &options);
 	if (xwayland->server == NULL) {
 		free(xwayland);
@@ -3,6 +3,7 @@
 #endif
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wlr/config.h>
 #include <wlr/types/wlr_compositor.h>
@@ -91,6 +92,18 @@ const char *const atom_map[ATOM_LAST] = {
 };
 
 #define STARTUP_INFO_REMOVE_PREFIX "remove: ID="
+
+typedef void (*xwm_reply_handler_t)(struct wlr_xwm *xwm,
+	struct wlr_xwayland_surface *xsurface, void *reply, uint32_t data);
+
+struct xwm_pending_reply {
+	struct wl_list link; // wlr_xwm.pending_replies
+	unsigned int sequence;
+	struct wlr_xwayland_surface *xsurface;
+	xwm_reply_handler_t handler;
+	uint32_t data;
+};
+
 struct pending_startup_id {
 	char *msg;
 	size_t len;
@@ -110,11 +123,84 @@ struct wlr_xwayland_surface *wlr_xwayland_surface_from_wlr_surface(
 	return (struct wlr_xwayland_surface *)surface->role_data;
 }
 
-// TODO: replace this with hash table?
+#define MIN_SURFACE_BUCKETS 64
+
+static size_t surface_bucket(struct wlr_xwm *xwm, xcb_window_t window_id) {
+	// Fibonacci hashing, IDs of a client only differ in their low bits
+	uint64_t hash = (uint64_t)window_id * 0x9E3779B97F4A7C15ull;
+	return (size_t)(hash >> 32) & (xwm->surface_buckets_len - 1);
+}
+
+static void xwm_resize_surface_buckets(struct wlr_xwm *xwm, size_t len) {
+	struct wl_list *buckets = calloc(len, sizeof(*buckets));
+	if (buckets == NULL) {
+		// Keep the current table, lookups just get slower
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	for (size_t i = 0; i < len; i++) {
+		wl_list_init(&buckets[i]);
+	}
+
+	free(xwm->surface_buckets);
+	xwm->surface_buckets = buckets;
+	xwm->surface_buckets_len = len;
+
+	struct wlr_xwayland_surface *surface;
+	wl_list_for_each(surface, &xwm->surfaces, link) {
+		wl_list_insert(&buckets[surface_bucket(xwm, surface->window_id)],
+			&surface->bucket_link);
+	}
+}
+
+static void xwm_add_surface(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *surface) {
+	wl_list_insert(&xwm->surfaces, &surface->link);
+	xwm->surfaces_len++;
+	wl_list_init(&surface->bucket_link);
+
+	size_t len = xwm->surface_buckets_len;
+	if (len == 0 || xwm->surfaces_len > len) {
+		xwm_resize_surface_buckets(xwm,
+			len == 0 ? MIN_SURFACE_BUCKETS : len * 2);
+	}
+
+	// The resize may have already inserted the new surface
+	if (xwm->surface_buckets_len > 0 && wl_list_empty(&surface->bucket_link)) {
+		wl_list_insert(
+			&xwm->surface_buckets[surface_bucket(xwm, surface->window_id)],
+			&surface->bucket_link);
+	}
+}
+
+static struct wl_list *unpaired_surface_bucket(struct wlr_xwm *xwm,
+		uint32_t surface_id) {
+	// Object IDs are allocated sequentially by the client
+	return &xwm->unpaired_surfaces[surface_id % XWM_UNPAIRED_SURFACE_BUCKETS];
+}
+
+static void xwm_remove_surface(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *surface) {
+	wl_list_remove(&surface->link);
+	wl_list_remove(&surface->bucket_link);
+	xwm->surfaces_len--;
+}
+
 static struct wlr_xwayland_surface *lookup_surface(struct wlr_xwm *xwm,
 		xcb_window_t window_id) {
 	struct wlr_xwayland_surface *surface;
-	wl_list_for_each(surface, &xwm->surfaces, link) {
+	if (xwm->surface_buckets_len == 0) {
+		wl_list_for_each(surface, &xwm->surfaces, link) {
+			if (surface->window_id == window_id) {
+				return surface;
+			}
+		}
+		return NULL;
+	}
+
+	struct wl_list *bucket =
+		&xwm->surface_buckets[surface_bucket(xwm, window_id)];
+	wl_list_for_each(surface, bucket, bucket_link) {
 		if (surface->window_id == window_id) {
 			return surface;
 		}
@@ -130,6 +216,68 @@ static int xwayland_surface_handle_ping_timeout(void *data) {
 	return 1;
 }
 
+static void xsurface_update_mapped(struct wlr_xwayland_surface *surface);
+
+static void xwm_add_pending_reply(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, unsigned int sequence,
+		xwm_reply_handler_t handler, uint32_t data) {
+	struct xwm_pending_reply *pending = calloc(1, sizeof(*pending));
+	if (pending == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		xcb_discard_reply(xwm->xcb_conn, sequence);
+		return;
+	}
+	pending->sequence = sequence;
+	pending->xsurface = xsurface;
+	pending->handler = handler;
+	pending->data = data;
+	wl_list_insert(xwm->pending_replies.prev, &pending->link);
+	xsurface->pending_replies++;
+}
+
+/**
+ * Handles the replies which have been received, in order. If sequence is
+ * non-NULL, stops at the first request sent after it: the replies to earlier
+ * requests are handled before an event, so that state is updated in the same
+ * order as on the X server. Never blocks.
+ */
+static void xwm_handle_pending_replies(struct wlr_xwm *xwm,
+		const uint32_t *sequence) {
+	while (!wl_list_empty(&xwm->pending_replies)) {
+		struct xwm_pending_reply *pending =
+			wl_container_of(xwm->pending_replies.next, pending, link);
+		if (sequence != NULL &&
+				(int32_t)(pending->sequence - *sequence) > 0) {
+			break;
+		}
+
+		void *reply = NULL;
+		xcb_generic_error_t *error = NULL;
+		if (!xcb_poll_for_reply(xwm->xcb_conn, pending->sequence,
+				&reply, &error)) {
+			break;
+		}
+		wl_list_remove(&pending->link);
+
+		struct wlr_xwayland_surface *xsurface = pending->xsurface;
+		xsurface->pending_replies--;
+		if (reply != NULL) {
+			pending->handler(xwm, xsurface, reply, pending->data);
+		}
+		xsurface_update_mapped(xsurface);
+
+		free(reply);
+		free(error);
+		free(pending);
+	}
+}
+
+static void read_surface_geometry(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, void *data, uint32_t unused) {
+	xcb_get_geometry_reply_t *reply = data;
+	xsurface->has_alpha = reply->depth == 32;
+}
+
 static struct wlr_xwayland_surface *xwayland_surface_create(
 		struct wlr_xwm *xwm, xcb_window_t window_id, int16_t x, int16_t y,
 		uint16_t width, uint16_t height, bool override_redirect) {
@@ -140,9 +288,6 @@ static struct wlr_xwayland_surface *xwayland_surface_create(
 		return NULL;
 	}
 
-	xcb_get_geometry_cookie_t geometry_cookie =
-		xcb_get_geometry(xwm->xcb_conn, window_id);
-
 	uint32_t values[1];
 	values[0] =
 		XCB_EVENT_MASK_FOCUS_CHANGE |
@@ -183,13 +328,6 @@ static struct wlr_xwayland_surface *xwayland_surface_create(
 	wl_signal_init(&surface->events.ping_timeout);
 	wl_signal_init(&surface->events.set_geometry);
 
-	xcb_get_geometry_reply_t *geometry_reply =
-		xcb_get_geometry_reply(xwm->xcb_conn, geometry_cookie, NULL);
-	if (geometry_reply != NULL) {
-		surface->has_alpha = geometry_reply->depth == 32;
-	}
-	free(geometry_reply);
-
 	struct wl_display *display = xwm->xwayland->wl_display;
 	struct wl_event_loop *loop = wl_display_get_event_loop(display);
 	surface->ping_timer = wl_event_loop_add_timer(loop,
@@ -200,7 +338,12 @@ static struct wlr_xwayland_surface *xwayland_surface_create(
 		return NULL;
 	}
 
-	wl_list_insert(&xwm->surfaces, &surface->link);
+	xwm_add_surface(xwm, surface);
+
+	xcb_get_geometry_cookie_t geometry_cookie =
+		xcb_get_geometry(xwm->xcb_conn, window_id);
+	xwm_add_pending_reply(xwm, surface, geometry_cookie.sequence,
+		read_surface_geometry, 0);
 
 	wlr_signal_emit_safe(&xwm->xwayland->events.new_surface, surface);
 
@@ -235,47 +378,13 @@ static void xwm_send_wm_message(struct wlr_xwayland_surface *surface,
 	xcb_flush(xwm->xcb_conn);
 }
 
-static void xwm_set_net_client_list(struct wlr_xwm *xwm) {
-	// FIXME: _NET_CLIENT_LIST is expected to be ordered by map time, but the
-	// order of surfaces in `xwm->surfaces` is by creation time. The order of
-	// windows _NET_CLIENT_LIST exposed by wlroots is wrong.
-
-	size_t mapped_surfaces = 0;
-	struct wlr_xwayland_surface *surface;
-	wl_list_for_each(surface, &xwm->surfaces, link) {
-		if (surface->mapped) {
-			mapped_surfaces++;
-		}
-	}
-
-	xcb_window_t *windows = malloc(sizeof(xcb_window_t) * mapped_surfaces);
-	if (!windows) {
-		return;
-	}
-
-	size_t index = 0;
-	wl_list_for_each(surface, &xwm->surfaces, link) {
-		if (surface->mapped) {
-			windows[index++] = surface->window_id;
-		}
-	}
-
-	xcb_change_property(xwm->xcb_conn, XCB_PROP_MODE_REPLACE,
-			xwm->screen->root, xwm->atoms[NET_CLIENT_LIST],
-			XCB_ATOM_WINDOW, 32, mapped_surfaces, windows);
-	free(windows);
-}
-
-static void xwm_set_net_client_list_stacking(struct wlr_xwm *xwm) {
+static void xwm_write_net_client_list_stacking(struct wlr_xwm *xwm) {
 	size_t num_surfaces = wl_list_length(&xwm->surfaces_in_stack_order);
 	xcb_window_t *windows = malloc(sizeof(xcb_window_t) * num_surfaces);
 	if (!windows) {
 		return;
 	}
 
-	// We store surfaces in top-to-bottom order because this is easier to reason
-	// about, but _NET_CLIENT_LIST_STACKING is supposed to be in bottom-to-top
-	// order, so iterate backwards through the list.
 	size_t i = 0;
 	struct wlr_xwayland_surface *xsurface;
 	wl_list_for_each(xsurface, &xwm->surfaces_in_stack_order, stack_link) {
@@ -288,6 +397,72 @@ static void xwm_set_net_client_list_stacking(struct wlr_xwm *xwm) {
 	free(windows);
 }
 
+static void handle_client_list_idle(void *data) {
+	struct wlr_xwm *xwm = data;
+	xwm->client_list_idle = NULL;
+
+	if (xwm->client_list_dirty) {
+		xcb_change_property(xwm->xcb_conn, XCB_PROP_MODE_REPLACE,
+				xwm->screen->root, xwm->atoms[NET_CLIENT_LIST],
+				XCB_ATOM_WINDOW, 32,
+				xwm->client_list.size / sizeof(xcb_window_t),
+				xwm->client_list.data);
+		xwm->client_list_dirty = false;
+	}
+	if (xwm->client_list_stacking_dirty) {
+		xwm_write_net_client_list_stacking(xwm);
+		xwm->client_list_stacking_dirty = false;
+	}
+	xcb_flush(xwm->xcb_conn);
+}
+
+static void xwm_schedule_client_list_update(struct wlr_xwm *xwm) {
+	if (xwm->client_list_idle != NULL) {
+		return;
+	}
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(xwm->xwayland->wl_display);
+	xwm->client_list_idle =
+		wl_event_loop_add_idle(loop, handle_client_list_idle, xwm);
+	if (xwm->client_list_idle == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add idle event source");
+		handle_client_list_idle(xwm);
+	}
+}
+
+static void xwm_add_net_client_list(struct wlr_xwm *xwm,
+		xcb_window_t window) {
+	xcb_window_t *entry = wl_array_add(&xwm->client_list, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	*entry = window;
+	xwm->client_list_dirty = true;
+	xwm_schedule_client_list_update(xwm);
+}
+
+static void xwm_remove_net_client_list(struct wlr_xwm *xwm,
+		xcb_window_t window) {
+	xcb_window_t *windows = xwm->client_list.data;
+	size_t len = xwm->client_list.size / sizeof(xcb_window_t);
+	for (size_t i = 0; i < len; i++) {
+		if (windows[i] == window) {
+			memmove(&windows[i], &windows[i + 1],
+				(len - i - 1) * sizeof(xcb_window_t));
+			xwm->client_list.size -= sizeof(xcb_window_t);
+			xwm->client_list_dirty = true;
+			xwm_schedule_client_list_update(xwm);
+			return;
+		}
+	}
+}
+
+static void xwm_set_net_client_list_stacking(struct wlr_xwm *xwm) {
+	xwm->client_list_stacking_dirty = true;
+	xwm_schedule_client_list_update(xwm);
+}
+
 static void xsurface_set_net_wm_state(struct wlr_xwayland_surface *xsurface);
 
 static void xwm_set_focus_window(struct wlr_xwm *xwm,
@@ -390,13 +565,25 @@ static void xwayland_surface_destroy(
 		struct wlr_xwayland_surface *xsurface) {
 	xsurface_unmap(xsurface);
 
+	struct xwm_pending_reply *pending, *tmp;
+	wl_list_for_each_safe(pending, tmp, &xsurface->xwm->pending_replies, link) {
+		if (pending->xsurface == xsurface) {
+			xcb_discard_reply(xsurface->xwm->xcb_conn, pending->sequence);
+			wl_list_remove(&pending->link);
+			free(pending);
+		}
+	}
+
 	wlr_signal_emit_safe(&xsurface->events.destroy, xsurface);
 
 	if (xsurface == xsurface->xwm->focus_surface) {
 		xwm_surface_activate(xsurface->xwm, NULL);
 	}
 
-	wl_list_remove(&xsurface->link);
+	xwm_remove_surface(xsurface->xwm, xsurface);
+	if (!wl_list_empty(&xsurface->stack_link)) {
+		xwm_set_net_client_list_stacking(xsurface->xwm);
+	}
 	wl_list_remove(&xsurface->stack_link);
 	wl_list_remove(&xsurface->parent_link);
 
@@ -576,19 +763,8 @@ static void read_surface_parent(struct wlr_xwm *xwm,
 }
 
 static void read_surface_client_id(struct wlr_xwm *xwm,
-		struct wlr_xwayland_surface *xsurface) {
-	xcb_res_client_id_spec_t spec = {
-		.client = xsurface->window_id,
-		.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID
-	};
-
-	xcb_res_query_client_ids_cookie_t cookie = xcb_res_query_client_ids(
-		xwm->xcb_conn, 1, &spec);
-	xcb_res_query_client_ids_reply_t *reply = xcb_res_query_client_ids_reply(
-		xwm->xcb_conn, cookie,  NULL);
-	if (reply == NULL) {
-		return;
-	}
+		struct wlr_xwayland_surface *xsurface, void *data, uint32_t unused) {
+	xcb_res_query_client_ids_reply_t *reply = data;
 
 	uint32_t *pid = NULL;
 	xcb_res_client_id_value_iterator_t iter =
@@ -602,12 +778,22 @@ static void read_surface_client_id(struct wlr_xwm *xwm,
 		xcb_res_client_id_value_next(&iter);
 	}
 	if (pid == NULL) {
-		free(reply);
 		return;
 	}
 	xsurface->pid = *pid;
 	wlr_signal_emit_safe(&xsurface->events.set_pid, xsurface);
-	free(reply);
+}
+
+static void request_surface_client_id(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface) {
+	xcb_res_client_id_spec_t spec = {
+		.client = xsurface->window_id,
+		.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID
+	};
+	xcb_res_query_client_ids_cookie_t cookie =
+		xcb_res_query_client_ids(xwm->xcb_conn, 1, &spec);
+	xwm_add_pending_reply(xwm, xsurface, cookie.sequence,
+		read_surface_client_id, 0);
 }
 
 static void read_surface_window_type(struct wlr_xwm *xwm,
@@ -768,31 +954,123 @@ static void read_surface_net_wm_state(struct wlr_xwm *xwm,
 	}
 }
 
-char *xwm_get_atom_name(struct wlr_xwm *xwm, xcb_atom_t atom) {
-	xcb_get_atom_name_cookie_t name_cookie =
-		xcb_get_atom_name(xwm->xcb_conn, atom);
+// Bounds the memory used by clients interning lots of atoms
+#define MAX_CACHED_ATOM_NAMES 4096
+
+struct xwm_atom_name {
+	struct wl_list link; // wlr_xwm.atom_names
+	xcb_atom_t atom;
+	char *name;
+};
+
+static struct wl_list *atom_name_bucket(struct wlr_xwm *xwm,
+		xcb_atom_t atom) {
+	// Atoms are allocated sequentially by the server
+	return &xwm->atom_names[atom % ATOM_NAME_BUCKETS];
+}
+
+static struct xwm_atom_name *lookup_atom_name(struct wlr_xwm *xwm,
+		xcb_atom_t atom) {
+	struct xwm_atom_name *entry;
+	wl_list_for_each(entry, atom_name_bucket(xwm, atom), link) {
+		if (entry->atom == atom) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static const char *add_atom_name(struct wlr_xwm *xwm, xcb_atom_t atom,
+		const char *name, size_t len) {
+	struct xwm_atom_name *entry = lookup_atom_name(xwm, atom);
+	if (entry != NULL) {
+		return entry->name;
+	}
+	if (xwm->atom_names_len >= MAX_CACHED_ATOM_NAMES) {
+		return NULL;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		return NULL;
+	}
+	entry->atom = atom;
+	entry->name = strndup(name, len);
+	if (entry->name == NULL) {
+		free(entry);
+		return NULL;
+	}
+	wl_list_insert(atom_name_bucket(xwm, atom), &entry->link);
+	xwm->atom_names_len++;
+	return entry->name;
+}
+
+static char *read_atom_name_reply(struct wlr_xwm *xwm, xcb_atom_t atom,
+		xcb_get_atom_name_cookie_t cookie) {
 	xcb_get_atom_name_reply_t *name_reply =
-		xcb_get_atom_name_reply(xwm->xcb_conn, name_cookie, NULL);
+		xcb_get_atom_name_reply(xwm->xcb_conn, cookie, NULL);
 	if (name_reply == NULL) {
 		return NULL;
 	}
 	size_t len = xcb_get_atom_name_name_length(name_reply);
 	char *buf = xcb_get_atom_name_name(name_reply); // not a C string
-	char *name = strndup(buf, len);
+	char *name = NULL;
+	const char *cached = add_atom_name(xwm, atom, buf, len);
+	if (cached != NULL) {
+		name = strdup(cached);
+	} else {
+		name = strndup(buf, len);
+	}
 	free(name_reply);
 	return name;
 }
 
-static void read_surface_property(struct wlr_xwm *xwm,
-		struct wlr_xwayland_surface *xsurface, xcb_atom_t property) {
-	xcb_get_property_cookie_t cookie = xcb_get_property(xwm->xcb_conn, 0,
-		xsurface->window_id, property, XCB_ATOM_ANY, 0, 2048);
-	xcb_get_property_reply_t *reply = xcb_get_property_reply(xwm->xcb_conn,
-		cookie, NULL);
-	if (reply == NULL) {
+void xwm_cache_atom_names(struct wlr_xwm *xwm, const xcb_atom_t *atoms,
+		size_t atoms_len) {
+	xcb_get_atom_name_cookie_t *cookies =
+		calloc(atoms_len, sizeof(*cookies));
+	if (cookies == NULL) {
 		return;
 	}
 
+	for (size_t i = 0; i < atoms_len; i++) {
+		if (atoms[i] != XCB_ATOM_NONE &&
+				lookup_atom_name(xwm, atoms[i]) == NULL) {
+			cookies[i] = xcb_get_atom_name(xwm->xcb_conn, atoms[i]);
+		}
+	}
+	for (size_t i = 0; i < atoms_len; i++) {
+		if (cookies[i].sequence != 0) {
+			free(read_atom_name_reply(xwm, atoms[i], cookies[i]));
+		}
+	}
+
+	free(cookies);
+}
+
+char *xwm_get_atom_name(struct wlr_xwm *xwm, xcb_atom_t atom) {
+	struct xwm_atom_name *entry = lookup_atom_name(xwm, atom);
+	if (entry != NULL) {
+		return strdup(entry->name);
+	}
+
+	xcb_get_atom_name_cookie_t name_cookie =
+		xcb_get_atom_name(xwm->xcb_conn, atom);
+	return read_atom_name_reply(xwm, atom, name_cookie);
+}
+
+// Only looks up the name if it's going to be logged, since it may block
+static char *xwm_get_atom_name_for_log(struct wlr_xwm *xwm, xcb_atom_t atom) {
+	if (wlr_log_get_verbosity() < WLR_DEBUG) {
+		return NULL;
+	}
+	return xwm_get_atom_name(xwm, atom);
+}
+
+static void read_surface_property(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, void *data, uint32_t property) {
+	xcb_get_property_reply_t *reply = data;
+
 	if (property == XCB_ATOM_WM_CLASS) {
 		read_surface_class(xwm, xsurface, reply);
 	} else if (property == XCB_ATOM_WM_NAME ||
@@ -819,13 +1097,19 @@ static void read_surface_property(struct wlr_xwm *xwm,
 	} else if (property == xwm->atoms[NET_STARTUP_ID]) {
 		read_surface_startup_id(xwm, xsurface, reply);
 	} else {
-		char *prop_name = xwm_get_atom_name(xwm, property);
+		char *prop_name = xwm_get_atom_name_for_log(xwm, property);
 		wlr_log(WLR_DEBUG, "unhandled X11 property %" PRIu32 " (%s) for window %" PRIu32,
 			property, prop_name ? prop_name : "(null)", xsurface->window_id);
 		free(prop_name);
 	}
+}
 
-	free(reply);
+static void request_surface_property(struct wlr_xwm *xwm,
+		struct wlr_xwayland_surface *xsurface, xcb_atom_t property) {
+	xcb_get_property_cookie_t cookie = xcb_get_property(xwm->xcb_conn, 0,
+		xsurface->window_id, property, XCB_ATOM_ANY, 0, 2048);
+	xwm_add_pending_reply(xwm, xsurface, cookie.sequence,
+		read_surface_property, property);
 }
 
 static void xwayland_surface_role_commit(struct wlr_surface *wlr_surface) {
@@ -835,10 +1119,18 @@ static void xwayland_surface_role_commit(struct wlr_surface *wlr_surface) {
 		return;
 	}
 
-	if (!surface->mapped && wlr_surface_has_buffer(surface->surface)) {
+	xsurface_update_mapped(surface);
+}
+
+static void xsurface_update_mapped(struct wlr_xwayland_surface *surface) {
+	// Wait for the properties read when the surface got associated, so that
+	// they're known by map handlers
+	if (!surface->mapped && surface->surface != NULL &&
+			surface->pending_replies == 0 &&
+			wlr_surface_has_buffer(surface->surface)) {
 		wlr_signal_emit_safe(&surface->events.map, surface);
 		surface->mapped = true;
-		xwm_set_net_client_list(surface->xwm);
+		xwm_add_net_client_list(surface->xwm, surface->window_id);
 	}
 }
 
@@ -855,7 +1147,7 @@ static void xwayland_surface_role_precommit(struct wlr_surface *wlr_surface,
 		if (surface->mapped) {
 			wlr_signal_emit_safe(&surface->events.unmap, surface);
 			surface->mapped = false;
-			xwm_set_net_client_list(surface->xwm);
+			xwm_remove_net_client_list(surface->xwm, surface->window_id);
 		}
 	}
 }
@@ -896,11 +1188,11 @@ static void xwm_map_shell_surface(struct wlr_xwm *xwm,
 		xwm->atoms[NET_WM_WINDOW_TYPE],
 		xwm->atoms[NET_WM_NAME],
 	};
-	for (size_t i = 0; i < sizeof(props)/sizeof(xcb_atom_t); i++) {
-		read_surface_property(xwm, xsurface, props[i]);
+	for (size_t i = 0; i < sizeof(props) / sizeof(props[0]); i++) {
+		request_surface_property(xwm, xsurface, props[i]);
 	}
 	if (xwm->xres) {
-		read_surface_client_id(xwm, xsurface);
+		request_surface_client_id(xwm, xsurface);
 	}
 
 	xsurface->surface_destroy.notify = handle_surface_destroy;
@@ -911,7 +1203,7 @@ static void xsurface_unmap(struct wlr_xwayland_surface *surface) {
 	if (surface->mapped) {
 		wlr_signal_emit_safe(&surface->events.unmap, surface);
 		surface->mapped = false;
-		xwm_set_net_client_list(surface->xwm);
+		xwm_remove_net_client_list(surface->xwm, surface->window_id);
 	}
 
 	if (surface->surface_id) {
@@ -1108,7 +1400,7 @@ static void xwm_handle_property_notify(struct wlr_xwm *xwm,
 		return;
 	}
 
-	read_surface_property(xwm, xsurface, ev->atom);
+	request_surface_property(xwm, xsurface, ev->atom);
 }
 
 static void xwm_handle_surface_id_message(struct wlr_xwm *xwm,
@@ -1120,6 +1412,12 @@ static void xwm_handle_surface_id_message(struct wlr_xwm *xwm,
 			ev->window);
 		return;
 	}
+	if (xsurface->surface_id) {
+		// The ID changed before the previous surface was created
+		wl_list_remove(&xsurface->unpaired_link);
+		xsurface->surface_id = 0;
+	}
+
 	/* Check if we got notified after wayland surface create event */
 	uint32_t id = ev->data.data32[0];
 	struct wl_resource *resource =
@@ -1130,7 +1428,8 @@ static void xwm_handle_surface_id_message(struct wlr_xwm *xwm,
 		xwm_map_shell_surface(xwm, xsurface, surface);
 	} else {
 		xsurface->surface_id = id;
-		wl_list_insert(&xwm->unpaired_surfaces, &xsurface->unpaired_link);
+		wl_list_insert(unpaired_surface_bucket(xwm, id),
+			&xsurface->unpaired_link);
 	}
 }
 
@@ -1281,7 +1580,7 @@ static void xwm_handle_net_wm_state_message(struct wlr_xwm *xwm,
 		} else if (property == xwm->atoms[NET_WM_STATE_HIDDEN]) {
 			changed = update_state(action, &xsurface->minimized);
 		} else if (property != XCB_ATOM_NONE) {
-			char *prop_name = xwm_get_atom_name(xwm, property);
+			char *prop_name = xwm_get_atom_name_for_log(xwm, property);
 			wlr_log(WLR_DEBUG, "Unhandled NET_WM_STATE property change "
 				"%"PRIu32" (%s)", property, prop_name ? prop_name : "(null)");
 			free(prop_name);
@@ -1345,7 +1644,7 @@ static void xwm_handle_wm_protocols_message(struct wlr_xwm *xwm,
 		wl_event_source_timer_update(surface->ping_timer, 0);
 		surface->pinging = false;
 	} else {
-		char *type_name = xwm_get_atom_name(xwm, type);
+		char *type_name = xwm_get_atom_name_for_log(xwm, type);
 		wlr_log(WLR_DEBUG, "unhandled WM_PROTOCOLS client message %" PRIu32 " (%s)",
 			type, type_name ? type_name : "(null)");
 		free(type_name);
@@ -1472,7 +1771,7 @@ static void xwm_handle_client_message(struct wlr_xwm *xwm,
 	} else if (ev->type == xwm->atoms[WM_CHANGE_STATE]) {
 		xwm_handle_wm_change_state_message(xwm, ev);
 	} else if (!xwm_handle_selection_client_message(xwm, ev)) {
-		char *type_name = xwm_get_atom_name(xwm, ev->type);
+		char *type_name = xwm_get_atom_name_for_log(xwm, ev->type);
 		wlr_log(WLR_DEBUG, "unhandled x11 client message %" PRIu32 " (%s)", ev->type,
 			type_name ? type_name : "(null)");
 		free(type_name);
@@ -1589,6 +1888,8 @@ static int x11_event_handler(int fd, uint32_t mask, void *data) {
 	while ((event = xcb_poll_for_event(xwm->xcb_conn))) {
 		count++;
 
+		xwm_handle_pending_replies(xwm, &event->full_sequence);
+
 		if (xwm->xwayland->user_event_handler &&
 				xwm->xwayland->user_event_handler(xwm, event)) {
 			break;
@@ -1643,6 +1944,8 @@ static int x11_event_handler(int fd, uint32_t mask, void *data) {
 		free(event);
 	}
 
+	xwm_handle_pending_replies(xwm, NULL);
+
 	if (count) {
 		xcb_flush(xwm->xcb_conn);
 	}
@@ -1665,7 +1968,8 @@ static void handle_compositor_new_surface(struct wl_listener *listener,
 
 	uint32_t surface_id = wl_resource_get_id(surface->resource);
 	struct wlr_xwayland_surface *xsurface;
-	wl_list_for_each(xsurface, &xwm->unpaired_surfaces, unpaired_link) {
+	wl_list_for_each(xsurface, unpaired_surface_bucket(xwm, surface_id),
+			unpaired_link) {
 		if (xsurface->surface_id == surface_id) {
 			xwm_map_shell_surface(xwm, xsurface, surface);
 			xsurface->surface_id = 0;
@@ -1781,8 +2085,11 @@ void xwm_destroy(struct wlr_xwm *xwm) {
 	wl_list_for_each_safe(xsurface, tmp, &xwm->surfaces, link) {
 		xwayland_surface_destroy(xsurface);
 	}
-	wl_list_for_each_safe(xsurface, tmp, &xwm->unpaired_surfaces, unpaired_link) {
-		xwayland_surface_destroy(xsurface);
+	for (size_t i = 0; i < XWM_UNPAIRED_SURFACE_BUCKETS; i++) {
+		wl_list_for_each_safe(xsurface, tmp, &xwm->unpaired_surfaces[i],
+				unpaired_link) {
+			xwayland_surface_destroy(xsurface);
+		}
 	}
 	wl_list_remove(&xwm->compositor_new_surface.link);
 	wl_list_remove(&xwm->compositor_destroy.link);
@@ -1792,12 +2099,28 @@ void xwm_destroy(struct wlr_xwm *xwm) {
 	wl_list_for_each_safe(pending, next, &xwm->pending_startup_ids, link) {
 		pending_startup_id_destroy(pending);
 	}
+	assert(wl_list_empty(&xwm->pending_replies));
+	free(xwm->surface_buckets);
+	if (xwm->client_list_idle) {
+		wl_event_source_remove(xwm->client_list_idle);
+	}
+	wl_array_release(&xwm->client_list);
+	for (size_t i = 0; i < ATOM_NAME_BUCKETS; i++) {
+		struct xwm_atom_name *entry, *entry_tmp;
+		wl_list_for_each_safe(entry, entry_tmp, &xwm->atom_names[i], link) {
+			wl_list_remove(&entry->link);
+			free(entry->name);
+			free(entry);
+		}
+	}
 
 	xwm->xwayland->xwm = NULL;
 	free(xwm);
 }
 
 static void xwm_get_resources(struct wlr_xwm *xwm) {
+	// Send all requests before waiting for the first reply, so that startup
+	// only costs a couple of round-trips
 	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_xfixes_id);
 	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_composite_id);
 	xcb_prefetch_extension_data(xwm->xcb_conn, &xcb_res_id);
@@ -1809,8 +2132,27 @@ static void xwm_get_resources(struct wlr_xwm *xwm) {
 		cookies[i] =
 			xcb_intern_atom(xwm->xcb_conn, 0, strlen(atom_map[i]), atom_map[i]);
 	}
+
+	xwm->xfixes = xcb_get_extension_data(xwm->xcb_conn, &xcb_xfixes_id);
+	if (!xwm->xfixes || !xwm->xfixes->present) {
+		wlr_log(WLR_DEBUG, "xfixes not available");
+	}
+	const xcb_query_extension_reply_t *xres =
+		xcb_get_extension_data(xwm->xcb_conn, &xcb_res_id);
+	bool has_xres = xres && xres->present;
+
+	xcb_xfixes_query_version_cookie_t xfixes_cookie =
+		xcb_xfixes_query_version(xwm->xcb_conn, XCB_XFIXES_MAJOR_VERSION,
+			XCB_XFIXES_MINOR_VERSION);
+	xcb_res_query_version_cookie_t xres_cookie = {0};
+	if (has_xres) {
+		xres_cookie = xcb_res_query_version(xwm->xcb_conn,
+			XCB_RES_MAJOR_VERSION, XCB_RES_MINOR_VERSION);
+	}
+
+	bool atoms_ok = true;
 	for (i = 0; i < ATOM_LAST; i++) {
-		xcb_generic_error_t *error;
+		xcb_generic_error_t *error = NULL;
 		xcb_intern_atom_reply_t *reply =
 			xcb_intern_atom_reply(xwm->xcb_conn, cookies[i], &error);
 		if (reply && !error) {
@@ -1819,25 +2161,26 @@ static void xwm_get_resources(struct wlr_xwm *xwm) {
 		free(reply);
 
 		if (error) {
-			wlr_log(WLR_ERROR, "could not resolve atom %s, x11 error code %d",
-				atom_map[i], error->error_code);
+			if (atoms_ok) {
+				wlr_log(WLR_ERROR, "could not resolve atom %s, x11 error code %d",
+					atom_map[i], error->error_code);
+			}
 			free(error);
-			return;
+			atoms_ok = false;
 		}
 	}
-
-	xwm->xfixes = xcb_get_extension_data(xwm->xcb_conn, &xcb_xfixes_id);
-
-	if (!xwm->xfixes || !xwm->xfixes->present) {
-		wlr_log(WLR_DEBUG, "xfixes not available");
+	if (!atoms_ok) {
+		xcb_discard_reply(xwm->xcb_conn, xfixes_cookie.sequence);
+		if (has_xres) {
+			xcb_discard_reply(xwm->xcb_conn, xres_cookie.sequence);
+		}
+		return;
+	}
+	for (i = 0; i < ATOM_LAST; i++) {
+		add_atom_name(xwm, xwm->atoms[i], atom_map[i], strlen(atom_map[i]));
 	}
 
-	xcb_xfixes_query_version_cookie_t xfixes_cookie;
-	xcb_xfixes_query_version_reply_t *xfixes_reply;
-	xfixes_cookie =
-		xcb_xfixes_query_version(xwm->xcb_conn, XCB_XFIXES_MAJOR_VERSION,
-			XCB_XFIXES_MINOR_VERSION);
-	xfixes_reply =
+	xcb_xfixes_query_version_reply_t *xfixes_reply =
 		xcb_xfixes_query_version_reply(xwm->xcb_conn, xfixes_cookie, NULL);
 
 	wlr_log(WLR_DEBUG, "xfixes version: %" PRIu32 ".%" PRIu32,
@@ -1846,15 +2189,10 @@ static void xwm_get_resources(struct wlr_xwm *xwm) {
 
 	free(xfixes_reply);
 
-	const xcb_query_extension_reply_t *xres =
-		xcb_get_extension_data(xwm->xcb_conn, &xcb_res_id);
-	if (!xres || !xres->present) {
+	if (!has_xres) {
 		return;
 	}
 
-	xcb_res_query_version_cookie_t xres_cookie =
-		xcb_res_query_version(xwm->xcb_conn, XCB_RES_MAJOR_VERSION,
-			XCB_RES_MINOR_VERSION);
 	xcb_res_query_version_reply_t *xres_reply =
 		xcb_res_query_version_reply(xwm->xcb_conn, xres_cookie, NULL);
 	if (xres_reply == NULL) {
@@ -2033,8 +2371,15 @@ struct wlr_xwm *xwm_create(struct wlr_xwayland *xwayland, int wm_fd) {
 	xwm->xwayland = xwayland;
 	wl_list_init(&xwm->surfaces);
 	wl_list_init(&xwm->surfaces_in_stack_order);
-	wl_list_init(&xwm->unpaired_surfaces);
+	for (size_t i = 0; i < XWM_UNPAIRED_SURFACE_BUCKETS; i++) {
+		wl_list_init(&xwm->unpaired_surfaces[i]);
+	}
 	wl_list_init(&xwm->pending_startup_ids);
+	wl_list_init(&xwm->pending_replies);
+	wl_array_init(&xwm->client_list);
+	for (size_t i = 0; i < ATOM_NAME_BUCKETS; i++) {
+		wl_list_init(&xwm->atom_names[i]);
+	}
 	xwm->ping_timeout = 10000;
 
 	xwm->xcb_conn = xcb_connect_to_fd(wm_fd, NULL);